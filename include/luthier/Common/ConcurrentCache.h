@@ -0,0 +1,68 @@
+//===-- ConcurrentCache.h - Luthier Concurrent Cache Helpers ----*- C++ -*-===//
+// 并发缓存辅助函数头文件
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// 您可以在遵守许可证的情况下使用此文件
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Defines the locking discipline shared by the caches of Luthier's
+/// singletons, so that independent entries can be computed concurrently.
+/// 定义 Luthier 单例的缓存共用的加锁规则，使不同的条目可以被并发计算
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_COMMON_CONCURRENT_CACHE_H
+#define LUTHIER_COMMON_CONCURRENT_CACHE_H
+#include "luthier/Common/ErrorCheck.h"
+#include <llvm/Support/Error.h>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
+
+namespace luthier {
+
+/// \brief Returns the entry of a cache protected by \p Mutex, computing it
+/// on a miss
+/// \details \p Lookup is invoked under a shared lock of \p Mutex, so that
+/// cache hits can proceed concurrently. On a miss, the entry is computed by
+/// \p Compute without holding the lock, so that threads missing different
+/// entries do not serialize; The computed entry is then handed to \p Insert
+/// under an exclusive lock. If several threads miss the same entry, all of
+/// them compute it; \p Insert must keep the first entry inserted, discard
+/// the others, and return the kept entry
+/// \param Mutex the mutex protecting the cache
+/// \param Lookup returns a pointer to the cached entry, or \c nullptr on a
+/// miss
+/// \param Compute returns an \c llvm::Expected holding the computed entry
+/// \param Insert inserts the computed entry into the cache if no other thread
+/// did so first, and returns a reference to the entry in the cache
+/// \return a reference to the cached entry, or the \c llvm::Error returned
+/// by \p Compute; Nothing is inserted on error
+/// 返回由 \p Mutex 保护的缓存中的条目，未命中时计算该条目
+/// \p Lookup 在 \p Mutex 的共享锁下调用，因此缓存命中可以并发进行。未命中时，
+/// \p Compute 在不持有锁的情况下计算条目，因此未命中不同条目的线程不会串行化；
+/// 随后计算出的条目在排他锁下交给 \p Insert。如果多个线程未命中同一条目，它们都会
+/// 计算该条目；\p Insert 必须保留第一个插入的条目，丢弃其余条目，并返回保留的条目
+template <typename LookupFnT, typename ComputeFnT, typename InsertFnT>
+auto lookupOrCompute(std::shared_mutex &Mutex, LookupFnT &&Lookup,
+                     ComputeFnT &&Compute, InsertFnT &&Insert)
+    -> llvm::Expected<std::remove_pointer_t<decltype(Lookup())> &> {
+  {
+    std::shared_lock Lock(Mutex);
+    if (auto *Entry = Lookup())
+      return *Entry;
+  }
+  auto Computed = Compute();
+  LUTHIER_RETURN_ON_ERROR(Computed.takeError());
+  std::unique_lock Lock(Mutex);
+  return Insert(std::move(*Computed));
+}
+
+} // namespace luthier
+
+#endif
@@ -0,0 +1,105 @@
+//===-- KeyedObjectPool.h - Luthier Keyed Object Pool -----------*- C++ -*-===//
+// 按键索引的对象池头文件
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// 您可以在遵守许可证的情况下使用此文件
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Defines the \c KeyedObjectPool class, a thread-safe pool of idle objects
+/// that are expensive to create, such as target machines.
+/// 定义 \c KeyedObjectPool 类，一个线程安全的空闲对象池，用于创建开销较大的对象，
+/// 例如目标机器
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_COMMON_KEYED_OBJECT_POOL_H
+#define LUTHIER_COMMON_KEYED_OBJECT_POOL_H
+#include <llvm/ADT/SmallVector.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace luthier {
+
+/// \brief Thread-safe pool of idle objects of type \p T, grouped by a key of
+/// type \p KeyT
+/// \details Objects are handed out in last-in first-out order, so that the
+/// most recently used one is reused first. At most \c MaxIdlePerKey objects
+/// are kept idle for each key; Objects returned to a full pool are destroyed,
+/// outside of the pool's lock
+/// 类型为 \p T 的空闲对象的线程安全池，按类型为 \p KeyT 的键分组
+/// 对象按后进先出的顺序分发，因此最近使用的对象最先被重用。每个键最多保留
+/// \c MaxIdlePerKey 个空闲对象；归还到已满的池中的对象在池的锁之外被销毁
+template <typename KeyT, typename T> class KeyedObjectPool {
+private:
+  /// Protects \c Idle
+  /// 保护 \c Idle
+  mutable std::mutex Mutex{};
+
+  /// Idle objects of each key
+  /// 每个键的空闲对象
+  std::unordered_map<KeyT, llvm::SmallVector<std::unique_ptr<T>, 4>> Idle{};
+
+  /// Maximum number of idle objects kept for each key
+  /// 每个键保留的最大空闲对象数量
+  const unsigned MaxIdlePerKey;
+
+public:
+  explicit KeyedObjectPool(unsigned MaxIdlePerKey)
+      : MaxIdlePerKey(MaxIdlePerKey) {}
+
+  /// \return an idle object of \p Key, or \c nullptr if there is none
+  /// 返回 \p Key 的一个空闲对象；如果没有则返回 \c nullptr
+  std::unique_ptr<T> take(const KeyT &Key) {
+    std::lock_guard Lock(Mutex);
+    auto It = Idle.find(Key);
+    if (It == Idle.end() || It->second.empty())
+      return nullptr;
+    return It->second.pop_back_val();
+  }
+
+  /// Returns the \p Object of \p Key to the pool
+  /// \return \c true if the object was kept, \c false if the pool of \p Key
+  /// was full and the object was destroyed
+  /// 将 \p Key 的 \p Object 归还到池中
+  /// 如果对象被保留则返回 \c true；如果 \p Key 的池已满且对象被销毁则返回 \c false
+  bool put(const KeyT &Key, std::unique_ptr<T> Object) {
+    {
+      std::lock_guard Lock(Mutex);
+      auto &Objects = Idle[Key];
+      if (Objects.size() < MaxIdlePerKey) {
+        Objects.push_back(std::move(Object));
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// \return the number of idle objects of \p Key
+  /// 返回 \p Key 的空闲对象数量
+  [[nodiscard]] size_t getNumIdle(const KeyT &Key) const {
+    std::lock_guard Lock(Mutex);
+    auto It = Idle.find(Key);
+    return It == Idle.end() ? 0 : It->second.size();
+  }
+
+  /// Destroys all idle objects
+  /// 销毁所有空闲对象
+  void clear() {
+    std::unordered_map<KeyT, llvm::SmallVector<std::unique_ptr<T>, 4>>
+        Destroyed;
+    {
+      std::lock_guard Lock(Mutex);
+      Destroyed.swap(Idle);
+    }
+  }
+};
+
+} // namespace luthier
+
+#endif
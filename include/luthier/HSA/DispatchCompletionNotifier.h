@@ -0,0 +1,142 @@
+//===-- DispatchCompletionNotifier.h ----------------------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Describes the \c DispatchCompletionNotifier, which attaches asynchronous
+/// completion handlers to intercepted kernel dispatches without blocking the
+/// queue or serializing the application's kernels.
+/// 描述 \c DispatchCompletionNotifier，它将异步完成处理程序附加到拦截的内核调度上，
+/// 而不会阻塞队列或串行化应用程序的内核
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_HSA_DISPATCH_COMPLETION_NOTIFIER_H
+#define LUTHIER_HSA_DISPATCH_COMPLETION_NOTIFIER_H
+#include "luthier/HSA/ApiTable.h"
+#include <condition_variable>
+#include <hsa/hsa.h>
+#include <llvm/ADT/FunctionExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Error.h>
+#include <mutex>
+
+namespace luthier::hsa {
+
+/// \brief Runs user handlers once intercepted kernel dispatches complete
+/// \details Attaching a handler replaces the completion signal of the
+/// dispatch packet with a signal owned by the notifier, which is serviced
+/// by the HSA runtime's asynchronous signal handler thread via
+/// \c hsa_amd_signal_async_handler. Once the dispatch completes, the handler
+/// is run on that thread, and only then is the application's original
+/// completion signal (if any) decremented, as the packet processor would
+/// have done. Hence, anything waiting on the original signal observes the
+/// results of the handler, while the queue keeps running uninterrupted.\n
+/// Replacement signals are pooled and reused across dispatches.
+/// \brief 在拦截的内核调度完成后运行用户处理程序
+/// \details 附加处理程序会将调度数据包的完成信号替换为通知器拥有的信号，该信号由
+/// HSA 运行时的异步信号处理线程通过 \c hsa_amd_signal_async_handler 服务。调度完成后，
+/// 处理程序在该线程上运行，然后才像数据包处理器那样递减应用程序的原始完成信号
+/// （如果有）。因此，等待原始信号的任何代码都能观察到处理程序的结果，而队列会不间断地
+/// 继续运行。\n
+/// 替换信号被池化并在调度之间重用。
+class DispatchCompletionNotifier {
+public:
+  /// Type of the handlers run once a dispatch completes
+  /// 调度完成后运行的处理程序类型
+  typedef llvm::unique_function<void()> HandlerType;
+
+private:
+  /// Used to create, destroy, and operate on signals
+  /// 用于创建、销毁和操作信号
+  const ApiTableContainer<::CoreApiTable> CoreApi;
+
+  /// Used to register the asynchronous signal handlers
+  /// 用于注册异步信号处理程序
+  const ApiTableContainer<::AmdExtTable> AmdExtApi;
+
+  /// State of a dispatch whose completion is pending
+  /// 完成尚未到来的调度的状态
+  struct PendingCompletion {
+    DispatchCompletionNotifier &Notifier;
+    /// The replacement completion signal of the dispatch
+    hsa_signal_t Signal;
+    /// The original completion signal of the dispatch; Might be zero
+    hsa_signal_t OriginalSignal;
+    HandlerType Handler;
+  };
+
+  /// Guards \c FreeSignals and \c NumPendingCompletions
+  /// 保护 \c FreeSignals 和 \c NumPendingCompletions
+  std::mutex Mutex{};
+
+  /// Notified when \c NumPendingCompletions reaches zero
+  /// 当 \c NumPendingCompletions 降为零时通知
+  std::condition_variable NoPendingCompletions{};
+
+  /// Replacement signals not attached to any dispatch, ready to be reused
+  /// 未附加到任何调度、可以重用的替换信号
+  llvm::SmallVector<hsa_signal_t, 16> FreeSignals{};
+
+  /// Number of dispatches with handlers not run yet
+  /// 处理程序尚未运行的调度数量
+  size_t NumPendingCompletions{0};
+
+  /// \return a signal from the pool with a value of one, or a newly
+  /// created one if the pool is empty
+  llvm::Expected<hsa_signal_t> acquireSignal();
+
+  /// Invoked by the HSA runtime once the replacement signal of a dispatch
+  /// drops below one
+  static bool signalHandler(hsa_signal_value_t Value, void *Arg);
+
+  /// Runs the handler of \p Completion, forwards the completion to its
+  /// original signal, and recycles its replacement signal
+  void complete(PendingCompletion &Completion);
+
+public:
+  DispatchCompletionNotifier(ApiTableContainer<::CoreApiTable> CoreApi,
+                             ApiTableContainer<::AmdExtTable> AmdExtApi)
+      : CoreApi(CoreApi), AmdExtApi(AmdExtApi) {}
+
+  DispatchCompletionNotifier(const DispatchCompletionNotifier &) = delete;
+
+  DispatchCompletionNotifier &
+  operator=(const DispatchCompletionNotifier &) = delete;
+
+  /// Waits for all pending handlers to run, and destroys the signals in the
+  /// pool
+  /// 等待所有挂起的处理程序运行完毕，并销毁池中的信号
+  ~DispatchCompletionNotifier();
+
+  /// Attaches \p Handler to the dispatch described by \p Packet, to be run
+  /// once the dispatch completes; Must be called before the packet is
+  /// written to its queue
+  /// \param Packet the intercepted dispatch packet; Its completion signal
+  /// is replaced
+  /// \param Handler the handler to run on the HSA runtime's asynchronous
+  /// signal handler thread once the dispatch completes
+  /// \return an \c llvm::Error if the handler could not be attached; The
+  /// packet is left untouched in that case
+  /// 将 \p Handler 附加到 \p Packet 描述的调度上，在调度完成后运行；必须在数据包
+  /// 写入队列之前调用
+  llvm::Error attach(hsa_kernel_dispatch_packet_t &Packet, HandlerType Handler);
+
+  /// Blocks until the handlers of all dispatches attached so far have run
+  /// 阻塞直到目前为止附加的所有调度的处理程序运行完毕
+  void waitForPendingCompletions();
+};
+
+} // namespace luthier::hsa
+
+#endif
@@ -0,0 +1,145 @@
+//===-- PacketBatch.h -------------------------------------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Describes the \c PacketBatch, a view of the packets intercepted from a
+/// single submission to an HSA queue which can be edited in place before
+/// being written to the queue.
+/// 描述 \c PacketBatch，即从单次 HSA 队列提交中拦截的数据包的视图，在写入队列之前
+/// 可以就地编辑
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_HSA_PACKET_BATCH_H
+#define LUTHIER_HSA_PACKET_BATCH_H
+#include "luthier/HSA/AqlPacket.h"
+#include <hsa/hsa_api_trace.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+
+namespace luthier::hsa {
+
+/// \brief A view of the packets of a single intercepted queue submission
+/// \details The HSA intercept queue hands its handlers a read-only array of
+/// packets. The batch forwards this array to the queue as is unless the
+/// packets are edited: On the first call to \c edit the packets are copied
+/// into a scratch buffer owned by the \c PacketMonitor, which is reused
+/// across submissions and hence does not allocate in the steady state. All
+/// further edits happen in place inside the scratch buffer.\n
+/// Unless \c submit is called by the packet callback, the batch is written
+/// to the queue after the callback returns
+/// \brief 单次拦截的队列提交的数据包视图
+/// \details HSA 拦截队列向其处理程序提供只读的数据包数组。除非数据包被编辑，否则
+/// 批次会将此数组原样转发到队列：首次调用 \c edit 时，数据包被复制到由
+/// \c PacketMonitor 拥有的暂存缓冲区中，该缓冲区在提交之间重用，因此在稳定状态下
+/// 不会分配内存。之后的所有编辑都在暂存缓冲区中就地进行。\n
+/// 除非数据包回调调用了 \c submit，否则批次将在回调返回后写入队列
+class PacketBatch {
+private:
+  /// The packets as submitted by the application
+  /// 应用程序提交的数据包
+  const llvm::ArrayRef<AqlPacket> OriginalPackets;
+
+  /// Writes packets to the underlying queue
+  /// 将数据包写入底层队列
+  const hsa_amd_queue_intercept_packet_writer Writer;
+
+  /// Scratch buffer the packets are copied into once edited
+  /// 数据包被编辑后复制到的暂存缓冲区
+  llvm::SmallVectorImpl<AqlPacket> &Scratch;
+
+  /// Whether the packets were copied into \c Scratch
+  /// 数据包是否已被复制到 \c Scratch 中
+  bool IsEdited{false};
+
+  /// Whether the batch was written to the queue
+  /// 批次是否已写入队列
+  bool IsSubmitted{false};
+
+public:
+  /// \param Packets the packets intercepted from the queue
+  /// \param Writer the writer of the queue the packets were submitted to
+  /// \param Scratch buffer to copy the packets into if they get edited; Its
+  /// contents are overwritten
+  PacketBatch(llvm::ArrayRef<AqlPacket> Packets,
+              hsa_amd_queue_intercept_packet_writer Writer,
+              llvm::SmallVectorImpl<AqlPacket> &Scratch)
+      : OriginalPackets(Packets), Writer(Writer), Scratch(Scratch) {}
+
+  PacketBatch(const PacketBatch &) = delete;
+
+  PacketBatch &operator=(const PacketBatch &) = delete;
+
+  /// \return the number of packets in the batch
+  /// \return 批次中的数据包数量
+  [[nodiscard]] size_t size() const { return OriginalPackets.size(); }
+
+  /// \return the current contents of the packets, including any edits
+  /// \return 数据包的当前内容，包括所有编辑
+  [[nodiscard]] llvm::ArrayRef<AqlPacket> packets() const {
+    return IsEdited ? llvm::ArrayRef<AqlPacket>(Scratch) : OriginalPackets;
+  }
+
+  [[nodiscard]] const AqlPacket &operator[](size_t Idx) const {
+    return packets()[Idx];
+  }
+
+  /// \return \c true if the packets were edited, \c false otherwise
+  /// \return 如果数据包被编辑过则返回 \c true，否则返回 \c false
+  [[nodiscard]] bool isEdited() const { return IsEdited; }
+
+  /// \return \c true if the batch was already written to the queue
+  /// \return 如果批次已写入队列则返回 \c true
+  [[nodiscard]] bool isSubmitted() const { return IsSubmitted; }
+
+  /// \return a mutable view of all the packets in the batch; Copies the
+  /// packets into the scratch buffer if not already done so
+  /// \return 批次中所有数据包的可变视图；如果尚未复制，则将数据包复制到暂存缓冲区中
+  [[nodiscard]] llvm::MutableArrayRef<AqlPacket> edit() {
+    if (!IsEdited) {
+      Scratch.assign(OriginalPackets.begin(), OriginalPackets.end());
+      IsEdited = true;
+    }
+    return Scratch;
+  }
+
+  /// \return a mutable reference to the packet at \p Idx
+  /// \return 索引为 \p Idx 的数据包的可变引用
+  [[nodiscard]] AqlPacket &edit(size_t Idx) { return edit()[Idx]; }
+
+  /// Writes \p Packets to the queue right away, ahead of this batch unless
+  /// it was already submitted; Useful for inserting extra packets (e.g.
+  /// barriers) around the application's packets
+  /// 立即将 \p Packets 写入队列；除非本批次已提交，否则它们位于本批次之前；
+  /// 可用于在应用程序的数据包周围插入额外的数据包（例如屏障）
+  void write(llvm::ArrayRef<AqlPacket> Packets) const {
+    Writer(Packets.data(), Packets.size());
+  }
+
+  /// Writes the current contents of the batch to the queue, if not already
+  /// written; Packets written after this call with \c write will come
+  /// after the batch
+  /// 如果尚未写入，则将批次的当前内容写入队列；在此调用之后使用 \c write
+  /// 写入的数据包将位于批次之后
+  void submit() {
+    if (IsSubmitted)
+      return;
+    write(packets());
+    IsSubmitted = true;
+  }
+};
+
+} // namespace luthier::hsa
+
+#endif
@@ -24,9 +24,11 @@
 #include "luthier/HSA/AqlPacket.h"
 #include "luthier/HSA/ExecutableSymbol.h"
 #include "luthier/HSA/HsaError.h"
+#include "luthier/HSA/PacketBatch.h"
 #include "luthier/Rocprofiler/ApiTableSnapshot.h"
 #include <hsa/hsa_api_trace.h>
 #include "luthier/Rocprofiler/ApiTableWrapperInstaller.h"
+#include <variant>
 
 namespace luthier::hsa {
 
@@ -37,6 +39,16 @@ public:
                              hsa_amd_queue_intercept_packet_writer)>
       CallbackType;
 
+  /// Callback which edits the intercepted packets in place through a
+  /// \c PacketBatch; Batches the callback does not edit are forwarded to the
+  /// queue without being copied
+  /// 通过 \c PacketBatch 就地编辑拦截的数据包的回调；回调未编辑的批次将不经复制
+  /// 直接转发到队列
+  typedef std::function<void(const hsa_queue_t &, uint64_t, PacketBatch &)>
+      BatchCallbackType;
+
+  typedef std::variant<CallbackType, BatchCallbackType> AnyCallbackType;
+
 private:
   const rocprofiler::HsaApiTableSnapshot<::CoreApiTable> &CoreApiSnapshot;
 
@@ -45,7 +57,7 @@ private:
   const rocprofiler::HsaExtensionTableSnapshot<HSA_EXTENSION_AMD_LOADER>
       &LoaderApiSnapshot;
 
-  const CallbackType CB;
+  const AnyCallbackType CB;
 
   std::unique_ptr<
       const rocprofiler::HsaApiTableWrapperInstaller<::CoreApiTable>>
@@ -71,7 +83,7 @@ public:
       const rocprofiler::HsaApiTableSnapshot<::AmdExtTable> &AmdExtSnapshot,
       const rocprofiler::HsaExtensionTableSnapshot<HSA_EXTENSION_AMD_LOADER>
           &LoaderApiSnapshot,
-      CallbackType CB, llvm::Error &Err)
+      AnyCallbackType CB, llvm::Error &Err)
       : CoreApiSnapshot(CoreApiSnapshot), AmdExtSnapshot(AmdExtSnapshot),
         LoaderApiSnapshot(LoaderApiSnapshot), CB(std::move(CB)) {
     HsaApiTableInterceptor = std::make_unique<
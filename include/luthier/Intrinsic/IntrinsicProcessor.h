@@ -227,6 +227,10 @@ private:
   /// A set of kernel arguments that needs to be accessed by this intrinsic
   llvm::SmallDenseSet<KernelArgumentType, 4> AccessedKernelArguments{};
 
+  /// 此 intrinsic 在 LDS 中暂存的工具全局计数器的名称
+  /// Names of the tool's global counters staged in LDS by this intrinsic
+  llvm::SmallVector<std::string, 1> LDSCounters{};
+
 public:
   /// \param Name 被 lowering 的 intrinsic 的名称
   /// \note 此函数在返回 \c IntrinsicIRProcessorFunc 结果后由 Luthier 内部调用；因此在 IR 处理器中设置 intrinsic 的名称没有效果
@@ -362,6 +366,37 @@ public:
   [[nodiscard]] size_t accessed_kernargs_size() const {
     return AccessedKernelArguments.size();
   }
+
+  /// 要求代码生成器在 LDS 中为全局计数器 \p GlobalCounterName 分配一个
+  /// 工作组私有的副本，在内核入口将其清零，并在内核退出时将其刷新回全局计数器
+  /// Asks the code generator to allocate a workgroup-private copy of the
+  /// global counter \p GlobalCounterName in LDS, zero it at kernel entry, and
+  /// flush it back to the global counter at kernel exit
+  void requestLDSCounter(llvm::StringRef GlobalCounterName) {
+    if (!llvm::is_contained(LDSCounters, GlobalCounterName))
+      LDSCounters.emplace_back(GlobalCounterName);
+  }
+
+  /// \returns 此 intrinsic 在 LDS 中暂存的全局计数器的名称
+  /// \returns the names of the global counters staged in LDS by the
+  /// intrinsic
+  [[nodiscard]] llvm::ArrayRef<std::string> lds_counters() const {
+    return LDSCounters;
+  }
+
+  /// 将内联汇编占位符、输出值和参数值重新绑定到 \p PlaceHolderCall（对此
+  /// intrinsic 内联汇编占位符的调用）及其操作数；如果 \p PlaceHolderCall 为
+  /// \c nullptr，则清除它们
+  /// \note 用于将 lowering 信息复制到另一个 \c llvm::LLVMContext 中的
+  /// instrumentation module 副本，以免引用原上下文中的 IR 值
+  /// Rebinds the inline assembly placeholder, the output value, and the
+  /// argument values to \p PlaceHolderCall, the call to the inline assembly
+  /// placeholder of this intrinsic, and its operands; Clears them if
+  /// \p PlaceHolderCall is \c nullptr
+  /// \note used when the lowering info is copied over to a copy of the
+  /// instrumentation module in another \c llvm::LLVMContext, so that it does
+  /// not refer to the IR values of the original context
+  void rebindIRValues(const llvm::CallInst *PlaceHolderCall);
 };
 
 /// \brief 描述每个 Luthier intrinsic 用于处理其在 LLVM IR 中的使用的函数类型，并返回描述其使用/定义值如何 lowering 到 <tt>llvm::MachineOperand</tt> 的 \c IntrinsicIRLoweringInfo，以及从 IR 处理阶段传递到 MIR 处理阶段所需的任意信息
@@ -22,6 +22,7 @@
 #ifndef LUTHIER_INTRINSIC_INTRINSICS_H
 #define LUTHIER_INTRINSIC_INTRINSICS_H
 #include "luthier/consts.h"
+#include "luthier/trace.h"
 #include <llvm/MC/MCRegister.h>
 
 namespace luthier {
@@ -118,6 +119,98 @@ LUTHIER_INTRINSIC_ANNOTATE uint32_t *implicitArgPtr() {
   return Out;
 }
 
+/// \brief 返回当前调度的插桩缓冲区的地址
+/// \details 缓冲区由主机上的 \c DispatchBufferPool 为每个调度分配并清零，其地址通过
+/// 用户参数区域（位于内核原始参数缓冲区之后）传递；调度完成后，缓冲区会交还给工具。
+/// 因此，写入此缓冲区的计数器可以归属到单个调度，而无需串行化内核
+/// \return 当前调度的插桩缓冲区的地址；在整个调度中是统一的
+/// \brief Returns the address of the instrumentation buffer of the current
+/// dispatch
+/// \details The buffer is allocated and zeroed for each dispatch by a
+/// \c DispatchBufferPool on the host, and its address is passed via the user
+/// argument area, placed after the kernel's original argument buffer; Once the
+/// dispatch completes, the buffer is handed back to the tool. Counters
+/// written to this buffer can therefore be attributed to a single dispatch
+/// without serializing kernels
+/// \return the address of the instrumentation buffer of the current dispatch;
+/// Uniform across the entire dispatch
+LUTHIER_INTRINSIC_ANNOTATE void *dispatchBuffer() {
+  void *Out;
+  doNotOptimize(Out);
+  return Out;
+}
+
+/// \brief 读取当前波前的着色器时钟计数器
+/// \details 在 GFX9 和 GFX10 上降级为 \c s_memtime；在 GFX11 上降级为读取
+/// \c SHADER_CYCLES 硬件寄存器，此时只有低 20 位有效，并会回绕；在 GFX12 上读取完整的 64 位计数器。
+/// 读取计数器被视为具有副作用，因此编译器不会将其移过其他指令
+/// \return 着色器时钟计数器的值；在波前内是统一的
+/// \brief Reads the shader clock counter of the current wavefront
+/// \details Lowered to \c s_memtime on GFX9 and GFX10; On GFX11 it is lowered
+/// to a read of the \c SHADER_CYCLES hardware register, in which case only the
+/// lower 20 bits are valid and wrap around; On GFX12 the full 64-bit counter
+/// is read. Reading the counter is treated as having side effects, so the
+/// compiler does not move it past other instructions
+/// \return the value of the shader clock counter; Uniform across the
+/// wavefront
+LUTHIER_INTRINSIC_ANNOTATE uint64_t readClock() {
+  uint64_t Out;
+  doNotOptimize(Out);
+  return Out;
+}
+
+/// \brief 读取以恒定频率递增的实时计数器
+/// \details 在 GFX9 和 GFX10 上降级为 \c s_memrealtime，在 GFX11 及更高版本上降级为
+/// \c s_sendmsg_rtn_b64；与 \c readClock 不同，其频率不受时钟门控和频率调节的影响
+/// \return 实时计数器的值；在波前内是统一的
+/// \brief Reads the real time counter, which is incremented at a constant
+/// frequency
+/// \details Lowered to \c s_memrealtime on GFX9 and GFX10, and to
+/// \c s_sendmsg_rtn_b64 on GFX11 and later; Unlike \c readClock, its frequency
+/// is not affected by clock gating and frequency scaling
+/// \return the value of the real time counter; Uniform across the wavefront
+LUTHIER_INTRINSIC_ANNOTATE uint64_t readRealTime() {
+  uint64_t Out;
+  doNotOptimize(Out);
+  return Out;
+}
+
+/// \brief 将区域计时器的一个端点累加到 \p Counter
+/// \details 供使用 \c InstrumentationTask::insertRegionTimer 插入的钩子调用。进入区域时
+/// 减去当前时钟，离开区域时加上当前时钟，因此 \p Counter 累加每个波前在区域中花费的周期，
+/// 而无需在两个钩子之间传递任何状态。每个波前只有第一个活跃通道执行原子操作。\n
+/// 在 GFX11 上，由于时钟计数器只有 20 位并会在区域内回绕，改为累加实时计数器的滴答数
+/// \param Counter 工具的全局计数器
+/// \param IsRegionEnd 调用是否位于区域的末尾
+/// \brief Accumulates one endpoint of a region timer into \p Counter
+/// \details Meant to be called by the hook inserted with
+/// \c InstrumentationTask::insertRegionTimer. The current clock is subtracted
+/// when entering the region and added when leaving it, hence \p Counter
+/// accumulates the cycles each wavefront spent in the region without carrying
+/// any state between the two hooks. Only the first active lane of each
+/// wavefront performs the atomic.\n
+/// On GFX11, the clock counter only has 20 bits and wraps around inside
+/// regions; Ticks of the real time counter are accumulated instead
+/// \param Counter the global counter of the tool
+/// \param IsRegionEnd whether the call is located at the end of the region
+__attribute__((device, always_inline)) void
+accumulateRegionTime(uint64_t *Counter, bool IsRegionEnd) {
+  // Read the clock before anything else, to keep the placement of the
+  // timestamp close to the region boundary
+#if defined(__GFX11__)
+  uint64_t Now = readRealTime();
+#else
+  uint64_t Now = readClock();
+#endif
+  uint64_t Exec = __builtin_amdgcn_read_exec();
+  uint32_t LaneIdx = __builtin_amdgcn_mbcnt_hi(
+      static_cast<uint32_t>(Exec >> 32),
+      __builtin_amdgcn_mbcnt_lo(static_cast<uint32_t>(Exec), 0));
+  if (LaneIdx == 0)
+    __hip_atomic_fetch_add(Counter, IsRegionEnd ? Now : -Now,
+                           __ATOMIC_RELAXED, __HIP_MEMORY_SCOPE_AGENT);
+}
+
 LUTHIER_INTRINSIC_ANNOTATE uint32_t workgroupIdX() {
   uint32_t Out;
   doNotOptimize(Out);
@@ -148,6 +241,145 @@ LUTHIER_INTRINSIC_ANNOTATE T sAtomicAdd(T *Address, T Value) {
   return Out;
 }
 
+/// \brief 将所有活跃通道的 \p Value 之和原子地加到 \p Address
+/// \details 求和在波前内通过 DPP 和 readlane 完成，整个波前只发出一次原子操作；生成的代码不包含分支。
+/// 没有活跃通道时加上零
+/// \tparam T 计数器的类型；必须是 32 位或 64 位整数
+/// \param Address 计数器的地址；在波前内必须是统一的
+/// \param Value 调用通道要加上的值
+/// \brief Atomically adds the sum of \p Value over all active lanes to
+/// \p Address
+/// \details The sum is reduced inside the wavefront with DPP and lane reads,
+/// and a single atomic is issued for the entire wavefront; The emitted code
+/// has no branches. Zero is added when no lane is active
+/// \tparam T type of the counter; Must be a 32-bit or 64-bit integer
+/// \param Address address of the counter; Must be uniform across the
+/// wavefront
+/// \param Value the value to be added by the calling lane
+template <typename T,
+          typename = std::enable_if_t<
+              std::is_same_v<T, uint32_t> || std::is_same_v<T, uint64_t> ||
+              std::is_same_v<T, int32_t> || std::is_same_v<T, int64_t>>>
+LUTHIER_INTRINSIC_ANNOTATE void waveAtomicAdd(T *Address, T Value) {
+  doNotOptimize(Address);
+  doNotOptimize(Value);
+}
+
+/// \brief 将 \p Value 加到 \p Counter 在当前工作组 LDS 中的副本
+/// \details 副本在内核入口处清零，并在工作组的最后一个波前退出时以一次全局原子操作
+/// 加回 \p Counter；因此每个工作组只对 \p Counter 执行一次全局原子操作
+/// \param Counter 工具的全局计数器；必须直接引用一个 \c __device__ 全局变量
+/// \param Value 调用通道要加上的值
+/// \brief Adds \p Value to the copy of \p Counter in the LDS of the current
+/// workgroup
+/// \details The copy is zeroed at kernel entry, and added back to
+/// \p Counter with a single global atomic once the last wavefront of the
+/// workgroup exits; Hence \p Counter only sees one global atomic per workgroup
+/// \param Counter the global counter of the tool; Must directly refer to a
+/// \c __device__ global variable
+/// \param Value the value to be added by the calling lane
+LUTHIER_INTRINSIC_ANNOTATE void ldsCounterAdd(uint64_t *Counter,
+                                              uint64_t Value) {
+  doNotOptimize(Counter);
+  doNotOptimize(Value);
+}
+
+/// \brief 在 \p Buffer 中为每个活跃通道预留一个记录槽位
+/// \details 整个波前只对 \p Buffer 的写索引执行一次标量原子操作；每个活跃通道获得一个唯一的槽位索引。
+/// 工具通常应使用 \c traceAppend，而不是直接调用此 intrinsic
+/// \param Buffer 跟踪缓冲区的地址；在波前内必须是统一的
+/// \returns 为调用通道预留的槽位索引；尚未回绕到缓冲区的容量
+/// \brief Reserves a record slot in the \p Buffer for each active lane
+/// \details A single scalar atomic is performed on the write index of the
+/// \p Buffer for the entire wavefront; Each active lane gets a unique slot
+/// index. Tools should generally use \c traceAppend instead of calling this
+/// intrinsic directly
+/// \param Buffer address of the trace buffer; Must be uniform across the
+/// wavefront
+/// \returns the index of the slot reserved for the calling lane; Not wrapped
+/// around the capacity of the buffer yet
+LUTHIER_INTRINSIC_ANNOTATE uint64_t traceReserve(TraceBufferHeader *Buffer) {
+  uint64_t Out;
+  doNotOptimize(Out);
+  doNotOptimize(Buffer);
+  return Out;
+}
+
+/// \brief 将 \p Record 追加到 \p Buffer
+/// \details 槽位通过 \c traceReserve 预留；当缓冲区已满时，行为由其 \c TraceBufferOverflowPolicy 决定
+/// \tparam T 记录的类型；必须是可平凡复制的，且不大于缓冲区的记录大小
+/// \param Buffer 跟踪缓冲区的地址；在波前内必须是统一的
+/// \param Record 要追加的记录
+/// \returns 如果记录被丢弃（包括记录大于缓冲区的记录大小，或在写入完成前被更新的记录覆盖时）则返回 \c false，否则返回 \c true
+/// \brief Appends the \p Record to the \p Buffer
+/// \details Slots are reserved via \c traceReserve; When the buffer is full,
+/// the behavior is dictated by its \c TraceBufferOverflowPolicy
+/// \tparam T type of the record; Must be trivially copyable and not larger
+/// than the record size of the buffer
+/// \param Buffer address of the trace buffer; Must be uniform across the
+/// wavefront
+/// \param Record the record to be appended
+/// \returns \c false if the record was dropped, including when it is larger
+/// than the record size of the buffer, or when a later record overwrote it
+/// before it was published, \c true otherwise
+template <typename T,
+          typename = std::enable_if_t<std::is_trivially_copyable_v<T>>>
+__attribute__((device, always_inline)) bool
+traceAppend(TraceBufferHeader *Buffer, const T &Record) {
+  const uint64_t Capacity = Buffer->Capacity;
+  const uint32_t Policy = Buffer->OverflowPolicy;
+  // The record size of the buffer is only known at runtime; Records that do
+  // not fit in a slot would overrun the tag of the next one, hence they are
+  // dropped instead
+  if (sizeof(T) > Buffer->RecordSize) {
+    __hip_atomic_fetch_add(&Buffer->NumDropped, uint64_t{1}, __ATOMIC_RELAXED,
+                           __HIP_MEMORY_SCOPE_SYSTEM);
+    return false;
+  }
+  if (Policy == TRACE_BUFFER_DROP_NEWEST &&
+      __hip_atomic_load(&Buffer->WriteIndex, __ATOMIC_RELAXED,
+                        __HIP_MEMORY_SCOPE_SYSTEM) -
+              __hip_atomic_load(&Buffer->ReadIndex, __ATOMIC_RELAXED,
+                                __HIP_MEMORY_SCOPE_SYSTEM) >=
+          Capacity) {
+    __hip_atomic_fetch_add(&Buffer->NumDropped, uint64_t{1}, __ATOMIC_RELAXED,
+                           __HIP_MEMORY_SCOPE_SYSTEM);
+    return false;
+  }
+  uint64_t Slot = traceReserve(Buffer);
+  // Unless overwriting is allowed, wait for the host to free the slot; Under
+  // the drop policy, this only happens when several wavefronts race past the
+  // fullness check above
+  if (Policy != TRACE_BUFFER_OVERWRITE_OLDEST) {
+    while (Slot - __hip_atomic_load(&Buffer->ReadIndex, __ATOMIC_ACQUIRE,
+                                    __HIP_MEMORY_SCOPE_SYSTEM) >=
+           Capacity)
+      __builtin_amdgcn_s_sleep(2);
+  }
+  auto *Tag = reinterpret_cast<uint64_t *>(
+      reinterpret_cast<char *>(Buffer) + TraceBufferSlotsOffset +
+      (Slot & (Capacity - 1)) * (TraceBufferSlotTagSize + Buffer->RecordSize));
+  // Mark the slot as being written before touching its payload, so that the
+  // host rejects the record it may be copying out of the slot; A record
+  // lapped by a later one before claiming its slot is dropped instead
+  const uint64_t WritingTag = getTraceSlotWritingTag(Slot);
+  uint64_t CurrentTag =
+      __hip_atomic_load(Tag, __ATOMIC_RELAXED, __HIP_MEMORY_SCOPE_SYSTEM);
+  do {
+    if (CurrentTag >= WritingTag)
+      return false;
+  } while (!__hip_atomic_compare_exchange_weak(
+      Tag, &CurrentTag, WritingTag, __ATOMIC_RELAXED, __ATOMIC_RELAXED,
+      __HIP_MEMORY_SCOPE_SYSTEM));
+  __builtin_amdgcn_fence(__ATOMIC_RELEASE, "");
+  __builtin_memcpy(Tag + 1, &Record, sizeof(T));
+  // Only publish the record if no later record claimed the slot meanwhile
+  uint64_t ExpectedTag = WritingTag;
+  return __hip_atomic_compare_exchange_strong(
+      Tag, &ExpectedTag, getTraceSlotPublishedTag(Slot), __ATOMIC_RELEASE,
+      __ATOMIC_RELAXED, __HIP_MEMORY_SCOPE_SYSTEM);
+}
+
 #endif
 
 } // namespace luthier
@@ -25,6 +25,8 @@
 #include "luthier/Common/Singleton.h"
 #include "luthier/Intrinsic/IntrinsicProcessor.h"
 #include "luthier/Rocprofiler/ApiTableSnapshot.h"
+#include <llvm/IR/PassManager.h>
+#include <memory>
 
 namespace llvm {
 
@@ -36,6 +38,10 @@ namespace luthier {
 
 class InstrumentationTask;
 
+class InstrumentationRecord;
+
+struct InjectedPayloadCodeGenState;
+
 class LiftedRepresentation;
 
 namespace hsa {
@@ -50,7 +56,9 @@ class ISA;
 /// 2. 对插桩模块运行 IR 优化流水线以优化插桩函数。\n
 /// 3. 运行 Luthier intrinsic 的 IR lowering 函数。\n
 /// 4. 对插桩模块运行修改后的 LLVM CodeGen 流水线，包括：a) 运行正常的 ISEL，b) 对 intrinsic 调用 MIR lowering 函数，c) 虚拟化对物理寄存器的访问，并在 MIR 中表达寄存器约束，d) 在插桩 Module 函数内的栈操作数寄存器分配和 lowering 之后进行自定义帧 lowering。\n
-/// 5. 跟踪每个 intrinsic 如何 lowering；有一组为 Luthier 内置的 intrinsic（例如 <tt>readReg</tt>），还有一组工具编写者可以通过描述它们的 lowering 方式来注册的 intrinsic。
+/// 5. 跟踪每个 intrinsic 如何 lowering；有一组为 Luthier 内置的 intrinsic（例如 <tt>readReg</tt>），还有一组工具编写者可以通过描述它们的 lowering 方式来注册的 intrinsic。\n
+/// 对不同内核的提升表示的插桩可以从多个线程并发进行；每次插桩只持有其提升表示的 \c llvm::LLVMContext 的锁。
+/// intrinsic 必须在任何插桩开始之前注册。
 /// \brief Singleton in charge of generating instrumented machine code
 /// \details <tt>CodeGenerator</tt> performs the following tasks:
 /// 1. Create calls to hooks inside an instrumentation
@@ -68,7 +76,11 @@ class ISA;
 /// 5. Keep track of how each intrinsic is lowered; There are a set of
 /// intrinsics built-in for Luthier (e.g. <tt>readReg</tt>) and there are a set
 /// of intrinsics which a tool writer can register by describing how they
-/// are lowered.
+/// are lowered. \n
+/// Lifted representations of different kernels can be instrumented
+/// concurrently from multiple threads; Each instrumentation only holds the
+/// lock of its lifted representation's \c llvm::LLVMContext. Intrinsics must
+/// be registered before any instrumentation starts.
 class CodeGenerator : public Singleton<CodeGenerator> {
 private:
   /// 保存有关如何 lowering Luthier intrinsic 的信息
@@ -120,6 +132,56 @@ public:
                                             LiftedRepresentation &)>
                  Mutator);
 
+  /// 与 \c instrument 相同，但额外将插桩的钩子和生成的注入负载保存到 \p Record 中，以便之后通过
+  /// \c reinstrument 进行增量重新插桩
+  /// \param LR 要被插桩的 \c LiftedRepresentation
+  /// \param Mutator 可以修改提升表示的函数；为了能够重新插桩，它只能插入钩子
+  /// \param [out] Record 被填充的插桩记录
+  /// \return 包含插桩代码的新 \c LiftedRepresentation，或在过程中遇到问题时返回 \c llvm::Error
+  /// Same as \c instrument, but also saves the inserted hooks and the
+  /// generated injected payloads in \p Record so that the \p LR can later be
+  /// re-instrumented incrementally using \c reinstrument
+  /// \param LR the \c LiftedRepresentation about to be instrumented
+  /// \param Mutator a function that can modify the lifted representation; To
+  /// be able to re-instrument, it must only insert hooks
+  /// \param [out] Record the instrumentation record being populated
+  /// \return a new \c LiftedRepresentation containing the instrumented code,
+  /// or an \c llvm::Error in case an issue was encountered during the process
+  llvm::Expected<std::unique_ptr<LiftedRepresentation>>
+  instrument(const LiftedRepresentation &LR,
+             llvm::function_ref<llvm::Error(InstrumentationTask &,
+                                            LiftedRepresentation &)>
+                 Mutator,
+             InstrumentationRecord &Record);
+
+  /// 增量地重新插桩 \p LR：克隆 \p LR，重放 \p Record 中记录的钩子，然后应用 \p DeltaMutator
+  /// 来添加（通过 \c InstrumentationTask::insertHookBefore）或移除（通过
+  /// \c InstrumentationTask::removeHooksBefore）钩子。只有签名发生变化的插桩点的注入负载会被重新生成；
+  /// 其余的重用 \p Record 中的机器代码
+  /// \param LR 之前用 \p Record 插桩的原始 \c LiftedRepresentation
+  /// \param [in, out] Record 之前插桩的记录；成功时被更新为此次插桩的记录
+  /// \param DeltaMutator 添加和移除钩子的函数；不能修改提升表示的指令
+  /// \return 包含插桩代码的新 \c LiftedRepresentation，或在过程中遇到问题时返回 \c llvm::Error
+  /// Incrementally re-instruments \p LR by cloning it, replaying the hooks
+  /// recorded in \p Record, and then applying the \p DeltaMutator to add
+  /// (via \c InstrumentationTask::insertHookBefore) or remove
+  /// (via \c InstrumentationTask::removeHooksBefore) hooks. Only the injected
+  /// payloads of instrumentation points whose signature has changed are
+  /// regenerated; The rest reuse the machine code in \p Record
+  /// \param LR the original \c LiftedRepresentation previously instrumented
+  /// with \p Record
+  /// \param [in, out] Record the record of the previous instrumentation; On
+  /// success, it is updated to the record of this instrumentation
+  /// \param DeltaMutator a function that adds and removes hooks; It must not
+  /// modify the instructions of the lifted representation
+  /// \return a new \c LiftedRepresentation containing the instrumented code,
+  /// or an \c llvm::Error in case an issue was encountered during the process
+  llvm::Expected<std::unique_ptr<LiftedRepresentation>>
+  reinstrument(const LiftedRepresentation &LR, InstrumentationRecord &Record,
+               llvm::function_ref<llvm::Error(InstrumentationTask &,
+                                              LiftedRepresentation &)>
+                   DeltaMutator);
+
   /// 对 \p Module 和 \p MMIWP 的 \c llvm::MachineModuleInfo 运行 \c llvm::AsmPrinter pass 以生成可重定位文件
   /// \note 此函数不以线程安全的方式访问 Module 的 \c llvm::LLVMContext
   /// \note 打印后，\p MMIWP 将被用于打印汇编文件的旧版 pass 管理器删除
@@ -155,6 +217,8 @@ private:
   /// \p Task 由 <tt>CodeGenerator::instrument</tt> 中的变体函数创建和填充
   /// \param [in] Task 应用于 \p LR 的 \c InstrumentationTask，包含一组将在目标应用程序的一组 <tt>llvm::MachineInstr</tt> 之前注入的钩子调用
   /// \param [in, out] LR 被插桩的 \c LiftedRepresentation
+  /// \param [in] Previous 之前插桩的记录，其注入负载可以被重用；如果没有则为 \c nullptr
+  /// \param [out] Record 如果不为 \c nullptr，则被填充为此次插桩的记录
   /// \return 指示过程中是否遇到问题的 \c llvm::Error
   /// Applies the instrumentation task \p Task to the lifted representation
   /// of \p LR \n
@@ -164,10 +228,25 @@ private:
   /// contains a set of hook calls that will be injected before a set of
   /// <tt>llvm::MachineInstr</tt>s of the target application
   /// \param [in, out] LR the \c LiftedRepresentation being instrumented
+  /// \param [in] Previous the record of a previous instrumentation whose
+  /// injected payloads can be reused; \c nullptr if there is none
+  /// \param [out] Record if not \c nullptr, will be populated with the
+  /// record of this instrumentation
   /// \return an \c llvm::Error indicating if any issues where encountered
   /// during the process
-  llvm::Error applyInstrumentationTask(const InstrumentationTask &Task,
-                                       LiftedRepresentation &LR);
+  llvm::Error
+  applyInstrumentationTask(const InstrumentationTask &Task,
+                           LiftedRepresentation &LR,
+                           const InstrumentationRecord *Previous = nullptr,
+                           InstrumentationRecord *Record = nullptr);
+
+  /// 在应用 \p Task 之后填充 \p Record
+  /// Populates the \p Record after applying the \p Task
+  static llvm::Error fillInstrumentationRecord(
+      const InstrumentationTask &Task, const LiftedRepresentation &LR,
+      llvm::ModuleAnalysisManager &TargetMAM,
+      const std::shared_ptr<InjectedPayloadCodeGenState> &CodeGenState,
+      InstrumentationRecord &Record);
 };
 
 } // namespace luthier
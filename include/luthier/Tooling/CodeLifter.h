@@ -22,6 +22,7 @@
 #ifndef LUTHIER_TOOLING_CODE_LIFTER_H
 #define LUTHIER_TOOLING_CODE_LIFTER_H
 #include "AMDGPUTargetMachine.h"
+#include "luthier/Common/ConcurrentCache.h"
 #include "luthier/Common/Singleton.h"
 #include "luthier/HSA/Agent.h"
 #include "luthier/HSA/Executable.h"
@@ -51,6 +52,8 @@
 #include <llvm/MC/MCInstrAnalysis.h>
 #include <llvm/Object/ELFObjectFile.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -97,9 +100,30 @@ class CodeLifter : public Singleton<CodeLifter> {
   //===--------------------------------------------------------------------===//
 
 private:
-  /// 保护代码提升器字段的互斥锁
-  /// Mutex to protect fields of the code lifter
-  std::recursive_mutex CacheMutex{};
+  // 每个缓存都由其自己的锁保护，并且缓存的条目在不持有锁的情况下被计算，因此不同内核的提升可以并发进行
+  // Each cache is protected by its own lock, and cache entries are computed
+  // without holding it, so that lifting of different kernels can proceed
+  // concurrently
+
+  /// 保护 \c DisassemblyInfoMap 的互斥锁
+  /// Mutex protecting the \c DisassemblyInfoMap
+  std::mutex DisassemblyInfoMutex{};
+
+  /// 保护 \c MCDisassembledSymbols 的互斥锁
+  /// Mutex protecting the \c MCDisassembledSymbols
+  std::shared_mutex DisassembledSymbolsMutex{};
+
+  /// 保护 \c DirectBranchTargetLocations 的互斥锁
+  /// Mutex protecting the \c DirectBranchTargetLocations
+  std::shared_mutex BranchTargetsMutex{};
+
+  /// 保护 \c Relocations 的互斥锁
+  /// Mutex protecting the \c Relocations
+  std::shared_mutex RelocationsMutex{};
+
+  /// 保护 \c LiftedKernelSymbols 的互斥锁
+  /// Mutex protecting the \c LiftedKernelSymbols
+  std::shared_mutex LiftedKernelsMutex{};
 
   const rocprofiler::HsaApiTableSnapshot<::CoreApiTable> &CoreApiSnapshot;
 
@@ -133,6 +157,9 @@ private:
   struct DisassemblyInfo {
     std::unique_ptr<llvm::MCContext> Context;
     std::unique_ptr<llvm::MCDisassembler> DisAsm;
+    /// 串行化 \c DisAsm 的使用，因为 MC 反汇编器不是线程安全的
+    /// Serializes uses of \c DisAsm, as MC disassemblers are not thread-safe
+    std::mutex Mutex{};
 
     DisassemblyInfo() : Context(nullptr), DisAsm(nullptr) {};
 
@@ -141,9 +168,10 @@ private:
         : Context(std::move(Context)), DisAsm(std::move(DisAsm)) {};
   };
 
-  /// 包含每个 \c hsa_isa_t 缓存的 \c DisassemblyInfo
-  /// Contains the cached \c DisassemblyInfo for each \c hsa_isa_t
-  llvm::DenseMap<hsa_isa_t, DisassemblyInfo> DisassemblyInfoMap{};
+  /// 包含每个 \c hsa_isa_t 缓存的 \c DisassemblyInfo；条目的地址在插入其他条目后保持不变
+  /// Contains the cached \c DisassemblyInfo for each \c hsa_isa_t; Entries
+  /// keep their address when other entries are inserted
+  std::unordered_map<hsa_isa_t, DisassemblyInfo> DisassemblyInfoMap{};
 
   /// 成功时，返回与给定 \p ISA 关联的 \c DisassemblyInfo 的引用。如果在 \c DisassemblyInfoMap 中不存在则创建
   /// \param ISA 要获取的 \c DisassemblyInfo 的 \c hsa_isa_t
@@ -213,85 +241,95 @@ public:
                 std::is_same_v<ST, hsa::LoadedCodeObjectDeviceFunction> ||
                 std::is_same_v<ST, hsa::LoadedCodeObjectKernel>>>
   llvm::Expected<llvm::ArrayRef<hsa::Instr>> disassemble(const ST &Symbol) {
-    std::lock_guard Lock(CacheMutex);
-    if (!MCDisassembledSymbols.contains(&Symbol)) {
-      // 获取与符号关联的 ISA
-      // Get the ISA associated with the Symbol
-      hsa_loaded_code_object_t LCO = Symbol.getLoadedCodeObject();
-
-      llvm::Expected<luthier::object::AMDGCNObjectFile &> ObjFileOrErr =
-          hsa::LoadedCodeObjectCache::instance().getAssociatedObjectFile(LCO);
-      LUTHIER_RETURN_ON_ERROR(ObjFileOrErr.takeError());
-
-      auto LLVMIsa = object::getObjectFileTargetTuple(*ObjFileOrErr);
-      LUTHIER_RETURN_ON_ERROR(LLVMIsa.takeError());
-
-      auto ISA =
-          hsa::isaFromLLVM(CoreApiSnapshot.getTable(), std::get<0>(*LLVMIsa),
-                           std::get<1>(*LLVMIsa), std::get<2>(*LLVMIsa));
-      LUTHIER_RETURN_ON_ERROR(ISA.takeError());
-      // 在主机上定位符号的加载内容
-      // Locate the loaded contents of the symbol on the host
-      auto MachineCodeOnDevice =
-          Symbol.getLoadedSymbolContents(LoaderApiSnapshot.getTable());
-      LUTHIER_RETURN_ON_ERROR(MachineCodeOnDevice.takeError());
-      auto MachineCodeOnHost = hsa::convertToHostEquivalent(
-          LoaderApiSnapshot.getTable(), *MachineCodeOnDevice);
-      LUTHIER_RETURN_ON_ERROR(MachineCodeOnHost.takeError());
-
-      auto InstructionsAndAddresses = disassemble(*ISA, *MachineCodeOnHost);
-      LUTHIER_RETURN_ON_ERROR(InstructionsAndAddresses.takeError());
-      auto [Instructions, Addresses] = *InstructionsAndAddresses;
-
-      auto &Out =
-          MCDisassembledSymbols
-              .emplace(Symbol.clone(),
-                       std::make_unique<llvm::SmallVector<hsa::Instr>>())
-              .first->second;
-      Out->reserve(Instructions.size());
-
-      auto TargetInfo = TargetManager::instance().getTargetInfo(*ISA);
-      LUTHIER_RETURN_ON_ERROR(TargetInfo.takeError());
-
-      auto MII = TargetInfo->getMCInstrInfo();
-
-      auto BaseLoadedAddress =
-          reinterpret_cast<luthier::address_t>(MachineCodeOnDevice->data());
-
-      luthier::address_t PrevInstAddress = BaseLoadedAddress;
-
-      for (unsigned int I = 0; I < Instructions.size(); ++I) {
-        auto &Inst = Instructions[I];
-        auto Address = Addresses[I] + BaseLoadedAddress;
-        auto Size = Address - PrevInstAddress;
-        if (MII->get(Inst.getOpcode()).isBranch()) {
-          LLVM_DEBUG(
-
-              llvm::dbgs() << "Instruction ";
-              Inst.dump_pretty(llvm::dbgs(), TargetInfo->getMCInstPrinter(),
-                               " ", TargetInfo->getMCRegisterInfo());
-              llvm::dbgs() << llvm::formatv(
-                  " at idx {0}, address {1:x}, size {2} is a branch; "
-                  "Evaluating its target.\n",
-                  I, Address, Size);
-
-          );
-          luthier::address_t Target;
-          if (evaluateBranch(Inst, Address, Size, Target)) {
-            LLVM_DEBUG(llvm::dbgs() << llvm::formatv(
-                           "Evaluated address {0:x} as the branch target.\n",
-                           Target););
-            addDirectBranchTargetAddress(LCO, Target);
-          } else {
-            LLVM_DEBUG(llvm::dbgs()
-                       << "Failed to evaluate the branch target.\n");
+    using InstrVector = llvm::SmallVector<hsa::Instr>;
+    auto InstrsOrErr = lookupOrCompute(
+        DisassembledSymbolsMutex,
+        [&]() -> InstrVector * {
+          auto It = MCDisassembledSymbols.find(&Symbol);
+          return It != MCDisassembledSymbols.end() ? It->second.get()
+                                                   : nullptr;
+        },
+        // 在不持有锁的情况下反汇编符号
+        // Disassemble the symbol without holding the lock
+        [&]() -> llvm::Expected<std::unique_ptr<InstrVector>> {
+          // 获取与符号关联的 ISA
+          // Get the ISA associated with the Symbol
+          hsa_loaded_code_object_t LCO = Symbol.getLoadedCodeObject();
+
+          llvm::Expected<luthier::object::AMDGCNObjectFile &> ObjFileOrErr =
+              hsa::LoadedCodeObjectCache::instance().getAssociatedObjectFile(
+                  LCO);
+          LUTHIER_RETURN_ON_ERROR(ObjFileOrErr.takeError());
+
+          auto ISA = TargetManager::instance().getISA(*ObjFileOrErr);
+          LUTHIER_RETURN_ON_ERROR(ISA.takeError());
+          // 在主机上定位符号的加载内容
+          // Locate the loaded contents of the symbol on the host
+          auto MachineCodeOnDevice =
+              Symbol.getLoadedSymbolContents(LoaderApiSnapshot.getTable());
+          LUTHIER_RETURN_ON_ERROR(MachineCodeOnDevice.takeError());
+          auto MachineCodeOnHost = hsa::convertToHostEquivalent(
+              LoaderApiSnapshot.getTable(), *MachineCodeOnDevice);
+          LUTHIER_RETURN_ON_ERROR(MachineCodeOnHost.takeError());
+
+          auto InstructionsAndAddresses = disassemble(*ISA, *MachineCodeOnHost);
+          LUTHIER_RETURN_ON_ERROR(InstructionsAndAddresses.takeError());
+          auto [Instructions, Addresses] = *InstructionsAndAddresses;
+
+          auto Out = std::make_unique<InstrVector>();
+          Out->reserve(Instructions.size());
+
+          auto TargetInfo = TargetManager::instance().getTargetInfo(*ISA);
+          LUTHIER_RETURN_ON_ERROR(TargetInfo.takeError());
+
+          auto MII = TargetInfo->getMCInstrInfo();
+
+          auto BaseLoadedAddress =
+              reinterpret_cast<luthier::address_t>(MachineCodeOnDevice->data());
+
+          luthier::address_t PrevInstAddress = BaseLoadedAddress;
+
+          for (unsigned int I = 0; I < Instructions.size(); ++I) {
+            auto &Inst = Instructions[I];
+            auto Address = Addresses[I] + BaseLoadedAddress;
+            auto Size = Address - PrevInstAddress;
+            if (MII->get(Inst.getOpcode()).isBranch()) {
+              LLVM_DEBUG(
+
+                  llvm::dbgs() << "Instruction ";
+                  Inst.dump_pretty(llvm::dbgs(), TargetInfo->getMCInstPrinter(),
+                                   " ", TargetInfo->getMCRegisterInfo());
+                  llvm::dbgs() << llvm::formatv(
+                      " at idx {0}, address {1:x}, size {2} is a branch; "
+                      "Evaluating its target.\n",
+                      I, Address, Size);
+
+              );
+              luthier::address_t Target;
+              if (evaluateBranch(Inst, Address, Size, Target)) {
+                LLVM_DEBUG(llvm::dbgs() << llvm::formatv(
+                               "Evaluated address {0:x} as the branch "
+                               "target.\n",
+                               Target););
+                addDirectBranchTargetAddress(LCO, Target);
+              } else {
+                LLVM_DEBUG(llvm::dbgs()
+                           << "Failed to evaluate the branch target.\n");
+              }
+            }
+            PrevInstAddress = Address;
+            Out->push_back(hsa::Instr(Inst, Symbol, Address, Size));
           }
-        }
-        PrevInstAddress = Address;
-        Out->push_back(hsa::Instr(Inst, Symbol, Address, Size));
-      }
-    }
-    return *MCDisassembledSymbols.find(&Symbol)->second;
+          return Out;
+        },
+        // 如果另一个线程先反汇编了该符号，则丢弃我们的结果
+        // If another thread disassembled the symbol first, ours is discarded
+        [&](std::unique_ptr<InstrVector> Out) -> InstrVector & {
+          return *MCDisassembledSymbols.emplace(Symbol.clone(), std::move(Out))
+                      .first->second;
+        });
+    LUTHIER_RETURN_ON_ERROR(InstrsOrErr.takeError());
+    return *InstrsOrErr;
   }
 
   /// 为给定的 \p ISA 反汇编 \p code 封装的机器码
@@ -371,14 +409,26 @@ private:
   } LCORelocationInfo;
 
   /// 每个提升的 \c hsa::LoadedCodeObject 中每个加载地址的 \c LCORelocationInfo 信息缓存\n
-  /// 将所有部分的重定位信息组合到此映射中
+  /// 将所有部分的重定位信息组合到此映射中；条目的地址在插入其他条目后保持不变
   /// Cache of \c LCORelocationInfo information per loaded address in each
   /// lifted \c hsa::LoadedCodeObject\n
-  /// Combines relocation information from all sections into this map
-  llvm::DenseMap<hsa_loaded_code_object_t,
-                 llvm::DenseMap<address_t, LCORelocationInfo>>
+  /// Combines relocation information from all sections into this map;
+  /// Entries keep their address when other entries are inserted
+  std::unordered_map<hsa_loaded_code_object_t,
+                     llvm::DenseMap<address_t, LCORelocationInfo>>
       Relocations{};
 
+  /// 计算 \p LCO 中每个加载地址的 \c LCORelocationInfo，但不缓存它们
+  /// \param LCO 被查询的 \c hsa::LoadedCodeObject
+  /// \return 成功时返回 \p LCO 的重定位信息；失败时返回 \c llvm::Error
+  /// Computes the \c LCORelocationInfo of each loaded address of \p LCO
+  /// without caching them
+  /// \param LCO the \c hsa::LoadedCodeObject being queried
+  /// \return on success, the relocation information of \p LCO; an
+  /// \c llvm::Error on failure
+  llvm::Expected<llvm::DenseMap<address_t, LCORelocationInfo>>
+  computeRelocations(hsa_loaded_code_object_t LCO);
+
   /// 如果 \p address 没有与之关联的重定位信息，返回 \c std::nullopt，否则返回关联的 \c LCORelocationInfo
   /// \param LCO 在其加载范围内包含 \p Address 的 \c hsa::LoadedCodeObject
   /// \param Address 被查询的加载地址
@@ -83,7 +83,7 @@ private:
   hsa::PacketMonitor *PacketMonitor{nullptr};
 
 public:
-  explicit Context(hsa::PacketMonitor::CallbackType PacketCallback,
+  explicit Context(hsa::PacketMonitor::AnyCallbackType PacketCallback,
                    llvm::Error &Err);
 
   ~Context() override;
@@ -0,0 +1,224 @@
+//===-- DispatchBufferPool.h - Dispatch Buffer Pool -------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了调度缓冲区池，它为每个插桩调度分配一个插桩缓冲区，通过内核参数
+/// 缓冲区之后的用户参数区域将其地址传递给钩子，并在调度完成后将其交还给工具。
+/// This file describes the dispatch buffer pool, which allocates an
+/// instrumentation buffer for each instrumented dispatch, passes its address
+/// to hooks via the user argument area after the kernel argument buffer, and
+/// hands it back to the tool once the dispatch completes.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_DISPATCH_BUFFER_POOL_H
+#define LUTHIER_TOOLING_DISPATCH_BUFFER_POOL_H
+#include "luthier/HSA/DispatchCompletionNotifier.h"
+#include <cstdint>
+#include <functional>
+#include <hsa/hsa.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/FunctionExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MathExtras.h>
+#include <memory>
+#include <mutex>
+
+namespace luthier {
+
+/// \return 参数段大小为 \p KernArgSegmentSize 的内核的用户参数区域相对于其参数缓冲区
+/// 开头的偏移量；即插桩内核读取 \c USER_KERNARG_OFFSET 时得到的值
+/// \return the offset of the user argument area of a kernel with an argument
+/// segment of \p KernArgSegmentSize bytes, from the beginning of its argument
+/// buffer; i.e. the value read by instrumented kernels for
+/// \c USER_KERNARG_OFFSET
+inline uint32_t getUserKernArgOffset(uint32_t KernArgSegmentSize) {
+  return llvm::alignTo(KernArgSegmentSize, 8);
+}
+
+/// \brief 为单个调度从 \c DispatchBufferPool 获取的内存块
+/// \brief A chunk of memory acquired from a \c DispatchBufferPool for a
+/// single dispatch
+struct DispatchBuffer {
+  /// 扩展的内核参数缓冲区：原始内核参数的副本，后跟用户参数区域
+  /// The extended kernel argument buffer: a copy of the original kernel
+  /// arguments, followed by the user argument area
+  void *KernArgs{nullptr};
+  /// 插桩缓冲区的开头，其地址存储在用户参数区域的第一个条目中
+  /// Beginning of the instrumentation buffer, whose address is stored in the
+  /// first entry of the user argument area
+  uint8_t *Data{nullptr};
+  /// 整个内存块的字节数
+  /// Number of bytes of the entire chunk
+  uint64_t ChunkSize{0};
+};
+
+/// \brief 每个插桩调度的插桩缓冲区池
+/// \details 应用程序的运行时按原始内核的参数段大小分配内核参数缓冲区，因此无法就地追加
+/// 用户参数。相反，每个调度从池中获取一个内存块，其中包含原始内核参数的副本、
+/// 用户参数区域以及清零的插桩缓冲区，并将数据包的 \c kernarg_address 指向该副本。
+/// 调度完成后，通过 \c hsa::DispatchCompletionNotifier 将缓冲区交还给工具，然后
+/// 将内存块返回到池中以供重用。\n
+/// 内存块按二的幂大小分类，并由调用者提供的分配器分配；内存必须可被主机和设备访问，
+/// 并且可用作内核参数（例如，从设备的内核参数内存池中分配）。\n
+/// 池可以从多个线程（例如多个队列的数据包回调）并发使用
+/// \brief A pool of instrumentation buffers for each instrumented dispatch
+/// \details The runtime of the application allocates the kernel argument
+/// buffer with the argument segment size of the original kernel, so the user
+/// arguments cannot be appended in place. Instead, each dispatch acquires a
+/// chunk from the pool, holding a copy of the original kernel arguments, the
+/// user argument area, and a zeroed instrumentation buffer, and the
+/// \c kernarg_address of the packet is pointed at the copy. Once the dispatch
+/// completes, the buffer is handed back to the tool via a
+/// \c hsa::DispatchCompletionNotifier, and the chunk is returned to the pool
+/// to be reused.\n
+/// Chunks are binned by power of two sizes, and are allocated with an
+/// allocator provided by the caller; The memory must be accessible by both
+/// the host and the device, and be usable as kernel arguments (e.g.
+/// allocated from the kernarg memory pool of the device).\n
+/// The pool can be used concurrently from multiple threads (e.g. the packet
+/// callbacks of multiple queues)
+class DispatchBufferPool {
+public:
+  /// 分配内存块的函数类型；失败时返回 \c nullptr
+  /// Type of the function allocating chunks; Returns \c nullptr on failure
+  typedef std::function<void *(uint64_t Size)> AllocateFunc;
+
+  /// 释放内存块的函数类型
+  /// Type of the function freeing chunks
+  typedef std::function<void(void *Ptr)> DeallocateFunc;
+
+  /// 调度完成后对其插桩缓冲区调用的函数类型；缓冲区的内容仅在调用期间有效
+  /// Type of the function invoked on the instrumentation buffer of a dispatch
+  /// once it completes; The contents of the buffer are only valid for the
+  /// duration of the call
+  typedef llvm::unique_function<void(llvm::ArrayRef<uint8_t> Buffer)>
+      CompletionHandler;
+
+private:
+  /// 每个插桩缓冲区的字节数
+  /// Number of bytes of each instrumentation buffer
+  const uint64_t BufferSize;
+
+  /// 用于在调度完成时交还缓冲区
+  /// Used to hand back buffers once dispatches complete
+  hsa::DispatchCompletionNotifier &Notifier;
+
+  const AllocateFunc Allocate;
+
+  const DeallocateFunc Deallocate;
+
+  /// 保护 \c FreeChunks 和 \c NumChunks
+  /// Guards \c FreeChunks and \c NumChunks
+  std::mutex Mutex{};
+
+  /// 按大小分类的空闲内存块
+  /// Free chunks, binned by their size
+  llvm::DenseMap<uint64_t, llvm::SmallVector<void *, 0>> FreeChunks{};
+
+  /// 池分配的内存块总数
+  /// Total number of chunks allocated by the pool
+  size_t NumChunks{0};
+
+  DispatchBufferPool(uint64_t BufferSize,
+                     hsa::DispatchCompletionNotifier &Notifier,
+                     AllocateFunc Allocate, DeallocateFunc Deallocate)
+      : BufferSize(BufferSize), Notifier(Notifier),
+        Allocate(std::move(Allocate)), Deallocate(std::move(Deallocate)) {}
+
+  /// \return 参数段大小为 \p KernArgSegmentSize 的内核的内存块中插桩缓冲区的偏移量
+  /// \return the offset of the instrumentation buffer inside the chunk of a
+  /// kernel with an argument segment of \p KernArgSegmentSize bytes
+  static uint64_t getDataOffset(uint32_t KernArgSegmentSize);
+
+public:
+  /// 创建一个新的调度缓冲区池
+  /// \param BufferSize 每个插桩缓冲区的字节数；不能为零
+  /// \param Notifier 用于附加完成处理程序的通知器；必须比池存活更久
+  /// \param Allocate 用于分配内存块的函数
+  /// \param Deallocate 用于在池销毁时释放内存块的函数
+  /// \return 新创建的池，或者在参数无效时返回 \c llvm::Error
+  /// Creates a new dispatch buffer pool
+  /// \param BufferSize number of bytes of each instrumentation buffer; Must
+  /// not be zero
+  /// \param Notifier notifier used to attach the completion handlers; Must
+  /// outlive the pool
+  /// \param Allocate function used to allocate chunks
+  /// \param Deallocate function used to free chunks when the pool is
+  /// destroyed
+  /// \return the newly created pool, or an \c llvm::Error if the arguments
+  /// are invalid
+  static llvm::Expected<std::unique_ptr<DispatchBufferPool>>
+  create(uint64_t BufferSize, hsa::DispatchCompletionNotifier &Notifier,
+         AllocateFunc Allocate, DeallocateFunc Deallocate);
+
+  DispatchBufferPool(const DispatchBufferPool &) = delete;
+
+  DispatchBufferPool &operator=(const DispatchBufferPool &) = delete;
+
+  /// 等待所有挂起的调度完成，并释放所有内存块
+  /// Waits for all pending dispatches to complete, and frees all chunks
+  ~DispatchBufferPool();
+
+  /// \return 每个插桩缓冲区的字节数
+  /// \return the number of bytes of each instrumentation buffer
+  [[nodiscard]] uint64_t getBufferSize() const { return BufferSize; }
+
+  /// \return 池迄今分配的内存块数
+  /// \return the number of chunks allocated by the pool so far
+  [[nodiscard]] size_t getNumChunks();
+
+  /// 获取一个内存块：将 \p KernArgs 的 \p KernArgSegmentSize 字节复制到其中，
+  /// 将插桩缓冲区的地址写入用户参数区域，并将插桩缓冲区清零
+  /// \return 获取的缓冲区，或者在分配失败时返回 \c llvm::Error
+  /// Acquires a chunk: Copies \p KernArgSegmentSize bytes of \p KernArgs into
+  /// it, writes the address of the instrumentation buffer into the user
+  /// argument area, and zeroes the instrumentation buffer
+  /// \return the acquired buffer, or an \c llvm::Error if allocation failed
+  llvm::Expected<DispatchBuffer> acquire(const void *KernArgs,
+                                         uint32_t KernArgSegmentSize);
+
+  /// 将 \p Buffer 的内存块返回到池中；设备不得再访问它
+  /// Returns the chunk of \p Buffer to the pool; The device must not access
+  /// it anymore
+  void release(const DispatchBuffer &Buffer);
+
+  /// 为 \p Packet 描述的调度获取一个缓冲区，将其内核参数重定向到扩展副本，并在调度
+  /// 完成后对插桩缓冲区调用 \p OnCompletion，然后回收缓冲区；必须在数据包写入队列之前调用
+  /// \param Packet 拦截的调度数据包；其 \c kernarg_address 和 \c completion_signal
+  /// 被替换
+  /// \param KernArgSegmentSize 原始内核的参数段大小
+  /// \param OnCompletion 在调度完成后于 HSA 运行时的异步信号处理线程上调用的函数
+  /// \return 失败时返回 \c llvm::Error；在这种情况下数据包保持不变
+  /// Acquires a buffer for the dispatch described by \p Packet, redirects its
+  /// kernel arguments to the extended copy, and invokes \p OnCompletion on the
+  /// instrumentation buffer once the dispatch completes before recycling
+  /// the buffer; Must be called before the packet is written to its queue
+  /// \param Packet the intercepted dispatch packet; Its \c kernarg_address and
+  /// \c completion_signal are replaced
+  /// \param KernArgSegmentSize argument segment size of the original kernel
+  /// \param OnCompletion function invoked on the HSA runtime's asynchronous
+  /// signal handler thread once the dispatch completes
+  /// \return an \c llvm::Error on failure; The packet is left untouched in
+  /// that case
+  llvm::Error attach(hsa_kernel_dispatch_packet_t &Packet,
+                     uint32_t KernArgSegmentSize,
+                     CompletionHandler OnCompletion);
+};
+
+} // namespace luthier
+
+#endif
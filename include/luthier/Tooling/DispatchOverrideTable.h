@@ -0,0 +1,190 @@
+//===-- DispatchOverrideTable.h - Dispatch Override Table -------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了调度覆盖表，一个以读为主的哈希表，将原始内核对象和插桩预设映射到
+/// 预先计算的插桩内核对象和段大小，使调度时的查找无需加锁。
+/// This file describes the dispatch override table, a read-mostly hash table
+/// mapping an original kernel object and an instrumentation preset to the
+/// precomputed instrumented kernel object and segment sizes, so that lookups
+/// at dispatch time do not take any locks.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_DISPATCH_OVERRIDE_TABLE_H
+#define LUTHIER_TOOLING_DISPATCH_OVERRIDE_TABLE_H
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace luthier {
+
+/// 插桩预设名称的整数标识符
+/// Integer identifier of an instrumentation preset name
+typedef uint32_t InstrumentationPresetID;
+
+/// \brief 将调度切换到其插桩版本所需的、预先计算的数据包字段
+/// \brief The precomputed packet fields needed to switch a dispatch over to
+/// its instrumented version
+struct DispatchOverride {
+  /// 插桩内核的内核描述符地址
+  /// Address of the kernel descriptor of the instrumented kernel
+  uint64_t InstrumentedKernelObject{0};
+  /// 插桩内核的私有段大小
+  /// Private segment size of the instrumented kernel
+  uint32_t PrivateSegmentSize{0};
+  /// 插桩内核比原始内核多需要的静态 LDS 字节数
+  /// Number of static LDS bytes the instrumented kernel needs on top of the
+  /// original kernel
+  uint32_t GroupSegmentSizeIncrease{0};
+  /// 原始内核的参数段大小；用于定位用户参数区域
+  /// Argument segment size of the original kernel; Used to locate the user
+  /// argument area
+  uint32_t KernArgSegmentSize{0};
+  /// 原始内核是否使用动态大小的栈；如果是，则保留调度的私有段大小
+  /// Whether the original kernel uses a dynamically sized stack; If so, the
+  /// private segment size of the dispatch is kept
+  bool UsesDynamicStack{false};
+  /// 使用动态栈的内核的调度私有段所增加的字节数，用于为插桩栈腾出空间
+  /// Number of bytes the private segment of dispatches of kernels using a
+  /// dynamic stack grows by to make room for the instrumentation stack
+  uint32_t DynamicStackPrivateSegmentSizeIncrease{0};
+};
+
+/// \brief 从（原始内核对象，预设）到 \c DispatchOverride 的开放寻址哈希表
+/// \details 写入（插入和删除）由互斥锁串行化；查找不加锁，只需一次探测序列。\n
+/// 槽位只会从空变为就绪，再从就绪变为墓碑，且就绪后其内容不再改变；因此读者在
+/// 观察到就绪状态后可以安全地读取槽位。扩容时会发布一个新表，旧表保留到
+/// 本对象销毁为止，以便仍在旧表中探测的读者不会访问已释放的内存
+/// \brief Open-addressing hash table from (original kernel object, preset) to
+/// \c DispatchOverride
+/// \details Writes (insertions and erasures) are serialized by a mutex;
+/// Lookups take no locks and only require a single probe sequence.\n
+/// Slots only go from empty to ready, and from ready to tombstone, and their
+/// contents never change once ready; Hence readers can safely read a slot
+/// after observing it is ready. Growing the table publishes a new table,
+/// and the old one is retired until this object is destroyed, so that
+/// readers still probing it never access freed memory
+class DispatchOverrideTable {
+private:
+  enum SlotState : uint32_t { SLOT_EMPTY = 0, SLOT_READY, SLOT_TOMBSTONE };
+
+  struct Slot {
+    std::atomic<uint32_t> State{SLOT_EMPTY};
+    InstrumentationPresetID Preset{0};
+    uint64_t OriginalKernelObject{0};
+    DispatchOverride Override{};
+  };
+
+  struct Table {
+    /// 槽位数减一；槽位数总是二的幂
+    /// Number of slots minus one; The number of slots is always a power of 2
+    const uint64_t Mask;
+    const std::unique_ptr<Slot[]> Slots;
+    /// 就绪或墓碑槽位的数量；仅由写者访问
+    /// Number of ready or tombstone slots; Only accessed by writers
+    uint64_t NumUsedSlots{0};
+    /// 就绪槽位的数量；仅由写者访问
+    /// Number of ready slots; Only accessed by writers
+    uint64_t NumReadySlots{0};
+
+    explicit Table(uint64_t NumSlots)
+        : Mask(NumSlots - 1), Slots(new Slot[NumSlots]) {}
+  };
+
+  /// 读者探测的当前表
+  /// The current table probed by readers
+  std::atomic<const Table *> CurrentTable;
+
+  /// 串行化对表的写入
+  /// Serializes writes to the table
+  std::mutex WriterMutex{};
+
+  /// 当前表和所有已退役的表
+  /// The current table and all retired tables
+  std::vector<std::unique_ptr<Table>> Tables{};
+
+  static uint64_t hash(uint64_t OriginalKernelObject,
+                       InstrumentationPresetID Preset) {
+    // Kernel descriptors are 64-byte aligned; Drop the always-zero bits
+    // before mixing in the preset
+    uint64_t H = (OriginalKernelObject >> 6) ^
+                 (static_cast<uint64_t>(Preset) * 0x9E3779B97F4A7C15ULL);
+    H *= 0xFF51AFD7ED558CCDULL;
+    return H ^ (H >> 32);
+  }
+
+  /// 将所有就绪槽位复制到一个至少有 \p MinNumSlots 个槽位的新表中并发布它；
+  /// 调用者必须持有 \c WriterMutex
+  /// Copies all ready slots into a new table with at least \p MinNumSlots
+  /// slots and publishes it; The caller must hold the \c WriterMutex
+  Table &rehash(uint64_t MinNumSlots);
+
+public:
+  /// \param InitialNumSlots 初始槽位数，向上取整为二的幂
+  /// \param InitialNumSlots initial number of slots, rounded up to a power
+  /// of 2
+  explicit DispatchOverrideTable(uint64_t InitialNumSlots = 64);
+
+  DispatchOverrideTable(const DispatchOverrideTable &) = delete;
+
+  DispatchOverrideTable &operator=(const DispatchOverrideTable &) = delete;
+
+  /// 不加锁地查找 \p OriginalKernelObject 在 \p Preset 下的覆盖
+  /// \return 找到的覆盖，如果不存在则返回 \c std::nullopt
+  /// Looks up the override of \p OriginalKernelObject under \p Preset without
+  /// taking any locks
+  /// \return the override if found, or \c std::nullopt otherwise
+  [[nodiscard]] std::optional<DispatchOverride>
+  lookup(uint64_t OriginalKernelObject, InstrumentationPresetID Preset) const {
+    const Table &T = *CurrentTable.load(std::memory_order_acquire);
+    // The load factor of the table is kept under 1/2, so the probe always
+    // reaches an empty slot
+    for (uint64_t I = hash(OriginalKernelObject, Preset) & T.Mask;;
+         I = (I + 1) & T.Mask) {
+      const Slot &S = T.Slots[I];
+      uint32_t State = S.State.load(std::memory_order_acquire);
+      if (State == SLOT_EMPTY)
+        return std::nullopt;
+      if (State == SLOT_READY &&
+          S.OriginalKernelObject == OriginalKernelObject &&
+          S.Preset == Preset)
+        return S.Override;
+    }
+  }
+
+  /// 插入 \p OriginalKernelObject 在 \p Preset 下的 \p Override
+  /// \return 如果插入成功则返回 \c true；如果已存在条目则返回 \c false
+  /// Inserts the \p Override of \p OriginalKernelObject under \p Preset
+  /// \return \c true if inserted, \c false if an entry already exists
+  bool insert(uint64_t OriginalKernelObject, InstrumentationPresetID Preset,
+              const DispatchOverride &Override);
+
+  /// 删除 \p OriginalKernelObject 在所有预设下的覆盖
+  /// \return 删除的条目数
+  /// Erases the overrides of \p OriginalKernelObject under all presets
+  /// \return the number of entries erased
+  size_t erase(uint64_t OriginalKernelObject);
+
+  /// \return 表中的条目数
+  /// \return the number of entries in the table
+  [[nodiscard]] size_t size();
+};
+
+} // namespace luthier
+
+#endif
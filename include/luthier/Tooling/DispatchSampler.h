@@ -0,0 +1,264 @@
+//===-- DispatchSampler.h - Luthier Dispatch Sampler ------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了调度采样策略和调度采样器，用于决定内核的哪些调度以插桩版本启动。
+/// This file describes dispatch sampling policies and the dispatch sampler,
+/// used to decide which dispatches of a kernel are launched with its
+/// instrumented version.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_DISPATCH_SAMPLER_H
+#define LUTHIER_TOOLING_DISPATCH_SAMPLER_H
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <hsa/hsa.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/Support/Error.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+
+namespace luthier {
+
+/// \brief 描述内核的哪些调度被采样（即以插桩版本启动）
+/// \details 除谓词策略外，每个策略都针对每个内核单独应用
+/// \brief Describes which dispatches of a kernel are sampled (i.e. launched
+/// with their instrumented version)
+/// \details Except for the predicate policy, each policy applies to each
+/// kernel separately
+class DispatchSamplingPolicy {
+public:
+  /// 对调度数据包的用户谓词类型
+  /// Type of the user predicate over dispatch packets
+  typedef std::function<bool(const hsa_kernel_dispatch_packet_t &Packet)>
+      PredicateFunc;
+
+  enum PolicyKind {
+    /// 采样每个调度
+    /// Samples every dispatch
+    ALL,
+    /// 采样每个内核的第 1、N+1、2N+1... 个调度
+    /// Samples the 1st, N+1th, 2N+1th, ... dispatch of each kernel
+    EVERY_NTH,
+    /// 采样每个内核的前 K 个调度
+    /// Samples the first K dispatches of each kernel
+    FIRST_K,
+    /// 在每个挂钟时间窗口内，最多采样每个内核的 K 个调度
+    /// Samples at most K dispatches of each kernel inside each window of
+    /// wall-clock time
+    TIME_BUDGET,
+    /// 采样用户谓词返回 \c true 的调度
+    /// Samples the dispatches the user predicate returns \c true for
+    PREDICATE
+  };
+
+private:
+  PolicyKind Kind;
+
+  /// \c EVERY_NTH 的 N，或 \c FIRST_K 和 \c TIME_BUDGET 的 K
+  /// N of \c EVERY_NTH, or K of \c FIRST_K and \c TIME_BUDGET
+  uint64_t Count{0};
+
+  /// \c TIME_BUDGET 的时间窗口
+  /// Time window of \c TIME_BUDGET
+  std::chrono::nanoseconds Window{0};
+
+  /// \c PREDICATE 的用户谓词
+  /// User predicate of \c PREDICATE
+  PredicateFunc Predicate{};
+
+  DispatchSamplingPolicy(PolicyKind Kind, uint64_t Count,
+                         std::chrono::nanoseconds Window,
+                         PredicateFunc Predicate)
+      : Kind(Kind), Count(Count), Window(Window),
+        Predicate(std::move(Predicate)) {}
+
+public:
+  /// \return 采样每个调度的策略
+  /// \return a policy sampling every dispatch
+  static DispatchSamplingPolicy all() { return {ALL, 0, {}, {}}; }
+
+  /// \return 采样每个内核每 \p N 个调度中的一个的策略，从第一个调度开始
+  /// \return a policy sampling one in every \p N dispatches of each kernel,
+  /// starting from the first one
+  static DispatchSamplingPolicy everyNth(uint64_t N) {
+    return {EVERY_NTH, N, {}, {}};
+  }
+
+  /// \return 采样每个内核前 \p K 个调度的策略
+  /// \return a policy sampling the first \p K dispatches of each kernel
+  static DispatchSamplingPolicy firstK(uint64_t K) {
+    return {FIRST_K, K, {}, {}};
+  }
+
+  /// \return 在每个 \p Window 挂钟时间内最多采样每个内核 \p K 个调度的策略；
+  /// 插桩的开销因此受限于采样率，而与内核的调度频率无关
+  /// \return a policy sampling at most \p K dispatches of each kernel in each
+  /// \p Window of wall-clock time; The overhead of instrumentation is hence
+  /// bounded by the sampling rate, regardless of how often the kernel is
+  /// dispatched
+  static DispatchSamplingPolicy timeBudget(uint64_t K,
+                                           std::chrono::nanoseconds Window) {
+    return {TIME_BUDGET, K, Window, {}};
+  }
+
+  /// \return 采样 \p Predicate 返回 \c true 的调度的策略
+  /// \return a policy sampling the dispatches \p Predicate returns \c true for
+  static DispatchSamplingPolicy predicate(PredicateFunc Predicate) {
+    return {PREDICATE, 0, {}, std::move(Predicate)};
+  }
+
+  [[nodiscard]] PolicyKind getKind() const { return Kind; }
+
+  [[nodiscard]] uint64_t getCount() const { return Count; }
+
+  [[nodiscard]] std::chrono::nanoseconds getWindow() const { return Window; }
+
+  [[nodiscard]] const PredicateFunc &getPredicate() const { return Predicate; }
+};
+
+/// \brief 一个内核的调度计数和采样计数
+/// \brief Number of dispatches and samples of a kernel
+struct DispatchSampleCounts {
+  /// 内核被调度的次数
+  /// Number of times the kernel was dispatched
+  uint64_t NumDispatches{0};
+  /// 被采样的调度数
+  /// Number of dispatches sampled
+  uint64_t NumSampled{0};
+
+  /// 将在采样的调度上测量的 \p SampledTotal 外推到内核的所有调度
+  /// \return 外推的总数，如果没有调度被采样则返回零
+  /// Extrapolates the \p SampledTotal measured over the sampled dispatches
+  /// to all dispatches of the kernel
+  /// \return the extrapolated total, or zero if no dispatch was sampled
+  [[nodiscard]] double extrapolate(double SampledTotal) const {
+    if (NumSampled == 0)
+      return 0;
+    return SampledTotal * static_cast<double>(NumDispatches) /
+           static_cast<double>(NumSampled);
+  }
+};
+
+/// \brief 将 \c DispatchSamplingPolicy 应用于拦截的调度数据包，并跟踪每个内核的
+/// 采样计数
+/// \details 内核由其原始的 \c kernel_object 标识；因此必须在数据包被
+/// \c overrideWithInstrumented 修改之前对其进行采样。\n
+/// 采样器可以从多个线程（例如多个队列的数据包回调）并发使用
+/// \brief Applies a \c DispatchSamplingPolicy to intercepted dispatch
+/// packets, and keeps track of the sample counts of each kernel
+/// \details Kernels are identified by their original \c kernel_object;
+/// Packets must hence be sampled before they are modified by
+/// \c overrideWithInstrumented.\n
+/// The sampler can be used concurrently from multiple threads (e.g. the
+/// packet callbacks of multiple queues)
+class DispatchSampler {
+public:
+  /// 返回当前时间的函数类型；可在测试中替换
+  /// Type of the function returning the current time; Can be replaced in
+  /// tests
+  typedef std::function<std::chrono::steady_clock::time_point()> ClockFunc;
+
+private:
+  /// 每个内核的采样状态
+  /// Sampling state of each kernel
+  struct KernelSamplingState {
+    std::atomic<uint64_t> NumDispatches{0};
+    std::atomic<uint64_t> NumSampled{0};
+    /// 保护 \c TIME_BUDGET 的时间窗口
+    /// Guards the time window of \c TIME_BUDGET
+    std::mutex WindowMutex{};
+    /// 当前时间窗口的开始时间；在内核的第一次调度之前为空
+    /// Start of the current time window; Empty before the first dispatch of
+    /// the kernel
+    std::optional<std::chrono::steady_clock::time_point> WindowStart{};
+    uint64_t NumSampledInWindow{0};
+  };
+
+  const DispatchSamplingPolicy Policy;
+
+  const ClockFunc Clock;
+
+  /// 保护 \c KernelStates 的插入
+  /// Guards insertions into \c KernelStates
+  mutable std::shared_mutex KernelStatesMutex{};
+
+  /// 原始 \c kernel_object 到其采样状态的映射
+  /// Mapping between the original \c kernel_object and its sampling state
+  llvm::DenseMap<uint64_t, std::unique_ptr<KernelSamplingState>>
+      KernelStates{};
+
+  DispatchSampler(DispatchSamplingPolicy Policy, ClockFunc Clock)
+      : Policy(std::move(Policy)), Clock(std::move(Clock)) {}
+
+  /// \return \p KernelObject 的采样状态，必要时创建
+  /// \return the sampling state of \p KernelObject, created if needed
+  KernelSamplingState &getOrCreateKernelState(uint64_t KernelObject);
+
+  /// \return 在 \p State 的时间窗口内是否还有剩余预算；如果有，则消耗一个
+  /// \return whether there is budget left inside the time window of
+  /// \p State; If so, consumes it
+  bool consumeTimeBudget(KernelSamplingState &State);
+
+public:
+  /// 创建一个新的调度采样器
+  /// \param Policy 要应用的采样策略
+  /// \param Clock 返回当前时间的函数；仅由 \c TIME_BUDGET 策略使用
+  /// \return 新创建的采样器，如果 \p Policy 的参数无效则返回 \c llvm::Error
+  /// Creates a new dispatch sampler
+  /// \param Policy the sampling policy to be applied
+  /// \param Clock function returning the current time; Only used by the
+  /// \c TIME_BUDGET policy
+  /// \return the newly created sampler, or an \c llvm::Error if the
+  /// parameters of \p Policy are invalid
+  static llvm::Expected<std::unique_ptr<DispatchSampler>>
+  create(DispatchSamplingPolicy Policy,
+         ClockFunc Clock = std::chrono::steady_clock::now);
+
+  DispatchSampler(const DispatchSampler &) = delete;
+
+  DispatchSampler &operator=(const DispatchSampler &) = delete;
+
+  /// 决定 \p Packet 描述的调度是否被采样，并更新其内核的计数
+  /// \param Packet 拦截的、尚未被修改的调度数据包
+  /// \return 如果调度应以插桩版本启动，则返回 \c true
+  /// Decides whether the dispatch described by \p Packet is sampled, and
+  /// updates the counts of its kernel
+  /// \param Packet the intercepted dispatch packet, not yet modified
+  /// \return \c true if the dispatch should be launched with its
+  /// instrumented version
+  bool sample(const hsa_kernel_dispatch_packet_t &Packet);
+
+  /// \return 原始 \c kernel_object 为 \p KernelObject 的内核的采样计数
+  /// \return the sample counts of the kernel with the original
+  /// \c kernel_object of \p KernelObject
+  [[nodiscard]] DispatchSampleCounts getCounts(uint64_t KernelObject) const;
+
+  /// 对每个已调度的内核及其采样计数调用 \p Callback
+  /// Invokes \p Callback on each dispatched kernel and its sample counts
+  void forEachKernel(
+      llvm::function_ref<void(uint64_t KernelObject,
+                              const DispatchSampleCounts &Counts)>
+          Callback) const;
+};
+
+} // namespace luthier
+
+#endif
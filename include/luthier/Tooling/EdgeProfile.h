@@ -0,0 +1,141 @@
+//===-- EdgeProfile.h - Edge Profiling Counter Placement --------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了边剖析计数器的放置，以及从计数器值重建所有边和块执行次数的主机端求解器。
+/// This file describes the placement of edge profiling counters, and the
+/// host-side solver which reconstructs the execution count of all edges and
+/// blocks from the counter values.
+/// \details 放置方式遵循 Knuth 和 Ball-Larus 的方法：在控制流图上（加上从每个出口块到虚拟出口块，
+/// 以及从虚拟出口块到入口块的虚拟边）构建最大生成树，只有不在树上的边才需要计数器；
+/// 树边的执行次数由流守恒离线求出
+/// The placement follows Knuth and Ball-Larus: A maximum spanning tree is
+/// built over the control flow graph, plus virtual edges from each exit block
+/// to a virtual exit block and from the virtual exit block to the entry
+/// block; Only edges not in the tree require a counter, and the execution
+/// count of the tree edges is solved offline using flow conservation
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_EDGE_PROFILE_H
+#define LUTHIER_TOOLING_EDGE_PROFILE_H
+#include <cstdint>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Error.h>
+
+namespace luthier {
+
+/// 控制流图的一条边
+/// An edge of a control flow graph
+struct ProfileEdge {
+  /// 源块的索引
+  /// Index of the source block
+  unsigned Src;
+  /// 目标块的索引
+  /// Index of the destination block
+  unsigned Dst;
+  /// 边的估计执行频率；频繁的边优先放在生成树上，从而不携带计数器
+  /// Estimated execution frequency of the edge; Frequent edges are placed in
+  /// the spanning tree first, so that they don't carry a counter
+  uint64_t Weight{1};
+};
+
+/// 控制流图上边剖析计数器的放置
+/// Placement of edge profiling counters over a control flow graph
+struct EdgeCounterPlacement {
+  /// 控制流图中块的数量，不包括虚拟出口块；虚拟出口块的索引为 \c NumBlocks
+  /// Number of blocks in the control flow graph, excluding the virtual exit
+  /// block; The virtual exit block has the index \c NumBlocks
+  unsigned NumBlocks{0};
+  /// 控制流图的边，后面是从每个出口块到虚拟出口块的边，最后一条边是从虚拟出口块到入口块的边
+  /// The edges of the control flow graph, followed by an edge from each exit
+  /// block to the virtual exit block; The last edge goes from the virtual
+  /// exit block to the entry block
+  llvm::SmallVector<ProfileEdge> Edges{};
+  /// 携带计数器的边在 \c Edges 中的索引，按升序排列；第 \c I 个计数器位于
+  /// <tt>Edges[CounterEdges[I]]</tt>
+  /// Indices of the edges carrying a counter in \c Edges, in ascending order;
+  /// Counter \c I is placed on <tt>Edges[CounterEdges[I]]</tt>
+  llvm::SmallVector<unsigned> CounterEdges{};
+
+  /// \return 如果 \p Edge 通向虚拟出口块则返回 \c true
+  /// \return \c true if \p Edge goes to the virtual exit block
+  [[nodiscard]] bool isExitEdge(const ProfileEdge &Edge) const {
+    return Edge.Dst == NumBlocks;
+  }
+};
+
+/// 计算控制流图的最小边剖析计数器放置
+/// \details 需要的计数器数量为边数（包括虚拟边）减去块数（包括虚拟出口块）再加上连通分量数；
+/// 从虚拟出口块到入口块的边总是在生成树上，因此永远不需要插桩
+/// \param NumBlocks 控制流图中块的数量
+/// \param EntryBlock 入口块的索引
+/// \param Edges 控制流图的边
+/// \param ExitBlocks 离开函数的块（例如以返回指令结束的块）
+/// \return 计数器的放置；如果某个块索引超出范围则返回 \c llvm::Error
+/// Calculates the minimal placement of edge profiling counters of a control
+/// flow graph
+/// \details The number of counters required is the number of edges
+/// (including the virtual ones), minus the number of blocks (including the
+/// virtual exit block), plus the number of connected components; The edge
+/// from the virtual exit block to the entry block is always in the spanning
+/// tree, and therefore is never instrumented
+/// \param NumBlocks number of blocks in the control flow graph
+/// \param EntryBlock index of the entry block
+/// \param Edges edges of the control flow graph
+/// \param ExitBlocks blocks leaving the function (e.g. blocks ending with a
+/// return instruction)
+/// \return the placement of the counters; An \c llvm::Error if a block index
+/// is out of range
+llvm::Expected<EdgeCounterPlacement>
+placeEdgeCounters(unsigned NumBlocks, unsigned EntryBlock,
+                  llvm::ArrayRef<ProfileEdge> Edges,
+                  llvm::ArrayRef<unsigned> ExitBlocks);
+
+/// 从计数器值重建 \p Placement 每条边的执行次数
+/// \param Placement 计数器的放置
+/// \param Counters 每个计数器的值，顺序与 <tt>Placement.CounterEdges</tt> 相同
+/// \return 每条边的执行次数，顺序与 <tt>Placement.Edges</tt> 相同；如果计数器值违反流守恒
+/// 则返回 \c llvm::Error
+/// Reconstructs the execution count of every edge of \p Placement from the
+/// counter values
+/// \param Placement the placement of the counters
+/// \param Counters the value of each counter, in the same order as
+/// <tt>Placement.CounterEdges</tt>
+/// \return the execution count of every edge, in the same order as
+/// <tt>Placement.Edges</tt>; An \c llvm::Error if the counter values violate
+/// flow conservation
+llvm::Expected<llvm::SmallVector<uint64_t>>
+reconstructEdgeCounts(const EdgeCounterPlacement &Placement,
+                      llvm::ArrayRef<uint64_t> Counters);
+
+/// 从计数器值重建 \p Placement 每个块的执行次数，即其所有入边执行次数之和
+/// \param Placement 计数器的放置
+/// \param Counters 每个计数器的值，顺序与 <tt>Placement.CounterEdges</tt> 相同
+/// \return 每个块的执行次数，不包括虚拟出口块；如果计数器值违反流守恒则返回 \c llvm::Error
+/// Reconstructs the execution count of every block of \p Placement from the
+/// counter values, i.e. the sum of the execution count of its incoming edges
+/// \param Placement the placement of the counters
+/// \param Counters the value of each counter, in the same order as
+/// <tt>Placement.CounterEdges</tt>
+/// \return the execution count of every block, excluding the virtual exit
+/// block; An \c llvm::Error if the counter values violate flow conservation
+llvm::Expected<llvm::SmallVector<uint64_t>>
+reconstructBlockCounts(const EdgeCounterPlacement &Placement,
+                       llvm::ArrayRef<uint64_t> Counters);
+
+} // namespace luthier
+
+#endif
@@ -0,0 +1,76 @@
+//===-- HookPredication.h - Injected Payload Enable Guards ------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了用钩子启用掩码检查保护注入负载的函数。
+/// This file describes the function guarding injected payloads with a check
+/// of the hook enable mask.
+/// \details 钩子启用掩码是工具设备代码中的一个全局字，主机可以在插桩内核运行时
+/// 修改它，而无需重新插桩或修改调度数据包
+/// The hook enable mask is a global word in the device code of the tool,
+/// which the host can flip while instrumented kernels run, without
+/// re-instrumenting or modifying dispatch packets
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_HOOK_PREDICATION_H
+#define LUTHIER_TOOLING_HOOK_PREDICATION_H
+#include <cstdint>
+#include <llvm/CodeGen/LivePhysRegs.h>
+#include <llvm/CodeGen/MachineFunction.h>
+#include <llvm/IR/GlobalValue.h>
+#include <llvm/Support/Error.h>
+
+namespace luthier {
+
+/// 在已分配寄存器的注入负载 \p PayloadMF 之前插入一个保护块，当 \p EnableMask
+/// 与 \p PayloadMask 没有共同置位的位时跳过整个负载
+/// \details 保护块以 GLC 加载掩码以绕过标量缓存，使主机端的更新对下一个执行到负载的
+/// 波前可见；保护块只写入从 \p UsedRegs 之外挑选的 SGPR，并且只等待标量内存访问；
+/// 如果 \p IsSCCLive，SCC 会先保存到其中一个 SGPR，并在负载和跳过路径上都恢复，
+/// 因此被跳过的负载不会触及应用程序的任何状态。保护块必须是负载的第一段代码，
+/// 即放在状态值数组加载和寄存器保存之前
+/// \param PayloadMF 要保护的注入负载
+/// \param EnableMask 钩子启用掩码全局变量
+/// \param PayloadMask 启用该负载的掩码位
+/// \param UsedRegs 保护块不能写入的寄存器；挑选的寄存器会被加入其中
+/// \param IsSCCLive SCC 在插桩点是否活跃
+/// \return 如果找不到空闲的 SGPR 或负载没有返回块，则返回 \c llvm::Error
+/// Inserts a guard block before the register allocated injected payload
+/// \p PayloadMF, which skips the whole payload when the \p EnableMask has
+/// no bits in common with the \p PayloadMask
+/// \details The guard loads the mask with GLC to bypass the scalar cache,
+/// so that updates from the host are seen by the next wavefront reaching
+/// the payload; The guard only writes to SGPRs picked outside \p UsedRegs, and
+/// only waits on scalar memory accesses; If \p IsSCCLive, SCC is first saved
+/// into one of the SGPRs and restored on both the payload and the skip
+/// paths, so a skipped payload touches none of the application's state. The
+/// guard must be the first code of the payload, i.e. placed before the state
+/// value array is loaded or any registers are saved
+/// \param PayloadMF the injected payload to be guarded
+/// \param EnableMask the hook enable mask global variable
+/// \param PayloadMask the bits of the mask enabling the payload
+/// \param UsedRegs the registers the guard must not write to; The picked
+/// registers are added to it
+/// \param IsSCCLive whether SCC is live at the instrumentation point
+/// \return an \c llvm::Error if no free SGPRs were found, or the payload has
+/// no return block
+llvm::Error emitHookEnableGuard(llvm::MachineFunction &PayloadMF,
+                                const llvm::GlobalValue &EnableMask,
+                                uint32_t PayloadMask,
+                                llvm::LivePhysRegs &UsedRegs, bool IsSCCLive);
+
+} // namespace luthier
+
+#endif
@@ -0,0 +1,55 @@
+//===-- HookSpecialization.h - Call Site Hook Specialization ----*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了将钩子调用针对其所在注入负载的调用点进行特化的函数。
+/// This file describes the function specializing the hook calls of an
+/// injected payload to their call site.
+/// \details 特化在 IR 优化流水线之前进行，因此即使在较低的优化级别下，
+/// 钩子的常量参数也会被传播到其函数体中
+/// Specialization happens before the IR optimization pipeline, so that the
+/// constant arguments of hooks are propagated into their bodies even at lower
+/// optimization levels
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_HOOK_SPECIALIZATION_H
+#define LUTHIER_TOOLING_HOOK_SPECIALIZATION_H
+#include <llvm/IR/Function.h>
+#include <llvm/Support/Error.h>
+
+namespace luthier {
+
+/// 将 \p InjectedPayload 中的每个钩子调用内联，并将调用点的常量参数折叠到钩子体中
+/// \details 常量条件为假的分支会被删除，未使用的 <tt>luthier::readReg</tt>
+/// 调用也会被删除，因此不会读取钩子不使用的寄存器参数；外联钩子不会被特化，
+/// 因为它们的机器代码由所有注入负载共享
+/// \param InjectedPayload 要特化的注入负载函数
+/// \return 如果特化后注入负载除返回外不包含任何指令，即在其插桩点不需要注入任何代码，
+/// 则返回 \c true；如果无法内联钩子，则返回 \c llvm::Error
+/// Inlines every hook call inside the \p InjectedPayload and folds the
+/// constant arguments of the call site into the hook body
+/// \details Branches on constant false conditions are removed, and so are
+/// unused calls to <tt>luthier::readReg</tt>, so register arguments not used
+/// by the hook are never read; Outlined hooks are not specialized, as their
+/// machine code is shared by all injected payloads
+/// \param InjectedPayload the injected payload function to be specialized
+/// \return \c true if the injected payload contains nothing but a return
+/// after specialization, meaning no code needs to be injected at its
+/// instrumentation point; An \c llvm::Error if a hook could not be inlined
+llvm::Expected<bool> specializeHookCalls(llvm::Function &InjectedPayload);
+
+} // namespace luthier
+
+#endif
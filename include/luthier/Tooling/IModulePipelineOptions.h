@@ -0,0 +1,140 @@
+//===-- IModulePipelineOptions.h --------------------------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file describes the <tt>IModulePipelineOptions</tt>, which control
+/// the IR and MIR pipelines run over the instrumentation module during
+/// code generation.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_IMODULE_PIPELINE_OPTIONS_H
+#define LUTHIER_TOOLING_IMODULE_PIPELINE_OPTIONS_H
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/CodeGen.h>
+#include <llvm/Support/Error.h>
+#include <string>
+
+namespace llvm {
+class PassBuilder;
+} // namespace llvm
+
+namespace luthier {
+
+/// \brief The kind of IR optimization pipeline run over the
+/// instrumentation module
+enum class IModuleIRPipelineKind {
+  O0 = 0,     ///< LLVM's default O0 pipeline
+  O1 = 1,     ///< LLVM's default O1 pipeline
+  O2 = 2,     ///< LLVM's default O2 pipeline
+  O3 = 3,     ///< LLVM's default O3 pipeline
+  FAST = 4,   ///< Only inlining, mem2reg, instcombine and simplifycfg; Intended
+              ///< for tools with trivial hooks where compile time matters
+              ///< more than the quality of the injected payloads
+  CUSTOM = 5, ///< A user-provided textual pass pipeline (e.g.
+              ///< <tt>"function(sroa,instcombine)"</tt>)
+};
+
+/// \brief How injected payloads are guarded by the hook enable mask, a
+/// device global word the host can flip while instrumented kernels run
+enum class HookPredicationKind {
+  NONE = 0,     ///< Injected payloads always run
+  GLOBAL = 1,   ///< Injected payloads are skipped when the enable mask is
+                ///< zero
+  PER_HOOK = 2, ///< Each hook owns a bit of the enable mask; Injected
+                ///< payloads are skipped when the bits of all their hooks
+                ///< are cleared
+};
+
+/// \brief Options controlling how the instrumentation module is compiled
+/// into injected payloads
+/// \details Each \c InstrumentationTask carries its own copy of these
+/// options, initialized from the command line defaults (see
+/// <tt>getDefault</tt>); A mutator function can override them per
+/// \c instrument call or per preset
+struct IModulePipelineOptions {
+  /// The IR pipeline to run over the instrumentation module
+  IModuleIRPipelineKind IRPipeline{IModuleIRPipelineKind::O3};
+  /// The textual IR pipeline; Only used when \c IRPipeline is
+  /// <tt>IModuleIRPipelineKind::CUSTOM</tt>
+  std::string CustomIRPipeline{};
+  /// The optimization level used by the legacy code gen pipeline run on the
+  /// instrumentation module
+  llvm::CodeGenOptLevel MIROptLevel{llvm::CodeGenOptLevel::Aggressive};
+  /// Maximum number of threads used to generate machine code for the
+  /// injected payloads; When greater than one, the injected payloads are
+  /// split into shards in program order, and each shard is compiled by a
+  /// separate worker with its own \c llvm::LLVMContext and target machine;
+  /// Injected payloads calling outlined hooks are always compiled in the
+  /// first shard, alongside the hooks
+  unsigned CodeGenThreads{1};
+  /// Whether the hook calls of each injected payload are specialized to
+  /// their call site before running the IR pipeline; Constant arguments are
+  /// then folded into the hooks regardless of the pipeline, and injected
+  /// payloads left empty are not injected at all
+  bool SpecializeHookCalls{true};
+  /// Whether each injected payload is guarded by a check of the hook enable
+  /// mask; The check runs before the payload loads the state value array or
+  /// saves any registers, so a disabled payload only costs a scalar load and
+  /// a branch. Adjacent injected payloads don't share their state value
+  /// array loads when guarded, as each of them can be skipped on its own
+  HookPredicationKind HookPredication{HookPredicationKind::NONE};
+
+  /// \return the pipeline options specified via the
+  /// <tt>-luthier-imodule-ir-pipeline</tt>,
+  /// <tt>-luthier-imodule-ir-passes</tt>,
+  /// <tt>-luthier-imodule-codegen-opt-level</tt>,
+  /// <tt>-luthier-imodule-codegen-threads</tt>,
+  /// <tt>-luthier-imodule-specialize-hook-calls</tt>, and
+  /// <tt>-luthier-imodule-hook-predication</tt> command line options
+  static IModulePipelineOptions getDefault();
+
+  /// Adds the IR optimization pipeline described by \c IRPipeline to \p MPM
+  /// \param PB the pass builder used to build the default pipelines, and to
+  /// parse the custom pipeline
+  /// \param MPM the pass manager run over the instrumentation module
+  /// \return an \c llvm::Error if the custom pipeline is empty or failed to
+  /// parse
+  llvm::Error addIRPipeline(llvm::PassBuilder &PB,
+                            llvm::ModulePassManager &MPM) const;
+
+  /// \return a copy of these options generating injected payloads of lower
+  /// register pressure, at the cost of their speed; Used to re-instrument
+  /// kernels whose occupancy drops beyond their budget
+  [[nodiscard]] IModulePipelineOptions withLowerRegisterPressure() const {
+    IModulePipelineOptions Out = *this;
+    // Unrolling, vectorization and aggressive hoisting of the O2 and O3
+    // pipelines lengthen live ranges
+    if (IRPipeline == IModuleIRPipelineKind::O2 ||
+        IRPipeline == IModuleIRPipelineKind::O3)
+      Out.IRPipeline = IModuleIRPipelineKind::O1;
+    // Reading unused register arguments of hooks keeps them live
+    Out.SpecializeHookCalls = true;
+    return Out;
+  }
+
+  /// \return \c true if both options generate the same injected payloads;
+  /// The number of code gen threads does not affect the generated code
+  bool producesSameCodeAs(const IModulePipelineOptions &Other) const {
+    return IRPipeline == Other.IRPipeline &&
+           CustomIRPipeline == Other.CustomIRPipeline &&
+           MIROptLevel == Other.MIROptLevel &&
+           SpecializeHookCalls == Other.SpecializeHookCalls &&
+           HookPredication == Other.HookPredication;
+  }
+};
+
+} // namespace luthier
+
+#endif
@@ -125,6 +125,17 @@ public:
   [[nodiscard]] virtual llvm::Expected<std::optional<luthier::address_t>>
   getGlobalVariablesLoadedOnAgent(llvm::StringRef GVName,
                                   hsa_agent_t Agent) const = 0;
+
+  /// Returns the bit owned by the hook \p HookName in the hook enable mask
+  /// of the module; Bits are assigned to the hooks of the module with
+  /// exported handles in the order of their names, so the injected payloads
+  /// and the host agree on them without any bookkeeping
+  /// \param HookName the name of the hook
+  /// \return the index of the bit of the hook, or an \c llvm::Error if the
+  /// hook has no exported handle, or the mask has no bit left for it
+  /// 返回钩子 \p HookName 在模块的钩子启用掩码中拥有的位
+  [[nodiscard]] virtual llvm::Expected<unsigned>
+  getHookEnableBit(llvm::StringRef HookName) const = 0;
 };
 
 //===----------------------------------------------------------------------===//
@@ -260,6 +271,9 @@ public:
   readBitcodeIntoContext(llvm::LLVMContext &Ctx,
                          hsa_agent_t Agent) const override;
 
+  [[nodiscard]] llvm::Expected<unsigned>
+  getHookEnableBit(llvm::StringRef HookName) const override;
+
   /// Same as <tt>getGlobalVariablesLoadedOnAgent</tt>,
   /// except it returns the ExecutableSymbol of the variables
   /// Use this function only if \c getGlobalVariablesLoadedOnAgent does not
@@ -0,0 +1,235 @@
+//===-- InstrumentationRecord.h ---------------------------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file describes the \c InstrumentationRecord class, which keeps track
+/// of the hooks and the generated injected payloads of an instrumented
+/// \c LiftedRepresentation so that it can later be re-instrumented
+/// incrementally.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_INSTRUMENTATION_RECORD_H
+#define LUTHIER_TOOLING_INSTRUMENTATION_RECORD_H
+#include "luthier/Tooling/IModulePipelineOptions.h"
+#include "luthier/Tooling/InstrumentationTask.h"
+#include "luthier/Tooling/PrePostAmbleEmitter.h"
+#include "luthier/Tooling/RunMIRPassesOnIModulePass.h"
+#include "luthier/Tooling/StateValueArrayStorage.h"
+#include <llvm/ADT/StringMap.h>
+#include <memory>
+
+namespace luthier {
+
+namespace hsa {
+
+class Instr;
+
+} // namespace hsa
+
+class AMDGPURegisterLiveness;
+
+class SVStorageAndLoadLocations;
+
+/// \brief 注入负载的机器代码所依赖的一切信息；如果两次插桩之间插桩点的签名没有改变，则可以重用之前生成的机器代码
+/// \brief Everything the machine code of an injected payload depends on;
+/// If the signature of an instrumentation point does not change between two
+/// instrumentations, its previously generated machine code can be reused
+struct InjectedPayloadSignature {
+  /// 在插桩点之前调用的钩子及其参数
+  /// The hooks invoked before the instrumentation point + their arguments
+  llvm::SmallVector<InstrumentationTask::hook_invocation_descriptor, 1> Hooks{};
+  /// 插桩点处的活跃物理寄存器，已排序
+  /// The physical registers live at the instrumentation point, sorted
+  llvm::SmallVector<llvm::MCPhysReg, 32> LiveIns{};
+  /// 状态值数组加载到的 VGPR
+  /// The VGPR the state value array is loaded into
+  llvm::MCRegister SVALoadVGPR{};
+  /// 加载状态值数组是否会破坏应用程序的活跃 VGPR
+  /// Whether loading the state value array clobbers a live VGPR of the app
+  bool LoadDestClobbersAppVGPR{false};
+  /// 注入负载是否加载状态值数组；否则由同一组相邻插桩点中前一个注入负载加载
+  /// Whether the injected payload loads the state value array; Otherwise the
+  /// payload before it in the same run of adjacent instrumentation points does
+  bool LoadsSVA{true};
+  /// 注入负载是否存回状态值数组；否则由同一组相邻插桩点中后一个注入负载存回
+  /// Whether the injected payload stores the state value array back;
+  /// Otherwise the payload after it in the same run of adjacent
+  /// instrumentation points does
+  bool StoresSVA{true};
+  /// 插桩点处状态值数组的存储方案
+  /// The storage scheme of the state value array at the instrumentation point
+  StateValueArrayStorage::StorageKind SVSScheme{};
+  /// 插桩点处存储状态值数组的寄存器
+  /// The registers storing the state value array at the instrumentation point
+  llvm::SmallVector<llvm::MCRegister, 4> SVSRegs{};
+
+  /// 计算插桩点 \p InstPoint 的签名
+  /// \param InstPoint 插桩点
+  /// \param Hooks 在 \p InstPoint 之前调用的钩子
+  /// \param RegLiveness 目标应用程序的寄存器活跃性分析
+  /// \param SVLocations 目标应用程序的状态值数组存储和加载位置
+  /// \return \p InstPoint 的签名
+  /// Computes the signature of the instrumentation point \p InstPoint
+  /// \param InstPoint the instrumentation point
+  /// \param Hooks the hooks invoked before \p InstPoint
+  /// \param RegLiveness the register liveness analysis of the target app
+  /// \param SVLocations the state value array storage and load locations of
+  /// the target app
+  /// \return the signature of \p InstPoint
+  static InjectedPayloadSignature
+  get(const llvm::MachineInstr &InstPoint,
+      llvm::ArrayRef<InstrumentationTask::hook_invocation_descriptor> Hooks,
+      const AMDGPURegisterLiveness &RegLiveness,
+      const SVStorageAndLoadLocations &SVLocations);
+
+  bool operator==(const InjectedPayloadSignature &Other) const;
+
+  bool operator!=(const InjectedPayloadSignature &Other) const {
+    return !(*this == Other);
+  }
+};
+
+/// \brief 使一次插桩生成的注入负载机器代码保持存活的状态
+/// \details 字段的声明顺序确保机器代码在插桩模块之前被销毁
+/// \brief State keeping the machine code of the injected payloads generated
+/// by a single instrumentation alive
+/// \details The fields are declared in an order that ensures the machine code
+/// is destroyed before the instrumentation module
+struct InjectedPayloadCodeGenState {
+  /// 用于生成机器代码的目标机器；与提升表示的目标机器分开，因此状态可以比插桩后的提升表示存活更久
+  /// The target machine used to generate the machine code; Separate from the
+  /// lifted representation's target machine so that the state can outlive
+  /// the instrumented lifted representation
+  PooledTargetMachine TM{nullptr};
+  /// 插桩模块，位于提升表示的上下文中
+  /// The instrumentation module, inside the lifted representation's context
+  std::unique_ptr<llvm::Module> IModule{nullptr};
+  /// 用于运行代码生成流水线的旧版 pass 管理器；拥有插桩模块的 MMI
+  /// The legacy pass manager used to run the code gen pipeline; Owns the
+  /// MMI of the instrumentation module
+  std::unique_ptr<llvm::legacy::PassManager> LegacyPM{nullptr};
+  /// 为注入负载生成的机器代码
+  /// The machine code generated for the injected payloads
+  IModuleCodeGenResult CodeGenResult{};
+};
+
+/// \brief 跟踪插桩后的 \c LiftedRepresentation 的钩子和生成的注入负载，以便之后可以对其进行增量重新插桩
+/// \details 记录由 \c CodeGenerator::instrument 填充，并由
+/// \c CodeGenerator::reinstrument 使用和更新。重新插桩时，签名未改变的插桩点将重用之前生成的机器代码，
+/// 因此代码生成的开销随变化量而不是内核的大小增长。\n
+/// 插桩点由其被提升自的 \c hsa::Instr 标识；因此，变体函数只能插入钩子，而不能向提升表示添加新指令。\n
+/// 记录引用提升表示的 \c llvm::LLVMContext，不能比它被创建自的 \c LiftedRepresentation 存活更久
+/// \brief Keeps track of the hooks and the generated injected payloads of an
+/// instrumented \c LiftedRepresentation so that it can later be
+/// re-instrumented incrementally
+/// \details A record is populated by \c CodeGenerator::instrument, and is
+/// consumed and updated by \c CodeGenerator::reinstrument. When
+/// re-instrumenting, instrumentation points with unchanged signatures reuse
+/// their previously generated machine code, so the cost of code generation
+/// scales with the delta rather than the size of the kernel.\n
+/// Instrumentation points are identified by the \c hsa::Instr they were lifted
+/// from; Hence, the mutator can only insert hooks, and must not add new
+/// instructions to the lifted representation.\n
+/// A record refers to the \c llvm::LLVMContext of the lifted representation,
+/// and must not outlive the \c LiftedRepresentation it was created from
+class InstrumentationRecord {
+public:
+  /// \brief 之前为插桩点生成的注入负载
+  /// \brief An injected payload previously generated for an instrumentation
+  /// point
+  struct CachedInjectedPayload {
+    /// 生成负载时插桩点的签名
+    /// Signature of the instrumentation point when the payload was generated
+    InjectedPayloadSignature Signature{};
+    /// 注入负载的机器代码；如果负载尚未生成则为 \c nullptr
+    /// Machine code of the injected payload; \c nullptr if the payload has
+    /// not been generated yet
+    const llvm::MachineFunction *MF{nullptr};
+    /// \c MF 所属的（插桩模块的副本）模块
+    /// The (copy of the instrumentation) module the \c MF belongs to
+    const llvm::Module *IModule{nullptr};
+    /// 容纳 \c MF 的机器模块信息
+    /// The machine module info housing the \c MF
+    const llvm::MachineModuleInfo *IMMI{nullptr};
+    /// 使 \c MF 保持存活的状态
+    /// The state keeping the \c MF alive
+    std::shared_ptr<const InjectedPayloadCodeGenState> State{nullptr};
+  };
+
+private:
+  friend class CodeGenerator;
+
+  friend class ReuseInjectedPayloadsPass;
+
+  /// 是否可以从此记录重新插桩
+  /// Whether or not re-instrumentation can be done from this record
+  bool IsReplayable{false};
+  /// 在每个插桩点之前插入的钩子
+  /// The hooks inserted before each instrumentation point
+  llvm::DenseMap<const hsa::Instr *,
+                 llvm::SmallVector<
+                     InstrumentationTask::hook_invocation_descriptor, 1>>
+      Hooks{};
+  /// 每个插桩点的注入负载
+  /// The injected payload of each instrumentation point
+  llvm::DenseMap<const hsa::Instr *, CachedInjectedPayload> Payloads{};
+  /// 注入负载访问的不在活跃寄存器中的物理寄存器，已排序；影响所有插桩点的状态值数组存储决策
+  /// Physical registers accessed by the injected payloads that are not in
+  /// the live-ins, sorted; Affects the state value array storage decisions
+  /// of all instrumentation points
+  llvm::SmallVector<llvm::MCPhysReg, 8> PhysRegsNotInLiveIns{};
+  /// 生成负载时使用的流水线选项
+  /// The pipeline options the payloads were generated with
+  IModulePipelineOptions PipelineOptions{};
+  /// 每个内核的导码规范，按名称索引
+  /// Preamble specs of each kernel, indexed by name
+  llvm::StringMap<FunctionPreambleDescriptor::KernelPreambleSpecs>
+      KernelPreambles{};
+  /// 每个设备函数的前后导码规范，按名称索引
+  /// Pre/post amble specs of each device function, indexed by name
+  llvm::StringMap<FunctionPreambleDescriptor::DeviceFunctionPreambleSpecs>
+      DeviceFunctionPreambles{};
+  /// 上次插桩重用的注入负载数量
+  /// Number of injected payloads reused by the last instrumentation
+  unsigned NumReusedPayloads{0};
+  /// 上次插桩重新生成的注入负载数量
+  /// Number of injected payloads regenerated by the last instrumentation
+  unsigned NumGeneratedPayloads{0};
+
+public:
+  InstrumentationRecord() = default;
+
+  /// \return 如果可以从此记录增量重新插桩则返回 \c true
+  /// \return \c true if incremental re-instrumentation can be done from this
+  /// record
+  [[nodiscard]] bool isReplayable() const { return IsReplayable; }
+
+  /// \return 上次插桩重用的注入负载数量
+  /// \return number of injected payloads reused by the last instrumentation
+  [[nodiscard]] unsigned getNumReusedPayloads() const {
+    return NumReusedPayloads;
+  }
+
+  /// \return 上次插桩重新生成的注入负载数量
+  /// \return number of injected payloads regenerated by the last
+  /// instrumentation
+  [[nodiscard]] unsigned getNumGeneratedPayloads() const {
+    return NumGeneratedPayloads;
+  }
+};
+
+} // namespace luthier
+
+#endif
@@ -0,0 +1,98 @@
+//===-- InstrumentationStack.h - Instrumentation Stack Setup ----*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了内核导码中插桩栈的设置，包括使用动态大小栈的内核的插桩栈放置。
+/// This file describes the setup of the instrumentation stack in the kernel
+/// preamble, including the placement of the instrumentation stack of kernels
+/// using a dynamically sized stack.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_INSTRUMENTATION_STACK_H
+#define LUTHIER_TOOLING_INSTRUMENTATION_STACK_H
+#include "luthier/HSA/Metadata.h"
+#include <cstdint>
+#include <llvm/CodeGen/MachineInstr.h>
+#include <llvm/MC/MCRegister.h>
+#include <llvm/Support/Error.h>
+
+namespace luthier {
+
+/// 使用动态栈的内核中插桩栈的放置方式
+/// Placement of the instrumentation stack in kernels using a dynamic stack
+enum class DynamicStackInstrumentationPlacement {
+  /// 在应用程序栈之下、固定私有段之后保留一个有界区域，并将应用程序栈的起点上移
+  /// Reserve a bounded region right after the fixed private segment, below
+  /// the application's stack, and move the start of the application's stack
+  /// up past it
+  BelowAppStack,
+  /// 在每个通道私有段的末尾、应用程序动态栈之上保留一个单独的切片；其位置在运行时
+  /// 从调度数据包中读取
+  /// Reserve a separate slice at the end of the private segment of each lane,
+  /// above the application's dynamic stack; Its location is read from the
+  /// dispatch packet at runtime
+  PerWaveSlice
+};
+
+/// 使用动态栈的内核的插桩栈区域的字节对齐
+/// Alignment in bytes of the instrumentation stack region of kernels using a
+/// dynamic stack
+constexpr uint32_t DynamicStackInstrumentationRegionAlign = 16;
+
+/// \return 命令行选择的动态栈内核插桩栈放置方式
+/// \return the placement of the instrumentation stack of dynamic stack
+/// kernels selected from the command line
+DynamicStackInstrumentationPlacement getDynamicStackInstrumentationPlacement();
+
+/// \return 插桩栈设置是否需要访问调度数据包指针
+/// \return whether setting up the instrumentation stack of a kernel with
+/// \p KernelMD requires access to the dispatch packet pointer
+bool doesInstrumentationStackRequireDispatchPtr(
+    const amdgpu::hsamd::Kernel::Metadata &KernelMD);
+
+/// 在 \p EntryInstr 之前发出设置插桩 scratch 和栈的代码，并将插桩帧寄存器存入
+/// \p SVSStorageVGPR 的状态值数组槽中
+/// \details 固定大小栈的内核的插桩栈从其固定私有段之后开始。对于使用动态栈的内核，
+/// 插桩栈根据 \c getDynamicStackInstrumentationPlacement 放置在有界区域中；在调度时，
+/// 私有段大小会增加该区域的大小，使应用程序的栈预算保持不变
+/// \param EntryInstr 内核的第一条指令；内核参数 SGPR 必须已启用
+/// \param SVSStorageVGPR 保存状态值数组的 VGPR
+/// \param KernelMD 原始内核的元数据
+/// \param InstrumentationStackSize 注入负载请求的每个通道的栈字节数
+/// \return 如果插桩栈不能被放置则返回 \c llvm::Error
+/// Emits code before \p EntryInstr that sets up instrumentation scratch and
+/// the instrumentation stack, and stores the instrumentation frame registers
+/// in their state value array slots of \p SVSStorageVGPR
+/// \details The instrumentation stack of kernels with a fixed-size stack
+/// starts right after their fixed private segment. For kernels using a
+/// dynamic stack, the instrumentation stack is placed in a bounded region
+/// according to \c getDynamicStackInstrumentationPlacement; At dispatch time,
+/// the private segment size grows by the size of the region, leaving the
+/// stack budget of the application untouched
+/// \param EntryInstr first instruction of the kernel; The kernel argument
+/// SGPRs must already be enabled
+/// \param SVSStorageVGPR the VGPR holding the state value array
+/// \param KernelMD metadata of the original kernel
+/// \param InstrumentationStackSize number of stack bytes per lane requested
+/// by the injected payloads
+/// \return an \c llvm::Error if the instrumentation stack cannot be placed
+llvm::Error emitCodeToSetupInstrumentationStack(
+    llvm::MachineInstr &EntryInstr, llvm::MCRegister SVSStorageVGPR,
+    const amdgpu::hsamd::Kernel::Metadata &KernelMD,
+    unsigned int InstrumentationStackSize);
+
+} // namespace luthier
+
+#endif
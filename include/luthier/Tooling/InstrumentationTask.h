@@ -20,6 +20,8 @@
 //===----------------------------------------------------------------------===//
 #ifndef LUTHIER_TOOLING_INSTRUMENTATION_TASK_H
 #define LUTHIER_TOOLING_INSTRUMENTATION_TASK_H
+#include "luthier/Tooling/IModulePipelineOptions.h"
+#include "luthier/Tooling/MachineEdgeProfile.h"
 #include "luthier/types.h"
 #include <functional>
 #include <llvm/ADT/DenseMap.h>
@@ -86,6 +88,15 @@ private:
   /// A list of hooks to be inserted at each \c llvm::MachineInstr of the
   /// <tt>LiftedRepresentation</tt>
   hook_insertion_tasks HookInsertionTasks{};
+  /// 用于将插桩模块编译为注入负载的 IR 和 MIR 流水线选项
+  /// Options of the IR and MIR pipelines used to compile the instrumentation
+  /// module into injected payloads
+  IModulePipelineOptions PipelineOptions{IModulePipelineOptions::getDefault()};
+
+  /// 允许 \c CodeGenerator 在增量重新插桩时重放之前记录的钩子
+  /// Allows the \c CodeGenerator to replay previously recorded hooks when
+  /// re-instrumenting incrementally
+  friend class CodeGenerator;
 
 public:
   /// InstrumentationTask 构造函数
@@ -115,6 +126,97 @@ public:
       llvm::ArrayRef<std::variant<llvm::Constant *, llvm::MCRegister>> Args =
           {});
 
+  /// 用一对时间戳包围从 \p RegionBegin 开始、在 \p RegionEnd 之前结束的区域\n
+  /// \p TimerHook 必须接受一个 \c bool 参数：它在 \p RegionBegin 之前以 \c false 调用，
+  /// 在 \p RegionEnd 之前以 \c true 调用，并且通常只调用 \c luthier::accumulateRegionTime
+  /// 以累加每个波前在区域中花费的时间。\n
+  /// 计时器钩子在 \p RegionBegin 处排在已排队钩子之后，在 \p RegionEnd 处排在已排队钩子之前，
+  /// 因此其他钩子不计入区域时间。每个进入区域的波前也必须离开它，即 \p RegionBegin 必须
+  /// 支配 \p RegionEnd，且 \p RegionEnd 必须后支配 \p RegionBegin
+  /// \param RegionBegin 区域的第一条指令
+  /// \param RegionEnd 区域之后的第一条指令
+  /// \param TimerHook 从 \c LUTHIER_GET_HOOK_HANDLE 获取的计时器钩子句柄
+  /// \return 指示操作成功或其失败的 \c llvm::Error
+  /// Brackets the region starting at \p RegionBegin and ending right before
+  /// \p RegionEnd with a pair of timestamps\n
+  /// The \p TimerHook must take a single \c bool argument: It is called with
+  /// \c false before \p RegionBegin and with \c true before \p RegionEnd, and
+  /// usually only calls \c luthier::accumulateRegionTime to accumulate the
+  /// time each wavefront spends in the region.\n
+  /// The timer hook is placed after the hooks already queued at
+  /// \p RegionBegin and before the hooks already queued at \p RegionEnd, so
+  /// other hooks are not accounted in the region's time. Every wavefront
+  /// entering the region must also leave it, i.e. \p RegionBegin must dominate
+  /// \p RegionEnd and \p RegionEnd must post-dominate \p RegionBegin
+  /// \param RegionBegin the first instruction of the region
+  /// \param RegionEnd the first instruction after the region
+  /// \param TimerHook handle of the timer hook obtained from
+  /// \c LUTHIER_GET_HOOK_HANDLE
+  /// \returns an \c llvm::Error indicating the success of the operation or
+  /// its failure
+  llvm::Error insertRegionTimer(llvm::MachineInstr &RegionBegin,
+                                llvm::MachineInstr &RegionEnd,
+                                const void *TimerHook);
+
+  /// 按照 \c computeMachineEdgeProfile 计算的最小放置，在 \c LiftedRepresentation 的
+  /// 内核及其可达设备函数中插入边剖析计数器\n
+  /// \p CounterHook 必须接受一个 \c unsigned \c int 参数，即要递增的计数器在全局计数器数组中的索引。
+  /// 计数器放在边的源块末尾或目标块开头；如果两者都不可行，则拆分该边。
+  /// 转储的计数器通过 \c MachineEdgeProfile::reconstructBlockCounts 重建为块执行次数
+  /// \param CounterHook 从 \c LUTHIER_GET_HOOK_HANDLE 获取的计数器钩子句柄
+  /// \return 计数器的放置，或指示失败的 \c llvm::Error
+  /// Inserts edge profiling counters into the kernel of the
+  /// \c LiftedRepresentation and the device functions reachable from it,
+  /// following the minimal placement computed by
+  /// \c computeMachineEdgeProfile\n
+  /// The \p CounterHook must take a single \c unsigned \c int argument, the
+  /// index of the counter to increment in the global counter array. Counters
+  /// are placed at the end of the source block or at the start of the
+  /// destination block of their edge; If neither is possible, the edge is
+  /// split. Dumped counters are reconstructed into block execution counts with
+  /// \c MachineEdgeProfile::reconstructBlockCounts
+  /// \param CounterHook handle of the counter hook obtained from
+  /// \c LUTHIER_GET_HOOK_HANDLE
+  /// \return the placement of the counters, or an \c llvm::Error indicating
+  /// the failure
+  llvm::Expected<MachineEdgeProfile>
+  insertEdgeCounters(const void *CounterHook);
+
+  /// 在内存指令 \p MI 之前为其每个访问插入 \p Hook，并传递访问的寻址操作数；
+  /// 钩子在注入的代码中使用 \c luthier::computeEffectiveAddress 计算每个通道的有效地址，
+  /// 因此工具无需解码 ISA 特定的操作数
+  /// \param MI FLAT、GLOBAL、SCRATCH、MUBUF、MTBUF 或 DS 指令
+  /// \param Hook 从 \c LUTHIER_GET_HOOK_HANDLE 获取的钩子句柄；其参数必须以
+  /// \c MemoryAccess 描述的参数开头
+  /// \param ExtraArgs 在访问参数之后传递给钩子的额外参数
+  /// \return 指示操作成功或其失败的 \c llvm::Error
+  /// Inserts \p Hook before the memory instruction \p MI once for each of
+  /// its accesses, passing the addressing operands of the access; The hook
+  /// computes the effective address of each lane in the injected code with
+  /// \c luthier::computeEffectiveAddress, so tools don't have to decode
+  /// ISA-specific operands
+  /// \param MI a FLAT, GLOBAL, SCRATCH, MUBUF, MTBUF or DS instruction
+  /// \param Hook handle of the hook obtained from \c LUTHIER_GET_HOOK_HANDLE;
+  /// Its arguments must start with the ones described by \c MemoryAccess
+  /// \param ExtraArgs extra arguments passed to the hook after the arguments
+  /// of the access
+  /// \returns an \c llvm::Error indicating the success of the operation or
+  /// its failure
+  llvm::Error insertMemoryAccessHookBefore(
+      llvm::MachineInstr &MI, const void *Hook,
+      llvm::ArrayRef<std::variant<llvm::Constant *, llvm::MCRegister>>
+          ExtraArgs = {});
+
+  /// 移除所有排队在 \p MI 之前插入的钩子；主要用于增量重新插桩时从之前的插桩中移除插桩点
+  /// \param MI 要移除其钩子的 \c llvm::MachineInstr
+  /// Removes all hooks queued to be inserted before \p MI; Mainly used to
+  /// drop instrumentation points of a previous instrumentation when
+  /// re-instrumenting incrementally
+  /// \param MI the \c llvm::MachineInstr whose hooks will be removed
+  void removeHooksBefore(llvm::MachineInstr &MI) {
+    HookInsertionTasks.erase(&MI);
+  }
+
   /// \return 钩子插入任务的常量引用
   /// \return a const reference to the hook insertion tasks
   [[nodiscard]] const hook_insertion_tasks &getHookInsertionTasks() const {
@@ -124,6 +226,21 @@ public:
   /// \return 此任务的插桩模块的常量引用
   /// \return a const reference to the instrumentation module of this task
   [[nodiscard]] const InstrumentationModule &getModule() const { return IM; }
+
+  /// 设置编译此任务的插桩模块时使用的流水线选项；默认值取自命令行选项
+  /// \param Options 新的流水线选项
+  /// Sets the pipeline options used when compiling the instrumentation module
+  /// of this task; Defaults are taken from the command line options
+  /// \param Options the new pipeline options
+  void setPipelineOptions(IModulePipelineOptions Options) {
+    PipelineOptions = std::move(Options);
+  }
+
+  /// \return 此任务的流水线选项的常量引用
+  /// \return a const reference to the pipeline options of this task
+  [[nodiscard]] const IModulePipelineOptions &getPipelineOptions() const {
+    return PipelineOptions;
+  }
 };
 
 } // namespace luthier
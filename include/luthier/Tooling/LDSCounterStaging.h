@@ -0,0 +1,91 @@
+//===-- LDSCounterStaging.h - LDS Counter Staging ---------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了在工作组的 LDS 中暂存的计数器的清零和刷新代码，该代码由内核导码和
+/// 每个 \c s_endpgm 之前的代码发出。
+/// This file describes the code zeroing and flushing the counters staged in
+/// the LDS of the workgroup, emitted in the kernel preamble and before each
+/// \c s_endpgm.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_LDS_COUNTER_STAGING_H
+#define LUTHIER_TOOLING_LDS_COUNTER_STAGING_H
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/CodeGen/MachineInstr.h>
+#include <llvm/Support/Error.h>
+#include <utility>
+
+namespace llvm {
+
+class GlobalVariable;
+
+class LivePhysRegs;
+
+} // namespace llvm
+
+namespace luthier {
+
+/// 在 \p EntryInstr 之前发出代码，将暂存在 LDS 中的计数器以及位于
+/// \p LiveWavesOffset 的工作组存活波前计数清零，然后统计工作组的波前；
+/// 屏障确保没有波前在计数器清零之前开始计数，也没有波前在所有波前被计数之前退出
+/// \param EntryInstr 内核的第一条指令
+/// \param CountersOffset 第一个暂存计数器的 LDS 偏移
+/// \param LiveWavesOffset 存活波前计数的 LDS 偏移，紧跟在最后一个计数器之后
+/// \param LiveRegs 在 \p EntryInstr 之前存活的寄存器；选中的临时寄存器会被加入其中
+/// \return 如果找不到空闲的临时寄存器则返回 \c llvm::Error
+/// Emits code before \p EntryInstr that zeroes the LDS-staged counters and
+/// the count of live wavefronts in the workgroup at \p LiveWavesOffset, then
+/// counts the wavefronts of the workgroup; Barriers make sure no wavefront
+/// starts counting before the counters are zeroed, nor exits before every
+/// wavefront is counted
+/// \param EntryInstr first instruction of the kernel
+/// \param CountersOffset LDS offset of the first staged counter
+/// \param LiveWavesOffset LDS offset of the live wavefront count, right after
+/// the last counter
+/// \param LiveRegs registers live before \p EntryInstr; The picked scratch
+/// registers are added to it
+/// \return an \c llvm::Error if no free scratch registers could be found
+llvm::Error emitCodeToZeroLDSCounters(llvm::MachineInstr &EntryInstr,
+                                      unsigned CountersOffset,
+                                      unsigned LiveWavesOffset,
+                                      llvm::LivePhysRegs &LiveRegs);
+
+/// 在 \p EndPgm 指令之前发出代码，使工作组的最后一个波前通过一次原子操作将每个
+/// LDS 暂存计数器加到其全局计数器上；此处不使用屏障，因为它可能与仍在运行的波前中
+/// 应用程序的屏障匹配
+/// \param EndPgm 内核的一条 \c s_endpgm 指令
+/// \param Counters 每个全局计数器及其暂存副本的 LDS 偏移
+/// \param LiveWavesOffset 存活波前计数的 LDS 偏移
+/// \return 发出的代码的第一条指令；如果找不到空闲的临时寄存器则返回 \c llvm::Error
+/// Emits code before the \p EndPgm instruction that makes the last wavefront
+/// of the workgroup add each LDS-staged counter to its global counter with a
+/// single atomic; No barrier is used here, as it could be matched against a
+/// barrier of the application in wavefronts that are still running
+/// \param EndPgm an \c s_endpgm instruction of the kernel
+/// \param Counters each global counter, along with the LDS offset of its
+/// staged copy
+/// \param LiveWavesOffset LDS offset of the live wavefront count
+/// \return the first instruction of the emitted code, or an \c llvm::Error
+/// if no free scratch registers could be found
+llvm::Expected<llvm::MachineInstr *> emitCodeToFlushLDSCounters(
+    llvm::MachineInstr &EndPgm,
+    llvm::ArrayRef<std::pair<const llvm::GlobalVariable *, unsigned>>
+        Counters,
+    unsigned LiveWavesOffset);
+
+} // namespace luthier
+
+#endif
@@ -30,6 +30,7 @@
 #include "luthier/HSA/Instr.h"
 #include "luthier/HSA/LoadedCodeObjectDeviceFunction.h"
 #include "luthier/HSA/LoadedCodeObjectKernel.h"
+#include "luthier/Tooling/TargetManager.h"
 
 namespace luthier {
 
@@ -70,7 +71,7 @@ class LiftedRepresentation {
 private:
   /// MMIWP 的目标机器
   /// Target machine of the \c MMIWP
-  std::unique_ptr<llvm::GCNTargetMachine> TM{};
+  PooledTargetMachine TM{};
 
   /// 拥有所有线程安全模块的线程安全上下文；
   /// 每个 LiftedRepresentation 被赋予自己的上下文，以允许与其他上下文进行独立处理
@@ -19,12 +19,17 @@
 #ifndef LUTHIER_TOOLING_MIR_CONVENIENCE_H
 #define LUTHIER_TOOLING_MIR_CONVENIENCE_H
 #include <llvm/CodeGen/MachineBasicBlock.h>
+#include <llvm/Support/Error.h>
 
 namespace llvm {
 
 class MCRegister;
 
-}
+class LivePhysRegs;
+
+class TargetRegisterClass;
+
+} // namespace llvm
 
 namespace luthier {
 
@@ -107,6 +112,17 @@ void emitStoreToEmergencySVSScratchSpillLocation(
 
 void emitWaitCnt(llvm::MachineBasicBlock::iterator MI);
 
+/// Picks a register of \p RC which is not in \p LiveRegs, and adds it to
+/// \p LiveRegs so that it is not picked again; Registers are tried in the
+/// raw allocation order of \p RC, and registers reserved in \p MF are never
+/// picked
+/// 选择一个不在 \p LiveRegs 中的 \p RC 寄存器，并将其加入 \p LiveRegs 以免再次被选中；
+/// 寄存器按 \p RC 的原始分配顺序尝试，\p MF 中保留的寄存器永远不会被选中
+llvm::Expected<llvm::MCRegister>
+pickFreePhysReg(const llvm::MachineFunction &MF,
+                const llvm::TargetRegisterClass &RC,
+                llvm::LivePhysRegs &LiveRegs);
+
 } // namespace luthier
 
 #endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+//===-- MachineEdgeProfile.h - Edge Profiling of Lifted Kernels -*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了对提升内核及其可达设备函数的边剖析计数器放置分析。
+/// This file describes the analysis placing edge profiling counters over a
+/// lifted kernel and the device functions reachable from it.
+/// \details 计数器放置在标量 MIR 控制流图上：波前级执行次数按标量块计算，
+/// \c VectorCFG 中的向量块与其所属标量块的执行次数相同
+/// Counters are placed over the scalar MIR control flow graph: Wavefront-level
+/// execution counts are per scalar block, and the vector blocks of the
+/// \c VectorCFG execute exactly as many times as their parent scalar block
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_MACHINE_EDGE_PROFILE_H
+#define LUTHIER_TOOLING_MACHINE_EDGE_PROFILE_H
+#include "luthier/Tooling/EdgeProfile.h"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/CodeGen/MachineBasicBlock.h>
+
+namespace luthier {
+
+class LiftedRepresentation;
+
+/// 单个机器函数的边剖析计数器放置
+/// Edge profiling counter placement of a single machine function
+struct MachineFunctionEdgeProfile {
+  /// 被剖析的机器函数
+  /// The machine function being profiled
+  llvm::MachineFunction *MF;
+  /// \c MF 的块；块 \c I 在 \c Placement 中的索引为 \c I
+  /// Blocks of \c MF; Block \c I has the index \c I in \c Placement
+  llvm::SmallVector<llvm::MachineBasicBlock *> Blocks{};
+  /// \c MF 控制流图上的计数器放置
+  /// Counter placement over the control flow graph of \c MF
+  EdgeCounterPlacement Placement{};
+  /// \c MF 第一个计数器在全局计数器数组中的索引
+  /// Index of the first counter of \c MF in the global counter array
+  unsigned FirstCounter{0};
+};
+
+/// 提升内核及其可达设备函数的边剖析计数器放置
+/// Edge profiling counter placement of a lifted kernel and the device
+/// functions reachable from it
+struct MachineEdgeProfile {
+  /// 每个被剖析函数的计数器放置；第一个总是内核
+  /// Counter placement of each profiled function; The first one is always the
+  /// kernel
+  llvm::SmallVector<MachineFunctionEdgeProfile, 1> Functions{};
+  /// 所有函数的计数器总数
+  /// Total number of counters across all functions
+  unsigned NumCounters{0};
+
+  /// 从转储的计数器重建每个被剖析块的执行次数
+  /// \param Counters 全局计数器数组，其大小必须为 \c NumCounters
+  /// \return 每个块的执行次数；如果计数器值违反流守恒则返回 \c llvm::Error
+  /// Reconstructs the execution count of every profiled block from the dumped
+  /// counters
+  /// \param Counters the global counter array; Its size must be
+  /// \c NumCounters
+  /// \return the execution count of every block; An \c llvm::Error if the
+  /// counter values violate flow conservation
+  [[nodiscard]] llvm::Expected<
+      llvm::DenseMap<const llvm::MachineBasicBlock *, uint64_t>>
+  reconstructBlockCounts(llvm::ArrayRef<uint64_t> Counters) const;
+};
+
+/// 计算 \p LR 的内核以及从其调用图可达的设备函数的边剖析计数器放置；
+/// 如果调用图不确定，则剖析 \p LR 的所有函数
+/// \details 循环回边和关键边的权重更高，以便尽量不在它们上放置计数器：
+/// 前者执行频繁，后者需要拆分才能插桩
+/// \param LR 被剖析的提升表示
+/// \return 计数器的放置，或指示失败的 \c llvm::Error
+/// Computes the edge profiling counter placement of the kernel of \p LR and
+/// the device functions reachable from it in the call graph; All functions of
+/// \p LR are profiled if the call graph is not deterministic
+/// \details Loop back edges and critical edges are weighed higher to keep
+/// counters off of them where possible: The former execute frequently and the
+/// latter must be split to be instrumented
+/// \param LR the lifted representation being profiled
+/// \return the placement of the counters, or an \c llvm::Error indicating
+/// the failure
+llvm::Expected<MachineEdgeProfile>
+computeMachineEdgeProfile(LiftedRepresentation &LR);
+
+} // namespace luthier
+
+#endif
@@ -0,0 +1,99 @@
+//===-- MemoryAccess.h - Memory Access Decoding -----------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了内存访问解码，它将 FLAT、GLOBAL、SCRATCH、缓冲区和 DS 指令的寻址
+/// 操作数转换为传递给内存访问钩子的统一参数列表。
+/// This file describes memory access decoding, which converts the addressing
+/// operands of FLAT, GLOBAL, SCRATCH, buffer, and DS instructions into a
+/// uniform list of arguments passed to memory access hooks.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_MEMORY_ACCESS_H
+#define LUTHIER_TOOLING_MEMORY_ACCESS_H
+#include "luthier/address.h"
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/CodeGen/MachineInstr.h>
+#include <llvm/IR/Constant.h>
+#include <llvm/MC/MCRegister.h>
+#include <llvm/Support/Error.h>
+#include <variant>
+
+namespace luthier {
+
+/// \brief 内存指令的单次访问，以其寻址操作数描述
+/// \details 内存访问钩子按以下顺序接收参数，其后是工具的额外参数：\n
+/// <tt>uint32_t Mode, uint32_t VAddr0, uint32_t VAddr1, uint32_t SBase0,
+/// uint32_t SBase1, uint32_t SOffset, int32_t Offset, uint32_t Size</tt>\n
+/// 钩子可以将前七个参数传递给 \c luthier::computeEffectiveAddress 以获得每个通道的
+/// 有效地址；寄存器操作数在注入的代码中读取，缺失的操作数以零传递
+/// \brief A single access of a memory instruction, described by its
+/// addressing operands
+/// \details Memory access hooks receive arguments in the following order,
+/// followed by the extra arguments of the tool:\n
+/// <tt>uint32_t Mode, uint32_t VAddr0, uint32_t VAddr1, uint32_t SBase0,
+/// uint32_t SBase1, uint32_t SOffset, int32_t Offset, uint32_t Size</tt>\n
+/// Hooks can pass the first seven arguments to
+/// \c luthier::computeEffectiveAddress to obtain the effective address of
+/// each lane; Register operands are read in the injected code, and missing
+/// operands are passed as zero
+struct MemoryAccess {
+  /// 访问的寻址模式
+  /// Addressing mode of the access
+  MemoryAddressingMode Mode{MEM_ADDR_FLAT};
+  /// 保存向量地址操作数的 32 位寄存器；如果缺失则为空
+  /// 32-bit registers holding the vector address operands; Null if missing
+  llvm::MCRegister VAddr[2]{};
+  /// 保存标量基址操作数的 32 位寄存器；如果缺失则为空
+  /// 32-bit registers holding the scalar base operands; Null if missing
+  llvm::MCRegister SBase[2]{};
+  /// 缓冲区访问的标量偏移量，可以是寄存器或立即数
+  /// Scalar offset of buffer accesses, either a register or an immediate
+  std::variant<llvm::MCRegister, uint32_t> SOffset{uint32_t{0}};
+  /// 访问的立即数偏移量，已按元素大小缩放
+  /// Immediate offset of the access, already scaled by its element size
+  int32_t Offset{0};
+  /// 每个通道访问的字节数
+  /// Number of bytes accessed by each lane
+  uint32_t Size{0};
+
+  /// \return 传递给内存访问钩子的参数
+  /// \param Ctx 用于创建常量参数的 LLVM 上下文
+  /// \return the arguments passed to memory access hooks
+  /// \param Ctx the LLVM context used to create constant arguments
+  [[nodiscard]] llvm::SmallVector<
+      std::variant<llvm::Constant *, llvm::MCRegister>, 8>
+  getHookArgs(llvm::LLVMContext &Ctx) const;
+};
+
+/// 解码 \p MI 执行的内存访问
+/// \param MI 提升表示中的 FLAT、GLOBAL、SCRATCH、MUBUF、MTBUF 或 DS 指令
+/// \return \p MI 的访问；DS 双地址指令有两个访问，其他指令有一个；
+/// 如果 \p MI 不访问内存或其寻址方式不受支持（例如 64 位缓冲区地址、GDS 访问以及通过
+/// 私有段缓冲区的 scratch 访问），则返回 \c llvm::Error
+/// Decodes the memory accesses performed by \p MI
+/// \param MI a FLAT, GLOBAL, SCRATCH, MUBUF, MTBUF or DS instruction of a
+/// lifted representation
+/// \return the accesses of \p MI; DS instructions with two addresses have
+/// two accesses, other instructions have one; An \c llvm::Error if \p MI
+/// does not access memory or its addressing is not supported (e.g. 64-bit
+/// buffer addresses, GDS accesses, and scratch accesses through the private
+/// segment buffer)
+llvm::Expected<llvm::SmallVector<MemoryAccess, 2>>
+decodeMemoryAccesses(const llvm::MachineInstr &MI);
+
+} // namespace luthier
+
+#endif
@@ -0,0 +1,126 @@
+//===-- OutlinedHookCallingConvPass.h ---------------------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了外联钩子的调用约定，以及在注入负载中实现该约定的 MIR 遍。
+/// This file describes the calling convention of outlined hooks, and the MIR
+/// pass which implements it inside the injected payloads.
+/// \details 外联钩子（使用 \c LUTHIER_OUTLINED_HOOK_ANNOTATE 注解）不会被内联到注入负载中，
+/// 而是只生成一次代码并被所有注入负载调用。调用点只保存钩子的 MIR 实际破坏的寄存器，
+/// 而不是默认调用约定的所有调用者保存寄存器
+/// Outlined hooks (annotated with \c LUTHIER_OUTLINED_HOOK_ANNOTATE) are not
+/// inlined into the injected payloads; Instead, they are code generated once
+/// and called by all injected payloads. Call sites only save the registers
+/// actually clobbered by the MIR of the hook, instead of all caller-saved
+/// registers of the default calling convention
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_OUTLINED_HOOK_CALLING_CONV_PASS_H
+#define LUTHIER_TOOLING_OUTLINED_HOOK_CALLING_CONV_PASS_H
+#include <cstdint>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/CodeGen/MachineFunctionPass.h>
+#include <llvm/CodeGen/MachineModuleInfo.h>
+#include <llvm/MC/MCRegister.h>
+#include <llvm/Support/Error.h>
+
+namespace luthier {
+
+/// \return 如果 \p MI 调用一个外联钩子则返回该钩子，否则返回 \c nullptr
+/// \return the outlined hook called by \p MI if \p MI is a call to an
+/// outlined hook, \c nullptr otherwise
+const llvm::Function *getOutlinedHookCallee(const llvm::MachineInstr &MI);
+
+/// 根据外联钩子 \p HookMF 的 MIR 计算其破坏的物理寄存器
+/// \details 钩子定义的每个寄存器（包括其内部调用的寄存器掩码所破坏的寄存器）及其所有别名都被视为被破坏，
+/// 但其序言/尾声保存和恢复的被调用者保存寄存器和保留寄存器除外
+/// \param HookMF 已经通过序言/尾声插入的外联钩子的机器函数
+/// \return 以物理寄存器编号为索引的被破坏寄存器集合
+/// Calculates the physical registers clobbered by the outlined hook
+/// \p HookMF from its MIR
+/// \details Every register defined by the hook, including the ones
+/// clobbered by the register masks of its own calls, and all of their aliases
+/// are considered clobbered, except the callee-saved registers saved and
+/// restored by its prologue/epilogue, and reserved registers
+/// \param HookMF the machine function of the outlined hook, after its
+/// prologue and epilogue have been inserted
+/// \return the set of clobbered registers, indexed by physical register
+llvm::BitVector
+getOutlinedHookClobberedRegs(const llvm::MachineFunction &HookMF);
+
+/// 将调用 \p CallMI 的寄存器掩码替换为仅破坏 \p HookClobberedRegs 的掩码，并在
+/// \p CallMI 周围保存和恢复所有跨调用存活且被钩子破坏的物理寄存器
+/// \details 物理寄存器被复制到新的虚拟寄存器中，使寄存器分配器将它们放在钩子未破坏的寄存器中，
+/// 或在必要时将它们溢出
+/// \param CallMI 寄存器分配之前对外联钩子的调用
+/// \param HookClobberedRegs 被调用钩子破坏的寄存器，由
+/// \c getOutlinedHookClobberedRegs 计算
+/// \return 调用点的保存集合，即在 \p CallMI 周围保存的物理寄存器；如果某个寄存器无法保存则返回
+/// \c llvm::Error
+/// Replaces the register mask of the call \p CallMI with a mask that only
+/// clobbers \p HookClobberedRegs, and saves and restores every physical
+/// register live across \p CallMI that is clobbered by the hook around it
+/// \details Physical registers are copied into new virtual registers, so that
+/// the register allocator places them in registers untouched by the hook,
+/// or spills them if necessary
+/// \param CallMI a call to an outlined hook before register allocation
+/// \param HookClobberedRegs the registers clobbered by the called hook, as
+/// calculated by \c getOutlinedHookClobberedRegs
+/// \return the save set of the call site, i.e. the physical registers saved
+/// around \p CallMI, or an \c llvm::Error if a register cannot be saved
+llvm::Expected<llvm::SmallVector<llvm::MCRegister, 4>>
+emitOutlinedHookCallSaves(llvm::MachineInstr &CallMI,
+                          const llvm::BitVector &HookClobberedRegs);
+
+/// \return 机器函数 \p MF 调用的外联钩子所需的最大栈大小（以字节为单位），包括钩子调用的
+/// 函数的栈帧；机器代码不可用的被调用者，以及递归和间接调用，按 AMDGPU 后端对外部调用假定的
+/// 栈大小计算
+/// \return the maximum stack size in bytes required by the outlined hooks
+/// called by \p MF, with their machine functions looked up in \p MMI; The
+/// frames of the functions called by the hooks are included, and callees
+/// without machine code, as well as recursive and indirect calls, are
+/// assumed to use the stack size the AMDGPU backend assumes for external
+/// calls
+uint64_t getOutlinedHookCallsStackSize(const llvm::MachineFunction &MF,
+                                       const llvm::MachineModuleInfo &MMI);
+
+/// 在注入负载中实现外联钩子调用约定的 MIR 遍
+/// \details 必须在寄存器分配之前运行；外联钩子必须在调用它们的注入负载之前完成代码生成，
+/// 否则（例如当钩子只在另一个代码生成分片中声明时）调用保持默认调用约定
+/// MIR pass which implements the calling convention of outlined hooks
+/// inside injected payloads
+/// \details Must run before register allocation; Outlined hooks must be
+/// code generated before the injected payloads calling them, otherwise
+/// (e.g. when the hook is only declared in another code gen shard) the call
+/// is left with the default calling convention
+class OutlinedHookCallingConvPass : public llvm::MachineFunctionPass {
+public:
+  static char ID;
+
+  explicit OutlinedHookCallingConvPass() : llvm::MachineFunctionPass(ID) {};
+
+  [[nodiscard]] llvm::StringRef getPassName() const override {
+    return "Luthier Outlined Hook Calling Convention";
+  }
+
+  bool runOnMachineFunction(llvm::MachineFunction &MF) override;
+
+  void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
+};
+
+} // namespace luthier
+
+#endif
@@ -0,0 +1,131 @@
+//===-- PatchLayout.h - Injected Payload Patch Layout -----------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了修补布局规划，它决定每个注入负载是内联到其插桩点，还是外联到函数
+/// 末尾并通过短跳转或长跳转蹦床到达。
+/// This file describes patch layout planning, which decides whether each
+/// injected payload is inlined into its instrumentation point, or outlined to
+/// the end of the function and reached through a short jump or a long jump
+/// trampoline.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_PATCH_LAYOUT_H
+#define LUTHIER_TOOLING_PATCH_LAYOUT_H
+#include <cstdint>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Error.h>
+
+namespace luthier {
+
+/// 注入负载修补到其插桩点的方式
+/// How an injected payload is patched into its instrumentation point
+enum PatchType {
+  /// 将注入负载直接修补到目标应用中
+  /// Patch the injected payload directly into the target app
+  INLINE = 0,
+  /// 将注入负载追加到函数末尾，使用短跳转到达
+  /// Append the injected payload to the end of the function, and reach it
+  /// using a short jump
+  OUTLINE = 1,
+  /// 将注入负载追加到函数末尾，使用 <tt>s_getpc</tt>/<tt>s_setpc</tt> 长跳转蹦床到达
+  /// Append the injected payload to the end of the function, and reach it
+  /// using an <tt>s_getpc</tt>/<tt>s_setpc</tt> long jump trampoline
+  OUTLINE_LONG = 2
+};
+
+/// 短跳转（<tt>s_branch</tt>）的字节大小
+/// Size of a short jump (<tt>s_branch</tt>) in bytes
+constexpr uint64_t ShortJumpSize = 4;
+
+/// 长跳转蹦床字节大小的上限，包括在 SCC 存活时保存和恢复 SCC 的指令
+/// Upper bound of the size of a long jump trampoline in bytes, including the
+/// instructions saving and restoring SCC when it is live
+constexpr uint64_t LongJumpSize = 32;
+
+/// 一个插桩点及其注入负载的大小
+/// An instrumentation point and the size of its injected payload
+struct PatchSite {
+  /// 插桩点在修补前距函数开头的字节偏移
+  /// Offset of the instrumentation point from the beginning of the function
+  /// in bytes, before patching
+  uint64_t Offset;
+  /// 注入负载的估计字节大小
+  /// Estimated size of the injected payload in bytes
+  uint64_t PayloadSize;
+};
+
+/// 函数的一条直接分支
+/// A direct branch of the function
+struct PatchBranch {
+  /// 分支指令在修补前的字节偏移
+  /// Offset of the branch instruction in bytes, before patching
+  uint64_t Offset;
+  /// 分支目标块开头在修补前的字节偏移
+  /// Offset of the beginning of the branch target block in bytes, before
+  /// patching
+  uint64_t TargetOffset;
+};
+
+/// \return 短跳转可以到达的最大字节距离；可通过隐藏选项
+/// <tt>-luthier-short-branch-offset-bits</tt> 缩小，以便测试长跳转
+/// \return the maximum distance in bytes a short jump can reach; Can be
+/// narrowed with the hidden <tt>-luthier-short-branch-offset-bits</tt> option
+/// to test long jumps
+uint64_t getShortBranchRange();
+
+/// 规划函数中每个注入负载的修补方式
+/// \details 负载默认内联；当分支因其与目标之间内联的负载而超出范围时，该区域中最大的负载
+/// 会被外联，直到分支可以到达其目标，从而使较小的负载保持内联。当外联负载距其插桩点
+/// 超出范围时，改用长跳转蹦床
+/// \note 任意大小的负载和函数都可以通过长跳转蹦床布局；唯一的限制是应用自身的分支不会被
+/// 松弛：如果在外联其间所有负载后，留在原处的跳转（每个 4 字节，长跳转为 32 字节）仍使
+/// 分支超出范围，则无法修补该函数
+/// \param Sites 函数的插桩点，按偏移排序；负载插入在该偏移处的指令之前
+/// \param Branches 函数的直接分支
+/// \param FunctionSize 修补前函数的字节大小
+/// \param BranchRange 短跳转可以到达的最大字节距离
+/// \param OutlineAll 如果为 \c true 则不内联任何负载
+/// \return 每个插桩点的修补方式，顺序与 \p Sites 相同；如果在外联所有相关负载后分支
+/// 仍无法到达其目标，则返回 \c llvm::Error
+/// Plans how each injected payload of a function is patched
+/// \details Payloads are inlined by default; When a branch goes out of range
+/// due to the payloads inlined between it and its target, the largest
+/// payloads of that region are outlined until the branch reaches its target,
+/// keeping smaller payloads inline. Outlined payloads that are out of range of
+/// their instrumentation point use a long jump trampoline instead
+/// \note Payloads and functions of any size can be laid out through long
+/// jump trampolines; The only limit is that the app's own branches are never
+/// relaxed: If the jumps left in place of the payloads between a branch and
+/// its target (4 bytes each, 32 bytes for long jumps) still push the branch
+/// out of range after outlining all of them, the function cannot be patched
+/// \param Sites instrumentation points of the function, sorted by offset;
+/// Payloads are inserted before the instruction at their offset
+/// \param Branches direct branches of the function
+/// \param FunctionSize size of the function before patching in bytes
+/// \param BranchRange maximum distance in bytes a short jump can reach
+/// \param OutlineAll if \c true, no payload is inlined
+/// \return the patch type of each instrumentation point, in the same order
+/// as \p Sites; An \c llvm::Error if a branch still cannot reach its target
+/// after outlining all payloads involved
+llvm::Expected<llvm::SmallVector<PatchType>>
+planPatchLayout(llvm::ArrayRef<PatchSite> Sites,
+                llvm::ArrayRef<PatchBranch> Branches, uint64_t FunctionSize,
+                uint64_t BranchRange, bool OutlineAll = false);
+
+} // namespace luthier
+
+#endif
@@ -21,41 +21,58 @@
 //===----------------------------------------------------------------------===//
 #ifndef LUTHIER_TOOLING_PATCH_LIFTED_REPRESENTATION_H
 #define LUTHIER_TOOLING_PATCH_LIFTED_REPRESENTATION_H
+#include "luthier/Tooling/PatchLayout.h"
 #include <llvm/CodeGen/MachineBasicBlock.h>
 #include <llvm/CodeGen/MachineModuleInfo.h>
 #include <llvm/IR/PassManager.h>
 
 namespace luthier {
 
+class IModuleCodeGenResult;
+
 class PatchLiftedRepresentationPass
     : public llvm::PassInfoMixin<PatchLiftedRepresentationPass> {
-public:
-  enum PatchType {
-    INLINE = 0,  ///< Patch the injected payload directly into the target app
-    OUTLINE = 1, ///< Append the injected payload to the end/beginning
-                 ///< of the function, jump to the injected
-                 ///< payload using a short jump
+private:
+  /// An injected payload to be patched before an instruction of the target
+  /// app
+  struct PayloadPatchSite {
+    /// The instruction the injected payload is patched before
+    llvm::MachineInstr *InsertionPoint;
+    /// The instrumentation point of the injected payload; Differs from
+    /// \c InsertionPoint when the pre-amble emitter placed code in between
+    const llvm::MachineInstr *InstPoint;
+    /// The machine code of the injected payload
+    const llvm::MachineFunction *PayloadMF;
   };
 
-private:
   /// The instrumentation module
   llvm::Module &IModule;
-  /// The instrumentation machine module info
-  llvm::MachineModuleInfo &IMMI;
+  /// The machine code generated for the instrumentation module
+  const IModuleCodeGenResult &CodeGenResult;
+  /// Mapping between the instrumentation points in the target app and the
+  /// machine code of the injected payload that will be patched into them
+  llvm::DenseMap<const llvm::MachineInstr *, const llvm::MachineFunction *>
+      InstPointToPayloadMF;
   /// Keeps track of the estimated size of each MF in bytes inside the
   /// instrumentation module
   llvm::SmallDenseMap<const llvm::MachineFunction *, uint64_t, 8>
       IModuleFuncSizes;
 
-  llvm::DenseMap<const llvm::MachineFunction *,
-                 PatchLiftedRepresentationPass::PatchType>
+  /// Decides how the injected payload of each of the \p PatchSites is
+  /// patched into its function; Payloads are inlined unless a branch of
+  /// their function would go out of range, in which case only the payloads
+  /// of the out-of-range regions are outlined
+  /// \return a mapping between the insertion point of each patch site and
+  /// its patch type, or an \c llvm::Error if a function cannot be patched
+  llvm::Expected<llvm::DenseMap<const llvm::MachineInstr *, PatchType>>
   decidePatchingMethod(llvm::Module &TargetAppM,
-                       llvm::ModuleAnalysisManager &TargetMAM);
+                       llvm::ModuleAnalysisManager &TargetMAM,
+                       llvm::ArrayRef<PayloadPatchSite> PatchSites);
 
 public:
   PatchLiftedRepresentationPass(llvm::Module &IModule,
-                                llvm::MachineModuleInfo &IMMI)
-      : IModule(IModule), IMMI(IMMI) {};
+                                const IModuleCodeGenResult &CodeGenResult)
+      : IModule(IModule), CodeGenResult(CodeGenResult) {};
 
   llvm::PreservedAnalyses run(llvm::Module &TargetAppM,
                               llvm::ModuleAnalysisManager &);
@@ -0,0 +1,123 @@
+//===-- PayloadOutlining.h - Injected Payload Outlining ---------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了注入负载的外联，它将负载追加到被插桩函数的末尾，并通过短跳转或
+/// <tt>s_getpc</tt>/<tt>s_setpc</tt> 长跳转蹦床往返于其插桩点。
+/// This file describes the outlining of injected payloads, which appends a
+/// payload to the end of the instrumented function, and jumps to and from its
+/// instrumentation point using either a short jump or an
+/// <tt>s_getpc</tt>/<tt>s_setpc</tt> long jump trampoline.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_PAYLOAD_OUTLINING_H
+#define LUTHIER_TOOLING_PAYLOAD_OUTLINING_H
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/CodeGen/MachineBasicBlock.h>
+#include <llvm/MC/MCRegister.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include <utility>
+
+namespace llvm {
+
+class LivePhysRegs;
+
+} // namespace llvm
+
+namespace luthier {
+
+/// 选择通往和来自外联注入负载的长跳转所使用的寄存器：一个用于计算跳转目标的 SGPR 对，
+/// 以及在 SCC 存活时用于保存 SCC 的一个 SGPR
+/// \param MF 被插桩的函数
+/// \param UsedRegs 在插桩点不能被覆盖的寄存器，例如应用的存活寄存器、状态值数组的
+/// 寄存器以及钩子读取的寄存器；选中的寄存器会被加入其中
+/// \param IsSCCLive SCC 在插桩点是否存活
+/// \return 跳转目标寄存器对以及 SCC 保存寄存器；如果 SCC 不存活，则后者无效；
+/// 如果找不到空闲寄存器则返回 \c llvm::Error
+/// Picks the registers used by the long jumps to and from an outlined
+/// injected payload: an SGPR pair to compute the jump target in, and if SCC
+/// is live, an SGPR to preserve SCC in
+/// \param MF the instrumented function
+/// \param UsedRegs registers that must not be clobbered at the
+/// instrumentation point, e.g. the live registers of the app, the registers
+/// of the state value array and the registers read by the hooks; The picked
+/// registers are added to it
+/// \param IsSCCLive whether SCC is live at the instrumentation point
+/// \return the jump target register pair and the SCC save register; The
+/// latter is invalid if SCC is not live; An \c llvm::Error if no free
+/// registers could be found
+llvm::Expected<std::pair<llvm::MCRegister, llvm::MCRegister>>
+pickLongJumpRegs(const llvm::MachineFunction &MF, llvm::LivePhysRegs &UsedRegs,
+                 bool IsSCCLive);
+
+/// 将注入负载的基本块 \p PayloadMBB 的指令克隆到 \p DstMBB 中 \p InsertionPoint 之前；
+/// 返回块的终结指令不会被克隆
+/// \param MBBMap 负载的每个基本块到其在被插桩函数中副本的映射
+/// \param VMap 插桩模块的全局值到其在被插桩代码中副本的映射
+/// \return 如果指令引用了 \p VMap 中没有的全局值，则返回 \c llvm::Error
+/// Clones the instructions of the injected payload block \p PayloadMBB into
+/// \p DstMBB before \p InsertionPoint; The terminators of return blocks are
+/// not cloned
+/// \param MBBMap mapping between each block of the payload and its copy in
+/// the instrumented function
+/// \param VMap mapping between the global values of the instrumentation
+/// module and their copies in the instrumented code
+/// \return an \c llvm::Error if an instruction refers to a global value not
+/// in \p VMap
+llvm::Error clonePayloadInstructions(
+    const llvm::MachineBasicBlock &PayloadMBB, llvm::MachineBasicBlock &DstMBB,
+    llvm::MachineBasicBlock::iterator InsertionPoint,
+    const llvm::DenseMap<const llvm::MachineBasicBlock *,
+                         llvm::MachineBasicBlock *> &MBBMap,
+    const llvm::ValueToValueMapTy &VMap);
+
+/// 将 \p InjectedPayloadMF 外联到 \p InsertionPointMI 所在函数的末尾；在
+/// \p InsertionPointMI 之前跳转到负载，负载的返回块跳转回 \p InsertionPointMI
+/// \param InjectedPayloadMF 要外联的注入负载
+/// \param InsertionPointMI 负载在其之前执行的指令
+/// \param MBBMap 负载的每个基本块到其在被插桩函数中副本的映射；由本函数填充
+/// \param VMap 插桩模块的全局值到其在被插桩代码中副本的映射
+/// \param LongJumpPCReg 如果有效，则使用长跳转蹦床并在此 SGPR 对中计算跳转目标；
+/// 否则使用短跳转
+/// \param SCCSaveReg 如果有效，则长跳转在此 SGPR 中保存 SCC，并在跳转后恢复
+/// \return 如果负载无法被克隆，则返回 \c llvm::Error
+/// Outlines \p InjectedPayloadMF to the end of the function of
+/// \p InsertionPointMI; The payload is jumped to right before
+/// \p InsertionPointMI, and its return blocks jump back to
+/// \p InsertionPointMI
+/// \param InjectedPayloadMF the injected payload to outline
+/// \param InsertionPointMI the instruction the payload runs before
+/// \param MBBMap mapping between each block of the payload and its copy in
+/// the instrumented function; Populated by this function
+/// \param VMap mapping between the global values of the instrumentation
+/// module and their copies in the instrumented code
+/// \param LongJumpPCReg if valid, long jump trampolines are used, and their
+/// target is computed in this SGPR pair; Otherwise, short jumps are used
+/// \param SCCSaveReg if valid, long jumps save SCC into this SGPR, and
+/// restore it after jumping
+/// \return an \c llvm::Error if the payload could not be cloned
+llvm::Error
+outlineInjectedPayload(const llvm::MachineFunction &InjectedPayloadMF,
+                       llvm::MachineInstr &InsertionPointMI,
+                       llvm::DenseMap<const llvm::MachineBasicBlock *,
+                                      llvm::MachineBasicBlock *> &MBBMap,
+                       const llvm::ValueToValueMapTy &VMap,
+                       llvm::MCRegister LongJumpPCReg,
+                       llvm::MCRegister SCCSaveReg);
+
+} // namespace luthier
+
+#endif
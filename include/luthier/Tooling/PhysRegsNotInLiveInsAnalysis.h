@@ -36,15 +36,22 @@ private:
 public:
   class Result {
     std::unique_ptr<llvm::LivePhysRegs> Regs;
+    /// Registers borrowed from a result calculated for another copy of the
+    /// instrumentation module; Takes precedence over \c Regs if not
+    /// \c nullptr
+    const llvm::LivePhysRegs *BorrowedRegs{nullptr};
 
     explicit Result(std::unique_ptr<llvm::LivePhysRegs> Regs)
         : Regs(std::move(Regs)) {}
 
+    explicit Result(const llvm::LivePhysRegs &BorrowedRegs)
+        : BorrowedRegs(&BorrowedRegs) {}
+
     friend class PhysRegsNotInLiveInsAnalysis;
 
   public:
     [[nodiscard]] const llvm::LivePhysRegs &getPhysRegsNotInLiveIns() const {
-      return *Regs;
+      return BorrowedRegs ? *BorrowedRegs : *Regs;
     }
 
     bool invalidate(llvm::Module &, const llvm::PreservedAnalyses &,
@@ -53,8 +60,20 @@ public:
     }
   };
 
+private:
+  /// If not \c nullptr, the registers already gathered for another copy of
+  /// the instrumentation module, used to seed the result of this analysis
+  const llvm::LivePhysRegs *PrecomputedRegs{nullptr};
+
+public:
   PhysRegsNotInLiveInsAnalysis() = default;
 
+  /// Constructor used when the instrumentation module is split across
+  /// code gen workers, where the accessed registers have already been
+  /// gathered from the original module
+  explicit PhysRegsNotInLiveInsAnalysis(const llvm::LivePhysRegs &Precomputed)
+      : PrecomputedRegs(&Precomputed) {};
+
   Result run(llvm::Module &IModule, llvm::ModuleAnalysisManager &IMAM);
 };
 
@@ -42,6 +42,15 @@ private:
                  llvm::Register>
       PhysRegLocationPerMBB;
 
+  /// Number of registers of each pinnable class inside the original
+  /// allocation of the lifted representation, i.e. up to its highest used
+  /// register of that class; Shared by all injected payloads
+  llvm::SmallDenseMap<const llvm::TargetRegisterClass *, unsigned, 4>
+      NumAllocatedRegs{};
+
+  /// The target app module \c NumAllocatedRegs was computed for
+  const llvm::Module *NumAllocatedRegsModule{nullptr};
+
 public:
   static char ID;
 
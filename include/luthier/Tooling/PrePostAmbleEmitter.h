@@ -29,8 +29,10 @@
 #include "luthier/Intrinsic/IntrinsicProcessor.h"
 #include "luthier/Tooling/LiftedRepresentation.h"
 #include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/StringSet.h>
 #include <llvm/CodeGen/MachineFunctionPass.h>
 #include <llvm/Support/Error.h>
+#include <mutex>
 
 namespace luthier {
 
@@ -63,6 +65,9 @@ struct FunctionPreambleDescriptor {
     /// functions
     /// 注入的有效负载函数访问的内核参数集合
     llvm::SmallDenseSet<KernelArgumentType, 8> RequestedKernelArguments{};
+    /// Names of the global counters staged in LDS by the injected payloads
+    /// 注入的有效负载在 LDS 中暂存的全局计数器的名称
+    llvm::StringSet<> LDSCounters{};
   } KernelPreambleSpecs;
 
   /// \brief struct describing the specifications of the preamble code for
@@ -85,6 +90,10 @@ struct FunctionPreambleDescriptor {
     /// payloads
     /// 设备函数注入的有效负载访问的内核参数集合
     llvm::SmallDenseSet<KernelArgumentType, 8> RequestedKernelArguments{};
+    /// Names of the global counters staged in LDS by the device function
+    /// injected payloads
+    /// 设备函数注入的有效负载在 LDS 中暂存的全局计数器的名称
+    llvm::StringSet<> LDSCounters{};
   } DeviceFunctionPreambleSpecs;
 
   FunctionPreambleDescriptor(const llvm::MachineModuleInfo &TargetMMI,
@@ -101,6 +110,33 @@ struct FunctionPreambleDescriptor {
                       DeviceFunctionPreambleSpecs, 4>
       DeviceFunctions{};
 
+  /// LDS offset of each staged counter, assigned by the
+  /// \c PrePostAmbleEmitter on top of the kernel's group segment
+  /// 每个暂存计数器的 LDS 偏移，由 \c PrePostAmbleEmitter 在内核的组段之上分配
+  llvm::StringMap<unsigned> LDSCounterOffsets{};
+
+  /// Maps each \c s_endpgm of the kernel to the first instruction of the
+  /// code flushing the staged counters before it; Injected payloads of the
+  /// \c s_endpgm are patched before the flush instead, so that their counts
+  /// are not lost
+  /// 将内核的每个 \c s_endpgm 映射到其之前刷新暂存计数器代码的第一条指令；
+  /// \c s_endpgm 的注入负载会被插入到刷新代码之前，以免丢失其计数
+  llvm::DenseMap<const llvm::MachineInstr *, llvm::MachineInstr *>
+      LDSCounterFlushes{};
+
+private:
+  /// Kept behind a pointer so that the descriptor remains movable
+  /// 通过指针持有，使描述符保持可移动
+  std::unique_ptr<std::mutex> UpdateMutex{std::make_unique<std::mutex>()};
+
+public:
+  /// Acquires the lock guarding updates to the descriptor; Must be held by
+  /// the code gen passes when they run in parallel over the injected payloads
+  /// 获取保护描述符更新的锁；代码生成 pass 并行处理注入负载时必须持有该锁
+  [[nodiscard]] std::unique_lock<std::mutex> getLock() const {
+    return std::unique_lock(*UpdateMutex);
+  }
+
   /// Never invalidate the results
   /// 永远不使结果失效
   bool invalidate(llvm::Module &, const llvm::PreservedAnalyses &,
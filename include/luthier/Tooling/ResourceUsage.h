@@ -0,0 +1,254 @@
+//===-- ResourceUsage.h - Kernel Resource Usage And Occupancy ---*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了内核资源使用情况、目标的理论占用率模型，以及插桩前后资源使用变化的报告和占用率预算。
+/// This file describes the resource usage of kernels, the theoretical
+/// occupancy model of targets, and the report of resource usage changes caused
+/// by instrumentation along with its occupancy budget.
+/// \details 所有计算都在主机端进行，不需要 GPU
+/// All calculations are done on the host and don't require a GPU
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_RESOURCE_USAGE_H
+#define LUTHIER_TOOLING_RESOURCE_USAGE_H
+#include <cstdint>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/raw_ostream.h>
+#include <optional>
+
+namespace luthier {
+
+/// 内核使用的会限制占用率的资源
+/// Resources used by a kernel which can limit its occupancy
+struct KernelResourceUsage {
+  /// 每个工作项使用的架构 VGPR 数量
+  /// Number of architectural VGPRs used by each work-item
+  unsigned NumVGPRs{0};
+  /// 每个工作项使用的累加 VGPR（AGPR）数量
+  /// Number of accumulation VGPRs (AGPRs) used by each work-item
+  unsigned NumAGPRs{0};
+  /// 每个波前使用的 SGPR 数量
+  /// Number of SGPRs used by each wavefront
+  unsigned NumSGPRs{0};
+  /// 每个工作项的私有段（scratch）大小，以字节为单位
+  /// Size of the private (scratch) segment of each work-item in bytes
+  uint32_t PrivateSegmentSize{0};
+  /// 每个工作组的静态组段（LDS）大小，以字节为单位
+  /// Size of the static group (LDS) segment of each workgroup in bytes
+  uint32_t GroupSegmentSize{0};
+};
+
+/// 目标的寄存器分配和占用率参数
+/// Register allocation and occupancy parameters of a target
+struct OccupancyTarget {
+  /// 波前大小
+  /// Wavefront size
+  unsigned WavefrontSize{64};
+  /// 每个 SIMD 的最大波前数
+  /// Maximum number of wavefronts per SIMD
+  unsigned MaxWavesPerSIMD{10};
+  /// 每个 CU（GFX10+ 上为 WGP）的 SIMD 数量
+  /// Number of SIMDs per CU (WGP on GFX10+)
+  unsigned SIMDsPerCU{4};
+  /// 每个 SIMD 的每通道 VGPR 总数
+  /// Total number of VGPRs per lane of each SIMD
+  unsigned VGPRsPerSIMD{256};
+  /// VGPR 的分配粒度
+  /// Allocation granule of VGPRs
+  unsigned VGPRAllocGranule{4};
+  /// 内核描述符中 VGPR 数量的编码粒度
+  /// Encoding granule of the VGPR count in the kernel descriptor
+  unsigned VGPREncodingGranule{4};
+  /// AGPR 是否与 VGPR 在同一寄存器文件中，并分配在其之后（GFX90A+）；否则 AGPR 位于大小相同的独立寄存器文件中
+  /// Whether AGPRs share the register file of VGPRs and are allocated after
+  /// them (GFX90A+); Otherwise AGPRs reside in a separate register file of the
+  /// same size
+  bool HasUnifiedAGPRs{false};
+  /// 每个 SIMD 的 SGPR 总数；如果 SGPR 不限制占用率（GFX10+）则为零
+  /// Total number of SGPRs per SIMD; Zero if SGPRs don't limit occupancy
+  /// (GFX10+)
+  unsigned SGPRsPerSIMD{800};
+  /// SGPR 的分配粒度
+  /// Allocation granule of SGPRs
+  unsigned SGPRAllocGranule{16};
+  /// 内核描述符中 SGPR 数量的编码粒度
+  /// Encoding granule of the SGPR count in the kernel descriptor
+  unsigned SGPREncodingGranule{8};
+  /// 每个 CU 的 LDS 大小，以字节为单位
+  /// Size of the LDS of each CU in bytes
+  uint32_t LDSPerCU{65536};
+
+  /// \return 处理器 \p Processor（例如 <tt>gfx90a</tt>）在波前大小为 \p WavefrontSize 时的参数；
+  /// 如果不支持该处理器则返回 \c llvm::Error
+  /// \return the parameters of the \p Processor (e.g. <tt>gfx90a</tt>) when
+  /// running wavefronts of size \p WavefrontSize; An \c llvm::Error if the
+  /// processor is not supported
+  static llvm::Expected<OccupancyTarget> get(llvm::StringRef Processor,
+                                             unsigned WavefrontSize);
+};
+
+/// 从内核描述符的 \c COMPUTE_PGM_RSRC1 中的粒度化寄存器计数解码内核的资源使用情况
+/// \note GFX10+ 的内核描述符不编码 SGPR 数量；此时 <tt>NumSGPRs</tt> 为零
+/// \param GranulatedVGPRCount 粒度化的工作项 VGPR 数量；在 GFX90A+ 上包括 AGPR
+/// \param GranulatedSGPRCount 粒度化的波前 SGPR 数量
+/// \param PrivateSegmentSize 私有段的固定大小
+/// \param GroupSegmentSize 组段的固定大小
+/// \param Target 内核的目标
+/// Decodes the resource usage of a kernel from the granulated register counts
+/// of the \c COMPUTE_PGM_RSRC1 of its kernel descriptor
+/// \note The kernel descriptors of GFX10+ targets don't encode the SGPR count;
+/// <tt>NumSGPRs</tt> is zero in this case
+/// \param GranulatedVGPRCount the granulated work-item VGPR count; Includes
+/// the AGPRs on GFX90A+
+/// \param GranulatedSGPRCount the granulated wavefront SGPR count
+/// \param PrivateSegmentSize the fixed size of the private segment
+/// \param GroupSegmentSize the fixed size of the group segment
+/// \param Target the target of the kernel
+KernelResourceUsage decodeKernelResourceUsage(unsigned GranulatedVGPRCount,
+                                              unsigned GranulatedSGPRCount,
+                                              uint32_t PrivateSegmentSize,
+                                              uint32_t GroupSegmentSize,
+                                              const OccupancyTarget &Target);
+
+/// 从内核元数据中的寄存器数量读取内核的资源使用情况
+/// \details 在 GFX90A+ 上，元数据的 <tt>.vgpr_count</tt> 已经是统一寄存器文件的总数，
+/// 即对齐到 4 的架构 VGPR 数量加上 AGPR 数量；此时 AGPR 会从中减去，以免被计算两次
+/// \param VGPRCount 元数据的 <tt>.vgpr_count</tt>
+/// \param AGPRCount 元数据的 <tt>.agpr_count</tt>（如果存在）
+/// \param SGPRCount 元数据的 <tt>.sgpr_count</tt>
+/// \param PrivateSegmentSize 私有段的固定大小
+/// \param GroupSegmentSize 组段的固定大小
+/// \param Target 内核的目标
+/// Reads the resource usage of a kernel from the register counts of its
+/// metadata
+/// \details On GFX90A+, the <tt>.vgpr_count</tt> of the metadata is already
+/// the total of the unified register file, i.e. the architectural VGPR count
+/// aligned to 4 plus the AGPR count; The AGPRs are subtracted from it in this
+/// case, so that they are not counted twice
+/// \param VGPRCount the <tt>.vgpr_count</tt> of the metadata
+/// \param AGPRCount the <tt>.agpr_count</tt> of the metadata, if present
+/// \param SGPRCount the <tt>.sgpr_count</tt> of the metadata
+/// \param PrivateSegmentSize the fixed size of the private segment
+/// \param GroupSegmentSize the fixed size of the group segment
+/// \param Target the target of the kernel
+KernelResourceUsage
+readKernelResourceUsage(unsigned VGPRCount, std::optional<unsigned> AGPRCount,
+                        unsigned SGPRCount, uint32_t PrivateSegmentSize,
+                        uint32_t GroupSegmentSize,
+                        const OccupancyTarget &Target);
+
+/// 计算使用 \p Usage 的内核在 \p Target 上每个 SIMD 的理论波前数
+/// \details 占用率受 VGPR、SGPR 和 LDS 的限制；私有段大小不限制理论占用率
+/// \param Usage 内核的资源使用情况
+/// \param Target 内核的目标
+/// \param WorkgroupSize 每个工作组的工作项数量，用于计算 LDS 限制
+/// \return 每个 SIMD 的理论波前数；如果内核的单个工作组无法放入一个 CU 则为零
+/// Calculates the theoretical number of wavefronts per SIMD of a kernel
+/// using \p Usage on \p Target
+/// \details Occupancy is limited by VGPRs, SGPRs and LDS; The size of the
+/// private segment doesn't limit the theoretical occupancy
+/// \param Usage the resource usage of the kernel
+/// \param Target the target of the kernel
+/// \param WorkgroupSize number of work-items in each workgroup, used to
+/// calculate the LDS limit
+/// \return the theoretical number of wavefronts per SIMD; Zero if a single
+/// workgroup of the kernel doesn't fit on a CU
+unsigned computeWavesPerSIMD(const KernelResourceUsage &Usage,
+                             const OccupancyTarget &Target,
+                             unsigned WorkgroupSize);
+
+/// 插桩前后内核的资源使用情况和理论占用率
+/// Resource usage and theoretical occupancy of a kernel before and after
+/// instrumentation
+struct ResourceUsageReport {
+  /// 原始内核的资源使用情况
+  /// Resource usage of the original kernel
+  KernelResourceUsage Original{};
+  /// 插桩后内核的资源使用情况
+  /// Resource usage of the instrumented kernel
+  KernelResourceUsage Instrumented{};
+  /// 原始内核每个 SIMD 的理论波前数
+  /// Theoretical wavefronts per SIMD of the original kernel
+  unsigned OriginalWavesPerSIMD{0};
+  /// 插桩后内核每个 SIMD 的理论波前数
+  /// Theoretical wavefronts per SIMD of the instrumented kernel
+  unsigned InstrumentedWavesPerSIMD{0};
+  /// 目标每个 SIMD 的最大波前数
+  /// Maximum wavefronts per SIMD of the target
+  unsigned MaxWavesPerSIMD{0};
+
+  /// \return 插桩导致的每个 SIMD 的波前数损失
+  /// \return the number of wavefronts per SIMD lost due to instrumentation
+  [[nodiscard]] unsigned getOccupancyDrop() const {
+    return OriginalWavesPerSIMD > InstrumentedWavesPerSIMD
+               ? OriginalWavesPerSIMD - InstrumentedWavesPerSIMD
+               : 0;
+  }
+
+  /// 将报告打印到 \p OS
+  /// Prints the report to \p OS
+  void print(llvm::raw_ostream &OS) const;
+};
+
+/// 计算插桩前后内核的资源使用报告
+/// \param Original 原始内核的资源使用情况
+/// \param Instrumented 插桩后内核的资源使用情况
+/// \param Target 内核的目标
+/// \param WorkgroupSize 每个工作组的工作项数量
+/// Computes the resource usage report of a kernel before and after
+/// instrumentation
+/// \param Original the resource usage of the original kernel
+/// \param Instrumented the resource usage of the instrumented kernel
+/// \param Target the target of the kernel
+/// \param WorkgroupSize number of work-items in each workgroup
+ResourceUsageReport
+computeResourceUsageReport(const KernelResourceUsage &Original,
+                           const KernelResourceUsage &Instrumented,
+                           const OccupancyTarget &Target,
+                           unsigned WorkgroupSize);
+
+/// 插桩允许造成的占用率损失
+/// The occupancy loss instrumentation is allowed to cause
+struct OccupancyBudget {
+  /// 插桩后内核每个 SIMD 最多可以损失的波前数；\c std::nullopt 表示不限制
+  /// Maximum number of wavefronts per SIMD the instrumented kernel can lose;
+  /// \c std::nullopt means unlimited
+  std::optional<unsigned> MaxWavesPerSIMDDrop{std::nullopt};
+  /// 超出预算时，是否先使用寄存器压力更低的注入负载选项重新插桩，然后再失败
+  /// Whether to re-instrument with injected payload options of lower register
+  /// pressure before failing when the budget is exceeded
+  bool RetryWithCheaperOptions{true};
+
+  /// \return 通过 <tt>-luthier-max-occupancy-drop</tt> 和
+  /// <tt>-luthier-occupancy-budget-retry</tt> 命令行选项指定的预算
+  /// \return the budget specified via the
+  /// <tt>-luthier-max-occupancy-drop</tt> and
+  /// <tt>-luthier-occupancy-budget-retry</tt> command line options
+  static OccupancyBudget getDefault();
+};
+
+/// 检查 \p Report 是否在 \p Budget 之内
+/// \return 如果超出预算，返回描述资源使用变化的 \c llvm::Error
+/// Checks if the \p Report is within the \p Budget
+/// \return an \c llvm::Error describing the resource usage changes if the
+/// budget is exceeded
+llvm::Error checkOccupancyBudget(const ResourceUsageReport &Report,
+                                 const OccupancyBudget &Budget);
+
+} // namespace luthier
+
+#endif
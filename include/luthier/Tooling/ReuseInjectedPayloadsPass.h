@@ -0,0 +1,75 @@
+//===-- ReuseInjectedPayloadsPass.h -----------------------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file describes the <tt>ReuseInjectedPayloadsPass</tt>, which
+/// records the signature of each instrumentation point and reuses the
+/// machine code of injected payloads generated by a previous instrumentation
+/// when their signature has not changed.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_REUSE_INJECTED_PAYLOADS_PASS_H
+#define LUTHIER_TOOLING_REUSE_INJECTED_PAYLOADS_PASS_H
+#include "luthier/Tooling/InstrumentationRecord.h"
+#include <llvm/IR/PassManager.h>
+
+namespace luthier {
+
+class LiftedRepresentation;
+
+/// \brief Records the signature of each instrumentation point in the
+/// \c InstrumentationRecord being populated, and reuses the injected
+/// payloads of the previous record with matching signatures
+/// \details This pass must run after the IR passes of the instrumentation
+/// module and before the MIR passes. Reused payloads are turned into
+/// declarations inside the instrumentation module, so that the code gen
+/// pipeline skips them; Their previously generated machine code is instead
+/// added as a unit to the \c IModuleCodeGenResult. If the accessed physical
+/// registers not in the live-ins or the pipeline options have changed, the
+/// state value array storage of every instrumentation point can change, and
+/// nothing is reused
+class ReuseInjectedPayloadsPass
+    : public llvm::PassInfoMixin<ReuseInjectedPayloadsPass> {
+private:
+  /// The instrumentation task being applied
+  const InstrumentationTask &Task;
+  /// The lifted representation being instrumented
+  const LiftedRepresentation &LR;
+  /// The instrumentation module
+  llvm::Module &IModule;
+  /// The record of the previous instrumentation; \c nullptr if there is none
+  const InstrumentationRecord *Previous;
+  /// The record being populated
+  InstrumentationRecord &Record;
+  /// Where the reused machine code is handed over to the patching pass
+  IModuleCodeGenResult &Result;
+
+public:
+  ReuseInjectedPayloadsPass(const InstrumentationTask &Task,
+                            const LiftedRepresentation &LR,
+                            llvm::Module &IModule,
+                            const InstrumentationRecord *Previous,
+                            InstrumentationRecord &Record,
+                            IModuleCodeGenResult &Result)
+      : Task(Task), LR(LR), IModule(IModule), Previous(Previous),
+        Record(Record), Result(Result) {};
+
+  llvm::PreservedAnalyses run(llvm::Module &TargetAppM,
+                              llvm::ModuleAnalysisManager &TargetMAM);
+};
+
+} // namespace luthier
+
+#endif
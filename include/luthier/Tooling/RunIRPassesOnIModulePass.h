@@ -21,8 +21,10 @@
 #ifndef LUTHIER_TOOLING_RUN_IR_PASSES_ON_IMODULE_PASS_H
 #define LUTHIER_TOOLING_RUN_IR_PASSES_ON_IMODULE_PASS_H
 #include "luthier/Intrinsic/IntrinsicProcessor.h"
+#include "luthier/Tooling/IModulePipelineOptions.h"
 #include "luthier/Tooling/InstrumentationTask.h"
 #include <llvm/IR/PassManager.h>
+#include <llvm/Passes/PassBuilder.h>
 #include <llvm/Target/TargetMachine.h>
 
 namespace luthier {
@@ -34,12 +36,14 @@ private:
   const InstrumentationTask &Task;
   const llvm::StringMap<IntrinsicProcessor> &IntrinsicProcessors;
   llvm::Module &IModule;
+  const IModulePipelineOptions &Options;
 
 public:
   RunIRPassesOnIModulePass(
       const InstrumentationTask &Task,
       const llvm::StringMap<IntrinsicProcessor> &IntrinsicProcessors,
-      llvm::GCNTargetMachine &TM, llvm::Module &IModule);
+      llvm::GCNTargetMachine &TM, llvm::Module &IModule,
+      const IModulePipelineOptions &Options);
 
   llvm::PreservedAnalyses run(llvm::Module &TargetAppM,
                               llvm::ModuleAnalysisManager &);
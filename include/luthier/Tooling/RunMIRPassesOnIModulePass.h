@@ -18,19 +18,108 @@
 /// This file describes the <tt>RunMIRPassesOnIModulePass</tt>, which
 /// runs the modified code gen pipeline on the instrumentation module to
 /// generate machine IR that will later be patched into the target module.
+/// It also describes the \c IModuleCodeGenResult, which holds the generated
+/// machine code until it is patched into the target module.
 //===----------------------------------------------------------------------===//
 #ifndef LUTHIER_TOOLING_RUN_MIR_PASSES_ON_IMODULE_PASS_H
 #define LUTHIER_TOOLING_RUN_MIR_PASSES_ON_IMODULE_PASS_H
 #include "luthier/Intrinsic/IntrinsicProcessor.h"
+#include "luthier/Tooling/IModuleIRGeneratorPass.h"
+#include "luthier/Tooling/IModulePipelineOptions.h"
+#include "luthier/Tooling/TargetManager.h"
 #include <AMDGPUTargetMachine.h>
+#include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/PassManager.h>
 
 namespace luthier {
 
+/// \brief Machine code generated for a set of injected payloads, ready to be
+/// patched into the target module
+struct InjectedPayloadCodeGenUnit {
+  /// The (copy of the) instrumentation module the payloads were generated from
+  const llvm::Module &IModule;
+  /// The machine module info housing the generated machine code
+  const llvm::MachineModuleInfo &IMMI;
+  /// Mapping between the injected payloads in \c IModule and the
+  /// instrumentation points they will be patched into
+  const InjectedPayloadAndInstPoint &IPIP;
+};
+
+/// \brief State owned by a single code gen worker when the injected payloads
+/// are compiled in parallel
+/// \details Each shard holds a copy of (a part of) the instrumentation module
+/// in its own \c llvm::LLVMContext along with its own target machine, so that
+/// the shards can be compiled concurrently without sharing any LLVM state
+/// besides the read-only analysis results of the target application \n
+/// The fields are declared in an order that ensures the machine code and the
+/// analysis results are destroyed before the module, and the module before
+/// its context
+struct IModuleCodeGenShard {
+  /// The context the shard's module lives in
+  llvm::LLVMContext Context{};
+  /// The target machine used to compile the shard
+  PooledTargetMachine TM{nullptr};
+  /// The shard's copy of the instrumentation module
+  std::unique_ptr<llvm::Module> IModule{nullptr};
+  /// Analysis manager of the shard's module
+  llvm::ModuleAnalysisManager IMAM{};
+  /// Legacy pass manager used to run the code gen pipeline; Owns the
+  /// \c MMIWP
+  std::unique_ptr<llvm::legacy::PassManager> LegacyPM{nullptr};
+  /// Houses the machine code generated for the shard
+  llvm::MachineModuleInfoWrapperPass *MMIWP{nullptr};
+};
+
+/// \brief Holds the machine code generated for the instrumentation module
+/// until the \c PatchLiftedRepresentationPass patches it into the target
+/// module
+class IModuleCodeGenResult {
+private:
+  /// Shards owned by this result if the code was generated in parallel
+  llvm::SmallVector<std::unique_ptr<IModuleCodeGenShard>, 0> Shards{};
+  /// Instrumentation point mappings of units whose machine code was
+  /// generated by a previous instrumentation
+  llvm::SmallVector<std::unique_ptr<InjectedPayloadAndInstPoint>, 0>
+      ReusedIPIPs{};
+  /// The generated code, in the order it must be patched in
+  llvm::SmallVector<InjectedPayloadCodeGenUnit, 1> Units{};
+
+public:
+  IModuleCodeGenResult() = default;
+
+  void addUnit(const llvm::Module &IModule, const llvm::MachineModuleInfo &IMMI,
+               const InjectedPayloadAndInstPoint &IPIP) {
+    Units.push_back({IModule, IMMI, IPIP});
+  }
+
+  /// Adds a unit of machine code generated by a previous instrumentation,
+  /// with its payloads mapped to the instrumentation points of \p IPIP
+  void addReusedUnit(const llvm::Module &IModule,
+                     const llvm::MachineModuleInfo &IMMI,
+                     std::unique_ptr<InjectedPayloadAndInstPoint> IPIP) {
+    ReusedIPIPs.push_back(std::move(IPIP));
+    addUnit(IModule, IMMI, *ReusedIPIPs.back());
+  }
+
+  void addShard(std::unique_ptr<IModuleCodeGenShard> Shard) {
+    Shards.push_back(std::move(Shard));
+  }
+
+  [[nodiscard]] llvm::ArrayRef<InjectedPayloadCodeGenUnit> units() const {
+    return Units;
+  }
+};
+
 /// \brief This pass runs the modified code gen pipeline on the instrumentation
 /// module to generate machine IR that will later be patched into the target
 /// module.
+/// \details If more than one code gen thread is requested, the injected
+/// payloads are split into shards in program order of their instrumentation
+/// points; The first shard is compiled in place on the instrumentation module,
+/// while the others are compiled concurrently by their own workers; The
+/// shards are handed over to the patching pass in the same order, so the
+/// final instrumented code does not depend on the number of threads used
 class RunMIRPassesOnIModulePass
     : public llvm::PassInfoMixin<RunMIRPassesOnIModulePass> {
 private:
@@ -43,12 +132,25 @@ private:
   llvm::MachineModuleInfoWrapperPass &IMMIWP;
   /// The legacy pass manager used to run the codegen pipeline
   llvm::legacy::PassManager &ILegacyPM;
+  /// The pipeline options of the instrumentation task
+  const IModulePipelineOptions &Options;
+  /// Where the generated machine code is stored
+  IModuleCodeGenResult &Result;
+
+  /// Splits the injected payloads of the instrumentation module into at most
+  /// \p NumShards shards and generates their machine code concurrently
+  llvm::Error runInParallel(llvm::Module &TargetAppM,
+                            llvm::ModuleAnalysisManager &TargetMAM,
+                            unsigned NumShards);
 
 public:
   RunMIRPassesOnIModulePass(llvm::GCNTargetMachine &TM, llvm::Module &IModule,
                             llvm::MachineModuleInfoWrapperPass &MMIWP,
-                            llvm::legacy::PassManager &ILegacyPM)
-      : TM(TM), IModule(IModule), IMMIWP(MMIWP), ILegacyPM(ILegacyPM) {};
+                            llvm::legacy::PassManager &ILegacyPM,
+                            const IModulePipelineOptions &Options,
+                            IModuleCodeGenResult &Result)
+      : TM(TM), IModule(IModule), IMMIWP(MMIWP), ILegacyPM(ILegacyPM),
+        Options(Options), Result(Result) {};
 
   llvm::PreservedAnalyses run(llvm::Module &TargetAppM,
                               llvm::ModuleAnalysisManager &TargetMAM);
@@ -56,4 +158,4 @@ public:
 
 } // namespace luthier
 
-#endif
\ No newline at end of file
+#endif
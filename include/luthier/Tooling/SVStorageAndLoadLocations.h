@@ -100,12 +100,33 @@ struct InstPointSVALoadPlan {
   bool LoadDestClobbersAppVGPR{};
   /// Where the state value is located before being loaded into the VGPR
   StateValueArrayStorage &StateValueStorageLocation;
+  /// Whether the injected payload must load the state value array and spill
+  /// the app's frame registers in its prologue; False if the payload of the
+  /// preceding instrumentation point of the same run has already done so
+  bool LoadsSVA{true};
+  /// Whether the injected payload must restore the app's frame registers and
+  /// store the state value array back in its epilogue; False if the payload
+  /// of the following instrumentation point of the same run will do so
+  bool StoresSVA{true};
+
+  /// \return true if the injected payload is part of a run of adjacent
+  /// instrumentation points sharing a single load and store of the state
+  /// value array
+  [[nodiscard]] bool isPartOfRun() const { return !LoadsSVA || !StoresSVA; }
 };
 
 /// \brief an analysis on a \c LiftedRepresentation that determines where the
 /// state value array is stored at each instruction of the
 /// \c LiftedRepresentation as well as where the state value will be loaded
 /// at each instrumentation point.
+/// \details Adjacent instrumentation points of a basic block are grouped into
+/// runs if the application instructions between them don't access the
+/// state value array load VGPR, the state value storage registers, the frame
+/// registers, the registers accessed in place by the payloads, or the exec
+/// mask;
+/// The state value array and the instrumentation frame then remain
+/// materialized across the whole run, and are only loaded before the first
+/// injected payload of the run and stored after its last one
 class SVStorageAndLoadLocations {
 private:
   /// Keeps track of how and where the state value array is stored in each
@@ -120,6 +141,19 @@ private:
   llvm::DenseMap<const llvm::MachineInstr *, InstPointSVALoadPlan>
       InstPointSVSLoadPlans{};
 
+  /// Groups the adjacent instrumentation points of each basic block of
+  /// \p MFs into runs, and updates their load plans to share a single load
+  /// and store of the state value array; Instrumentation points whose
+  /// injected payloads in \p IPIP are predicated are left out of runs, as
+  /// each of them can be skipped on its own
+  /// \param AccessedPhysicalRegistersNotInLiveIns registers accessed in
+  /// place by the injected payloads; App instructions accessing them end
+  /// the run
+  void formSVALoadRuns(
+      llvm::ArrayRef<llvm::MachineFunction *> MFs,
+      const InjectedPayloadAndInstPoint &IPIP,
+      const llvm::LivePhysRegs &AccessedPhysicalRegistersNotInLiveIns);
+
 public:
   SVStorageAndLoadLocations() = default;
 
@@ -133,6 +167,24 @@ public:
       const InjectedPayloadAndInstPoint &IPIP, FunctionPreambleDescriptor &FPD,
       const llvm::LivePhysRegs &AccessedPhysicalRegistersNotInLiveIns);
 
+  /// calculates the storage and load locations of the state value array
+  /// inside \p MF as if no fixed storage location could be found for it
+  /// \details Unlike \c calculate, which only stores the state value array
+  /// in registers the application never uses, the array can be relocated
+  /// into any of \p CandidateRegs, as long as it is not live or written by
+  /// the instruction it is stored across; This exposes the relocation of the
+  /// state value array to offline tests
+  /// \param CandidateRegs the registers the state value array can be stored
+  /// in
+  /// \return an \c llvm::Error indication the success of failure of the
+  /// operation
+  llvm::Error calculateRelocatable(
+      llvm::MachineFunction &MF, const llvm::SlotIndexes &MFSlotIndexes,
+      const AMDGPURegisterLiveness &RegLiveness,
+      const InjectedPayloadAndInstPoint &IPIP,
+      const llvm::LivePhysRegs &CandidateRegs,
+      const llvm::LivePhysRegs &AccessedPhysicalRegistersNotInLiveIns);
+
   /// Given the \p MBB of the \c LiftedRepresentation being worked on by this
   /// analysis, returns the state value array storage of every instruction
   /// interval inside the \p MBB
@@ -20,12 +20,17 @@
 //===----------------------------------------------------------------------===//
 #ifndef LUTHIER_TOOLING_TARGET_MANAGER_H
 #define LUTHIER_TOOLING_TARGET_MANAGER_H
+#include "luthier/Common/KeyedObjectPool.h"
 #include "luthier/Common/Singleton.h"
 #include "luthier/HSA/ISA.h"
 #include "luthier/Rocprofiler/ApiTableSnapshot.h"
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/Target/TargetOptions.h>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <unordered_map>
 #include <vector>
 
@@ -47,7 +52,20 @@ class MCInstPrinter;
 
 class GCNTargetMachine;
 
+class TargetMachine;
+
 class LLVMContext;
+
+class Triple;
+
+class SubtargetFeatures;
+
+namespace object {
+
+class ObjectFile;
+
+} // namespace object
+
 } // namespace llvm
 
 namespace luthier {
@@ -93,6 +111,23 @@ public:
   }
 };
 
+/// \brief 将借用的目标机器归还到 \c TargetManager 的池中
+/// \brief Returns a borrowed target machine to the pool of the
+/// \c TargetManager
+struct TargetMachinePoolReturner {
+  /// 目标机器的 ISA
+  /// ISA of the target machine
+  hsa_isa_t ISA{};
+
+  void operator()(llvm::GCNTargetMachine *TM) const;
+};
+
+/// \brief 从 \c TargetManager 的池中借用的目标机器；销毁时被归还到池中
+/// \brief A target machine borrowed from the pool of the \c TargetManager;
+/// Gets returned to the pool when destroyed
+typedef std::unique_ptr<llvm::GCNTargetMachine, TargetMachinePoolReturner>
+    PooledTargetMachine;
+
 /// \brief in charge of creating and managing LLVM constructs that are shared
 /// among different components of Luthier (e.g. CodeLifter, CodeGenerator)
 /// Initializes the AMDGPU LLVM target upon construction, and shuts down LLVM
@@ -101,8 +136,36 @@ public:
 /// 在构造时初始化 AMDGPU LLVM 目标，并在析构时关闭 LLVM
 class TargetManager : public Singleton<TargetManager> {
 private:
+  /// Protects the \c LLVMTargetInfo cache; Cache hits only take a shared lock
+  /// 保护 \c LLVMTargetInfo 缓存；缓存命中只获取共享锁
+  mutable std::shared_mutex TargetInfoMutex{};
+
   mutable std::unordered_map<hsa_isa_t, TargetInfo> LLVMTargetInfo{};
 
+  /// Creates the MC-level LLVM constructs of \p Isa without caching them
+  /// 创建 \p Isa 的 MC 层 LLVM 构造，但不缓存它们
+  llvm::Expected<TargetInfo> createTargetInfo(hsa_isa_t Isa) const;
+
+  /// Protects the \c ISAMap
+  /// 保护 \c ISAMap
+  mutable std::shared_mutex ISAMutex{};
+
+  /// Memoized mapping between the triple, CPU and features of a target and
+  /// its \c hsa_isa_t, to avoid round-tripping through HSA ISA names
+  /// 目标的三元组、CPU 和特性与其 \c hsa_isa_t 之间的记忆化映射，以避免通过 HSA ISA 名称往返
+  mutable llvm::StringMap<hsa_isa_t> ISAMap{};
+
+  /// Target machines not currently borrowed, per ISA; They are reset to
+  /// the default target options and optimization level upon being returned
+  /// 每个 ISA 当前未被借用的目标机器；归还时它们被重置为默认的目标选项和优化级别
+  mutable KeyedObjectPool<hsa_isa_t, llvm::GCNTargetMachine> TargetMachinePool;
+
+  friend TargetMachinePoolReturner;
+
+  /// Returns the borrowed \p TM of \p ISA to the pool
+  /// 将借用的 \p ISA 的 \p TM 归还到池中
+  void returnTargetMachine(hsa_isa_t ISA, llvm::GCNTargetMachine *TM) const;
+
   const rocprofiler::HsaApiTableSnapshot<::CoreApiTable> &CoreApiTableSnapshot;
 
 public:
@@ -131,6 +194,35 @@ public:
   llvm::Expected<std::unique_ptr<llvm::GCNTargetMachine>>
   createTargetMachine(hsa_isa_t ISA,
                       const llvm::TargetOptions &TargetOptions = {}) const;
+
+  /// Borrows an \c llvm::GCNTargetMachine of the \p ISA with default target
+  /// options from the pool, creating a new one if none is available \n
+  /// Reusing target machines avoids re-creating them and their subtargets
+  /// for every lifted or instrumented kernel; The borrower is free to modify
+  /// the options and the optimization level of the target machine, which
+  /// are reset when it is returned to the pool
+  /// \param ISA \c hsa::ISA of the target
+  /// \return the borrowed target machine, which is returned to the pool once
+  /// destroyed, or an \c llvm::Error if the process fails
+  /// 从池中借用具有默认目标选项的 \p ISA 的 \c llvm::GCNTargetMachine，如果没有可用的则创建一个新的
+  llvm::Expected<PooledTargetMachine>
+  borrowTargetMachine(hsa_isa_t ISA) const;
+
+  /// \return the \c hsa_isa_t of the target described by \p TT, \p CPU and
+  /// \p Features; Results are memoized
+  /// 返回由 \p TT、\p CPU 和 \p Features 描述的目标的 \c hsa_isa_t；结果被记忆化
+  llvm::Expected<hsa_isa_t>
+  getISA(const llvm::Triple &TT, llvm::StringRef CPU,
+         const llvm::SubtargetFeatures &Features) const;
+
+  /// \return the \c hsa_isa_t the \p ObjFile targets; Results are memoized
+  /// 返回 \p ObjFile 的目标 \c hsa_isa_t；结果被记忆化
+  llvm::Expected<hsa_isa_t>
+  getISA(const llvm::object::ObjectFile &ObjFile) const;
+
+  /// \return the \c hsa_isa_t the \p TM targets; Results are memoized
+  /// 返回 \p TM 的目标 \c hsa_isa_t；结果被记忆化
+  llvm::Expected<hsa_isa_t> getISA(const llvm::TargetMachine &TM) const;
 };
 
 } // namespace luthier
@@ -32,6 +32,7 @@
 #include "luthier/HSA/LoadedCodeObject.h"
 #include "luthier/HSA/LoadedCodeObjectKernel.h"
 #include "luthier/Rocprofiler/ApiTableWrapperInstaller.h"
+#include "luthier/Tooling/DispatchOverrideTable.h"
 #include "luthier/Tooling/InstrumentationModule.h"
 #include "luthier/types.h"
 #include <hip/amd_detail/amd_hip_vector_types.h>
@@ -41,6 +42,7 @@
 #include <llvm/ADT/StringMap.h>
 #include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 #include <llvm/IR/Module.h>
+#include <shared_mutex>
 #include <vector>
 
 namespace luthier {
@@ -55,9 +57,10 @@ class LoadedCodeObjectCache;
 /// 插桩模块，以及启动插桩内核
 class ToolExecutableLoader : public Singleton<ToolExecutableLoader> {
 private:
-  /// Mutex to protect internal state of the loader
-  /// 用于保护加载器内部状态的互斥锁
-  std::recursive_mutex Mutex;
+  /// Mutex to protect internal state of the loader; Lookups of instrumented
+  /// kernels only take a shared lock so that they can proceed concurrently
+  /// 用于保护加载器内部状态的互斥锁；插桩内核的查找只获取共享锁，因此可以并发进行
+  mutable std::shared_mutex Mutex;
 
   /// Table snapshot used to invoke HSA core operations
   /// 用于调用 HSA 核心操作的表快照
@@ -97,6 +100,18 @@ private:
   llvm::DenseMap<hsa_executable_t, llvm::DenseSet<hsa_executable_t>>
       OriginalExecutablesWithKernelsInstrumented{};
 
+  /// Integer IDs assigned to each preset name, in order of first use
+  /// 按首次使用顺序分配给每个预设名称的整数 ID
+  llvm::StringMap<InstrumentationPresetID> PresetIDs{};
+
+  /// Precomputed overrides of each instrumented kernel, keyed by the address
+  /// of the original kernel descriptor and the preset ID; Populated when an
+  /// instrumented kernel is loaded, and looked up without taking the
+  /// \c Mutex at dispatch time
+  /// 每个插桩内核的预计算覆盖，以原始内核描述符地址和预设 ID 为键；在加载插桩
+  /// 内核时填充，并在调度时不获取 \c Mutex 进行查找
+  DispatchOverrideTable DispatchOverrides{};
+
   static t___hipRegisterFunction UnderlyingHipRegisterFn;
 
   static decltype(hsa_executable_freeze) *UnderlyingHsaExecutableFreezeFn;
@@ -142,6 +157,18 @@ public:
                          llvm::StringRef Preset,
                          const llvm::StringMap<const void *> &ExternVariables);
 
+  /// Parses the metadata of the instrumented version of \p OriginalKernel
+  /// inside the \p InstrumentedElf before it is loaded
+  /// \param InstrumentedElf the linked instrumented code object
+  /// \param OriginalKernel the un-instrumented original kernel
+  /// \return the metadata of the instrumented kernel, or an \c llvm::Error
+  /// if the metadata of the kernel is not found or is malformed
+  /// 在加载之前解析 \p InstrumentedElf 中 \p OriginalKernel 的插桩版本的元数据
+  [[nodiscard]] llvm::Expected<std::unique_ptr<amdgpu::hsamd::Kernel::Metadata>>
+  parseInstrumentedKernelMetadata(
+      llvm::ArrayRef<uint8_t> InstrumentedElf,
+      const hsa::LoadedCodeObjectKernel &OriginalKernel) const;
+
   /// Returns the instrumented kernel's \c hsa::ExecutableSymbol given its
   /// original un-instrumented version's \c hsa::ExecutableSymbol and the
   /// preset name it was instrumented under \n
@@ -157,6 +184,33 @@ public:
   getInstrumentedKernel(hsa_executable_symbol_t OriginalKernel,
                         llvm::StringRef Preset) const;
 
+  /// Returns the ID of the \p Preset name, assigning it a new one if the
+  /// preset was never used before \n
+  /// Tools can query the ID once, and use it to override dispatch packets
+  /// without any string lookups
+  /// 返回 \p Preset 名称的 ID；如果该预设从未被使用过，则为其分配一个新 ID
+  [[nodiscard]] InstrumentationPresetID
+  getOrCreatePresetID(llvm::StringRef Preset);
+
+  /// \return the ID of the \p Preset name if it was ever used, or
+  /// \c std::nullopt otherwise
+  /// \return 如果 \p Preset 名称曾被使用过则返回其 ID，否则返回 \c std::nullopt
+  [[nodiscard]] std::optional<InstrumentationPresetID>
+  lookupPresetID(llvm::StringRef Preset) const;
+
+  /// Looks up the precomputed override of the kernel with the original
+  /// kernel descriptor address \p OriginalKernelObject under \p Preset
+  /// without taking any locks
+  /// \return the override if the kernel was instrumented under \p Preset,
+  /// or \c std::nullopt otherwise
+  /// 不加锁地查找原始内核描述符地址为 \p OriginalKernelObject 的内核在
+  /// \p Preset 下的预计算覆盖
+  [[nodiscard]] std::optional<DispatchOverride>
+  lookupDispatchOverride(uint64_t OriginalKernelObject,
+                         InstrumentationPresetID Preset) const {
+    return DispatchOverrides.lookup(OriginalKernelObject, Preset);
+  }
+
   /// Checks if the given \p Kernel is instrumented under the given \p Preset
   /// \return \c true if it's instrumented, \c false otherwise
   /// 检查给定的 \p Kernel 是否在给定的 \p Preset 下被插桩
@@ -172,6 +226,16 @@ public:
   ~ToolExecutableLoader() override;
 
 private:
+  /// Same as \c isKernelInstrumented, but expects the caller to hold the
+  /// \c Mutex
+  [[nodiscard]] bool
+  isKernelInstrumentedUnlocked(hsa_executable_symbol_t Kernel,
+                               llvm::StringRef Preset) const {
+    auto It = OriginalToInstrumentedKernelsMap.find(Kernel);
+    return It != OriginalToInstrumentedKernelsMap.end() &&
+           It->second.contains(Preset);
+  }
+
   void insertInstrumentedKernelIntoMap(
       const hsa_executable_t OriginalExecutable,
       const hsa_executable_symbol_t OriginalKernel, llvm::StringRef Preset,
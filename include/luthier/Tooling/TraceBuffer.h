@@ -0,0 +1,260 @@
+//===-- TraceBuffer.h - Luthier Trace Buffer --------------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief 本文件描述了跟踪缓冲区的主机端，以及在内核运行时消费设备追加的记录的排出线程。
+/// This file describes the host side of trace buffers, as well as the drain
+/// thread which consumes the records appended by the device while kernels
+/// are running.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TOOLING_TRACE_BUFFER_H
+#define LUTHIER_TOOLING_TRACE_BUFFER_H
+#include "luthier/trace.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/Support/Error.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace luthier {
+
+/// \brief 由设备通过 \c traceAppend 填充、由主机排出的记录环形缓冲区
+/// \details 缓冲区的内存由调用者提供的分配器分配；为了在内核运行时排出记录，内存必须是主机和设备均可访问的细粒度（系统一致性）内存。
+/// 在 CPU 上（例如在测试中）也可以使用普通主机内存，并由模拟的生产者遵循 \c TraceBufferHeader 描述的协议来填充。\n
+/// 一次只能有一个消费者排出缓冲区；\c drain 在内部被串行化
+/// \brief A ring buffer of records populated by the device via
+/// \c traceAppend and drained by the host
+/// \details The memory of the buffer is allocated with an allocator provided
+/// by the caller; To drain records while kernels are running, the memory
+/// must be fine-grained (i.e. system-coherent) and accessible to both the host
+/// and the device. On the CPU (e.g. in tests), plain host memory can be used
+/// as well, populated by a simulated producer following the protocol
+/// described by \c TraceBufferHeader.\n
+/// Only a single consumer can drain the buffer at a time; \c drain is
+/// serialized internally
+class TraceBuffer {
+public:
+  /// 分配缓冲区内存的函数类型；失败时返回 \c nullptr
+  /// Type of the function allocating the buffer's memory; Returns
+  /// \c nullptr on failure
+  typedef std::function<void *(uint64_t Size)> AllocateFunc;
+
+  /// 释放缓冲区内存的函数类型
+  /// Type of the function freeing the buffer's memory
+  typedef std::function<void(void *Ptr)> DeallocateFunc;
+
+  /// 对每个被消费的记录调用的函数类型；记录的内容仅在调用期间有效
+  /// Type of the function invoked on each consumed record; The contents of
+  /// the record are only valid for the duration of the call
+  typedef llvm::function_ref<void(llvm::ArrayRef<uint8_t> Record)>
+      RecordConsumer;
+
+private:
+  /// 缓冲区内存的开头
+  /// Beginning of the buffer's memory
+  TraceBufferHeader *Header;
+
+  /// 用于释放 \c Header 的函数
+  /// Used to free the \c Header
+  DeallocateFunc Deallocate;
+
+  /// 串行化对缓冲区的排出
+  /// Serializes draining the buffer
+  std::mutex DrainMutex{};
+
+  /// 主机要消费的下一个槽位的索引
+  /// Index of the next slot to be consumed by the host
+  uint64_t NextSlot{0};
+
+  /// 主机已消费的记录数
+  /// Number of records consumed by the host
+  std::atomic<uint64_t> NumConsumed{0};
+
+  /// 在 \c TRACE_BUFFER_OVERWRITE_OLDEST 策略下被主机消费之前就被覆盖的记录数
+  /// Number of records overwritten before being consumed by the host under
+  /// the \c TRACE_BUFFER_OVERWRITE_OLDEST policy
+  std::atomic<uint64_t> NumLost{0};
+
+  TraceBuffer(TraceBufferHeader *Header, DeallocateFunc Deallocate)
+      : Header(Header), Deallocate(std::move(Deallocate)) {}
+
+  /// \return 指向 \p Slot 的标签的指针
+  /// \return a pointer to the tag of the \p Slot
+  [[nodiscard]] uint64_t *getSlotTag(uint64_t Slot) const;
+
+public:
+  /// \return 具有 \p Capacity 个 \p RecordSize 字节记录槽位的缓冲区所需的字节数
+  /// \return the number of bytes required for a buffer with \p Capacity
+  /// record slots of \p RecordSize bytes
+  static uint64_t getAllocationSize(uint32_t Capacity, uint32_t RecordSize);
+
+  /// 创建一个新的跟踪缓冲区
+  /// \param Capacity 记录槽位的数量；必须是 2 的幂
+  /// \param RecordSize 每条记录的字节数；必须是 8 的倍数
+  /// \param Policy 缓冲区满时设备的行为
+  /// \param Allocate 用于分配缓冲区内存的函数
+  /// \param Deallocate 用于在缓冲区销毁时释放其内存的函数
+  /// \return 新创建的缓冲区，或者在失败时返回 \c llvm::Error
+  /// Creates a new trace buffer
+  /// \param Capacity number of record slots; Must be a power of two
+  /// \param RecordSize number of bytes of each record; Must be a multiple of 8
+  /// \param Policy behavior of the device when the buffer is full
+  /// \param Allocate function used to allocate the memory of the buffer
+  /// \param Deallocate function used to free the memory of the buffer when
+  /// it is destroyed
+  /// \return the newly created buffer, or an \c llvm::Error on failure
+  static llvm::Expected<std::unique_ptr<TraceBuffer>>
+  create(uint32_t Capacity, uint32_t RecordSize,
+         TraceBufferOverflowPolicy Policy, const AllocateFunc &Allocate,
+         DeallocateFunc Deallocate);
+
+  TraceBuffer(const TraceBuffer &) = delete;
+
+  TraceBuffer &operator=(const TraceBuffer &) = delete;
+
+  ~TraceBuffer();
+
+  /// \return 要传递给设备代码的缓冲区地址
+  /// \return the address of the buffer to be passed to the device code
+  [[nodiscard]] TraceBufferHeader *getDeviceHandle() const { return Header; }
+
+  /// \return 缓冲区的记录槽位数
+  /// \return the number of record slots of the buffer
+  [[nodiscard]] uint32_t getCapacity() const { return Header->Capacity; }
+
+  /// \return 每条记录的字节数
+  /// \return the number of bytes of each record
+  [[nodiscard]] uint32_t getRecordSize() const { return Header->RecordSize; }
+
+  /// \return 缓冲区的溢出策略
+  /// \return the overflow policy of the buffer
+  [[nodiscard]] TraceBufferOverflowPolicy getOverflowPolicy() const {
+    return static_cast<TraceBufferOverflowPolicy>(Header->OverflowPolicy);
+  }
+
+  /// 按顺序消费设备已发布的记录，直到遇到尚未发布的记录或消费了 \p MaxRecords 条记录
+  /// \param Consumer 对每个被消费的记录调用的函数
+  /// \param MaxRecords 要消费的最大记录数
+  /// \return 被消费的记录数
+  /// Consumes the records published by the device in order, until a record
+  /// that is not yet published is encountered, or \p MaxRecords records are
+  /// consumed
+  /// \param Consumer function invoked on each consumed record
+  /// \param MaxRecords maximum number of records to consume
+  /// \return the number of consumed records
+  size_t drain(RecordConsumer Consumer,
+               size_t MaxRecords = std::numeric_limits<size_t>::max());
+
+  /// \return 主机已消费的记录数
+  /// \return the number of records consumed by the host
+  [[nodiscard]] uint64_t getNumConsumed() const { return NumConsumed.load(); }
+
+  /// \return 设备在 \c TRACE_BUFFER_DROP_NEWEST 策略下丢弃的记录数，以及因大于记录大小而被丢弃的记录数
+  /// \return the number of records dropped by the device under the
+  /// \c TRACE_BUFFER_DROP_NEWEST policy, or for being larger than the record
+  /// size of the buffer
+  [[nodiscard]] uint64_t getNumDropped() const;
+
+  /// \return 在 \c TRACE_BUFFER_OVERWRITE_OLDEST 策略下被主机消费之前就被覆盖的记录数
+  /// \return the number of records overwritten before being consumed by the
+  /// host under the \c TRACE_BUFFER_OVERWRITE_OLDEST policy
+  [[nodiscard]] uint64_t getNumLost() const { return NumLost.load(); }
+};
+
+/// \brief 在内核运行时周期性地排出 \c TraceBuffer 的后台线程
+/// \details 线程在构造时启动；\c stop 会在线程退出后最后排出一次缓冲区，因此应在所有写入缓冲区的内核完成后调用，以确保不遗漏任何记录
+/// \brief A background thread periodically draining a \c TraceBuffer while
+/// kernels are running
+/// \details The thread is started upon construction; \c stop drains the
+/// buffer one last time after the thread exits, hence it should be called
+/// after all kernels writing to the buffer have finished to ensure no record
+/// is missed
+class TraceBufferDrainThread {
+public:
+  /// 对每个被消费的记录调用的函数类型
+  /// Type of the function invoked on each consumed record
+  typedef std::function<void(llvm::ArrayRef<uint8_t> Record)> RecordConsumer;
+
+private:
+  /// 被排出的缓冲区
+  /// The buffer being drained
+  TraceBuffer &Buffer;
+
+  /// 对每个被消费的记录调用的函数
+  /// Function invoked on each consumed record
+  RecordConsumer Consumer;
+
+  /// 两次排出之间的等待时间
+  /// Time to wait between two drains
+  const std::chrono::microseconds PollInterval;
+
+  /// 保护 \c StopRequested
+  /// Protects \c StopRequested
+  std::mutex Mutex{};
+
+  /// 用于在请求停止时唤醒线程
+  /// Used to wake up the thread when a stop is requested
+  std::condition_variable StopCV{};
+
+  /// 是否已请求线程停止
+  /// Whether the thread has been requested to stop
+  bool StopRequested{false};
+
+  /// 排出线程
+  /// The drain thread
+  std::thread Worker;
+
+  /// 线程的主循环
+  /// Main loop of the thread
+  void run();
+
+public:
+  /// 启动一个排出 \p Buffer 的线程
+  /// \param Buffer 要排出的缓冲区；必须比此对象存活更久
+  /// \param Consumer 对每个被消费的记录调用的函数；在排出线程上调用
+  /// \param PollInterval 两次排出之间的等待时间
+  /// Starts a thread draining the \p Buffer
+  /// \param Buffer the buffer to drain; Must outlive this object
+  /// \param Consumer function invoked on each consumed record; Called on the
+  /// drain thread
+  /// \param PollInterval time to wait between two drains
+  TraceBufferDrainThread(
+      TraceBuffer &Buffer, RecordConsumer Consumer,
+      std::chrono::microseconds PollInterval = std::chrono::microseconds(100));
+
+  TraceBufferDrainThread(const TraceBufferDrainThread &) = delete;
+
+  TraceBufferDrainThread &operator=(const TraceBufferDrainThread &) = delete;
+
+  /// 如果线程仍在运行，则停止它
+  /// Stops the thread if it is still running
+  ~TraceBufferDrainThread();
+
+  /// 停止线程，并最后排出一次缓冲区
+  /// Stops the thread and drains the buffer one last time
+  void stop();
+};
+
+} // namespace luthier
+
+#endif
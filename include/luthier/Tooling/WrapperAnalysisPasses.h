@@ -100,9 +100,26 @@ public:
     }
   };
 
+private:
+  /// If not \c nullptr, the lowering info already gathered for another copy
+  /// of the instrumentation module, used to seed the result of this analysis
+  const std::vector<IntrinsicIRLoweringInfo> *PrecomputedInfo{nullptr};
+
+public:
   IntrinsicIRLoweringInfoMapAnalysis() = default;
 
-  Result run(llvm::Module &, llvm::ModuleAnalysisManager &) { return {}; }
+  /// Constructor used when the instrumentation module is split across
+  /// code gen workers, where the IR lowering stage has already been run on
+  /// the original module
+  explicit IntrinsicIRLoweringInfoMapAnalysis(
+      const std::vector<IntrinsicIRLoweringInfo> &PrecomputedInfo)
+      : PrecomputedInfo(&PrecomputedInfo) {};
+
+  /// If precomputed lowering info was passed, copies it and rebinds its IR
+  /// values to the intrinsic placeholders of \p IModule, found by their
+  /// index; Otherwise, returns an empty result to be populated by the
+  /// \c ProcessIntrinsicsAtIRLevelPass
+  Result run(llvm::Module &IModule, llvm::ModuleAnalysisManager &);
 };
 
 /// \brief an analysis used by the instrumentation module passes that gives
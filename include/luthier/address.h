@@ -0,0 +1,140 @@
+//===-- address.h - Luthier Memory Addressing Modes -------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file describes the addressing modes of memory instructions passed to
+/// memory access hooks, and how their effective addresses are computed from
+/// the operands of the instruction. It is shared between the host code
+/// decoding memory instructions and the device code of the hooks.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_ADDRESS_H
+#define LUTHIER_ADDRESS_H
+#include <cstdint>
+
+#if defined(__HIPCC__)
+#define LUTHIER_ADDRESS_FUNC __attribute__((host, device, always_inline))
+#else
+#define LUTHIER_ADDRESS_FUNC inline
+#endif
+
+namespace luthier {
+
+/// \brief Addressing mode of a memory access passed to a memory access hook
+/// \details Each mode dictates how the operands passed to the hook are
+/// interpreted by \c computeEffectiveAddress; Operands not mentioned by a mode
+/// are passed as zero
+enum MemoryAddressingMode : uint32_t {
+  /// FLAT and GLOBAL instructions without a scalar base:
+  /// <tt>VAddr1:VAddr0 + Offset</tt>
+  MEM_ADDR_FLAT = 0,
+  /// GLOBAL instructions with a scalar base:
+  /// <tt>SBase1:SBase0 + VAddr0 + Offset</tt>
+  MEM_ADDR_GLOBAL_SADDR = 1,
+  /// SCRATCH instructions: <tt>VAddr0 + SBase0 + Offset</tt>, an offset inside
+  /// the private segment of the lane
+  MEM_ADDR_SCRATCH = 2,
+  /// MUBUF and MTBUF instructions without a vector address:
+  /// <tt>Base + SOffset + Offset</tt>, where \c Base is the base address of
+  /// the buffer resource whose first two dwords are \c SBase0 and \c SBase1
+  MEM_ADDR_BUFFER = 3,
+  /// MUBUF and MTBUF instructions with a vector offset:
+  /// <tt>Base + SOffset + Offset + VAddr1</tt>
+  MEM_ADDR_BUFFER_OFFEN = 4,
+  /// MUBUF and MTBUF instructions with a vector index:
+  /// <tt>Base + SOffset + Offset + VAddr0 * Stride</tt>, where \c Stride is
+  /// the stride of the buffer resource
+  MEM_ADDR_BUFFER_IDXEN = 5,
+  /// MUBUF and MTBUF instructions with both a vector index and a vector
+  /// offset: <tt>Base + SOffset + Offset + VAddr0 * Stride + VAddr1</tt>
+  MEM_ADDR_BUFFER_BOTHEN = 6,
+  /// DS instructions accessing the LDS: <tt>VAddr0 + Offset</tt>, an offset
+  /// inside the LDS allocation of the workgroup
+  MEM_ADDR_LDS = 7
+};
+
+/// \return the base address of a buffer resource whose first two dwords are
+/// \p Rsrc0 and \p Rsrc1
+LUTHIER_ADDRESS_FUNC uint64_t getBufferResourceBase(uint32_t Rsrc0,
+                                                    uint32_t Rsrc1) {
+  return static_cast<uint64_t>(Rsrc0) |
+         (static_cast<uint64_t>(Rsrc1 & 0xFFFF) << 32);
+}
+
+/// \return the stride of a buffer resource whose second dword is \p Rsrc1
+LUTHIER_ADDRESS_FUNC uint32_t getBufferResourceStride(uint32_t Rsrc1) {
+  return (Rsrc1 >> 16) & 0x3FFF;
+}
+
+/// \return true if swizzling is enabled in a buffer resource whose second
+/// dword is \p Rsrc1
+/// \details Checks both bits above the stride, which hold the swizzle enable
+/// bit on all targets, and its second bit on GFX11+; The cache swizzle bit
+/// sharing them on earlier targets is conservatively treated as swizzling
+LUTHIER_ADDRESS_FUNC bool isBufferResourceSwizzled(uint32_t Rsrc1) {
+  return (Rsrc1 >> 30) != 0;
+}
+
+/// \brief Computes the effective address of a memory access from the
+/// operands passed to a memory access hook
+/// \details Buffer addresses are computed without range checking; The
+/// address of swizzled buffers depends on the lane and on fields of the
+/// buffer resource not passed to hooks, so it is not computed
+/// \param Mode the \c MemoryAddressingMode of the access
+/// \param VAddr0 first vector address operand
+/// \param VAddr1 second vector address operand
+/// \param SBase0 first scalar base operand
+/// \param SBase1 second scalar base operand
+/// \param SOffset scalar offset of buffer accesses
+/// \param Offset immediate offset of the access
+/// \return the effective address of the access; \c 0 if \p Mode is invalid,
+/// or if a buffer access uses a swizzled buffer resource
+LUTHIER_ADDRESS_FUNC uint64_t computeEffectiveAddress(
+    uint32_t Mode, uint32_t VAddr0, uint32_t VAddr1, uint32_t SBase0,
+    uint32_t SBase1, uint32_t SOffset, int32_t Offset) {
+  const uint64_t SignedOffset = static_cast<uint64_t>(int64_t{Offset});
+  const uint64_t BufferAddress = getBufferResourceBase(SBase0, SBase1) +
+                                 SOffset + static_cast<uint32_t>(Offset);
+  const uint64_t BufferIndexOffset =
+      static_cast<uint64_t>(VAddr0) * getBufferResourceStride(SBase1);
+  const bool IsSwizzled = isBufferResourceSwizzled(SBase1);
+  switch (Mode) {
+  case MEM_ADDR_FLAT:
+    return ((static_cast<uint64_t>(VAddr1) << 32) | VAddr0) + SignedOffset;
+  case MEM_ADDR_GLOBAL_SADDR:
+    return ((static_cast<uint64_t>(SBase1) << 32) | SBase0) + VAddr0 +
+           SignedOffset;
+  case MEM_ADDR_SCRATCH:
+    return static_cast<uint32_t>(VAddr0 + SBase0 + Offset);
+  case MEM_ADDR_BUFFER:
+    return IsSwizzled ? 0 : BufferAddress;
+  case MEM_ADDR_BUFFER_OFFEN:
+    return IsSwizzled ? 0 : BufferAddress + VAddr1;
+  case MEM_ADDR_BUFFER_IDXEN:
+    return IsSwizzled ? 0 : BufferAddress + BufferIndexOffset;
+  case MEM_ADDR_BUFFER_BOTHEN:
+    return IsSwizzled ? 0 : BufferAddress + BufferIndexOffset + VAddr1;
+  case MEM_ADDR_LDS:
+    return static_cast<uint32_t>(VAddr0 + Offset);
+  default:
+    return 0;
+  }
+}
+
+} // namespace luthier
+
+#undef LUTHIER_ADDRESS_FUNC
+
+#endif
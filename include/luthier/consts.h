@@ -43,10 +43,18 @@ namespace luthier {
 /// All hooks in instrumentation modules must have this attribute
 #define LUTHIER_HOOK_ATTRIBUTE luthier_hook
 
+/// Hooks that are code generated once and called by the injected payloads
+/// instead of being inlined into them have this attribute
+#define LUTHIER_OUTLINED_HOOK_ATTRIBUTE luthier_outlined_hook
+
 /// Name of the reserved managed variable defined in all Luthier tools so
 /// that its device module can be easily identified at runtime
 #define LUTHIER_RESERVED_MANAGED_VAR __luthier_reserved
 
+/// Name of the device variable defined in all Luthier tools holding the hook
+/// enable mask, checked by predicated injected payloads before they run
+#define LUTHIER_HOOK_ENABLE_MASK_VAR __luthier_hook_enable_mask
+
 /// All bindings to Luthier intrinsics must have this attribute
 #define LUTHIER_INTRINSIC_ATTRIBUTE luthier_intrinsic
 
@@ -58,24 +66,37 @@ namespace luthier {
 /// have this attribute
 #define LUTHIER_INJECTED_PAYLOAD_ATTRIBUTE luthier_injected_payload
 
+/// Predicated injected payloads have this attribute, holding the bits of the
+/// hook enable mask which enable them
+#define LUTHIER_HOOK_ENABLE_MASK_ATTRIBUTE luthier_hook_enable_mask
+
 static constexpr const char *HookHandlePrefix =
     LUTHIER_STRINGIFY(LUTHIER_HOOK_HANDLE_PREFIX);
 
 static constexpr const char *ReservedManagedVar =
     LUTHIER_STRINGIFY(LUTHIER_RESERVED_MANAGED_VAR);
 
+static constexpr const char *HookEnableMaskVar =
+    LUTHIER_STRINGIFY(LUTHIER_HOOK_ENABLE_MASK_VAR);
+
 static constexpr const char *HipCUIDPrefix =
     LUTHIER_STRINGIFY(LUTHIER_HIP_CUID_PREFIX);
 
 static constexpr const char *HookAttribute =
     LUTHIER_STRINGIFY(LUTHIER_HOOK_ATTRIBUTE);
 
+static constexpr const char *OutlinedHookAttribute =
+    LUTHIER_STRINGIFY(LUTHIER_OUTLINED_HOOK_ATTRIBUTE);
+
 static constexpr const char *IntrinsicAttribute =
     LUTHIER_STRINGIFY(LUTHIER_INTRINSIC_ATTRIBUTE);
 
 static constexpr const char *InjectedPayloadAttribute =
     LUTHIER_STRINGIFY(LUTHIER_INJECTED_PAYLOAD_ATTRIBUTE);
 
+static constexpr const char *HookEnableMaskAttribute =
+    LUTHIER_STRINGIFY(LUTHIER_HOOK_ENABLE_MASK_ATTRIBUTE);
+
 } // namespace luthier
 
 #endif
\ No newline at end of file
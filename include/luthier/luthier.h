@@ -36,8 +36,12 @@
 #include "luthier/HSA/LoadedCodeObjectKernel.h"
 #include "luthier/HSA/LoadedCodeObjectSymbol.h"
 #include "luthier/Intrinsic/Intrinsics.h"
+#include "luthier/Tooling/DispatchBufferPool.h"
+#include "luthier/Tooling/DispatchOverrideTable.h"
+#include "luthier/Tooling/DispatchSampler.h"
 #include "luthier/Tooling/InstrumentationTask.h"
 #include "luthier/Tooling/LiftedRepresentation.h"
+#include "luthier/Tooling/ResourceUsage.h"
 #include "luthier/types.h"
 
 namespace luthier {
@@ -146,19 +150,40 @@ llvm::Error printLiftedRepresentation(
 //  update the instrumentAndLoad docs
 
 /// 通过对 <tt>Kernel</tt> 的提升表示 \p LR 应用插桩任务 <tt>ITask</tt> 来对其进行插桩。\n
-/// 插桩后，将插桩后的代码加载到与 \p Kernel 相同的设备上
+/// 插桩后，将插桩后的代码加载到与 \p Kernel 相同的设备上\n
+/// 如果插桩后内核的占用率损失超出 \p Budget，则在允许时使用寄存器压力更低的注入负载选项
+/// 再次调用 \p Mutator 重新插桩；如果仍然超出预算，则不加载内核并返回错误
+/// \note 注入负载在过远时通过长跳转蹦床外联，因此任意大小的负载和内核都可以被插桩；
+/// 但应用自身的分支不会被松弛，如果一个分支与其目标之间留下的跳转使其超出范围，则返回错误
 /// \param Kernel 即将被插桩的内核
 /// \param LR \p Kernel 的提升表示
 /// \param ITask 描述要对 <tt>kernel</tt> 的 <tt>LR</tt> 执行的插桩任务的插桩任务
+/// \param Preset 插桩的预设名称
+/// \param [out] Report 如果不为 \c nullptr，则写入插桩前后内核的资源使用报告
+/// \param Budget 插桩允许造成的占用率损失；默认值取自命令行选项
 /// \return 描述操作成功或失败的 \c llvm::Error
 /// Instruments the <tt>Kernel</tt>'s lifted representation \p LR by
 /// applying the instrumentation task <tt>ITask</tt> to it.\n After
 /// instrumentation, loads the instrumented code onto the same device as the
-/// \p Kernel
+/// \p Kernel\n
+/// If the occupancy lost by the instrumented kernel exceeds the \p Budget,
+/// the \p Mutator is invoked again to re-instrument the kernel with injected
+/// payload options of lower register pressure when allowed; If the budget is
+/// still exceeded, the kernel is not loaded and an error is returned
+/// \note Injected payloads are outlined through long jump trampolines when
+/// they are too far away, so payloads and kernels of any size can be
+/// instrumented; The app's own branches are not relaxed however, and an error
+/// is returned if the jumps left between a branch and its target push it out
+/// of range
 /// \param Kernel the kernel that's about to be instrumented
 /// \param LR the lifted representation of the \p Kernel
 /// \param ITask the instrumentation task, describing the instrumentation to
 /// be performed on the <tt>kernel</tt>'s <tt>LR</tt>
+/// \param Preset the preset name of the instrumentation
+/// \param [out] Report if not \c nullptr, the resource usage report of the
+/// kernel before and after instrumentation is written to it
+/// \param Budget the occupancy loss instrumentation is allowed to cause;
+/// Defaults are taken from the command line options
 /// \return an \c llvm::Error describing if the operation succeeded or
 /// failed
 llvm::Error
@@ -167,7 +192,9 @@ instrumentAndLoad(const hsa::LoadedCodeObjectKernel &Kernel,
                   llvm::function_ref<llvm::Error(InstrumentationTask &,
                                                  LiftedRepresentation &)>
                       Mutator,
-                  llvm::StringRef Preset);
+                  llvm::StringRef Preset,
+                  ResourceUsageReport *Report = nullptr,
+                  const OccupancyBudget &Budget = OccupancyBudget::getDefault());
 
 /// 检查 \p Kernel 是否在给定的 \p Preset 下被插桩
 /// \param [in] 应用的 \c hsa::LoadedCodeObjectKernel
@@ -207,6 +234,137 @@ isKernelInstrumented(const hsa::LoadedCodeObjectKernel &Kernel,
 llvm::Error overrideWithInstrumented(hsa_kernel_dispatch_packet_t &Packet,
                                      llvm::StringRef Preset);
 
+/// 返回 \p Preset 名称的整数 ID；如果该预设从未被使用过，则为其分配一个新 ID\n
+/// 工具可以在初始化时查询一次 ID，并在调度时将其传递给
+/// \c overrideWithInstrumented，以避免任何字符串查找
+/// \param Preset 插桩预设的名称
+/// \return 预设的 ID
+/// Returns the integer ID of the \p Preset name, assigning it a new one if
+/// the preset was never used before\n
+/// Tools can query the ID once at initialization, and pass it to
+/// \c overrideWithInstrumented at dispatch time to avoid any string lookups
+/// \param Preset name of the instrumentation preset
+/// \return the ID of the preset
+InstrumentationPresetID getInstrumentationPresetID(llvm::StringRef Preset);
+
+/// 与按名称接受预设的 \c overrideWithInstrumented 相同，但通过其 ID 标识预设；
+/// 对预先计算的调度覆盖表执行单次无锁查找，不调用任何 HSA 函数
+/// \param Packet 从 HSA 队列拦截的 HSA 调度数据包
+/// \param Preset 内核被插桩的预设的 ID
+/// \return 报告错误的 \c llvm::Error
+/// Same as the \c overrideWithInstrumented taking the preset by name, but
+/// identifies the preset by its ID; Performs a single lock-free lookup into
+/// the precomputed dispatch override table, without calling into HSA
+/// \param Packet the HSA dispatch packet intercepted from an HSA queue
+/// \param Preset the ID of the preset the kernel was instrumented under
+/// \return an \c llvm::Error reporting the failure
+/// \sa getInstrumentationPresetID
+llvm::Error overrideWithInstrumented(hsa_kernel_dispatch_packet_t &Packet,
+                                     InstrumentationPresetID Preset);
+
+/// 与按 ID 接受预设的 \c overrideWithInstrumented 相同，但还从 \p Buffers 为调度
+/// 获取一个插桩缓冲区；钩子通过 \c luthier::dispatchBuffer 访问该缓冲区，调度完成后
+/// 在 HSA 运行时的异步信号处理线程上对其调用 \p OnCompletion\n
+/// 每个调度都有自己清零的缓冲区，因此工具无需串行化内核即可将测量结果归属到单个调度
+/// \param Packet 从 HSA 队列拦截的 HSA 调度数据包；其 \c kernarg_address 和
+/// \c completion_signal 也被替换
+/// \param Preset 内核被插桩的预设的 ID
+/// \param Buffers 从中获取调度缓冲区的池
+/// \param OnCompletion 调度完成后对其缓冲区调用的函数
+/// \return 报告错误的 \c llvm::Error
+/// Same as the \c overrideWithInstrumented taking the preset by ID, but also
+/// acquires an instrumentation buffer for the dispatch from \p Buffers; Hooks
+/// access the buffer via \c luthier::dispatchBuffer, and \p OnCompletion is
+/// invoked on it on the HSA runtime's asynchronous signal handler thread once
+/// the dispatch completes\n
+/// Each dispatch gets its own zeroed buffer, so tools can attribute
+/// measurements to a single dispatch without serializing kernels
+/// \param Packet the HSA dispatch packet intercepted from an HSA queue; Its
+/// \c kernarg_address and \c completion_signal are replaced as well
+/// \param Preset the ID of the preset the kernel was instrumented under
+/// \param Buffers the pool to acquire the dispatch buffer from
+/// \param OnCompletion function invoked on the buffer of the dispatch once
+/// it completes
+/// \return an \c llvm::Error reporting the failure
+/// \sa DispatchBufferPool
+llvm::Error
+overrideWithInstrumented(hsa_kernel_dispatch_packet_t &Packet,
+                         InstrumentationPresetID Preset,
+                         DispatchBufferPool &Buffers,
+                         DispatchBufferPool::CompletionHandler OnCompletion);
+
+/// 先使用 \p Sampler 决定调度是否被采样；仅当调度被采样时，才用给定 \p Preset
+/// 下的插桩版本覆盖 \p Packet 的内核对象字段\n
+/// 未被采样的调度保持原始的 \c kernel_object，除采样决策外不做任何额外的主机端工作\n
+/// 工具可以使用 \p Sampler 的每内核计数将采样调度上的测量值外推到所有调度
+/// \param Packet 从 HSA 队列拦截的、尚未被修改的 HSA 调度数据包
+/// \param Preset 内核被插桩的预设
+/// \param Sampler 决定调度是否被采样的调度采样器
+/// \return 如果调度被采样并被覆盖则返回 \c true，否则返回 \c false；
+/// 或报告错误的 \c llvm::Error
+/// First uses the \p Sampler to decide whether the dispatch is sampled; Only
+/// if the dispatch is sampled, overrides the kernel object field of the
+/// \p Packet with its instrumented version under the given \p Preset\n
+/// Dispatches not sampled keep their original \c kernel_object, with no
+/// host-side work besides the sampling decision\n
+/// Tools can use the per-kernel counts of the \p Sampler to extrapolate
+/// measurements over the sampled dispatches to all dispatches
+/// \param Packet the HSA dispatch packet intercepted from an HSA queue, not
+/// yet modified
+/// \param Preset the preset the kernel was instrumented under
+/// \param Sampler the dispatch sampler deciding whether the dispatch is
+/// sampled
+/// \return \c true if the dispatch was sampled and overridden, \c false
+/// otherwise; Or an \c llvm::Error reporting the failure
+/// \sa DispatchSampler
+llvm::Expected<bool>
+overrideWithInstrumented(hsa_kernel_dispatch_packet_t &Packet,
+                         llvm::StringRef Preset, DispatchSampler &Sampler);
+
+//===----------------------------------------------------------------------===//
+//  钩子谓词 API
+//  Hook Predication APIs
+//===----------------------------------------------------------------------===//
+
+/// 在 \p Agent 上启用或禁用所有钩子，即将工具的钩子启用掩码全部置位或清零\n
+/// 只影响使用 \c HookPredicationKind::GLOBAL 或
+/// \c HookPredicationKind::PER_HOOK 谓词插桩的内核；更改在下一个执行到注入负载的
+/// 波前上生效，无需重新插桩或修改调度数据包
+/// \param Agent 加载了工具设备代码的代理
+/// \param Enabled 是否启用钩子
+/// \return 报告错误的 \c llvm::Error
+/// Enables or disables all hooks on the \p Agent, by setting or clearing
+/// every bit of the hook enable mask of the tool\n
+/// Only affects kernels instrumented with \c HookPredicationKind::GLOBAL or
+/// \c HookPredicationKind::PER_HOOK predication; The change takes effect on
+/// the next wavefront reaching an injected payload, without re-instrumenting
+/// or modifying any dispatch packets
+/// \param Agent the agent the device code of the tool is loaded on
+/// \param Enabled whether the hooks are enabled
+/// \return an \c llvm::Error reporting the failure
+/// \sa IModulePipelineOptions::HookPredication
+llvm::Error setHooksEnabled(hsa_agent_t Agent, bool Enabled);
+
+/// 在 \p Agent 上启用或禁用 \p Hook，即置位或清零其在工具的钩子启用掩码中的位\n
+/// 使用 \c HookPredicationKind::PER_HOOK 谓词插桩时，只有当注入负载的所有钩子都被禁用时才会跳过该负载；
+/// 使用 \c HookPredicationKind::GLOBAL 谓词插桩时，只要掩码中还有任何位被置位，注入负载就会运行
+/// \param Agent 加载了工具设备代码的代理
+/// \param Hook 从 \c LUTHIER_GET_HOOK_HANDLE 获取的钩子句柄
+/// \param Enabled 是否启用钩子
+/// \return 报告错误的 \c llvm::Error
+/// Enables or disables the \p Hook on the \p Agent, by setting or clearing
+/// its bit in the hook enable mask of the tool\n
+/// With \c HookPredicationKind::PER_HOOK predication, an injected payload is
+/// only skipped when all of its hooks are disabled; With
+/// \c HookPredicationKind::GLOBAL predication, injected payloads run as long
+/// as any bit of the mask is set
+/// \param Agent the agent the device code of the tool is loaded on
+/// \param Hook handle of the hook obtained from \c LUTHIER_GET_HOOK_HANDLE
+/// \param Enabled whether the hook is enabled
+/// \return an \c llvm::Error reporting the failure
+/// \sa IModulePipelineOptions::HookPredication
+llvm::Error setHookEnabled(hsa_agent_t Agent, const void *Hook, bool Enabled);
+
 /// \brief 如果工具包含插桩钩子，它\b必须使用此宏一次。Luthier 钩子通过 \p LUTHIER_HOOK_CREATE 宏进行注解。\n
 ///
 /// \p MARK_LUTHIER_DEVICE_MODULE 宏在工具设备代码中定义一个类型为 \p char、名为 \p __luthier_reserved 的托管变量。
@@ -219,6 +377,8 @@ llvm::Error overrideWithInstrumented(hsa_kernel_dispatch_packet_t &Packet,
 /// 2. <b>Luthier 可以通过常量时间符号哈希查找轻松识别工具的代码对象</b>。
 /// \n
 /// 如果目标应用程序没有使用 HIP 运行时，则 HIP 运行时不会启动任何内核，这意味着工具的 FAT 二进制文件永远不会被加载。在这种情况下，由于 HIP 运行时仅用于 Luthier 的功能，必须将 `HIP_ENABLE_DEFERRED_LOADING` 环境变量设置为零，以确保 Luthier 工具代码对象立即在所有设备上加载。
+/// \n
+/// 此宏还定义了工具的钩子启用掩码，谓词化的注入负载在运行前会检查它；初始时所有钩子均被启用。
 /// \sa LUTHIER_HOOK_ANNOTATE
 /// \brief If a tool contains an instrumentation hook it \b must
 /// use this macro once. Luthier hooks are annotated via the the
@@ -249,15 +409,38 @@ llvm::Error overrideWithInstrumented(hsa_kernel_dispatch_packet_t &Packet,
 /// Luthier's function, the `HIP_ENABLE_DEFERRED_LOADING` environment
 /// variable must be set to zero to ensure Luthier tool code objects get loaded
 /// right away on all devices.
+/// \n
+/// The macro also defines the hook enable mask of the tool, checked by
+/// predicated injected payloads before they run; All hooks are enabled
+/// initially.
 /// \sa LUTHIER_HOOK_ANNOTATE
+/// \sa setHookEnabled
 #define MARK_LUTHIER_DEVICE_MODULE                                             \
-  __attribute__((managed, used)) char LUTHIER_RESERVED_MANAGED_VAR = 0;
+  __attribute__((managed, used)) char LUTHIER_RESERVED_MANAGED_VAR = 0;        \
+  __attribute__((device, used)) unsigned int LUTHIER_HOOK_ENABLE_MASK_VAR =    \
+      0xFFFFFFFF;
 
 #define LUTHIER_HOOK_ANNOTATE                                                  \
   __attribute__((                                                              \
       device, used,                                                            \
       annotate(LUTHIER_STRINGIFY(LUTHIER_HOOK_ATTRIBUTE)))) extern "C" void
 
+/// \brief 与 \p LUTHIER_HOOK_ANNOTATE 相同，但钩子不会被内联到注入负载中；它只生成一次代码，
+/// 每个插桩点调用同一个函数体，调用点只保存钩子实际破坏的寄存器。\n
+/// 外联钩子不能访问物理寄存器或内核参数。
+/// \sa OutlinedHookCallingConvPass
+/// \brief Same as \p LUTHIER_HOOK_ANNOTATE, except the hook is not inlined
+/// into the injected payloads; It is code generated once, and every
+/// instrumentation point calls the same body, with the call sites only
+/// saving the registers actually clobbered by the hook. \n
+/// Outlined hooks cannot access physical registers or kernel arguments.
+/// \sa OutlinedHookCallingConvPass
+#define LUTHIER_OUTLINED_HOOK_ANNOTATE                                         \
+  __attribute__((device, used,                                                 \
+                 annotate(LUTHIER_STRINGIFY(LUTHIER_HOOK_ATTRIBUTE)),          \
+                 annotate(LUTHIER_STRINGIFY(                                   \
+                     LUTHIER_OUTLINED_HOOK_ATTRIBUTE)))) extern "C" void
+
 #define LUTHIER_EXPORT_HOOK_HANDLE(HookName)                                   \
   __attribute__((global, used)) extern "C" void LUTHIER_CAT(                   \
       LUTHIER_HOOK_HANDLE_PREFIX, HookName)(){};
@@ -0,0 +1,92 @@
+//===-- trace.h - Luthier Trace Buffer Layout -------------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file describes the memory layout of Luthier's trace buffers, shared
+/// between the device code appending records to them and the host code
+/// draining them.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TRACE_H
+#define LUTHIER_TRACE_H
+#include <cstdint>
+
+namespace luthier {
+
+/// What the device does when a trace buffer has no free slots left
+enum TraceBufferOverflowPolicy : uint32_t {
+  /// Wait for the host to drain enough records to free a slot
+  TRACE_BUFFER_BLOCK = 0,
+  /// Discard the newly appended records, and count them as dropped
+  TRACE_BUFFER_DROP_NEWEST = 1,
+  /// Overwrite the oldest records not yet consumed by the host; The host
+  /// counts the overwritten records as lost
+  TRACE_BUFFER_OVERWRITE_OLDEST = 2
+};
+
+/// \brief Header of a trace buffer, located at the beginning of its
+/// allocation
+/// \details A trace buffer is a ring of \c Capacity record slots, starting
+/// \c TraceBufferSlotsOffset bytes after the header. Each slot is a
+/// 64-bit tag followed by \c RecordSize bytes of payload. The device reserves
+/// slots by incrementing \c WriteIndex with one atomic per wavefront, marks
+/// the slot as being written by setting its tag to the odd
+/// \c getTraceSlotWritingTag, writes the payload of the record, and then
+/// publishes it by storing the even \c getTraceSlotPublishedTag to the tag
+/// with release semantics. The tags act as a sequence lock: the host consumes
+/// records in order of their slot index, only accepts a record if its tag is
+/// published and remains unchanged while the payload is copied out, and
+/// publishes its progress in \c ReadIndex
+struct TraceBufferHeader {
+  /// Number of slots reserved by the device so far
+  uint64_t WriteIndex;
+  /// Number of slots consumed by the host so far
+  uint64_t ReadIndex;
+  /// Number of records dropped by the device under the
+  /// \c TRACE_BUFFER_DROP_NEWEST policy, or for being larger than
+  /// \c RecordSize
+  uint64_t NumDropped;
+  /// Number of record slots; Must be a power of two
+  uint32_t Capacity;
+  /// Size of each record's payload in bytes; Must be a multiple of 8
+  uint32_t RecordSize;
+  /// The \c TraceBufferOverflowPolicy of the buffer
+  uint32_t OverflowPolicy;
+  /// Reserved for future use
+  uint32_t Reserved;
+};
+
+/// Offset of the first record slot from the beginning of the trace buffer;
+/// Keeps the slots off the cache line of the frequently-updated indices
+static constexpr uint64_t TraceBufferSlotsOffset = 128;
+
+/// Size of the tag preceding the payload of each record slot
+static constexpr uint64_t TraceBufferSlotTagSize = sizeof(uint64_t);
+
+/// \return the tag of a record slot once the record of \p SlotIndex is
+/// published in it; Tags of later slot indices compare greater
+constexpr uint64_t getTraceSlotPublishedTag(uint64_t SlotIndex) {
+  return (SlotIndex + 1) << 1;
+}
+
+/// \return the tag of a record slot while the record of \p SlotIndex is
+/// being written to it
+constexpr uint64_t getTraceSlotWritingTag(uint64_t SlotIndex) {
+  return getTraceSlotPublishedTag(SlotIndex) | 1;
+}
+
+} // namespace luthier
+
+#endif
@@ -17,6 +17,7 @@
 /// \file
 /// This file contains the main function for the Luthier tablegen utility.
 //===----------------------------------------------------------------------===//
+#include "MemoryAccessInfoBackend.hpp"
 #include "RealToPseudoOpcodeMapBackend.hpp"
 #include "RealToPseudoRegisterMapBackend.hpp"
 #include <llvm/Support/CommandLine.h>
@@ -34,6 +35,11 @@ int main(int argc, char *argv[]) {
   llvm::TableGen::Emitter::Opt RealToPseudoRegisterOption(
       "gen-si-real-to-pseudo-reg-map", luthier::emitRealToPseudoRegisterTable,
       "Generate a Real to Pseudo Register enum map for the AMDGPU backend");
+
+  llvm::TableGen::Emitter::Opt MemoryAccessInfoOption(
+      "gen-si-memory-access-info", luthier::emitMemoryAccessInfoTable,
+      "Generate a table describing the memory accesses of the AMDGPU "
+      "backend's memory instructions");
   llvm::cl::ParseCommandLineOptions(argc, argv);
   return llvm::TableGenMain(argv[0]);
 }
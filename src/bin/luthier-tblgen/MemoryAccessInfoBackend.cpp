@@ -0,0 +1,201 @@
+//===-- MemoryAccessInfoBackend.cpp - Memory Access Info Table ------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Contains implementation for the memory access info tablegen backend for
+/// the Luthier tablegen.
+//===----------------------------------------------------------------------===//
+#include "MemoryAccessInfoBackend.hpp"
+#include <Common/CodeGenInstruction.h>
+#include <Common/CodeGenTarget.h>
+#include <algorithm>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/TableGen/Record.h>
+
+namespace luthier {
+
+/// \return the value of the single-bit field \p Name of \p R; \c false if
+/// \p R has no such field
+static bool getBitField(const llvm::Record &R, llvm::StringRef Name) {
+  const llvm::RecordVal *Val = R.getValue(Name);
+  if (!Val)
+    return false;
+  const llvm::Init *Value = Val->getValue();
+  if (const auto *Bits = llvm::dyn_cast<llvm::BitsInit>(Value))
+    Value = Bits->getNumBits() == 1 ? Bits->getBit(0) : nullptr;
+  const auto *Bit = llvm::dyn_cast_or_null<llvm::BitInit>(Value);
+  return Bit && Bit->getValue();
+}
+
+/// \return \c true if \p Inst is a MUBUF, MTBUF, FLAT or DS pseudo
+static bool isMemoryPseudo(const llvm::Record &Inst) {
+  return Inst.isSubClassOf("MUBUF_Pseudo") ||
+         Inst.isSubClassOf("MTBUF_Pseudo") ||
+         Inst.isSubClassOf("FLAT_Pseudo") || Inst.isSubClassOf("DS_Pseudo");
+}
+
+/// \return the mnemonic of \p Inst, shared among its addressing variants
+static llvm::StringRef getMnemonic(const llvm::Record &Inst) {
+  if (const llvm::RecordVal *Mnemonic = Inst.getValue("Mnemonic")) {
+    if (const auto *Str =
+            llvm::dyn_cast<llvm::StringInit>(Mnemonic->getValue()))
+      return Str->getValue();
+  }
+  return Inst.getName();
+}
+
+/// \return the number of bytes of the value type \p VT
+static unsigned getValueTypeSize(const llvm::Record &VT) {
+  return VT.getValueAsInt("Size") / 8;
+}
+
+/// Follows the root of \p Node through type casts and the fragments it
+/// wraps, until reaching a fragment with a \c MemoryVT
+/// \return the number of bytes of the \c MemoryVT found, or zero if the root
+/// of \p Node does not constrain the memory type
+static unsigned findMemoryVTSize(const llvm::Init *Node) {
+  const auto *Dag = llvm::dyn_cast<llvm::DagInit>(Node);
+  if (!Dag)
+    return 0;
+  const auto *Op = llvm::dyn_cast<llvm::DefInit>(Dag->getOperator());
+  if (!Op)
+    return 0;
+  const llvm::Record *OpDef = Op->getDef();
+  if (OpDef->isSubClassOf("ValueType"))
+    return Dag->getNumArgs() == 1 ? findMemoryVTSize(Dag->getArg(0)) : 0;
+  if (!OpDef->isSubClassOf("PatFrags"))
+    return 0;
+  if (const auto *VT =
+          llvm::dyn_cast<llvm::DefInit>(OpDef->getValueInit("MemoryVT")))
+    return getValueTypeSize(*VT->getDef());
+  const llvm::ListInit *Fragments = OpDef->getValueAsListInit("Fragments");
+  return Fragments->size() == 1 ? findMemoryVTSize(Fragments->getElement(0))
+                                : 0;
+}
+
+/// \return the memory pseudo instruction selected by the result \p Node of a
+/// pattern, or \c nullptr if there is none
+static const llvm::Record *findMemoryPseudo(const llvm::Init *Node) {
+  const auto *Dag = llvm::dyn_cast<llvm::DagInit>(Node);
+  if (!Dag)
+    return nullptr;
+  if (const auto *Op = llvm::dyn_cast<llvm::DefInit>(Dag->getOperator());
+      Op && isMemoryPseudo(*Op->getDef()))
+    return Op->getDef();
+  for (unsigned I = 0; I < Dag->getNumArgs(); ++I) {
+    if (const llvm::Record *Inst = findMemoryPseudo(Dag->getArg(I)))
+      return Inst;
+  }
+  return nullptr;
+}
+
+void MemoryAccessInfoEmitter::visitPattern(const llvm::Record &Pattern) {
+  const llvm::ListInit *Results = Pattern.getValueAsListInit("ResultInstrs");
+  if (Results->size() == 0)
+    return;
+  const llvm::Record *Inst = findMemoryPseudo(Results->getElement(0));
+  if (!Inst)
+    return;
+  const llvm::DagInit *Match = Pattern.getValueAsDag("PatternToMatch");
+  unsigned Size = findMemoryVTSize(Match);
+  // Atomics matched by target nodes without a memory type access as many
+  // bytes as they return
+  if (Size == 0 && (getBitField(*Inst, "IsAtomicRet") ||
+                    getBitField(*Inst, "IsAtomicNoRet"))) {
+    if (const auto *VT = llvm::dyn_cast<llvm::DefInit>(Match->getOperator());
+        VT && VT->getDef()->isSubClassOf("ValueType"))
+      Size = getValueTypeSize(*VT->getDef());
+  }
+  if (Size == 0)
+    return;
+  auto [It, Inserted] = MemorySizes.try_emplace(getMnemonic(*Inst), Size);
+  if (!Inserted)
+    It->second = std::min(It->second, Size);
+}
+
+MemoryAccessInfoEmitter::MemoryAccessInfoEmitter(
+    llvm::CodeGenTarget &Target, const llvm::RecordKeeper &Records)
+    : Target(Target) {
+  for (const llvm::Record *Pattern :
+       Records.getAllDerivedDefinitions("Pattern"))
+    visitPattern(*Pattern);
+}
+
+void MemoryAccessInfoEmitter::emitTablesWithFunc(llvm::raw_ostream &OS) {
+  llvm::ArrayRef<const llvm::CodeGenInstruction *> NumberedInstructions =
+      Target.getInstructionsByEnumValue();
+
+  OS << "enum BufferAddressingKind : uint8_t {\n";
+  OS << "  BUF_ADDR_OFFSET,\n";
+  OS << "  BUF_ADDR_OFFEN,\n";
+  OS << "  BUF_ADDR_IDXEN,\n";
+  OS << "  BUF_ADDR_BOTHEN,\n";
+  OS << "  BUF_ADDR_ADDR64\n";
+  OS << "};\n\n";
+
+  OS << "struct MemoryAccessInfo {\n";
+  OS << "  uint8_t MemorySize;\n";
+  OS << "  BufferAddressingKind BufferAddrKind;\n";
+  OS << "  bool IsTFE;\n";
+  OS << "};\n\n";
+
+  OS << "LLVM_READONLY\n";
+  OS << "MemoryAccessInfo getMemoryAccessInfo(uint16_t Opcode) {\n";
+  OS << "  static constexpr MemoryAccessInfo MemoryAccessInfoTable[] {\n";
+  for (const auto &NumberedInst : NumberedInstructions) {
+    const llvm::Record &Inst = *NumberedInst->TheDef;
+    if (!isMemoryPseudo(Inst)) {
+      OS << "    {},\n";
+      continue;
+    }
+    llvm::StringRef AddrKind = "BUF_ADDR_OFFSET";
+    if (getBitField(Inst, "addr64"))
+      AddrKind = "BUF_ADDR_ADDR64";
+    else if (getBitField(Inst, "offen") && getBitField(Inst, "idxen"))
+      AddrKind = "BUF_ADDR_BOTHEN";
+    else if (getBitField(Inst, "offen"))
+      AddrKind = "BUF_ADDR_OFFEN";
+    else if (getBitField(Inst, "idxen"))
+      AddrKind = "BUF_ADDR_IDXEN";
+    auto SizeIt = MemorySizes.find(getMnemonic(Inst));
+    OS << llvm::formatv(
+        "    {{{0}, {1}, {2}}, // {3}\n",
+        SizeIt == MemorySizes.end() ? 0 : SizeIt->second, AddrKind,
+        getBitField(Inst, "tfe") ? "true" : "false", Inst.getName());
+  }
+  OS << "  }; // End of Table\n\n";
+  OS << llvm::formatv("  if (Opcode >= {0})\n", NumberedInstructions.size());
+  OS << "    return {};\n";
+  OS << "  return MemoryAccessInfoTable[Opcode];\n";
+  OS << "}\n\n";
+}
+
+void emitMemoryAccessInfoTable(const llvm::RecordKeeper &Records,
+                               llvm::raw_ostream &OS) {
+  llvm::CodeGenTarget Target(Records);
+  OS << "#ifndef GET_MEMORY_ACCESS_INFO\n";
+  OS << "#define GET_MEMORY_ACCESS_INFO\n";
+  OS << "namespace luthier {\n\n";
+
+  MemoryAccessInfoEmitter Emitter(Target, Records);
+
+  // Emit the table and the function to query it.
+  Emitter.emitTablesWithFunc(OS);
+  OS << "} // end namespace luthier\n";
+  OS << "#endif // GET_MEMORY_ACCESS_INFO\n\n";
+}
+
+} // namespace luthier
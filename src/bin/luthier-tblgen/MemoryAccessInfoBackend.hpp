@@ -0,0 +1,84 @@
+//===-- MemoryAccessInfoBackend.hpp - Memory Access Info Table ------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Contains definitions for the memory access info tablegen backend for the
+/// Luthier tablegen. It emits a table describing how each MUBUF, MTBUF,
+/// FLAT and DS pseudo instruction of the AMDGPU backend accesses memory, which
+/// cannot be recovered from the operands of the instruction alone.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TBLGEN_MEMORY_ACCESS_INFO_BACKEND_HPP
+#define LUTHIER_TBLGEN_MEMORY_ACCESS_INFO_BACKEND_HPP
+#include <llvm/ADT/StringMap.h>
+
+namespace llvm {
+
+class CodeGenTarget;
+
+class RecordKeeper;
+
+class Record;
+
+class raw_ostream;
+
+} // namespace llvm
+
+namespace luthier {
+/// \brief Emits a table describing the memory accesses of the MUBUF, MTBUF,
+/// FLAT and DS instructions of the AMDGPU backend
+/// \details Each entry holds:
+/// - The addressing kind of buffer instructions, taken from the \c offen,
+/// \c idxen and \c addr64 fields of their pseudo records.
+/// - Whether the buffer instruction returns a TFE status dword, taken from
+/// its \c tfe field.
+/// - The number of bytes accessed by each lane, taken from the \c MemoryVT of
+/// the fragments matched by the selection patterns of the instruction, or
+/// from the value type of the pattern for atomics. As not all addressing
+/// variants of an instruction have selection patterns, the size is shared
+/// among all pseudos with the same mnemonic. Instructions without a known
+/// size have zero in their entry, and access as many bytes as their data
+/// register.
+class MemoryAccessInfoEmitter {
+private:
+  /// The CodeGen target class of the AMDGPU backend; Used to emit instruction
+  /// enums in order
+  const llvm::CodeGenTarget &Target;
+
+  /// Number of bytes accessed by each lane, for each mnemonic with a
+  /// selection pattern
+  llvm::StringMap<unsigned> MemorySizes;
+
+  /// Records the memory size of the instruction selected by \p Pattern
+  void visitPattern(const llvm::Record &Pattern);
+
+public:
+  MemoryAccessInfoEmitter(llvm::CodeGenTarget &Target,
+                          const llvm::RecordKeeper &Records);
+
+  /// Emits the memory access info table and the function to query it
+  /// \param OS Output stream of the emitted file
+  void emitTablesWithFunc(llvm::raw_ostream &OS);
+};
+
+/// Parse the \c Records and emit a table describing how MUBUF, MTBUF, FLAT and
+/// DS instructions of the AMDGPU backend access memory
+/// \param Records Records parsed by the tablegen parser
+/// \param OS Output stream of the emitted file
+void emitMemoryAccessInfoTable(const llvm::RecordKeeper &Records,
+                               llvm::raw_ostream &OS);
+} // namespace luthier
+
+#endif
@@ -24,6 +24,7 @@
 #include "luthier/Intrinsic/IntrinsicCalls.h"
 #include "luthier/consts.h"
 #include "llvm/Passes/PassPlugin.h"
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/ADT/StringExtras.h>
 #include <llvm/Analysis/ValueTracking.h>
 #include <llvm/Bitcode/BitcodeWriterPass.h>
@@ -78,11 +79,14 @@ getDemangledFunctionNameWithNamespace(llvm::StringRef MangledFuncName) {
 /// gets updated
 /// \param [in] M Module to inspect
 /// \param [out] Hooks a list of hook functions found in \p M
+/// \param [out] OutlinedHooks the set of hooks in \p Hooks that must not
+/// be inlined into the injected payloads
 /// \param [out] Intrinsics a list of intrinsics found in \p M
 /// \return any \c llvm::Error encountered during the process
 static llvm::Error
 getAnnotatedValues(const llvm::Module &M,
                    llvm::SmallVectorImpl<llvm::Function *> &Hooks,
+                   llvm::SmallPtrSetImpl<llvm::Function *> &OutlinedHooks,
                    llvm::SmallVectorImpl<llvm::Function *> &Intrinsics) {
   const llvm::GlobalVariable *V =
       M.getGlobalVariable("llvm.global.annotations");
@@ -103,6 +107,10 @@ getAnnotatedValues(const llvm::Module &M,
       if (Content == HookAttribute) {
         Hooks.push_back(Func);
         LLVM_DEBUG(llvm::dbgs() << "Found hook " << Func->getName() << ".\n");
+      } else if (Content == OutlinedHookAttribute) {
+        OutlinedHooks.insert(Func);
+        LLVM_DEBUG(llvm::dbgs()
+                   << "Found outlined hook " << Func->getName() << ".\n");
       } else if (Content == IntrinsicAttribute) {
         Intrinsics.push_back(Func);
         LLVM_DEBUG(llvm::dbgs()
@@ -132,8 +140,10 @@ EmbedInstrumentationModuleBitcodePass::run(llvm::Module &M,
 
   // Extract all the hooks and intrinsics
   llvm::SmallVector<llvm::Function *, 4> Hooks;
+  llvm::SmallPtrSet<llvm::Function *, 4> OutlinedHooks;
   llvm::SmallVector<llvm::Function *, 4> Intrinsics;
-  if (auto Err = getAnnotatedValues(*ClonedModule, Hooks, Intrinsics))
+  if (auto Err = getAnnotatedValues(*ClonedModule, Hooks, OutlinedHooks,
+                                    Intrinsics))
     llvm::report_fatal_error(std::move(Err), true);
 
   // Remove the annotations variable from the Module now that it is processed
@@ -155,10 +165,18 @@ EmbedInstrumentationModuleBitcodePass::run(llvm::Module &M,
 
   // Give each Hook function a "hook" attribute
   for (auto Hook : Hooks) {
-    // TODO: remove the always inline attribute once Hooks support the anyreg
-    // calling convention
-    Hook->addFnAttr(HookAttribute);
     Hook->removeFnAttr(llvm::Attribute::OptimizeNone);
+    // Outlined hooks are code generated once and called by the injected
+    // payloads with the outlined hook calling convention; Like device
+    // functions, they don't get the "hook" attribute, as they cannot access
+    // the physical registers of the instrumentation point
+    if (OutlinedHooks.contains(Hook)) {
+      Hook->addFnAttr(OutlinedHookAttribute);
+      Hook->removeFnAttr(llvm::Attribute::AlwaysInline);
+      Hook->addFnAttr(llvm::Attribute::NoInline);
+      continue;
+    }
+    Hook->addFnAttr(HookAttribute);
     Hook->removeFnAttr(llvm::Attribute::NoInline);
     Hook->addFnAttr(llvm::Attribute::AlwaysInline);
   }
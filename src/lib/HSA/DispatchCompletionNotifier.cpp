@@ -0,0 +1,113 @@
+//===-- DispatchCompletionNotifier.cpp ------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Implements the \c DispatchCompletionNotifier.
+//===----------------------------------------------------------------------===//
+#include "luthier/HSA/DispatchCompletionNotifier.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/HSA/HsaError.h"
+#include <memory>
+
+namespace luthier::hsa {
+
+DispatchCompletionNotifier::~DispatchCompletionNotifier() {
+  waitForPendingCompletions();
+  for (hsa_signal_t Signal : FreeSignals) {
+    LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_HSA_CALL_ERROR_CHECK(
+        CoreApi.callFunction<hsa_signal_destroy>(Signal),
+        "Failed to destroy a dispatch completion signal"));
+  }
+}
+
+llvm::Expected<hsa_signal_t> DispatchCompletionNotifier::acquireSignal() {
+  {
+    std::lock_guard Lock(Mutex);
+    if (!FreeSignals.empty())
+      return FreeSignals.pop_back_val();
+  }
+  hsa_signal_t Signal;
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_HSA_CALL_ERROR_CHECK(
+      CoreApi.callFunction<hsa_signal_create>(1, 0, nullptr, &Signal),
+      "Failed to create a dispatch completion signal"));
+  return Signal;
+}
+
+bool DispatchCompletionNotifier::signalHandler(hsa_signal_value_t,
+                                               void *Arg) {
+  auto *Completion = static_cast<PendingCompletion *>(Arg);
+  Completion->Notifier.complete(*Completion);
+  // The replacement signal is recycled, so the handler must not be invoked
+  // again
+  return false;
+}
+
+void DispatchCompletionNotifier::complete(PendingCompletion &Completion) {
+  std::unique_ptr<PendingCompletion> Owner(&Completion);
+  if (Completion.Handler)
+    Completion.Handler();
+  // Forward the completion to the application only after the handler has
+  // run, as the packet processor would have done had the signal not been
+  // replaced
+  if (Completion.OriginalSignal.handle != 0)
+    CoreApi.callFunction<hsa_signal_subtract_screlease>(
+        Completion.OriginalSignal, 1);
+  CoreApi.callFunction<hsa_signal_store_relaxed>(Completion.Signal, 1);
+  std::lock_guard Lock(Mutex);
+  FreeSignals.push_back(Completion.Signal);
+  if (--NumPendingCompletions == 0)
+    NoPendingCompletions.notify_all();
+}
+
+llvm::Error
+DispatchCompletionNotifier::attach(hsa_kernel_dispatch_packet_t &Packet,
+                                   HandlerType Handler) {
+  llvm::Expected<hsa_signal_t> SignalOrErr = acquireSignal();
+  LUTHIER_RETURN_ON_ERROR(SignalOrErr.takeError());
+  hsa_signal_t Signal = *SignalOrErr;
+
+  auto Completion = std::make_unique<PendingCompletion>(PendingCompletion{
+      *this, Signal, Packet.completion_signal, std::move(Handler)});
+  {
+    std::lock_guard Lock(Mutex);
+    ++NumPendingCompletions;
+  }
+
+  // The replacement signal is not yet attached to the packet, so the
+  // handler cannot fire before the registration returns
+  if (llvm::Error Err = LUTHIER_HSA_CALL_ERROR_CHECK(
+          AmdExtApi.callFunction<hsa_amd_signal_async_handler>(
+              Signal, HSA_SIGNAL_CONDITION_LT, 1, signalHandler,
+              Completion.get()),
+          "Failed to register the dispatch completion handler")) {
+    std::lock_guard Lock(Mutex);
+    FreeSignals.push_back(Signal);
+    if (--NumPendingCompletions == 0)
+      NoPendingCompletions.notify_all();
+    return Err;
+  }
+  // Ownership of the completion is passed to the signal handler
+  Completion.release();
+  Packet.completion_signal = Signal;
+  return llvm::Error::success();
+}
+
+void DispatchCompletionNotifier::waitForPendingCompletions() {
+  std::unique_lock Lock(Mutex);
+  NoPendingCompletions.wait(Lock, [&] { return NumPendingCompletions == 0; });
+}
+
+} // namespace luthier::hsa
@@ -29,7 +29,7 @@ namespace luthier::hsa {
 
 KernelDescriptor::Rsrc1Info KernelDescriptor::getRsrc1() const {
   Rsrc1Info Out;
-  Out.GranulatedWaveFrontSGPRCount =
+  Out.GranulatedWorkItemVGPRCount =
       AMD_HSA_BITS_GET(this->ComputePgmRsrc1,
                        AMD_COMPUTE_PGM_RSRC_ONE_GRANULATED_WORKITEM_VGPR_COUNT);
   Out.GranulatedWaveFrontSGPRCount = AMD_HSA_BITS_GET(
@@ -95,10 +95,33 @@ void PacketMonitor::interceptQueuePacketHandler(
       Data != nullptr, "Failed to get the queue used to dispatch packets."));
   auto &Queue = *static_cast<hsa_queue_t *>(Data);
 
-  PacketMonitor.CB(
-      Queue, UserPacketIdx,
-      llvm::ArrayRef(static_cast<const AqlPacket *>(Packets), PacketCount),
-      Writer);
+  llvm::ArrayRef PacketArray(static_cast<const AqlPacket *>(Packets),
+                             PacketCount);
+
+  if (const auto *CB = std::get_if<CallbackType>(&PacketMonitor.CB)) {
+    (*CB)(Queue, UserPacketIdx, PacketArray, Writer);
+    return;
+  }
+
+  // Scratch buffers of the batches being handled on this thread, indexed by
+  // their nesting depth, as the callback can itself submit packets to
+  // another intercepted queue; They are reused across submissions so that
+  // editing packets does not allocate in the steady state
+  static thread_local llvm::SmallVector<
+      std::unique_ptr<llvm::SmallVector<AqlPacket, 0>>, 2>
+      ScratchBuffers;
+  static thread_local size_t NestingDepth{0};
+
+  if (ScratchBuffers.size() == NestingDepth)
+    ScratchBuffers.push_back(
+        std::make_unique<llvm::SmallVector<AqlPacket, 0>>());
+  PacketBatch Batch(PacketArray, Writer, *ScratchBuffers[NestingDepth]);
+  ++NestingDepth;
+  std::get<BatchCallbackType>(PacketMonitor.CB)(Queue, UserPacketIdx, Batch);
+  --NestingDepth;
+  // Forward the batch if the callback did not already do so; Unedited
+  // batches are written straight from the intercepted packets
+  Batch.submit();
 }
 } // namespace hsa
 
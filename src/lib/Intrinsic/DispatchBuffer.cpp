@@ -0,0 +1,118 @@
+//===-- DispatchBuffer.cpp - Luthier per-dispatch buffer access -----------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements Luthier's <tt>DispatchBuffer</tt> intrinsic.
+//===----------------------------------------------------------------------===//
+#include "luthier/Intrinsic/DispatchBuffer.h"
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "SIRegisterInfo.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/Common/LuthierError.h"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/User.h>
+#include <llvm/MC/MCRegister.h>
+
+namespace luthier {
+
+llvm::Expected<IntrinsicIRLoweringInfo>
+dispatchBufferIRProcessor(const llvm::Function &Intrinsic,
+                          const llvm::CallInst &User,
+                          const llvm::GCNTargetMachine &TM) {
+  // The user must not have any operands
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      User.arg_size() == 0,
+      llvm::formatv("Expected no operands to be passed to the "
+                    "luthier::dispatchBuffer intrinsic '{0}', got {1}.",
+                    User, User.arg_size())));
+
+  luthier::IntrinsicIRLoweringInfo Out;
+  // The buffer address is the same for the entire dispatch, hence it will be
+  // returned in an SGPR
+  Out.setReturnValueInfo(&User, "s");
+  // The address of the buffer is stored in the user argument area, placed
+  // right after the kernel's original argument buffer
+  Out.requestAccessToKernelArgument(USER_KERNARG_OFFSET);
+  Out.requestAccessToKernelArgument(KERNARG_SEGMENT_PTR);
+
+  return Out;
+}
+
+llvm::Error dispatchBufferMIRProcessor(
+    const IntrinsicIRLoweringInfo &IRLoweringInfo,
+    llvm::ArrayRef<std::pair<llvm::InlineAsm::Flag, llvm::Register>> Args,
+    const std::function<llvm::MachineInstrBuilder(int)> &MIBuilder,
+    const std::function<llvm::Register(const llvm::TargetRegisterClass *)>
+        &VirtRegBuilder,
+    const std::function<llvm::Register(KernelArgumentType)> &KernArgAccessor,
+    const llvm::MachineFunction &MF,
+    const std::function<llvm::Register(llvm::MCRegister)> &PhysRegAccessor,
+    llvm::DenseMap<llvm::MCRegister, llvm::Register> &PhysRegsToBeOverwritten) {
+  // There should be only a single virtual register involved in the operation
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Args.size() == 1,
+      llvm::formatv("Number of virtual register arguments "
+                    "involved in the MIR lowering stage of "
+                    "luthier::dispatchBuffer is {0} instead of 1.",
+                    Args.size())));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Args[0].first.isRegDefKind(),
+      "The register argument of luthier::dispatchBuffer is not a definition."));
+  llvm::Register Output = Args[0].second;
+
+  llvm::Register KernArgSGPR = KernArgAccessor(KERNARG_SEGMENT_PTR);
+  llvm::Register UserOffsetSGPR = KernArgAccessor(USER_KERNARG_OFFSET);
+
+  // Calculate the address of the user argument area
+  llvm::Register AddressLo = VirtRegBuilder(&llvm::AMDGPU::SGPR_32RegClass);
+  MIBuilder(llvm::AMDGPU::S_ADD_U32)
+      .addReg(AddressLo, llvm::RegState::Define)
+      .addReg(KernArgSGPR, 0, llvm::SIRegisterInfo::getSubRegFromChannel(0))
+      .addReg(UserOffsetSGPR);
+
+  llvm::Register AddressHi = VirtRegBuilder(&llvm::AMDGPU::SGPR_32RegClass);
+  MIBuilder(llvm::AMDGPU::S_ADDC_U32)
+      .addReg(AddressHi, llvm::RegState::Define)
+      .addReg(KernArgSGPR, 0, llvm::SIRegisterInfo::getSubRegFromChannel(1))
+      .addImm(0);
+
+  llvm::Register Address = VirtRegBuilder(&llvm::AMDGPU::SReg_64RegClass);
+  MIBuilder(llvm::AMDGPU::REG_SEQUENCE)
+      .addReg(Address, llvm::RegState::Define)
+      .addReg(AddressLo)
+      .addImm(llvm::SIRegisterInfo::getSubRegFromChannel(0))
+      .addReg(AddressHi)
+      .addImm(llvm::SIRegisterInfo::getSubRegFromChannel(1));
+
+  // The first entry of the user argument area is the address of the buffer
+  llvm::Register Buffer = VirtRegBuilder(&llvm::AMDGPU::SReg_64_XEXECRegClass);
+  MIBuilder(llvm::AMDGPU::S_LOAD_DWORDX2_IMM)
+      .addReg(Buffer, llvm::RegState::Define)
+      .addReg(Address, llvm::RegState::Kill)
+      .addImm(0)
+      .addImm(0);
+
+  (void)MIBuilder(llvm::AMDGPU::COPY)
+      .addReg(Output, llvm::RegState::Define)
+      .addReg(Buffer, llvm::RegState::Kill);
+
+  return llvm::Error::success();
+}
+
+} // namespace luthier
@@ -20,11 +20,31 @@
 //===----------------------------------------------------------------------===//
 #include "luthier/Common/GenericLuthierError.h"
 #include "luthier/Common/LuthierError.h"
+#include "luthier/Intrinsic/IntrinsicProcessor.h"
 #include <llvm/CodeGen/MachineInstr.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/Support/Error.h>
 
 namespace luthier {
 
+void IntrinsicIRLoweringInfo::rebindIRValues(
+    const llvm::CallInst *PlaceHolderCall) {
+  if (PlaceHolderCall == nullptr) {
+    PlaceHolderInlineAsm = nullptr;
+    OutValue.Val = nullptr;
+    for (auto &Arg : Args)
+      Arg.Val = nullptr;
+    return;
+  }
+  // The placeholder call was created with the arguments in the same order
+  // as Args, and replaced all uses of the intrinsic's output
+  PlaceHolderInlineAsm =
+      llvm::cast<llvm::InlineAsm>(PlaceHolderCall->getCalledOperand());
+  OutValue.Val = PlaceHolderCall;
+  for (auto [Arg, Operand] : llvm::zip(Args, PlaceHolderCall->args()))
+    Arg.Val = Operand.get();
+}
+
 llvm::Expected<unsigned int>
 getIntrinsicInlineAsmPlaceHolderIdx(const llvm::MachineInstr &MI) {
   if (MI.isInlineAsm()) {
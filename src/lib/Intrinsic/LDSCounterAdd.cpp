@@ -0,0 +1,133 @@
+//===-- LDSCounterAdd.cpp -------------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the LDS-staged counter add intrinsic.
+//===----------------------------------------------------------------------===//
+#include "luthier/Intrinsic/LDSCounterAdd.h"
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "SIInstrInfo.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/Common/LuthierError.h"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/User.h>
+#include <llvm/MC/MCRegister.h>
+
+namespace luthier {
+
+llvm::Expected<IntrinsicIRLoweringInfo>
+ldsCounterAddIRProcessor(const llvm::Function &Intrinsic,
+                         const llvm::CallInst &User,
+                         const llvm::GCNTargetMachine &TM) {
+  // The User must only have 2 operands
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      User.arg_size() == 2,
+      llvm::formatv("Expected two operands to be passed to the "
+                    "luthier::ldsCounterAdd intrinsic '{0}', got {1}.",
+                    User, User.arg_size())));
+  // The counter must be a global variable of the tool, as its LDS copy is
+  // allocated and flushed back by the code generator
+  const auto *Counter = llvm::dyn_cast<llvm::GlobalVariable>(
+      User.getArgOperand(0)->stripPointerCasts());
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Counter != nullptr,
+      llvm::formatv("The counter passed to the luthier::ldsCounterAdd "
+                    "intrinsic '{0}' is not a global variable.",
+                    User)));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      User.getArgOperand(1)->getType()->isIntegerTy(64),
+      llvm::formatv("The value passed to the luthier::ldsCounterAdd "
+                    "intrinsic '{0}' is not a 64-bit integer.",
+                    User)));
+
+  luthier::IntrinsicIRLoweringInfo Out;
+  // The intrinsic returns void, hence the constraint of its return value is
+  // never used
+  Out.setReturnValueInfo(&User, "s");
+  // Each lane contributes its own value to the counter
+  Out.addArgInfo(User.getArgOperand(1), "v");
+  Out.requestLDSCounter(Counter->getName());
+  return Out;
+}
+
+llvm::Error ldsCounterAddMIRProcessor(
+    const IntrinsicIRLoweringInfo &IRLoweringInfo,
+    llvm::ArrayRef<std::pair<llvm::InlineAsm::Flag, llvm::Register>> Args,
+    const std::function<llvm::MachineInstrBuilder(int)> &MIBuilder,
+    const std::function<llvm::Register(const llvm::TargetRegisterClass *)>
+        &VirtRegBuilder,
+    const std::function<llvm::Register(KernelArgumentType)> &,
+    const llvm::MachineFunction &MF,
+    const std::function<llvm::Register(llvm::MCRegister)> &PhysRegAccessor,
+    llvm::DenseMap<llvm::MCRegister, llvm::Register> &PhysRegsToBeOverwritten) {
+  // There should be only a single virtual register involved in the operation
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Args.size() == 1,
+      llvm::formatv("Number of virtual register arguments "
+                    "involved in the MIR lowering stage of "
+                    "luthier::ldsCounterAdd is {0} instead of 1.",
+                    Args.size())));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Args[0].first.isRegUseKind(), "The virtual register argument for "
+                                    "luthier::ldsCounterAdd is not a use."));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      IRLoweringInfo.lds_counters().size() == 1,
+      "Expected luthier::ldsCounterAdd to stage a single counter in LDS."));
+  llvm::Register VData = Args[0].second;
+
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !ST.ldsRequiresM0Init(),
+      llvm::formatv("luthier::ldsCounterAdd is not supported on {0}, as its "
+                    "LDS instructions require M0 to be initialized.",
+                    ST.getCPU())));
+
+  const auto *Counter = MF.getFunction().getParent()->getNamedGlobal(
+      IRLoweringInfo.lds_counters().front());
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Counter != nullptr,
+      llvm::formatv("Failed to find the counter {0} of luthier::ldsCounterAdd "
+                    "inside the instrumentation module.",
+                    IRLoweringInfo.lds_counters().front())));
+
+  // Refer to the LDS copy of the counter through the global counter itself;
+  // The operand is turned into the LDS offset of the copy once it is
+  // allocated by the pre-amble emitter
+  llvm::Register SOffset = VirtRegBuilder(&llvm::AMDGPU::SReg_32RegClass);
+  MIBuilder(llvm::AMDGPU::S_MOV_B32)
+      .addReg(SOffset, llvm::RegState::Define)
+      .addGlobalAddress(Counter, 0, llvm::SIInstrInfo::MO_ABS32_LO);
+
+  llvm::Register VAddr = VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass);
+  MIBuilder(llvm::AMDGPU::V_MOV_B32_e32)
+      .addReg(VAddr, llvm::RegState::Define)
+      .addReg(SOffset, llvm::RegState::Kill);
+
+  // Each active lane adds its value; LDS atomics are cheap enough compared
+  // to global ones that no wavefront-level reduction is needed
+  MIBuilder(llvm::AMDGPU::DS_ADD_U64_gfx9)
+      .addReg(VAddr, llvm::RegState::Kill)
+      .addReg(VData)
+      .addImm(0)
+      .addImm(0);
+  return llvm::Error::success();
+}
+
+} // namespace luthier
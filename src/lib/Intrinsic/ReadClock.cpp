@@ -0,0 +1,208 @@
+//===-- ReadClock.cpp -----------------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements Luthier's <tt>ReadClock</tt> and
+/// <tt>ReadRealTime</tt> intrinsics.
+//===----------------------------------------------------------------------===//
+#include "luthier/Intrinsic/ReadClock.h"
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "SIDefines.h"
+#include "SIRegisterInfo.h"
+#include "Utils/AMDGPUBaseInfo.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/Common/LuthierError.h"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/User.h>
+
+namespace luthier {
+
+/// Both counters are read without operands, and are uniform across the
+/// wavefront; Hence their value is returned in an SGPR pair
+static llvm::Expected<IntrinsicIRLoweringInfo>
+counterIRProcessor(llvm::StringRef Name, const llvm::CallInst &User) {
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      User.arg_size() == 0,
+      llvm::formatv("Expected no operands to be passed to the "
+                    "luthier::{0} intrinsic '{1}', got {2}.",
+                    Name, User, User.arg_size())));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      User.getType()->isIntegerTy(64),
+      llvm::formatv("The luthier::{0} intrinsic '{1}' must return a 64-bit "
+                    "integer.",
+                    Name, User)));
+  luthier::IntrinsicIRLoweringInfo Out;
+  Out.setReturnValueInfo(&User, "s");
+  return Out;
+}
+
+/// \return the output register of a counter intrinsic, after checking the
+/// virtual register arguments passed to its MIR processor
+static llvm::Expected<llvm::Register> getCounterOutput(
+    llvm::StringRef Name,
+    llvm::ArrayRef<std::pair<llvm::InlineAsm::Flag, llvm::Register>> Args) {
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Args.size() == 1,
+      llvm::formatv("Number of virtual register arguments involved in the MIR "
+                    "lowering stage of luthier::{0} is {1} instead of 1.",
+                    Name, Args.size())));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Args[0].first.isRegDefKind(),
+      llvm::formatv("The register argument of luthier::{0} is not a "
+                    "definition.",
+                    Name)));
+  return Args[0].second;
+}
+
+/// Reads a 64-bit counter into \p Output using \p Opcode, a scalar memory
+/// instruction returning the counter without any operands
+static void readCounterWithSMem(
+    unsigned Opcode, llvm::Register Output,
+    const std::function<llvm::MachineInstrBuilder(int)> &MIBuilder,
+    const std::function<llvm::Register(const llvm::TargetRegisterClass *)>
+        &VirtRegBuilder) {
+  llvm::Register Counter = VirtRegBuilder(&llvm::AMDGPU::SReg_64_XEXECRegClass);
+  MIBuilder(Opcode).addReg(Counter, llvm::RegState::Define);
+  (void)MIBuilder(llvm::AMDGPU::COPY)
+      .addReg(Output, llvm::RegState::Define)
+      .addReg(Counter, llvm::RegState::Kill);
+}
+
+llvm::Expected<IntrinsicIRLoweringInfo>
+readClockIRProcessor(const llvm::Function &Intrinsic,
+                     const llvm::CallInst &User,
+                     const llvm::GCNTargetMachine &TM) {
+  return counterIRProcessor("readClock", User);
+}
+
+llvm::Error readClockMIRProcessor(
+    const IntrinsicIRLoweringInfo &IRLoweringInfo,
+    llvm::ArrayRef<std::pair<llvm::InlineAsm::Flag, llvm::Register>> Args,
+    const std::function<llvm::MachineInstrBuilder(int)> &MIBuilder,
+    const std::function<llvm::Register(const llvm::TargetRegisterClass *)>
+        &VirtRegBuilder,
+    const std::function<llvm::Register(KernelArgumentType)> &,
+    const llvm::MachineFunction &MF,
+    const std::function<llvm::Register(llvm::MCRegister)> &PhysRegAccessor,
+    llvm::DenseMap<llvm::MCRegister, llvm::Register> &PhysRegsToBeOverwritten) {
+  llvm::Expected<llvm::Register> OutputOrErr =
+      getCounterOutput("readClock", Args);
+  LUTHIER_RETURN_ON_ERROR(OutputOrErr.takeError());
+  llvm::Register Output = *OutputOrErr;
+  auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  namespace Hwreg = llvm::AMDGPU::Hwreg;
+
+  if (ST.hasShaderCyclesHiLoRegisters()) {
+    // The full 64-bit counter is exposed as two hardware registers; The high
+    // half is read before and after the low half, and the low half is zeroed
+    // if it wrapped around in between
+    auto ReadHwReg = [&](unsigned Id) {
+      llvm::Register Reg = VirtRegBuilder(&llvm::AMDGPU::SReg_32RegClass);
+      MIBuilder(llvm::AMDGPU::S_GETREG_B32)
+          .addReg(Reg, llvm::RegState::Define)
+          .addImm(Hwreg::HwregEncoding::encode(Id, 0, 32));
+      return Reg;
+    };
+    llvm::Register HiBefore = ReadHwReg(Hwreg::ID_SHADER_CYCLES_HI);
+    llvm::Register Lo = ReadHwReg(Hwreg::ID_SHADER_CYCLES);
+    llvm::Register HiAfter = ReadHwReg(Hwreg::ID_SHADER_CYCLES_HI);
+    MIBuilder(llvm::AMDGPU::S_CMP_EQ_U32)
+        .addReg(HiBefore, llvm::RegState::Kill)
+        .addReg(HiAfter);
+    llvm::Register LoSelected = VirtRegBuilder(&llvm::AMDGPU::SReg_32RegClass);
+    MIBuilder(llvm::AMDGPU::S_CSELECT_B32)
+        .addReg(LoSelected, llvm::RegState::Define)
+        .addReg(Lo, llvm::RegState::Kill)
+        .addImm(0);
+    (void)MIBuilder(llvm::AMDGPU::REG_SEQUENCE)
+        .addReg(Output, llvm::RegState::Define)
+        .addReg(LoSelected, llvm::RegState::Kill)
+        .addImm(llvm::SIRegisterInfo::getSubRegFromChannel(0))
+        .addReg(HiAfter, llvm::RegState::Kill)
+        .addImm(llvm::SIRegisterInfo::getSubRegFromChannel(1));
+  } else if (ST.hasSMemTimeInst()) {
+    readCounterWithSMem(llvm::AMDGPU::S_MEMTIME, Output, MIBuilder,
+                        VirtRegBuilder);
+  } else if (ST.hasShaderCyclesRegister()) {
+    // Only the lower 20 bits of the counter are exposed; Hooks measuring
+    // intervals must take its wrap around into account
+    llvm::Register Lo = VirtRegBuilder(&llvm::AMDGPU::SReg_32RegClass);
+    MIBuilder(llvm::AMDGPU::S_GETREG_B32)
+        .addReg(Lo, llvm::RegState::Define)
+        .addImm(Hwreg::HwregEncoding::encode(Hwreg::ID_SHADER_CYCLES, 0, 20));
+    llvm::Register Hi = VirtRegBuilder(&llvm::AMDGPU::SReg_32RegClass);
+    MIBuilder(llvm::AMDGPU::S_MOV_B32)
+        .addReg(Hi, llvm::RegState::Define)
+        .addImm(0);
+    (void)MIBuilder(llvm::AMDGPU::REG_SEQUENCE)
+        .addReg(Output, llvm::RegState::Define)
+        .addReg(Lo, llvm::RegState::Kill)
+        .addImm(llvm::SIRegisterInfo::getSubRegFromChannel(0))
+        .addReg(Hi, llvm::RegState::Kill)
+        .addImm(llvm::SIRegisterInfo::getSubRegFromChannel(1));
+  } else {
+    return LUTHIER_MAKE_GENERIC_ERROR(
+        llvm::formatv("Target {0} has no shader clock counter to lower "
+                      "luthier::readClock with.",
+                      ST.getCPU()));
+  }
+  return llvm::Error::success();
+}
+
+llvm::Expected<IntrinsicIRLoweringInfo>
+readRealTimeIRProcessor(const llvm::Function &Intrinsic,
+                        const llvm::CallInst &User,
+                        const llvm::GCNTargetMachine &TM) {
+  return counterIRProcessor("readRealTime", User);
+}
+
+llvm::Error readRealTimeMIRProcessor(
+    const IntrinsicIRLoweringInfo &IRLoweringInfo,
+    llvm::ArrayRef<std::pair<llvm::InlineAsm::Flag, llvm::Register>> Args,
+    const std::function<llvm::MachineInstrBuilder(int)> &MIBuilder,
+    const std::function<llvm::Register(const llvm::TargetRegisterClass *)>
+        &VirtRegBuilder,
+    const std::function<llvm::Register(KernelArgumentType)> &,
+    const llvm::MachineFunction &MF,
+    const std::function<llvm::Register(llvm::MCRegister)> &PhysRegAccessor,
+    llvm::DenseMap<llvm::MCRegister, llvm::Register> &PhysRegsToBeOverwritten) {
+  llvm::Expected<llvm::Register> OutputOrErr =
+      getCounterOutput("readRealTime", Args);
+  LUTHIER_RETURN_ON_ERROR(OutputOrErr.takeError());
+  llvm::Register Output = *OutputOrErr;
+  auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+
+  if (ST.hasSMemRealTime()) {
+    readCounterWithSMem(llvm::AMDGPU::S_MEMREALTIME, Output, MIBuilder,
+                        VirtRegBuilder);
+  } else if (ST.getGeneration() >= llvm::AMDGPUSubtarget::GFX11) {
+    // The real time counter is requested from the message unit instead
+    (void)MIBuilder(llvm::AMDGPU::S_SENDMSG_RTN_B64)
+        .addReg(Output, llvm::RegState::Define)
+        .addImm(llvm::AMDGPU::SendMsg::ID_RTN_GET_REALTIME);
+  } else {
+    return LUTHIER_MAKE_GENERIC_ERROR(
+        llvm::formatv("Target {0} has no real time counter to lower "
+                      "luthier::readRealTime with.",
+                      ST.getCPU()));
+  }
+  return llvm::Error::success();
+}
+
+} // namespace luthier
@@ -0,0 +1,168 @@
+//===-- TraceReserve.cpp --------------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the trace buffer slot reservation intrinsic.
+//===----------------------------------------------------------------------===//
+#include "luthier/Intrinsic/TraceReserve.h"
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "SIDefines.h"
+#include "SIRegisterInfo.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/Common/LuthierError.h"
+#include "luthier/trace.h"
+#include <cstddef>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/User.h>
+#include <llvm/MC/MCRegister.h>
+
+namespace luthier {
+
+llvm::Expected<IntrinsicIRLoweringInfo>
+traceReserveIRProcessor(const llvm::Function &Intrinsic,
+                        const llvm::CallInst &User,
+                        const llvm::GCNTargetMachine &TM) {
+  // The User must only have 1 operand
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      User.arg_size() == 1,
+      llvm::formatv("Expected one operand to be passed to the "
+                    "luthier::traceReserve intrinsic '{0}', got {1}.",
+                    User, User.arg_size())));
+
+  luthier::IntrinsicIRLoweringInfo Out;
+  // Each lane gets its own slot index, hence the output will be in a VGPR
+  Out.setReturnValueInfo(&User, "v");
+  // The address of the trace buffer must be uniform across the wavefront,
+  // as it is used as the base of a scalar atomic
+  Out.addArgInfo(User.getArgOperand(0), "s");
+  return Out;
+}
+
+llvm::Error traceReserveMIRProcessor(
+    const IntrinsicIRLoweringInfo &IRLoweringInfo,
+    llvm::ArrayRef<std::pair<llvm::InlineAsm::Flag, llvm::Register>> Args,
+    const std::function<llvm::MachineInstrBuilder(int)> &MIBuilder,
+    const std::function<llvm::Register(const llvm::TargetRegisterClass *)>
+        &VirtRegBuilder,
+    const std::function<llvm::Register(KernelArgumentType)> &,
+    const llvm::MachineFunction &MF,
+    const std::function<llvm::Register(llvm::MCRegister)> &PhysRegAccessor,
+    llvm::DenseMap<llvm::MCRegister, llvm::Register> &PhysRegsToBeOverwritten) {
+  // There should be two virtual registers involved in the operation
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Args.size() == 2,
+      llvm::formatv("Number of virtual register arguments "
+                    "involved in the MIR lowering stage of "
+                    "luthier::traceReserve is {0} instead of 2.",
+                    Args.size())));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Args[0].first.isRegDefKind(), "The first virtual register argument for "
+                                    "luthier::traceReserve is not a def."));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Args[1].first.isRegUseKind(), "The second virtual register argument for "
+                                    "luthier::traceReserve is not a use."));
+  llvm::Register Output = Args[0].second;
+  llvm::Register SBufferAddress = Args[1].second;
+
+  auto &MRI = MF.getRegInfo();
+  auto &TRI = *MF.getSubtarget<llvm::GCNSubtarget>().getRegisterInfo();
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      TRI.getRegSizeInBits(Output, MRI) == 64,
+      "The output register of luthier::traceReserve must be 64 bits wide."));
+
+  // Count the number of active lanes; Each of them reserves a single slot
+  llvm::Register NumActiveLanes =
+      VirtRegBuilder(&llvm::AMDGPU::SReg_32RegClass);
+  MIBuilder(llvm::AMDGPU::S_BCNT1_I32_B64)
+      .addReg(NumActiveLanes, llvm::RegState::Define)
+      .addReg(llvm::AMDGPU::EXEC);
+
+  llvm::Register Zero = VirtRegBuilder(&llvm::AMDGPU::SReg_32RegClass);
+  MIBuilder(llvm::AMDGPU::S_MOV_B32)
+      .addReg(Zero, llvm::RegState::Define)
+      .addImm(0);
+
+  llvm::Register NumSlots = VirtRegBuilder(&llvm::AMDGPU::SReg_64RegClass);
+  MIBuilder(llvm::AMDGPU::REG_SEQUENCE)
+      .addReg(NumSlots, llvm::RegState::Define)
+      .addReg(NumActiveLanes)
+      .addImm(llvm::SIRegisterInfo::getSubRegFromChannel(0))
+      .addReg(Zero)
+      .addImm(llvm::SIRegisterInfo::getSubRegFromChannel(1));
+
+  // Reserve the slots of the entire wavefront with a single scalar atomic
+  // on the write index of the buffer
+  llvm::Register FirstSlot = VirtRegBuilder(&llvm::AMDGPU::SReg_64RegClass);
+  MIBuilder(llvm::AMDGPU::S_ATOMIC_ADD_X2_IMM_RTN)
+      .addReg(FirstSlot, llvm::RegState::Define)
+      .addReg(NumSlots)
+      .addReg(SBufferAddress)
+      .addImm(offsetof(TraceBufferHeader, WriteIndex))
+      .addImm(llvm::AMDGPU::CPol::GLC);
+
+  // Each lane's slot is offset by the number of active lanes before it
+  llvm::Register MbcntLo = VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass);
+  MIBuilder(llvm::AMDGPU::V_MBCNT_LO_U32_B32_e64)
+      .addReg(MbcntLo, llvm::RegState::Define)
+      .addImm(-1)
+      .addImm(0);
+
+  llvm::Register LaneRank = VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass);
+  MIBuilder(llvm::AMDGPU::V_MBCNT_HI_U32_B32_e64)
+      .addReg(LaneRank, llvm::RegState::Define)
+      .addImm(-1)
+      .addReg(MbcntLo);
+
+  llvm::Register SlotLo = VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass);
+  llvm::Register Carry = VirtRegBuilder(TRI.getBoolRC());
+  MIBuilder(llvm::AMDGPU::V_ADD_CO_U32_e64)
+      .addReg(SlotLo, llvm::RegState::Define)
+      .addReg(Carry, llvm::RegState::Define)
+      .addReg(FirstSlot, 0, llvm::SIRegisterInfo::getSubRegFromChannel(0))
+      .addReg(LaneRank)
+      .addImm(0);
+
+  // Move the high half of the first slot to a VGPR to stay within the
+  // constant bus limit of the carry add
+  llvm::Register FirstSlotHi = VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass);
+  MIBuilder(llvm::AMDGPU::V_MOV_B32_e32)
+      .addReg(FirstSlotHi, llvm::RegState::Define)
+      .addReg(FirstSlot, 0, llvm::SIRegisterInfo::getSubRegFromChannel(1));
+
+  llvm::Register SlotHi = VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass);
+  llvm::Register DeadCarry = VirtRegBuilder(TRI.getBoolRC());
+  MIBuilder(llvm::AMDGPU::V_ADDC_U32_e64)
+      .addReg(SlotHi, llvm::RegState::Define)
+      .addReg(DeadCarry, llvm::RegState::Define | llvm::RegState::Dead)
+      .addReg(FirstSlotHi)
+      .addImm(0)
+      .addReg(Carry, llvm::RegState::Kill)
+      .addImm(0);
+
+  (void)MIBuilder(llvm::AMDGPU::REG_SEQUENCE)
+      .addReg(Output, llvm::RegState::Define)
+      .addReg(SlotLo)
+      .addImm(llvm::SIRegisterInfo::getSubRegFromChannel(0))
+      .addReg(SlotHi)
+      .addImm(llvm::SIRegisterInfo::getSubRegFromChannel(1));
+
+  return llvm::Error::success();
+}
+
+} // namespace luthier
@@ -0,0 +1,294 @@
+//===-- WaveAtomicAdd.cpp -------------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the wave-reduced atomic add intrinsic.
+//===----------------------------------------------------------------------===//
+#include "luthier/Intrinsic/WaveAtomicAdd.h"
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "SIDefines.h"
+#include "SIRegisterInfo.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/Common/LuthierError.h"
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/User.h>
+#include <llvm/MC/MCRegister.h>
+
+namespace luthier {
+
+llvm::Expected<IntrinsicIRLoweringInfo>
+waveAtomicAddIRProcessor(const llvm::Function &Intrinsic,
+                         const llvm::CallInst &User,
+                         const llvm::GCNTargetMachine &TM) {
+  // The User must only have 2 operands
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      User.arg_size() == 2,
+      llvm::formatv("Expected two operands to be passed to the "
+                    "luthier::waveAtomicAdd intrinsic '{0}', got {1}.",
+                    User, User.arg_size())));
+
+  luthier::IntrinsicIRLoweringInfo Out;
+  // The intrinsic returns void, hence the constraint of its return value is
+  // never used
+  Out.setReturnValueInfo(&User, "s");
+  // The address of the counter must be uniform across the wavefront, as only
+  // a single atomic is issued for the entire wavefront
+  Out.addArgInfo(User.getArgOperand(0), "s");
+  // Each lane contributes its own value to the sum
+  Out.addArgInfo(User.getArgOperand(1), "v");
+  return Out;
+}
+
+/// Adds the 32-bit halves in \p RHS to the ones in \p LHS, and returns the
+/// halves of the sum; Carries are propagated between the halves of 64-bit
+/// values
+static llvm::SmallVector<llvm::Register, 2> buildVectorAdd(
+    llvm::ArrayRef<llvm::Register> LHS, llvm::ArrayRef<llvm::Register> RHS,
+    const std::function<llvm::MachineInstrBuilder(int)> &MIBuilder,
+    const std::function<llvm::Register(const llvm::TargetRegisterClass *)>
+        &VirtRegBuilder,
+    const llvm::SIRegisterInfo &TRI) {
+  llvm::SmallVector<llvm::Register, 2> Out;
+  Out.push_back(VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass));
+  if (LHS.size() == 1) {
+    MIBuilder(llvm::AMDGPU::V_ADD_U32_e64)
+        .addReg(Out[0], llvm::RegState::Define)
+        .addReg(LHS[0])
+        .addReg(RHS[0])
+        .addImm(0);
+    return Out;
+  }
+  llvm::Register Carry = VirtRegBuilder(TRI.getBoolRC());
+  MIBuilder(llvm::AMDGPU::V_ADD_CO_U32_e64)
+      .addReg(Out[0], llvm::RegState::Define)
+      .addReg(Carry, llvm::RegState::Define)
+      .addReg(LHS[0])
+      .addReg(RHS[0])
+      .addImm(0);
+  Out.push_back(VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass));
+  llvm::Register DeadCarry = VirtRegBuilder(TRI.getBoolRC());
+  MIBuilder(llvm::AMDGPU::V_ADDC_U32_e64)
+      .addReg(Out[1], llvm::RegState::Define)
+      .addReg(DeadCarry, llvm::RegState::Define | llvm::RegState::Dead)
+      .addReg(LHS[1])
+      .addReg(RHS[1])
+      .addReg(Carry, llvm::RegState::Kill)
+      .addImm(0);
+  return Out;
+}
+
+llvm::Error waveAtomicAddMIRProcessor(
+    const IntrinsicIRLoweringInfo &IRLoweringInfo,
+    llvm::ArrayRef<std::pair<llvm::InlineAsm::Flag, llvm::Register>> Args,
+    const std::function<llvm::MachineInstrBuilder(int)> &MIBuilder,
+    const std::function<llvm::Register(const llvm::TargetRegisterClass *)>
+        &VirtRegBuilder,
+    const std::function<llvm::Register(KernelArgumentType)> &,
+    const llvm::MachineFunction &MF,
+    const std::function<llvm::Register(llvm::MCRegister)> &PhysRegAccessor,
+    llvm::DenseMap<llvm::MCRegister, llvm::Register> &PhysRegsToBeOverwritten) {
+  // There should be two virtual registers involved in the operation
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Args.size() == 2,
+      llvm::formatv("Number of virtual register arguments "
+                    "involved in the MIR lowering stage of "
+                    "luthier::waveAtomicAdd is {0} instead of 2.",
+                    Args.size())));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Args[0].first.isRegUseKind(), "The first virtual register argument for "
+                                    "luthier::waveAtomicAdd is not a use."));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Args[1].first.isRegUseKind(), "The second virtual register argument for "
+                                    "luthier::waveAtomicAdd is not a use."));
+  llvm::Register SBaseAddress = Args[0].second;
+  llvm::Register VData = Args[1].second;
+
+  auto &MRI = MF.getRegInfo();
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  auto &TRI = *ST.getRegisterInfo();
+
+  auto DataRegSize = TRI.getRegSizeInBits(VData, MRI);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      DataRegSize == 64 || DataRegSize == 32,
+      llvm::formatv("Data register size of luthier::waveAtomicAdd must be "
+                    "either 64 or 32 bits, got {0} instead.",
+                    DataRegSize)));
+  const bool Is64Bit = DataRegSize == 64;
+  const unsigned NumHalves = DataRegSize / 32;
+
+  // Set the inactive lanes to zero so that they don't contribute to the
+  // sum; The reduction below runs in strict whole wave mode, which is set up
+  // by the SI whole quad mode pass before register allocation
+  llvm::SmallVector<llvm::Register, 2> Partial;
+  if (Is64Bit) {
+    llvm::Register Merged = VirtRegBuilder(&llvm::AMDGPU::VReg_64RegClass);
+    MIBuilder(llvm::AMDGPU::V_SET_INACTIVE_B64)
+        .addReg(Merged, llvm::RegState::Define)
+        .addReg(VData)
+        .addImm(0);
+    for (unsigned I = 0; I < NumHalves; ++I) {
+      Partial.push_back(VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass));
+      MIBuilder(llvm::AMDGPU::COPY)
+          .addReg(Partial.back(), llvm::RegState::Define)
+          .addReg(Merged, 0, llvm::SIRegisterInfo::getSubRegFromChannel(I));
+    }
+  } else {
+    Partial.push_back(VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass));
+    MIBuilder(llvm::AMDGPU::V_SET_INACTIVE_B32)
+        .addReg(Partial.back(), llvm::RegState::Define)
+        .addReg(VData)
+        .addImm(0);
+  }
+
+  // Lanes shifting in from outside their row keep the identity value
+  llvm::Register Identity = VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass);
+  MIBuilder(llvm::AMDGPU::V_MOV_B32_e32)
+      .addReg(Identity, llvm::RegState::Define)
+      .addImm(0);
+
+  // Inclusive scan inside each row of 16 lanes with DPP row shifts; Once
+  // done, the last lane of each row holds the sum of its row
+  for (unsigned Shift = 1; Shift < 16; Shift <<= 1) {
+    llvm::SmallVector<llvm::Register, 2> Shifted;
+    for (llvm::Register Half : Partial) {
+      Shifted.push_back(VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass));
+      MIBuilder(llvm::AMDGPU::V_MOV_B32_dpp)
+          .addReg(Shifted.back(), llvm::RegState::Define)
+          .addReg(Identity)
+          .addReg(Half)
+          .addImm(llvm::AMDGPU::DPP::ROW_SHR0 + Shift)
+          .addImm(0xf)
+          .addImm(0xf)
+          .addImm(0);
+    }
+    Partial = buildVectorAdd(Partial, Shifted, MIBuilder, VirtRegBuilder, TRI);
+  }
+
+  llvm::SmallVector<llvm::Register, 2> RowSums;
+  for (llvm::Register Half : Partial) {
+    RowSums.push_back(VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass));
+    MIBuilder(llvm::AMDGPU::STRICT_WWM)
+        .addReg(RowSums.back(), llvm::RegState::Define)
+        .addReg(Half);
+  }
+
+  // Read the sum of each row, and add them up in SGPRs; Lane reads ignore
+  // the exec mask, so this part no longer needs the whole wavefront enabled
+  const unsigned NumRows = ST.getWavefrontSize() / 16;
+  llvm::SmallVector<llvm::Register, 2> Total;
+  for (unsigned Row = 0; Row < NumRows; ++Row) {
+    llvm::SmallVector<llvm::Register, 2> RowSum;
+    for (llvm::Register Half : RowSums) {
+      RowSum.push_back(VirtRegBuilder(&llvm::AMDGPU::SGPR_32RegClass));
+      MIBuilder(llvm::AMDGPU::V_READLANE_B32)
+          .addReg(RowSum.back(), llvm::RegState::Define)
+          .addReg(Half)
+          .addImm(Row * 16 + 15);
+    }
+    if (Row == 0) {
+      Total = RowSum;
+      continue;
+    }
+    llvm::SmallVector<llvm::Register, 2> NewTotal;
+    for (unsigned I = 0; I < NumHalves; ++I) {
+      NewTotal.push_back(VirtRegBuilder(&llvm::AMDGPU::SGPR_32RegClass));
+      MIBuilder(I == 0 ? llvm::AMDGPU::S_ADD_U32 : llvm::AMDGPU::S_ADDC_U32)
+          .addReg(NewTotal.back(), llvm::RegState::Define)
+          .addReg(Total[I])
+          .addReg(RowSum[I]);
+    }
+    Total = NewTotal;
+  }
+
+  llvm::Register SData = Total[0];
+  if (Is64Bit) {
+    SData = VirtRegBuilder(&llvm::AMDGPU::SReg_64RegClass);
+    MIBuilder(llvm::AMDGPU::REG_SEQUENCE)
+        .addReg(SData, llvm::RegState::Define)
+        .addReg(Total[0])
+        .addImm(llvm::SIRegisterInfo::getSubRegFromChannel(0))
+        .addReg(Total[1])
+        .addImm(llvm::SIRegisterInfo::getSubRegFromChannel(1));
+  }
+
+  // Scalar atomics are issued once for the entire wavefront
+  if (ST.hasScalarAtomics()) {
+    (void)MIBuilder(Is64Bit ? llvm::AMDGPU::S_ATOMIC_ADD_X2_IMM
+                            : llvm::AMDGPU::S_ATOMIC_ADD_IMM)
+        .addReg(SData)
+        .addReg(SBaseAddress)
+        .addImm(0)
+        .addImm(0);
+    return llvm::Error::success();
+  }
+
+  // Otherwise, restrict the exec mask to the first active lane around a
+  // vector atomic; When no lane is active, the shifted mask does not
+  // intersect with the exec mask, and the atomic is skipped
+  const bool IsWave32 = ST.isWave32();
+  const llvm::MCRegister Exec =
+      IsWave32 ? llvm::AMDGPU::EXEC_LO : llvm::AMDGPU::EXEC;
+  llvm::Register FirstLane = VirtRegBuilder(&llvm::AMDGPU::SReg_32RegClass);
+  MIBuilder(IsWave32 ? llvm::AMDGPU::S_FF1_I32_B32
+                     : llvm::AMDGPU::S_FF1_I32_B64)
+      .addReg(FirstLane, llvm::RegState::Define)
+      .addReg(Exec);
+
+  llvm::Register FirstLaneMask = VirtRegBuilder(TRI.getBoolRC());
+  MIBuilder(IsWave32 ? llvm::AMDGPU::S_LSHL_B32 : llvm::AMDGPU::S_LSHL_B64)
+      .addReg(FirstLaneMask, llvm::RegState::Define)
+      .addImm(1)
+      .addReg(FirstLane);
+
+  llvm::Register SavedExec = VirtRegBuilder(TRI.getBoolRC());
+  MIBuilder(IsWave32 ? llvm::AMDGPU::S_AND_SAVEEXEC_B32
+                     : llvm::AMDGPU::S_AND_SAVEEXEC_B64)
+      .addReg(SavedExec, llvm::RegState::Define)
+      .addReg(FirstLaneMask);
+
+  llvm::Register VOffset = VirtRegBuilder(&llvm::AMDGPU::VGPR_32RegClass);
+  MIBuilder(llvm::AMDGPU::V_MOV_B32_e32)
+      .addReg(VOffset, llvm::RegState::Define)
+      .addImm(0);
+
+  llvm::Register VTotal =
+      VirtRegBuilder(Is64Bit ? &llvm::AMDGPU::VReg_64RegClass
+                             : &llvm::AMDGPU::VGPR_32RegClass);
+  MIBuilder(Is64Bit ? llvm::AMDGPU::V_MOV_B64_PSEUDO
+                    : llvm::AMDGPU::V_MOV_B32_e32)
+      .addReg(VTotal, llvm::RegState::Define)
+      .addReg(SData);
+
+  MIBuilder(Is64Bit ? llvm::AMDGPU::GLOBAL_ATOMIC_ADD_X2_SADDR
+                    : llvm::AMDGPU::GLOBAL_ATOMIC_ADD_SADDR)
+      .addReg(VOffset)
+      .addReg(VTotal)
+      .addReg(SBaseAddress)
+      .addImm(0)
+      .addImm(0);
+
+  (void)MIBuilder(IsWave32 ? llvm::AMDGPU::S_MOV_B32 : llvm::AMDGPU::S_MOV_B64)
+      .addReg(Exec, llvm::RegState::Define)
+      .addReg(SavedExec, llvm::RegState::Kill);
+
+  return llvm::Error::success();
+}
+
+} // namespace luthier
@@ -24,11 +24,14 @@
 #include "luthier/Tooling/AMDGPURegisterLiveness.h"
 #include "luthier/Tooling/CodeLifter.h"
 #include "luthier/Tooling/InjectedPayloadPEIPass.h"
+#include "luthier/Tooling/InstrumentationRecord.h"
 #include "luthier/Tooling/MMISlotIndexesAnalysis.h"
 #include "luthier/Tooling/PatchLiftedRepresentationPass.h"
 #include "luthier/Tooling/PrePostAmbleEmitter.h"
+#include "luthier/Tooling/ReuseInjectedPayloadsPass.h"
 #include "luthier/Tooling/RunIRPassesOnIModulePass.h"
 #include "luthier/Tooling/RunMIRPassesOnIModulePass.h"
+#include "luthier/Tooling/TargetManager.h"
 #include "luthier/Tooling/ToolExecutableLoader.h"
 #include "luthier/Tooling/WrapperAnalysisPasses.h"
 #include <AMDGPUResourceUsageAnalysis.h>
@@ -94,12 +97,17 @@ llvm::Error CodeGenerator::printAssembly(
   return llvm::Error::success();
 }
 
-llvm::Error
-CodeGenerator::applyInstrumentationTask(const InstrumentationTask &Task,
-                                        LiftedRepresentation &LR) {
+llvm::Error CodeGenerator::applyInstrumentationTask(
+    const InstrumentationTask &Task, LiftedRepresentation &LR,
+    const InstrumentationRecord *Previous, InstrumentationRecord *Record) {
   // Early exit if no hooks are to be inserted into the LR
-  if (Task.getHookInsertionTasks().empty())
+  if (Task.getHookInsertionTasks().empty()) {
+    if (Record) {
+      *Record = InstrumentationRecord();
+      Record->IsReplayable = true;
+    }
     return llvm::Error::success();
+  }
   // Acquire the Lifted Representation's lock
   auto Lock = LR.getLock();
   // Each LCO will get its own copy of the instrumented module
@@ -107,10 +115,26 @@ CodeGenerator::applyInstrumentationTask(const InstrumentationTask &Task,
   auto Agent = hsa::loadedCodeObjectGetAgent(LoaderApiSnapshot.getTable(), LCO);
   LUTHIER_RETURN_ON_ERROR(Agent.takeError());
 
-  auto &TM = LR.getTM();
+  // Holds the instrumentation module and its generated machine code; If a
+  // record is requested, it is kept alive by the record so that the
+  // machine code can be reused by later instrumentations
+  auto CodeGenState = std::make_shared<InjectedPayloadCodeGenState>();
+  // Recorded machine code must not depend on the target machine of the
+  // instrumented LR, which can be destroyed before the record is
+  if (Record) {
+    auto &LRTM = LR.getTM();
+    auto ISA = TargetManager::instance().getISA(LRTM);
+    LUTHIER_RETURN_ON_ERROR(ISA.takeError());
+    LUTHIER_RETURN_ON_ERROR(TargetManager::instance()
+                                .borrowTargetMachine(*ISA)
+                                .moveInto(CodeGenState->TM));
+    CodeGenState->TM->Options = LRTM.Options;
+    CodeGenState->TM->setOptLevel(LRTM.getOptLevel());
+  }
+  auto &TM = Record ? *CodeGenState->TM : LR.getTM();
   // Load the bitcode of the instrumentation module into the
   // Lifted Representation's context
-  std::unique_ptr<llvm::Module> IModule;
+  std::unique_ptr<llvm::Module> &IModule = CodeGenState->IModule;
   LUTHIER_RETURN_ON_ERROR(Task.getModule()
                               .readBitcodeIntoContext(LR.getContext(), *Agent)
                               .moveInto(IModule));
@@ -136,10 +160,16 @@ CodeGenerator::applyInstrumentationTask(const InstrumentationTask &Task,
   // We allocate this on the heap to have the most control over its lifetime,
   // as if it goes out of scope it will also delete the instrumentation
   // MMI
-  auto LegacyIPM = new llvm::legacy::PassManager();
+  CodeGenState->LegacyPM = std::make_unique<llvm::legacy::PassManager>();
+  auto LegacyIPM = CodeGenState->LegacyPM.get();
   // Instrumentation module MMI wrapper pass, which will house the final
   // generate instrumented code
   auto *IMMIWP = new llvm::MachineModuleInfoWrapperPass(&TM);
+  // Holds on to the machine code generated for the injected payloads until
+  // it is patched into the lifted representation
+  IModuleCodeGenResult &CodeGenResult = CodeGenState->CodeGenResult;
+  // The record populated by this instrumentation
+  InstrumentationRecord NewRecord;
 
   // Create a module analysis manager for the target code
   llvm::ModuleAnalysisManager TargetMAM;
@@ -174,19 +204,78 @@ CodeGenerator::applyInstrumentationTask(const InstrumentationTask &Task,
   TargetMAM.registerPass(
       [&]() { return FunctionPreambleDescriptorAnalysis(); });
   // Add the IR pipeline for the instrumentation module
-  TargetMPM.addPass(
-      RunIRPassesOnIModulePass(Task, IntrinsicsProcessors, TM, *IModule));
+  TargetMPM.addPass(RunIRPassesOnIModulePass(Task, IntrinsicsProcessors, TM,
+                                             *IModule,
+                                             Task.getPipelineOptions()));
+  // Reuse the machine code of unchanged injected payloads
+  if (Record)
+    TargetMPM.addPass(ReuseInjectedPayloadsPass(Task, LR, *IModule, Previous,
+                                                NewRecord, CodeGenResult));
   // Add the MIR pipeline for the instrumentation module
   TargetMPM.addPass(
-      RunMIRPassesOnIModulePass(TM, *IModule, *IMMIWP, *LegacyIPM));
+      RunMIRPassesOnIModulePass(TM, *IModule, *IMMIWP, *LegacyIPM,
+                                Task.getPipelineOptions(), CodeGenResult));
   // Add the kernel pre-amble emission pass
   TargetMPM.addPass(PrePostAmbleEmitter());
   // Add the lifted representation patching pass
-  TargetMPM.addPass(PatchLiftedRepresentationPass(*IModule, IMMIWP->getMMI()));
+  TargetMPM.addPass(PatchLiftedRepresentationPass(*IModule, CodeGenResult));
 
   TargetMPM.run(LR.getModule(), TargetMAM);
-  // TODO: remove this once the new MMI makes it to LLVM master
-  delete LegacyIPM;
+
+  if (Record) {
+    LUTHIER_RETURN_ON_ERROR(fillInstrumentationRecord(
+        Task, LR, TargetMAM, CodeGenState, NewRecord));
+    *Record = std::move(NewRecord);
+  }
+  return llvm::Error::success();
+}
+
+llvm::Error CodeGenerator::fillInstrumentationRecord(
+    const InstrumentationTask &Task, const LiftedRepresentation &LR,
+    llvm::ModuleAnalysisManager &TargetMAM,
+    const std::shared_ptr<InjectedPayloadCodeGenState> &CodeGenState,
+    InstrumentationRecord &Record) {
+  // Record the hooks of each instrumentation point; Hooks inserted before
+  // instructions that were not lifted cannot be replayed
+  Record.IsReplayable = true;
+  for (const auto &[MI, Hooks] : Task.getHookInsertionTasks()) {
+    if (const hsa::Instr *Inst = LR.getLiftedEquivalent(*MI))
+      Record.Hooks.insert({Inst, Hooks});
+    else
+      Record.IsReplayable = false;
+  }
+  // Record the machine code generated by this instrumentation; Reused
+  // payloads already point to their machine code
+  for (const auto &Unit : CodeGenState->CodeGenResult.units()) {
+    for (const auto &[MI, Payload] : Unit.IPIP.mi_payload()) {
+      const auto *MF = Unit.IMMI.getMachineFunction(*Payload);
+      if (MF == nullptr)
+        continue;
+      const hsa::Instr *Inst = LR.getLiftedEquivalent(*MI);
+      if (Inst == nullptr)
+        continue;
+      auto It = Record.Payloads.find(Inst);
+      if (It == Record.Payloads.end() || It->second.MF != nullptr)
+        continue;
+      It->second.MF = MF;
+      It->second.IModule = &Unit.IModule;
+      It->second.IMMI = &Unit.IMMI;
+      It->second.State = CodeGenState;
+    }
+  }
+  // Record the preamble requirements of each function, so that they can be
+  // re-applied when the payloads are reused
+  auto *PreambleDescriptor =
+      TargetMAM.getCachedResult<FunctionPreambleDescriptorAnalysis>(
+          LR.getModule());
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      PreambleDescriptor != nullptr,
+      "Failed to get the function preamble descriptor of the lifted "
+      "representation."));
+  for (const auto &[MF, Specs] : PreambleDescriptor->Kernels)
+    Record.KernelPreambles.insert({MF->getName(), Specs});
+  for (const auto &[MF, Specs] : PreambleDescriptor->DeviceFunctions)
+    Record.DeviceFunctionPreambles.insert({MF->getName(), Specs});
   return llvm::Error::success();
 }
 
@@ -228,4 +317,72 @@ llvm::Expected<std::unique_ptr<LiftedRepresentation>> CodeGenerator::instrument(
   return std::move(ClonedLR);
 }
 
+llvm::Expected<std::unique_ptr<LiftedRepresentation>> CodeGenerator::instrument(
+    const LiftedRepresentation &LR,
+    llvm::function_ref<llvm::Error(InstrumentationTask &,
+                                   LiftedRepresentation &)>
+        Mutator,
+    InstrumentationRecord &Record) {
+  // Acquire the context lock for thread-safety
+  auto Lock = LR.getLock();
+  std::unique_ptr<LiftedRepresentation> ClonedLR;
+  // Clone the Lifted Representation
+  LUTHIER_RETURN_ON_ERROR(
+      CodeLifter::instance().cloneRepresentation(LR).moveInto(ClonedLR));
+  InstrumentationTask IT(*ClonedLR);
+  LUTHIER_RETURN_ON_ERROR(Mutator(IT, *ClonedLR));
+  // Apply the instrumentation task, and populate the record from scratch
+  LUTHIER_RETURN_ON_ERROR(
+      applyInstrumentationTask(IT, *ClonedLR, nullptr, &Record));
+  return std::move(ClonedLR);
+}
+
+llvm::Expected<std::unique_ptr<LiftedRepresentation>>
+CodeGenerator::reinstrument(
+    const LiftedRepresentation &LR, InstrumentationRecord &Record,
+    llvm::function_ref<llvm::Error(InstrumentationTask &,
+                                   LiftedRepresentation &)>
+        DeltaMutator) {
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Record.isReplayable(),
+      "The instrumentation record cannot be used for re-instrumentation, as "
+      "hooks were inserted before instructions that were not lifted."));
+  // Acquire the context lock for thread-safety
+  auto Lock = LR.getLock();
+  std::unique_ptr<LiftedRepresentation> ClonedLR;
+  // Clone the Lifted Representation
+  LUTHIER_RETURN_ON_ERROR(
+      CodeLifter::instance().cloneRepresentation(LR).moveInto(ClonedLR));
+  InstrumentationTask IT(*ClonedLR);
+  // Replay the recorded hooks on the instructions of the clone; The lifted
+  // instructions are shared between clones of the same LR
+  for (auto &F : ClonedLR->getModule()) {
+    auto *MF = ClonedLR->getMMI().getMachineFunction(F);
+    if (MF == nullptr)
+      continue;
+    for (auto &MBB : *MF) {
+      for (auto &MI : MBB) {
+        const hsa::Instr *Inst = ClonedLR->getLiftedEquivalent(MI);
+        if (Inst == nullptr)
+          continue;
+        if (auto It = Record.Hooks.find(Inst); It != Record.Hooks.end())
+          IT.HookInsertionTasks.insert({&MI, It->second});
+      }
+    }
+  }
+  // Apply the changes on top of the replayed hooks
+  LUTHIER_RETURN_ON_ERROR(DeltaMutator(IT, *ClonedLR));
+  // Apply the instrumentation task, reusing the unchanged injected payloads
+  // of the record
+  LUTHIER_RETURN_ON_ERROR(
+      applyInstrumentationTask(IT, *ClonedLR, &Record, &Record));
+
+  LLVM_DEBUG(llvm::dbgs() << "Re-instrumentation reused "
+                          << Record.getNumReusedPayloads()
+                          << " injected payloads and generated "
+                          << Record.getNumGeneratedPayloads() << ".\n");
+
+  return std::move(ClonedLR);
+}
+
 } // namespace luthier
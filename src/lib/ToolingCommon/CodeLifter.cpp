@@ -117,6 +117,7 @@ bool CodeLifter::evaluateBranch(const llvm::MCInst &Inst, uint64_t Addr,
 
 llvm::Expected<CodeLifter::DisassemblyInfo &>
 luthier::CodeLifter::getDisassemblyInfo(hsa_isa_t ISA) {
+  std::lock_guard Lock(DisassemblyInfoMutex);
   if (!DisassemblyInfoMap.contains(ISA)) {
     auto TargetInfo = TargetManager::instance().getTargetInfo(ISA);
     LUTHIER_RETURN_ON_ERROR(TargetInfo.takeError());
@@ -138,23 +139,24 @@ luthier::CodeLifter::getDisassemblyInfo(hsa_isa_t ISA) {
         DisAsm != nullptr, "Failed to create an MCDisassembler for the LLVM "
                            "disassembly operation."));
 
-    DisassemblyInfoMap.insert(
-        {ISA, DisassemblyInfo{std::move(MCCtx), std::move(DisAsm)}});
+    DisassemblyInfoMap.try_emplace(ISA, std::move(MCCtx), std::move(DisAsm));
   }
-  return DisassemblyInfoMap[ISA];
+  return DisassemblyInfoMap.at(ISA);
 }
 
 bool CodeLifter::isAddressDirectBranchTarget(hsa_loaded_code_object_t LCO,
                                              address_t Address) {
-  if (!DirectBranchTargetLocations.contains(LCO)) {
+  std::shared_lock Lock(BranchTargetsMutex);
+  auto It = DirectBranchTargetLocations.find(LCO);
+  if (It == DirectBranchTargetLocations.end()) {
     return false;
   }
-  auto &AddressInfo = DirectBranchTargetLocations[LCO];
-  return AddressInfo.contains(Address);
+  return It->second.contains(Address);
 }
 
 void luthier::CodeLifter::addDirectBranchTargetAddress(
     hsa_loaded_code_object_t LCO, address_t Address) {
+  std::unique_lock Lock(BranchTargetsMutex);
   if (!DirectBranchTargetLocations.contains(LCO)) {
     DirectBranchTargetLocations.insert(
         {LCO, llvm::DenseSet<luthier::address_t>{}});
@@ -171,6 +173,7 @@ CodeLifter::disassemble(hsa_isa_t ISA, llvm::ArrayRef<uint8_t> Code) {
   auto TargetInfo = TargetManager::instance().getTargetInfo(ISA);
   LUTHIER_RETURN_ON_ERROR(TargetInfo.takeError());
   const auto &DisAsm = DisassemblyInfo->DisAsm;
+  std::lock_guard DisAsmLock(DisassemblyInfo->Mutex);
 
   size_t MaxReadSize = TargetInfo->getMCAsmInfo()->getMaxInstLength();
   size_t Idx = 0;
@@ -200,64 +203,80 @@ CodeLifter::disassemble(hsa_isa_t ISA, llvm::ArrayRef<uint8_t> Code) {
   return std::make_pair(Instructions, Addresses);
 }
 
-llvm::Expected<const CodeLifter::LCORelocationInfo *>
-CodeLifter::resolveRelocation(hsa_loaded_code_object_t LCO,
-                              luthier::address_t Address) {
-  if (!Relocations.contains(LCO)) {
-    // If the LCO doesn't have its relocation info cached, calculate it
-    auto LoadedMemory =
-        hsa::loadedCodeObjectGetLoadedMemory(LoaderApiSnapshot.getTable(), LCO);
-    LUTHIER_RETURN_ON_ERROR(LoadedMemory.takeError());
-
-    auto LoadedMemoryBase = reinterpret_cast<address_t>(LoadedMemory->data());
-
-    llvm::Expected<object::AMDGCNObjectFile &> StorageELFOrErr =
-        hsa::LoadedCodeObjectCache::instance().getAssociatedObjectFile(LCO);
-    LUTHIER_RETURN_ON_ERROR(StorageELFOrErr.takeError());
-
-    // Create an entry for the LCO in the relocations map
-    auto &LCORelocationsMap =
-        Relocations
-            .insert({LCO, llvm::DenseMap<address_t, LCORelocationInfo>{}})
-            .first->getSecond();
-
-    for (const auto &Section : StorageELFOrErr->sections()) {
-      for (const llvm::object::ELFRelocationRef Reloc : Section.relocations()) {
-        // Only rely on the loaded address of the symbol instead of its name
-        // The name will be stripped from the relocation section
-        // if the symbol has a private linkage (i.e. device functions)
-        auto RelocSym = Reloc.getSymbol();
-        if (RelocSym != StorageELFOrErr->symbol_end()) {
-          auto RelocSymbolLoadedAddress = Reloc.getSymbol()->getAddress();
-          LUTHIER_RETURN_ON_ERROR(RelocSymbolLoadedAddress.takeError());
-          // Check with the hsa::Platform which HSA executable Symbol this
-          // address is associated with
-          auto RelocSymbol = hsa::LoadedCodeObjectSymbol::fromLoadedAddress(
-              CoreApiSnapshot.getTable(), LoaderApiSnapshot.getTable(),
-              LoadedMemoryBase + *RelocSymbolLoadedAddress);
-          LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-              *RelocSymbol != nullptr,
-              llvm::formatv("Failed to find a symbol associated with device "
-                            "address {0:x}.",
-                            LoadedMemoryBase + *RelocSymbolLoadedAddress)));
-          // The target address will be the base of the loaded
-          luthier::address_t TargetAddress =
-              LoadedMemoryBase + Reloc.getOffset();
-          LLVM_DEBUG(llvm::dbgs() << llvm::formatv(
-                         "Relocation found for symbol {0} at address {1:x} for "
-                         "LCO {2:x}.\n",
-                         llvm::cantFail(RelocSymbol.get()->getName()),
-                         TargetAddress, LCO.handle));
-          LCORelocationsMap.insert(
-              {TargetAddress,
-               LCORelocationInfo{std::move(RelocSymbol.get()->clone()),
-                                 Reloc}});
-        }
+llvm::Expected<llvm::DenseMap<address_t, CodeLifter::LCORelocationInfo>>
+CodeLifter::computeRelocations(hsa_loaded_code_object_t LCO) {
+  auto LoadedMemory =
+      hsa::loadedCodeObjectGetLoadedMemory(LoaderApiSnapshot.getTable(), LCO);
+  LUTHIER_RETURN_ON_ERROR(LoadedMemory.takeError());
+
+  auto LoadedMemoryBase = reinterpret_cast<address_t>(LoadedMemory->data());
+
+  llvm::Expected<object::AMDGCNObjectFile &> StorageELFOrErr =
+      hsa::LoadedCodeObjectCache::instance().getAssociatedObjectFile(LCO);
+  LUTHIER_RETURN_ON_ERROR(StorageELFOrErr.takeError());
+
+  llvm::DenseMap<address_t, LCORelocationInfo> LCORelocationsMap;
+
+  for (const auto &Section : StorageELFOrErr->sections()) {
+    for (const llvm::object::ELFRelocationRef Reloc : Section.relocations()) {
+      // Only rely on the loaded address of the symbol instead of its name
+      // The name will be stripped from the relocation section
+      // if the symbol has a private linkage (i.e. device functions)
+      auto RelocSym = Reloc.getSymbol();
+      if (RelocSym != StorageELFOrErr->symbol_end()) {
+        auto RelocSymbolLoadedAddress = Reloc.getSymbol()->getAddress();
+        LUTHIER_RETURN_ON_ERROR(RelocSymbolLoadedAddress.takeError());
+        // Check with the hsa::Platform which HSA executable Symbol this
+        // address is associated with
+        auto RelocSymbol = hsa::LoadedCodeObjectSymbol::fromLoadedAddress(
+            CoreApiSnapshot.getTable(), LoaderApiSnapshot.getTable(),
+            LoadedMemoryBase + *RelocSymbolLoadedAddress);
+        LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+            *RelocSymbol != nullptr,
+            llvm::formatv("Failed to find a symbol associated with device "
+                          "address {0:x}.",
+                          LoadedMemoryBase + *RelocSymbolLoadedAddress)));
+        // The target address will be the base of the loaded
+        luthier::address_t TargetAddress =
+            LoadedMemoryBase + Reloc.getOffset();
+        LLVM_DEBUG(llvm::dbgs() << llvm::formatv(
+                       "Relocation found for symbol {0} at address {1:x} for "
+                       "LCO {2:x}.\n",
+                       llvm::cantFail(RelocSymbol.get()->getName()),
+                       TargetAddress, LCO.handle));
+        LCORelocationsMap.insert(
+            {TargetAddress,
+             LCORelocationInfo{std::move(RelocSymbol.get()->clone()),
+                               Reloc}});
       }
     }
   }
-  // Querying actually begins here
-  const auto &LCORelocationsMap = Relocations.at(LCO);
+  return LCORelocationsMap;
+}
+
+llvm::Expected<const CodeLifter::LCORelocationInfo *>
+CodeLifter::resolveRelocation(hsa_loaded_code_object_t LCO,
+                              luthier::address_t Address) {
+  using LCORelocationsMapT = llvm::DenseMap<address_t, LCORelocationInfo>;
+  auto LCORelocationsMapOrErr = lookupOrCompute(
+      RelocationsMutex,
+      [&]() -> const LCORelocationsMapT * {
+        auto It = Relocations.find(LCO);
+        return It != Relocations.end() ? &It->second : nullptr;
+      },
+      // If the LCO doesn't have its relocation info cached, calculate it
+      // without holding the lock
+      [&]() { return computeRelocations(LCO); },
+      // Create an entry for the LCO in the relocations map; If another thread
+      // created it first, ours is discarded
+      [&](LCORelocationsMapT LCORelocationsMap) -> const LCORelocationsMapT & {
+        return Relocations.try_emplace(LCO, std::move(LCORelocationsMap))
+            .first->second;
+      });
+  LUTHIER_RETURN_ON_ERROR(LCORelocationsMapOrErr.takeError());
+  // Querying actually begins here; The per-LCO maps are never modified after
+  // insertion, so the entry stays valid after releasing the lock
+  const auto &LCORelocationsMap = *LCORelocationsMapOrErr;
   LLVM_DEBUG(
       llvm::dbgs() << llvm::formatv("Querying address {0:x} for LCO {1:x}\n",
                                     Address, LCO.handle));
@@ -281,19 +300,15 @@ llvm::Error CodeLifter::initLR(LiftedRepresentation &LR,
   // Get the LCO of the kernel
   hsa_loaded_code_object_t LCO = Kernel.getLoadedCodeObject();
   LR.LCO = LCO;
-  // Create a new Target Machine for the LCO
+  // Borrow a Target Machine for the LCO
   llvm::Expected<object::AMDGCNObjectFile &> ObjFileOrErr =
       hsa::LoadedCodeObjectCache::instance().getAssociatedObjectFile(LCO);
   LUTHIER_RETURN_ON_ERROR(ObjFileOrErr.takeError());
 
-  auto LLVMIsa = object::getObjectFileTargetTuple(*ObjFileOrErr);
-  LUTHIER_RETURN_ON_ERROR(LLVMIsa.takeError());
-
-  auto ISA = hsa::isaFromLLVM(CoreApiSnapshot.getTable(), std::get<0>(*LLVMIsa),
-                              std::get<1>(*LLVMIsa), std::get<2>(*LLVMIsa));
+  auto ISA = TargetManager::instance().getISA(*ObjFileOrErr);
   LUTHIER_RETURN_ON_ERROR(ISA.takeError());
   LUTHIER_RETURN_ON_ERROR(
-      TargetManager::instance().createTargetMachine(*ISA).moveInto(LR.TM));
+      TargetManager::instance().borrowTargetMachine(*ISA).moveInto(LR.TM));
   // Enable the AsmVerbose option in case we're printing a .s file
   LR.TM->Options.MCOptions.AsmVerbose = true;
   // Create the llvm::Module for this LCO
@@ -675,11 +690,7 @@ llvm::Error CodeLifter::liftFunction(const hsa::LoadedCodeObjectSymbol &Symbol,
       hsa::LoadedCodeObjectCache::instance().getAssociatedObjectFile(LCO);
   LUTHIER_RETURN_ON_ERROR(ObjFileOrErr.takeError());
 
-  auto LLVMIsa = object::getObjectFileTargetTuple(*ObjFileOrErr);
-  LUTHIER_RETURN_ON_ERROR(LLVMIsa.takeError());
-
-  auto ISA = hsa::isaFromLLVM(CoreApiSnapshot.getTable(), std::get<0>(*LLVMIsa),
-                              std::get<1>(*LLVMIsa), std::get<2>(*LLVMIsa));
+  auto ISA = TargetManager::instance().getISA(*ObjFileOrErr);
   LUTHIER_RETURN_ON_ERROR(ISA.takeError());
 
   auto TargetInfo = TargetManager::instance().getTargetInfo(*ISA);
@@ -1066,60 +1077,73 @@ llvm::Error CodeLifter::liftFunction(const hsa::LoadedCodeObjectSymbol &Symbol,
 
 llvm::Expected<const LiftedRepresentation &>
 luthier::CodeLifter::lift(const hsa::LoadedCodeObjectKernel &KernelSymbol) {
-  std::lock_guard Lock(CacheMutex);
-  if (!LiftedKernelSymbols.contains(KernelSymbol)) {
-    // Lift the kernel if not already lifted
-    llvm::TimeTraceScope Scope("Lifting Kernel");
-    // Start a lifted representation
-    std::unique_ptr<LiftedRepresentation> LR(new LiftedRepresentation());
-    // Initialize the LR
-    LUTHIER_RETURN_ON_ERROR(initLR(*LR, KernelSymbol));
-
-    hsa_loaded_code_object_t LCO = LR->LCO;
-
-    auto &COC = hsa::LoadedCodeObjectCache::instance();
-
-    // Create Global Variables associated with the LCO
-    llvm::SmallVector<std::unique_ptr<hsa::LoadedCodeObjectSymbol>, 4>
-        GlobalVariables;
-    LUTHIER_RETURN_ON_ERROR(COC.getVariableSymbols(LCO, GlobalVariables));
-    LUTHIER_RETURN_ON_ERROR(COC.getExternalSymbols(LCO, GlobalVariables));
-    for (auto &GV : GlobalVariables) {
-      LUTHIER_RETURN_ON_ERROR(initLiftedGlobalVariableEntry(LCO, *GV, *LR));
-    }
-    // Create Kernel entries for the LCO
-    llvm::SmallVector<std::unique_ptr<hsa::LoadedCodeObjectSymbol>> Kernels;
-    LUTHIER_RETURN_ON_ERROR(COC.getKernelSymbols(LCO, Kernels));
-    for (const auto &Kernel : Kernels) {
-      if (*Kernel == KernelSymbol)
-        LUTHIER_RETURN_ON_ERROR(initLiftedKernelEntry(KernelSymbol, *LR));
-      else
-        LUTHIER_RETURN_ON_ERROR(
-            initLiftedGlobalVariableEntry(LCO, *Kernel, *LR));
-    }
-    // Create device function entries for this LCO
-    llvm::SmallVector<std::unique_ptr<hsa::LoadedCodeObjectSymbol>, 4>
-        DeviceFuncs;
-    LUTHIER_RETURN_ON_ERROR(COC.getDeviceFunctionSymbols(LCO, DeviceFuncs));
-    for (const auto &Func : DeviceFuncs) {
-      LUTHIER_RETURN_ON_ERROR(initLiftedDeviceFunctionEntry(
-          *llvm::dyn_cast<hsa::LoadedCodeObjectDeviceFunction>(Func.get()),
-          *LR));
-    }
-    // Now that all global objects are initialized, we can now populate
-    // the target kernel's instructions
+  return lookupOrCompute(
+      LiftedKernelsMutex,
+      [&]() -> const LiftedRepresentation * {
+        auto It = LiftedKernelSymbols.find(&KernelSymbol);
+        return It != LiftedKernelSymbols.end() ? It->second.get() : nullptr;
+      },
+      // Lift the kernel without holding the lock, so that other kernels can
+      // be lifted concurrently
+      [&]() -> llvm::Expected<std::unique_ptr<LiftedRepresentation>> {
+        // Lift the kernel if not already lifted
+        llvm::TimeTraceScope Scope("Lifting Kernel");
+        // Start a lifted representation
+        std::unique_ptr<LiftedRepresentation> LR(new LiftedRepresentation());
+        // Initialize the LR
+        LUTHIER_RETURN_ON_ERROR(initLR(*LR, KernelSymbol));
+
+        hsa_loaded_code_object_t LCO = LR->LCO;
+
+        auto &COC = hsa::LoadedCodeObjectCache::instance();
+
+        // Create Global Variables associated with the LCO
+        llvm::SmallVector<std::unique_ptr<hsa::LoadedCodeObjectSymbol>, 4>
+            GlobalVariables;
+        LUTHIER_RETURN_ON_ERROR(COC.getVariableSymbols(LCO, GlobalVariables));
+        LUTHIER_RETURN_ON_ERROR(COC.getExternalSymbols(LCO, GlobalVariables));
+        for (auto &GV : GlobalVariables) {
+          LUTHIER_RETURN_ON_ERROR(initLiftedGlobalVariableEntry(LCO, *GV, *LR));
+        }
+        // Create Kernel entries for the LCO
+        llvm::SmallVector<std::unique_ptr<hsa::LoadedCodeObjectSymbol>> Kernels;
+        LUTHIER_RETURN_ON_ERROR(COC.getKernelSymbols(LCO, Kernels));
+        for (const auto &Kernel : Kernels) {
+          if (*Kernel == KernelSymbol)
+            LUTHIER_RETURN_ON_ERROR(initLiftedKernelEntry(KernelSymbol, *LR));
+          else
+            LUTHIER_RETURN_ON_ERROR(
+                initLiftedGlobalVariableEntry(LCO, *Kernel, *LR));
+        }
+        // Create device function entries for this LCO
+        llvm::SmallVector<std::unique_ptr<hsa::LoadedCodeObjectSymbol>, 4>
+            DeviceFuncs;
+        LUTHIER_RETURN_ON_ERROR(COC.getDeviceFunctionSymbols(LCO, DeviceFuncs));
+        for (const auto &Func : DeviceFuncs) {
+          LUTHIER_RETURN_ON_ERROR(initLiftedDeviceFunctionEntry(
+              *llvm::dyn_cast<hsa::LoadedCodeObjectDeviceFunction>(Func.get()),
+              *LR));
+        }
+        // Now that all global objects are initialized, we can now populate
+        // the target kernel's instructions
 
-    LUTHIER_RETURN_ON_ERROR(liftFunction(KernelSymbol, LR->getKernelMF(), *LR));
+        LUTHIER_RETURN_ON_ERROR(
+            liftFunction(KernelSymbol, LR->getKernelMF(), *LR));
 
-    for (const auto &[Func, MF] : LR->functions()) {
-      LUTHIER_RETURN_ON_ERROR(liftFunction(*Func, *MF, *LR));
-    }
-    LiftedKernelSymbols.emplace(
-        llvm::unique_dyn_cast<hsa::LoadedCodeObjectKernel>(
-            KernelSymbol.clone()),
-        std::move(LR));
-  }
-  return *LiftedKernelSymbols.find(&KernelSymbol)->second;
+        for (const auto &[Func, MF] : LR->functions()) {
+          LUTHIER_RETURN_ON_ERROR(liftFunction(*Func, *MF, *LR));
+        }
+        return LR;
+      },
+      // If another thread lifted the same kernel first, ours is discarded
+      [&](std::unique_ptr<LiftedRepresentation> LR)
+          -> const LiftedRepresentation & {
+        return *LiftedKernelSymbols
+                    .emplace(llvm::unique_dyn_cast<hsa::LoadedCodeObjectKernel>(
+                                 KernelSymbol.clone()),
+                             std::move(LR))
+                    .first->second;
+      });
 }
 
 llvm::Expected<std::unique_ptr<LiftedRepresentation>>
@@ -1149,14 +1173,10 @@ CodeLifter::cloneRepresentation(const LiftedRepresentation &SrcLR) {
       hsa::LoadedCodeObjectCache::instance().getAssociatedObjectFile(SrcLR.LCO);
   LUTHIER_RETURN_ON_ERROR(ObjFileOrErr.takeError());
 
-  auto LLVMIsa = object::getObjectFileTargetTuple(*ObjFileOrErr);
-  LUTHIER_RETURN_ON_ERROR(LLVMIsa.takeError());
-
-  auto ISA = hsa::isaFromLLVM(CoreApiSnapshot.getTable(), std::get<0>(*LLVMIsa),
-                              std::get<1>(*LLVMIsa), std::get<2>(*LLVMIsa));
+  auto ISA = TargetManager::instance().getISA(*ObjFileOrErr);
   LUTHIER_RETURN_ON_ERROR(ISA.takeError());
   LUTHIER_RETURN_ON_ERROR(
-      TargetManager::instance().createTargetMachine(*ISA).moveInto(DestLR->TM));
+      TargetManager::instance().borrowTargetMachine(*ISA).moveInto(DestLR->TM));
   DestLR->Module->setDataLayout(DestLR->TM->createDataLayout());
   DestLR->MMIWP =
       std::make_unique<llvm::MachineModuleInfoWrapperPass>(DestLR->TM.get());
@@ -21,9 +21,14 @@
 #include "luthier/HSA/Executable.h"
 #include "luthier/HSA/LoadedCodeObjectCache.h"
 #include "luthier/HSA/PacketMointor.h"
+#include "luthier/Intrinsic/DispatchBuffer.h"
 #include "luthier/Intrinsic/ImplicitArgPtr.h"
+#include "luthier/Intrinsic/LDSCounterAdd.h"
+#include "luthier/Intrinsic/ReadClock.h"
 #include "luthier/Intrinsic/ReadReg.h"
 #include "luthier/Intrinsic/SAtomicAdd.h"
+#include "luthier/Intrinsic/TraceReserve.h"
+#include "luthier/Intrinsic/WaveAtomicAdd.h"
 #include "luthier/Intrinsic/WriteExec.h"
 #include "luthier/Intrinsic/WriteReg.h"
 #include "luthier/LLVM/EagerManagedStatic.h"
@@ -69,7 +74,7 @@ static EagerManagedStatic<llvm::cl::opt<std::string>>
 
 template <> Context *Singleton<Context>::Instance{nullptr};
 
-Context::Context(hsa::PacketMonitor::CallbackType PacketCallback,
+Context::Context(hsa::PacketMonitor::AnyCallbackType PacketCallback,
                  llvm::Error &Err) {
   llvm::ErrorAsOutParameter EAO(Err);
   // Initialize all Luthier singletons
@@ -113,8 +118,21 @@ Context::Context(hsa::PacketMonitor::CallbackType PacketCallback,
   CG->registerIntrinsic(
       "luthier::implicitArgPtr",
       {implicitArgPtrIRProcessor, implicitArgPtrMIRProcessor});
+  CG->registerIntrinsic(
+      "luthier::dispatchBuffer",
+      {dispatchBufferIRProcessor, dispatchBufferMIRProcessor});
+  CG->registerIntrinsic("luthier::readClock",
+                        {readClockIRProcessor, readClockMIRProcessor});
+  CG->registerIntrinsic("luthier::readRealTime",
+                        {readRealTimeIRProcessor, readRealTimeMIRProcessor});
   CG->registerIntrinsic("luthier::sAtomicAdd",
                         {sAtomicAddIRProcessor, sAtomicAddMIRProcessor});
+  CG->registerIntrinsic("luthier::traceReserve",
+                        {traceReserveIRProcessor, traceReserveMIRProcessor});
+  CG->registerIntrinsic("luthier::waveAtomicAdd",
+                        {waveAtomicAddIRProcessor, waveAtomicAddMIRProcessor});
+  CG->registerIntrinsic("luthier::ldsCounterAdd",
+                        {ldsCounterAddIRProcessor, ldsCounterAddMIRProcessor});
 
   PacketMonitor = new hsa::PacketMonitor(
       *HsaCoreApiTableSnapshot, *HsaAmdExtTableSnapshot, *VenLoaderSnapshot,
@@ -0,0 +1,137 @@
+//===-- DispatchBufferPool.cpp --------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the dispatch buffer pool.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/DispatchBufferPool.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include <algorithm>
+#include <cstring>
+#include <llvm/Support/FormatVariadic.h>
+
+namespace luthier {
+
+/// Alignment of the kernel argument buffer and the instrumentation buffer
+/// inside each chunk
+static constexpr uint64_t ChunkAlignment = 64;
+
+/// Size of the smallest chunk bin
+static constexpr uint64_t MinChunkSize = 256;
+
+uint64_t DispatchBufferPool::getDataOffset(uint32_t KernArgSegmentSize) {
+  // The user argument area only holds the address of the instrumentation
+  // buffer
+  return llvm::alignTo(getUserKernArgOffset(KernArgSegmentSize) +
+                           sizeof(uint64_t),
+                       ChunkAlignment);
+}
+
+llvm::Expected<std::unique_ptr<DispatchBufferPool>>
+DispatchBufferPool::create(uint64_t BufferSize,
+                           hsa::DispatchCompletionNotifier &Notifier,
+                           AllocateFunc Allocate, DeallocateFunc Deallocate) {
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      BufferSize != 0, "The size of dispatch buffers must not be zero."));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Allocate && Deallocate,
+      "Dispatch buffer pools require both an allocator and a deallocator."));
+  return std::unique_ptr<DispatchBufferPool>(new DispatchBufferPool(
+      BufferSize, Notifier, std::move(Allocate), std::move(Deallocate)));
+}
+
+DispatchBufferPool::~DispatchBufferPool() {
+  // Chunks still attached to dispatches are returned to the pool by their
+  // completion handlers
+  Notifier.waitForPendingCompletions();
+  for (auto &[ChunkSize, Chunks] : FreeChunks) {
+    for (void *Chunk : Chunks)
+      Deallocate(Chunk);
+  }
+}
+
+size_t DispatchBufferPool::getNumChunks() {
+  std::lock_guard Lock(Mutex);
+  return NumChunks;
+}
+
+llvm::Expected<DispatchBuffer>
+DispatchBufferPool::acquire(const void *KernArgs, uint32_t KernArgSegmentSize) {
+  uint64_t DataOffset = getDataOffset(KernArgSegmentSize);
+  uint64_t ChunkSize =
+      std::max(llvm::PowerOf2Ceil(DataOffset + BufferSize), MinChunkSize);
+
+  void *Chunk = nullptr;
+  {
+    std::lock_guard Lock(Mutex);
+    auto It = FreeChunks.find(ChunkSize);
+    if (It != FreeChunks.end() && !It->second.empty())
+      Chunk = It->second.pop_back_val();
+  }
+  if (!Chunk) {
+    Chunk = Allocate(ChunkSize);
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        Chunk != nullptr,
+        llvm::formatv("Failed to allocate a dispatch buffer chunk of {0} "
+                      "bytes.",
+                      ChunkSize)));
+    std::lock_guard Lock(Mutex);
+    ++NumChunks;
+  }
+
+  auto *ChunkBytes = static_cast<uint8_t *>(Chunk);
+  DispatchBuffer Buffer{Chunk, ChunkBytes + DataOffset, ChunkSize};
+  if (KernArgSegmentSize != 0)
+    std::memcpy(ChunkBytes, KernArgs, KernArgSegmentSize);
+  auto DataAddress = reinterpret_cast<uint64_t>(Buffer.Data);
+  std::memcpy(ChunkBytes + getUserKernArgOffset(KernArgSegmentSize),
+              &DataAddress, sizeof(DataAddress));
+  std::memset(Buffer.Data, 0, BufferSize);
+  return Buffer;
+}
+
+void DispatchBufferPool::release(const DispatchBuffer &Buffer) {
+  std::lock_guard Lock(Mutex);
+  FreeChunks[Buffer.ChunkSize].push_back(Buffer.KernArgs);
+}
+
+llvm::Error DispatchBufferPool::attach(hsa_kernel_dispatch_packet_t &Packet,
+                                       uint32_t KernArgSegmentSize,
+                                       CompletionHandler OnCompletion) {
+  llvm::Expected<DispatchBuffer> BufferOrErr =
+      acquire(Packet.kernarg_address, KernArgSegmentSize);
+  LUTHIER_RETURN_ON_ERROR(BufferOrErr.takeError());
+  DispatchBuffer Buffer = *BufferOrErr;
+
+  auto Handler = [this, Buffer,
+                  OnCompletion = std::move(OnCompletion)]() mutable {
+    if (OnCompletion)
+      OnCompletion(llvm::ArrayRef<uint8_t>(Buffer.Data, BufferSize));
+    release(Buffer);
+  };
+
+  void *OriginalKernArgs = Packet.kernarg_address;
+  Packet.kernarg_address = Buffer.KernArgs;
+  if (llvm::Error Err = Notifier.attach(Packet, std::move(Handler))) {
+    Packet.kernarg_address = OriginalKernArgs;
+    release(Buffer);
+    return Err;
+  }
+  return llvm::Error::success();
+}
+
+} // namespace luthier
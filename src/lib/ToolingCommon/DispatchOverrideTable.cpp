@@ -0,0 +1,109 @@
+//===-- DispatchOverrideTable.cpp -----------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the writer side of the dispatch override table.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/DispatchOverrideTable.h"
+#include <algorithm>
+#include <llvm/Support/MathExtras.h>
+
+namespace luthier {
+
+DispatchOverrideTable::DispatchOverrideTable(uint64_t InitialNumSlots) {
+  Tables.push_back(std::make_unique<Table>(
+      llvm::PowerOf2Ceil(std::max<uint64_t>(InitialNumSlots, 2))));
+  CurrentTable.store(Tables.back().get(), std::memory_order_release);
+}
+
+DispatchOverrideTable::Table &
+DispatchOverrideTable::rehash(uint64_t MinNumSlots) {
+  const Table &Old = *Tables.back();
+  auto New = std::make_unique<Table>(llvm::PowerOf2Ceil(MinNumSlots));
+  // Tombstones are dropped while copying; The new table is not visible to
+  // readers yet, so its slots can be filled in any order
+  for (uint64_t I = 0; I <= Old.Mask; ++I) {
+    const Slot &OldSlot = Old.Slots[I];
+    if (OldSlot.State.load(std::memory_order_relaxed) != SLOT_READY)
+      continue;
+    uint64_t J =
+        hash(OldSlot.OriginalKernelObject, OldSlot.Preset) & New->Mask;
+    while (New->Slots[J].State.load(std::memory_order_relaxed) != SLOT_EMPTY)
+      J = (J + 1) & New->Mask;
+    Slot &NewSlot = New->Slots[J];
+    NewSlot.OriginalKernelObject = OldSlot.OriginalKernelObject;
+    NewSlot.Preset = OldSlot.Preset;
+    NewSlot.Override = OldSlot.Override;
+    NewSlot.State.store(SLOT_READY, std::memory_order_relaxed);
+    ++New->NumUsedSlots;
+    ++New->NumReadySlots;
+  }
+  // Readers still probing the old table keep seeing a consistent snapshot;
+  // It is only freed when the table itself is destroyed
+  CurrentTable.store(New.get(), std::memory_order_release);
+  Tables.push_back(std::move(New));
+  return *Tables.back();
+}
+
+bool DispatchOverrideTable::insert(uint64_t OriginalKernelObject,
+                                   InstrumentationPresetID Preset,
+                                   const DispatchOverride &Override) {
+  std::lock_guard Lock(WriterMutex);
+  if (lookup(OriginalKernelObject, Preset).has_value())
+    return false;
+  Table *T = Tables.back().get();
+  // Keep the load factor (including tombstones) under 1/2 so that probes
+  // always terminate at an empty slot
+  if ((T->NumUsedSlots + 1) * 2 > T->Mask + 1)
+    T = &rehash(std::max<uint64_t>((T->NumReadySlots + 1) * 4, T->Mask + 1));
+  uint64_t I = hash(OriginalKernelObject, Preset) & T->Mask;
+  while (T->Slots[I].State.load(std::memory_order_relaxed) != SLOT_EMPTY)
+    I = (I + 1) & T->Mask;
+  Slot &S = T->Slots[I];
+  S.OriginalKernelObject = OriginalKernelObject;
+  S.Preset = Preset;
+  S.Override = Override;
+  // Publish the slot contents to readers
+  S.State.store(SLOT_READY, std::memory_order_release);
+  ++T->NumUsedSlots;
+  ++T->NumReadySlots;
+  return true;
+}
+
+size_t DispatchOverrideTable::erase(uint64_t OriginalKernelObject) {
+  std::lock_guard Lock(WriterMutex);
+  Table &T = *Tables.back();
+  size_t NumErased = 0;
+  // Erasures only happen when an executable is destroyed; A linear scan
+  // covers the entries of all presets at once
+  for (uint64_t I = 0; I <= T.Mask; ++I) {
+    Slot &S = T.Slots[I];
+    if (S.State.load(std::memory_order_relaxed) == SLOT_READY &&
+        S.OriginalKernelObject == OriginalKernelObject) {
+      S.State.store(SLOT_TOMBSTONE, std::memory_order_release);
+      ++NumErased;
+    }
+  }
+  T.NumReadySlots -= NumErased;
+  return NumErased;
+}
+
+size_t DispatchOverrideTable::size() {
+  std::lock_guard Lock(WriterMutex);
+  return Tables.back()->NumReadySlots;
+}
+
+} // namespace luthier
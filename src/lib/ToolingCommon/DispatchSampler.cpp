@@ -0,0 +1,147 @@
+//===-- DispatchSampler.cpp -----------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the dispatch sampler.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/DispatchSampler.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include <llvm/Support/FormatVariadic.h>
+
+namespace luthier {
+
+llvm::Expected<std::unique_ptr<DispatchSampler>>
+DispatchSampler::create(DispatchSamplingPolicy Policy, ClockFunc Clock) {
+  switch (Policy.getKind()) {
+  case DispatchSamplingPolicy::ALL:
+    break;
+  case DispatchSamplingPolicy::EVERY_NTH:
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        Policy.getCount() != 0,
+        "Cannot sample every 0th dispatch of a kernel."));
+    break;
+  case DispatchSamplingPolicy::FIRST_K:
+    break;
+  case DispatchSamplingPolicy::TIME_BUDGET:
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        Policy.getWindow().count() > 0,
+        llvm::formatv("Time budget window must be positive, got {0} ns "
+                      "instead.",
+                      Policy.getWindow().count())));
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        static_cast<bool>(Clock),
+        "The time budget policy requires a clock function."));
+    break;
+  case DispatchSamplingPolicy::PREDICATE:
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        static_cast<bool>(Policy.getPredicate()),
+        "The predicate sampling policy requires a predicate function."));
+    break;
+  default:
+    return LUTHIER_MAKE_GENERIC_ERROR(
+        llvm::formatv("Invalid dispatch sampling policy {0}.",
+                      static_cast<int>(Policy.getKind())));
+  }
+  return std::unique_ptr<DispatchSampler>(
+      new DispatchSampler(std::move(Policy), std::move(Clock)));
+}
+
+DispatchSampler::KernelSamplingState &
+DispatchSampler::getOrCreateKernelState(uint64_t KernelObject) {
+  // Kernels are dispatched far more often than they are discovered; Only
+  // take the exclusive lock the first time a kernel is seen
+  {
+    std::shared_lock Lock(KernelStatesMutex);
+    auto It = KernelStates.find(KernelObject);
+    if (It != KernelStates.end())
+      return *It->second;
+  }
+  std::unique_lock Lock(KernelStatesMutex);
+  auto &State = KernelStates[KernelObject];
+  if (!State)
+    State = std::make_unique<KernelSamplingState>();
+  return *State;
+}
+
+bool DispatchSampler::consumeTimeBudget(KernelSamplingState &State) {
+  auto Now = Clock();
+  // The window is checked, reset and consumed under a single lock; Keying the
+  // reset on state updated outside of it would let a racing dispatch reset a
+  // window another dispatch has just consumed
+  std::lock_guard Lock(State.WindowMutex);
+  // Start a new window if this is the first dispatch of the kernel, or if the
+  // current window has elapsed
+  if (!State.WindowStart || Now - *State.WindowStart >= Policy.getWindow()) {
+    State.WindowStart = Now;
+    State.NumSampledInWindow = 0;
+  }
+  if (State.NumSampledInWindow >= Policy.getCount())
+    return false;
+  ++State.NumSampledInWindow;
+  return true;
+}
+
+bool DispatchSampler::sample(const hsa_kernel_dispatch_packet_t &Packet) {
+  auto &State = getOrCreateKernelState(Packet.kernel_object);
+  // Index of this dispatch among all dispatches of the kernel
+  uint64_t DispatchIdx =
+      State.NumDispatches.fetch_add(1, std::memory_order_relaxed);
+  bool IsSampled{false};
+  switch (Policy.getKind()) {
+  case DispatchSamplingPolicy::ALL:
+    IsSampled = true;
+    break;
+  case DispatchSamplingPolicy::EVERY_NTH:
+    IsSampled = DispatchIdx % Policy.getCount() == 0;
+    break;
+  case DispatchSamplingPolicy::FIRST_K:
+    IsSampled = DispatchIdx < Policy.getCount();
+    break;
+  case DispatchSamplingPolicy::TIME_BUDGET:
+    IsSampled = consumeTimeBudget(State);
+    break;
+  case DispatchSamplingPolicy::PREDICATE:
+    IsSampled = Policy.getPredicate()(Packet);
+    break;
+  }
+  if (IsSampled)
+    State.NumSampled.fetch_add(1, std::memory_order_relaxed);
+  return IsSampled;
+}
+
+DispatchSampleCounts DispatchSampler::getCounts(uint64_t KernelObject) const {
+  std::shared_lock Lock(KernelStatesMutex);
+  auto It = KernelStates.find(KernelObject);
+  if (It == KernelStates.end())
+    return {};
+  return {It->second->NumDispatches.load(std::memory_order_relaxed),
+          It->second->NumSampled.load(std::memory_order_relaxed)};
+}
+
+void DispatchSampler::forEachKernel(
+    llvm::function_ref<void(uint64_t KernelObject,
+                            const DispatchSampleCounts &Counts)>
+        Callback) const {
+  std::shared_lock Lock(KernelStatesMutex);
+  for (const auto &[KernelObject, State] : KernelStates) {
+    Callback(KernelObject,
+             {State->NumDispatches.load(std::memory_order_relaxed),
+              State->NumSampled.load(std::memory_order_relaxed)});
+  }
+}
+
+} // namespace luthier
@@ -0,0 +1,195 @@
+//===-- EdgeProfile.cpp ---------------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements edge profiling counter placement and the
+/// reconstruction of edge and block execution counts.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/EdgeProfile.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include <algorithm>
+#include <limits>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <numeric>
+
+namespace luthier {
+
+/// Finds the representative of \p Block in the disjoint set forest
+/// \p Parents, compressing the path along the way
+static unsigned findRoot(llvm::SmallVectorImpl<unsigned> &Parents,
+                         unsigned Block) {
+  while (Parents[Block] != Block) {
+    Parents[Block] = Parents[Parents[Block]];
+    Block = Parents[Block];
+  }
+  return Block;
+}
+
+llvm::Expected<EdgeCounterPlacement>
+placeEdgeCounters(unsigned NumBlocks, unsigned EntryBlock,
+                  llvm::ArrayRef<ProfileEdge> Edges,
+                  llvm::ArrayRef<unsigned> ExitBlocks) {
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      EntryBlock < NumBlocks,
+      llvm::formatv("Entry block {0} is out of range of the {1} blocks of "
+                    "the control flow graph.",
+                    EntryBlock, NumBlocks)));
+  for (const ProfileEdge &Edge : Edges) {
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        Edge.Src < NumBlocks && Edge.Dst < NumBlocks,
+        llvm::formatv("Edge {0} -> {1} is out of range of the {2} blocks of "
+                      "the control flow graph.",
+                      Edge.Src, Edge.Dst, NumBlocks)));
+  }
+  EdgeCounterPlacement Out;
+  Out.NumBlocks = NumBlocks;
+  Out.Edges.append(Edges.begin(), Edges.end());
+  for (unsigned Exit : ExitBlocks) {
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        Exit < NumBlocks,
+        llvm::formatv("Exit block {0} is out of range of the {1} blocks of "
+                      "the control flow graph.",
+                      Exit, NumBlocks)));
+    Out.Edges.push_back({Exit, NumBlocks, 1});
+  }
+  // The virtual edge can't be instrumented, so it's given the highest weight
+  // to be placed in the spanning tree first
+  Out.Edges.push_back(
+      {NumBlocks, EntryBlock, std::numeric_limits<uint64_t>::max()});
+
+  // Build the maximum spanning tree of the undirected graph using Kruskal's
+  // algorithm; Edges that close a cycle get a counter
+  llvm::SmallVector<unsigned> SortedEdges(Out.Edges.size());
+  std::iota(SortedEdges.begin(), SortedEdges.end(), 0);
+  std::stable_sort(SortedEdges.begin(), SortedEdges.end(),
+                   [&](unsigned LHS, unsigned RHS) {
+                     return Out.Edges[LHS].Weight > Out.Edges[RHS].Weight;
+                   });
+  llvm::SmallVector<unsigned> Parents(NumBlocks + 1);
+  std::iota(Parents.begin(), Parents.end(), 0);
+  for (unsigned EdgeIdx : SortedEdges) {
+    const ProfileEdge &Edge = Out.Edges[EdgeIdx];
+    unsigned SrcRoot = findRoot(Parents, Edge.Src);
+    unsigned DstRoot = findRoot(Parents, Edge.Dst);
+    if (SrcRoot == DstRoot)
+      Out.CounterEdges.push_back(EdgeIdx);
+    else
+      Parents[SrcRoot] = DstRoot;
+  }
+  llvm::sort(Out.CounterEdges);
+  return Out;
+}
+
+llvm::Expected<llvm::SmallVector<uint64_t>>
+reconstructEdgeCounts(const EdgeCounterPlacement &Placement,
+                      llvm::ArrayRef<uint64_t> Counters) {
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Counters.size() == Placement.CounterEdges.size(),
+      llvm::formatv("Expected {0} counter values, got {1}.",
+                    Placement.CounterEdges.size(), Counters.size())));
+  unsigned NumNodes = Placement.NumBlocks + 1;
+  llvm::ArrayRef<ProfileEdge> Edges = Placement.Edges;
+
+  llvm::SmallVector<uint64_t> EdgeCounts(Edges.size(), 0);
+  llvm::SmallVector<bool> IsKnown(Edges.size(), false);
+  for (size_t CounterIdx = 0; CounterIdx < Counters.size(); ++CounterIdx) {
+    unsigned EdgeIdx = Placement.CounterEdges[CounterIdx];
+    EdgeCounts[EdgeIdx] = Counters[CounterIdx];
+    IsKnown[EdgeIdx] = true;
+  }
+
+  // The sum of the known incoming and outgoing edge counts of each node, and
+  // the edges with unknown counts incident to each node; Self loops don't
+  // affect flow conservation, and are always instrumented
+  llvm::SmallVector<uint64_t> KnownIn(NumNodes, 0);
+  llvm::SmallVector<uint64_t> KnownOut(NumNodes, 0);
+  llvm::SmallVector<llvm::SmallVector<unsigned, 4>> UnknownEdges(NumNodes);
+  for (unsigned EdgeIdx = 0; EdgeIdx < Edges.size(); ++EdgeIdx) {
+    const ProfileEdge &Edge = Edges[EdgeIdx];
+    if (Edge.Src == Edge.Dst)
+      continue;
+    if (IsKnown[EdgeIdx]) {
+      KnownOut[Edge.Src] += EdgeCounts[EdgeIdx];
+      KnownIn[Edge.Dst] += EdgeCounts[EdgeIdx];
+    } else {
+      UnknownEdges[Edge.Src].push_back(EdgeIdx);
+      UnknownEdges[Edge.Dst].push_back(EdgeIdx);
+    }
+  }
+  // Solve the tree edges from the leaves of the spanning tree inwards; A
+  // node with a single unknown edge gets its count from flow conservation
+  llvm::SmallVector<unsigned> Worklist;
+  llvm::SmallVector<unsigned> NumUnknownEdges(NumNodes);
+  for (unsigned Node = 0; Node < NumNodes; ++Node) {
+    NumUnknownEdges[Node] = UnknownEdges[Node].size();
+    if (NumUnknownEdges[Node] == 1)
+      Worklist.push_back(Node);
+  }
+  while (!Worklist.empty()) {
+    unsigned Node = Worklist.pop_back_val();
+    if (NumUnknownEdges[Node] != 1)
+      continue;
+    unsigned EdgeIdx = *llvm::find_if(UnknownEdges[Node], [&](unsigned I) {
+      return !IsKnown[I];
+    });
+    const ProfileEdge &Edge = Edges[EdgeIdx];
+    bool IsIncoming = Edge.Dst == Node;
+    uint64_t Known = IsIncoming ? KnownIn[Node] : KnownOut[Node];
+    uint64_t Other = IsIncoming ? KnownOut[Node] : KnownIn[Node];
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        Other >= Known,
+        llvm::formatv("Counter values violate flow conservation at block {0}.",
+                      Node)));
+    EdgeCounts[EdgeIdx] = Other - Known;
+    IsKnown[EdgeIdx] = true;
+    KnownOut[Edge.Src] += EdgeCounts[EdgeIdx];
+    KnownIn[Edge.Dst] += EdgeCounts[EdgeIdx];
+    for (unsigned Endpoint : {Edge.Src, Edge.Dst}) {
+      if (--NumUnknownEdges[Endpoint] == 1)
+        Worklist.push_back(Endpoint);
+    }
+  }
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      llvm::all_of(IsKnown, [](bool Known) { return Known; }),
+      "Failed to solve the execution count of all edges; The counters don't "
+      "form a valid placement."));
+  // Nodes whose edges are all known must conserve flow as well
+  for (unsigned Node = 0; Node < NumNodes; ++Node) {
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        KnownIn[Node] == KnownOut[Node],
+        llvm::formatv("Counter values violate flow conservation at block {0}.",
+                      Node)));
+  }
+  return EdgeCounts;
+}
+
+llvm::Expected<llvm::SmallVector<uint64_t>>
+reconstructBlockCounts(const EdgeCounterPlacement &Placement,
+                       llvm::ArrayRef<uint64_t> Counters) {
+  auto EdgeCounts = reconstructEdgeCounts(Placement, Counters);
+  LUTHIER_RETURN_ON_ERROR(EdgeCounts.takeError());
+  llvm::SmallVector<uint64_t> BlockCounts(Placement.NumBlocks, 0);
+  for (size_t EdgeIdx = 0; EdgeIdx < Placement.Edges.size(); ++EdgeIdx) {
+    const ProfileEdge &Edge = Placement.Edges[EdgeIdx];
+    if (!Placement.isExitEdge(Edge))
+      BlockCounts[Edge.Dst] += (*EdgeCounts)[EdgeIdx];
+  }
+  return BlockCounts;
+}
+
+} // namespace luthier
@@ -0,0 +1,162 @@
+//===-- HookPredication.cpp -----------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the guarding of injected payloads with a check of
+/// the hook enable mask.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/HookPredication.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/Tooling/MIRConvenience.h"
+#include <GCNSubtarget.h>
+#include <SIDefines.h>
+#include <Utils/AMDGPUBaseInfo.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/FormatVariadic.h>
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "luthier-hook-predication"
+
+namespace luthier {
+
+/// Emits \c S_CMP_LG_U32 at the beginning of \p MBB, restoring SCC saved by
+/// the guard in \p SCCSaveReg
+static void restoreSCCSavedByGuard(llvm::MachineBasicBlock &MBB,
+                                   llvm::MCRegister SCCSaveReg) {
+  const auto &TII = *MBB.getParent()->getSubtarget().getInstrInfo();
+  MBB.addLiveIn(SCCSaveReg);
+  llvm::BuildMI(MBB, MBB.begin(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_CMP_LG_U32))
+      .addReg(SCCSaveReg, llvm::RegState::Kill)
+      .addImm(0);
+}
+
+llvm::Error emitHookEnableGuard(llvm::MachineFunction &PayloadMF,
+                                const llvm::GlobalValue &EnableMask,
+                                uint32_t PayloadMask,
+                                llvm::LivePhysRegs &UsedRegs, bool IsSCCLive) {
+  const auto &ST = PayloadMF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  const auto &TRI = *ST.getRegisterInfo();
+
+  auto ReturnMBB = llvm::find_if(PayloadMF, [](const auto &MBB) {
+    return MBB.isReturnBlock();
+  });
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      ReturnMBB != PayloadMF.end(),
+      llvm::formatv("Injected payload {0} has no return block to skip to.",
+                    PayloadMF.getName())));
+  const llvm::MachineInstr &Return = *ReturnMBB->getFirstTerminator();
+
+  auto AddrReg =
+      pickFreePhysReg(PayloadMF, llvm::AMDGPU::SGPR_64RegClass, UsedRegs);
+  LUTHIER_RETURN_ON_ERROR(AddrReg.takeError());
+  llvm::MCRegister MaskReg = TRI.getSubReg(*AddrReg, llvm::AMDGPU::sub0);
+  llvm::MCRegister SCCSaveReg;
+  if (IsSCCLive) {
+    auto Reg =
+        pickFreePhysReg(PayloadMF, llvm::AMDGPU::SGPR_32RegClass, UsedRegs);
+    LUTHIER_RETURN_ON_ERROR(Reg.takeError());
+    SCCSaveReg = *Reg;
+  }
+
+  llvm::MachineBasicBlock &PayloadEntryMBB = PayloadMF.front();
+  auto *GuardMBB = PayloadMF.CreateMachineBasicBlock();
+  PayloadMF.insert(PayloadMF.begin(), GuardMBB);
+  auto *SkipMBB = PayloadMF.CreateMachineBasicBlock();
+  PayloadMF.push_back(SkipMBB);
+  for (const auto &LiveIn : PayloadEntryMBB.liveins()) {
+    GuardMBB->addLiveIn(LiveIn);
+    SkipMBB->addLiveIn(LiveIn);
+  }
+  GuardMBB->addSuccessor(&PayloadEntryMBB);
+  GuardMBB->addSuccessor(SkipMBB);
+
+  if (SCCSaveReg.isValid()) {
+    llvm::BuildMI(GuardMBB, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_CSELECT_B32), SCCSaveReg)
+        .addImm(1)
+        .addImm(0);
+  }
+  // Compute the address of the mask the same way the compiler does for
+  // global variables, so that it is resolved by the loader in the same way
+  bool IsAccessedViaGOT =
+      ST.getTargetLowering()->shouldEmitGOTReloc(&EnableMask);
+  llvm::BuildMI(GuardMBB, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::SI_PC_ADD_REL_OFFSET), *AddrReg)
+      .addGlobalAddress(&EnableMask, 4,
+                        IsAccessedViaGOT
+                            ? llvm::SIInstrInfo::MO_GOTPCREL32_LO
+                            : llvm::SIInstrInfo::MO_REL32_LO)
+      .addGlobalAddress(&EnableMask, 12,
+                        IsAccessedViaGOT
+                            ? llvm::SIInstrInfo::MO_GOTPCREL32_HI
+                            : llvm::SIInstrInfo::MO_REL32_HI);
+  // Only wait on scalar memory, so that the outstanding vector memory
+  // accesses of the app are not waited on
+  llvm::AMDGPU::IsaVersion IV = llvm::AMDGPU::getIsaVersion(ST.getCPU());
+  unsigned LgkmCntZero = llvm::AMDGPU::encodeWaitcnt(
+      IV, llvm::AMDGPU::getVmcntBitMask(IV),
+      llvm::AMDGPU::getExpcntBitMask(IV), 0);
+  if (IsAccessedViaGOT) {
+    llvm::BuildMI(GuardMBB, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_LOAD_DWORDX2_IMM), *AddrReg)
+        .addReg(*AddrReg, llvm::RegState::Kill)
+        .addImm(0)
+        .addImm(0);
+    llvm::BuildMI(GuardMBB, llvm::DebugLoc(), TII.get(llvm::AMDGPU::S_WAITCNT))
+        .addImm(LgkmCntZero);
+  }
+  // The mask is loaded with GLC to bypass the scalar cache, so that updates
+  // from the host are seen by the next wavefront reaching the payload
+  llvm::BuildMI(GuardMBB, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_LOAD_DWORD_IMM), MaskReg)
+      .addReg(*AddrReg, llvm::RegState::Kill)
+      .addImm(0)
+      .addImm(llvm::AMDGPU::CPol::GLC);
+  llvm::BuildMI(GuardMBB, llvm::DebugLoc(), TII.get(llvm::AMDGPU::S_WAITCNT))
+      .addImm(LgkmCntZero);
+  // SCC is set if any of the bits enabling the payload are set
+  llvm::BuildMI(GuardMBB, llvm::DebugLoc(), TII.get(llvm::AMDGPU::S_AND_B32),
+                MaskReg)
+      .addReg(MaskReg, llvm::RegState::Kill)
+      .addImm(static_cast<int32_t>(PayloadMask));
+  llvm::BuildMI(GuardMBB, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_CBRANCH_SCC0))
+      .addMBB(SkipMBB);
+
+  // The skip path returns right away
+  auto Builder =
+      llvm::BuildMI(SkipMBB, llvm::DebugLoc(), TII.get(Return.getOpcode()));
+  for (const auto &MO : Return.explicit_operands())
+    Builder.add(MO);
+
+  if (SCCSaveReg.isValid()) {
+    restoreSCCSavedByGuard(PayloadEntryMBB, SCCSaveReg);
+    restoreSCCSavedByGuard(*SkipMBB, SCCSaveReg);
+  }
+  PayloadMF.RenumberBlocks();
+
+  LLVM_DEBUG(llvm::dbgs() << "Guarded injected payload " << PayloadMF.getName()
+                          << " with hook enable mask bits "
+                          << llvm::format_hex(PayloadMask, 10) << ".\n";);
+  return llvm::Error::success();
+}
+
+} // namespace luthier
@@ -0,0 +1,136 @@
+//===-- HookSpecialization.cpp --------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the specialization of hook calls to their call site.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/HookSpecialization.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/consts.h"
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <llvm/Transforms/Utils/PromoteMemToReg.h>
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "luthier-hook-specialization"
+
+namespace luthier {
+
+/// Maximum number of times hook calls are inlined into a single injected
+/// payload; Hooks can call other hooks, but not recursively
+static constexpr unsigned MaxHookInliningRounds = 16;
+
+/// Erases the calls to the <tt>luthier::readReg</tt> intrinsic inside \p F
+/// whose results are not used
+/// \return \c true if any calls were erased
+static bool eraseUnusedRegisterReads(llvm::Function &F) {
+  bool Changed{false};
+  for (llvm::Instruction &I :
+       llvm::make_early_inc_range(llvm::instructions(F))) {
+    auto *Call = llvm::dyn_cast<llvm::CallInst>(&I);
+    if (Call == nullptr || !Call->use_empty())
+      continue;
+    const llvm::Function *Callee = Call->getCalledFunction();
+    if (Callee != nullptr &&
+        Callee->getFnAttribute(IntrinsicAttribute).getValueAsString() ==
+            "luthier::readReg") {
+      Call->eraseFromParent();
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+llvm::Expected<bool> specializeHookCalls(llvm::Function &InjectedPayload) {
+  // Inline the hook calls until none are left, as the body of an inlined
+  // hook can call other hooks
+  for (unsigned Round = 0;; ++Round) {
+    llvm::SmallVector<llvm::CallBase *, 4> HookCalls;
+    for (llvm::Instruction &I : llvm::instructions(InjectedPayload)) {
+      auto *Call = llvm::dyn_cast<llvm::CallBase>(&I);
+      if (Call == nullptr)
+        continue;
+      const llvm::Function *Callee = Call->getCalledFunction();
+      if (Callee != nullptr && !Callee->isDeclaration() &&
+          Callee->hasFnAttribute(HookAttribute))
+        HookCalls.push_back(Call);
+    }
+    if (HookCalls.empty())
+      break;
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        Round < MaxHookInliningRounds,
+        llvm::formatv("Hooks called by injected payload {0} are recursive.",
+                      InjectedPayload.getName())));
+    for (llvm::CallBase *Call : HookCalls) {
+      llvm::StringRef HookName = Call->getCalledFunction()->getName();
+      llvm::InlineFunctionInfo IFI;
+      llvm::InlineResult Res = llvm::InlineFunction(*Call, IFI);
+      LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+          Res.isSuccess(),
+          llvm::formatv("Failed to inline hook {0} into injected payload {1}: "
+                        "{2}.",
+                        HookName, InjectedPayload.getName(),
+                        Res.getFailureReason())));
+    }
+  }
+
+  // Promote the allocas of the inlined hooks, so that the constant arguments
+  // stored into them can be folded
+  llvm::SmallVector<llvm::AllocaInst *, 8> Allocas;
+  for (llvm::Instruction &I : InjectedPayload.getEntryBlock()) {
+    if (auto *Alloca = llvm::dyn_cast<llvm::AllocaInst>(&I);
+        Alloca != nullptr && llvm::isAllocaPromotable(Alloca))
+      Allocas.push_back(Alloca);
+  }
+  if (!Allocas.empty()) {
+    llvm::DominatorTree DT(InjectedPayload);
+    llvm::PromoteMemToReg(Allocas, DT);
+  }
+
+  // Fold the constant arguments into the body of the hooks, and remove the
+  // code guarded by constant false conditions
+  bool Changed{true};
+  while (Changed) {
+    Changed = false;
+    for (llvm::BasicBlock &BB : InjectedPayload) {
+      Changed |= llvm::SimplifyInstructionsInBlock(&BB);
+      Changed |= llvm::ConstantFoldTerminator(&BB, true);
+    }
+    Changed |= llvm::removeUnreachableBlocks(InjectedPayload);
+    for (llvm::BasicBlock &BB :
+         llvm::make_early_inc_range(InjectedPayload))
+      Changed |= llvm::MergeBlockIntoPredecessor(&BB);
+    Changed |= eraseUnusedRegisterReads(InjectedPayload);
+  }
+
+  const llvm::BasicBlock &Entry = InjectedPayload.getEntryBlock();
+  bool IsEmpty = InjectedPayload.size() == 1 &&
+                 Entry.sizeWithoutDebug() == 1 &&
+                 llvm::isa<llvm::ReturnInst>(Entry.getTerminator());
+  LLVM_DEBUG(llvm::dbgs() << "Specialized the hook calls of injected payload "
+                          << InjectedPayload.getName() << "; "
+                          << (IsEmpty ? "Payload is empty" : "Payload remains")
+                          << ".\n";);
+  return IsEmpty;
+}
+
+} // namespace luthier
@@ -22,8 +22,11 @@
 #include "luthier/Common/GenericLuthierError.h"
 #include "luthier/Common/LuthierError.h"
 #include "luthier/Intrinsic/IntrinsicCalls.h"
+#include "luthier/Tooling/HookSpecialization.h"
+#include "luthier/Tooling/InstrumentationModule.h"
 #include "luthier/Tooling/InstrumentationTask.h"
 #include "luthier/consts.h"
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/CodeGen/MachineBasicBlock.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
@@ -121,10 +124,40 @@ static llvm::Expected<llvm::Function &> generateInjectedPayloadForApplicationMI(
   return *InjectedPayload;
 }
 
+/// \return the bits of the hook enable mask which enable the injected payload
+/// calling the hooks of \p HookInvocationSpecs, under the \p Predication
+/// requested by the task
+static llvm::Expected<uint32_t> getInjectedPayloadEnableMask(
+    const InstrumentationModule &IM, HookPredicationKind Predication,
+    llvm::ArrayRef<InstrumentationTask::hook_invocation_descriptor>
+        HookInvocationSpecs) {
+  if (Predication == HookPredicationKind::GLOBAL)
+    return ~0U;
+  uint32_t Mask{0};
+  for (const auto &HookInvSpec : HookInvocationSpecs) {
+    auto Bit = IM.getHookEnableBit(HookInvSpec.HookName);
+    LUTHIER_RETURN_ON_ERROR(Bit.takeError());
+    Mask |= 1U << *Bit;
+  }
+  return Mask;
+}
+
 llvm::PreservedAnalyses
 IModuleIRGeneratorPass::run(llvm::Module &M, llvm::ModuleAnalysisManager &MAM) {
   auto &IPIP = MAM.getResult<InjectedPayloadAndInstPointAnalysis>(M);
   llvm::TimeTraceScope Scope("Instrumentation Module IR Generation");
+  HookPredicationKind Predication = Task.getPipelineOptions().HookPredication;
+  if (Predication != HookPredicationKind::NONE &&
+      M.getNamedGlobal(HookEnableMaskVar) == nullptr) {
+    M.getContext().emitError(
+        llvm::formatv("Hook predication was requested, but the "
+                      "instrumentation module does not define the hook "
+                      "enable mask {0}; Make sure the tool uses "
+                      "MARK_LUTHIER_DEVICE_MODULE.",
+                      HookEnableMaskVar)
+            .str());
+    return llvm::PreservedAnalyses::all();
+  }
   // Generate and populate the injected payload functions in the
   // instrumentation module and keep track of them inside the map
   for (const auto &[ApplicationMI, HookSpecs] : Task.getHookInsertionTasks()) {
@@ -135,6 +168,33 @@ IModuleIRGeneratorPass::run(llvm::Module &M, llvm::ModuleAnalysisManager &MAM) {
       M.getContext().emitError(llvm::toString(std::move(Err)));
       return llvm::PreservedAnalyses::all();
     }
+    // Specialize the hooks to the call site; If nothing is left of them,
+    // nothing is injected before the application MI either
+    if (Task.getPipelineOptions().SpecializeHookCalls) {
+      auto IsEmpty = specializeHookCalls(*HookFunc);
+      if (auto Err = IsEmpty.takeError()) {
+        M.getContext().emitError(llvm::toString(std::move(Err)));
+        return llvm::PreservedAnalyses::all();
+      }
+      if (*IsEmpty) {
+        LLVM_DEBUG(llvm::dbgs() << "Injected payload of MI " << *ApplicationMI
+                                << " is empty after specialization; Removing "
+                                   "it.\n";);
+        HookFunc->eraseFromParent();
+        continue;
+      }
+    }
+    // Record the bits of the hook enable mask guarding the payload; The
+    // guard itself is emitted after the payload is register allocated
+    if (Predication != HookPredicationKind::NONE) {
+      auto Mask = getInjectedPayloadEnableMask(Task.getModule(), Predication,
+                                               HookSpecs);
+      if (auto Err = Mask.takeError()) {
+        M.getContext().emitError(llvm::toString(std::move(Err)));
+        return llvm::PreservedAnalyses::all();
+      }
+      HookFunc->addFnAttr(HookEnableMaskAttribute, llvm::utostr(*Mask));
+    }
     IPIP.addEntry(*ApplicationMI, *HookFunc);
   }
   return llvm::PreservedAnalyses::all();
@@ -0,0 +1,159 @@
+//===-- IModulePipelineOptions.cpp ----------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the <tt>IModulePipelineOptions</tt> and their
+/// command line defaults.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/IModulePipelineOptions.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/LLVM/EagerManagedStatic.h"
+#include <llvm/Passes/OptimizationLevel.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+#include <llvm/Transforms/Utils/Mem2Reg.h>
+
+namespace luthier {
+
+static EagerManagedStatic<llvm::cl::OptionCategory>
+    IModulePipelineOptionCategory(
+        "Luthier Instrumentation Module Pipeline Options");
+
+static EagerManagedStatic<llvm::cl::opt<IModuleIRPipelineKind>>
+    IModuleIRPipeline(
+        "luthier-imodule-ir-pipeline",
+        llvm::cl::desc(
+            "IR optimization pipeline run over the instrumentation module"),
+        llvm::cl::values(
+            clEnumValN(IModuleIRPipelineKind::O0, "O0", "Default O0 pipeline"),
+            clEnumValN(IModuleIRPipelineKind::O1, "O1", "Default O1 pipeline"),
+            clEnumValN(IModuleIRPipelineKind::O2, "O2", "Default O2 pipeline"),
+            clEnumValN(IModuleIRPipelineKind::O3, "O3", "Default O3 pipeline"),
+            clEnumValN(IModuleIRPipelineKind::FAST, "fast",
+                       "Inline, mem2reg, instcombine and simplifycfg only"),
+            clEnumValN(IModuleIRPipelineKind::CUSTOM, "custom",
+                       "Use the pipeline in -luthier-imodule-ir-passes")),
+        llvm::cl::init(IModuleIRPipelineKind::O3),
+        llvm::cl::cat(*IModulePipelineOptionCategory));
+
+static EagerManagedStatic<llvm::cl::opt<std::string>> IModuleIRPasses(
+    "luthier-imodule-ir-passes",
+    llvm::cl::desc("Textual IR pass pipeline run over the instrumentation "
+                   "module; Implies -luthier-imodule-ir-pipeline=custom"),
+    llvm::cl::value_desc("pipeline"),
+    llvm::cl::cat(*IModulePipelineOptionCategory));
+
+static EagerManagedStatic<llvm::cl::opt<unsigned>> IModuleCodeGenOptLevel(
+    "luthier-imodule-codegen-opt-level",
+    llvm::cl::desc("Code gen optimization level (0-3) used when generating "
+                   "machine code for the instrumentation module"),
+    llvm::cl::init(3), llvm::cl::cat(*IModulePipelineOptionCategory));
+
+static EagerManagedStatic<llvm::cl::opt<unsigned>> IModuleCodeGenThreads(
+    "luthier-imodule-codegen-threads",
+    llvm::cl::desc("Number of threads used to generate machine code for the "
+                   "injected payloads; 0 uses all available hardware threads"),
+    llvm::cl::init(1), llvm::cl::cat(*IModulePipelineOptionCategory));
+
+static EagerManagedStatic<llvm::cl::opt<bool>> IModuleSpecializeHookCalls(
+    "luthier-imodule-specialize-hook-calls",
+    llvm::cl::desc("Specialize the hook calls of each injected payload to "
+                   "their call site before the IR pipeline, and remove the "
+                   "injected payloads that end up empty"),
+    llvm::cl::init(true), llvm::cl::cat(*IModulePipelineOptionCategory));
+
+static EagerManagedStatic<llvm::cl::opt<HookPredicationKind>>
+    IModuleHookPredication(
+        "luthier-imodule-hook-predication",
+        llvm::cl::desc("Guard the injected payloads with a check of the hook "
+                       "enable mask set by the host"),
+        llvm::cl::values(
+            clEnumValN(HookPredicationKind::NONE, "none",
+                       "Injected payloads always run"),
+            clEnumValN(HookPredicationKind::GLOBAL, "global",
+                       "Skip all injected payloads when the mask is zero"),
+            clEnumValN(HookPredicationKind::PER_HOOK, "per-hook",
+                       "Skip injected payloads whose hooks are disabled")),
+        llvm::cl::init(HookPredicationKind::NONE),
+        llvm::cl::cat(*IModulePipelineOptionCategory));
+
+IModulePipelineOptions IModulePipelineOptions::getDefault() {
+  IModulePipelineOptions Out;
+  if (!IModuleIRPasses->empty()) {
+    Out.IRPipeline = IModuleIRPipelineKind::CUSTOM;
+    Out.CustomIRPipeline = IModuleIRPasses->getValue();
+  } else
+    Out.IRPipeline = IModuleIRPipeline->getValue();
+  if (auto Level = llvm::CodeGenOpt::getLevel(
+          static_cast<int>(IModuleCodeGenOptLevel->getValue())))
+    Out.MIROptLevel = *Level;
+  Out.CodeGenThreads = IModuleCodeGenThreads->getValue() == 0
+                           ? llvm::hardware_concurrency().compute_thread_count()
+                           : IModuleCodeGenThreads->getValue();
+  Out.SpecializeHookCalls = IModuleSpecializeHookCalls->getValue();
+  Out.HookPredication = IModuleHookPredication->getValue();
+  return Out;
+}
+
+llvm::Error
+IModulePipelineOptions::addIRPipeline(llvm::PassBuilder &PB,
+                                      llvm::ModulePassManager &MPM) const {
+  switch (IRPipeline) {
+  case IModuleIRPipelineKind::O0:
+    MPM.addPass(PB.buildO0DefaultPipeline(llvm::OptimizationLevel::O0));
+    break;
+  case IModuleIRPipelineKind::O1:
+    MPM.addPass(PB.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O1));
+    break;
+  case IModuleIRPipelineKind::O2:
+    MPM.addPass(PB.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2));
+    break;
+  case IModuleIRPipelineKind::O3:
+    MPM.addPass(PB.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O3));
+    break;
+  case IModuleIRPipelineKind::FAST: {
+    // Hooks are always inlined into the injected payloads (unless they are
+    // outlined), so the always inliner is enough to flatten them before
+    // running the cleanup passes
+    MPM.addPass(llvm::AlwaysInlinerPass());
+    llvm::FunctionPassManager FPM;
+    FPM.addPass(llvm::PromotePass());
+    FPM.addPass(llvm::InstCombinePass());
+    FPM.addPass(llvm::SimplifyCFGPass());
+    MPM.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(FPM)));
+    break;
+  }
+  case IModuleIRPipelineKind::CUSTOM:
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        !CustomIRPipeline.empty(),
+        "Custom IR pipeline was requested for the instrumentation module, "
+        "but no pipeline was specified."));
+    if (auto Err = PB.parsePassPipeline(MPM, CustomIRPipeline))
+      return llvm::make_error<GenericLuthierError>(llvm::formatv(
+          "Failed to parse the instrumentation module IR pipeline {0}: {1}",
+          CustomIRPipeline, llvm::toString(std::move(Err))));
+    break;
+  }
+  return llvm::Error::success();
+}
+
+} // namespace luthier
@@ -19,18 +19,25 @@
 /// insertion pass.
 //===----------------------------------------------------------------------===//
 #include "luthier/Tooling/InjectedPayloadPEIPass.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
 #include "luthier/LLVM/streams.h"
+#include "luthier/Tooling/AMDGPURegisterLiveness.h"
+#include "luthier/Tooling/HookPredication.h"
 #include "luthier/Tooling/IntrinsicMIRLoweringPass.h"
 #include "luthier/Tooling/LiftedRepresentation.h"
+#include "luthier/Tooling/OutlinedHookCallingConvPass.h"
 #include "luthier/Tooling/PhysRegsNotInLiveInsAnalysis.h"
 #include "luthier/Tooling/SVStorageAndLoadLocations.h"
 #include "luthier/Tooling/StateValueArraySpecs.h"
 #include "luthier/Tooling/WrapperAnalysisPasses.h"
 #include "luthier/consts.h"
 #include <GCNSubtarget.h>
+#include <algorithm>
 #include <llvm/CodeGen/MachineDominators.h>
 #include <llvm/CodeGen/MachineInstrBuilder.h>
 #include <llvm/CodeGen/Passes.h>
+#include <llvm/Support/FormatVariadic.h>
 
 #undef DEBUG_TYPE
 #define DEBUG_TYPE "luthier-injected-payload-pei-pass"
@@ -43,6 +50,61 @@ static llvm::RegisterPass<InjectedPayloadPEIPass>
     X("injected-payload-pei", "Injected Payload PEI Pass",
       true /* Only looks at CFG */, false /* Analysis Pass */);
 
+/// Guards the injected payload \p MF with a check of the hook enable mask,
+/// if it was predicated by the IR generator; The guard must not write to the
+/// registers live at the \p InstPoint, the registers accessed by the hooks,
+/// or the storage of the state value array
+/// \return \c true if the payload was guarded
+static llvm::Expected<bool>
+guardInjectedPayload(llvm::MachineFunction &MF,
+                     const llvm::MachineInstr &InstPoint,
+                     const AMDGPURegisterLiveness &RegLiveness,
+                     const InstPointSVALoadPlan &LoadPlan,
+                     const llvm::LivePhysRegs &AccessedPhysRegs) {
+  const llvm::Function &F = MF.getFunction();
+  if (!F.hasFnAttribute(HookEnableMaskAttribute))
+    return false;
+  uint32_t PayloadMask;
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !F.getFnAttribute(HookEnableMaskAttribute)
+           .getValueAsString()
+           .getAsInteger(10, PayloadMask),
+      llvm::formatv("Failed to parse the hook enable mask bits of injected "
+                    "payload {0}.",
+                    F.getName())));
+  const llvm::GlobalValue *EnableMask =
+      F.getParent()->getNamedValue(HookEnableMaskVar);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      EnableMask != nullptr,
+      llvm::formatv("Failed to find the hook enable mask {0} in the "
+                    "instrumentation module.",
+                    HookEnableMaskVar)));
+  const llvm::LivePhysRegs *LiveIns =
+      RegLiveness.getMFLevelInstrLiveIns(InstPoint);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      LiveIns != nullptr,
+      llvm::formatv("Failed to get the live registers of the instrumentation "
+                    "point of injected payload {0}.",
+                    F.getName())));
+
+  llvm::LivePhysRegs UsedRegs(*MF.getSubtarget().getRegisterInfo());
+  for (llvm::MCPhysReg Reg : *LiveIns)
+    UsedRegs.addReg(Reg);
+  for (llvm::MCPhysReg Reg : AccessedPhysRegs)
+    UsedRegs.addReg(Reg);
+  llvm::SmallVector<llvm::MCRegister, 4> SVSRegs;
+  LoadPlan.StateValueStorageLocation.getAllStorageRegisters(SVSRegs);
+  for (llvm::MCRegister Reg : SVSRegs)
+    UsedRegs.addReg(Reg);
+  for (const auto &LiveIn : MF.front().liveins())
+    UsedRegs.addReg(LiveIn.PhysReg);
+
+  LUTHIER_RETURN_ON_ERROR(emitHookEnableGuard(
+      MF, *EnableMask, PayloadMask, UsedRegs,
+      LiveIns->contains(llvm::AMDGPU::SCC)));
+  return true;
+}
+
 bool InjectedPayloadPEIPass::runOnMachineFunction(llvm::MachineFunction &MF) {
 
   LLVM_DEBUG(llvm::dbgs() << "Running the injected payload prologue/epilogue "
@@ -84,7 +146,8 @@ bool InjectedPayloadPEIPass::runOnMachineFunction(llvm::MachineFunction &MF) {
           TargetModule);
 
   auto &PKInfo =
-      TargetMAM.getResult<FunctionPreambleDescriptorAnalysis>(TargetModule);
+      *TargetMAM.getCachedResult<FunctionPreambleDescriptorAnalysis>(
+          TargetModule);
 
   const auto &PhysicalRegsNotTobeClobbered =
       IMAM.getCachedResult<PhysRegsNotInLiveInsAnalysis>(IModule)
@@ -103,6 +166,17 @@ bool InjectedPayloadPEIPass::runOnMachineFunction(llvm::MachineFunction &MF) {
   // Target Machine function which this injected payload will be patched into
   auto TargetMF = IPIP.at(MF.getFunction())->getMF();
 
+  // Predicated payloads are guarded once their prologue and epilogue are in
+  // place, so that the guard runs before anything else
+  auto GuardPayload = [&]() {
+    auto IsGuarded = guardInjectedPayload(
+        MF, *IPIP.at(MF.getFunction()),
+        *TargetMAM.getCachedResult<AMDGPURegLivenessAnalysis>(TargetModule),
+        StateValueLoadPlan, PhysicalRegsNotTobeClobbered);
+    LUTHIER_REPORT_FATAL_ON_ERROR(IsGuarded.takeError());
+    return *IsGuarded;
+  };
+
   // We need to first determine if we need to even emit a prologue/epilogue for
   // this hook; If the hooks makes use of the state value VGPR
   // (reads from it/writes to it), or is using s[0:3], s32, and FS, then it
@@ -139,18 +213,30 @@ bool InjectedPayloadPEIPass::runOnMachineFunction(llvm::MachineFunction &MF) {
     }
   }
 
+  // The first and last injected payloads of a run load and store the state
+  // value array on behalf of the whole run, even if they don't use it
+  // themselves
+  if (StateValueLoadPlan.isPartOfRun() &&
+      (StateValueLoadPlan.LoadsSVA || StateValueLoadPlan.StoresSVA)) {
+    LLVM_DEBUG(llvm::dbgs() << "Injected payload is at the boundary of a "
+                               "state value array load run.\n";);
+    HookMakesUseOfStateValueArray = true;
+  }
+
   if (!HookMakesUseOfStateValueArray) {
     LLVM_DEBUG(llvm::dbgs()
                    << "Hook doesn't make use of the state value array load "
                       "VGPR. Skipping "
                       "emission of prologue and epiloge for this function.\n";);
-    return false;
+    return GuardPayload();
   }
 
   // Keep track of the first instruction of the injected payload
   auto &EntryInstruction = *MF.front().begin();
-  // emit the prologue
-  if (StateValueStorage.requiresLoadAndStoreBeforeUse()) {
+  // emit the prologue; Payloads inside a run find the state value array
+  // already loaded by the payload before them
+  if (StateValueLoadPlan.LoadsSVA &&
+      StateValueStorage.requiresLoadAndStoreBeforeUse()) {
     StateValueStorage.emitCodeToLoadSVA(
         EntryInstruction, StateValueLoadPlan.StateValueArrayLoadVGPR);
     Changed |= true;
@@ -161,6 +247,7 @@ bool InjectedPayloadPEIPass::runOnMachineFunction(llvm::MachineFunction &MF) {
   // to FS
   if (StateValueStorage.getStateValueStorageReg() == 0) {
     RequiresAccessToStack = true;
+    auto Lock = PKInfo.getLock();
     if (TargetMF->getFunction().getCallingConv() ==
         llvm::CallingConv::AMDGPU_KERNEL) {
       PKInfo.Kernels[TargetMF].RequiresScratchAndStackSetup = true;
@@ -175,10 +262,26 @@ bool InjectedPayloadPEIPass::runOnMachineFunction(llvm::MachineFunction &MF) {
   // then we need to signal the LR pre-kernel inserter that we need them +
   // Generate code to load it
   auto &FrameInfo = MF.getFrameInfo();
+  uint64_t PayloadStackSize =
+      FrameInfo.hasStackObjects() ? FrameInfo.getStackSize() : 0;
+  // Frames of the outlined hooks called by the payload are placed right
+  // after the frame of the payload
+  uint64_t OutlinedHooksStackSize = getOutlinedHookCallsStackSize(
+      MF, getAnalysis<llvm::MachineModuleInfoWrapperPass>().getMMI());
   // TODO: Make sure this is correct
-  if (FrameInfo.hasStackObjects() && FrameInfo.getStackSize() != 0) {
+  if (PayloadStackSize + OutlinedHooksStackSize != 0) {
     LLVM_DEBUG(llvm::dbgs() << "Found a use of stack.\n";);
     RequiresAccessToStack = true;
+    auto Lock = PKInfo.getLock();
+    // All injected payloads of the LR start their frames at the beginning of
+    // the instrumentation stack set up by the kernel preamble
+    auto &LR =
+        TargetMAM.getCachedResult<LiftedRepresentationAnalysis>(TargetModule)
+            ->getLR();
+    auto &KernelSpecs = PKInfo.Kernels[&LR.getKernelMF()];
+    KernelSpecs.RequestedAdditionalStackSizeInBytes = std::max<unsigned int>(
+        KernelSpecs.RequestedAdditionalStackSizeInBytes,
+        PayloadStackSize + OutlinedHooksStackSize);
     if (TargetMF->getFunction().getCallingConv() ==
         llvm::CallingConv::AMDGPU_KERNEL) {
       PKInfo.Kernels[TargetMF].RequiresScratchAndStackSetup = true;
@@ -191,12 +294,14 @@ bool InjectedPayloadPEIPass::runOnMachineFunction(llvm::MachineFunction &MF) {
 
   // If the app has either s0, s1, s2, s3, s32, and FLAT_SCRATCH_LO/HI
   // live/we shouldn't clobber them,
-  // then we need to spill it to the value register before the hook runs
+  // then we need to spill it to the value register before the hook runs;
+  // Inside a run, they were already spilled by the first payload of the run
   for (const auto &[PhysReg, SpillLane] :
        stateValueArray::getFrameSpillSlots()) {
-    if (InstPointLiveRegs.contains(PhysReg) ||
-        (!PhysicalRegsNotTobeClobbered.empty() &&
-         PhysicalRegsNotTobeClobbered.contains(PhysReg))) {
+    if (StateValueLoadPlan.LoadsSVA &&
+        (InstPointLiveRegs.contains(PhysReg) ||
+         (!PhysicalRegsNotTobeClobbered.empty() &&
+          PhysicalRegsNotTobeClobbered.contains(PhysReg)))) {
       llvm::BuildMI(MF.front(), EntryInstruction, llvm::DebugLoc(),
                     TII->get(llvm::AMDGPU::V_WRITELANE_B32),
                     StateValueLoadPlan.StateValueArrayLoadVGPR)
@@ -217,10 +322,41 @@ bool InjectedPayloadPEIPass::runOnMachineFunction(llvm::MachineFunction &MF) {
     }
   }
 
+  // The payload is naked, so its stack pointer still points to the
+  // beginning of its own frame; Move it past the frame around each call to an
+  // outlined hook. SCC is never live across a call, hence it is marked dead
+  // in the adjustments, the same way the AMDGPU frame lowering does
+  if (PayloadStackSize != 0 && OutlinedHooksStackSize != 0) {
+    const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+    uint64_t ScaledFrameSize =
+        PayloadStackSize * (ST.enableFlatScratch() ? 1 : ST.getWavefrontSize());
+    for (auto &MBB : MF) {
+      for (auto &MI : MBB) {
+        if (!getOutlinedHookCallee(MI))
+          continue;
+        auto Add =
+            llvm::BuildMI(MBB, MI, MI.getDebugLoc(),
+                          TII->get(llvm::AMDGPU::S_ADD_I32),
+                          llvm::AMDGPU::SGPR32)
+                .addReg(llvm::AMDGPU::SGPR32, llvm::RegState::Kill)
+                .addImm(ScaledFrameSize);
+        Add->getOperand(3).setIsDead();
+        auto Sub =
+            llvm::BuildMI(MBB, std::next(MI.getIterator()), MI.getDebugLoc(),
+                          TII->get(llvm::AMDGPU::S_SUB_I32),
+                          llvm::AMDGPU::SGPR32)
+                .addReg(llvm::AMDGPU::SGPR32, llvm::RegState::Kill)
+                .addImm(ScaledFrameSize);
+        Sub->getOperand(3).setIsDead();
+      }
+    }
+    Changed |= true;
+  }
+
   // Emit epilogue (do everything we just did now in reverse for all return
-  // blocks)
+  // blocks); Inside a run, this is left to the last payload of the run
   for (auto &MBB : MF) {
-    if (MBB.isReturnBlock()) {
+    if (StateValueLoadPlan.StoresSVA && MBB.isReturnBlock()) {
       auto FirstTermInst = MBB.getFirstTerminator();
       // There's no need to save s[0:3]/s32/FS of instrumentation
       // Restore s[0:3]/s32/FS of the app if saved in the prologue
@@ -246,6 +382,8 @@ bool InjectedPayloadPEIPass::runOnMachineFunction(llvm::MachineFunction &MF) {
     }
   }
 
+  Changed |= GuardPayload();
+
   LLVM_DEBUG(
       llvm::dbgs()
           << "Machine function contents after inserting prologue/epilogue:\n";
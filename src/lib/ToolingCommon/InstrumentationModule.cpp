@@ -244,6 +244,25 @@ StaticInstrumentationModule::convertHookHandleToHookName(
   return HookHandleMap.at(Handle);
 }
 
+llvm::Expected<unsigned>
+StaticInstrumentationModule::getHookEnableBit(llvm::StringRef HookName) const {
+  std::shared_lock Lock(Mutex);
+  llvm::SmallVector<llvm::StringRef, 32> HookNames;
+  for (const auto &[Handle, Name] : HookHandleMap)
+    HookNames.push_back(Name);
+  llvm::sort(HookNames);
+  const auto *It = llvm::find(HookNames, HookName);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      It != HookNames.end(),
+      llvm::formatv("Failed to find the handle of hook {0}.", HookName)));
+  unsigned Bit = std::distance(HookNames.begin(), It);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Bit < 32, llvm::formatv("Hook {0} has no bit left in the 32-bit hook "
+                              "enable mask.",
+                              HookName)));
+  return Bit;
+}
+
 llvm::Expected<bool>
 StaticInstrumentationModule::isStaticInstrumentationModuleExecutable(
     const hsa::ApiTableContainer<::CoreApiTable> &CoreApi,
@@ -0,0 +1,324 @@
+//===-- InstrumentationStack.cpp ------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the setup of the instrumentation stack in the kernel
+/// preamble.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/InstrumentationStack.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/Tooling/StateValueArraySpecs.h"
+#include <GCNSubtarget.h>
+#include <SIMachineFunctionInfo.h>
+#include <cstddef>
+#include <hsa/hsa.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/MathExtras.h>
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "luthier-instrumentation-stack"
+
+namespace luthier {
+
+static llvm::cl::opt<DynamicStackInstrumentationPlacement>
+    DynamicStackPlacement(
+        "luthier-dynamic-stack-instrumentation-placement",
+        llvm::cl::desc("Placement of the instrumentation stack of kernels "
+                       "using a dynamic stack."),
+        llvm::cl::init(DynamicStackInstrumentationPlacement::BelowAppStack),
+        llvm::cl::values(
+            clEnumValN(DynamicStackInstrumentationPlacement::BelowAppStack,
+                       "below-app-stack",
+                       "Reserve a bounded region below the application's "
+                       "stack"),
+            clEnumValN(DynamicStackInstrumentationPlacement::PerWaveSlice,
+                       "per-wave-slice",
+                       "Reserve a separate slice above the application's "
+                       "stack")));
+
+static llvm::cl::opt<unsigned> MaxDynamicStackInstrumentationRegionSize(
+    "luthier-max-dynamic-stack-instrumentation-region-size",
+    llvm::cl::desc("Maximum number of bytes per lane reserved for the "
+                   "instrumentation stack of kernels using a dynamic stack."),
+    llvm::cl::init(4096));
+
+DynamicStackInstrumentationPlacement getDynamicStackInstrumentationPlacement() {
+  return DynamicStackPlacement;
+}
+
+bool doesInstrumentationStackRequireDispatchPtr(
+    const amdgpu::hsamd::Kernel::Metadata &KernelMD) {
+  return KernelMD.UsesDynamicStack &&
+         DynamicStackPlacement ==
+             DynamicStackInstrumentationPlacement::PerWaveSlice;
+}
+
+/// \return the factor stack offsets are scaled by in the stack pointer;
+/// Without flat scratch, the stack pointer holds an offset into the swizzled
+/// private segment of the whole wave
+static unsigned int getScratchScaleFactor(const llvm::GCNSubtarget &ST) {
+  return ST.enableFlatScratch() ? 1 : ST.getWavefrontSize();
+}
+
+/// Moves the start of the application's stack up by \p RegionSize bytes per
+/// lane by adjusting the initialization of the stack pointer in the entry
+/// block of the kernel of \p EntryInstr
+static llvm::Error shiftAppStackStart(llvm::MachineInstr &EntryInstr,
+                                      unsigned int RegionSize) {
+  auto &MBB = *EntryInstr.getParent();
+  auto &MF = *MBB.getParent();
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TRI = *ST.getRegisterInfo();
+  auto SPInit = llvm::find_if(
+      llvm::make_range(llvm::MachineBasicBlock::iterator(EntryInstr),
+                       MBB.end()),
+      [&](const llvm::MachineInstr &MI) {
+        return MI.modifiesRegister(llvm::AMDGPU::SGPR32, &TRI);
+      });
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      SPInit != MBB.end() &&
+          (SPInit->getOpcode() == llvm::AMDGPU::S_MOV_B32 ||
+           SPInit->getOpcode() == llvm::AMDGPU::S_MOVK_I32) &&
+          SPInit->getOperand(1).isImm(),
+      llvm::formatv("Failed to find the initialization of the stack pointer "
+                    "in the entry block of kernel {0}.",
+                    MF.getName())));
+  auto &StackStart = SPInit->getOperand(1);
+  // The new offset might not fit in the immediate of s_movk_i32
+  SPInit->setDesc(ST.getInstrInfo()->get(llvm::AMDGPU::S_MOV_B32));
+  StackStart.setImm(StackStart.getImm() +
+                    RegionSize * getScratchScaleFactor(ST));
+  return llvm::Error::success();
+}
+
+/// Emits code before \p EntryInstr that points s32 to the last
+/// \p RegionSize bytes of the private segment of each lane, as sized by the
+/// dispatch packet
+static void emitCodeToPointSPToPerWaveSlice(llvm::MachineInstr &EntryInstr,
+                                            unsigned int RegionSize) {
+  auto &MBB = *EntryInstr.getParent();
+  auto &MF = *MBB.getParent();
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  auto &MFI = *MF.getInfo<llvm::SIMachineFunctionInfo>();
+
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_LOAD_DWORD_IMM), llvm::AMDGPU::SGPR32)
+      .addReg(MFI.getPreloadedReg(llvm::AMDGPUFunctionArgInfo::DISPATCH_PTR))
+      .addImm(offsetof(hsa_kernel_dispatch_packet_t, private_segment_size))
+      .addImm(0);
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_WAITCNT))
+      .addImm(0);
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_SUB_U32), llvm::AMDGPU::SGPR32)
+      .addReg(llvm::AMDGPU::SGPR32, llvm::RegState::Kill)
+      .addImm(RegionSize);
+  if (unsigned int ScaleFactor = getScratchScaleFactor(ST); ScaleFactor != 1) {
+    llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_LSHL_B32), llvm::AMDGPU::SGPR32)
+        .addReg(llvm::AMDGPU::SGPR32, llvm::RegState::Kill)
+        .addImm(llvm::Log2_32(ScaleFactor));
+  }
+}
+
+llvm::Error emitCodeToSetupInstrumentationStack(
+    llvm::MachineInstr &EntryInstr, llvm::MCRegister SVSStorageVGPR,
+    const amdgpu::hsamd::Kernel::Metadata &KernelMD,
+    unsigned int InstrumentationStackSize) {
+  auto &MF = *EntryInstr.getMF();
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  const auto &TRI = *ST.getRegisterInfo();
+  auto &MFI = *MF.getInfo<llvm::SIMachineFunctionInfo>();
+  // First make a copy of S0 and S1/ FS_lo FS_hi in the state value
+  // register
+  auto SGPR0SpillSlot =
+      stateValueArray::getFrameSpillSlotLaneId(llvm::AMDGPU::SGPR0);
+
+  auto SGPR1SpillSlot =
+      stateValueArray::getFrameSpillSlotLaneId(llvm::AMDGPU::SGPR1);
+
+  auto SGPRFlatScrLoSpillSlot =
+      stateValueArray::getFrameSpillSlotLaneId(llvm::AMDGPU::FLAT_SCR_LO);
+
+  auto SGPRFlatScrHiSpillSlot =
+      stateValueArray::getFrameSpillSlotLaneId(llvm::AMDGPU::FLAT_SCR_HI);
+
+  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_WRITELANE_B32), SVSStorageVGPR)
+      .addReg(TRI.getSubReg(
+          MFI.getPreloadedReg(
+              llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
+          llvm::AMDGPU::sub0))
+      .addImm(SGPR0SpillSlot)
+      .addReg(SVSStorageVGPR);
+
+  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_WRITELANE_B32), SVSStorageVGPR)
+      .addReg(TRI.getSubReg(
+          MFI.getPreloadedReg(
+              llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
+          llvm::AMDGPU::sub1))
+      .addImm(SGPR1SpillSlot)
+      .addReg(SVSStorageVGPR);
+
+  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_WRITELANE_B32), SVSStorageVGPR)
+      .addReg(TRI.getSubReg(
+          MFI.getPreloadedReg(llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
+          llvm::AMDGPU::sub0))
+      .addImm(SGPRFlatScrLoSpillSlot)
+      .addReg(SVSStorageVGPR);
+
+  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_WRITELANE_B32), SVSStorageVGPR)
+      .addReg(TRI.getSubReg(
+          MFI.getPreloadedReg(llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
+          llvm::AMDGPU::sub1))
+      .addImm(SGPRFlatScrHiSpillSlot)
+      .addReg(SVSStorageVGPR);
+
+  // Add the PSWO to SGPR0/its carry to SGPR1
+  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_ADD_U32))
+      .addReg(TRI.getSubReg(
+                  MFI.getPreloadedReg(
+                      llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
+                  llvm::AMDGPU::sub0),
+              llvm::RegState::Define)
+      .addReg(TRI.getSubReg(
+                  MFI.getPreloadedReg(
+                      llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
+                  llvm::AMDGPU::sub0),
+              llvm::RegState::Kill)
+      .addReg(MFI.getPreloadedReg(
+          llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_WAVE_BYTE_OFFSET));
+
+  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_ADDC_U32))
+      .addReg(TRI.getSubReg(
+                  MFI.getPreloadedReg(
+                      llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
+                  llvm::AMDGPU::sub1),
+              llvm::RegState::Define)
+      .addReg(TRI.getSubReg(
+                  MFI.getPreloadedReg(
+                      llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
+                  llvm::AMDGPU::sub1),
+              llvm::RegState::Kill)
+      .addImm(0);
+  // Add the PSWO to FS_init_lo/its carry to FS_init_hi
+  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_ADD_U32))
+      .addReg(TRI.getSubReg(MFI.getPreloadedReg(
+                                llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
+                            llvm::AMDGPU::sub0),
+              llvm::RegState::Define)
+      .addReg(TRI.getSubReg(MFI.getPreloadedReg(
+                                llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
+                            llvm::AMDGPU::sub0),
+              llvm::RegState::Kill)
+      .addReg(MFI.getPreloadedReg(
+          llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_WAVE_BYTE_OFFSET));
+  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_ADDC_U32))
+      .addReg(TRI.getSubReg(MFI.getPreloadedReg(
+                                llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
+                            llvm::AMDGPU::sub1),
+              llvm::RegState::Define)
+      .addReg(TRI.getSubReg(MFI.getPreloadedReg(
+                                llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
+                            llvm::AMDGPU::sub1),
+              llvm::RegState::Kill)
+      .addImm(0);
+
+  // Point s32 to the beginning of the instrumentation stack; For kernels
+  // with a fixed-size stack, it starts right after the fixed private segment
+  bool UsesPerWaveSlice{false};
+  if (KernelMD.UsesDynamicStack) {
+    // The application's stack grows past its fixed private segment up to a
+    // limit only known at dispatch time; Reserve a separate region for the
+    // instrumentation stack, which the dispatch makes room for
+    unsigned int RegionSize = llvm::alignTo(
+        InstrumentationStackSize, DynamicStackInstrumentationRegionAlign);
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        RegionSize <= MaxDynamicStackInstrumentationRegionSize,
+        llvm::formatv("The instrumentation stack of kernel {0} requires {1} "
+                      "bytes per lane, which exceeds the maximum of {2} bytes "
+                      "reserved for kernels using a dynamic stack.",
+                      MF.getName(), RegionSize,
+                      MaxDynamicStackInstrumentationRegionSize.getValue())));
+    UsesPerWaveSlice = DynamicStackPlacement ==
+                       DynamicStackInstrumentationPlacement::PerWaveSlice;
+    if (UsesPerWaveSlice)
+      emitCodeToPointSPToPerWaveSlice(EntryInstr, RegionSize);
+    else if (RegionSize != 0)
+      LUTHIER_RETURN_ON_ERROR(shiftAppStackStart(EntryInstr, RegionSize));
+  }
+  if (!UsesPerWaveSlice) {
+    llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_MOV_B32), llvm::AMDGPU::SGPR32)
+        .addImm(KernelMD.PrivateSegmentFixedSize * getScratchScaleFactor(ST));
+  }
+
+  // Store frame registers in their slots
+  for (const auto &[PhysReg, StoreSlot] :
+       stateValueArray::getFrameStoreSlots()) {
+    llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::V_WRITELANE_B32), SVSStorageVGPR)
+        .addReg(PhysReg)
+        .addImm(StoreSlot)
+        .addReg(SVSStorageVGPR);
+  }
+
+  // Restore S0, S1, FS_init_lo, and FS_init_hi
+  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_READLANE_B32), llvm::AMDGPU::SGPR0)
+      .addReg(SVSStorageVGPR)
+      .addImm(SGPR0SpillSlot);
+
+  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_READLANE_B32), llvm::AMDGPU::SGPR1)
+      .addReg(SVSStorageVGPR)
+      .addImm(SGPR1SpillSlot);
+
+  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_READLANE_B32))
+      .addReg(TRI.getSubReg(MFI.getPreloadedReg(
+                                llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
+                            llvm::AMDGPU::sub0),
+              llvm::RegState::Define)
+      .addReg(SVSStorageVGPR)
+      .addImm(SGPRFlatScrLoSpillSlot);
+
+  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_READLANE_B32))
+      .addReg(TRI.getSubReg(MFI.getPreloadedReg(
+                                llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
+                            llvm::AMDGPU::sub1),
+              llvm::RegState::Define)
+      .addReg(SVSStorageVGPR)
+      .addImm(SGPRFlatScrHiSpillSlot);
+
+  return llvm::Error::success();
+}
+
+} // namespace luthier
@@ -19,7 +19,14 @@
 #include "luthier/Tooling/InstrumentationTask.h"
 #include "luthier/Tooling/CodeGenerator.h"
 #include "luthier/Tooling/CodeLifter.h"
+#include "luthier/Tooling/MemoryAccess.h"
 #include "luthier/Tooling/ToolExecutableLoader.h"
+#include <algorithm>
+#include <llvm/CodeGen/MachineFunction.h>
+#include <llvm/CodeGen/TargetInstrInfo.h>
+#include <llvm/CodeGen/TargetSubtargetInfo.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Support/FormatVariadic.h>
 
 namespace luthier {
 
@@ -41,6 +48,123 @@ llvm::Error luthier::InstrumentationTask::insertHookBefore(
   return llvm::Error::success();
 }
 
+llvm::Error
+InstrumentationTask::insertRegionTimer(llvm::MachineInstr &RegionBegin,
+                                       llvm::MachineInstr &RegionEnd,
+                                       const void *TimerHook) {
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      &RegionBegin != &RegionEnd, "The timed region must not be empty."));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      RegionBegin.getMF() == RegionEnd.getMF(),
+      "The beginning and the end of the timed region must be inside the same "
+      "machine function."));
+  auto &Ctx = LR.getContext();
+  LUTHIER_RETURN_ON_ERROR(insertHookBefore(
+      RegionBegin, TimerHook, {llvm::ConstantInt::getFalse(Ctx)}));
+  LUTHIER_RETURN_ON_ERROR(insertHookBefore(RegionEnd, TimerHook,
+                                           {llvm::ConstantInt::getTrue(Ctx)}));
+  // Move the closing timestamp in front of the hooks already queued at the
+  // end of the region
+  auto &EndHooks = HookInsertionTasks[&RegionEnd];
+  std::rotate(EndHooks.begin(), std::prev(EndHooks.end()), EndHooks.end());
+  return llvm::Error::success();
+}
+
+llvm::Error InstrumentationTask::insertMemoryAccessHookBefore(
+    llvm::MachineInstr &MI, const void *Hook,
+    llvm::ArrayRef<std::variant<llvm::Constant *, llvm::MCRegister>>
+        ExtraArgs) {
+  auto Accesses = decodeMemoryAccesses(MI);
+  LUTHIER_RETURN_ON_ERROR(Accesses.takeError());
+  for (const MemoryAccess &Access : *Accesses) {
+    auto Args = Access.getHookArgs(LR.getContext());
+    Args.append(ExtraArgs.begin(), ExtraArgs.end());
+    LUTHIER_RETURN_ON_ERROR(insertHookBefore(MI, Hook, Args));
+  }
+  return llvm::Error::success();
+}
+
+/// \return the instruction before which a counter of the edge \p Src ->
+/// \p Dst can be inserted without splitting the edge, or \c nullptr if the
+/// edge must be split; \p Dst is \c nullptr for edges leaving the function
+static llvm::MachineInstr *
+findEdgeCounterInsertionPoint(llvm::MachineBasicBlock &Src,
+                              llvm::MachineBasicBlock *Dst) {
+  // Every execution of a block with at most one successor goes through the
+  // edge
+  if (Src.succ_size() <= 1 && !Src.empty()) {
+    auto FirstTerm = Src.getFirstTerminator();
+    return FirstTerm != Src.end() ? &*FirstTerm : &Src.back();
+  }
+  // Every execution of a block with a single predecessor comes from the edge
+  if (Dst != nullptr && Dst->pred_size() == 1 && !Dst->empty() &&
+      !Dst->isEntryBlock())
+    return &Dst->front();
+  return nullptr;
+}
+
+/// Splits the edge \p Src -> \p Dst by inserting an empty block branching
+/// to \p Dst in between
+/// \return the new block, or an \c llvm::Error if the edge cannot be split
+static llvm::Expected<llvm::MachineBasicBlock &>
+splitEdge(llvm::MachineBasicBlock &Src, llvm::MachineBasicBlock &Dst) {
+  bool FallsThrough = Src.isLayoutSuccessor(&Dst);
+  bool BranchesToDst = llvm::any_of(Src.terminators(), [&](auto &Term) {
+    return llvm::any_of(Term.operands(), [&](auto &Op) {
+      return Op.isMBB() && Op.getMBB() == &Dst;
+    });
+  });
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      FallsThrough || BranchesToDst,
+      llvm::formatv("Cannot split the edge {0} -> {1} since its branch target "
+                    "is not known.",
+                    Src.getFullName(), Dst.getFullName())));
+  llvm::MachineFunction &MF = *Src.getParent();
+  llvm::MachineBasicBlock *NewMBB = MF.CreateMachineBasicBlock();
+  // Keep falling through from the source block into the new block
+  MF.insert(FallsThrough ? std::next(Src.getIterator()) : MF.end(), NewMBB);
+  Src.ReplaceUsesOfBlockWith(&Dst, NewMBB);
+  NewMBB->addSuccessor(&Dst);
+  for (const auto &LiveIn : Dst.liveins())
+    NewMBB->addLiveIn(LiveIn);
+  MF.getSubtarget().getInstrInfo()->insertUnconditionalBranch(
+      *NewMBB, &Dst, llvm::DebugLoc());
+  return *NewMBB;
+}
+
+llvm::Expected<MachineEdgeProfile>
+InstrumentationTask::insertEdgeCounters(const void *CounterHook) {
+  auto Profile = computeMachineEdgeProfile(LR);
+  LUTHIER_RETURN_ON_ERROR(Profile.takeError());
+  auto *IndexTy = llvm::Type::getInt32Ty(LR.getContext());
+  for (const MachineFunctionEdgeProfile &FuncProfile : Profile->Functions) {
+    const EdgeCounterPlacement &Placement = FuncProfile.Placement;
+    for (size_t I = 0; I < Placement.CounterEdges.size(); ++I) {
+      const ProfileEdge &Edge = Placement.Edges[Placement.CounterEdges[I]];
+      llvm::MachineBasicBlock &Src = *FuncProfile.Blocks[Edge.Src];
+      llvm::MachineBasicBlock *Dst = Placement.isExitEdge(Edge)
+                                         ? nullptr
+                                         : FuncProfile.Blocks[Edge.Dst];
+      llvm::MachineInstr *InsertionPoint =
+          findEdgeCounterInsertionPoint(Src, Dst);
+      if (InsertionPoint == nullptr) {
+        LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+            Dst != nullptr,
+            llvm::formatv("Exit block {0} has no instructions to place an edge "
+                          "counter before.",
+                          Src.getFullName())));
+        auto NewMBB = splitEdge(Src, *Dst);
+        LUTHIER_RETURN_ON_ERROR(NewMBB.takeError());
+        InsertionPoint = &NewMBB->front();
+      }
+      LUTHIER_RETURN_ON_ERROR(insertHookBefore(
+          *InsertionPoint, CounterHook,
+          {llvm::ConstantInt::get(IndexTy, FuncProfile.FirstCounter + I)}));
+    }
+  }
+  return Profile;
+}
+
 InstrumentationTask::InstrumentationTask(LiftedRepresentation &LR)
     : LR(LR),
       IM(ToolExecutableLoader::instance().getStaticInstrumentationModule()) {};
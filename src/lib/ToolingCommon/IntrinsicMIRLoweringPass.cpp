@@ -59,7 +59,8 @@ bool IntrinsicMIRLoweringPass::runOnMachineFunction(llvm::MachineFunction &MF) {
   auto &TargetModule = TargetMAMAndModule.getTargetAppModule();
 
   auto &PreambleDescriptor =
-      TargetMAM.getResult<FunctionPreambleDescriptorAnalysis>(TargetModule);
+      *TargetMAM.getCachedResult<FunctionPreambleDescriptorAnalysis>(
+          TargetModule);
 
   auto &IPIP = IMAM.getResult<InjectedPayloadAndInstPointAnalysis>(IModule);
 
@@ -67,8 +68,9 @@ bool IntrinsicMIRLoweringPass::runOnMachineFunction(llvm::MachineFunction &MF) {
 
   llvm::MCRegister SVAVGPR =
       TargetMAM
-          .getResult<LRStateValueStorageAndLoadLocationsAnalysis>(TargetModule)
-          .getStateValueArrayLoadPlanForInstPoint(TargetMI)
+          .getCachedResult<LRStateValueStorageAndLoadLocationsAnalysis>(
+              TargetModule)
+          ->getStateValueArrayLoadPlanForInstPoint(TargetMI)
           ->StateValueArrayLoadVGPR;
 
   for (auto &MBB : MF) {
@@ -131,13 +133,16 @@ bool IntrinsicMIRLoweringPass::runOnMachineFunction(llvm::MachineFunction &MF) {
           }
           // Add the requested kernarg
           auto TargetMF = TargetMI.getParent()->getParent();
-          if (TargetMF->getFunction().getCallingConv() ==
-              llvm::CallingConv::AMDGPU_KERNEL) {
-            PreambleDescriptor.Kernels[TargetMF]
-                .RequestedKernelArguments.insert(KA);
-          } else {
-            PreambleDescriptor.DeviceFunctions[TargetMF]
-                .RequestedKernelArguments.insert(KA);
+          {
+            auto Lock = PreambleDescriptor.getLock();
+            if (TargetMF->getFunction().getCallingConv() ==
+                llvm::CallingConv::AMDGPU_KERNEL) {
+              PreambleDescriptor.Kernels[TargetMF]
+                  .RequestedKernelArguments.insert(KA);
+            } else {
+              PreambleDescriptor.DeviceFunctions[TargetMF]
+                  .RequestedKernelArguments.insert(KA);
+            }
           }
 
           // Emit a reg sequence if the arg size was greater than 1
@@ -198,6 +203,19 @@ bool IntrinsicMIRLoweringPass::runOnMachineFunction(llvm::MachineFunction &MF) {
           MF.getFunction().getContext().emitError(
               "Intrinsic processor was not found in the intrinsic processor "
               "map.");
+        // Record the counters staged in LDS by the intrinsic, so that the
+        // pre-amble emitter allocates, zeroes, and flushes them
+        if (!IRLoweringInfo.lds_counters().empty()) {
+          auto TargetMF = TargetMI.getParent()->getParent();
+          auto Lock = PreambleDescriptor.getLock();
+          auto &LDSCounters =
+              TargetMF->getFunction().getCallingConv() ==
+                      llvm::CallingConv::AMDGPU_KERNEL
+                  ? PreambleDescriptor.Kernels[TargetMF].LDSCounters
+                  : PreambleDescriptor.DeviceFunctions[TargetMF].LDSCounters;
+          for (const auto &Counter : IRLoweringInfo.lds_counters())
+            LDSCounters.insert(Counter);
+        }
         if (auto Err = IRProcessor->second.MIRProcessor(
                 IRLoweringInfo, ArgVec, MIBuilder, VirtRegBuilder,
                 SVAAccessorBuilder, MF, PhysRegAccessor, ToBeOverwrittenRegs)) {
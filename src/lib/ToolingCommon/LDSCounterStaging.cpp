@@ -0,0 +1,210 @@
+//===-- LDSCounterStaging.cpp ---------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the code zeroing and flushing the counters staged in
+/// the LDS of the workgroup.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/LDSCounterStaging.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Tooling/MIRConvenience.h"
+#include <GCNSubtarget.h>
+#include <SIInstrInfo.h>
+#include <llvm/CodeGen/LivePhysRegs.h>
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/IR/GlobalVariable.h>
+
+namespace luthier {
+
+llvm::Error emitCodeToZeroLDSCounters(llvm::MachineInstr &EntryInstr,
+                                      unsigned CountersOffset,
+                                      unsigned LiveWavesOffset,
+                                      llvm::LivePhysRegs &LiveRegs) {
+  auto &MF = *EntryInstr.getMF();
+  auto &MBB = *EntryInstr.getParent();
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  const bool IsWave32 = ST.isWave32();
+
+  const auto &ExecRC = IsWave32 ? llvm::AMDGPU::SGPR_32RegClass
+                                : llvm::AMDGPU::SGPR_64RegClass;
+
+  auto SavedExec = pickFreePhysReg(MF, ExecRC, LiveRegs);
+  LUTHIER_RETURN_ON_ERROR(SavedExec.takeError());
+  auto VZero = pickFreePhysReg(MF, llvm::AMDGPU::VGPR_32RegClass, LiveRegs);
+  LUTHIER_RETURN_ON_ERROR(VZero.takeError());
+  auto VOne = pickFreePhysReg(MF, llvm::AMDGPU::VGPR_32RegClass, LiveRegs);
+  LUTHIER_RETURN_ON_ERROR(VOne.takeError());
+
+  const unsigned MovOpc =
+      IsWave32 ? llvm::AMDGPU::S_MOV_B32 : llvm::AMDGPU::S_MOV_B64;
+  const llvm::MCRegister Exec =
+      IsWave32 ? llvm::AMDGPU::EXEC_LO : llvm::AMDGPU::EXEC;
+  // A single lane of each wavefront does the work
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(), TII.get(MovOpc), *SavedExec)
+      .addReg(Exec);
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(), TII.get(MovOpc), Exec)
+      .addImm(1);
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_MOV_B32_e32), *VZero)
+      .addImm(0);
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_MOV_B32_e32), *VOne)
+      .addImm(1);
+  for (unsigned Offset = CountersOffset; Offset < LiveWavesOffset + 8;
+       Offset += 4) {
+    llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::DS_WRITE_B32_gfx9))
+        .addReg(*VZero)
+        .addReg(*VZero)
+        .addImm(Offset)
+        .addImm(0);
+  }
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_WAITCNT))
+      .addImm(0);
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_BARRIER));
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::DS_ADD_U32_gfx9))
+      .addReg(*VZero, llvm::RegState::Kill)
+      .addReg(*VOne, llvm::RegState::Kill)
+      .addImm(LiveWavesOffset)
+      .addImm(0);
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_WAITCNT))
+      .addImm(0);
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_BARRIER));
+  llvm::BuildMI(MBB, EntryInstr, llvm::DebugLoc(), TII.get(MovOpc), Exec)
+      .addReg(*SavedExec, llvm::RegState::Kill);
+  return llvm::Error::success();
+}
+
+llvm::Expected<llvm::MachineInstr *> emitCodeToFlushLDSCounters(
+    llvm::MachineInstr &EndPgm,
+    llvm::ArrayRef<std::pair<const llvm::GlobalVariable *, unsigned>>
+        Counters,
+    unsigned LiveWavesOffset) {
+  auto &MF = *EndPgm.getMF();
+  auto &MBB = *EndPgm.getParent();
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  const auto &TRI = *ST.getRegisterInfo();
+  const bool IsWave32 = ST.isWave32();
+
+  // Registers of the application are dead once it reaches s_endpgm
+  llvm::LivePhysRegs LiveRegs(TRI);
+  auto VAddr = pickFreePhysReg(MF, llvm::AMDGPU::VGPR_32RegClass, LiveRegs);
+  LUTHIER_RETURN_ON_ERROR(VAddr.takeError());
+  auto VOne = pickFreePhysReg(MF, llvm::AMDGPU::VGPR_32RegClass, LiveRegs);
+  LUTHIER_RETURN_ON_ERROR(VOne.takeError());
+  auto VLeft = pickFreePhysReg(MF, llvm::AMDGPU::VGPR_32RegClass, LiveRegs);
+  LUTHIER_RETURN_ON_ERROR(VLeft.takeError());
+  auto VData =
+      pickFreePhysReg(MF, *TRI.getVGPRClassForBitWidth(64), LiveRegs);
+  LUTHIER_RETURN_ON_ERROR(VData.takeError());
+  auto SIsLast = pickFreePhysReg(MF,
+                                 IsWave32 ? llvm::AMDGPU::SGPR_32RegClass
+                                          : llvm::AMDGPU::SGPR_64RegClass,
+                                 LiveRegs);
+  LUTHIER_RETURN_ON_ERROR(SIsLast.takeError());
+  auto SAddr = pickFreePhysReg(MF, llvm::AMDGPU::SGPR_64RegClass, LiveRegs);
+  LUTHIER_RETURN_ON_ERROR(SAddr.takeError());
+
+  const llvm::MCRegister Exec =
+      IsWave32 ? llvm::AMDGPU::EXEC_LO : llvm::AMDGPU::EXEC;
+  // Wait for the counter updates of this wavefront to land, then leave the
+  // workgroup using a single lane, as the exec mask no longer matters
+  auto *FlushBegin =
+      llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                    TII.get(llvm::AMDGPU::S_WAITCNT))
+          .addImm(0)
+          .getInstr();
+  llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                TII.get(IsWave32 ? llvm::AMDGPU::S_MOV_B32
+                                 : llvm::AMDGPU::S_MOV_B64),
+                Exec)
+      .addImm(1);
+  llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_MOV_B32_e32), *VAddr)
+      .addImm(0);
+  llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_MOV_B32_e32), *VOne)
+      .addImm(1);
+  llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::DS_SUB_RTN_U32_gfx9), *VLeft)
+      .addReg(*VAddr)
+      .addReg(*VOne, llvm::RegState::Kill)
+      .addImm(LiveWavesOffset)
+      .addImm(0);
+  llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_WAITCNT))
+      .addImm(0);
+  // Only the last wavefront to leave keeps its lane enabled
+  llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_CMP_EQ_U32_e64), *SIsLast)
+      .addImm(1)
+      .addReg(*VLeft, llvm::RegState::Kill);
+  llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                TII.get(IsWave32 ? llvm::AMDGPU::S_AND_B32
+                                 : llvm::AMDGPU::S_AND_B64),
+                Exec)
+      .addReg(Exec)
+      .addReg(*SIsLast, llvm::RegState::Kill);
+
+  for (const auto &[GlobalCounter, Offset] : Counters) {
+    // Load the address of the global counter from the GOT, the same way
+    // relocated accesses of the application are lifted
+    llvm::MCRegister SAddrLo = TRI.getSubReg(*SAddr, llvm::AMDGPU::sub0);
+    llvm::MCRegister SAddrHi = TRI.getSubReg(*SAddr, llvm::AMDGPU::sub1);
+    llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_GETPC_B64), *SAddr);
+    llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_ADD_U32), SAddrLo)
+        .addReg(SAddrLo)
+        .addGlobalAddress(GlobalCounter, 4,
+                          llvm::SIInstrInfo::MO_GOTPCREL32_LO);
+    llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_ADDC_U32), SAddrHi)
+        .addReg(SAddrHi)
+        .addGlobalAddress(GlobalCounter, 12,
+                          llvm::SIInstrInfo::MO_GOTPCREL32_HI);
+    llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_LOAD_DWORDX2_IMM), *SAddr)
+        .addReg(*SAddr)
+        .addImm(0)
+        .addImm(0);
+    llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::DS_READ_B64_gfx9), *VData)
+        .addReg(*VAddr)
+        .addImm(Offset)
+        .addImm(0);
+    llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_WAITCNT))
+        .addImm(0);
+    llvm::BuildMI(MBB, EndPgm, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::GLOBAL_ATOMIC_ADD_X2_SADDR))
+        .addReg(*VAddr)
+        .addReg(*VData, llvm::RegState::Kill)
+        .addReg(*SAddr, llvm::RegState::Kill)
+        .addImm(0)
+        .addImm(0);
+  }
+  return FlushBegin;
+}
+
+} // namespace luthier
@@ -19,8 +19,11 @@
 /// MIR instructions.
 //===----------------------------------------------------------------------===//
 #include "luthier/Tooling/MIRConvenience.h"
+#include "luthier/Common/GenericLuthierError.h"
 #include <SIInstrInfo.h>
+#include <llvm/CodeGen/LivePhysRegs.h>
 #include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/Support/FormatVariadic.h>
 
 namespace luthier {
 
@@ -236,4 +239,21 @@ void emitWaitCnt(llvm::MachineBasicBlock::iterator MI) {
       .addImm(0);
 }
 
+llvm::Expected<llvm::MCRegister>
+pickFreePhysReg(const llvm::MachineFunction &MF,
+                const llvm::TargetRegisterClass &RC,
+                llvm::LivePhysRegs &LiveRegs) {
+  const auto &MRI = MF.getRegInfo();
+  for (llvm::MCPhysReg Reg : RC.getRawAllocationOrder(MF)) {
+    if (LiveRegs.available(MRI, Reg)) {
+      LiveRegs.addReg(Reg);
+      return Reg;
+    }
+  }
+  return LUTHIER_MAKE_GENERIC_ERROR(llvm::formatv(
+      "Failed to find a free {0} register in function {1}.",
+      MF.getSubtarget().getRegisterInfo()->getRegClassName(&RC),
+      MF.getName()));
+}
+
 } // namespace luthier
\ No newline at end of file
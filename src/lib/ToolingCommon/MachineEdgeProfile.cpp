@@ -0,0 +1,177 @@
+//===-- MachineEdgeProfile.cpp --------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the edge profiling counter placement analysis of
+/// lifted kernels.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/MachineEdgeProfile.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/Tooling/LRCallgraph.h"
+#include "luthier/Tooling/LiftedRepresentation.h"
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/CodeGen/MachineFunction.h>
+#include <llvm/Support/FormatVariadic.h>
+
+#undef DEBUG_TYPE
+
+#define DEBUG_TYPE "luthier-machine-edge-profile"
+
+namespace luthier {
+
+/// Weight multiplier of loop back edges, which are expected to execute more
+/// often than the other edges of the function
+static constexpr uint64_t BackEdgeWeight = 16;
+
+/// Weight multiplier of critical edges, which must be split to carry a counter
+static constexpr uint64_t CriticalEdgeWeight = 2;
+
+/// Finds the back edges of \p MF with a depth-first traversal from its entry
+/// block
+/// \return the set of (source, destination) block numbers of the back edges
+static llvm::DenseSet<std::pair<unsigned, unsigned>>
+findBackEdges(const llvm::MachineFunction &MF) {
+  llvm::DenseSet<std::pair<unsigned, unsigned>> BackEdges;
+  llvm::SmallVector<bool> Visited(MF.getNumBlockIDs(), false);
+  llvm::SmallVector<bool> OnStack(MF.getNumBlockIDs(), false);
+  llvm::SmallVector<
+      std::pair<const llvm::MachineBasicBlock *,
+                llvm::MachineBasicBlock::const_succ_iterator>>
+      Stack;
+  const llvm::MachineBasicBlock &Entry = MF.front();
+  Stack.push_back({&Entry, Entry.succ_begin()});
+  Visited[Entry.getNumber()] = OnStack[Entry.getNumber()] = true;
+  while (!Stack.empty()) {
+    auto &[MBB, SuccIt] = Stack.back();
+    if (SuccIt == MBB->succ_end()) {
+      OnStack[MBB->getNumber()] = false;
+      Stack.pop_back();
+      continue;
+    }
+    const llvm::MachineBasicBlock *Succ = *SuccIt++;
+    if (OnStack[Succ->getNumber()]) {
+      BackEdges.insert({MBB->getNumber(), Succ->getNumber()});
+    } else if (!Visited[Succ->getNumber()]) {
+      Visited[Succ->getNumber()] = OnStack[Succ->getNumber()] = true;
+      Stack.push_back({Succ, Succ->succ_begin()});
+    }
+  }
+  return BackEdges;
+}
+
+/// Places the edge profiling counters of \p MF
+static llvm::Expected<MachineFunctionEdgeProfile>
+placeMachineFunctionCounters(llvm::MachineFunction &MF) {
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !MF.empty(), llvm::formatv("Machine function {0} has no basic blocks.",
+                                 MF.getName())));
+  MachineFunctionEdgeProfile Out{&MF};
+  llvm::DenseMap<const llvm::MachineBasicBlock *, unsigned> BlockIndices;
+  for (llvm::MachineBasicBlock &MBB : MF) {
+    BlockIndices.insert({&MBB, Out.Blocks.size()});
+    Out.Blocks.push_back(&MBB);
+  }
+  auto BackEdges = findBackEdges(MF);
+
+  llvm::SmallVector<ProfileEdge> Edges;
+  llvm::SmallVector<unsigned> ExitBlocks;
+  for (const llvm::MachineBasicBlock *MBB : Out.Blocks) {
+    unsigned Src = BlockIndices.at(MBB);
+    if (MBB->succ_empty())
+      ExitBlocks.push_back(Src);
+    for (const llvm::MachineBasicBlock *Succ : MBB->successors()) {
+      uint64_t Weight = 1;
+      if (BackEdges.contains({MBB->getNumber(), Succ->getNumber()}))
+        Weight *= BackEdgeWeight;
+      if (MBB->succ_size() > 1 && Succ->pred_size() > 1)
+        Weight *= CriticalEdgeWeight;
+      Edges.push_back({Src, BlockIndices.at(Succ), Weight});
+    }
+  }
+  auto PlacementOrErr =
+      placeEdgeCounters(Out.Blocks.size(), 0, Edges, ExitBlocks);
+  LUTHIER_RETURN_ON_ERROR(PlacementOrErr.takeError());
+  Out.Placement = std::move(*PlacementOrErr);
+  return Out;
+}
+
+llvm::Expected<MachineEdgeProfile>
+computeMachineEdgeProfile(LiftedRepresentation &LR) {
+  LRCallGraph CG;
+  LUTHIER_RETURN_ON_ERROR(CG.analyse(LR.getModule(), LR.getMMI()));
+
+  // Find the functions reachable from the kernel; If a call target is
+  // unknown, any of the functions of the LR might be called
+  llvm::DenseSet<const llvm::MachineFunction *> Reachable;
+  if (!CG.hasNonDeterministicCallGraph()) {
+    llvm::SmallVector<const llvm::MachineFunction *> Worklist{
+        &LR.getKernelMF()};
+    Reachable.insert(&LR.getKernelMF());
+    while (!Worklist.empty()) {
+      const llvm::MachineFunction *MF = Worklist.pop_back_val();
+      for (const auto &[CallMI, CalleeMF] :
+           CG.getCallGraphNode(const_cast<llvm::MachineFunction *>(MF))
+               .CalledFunctions) {
+        if (CalleeMF != nullptr && Reachable.insert(CalleeMF).second)
+          Worklist.push_back(CalleeMF);
+      }
+    }
+  }
+
+  MachineEdgeProfile Out;
+  llvm::SmallVector<llvm::MachineFunction *> ProfiledFunctions{
+      &LR.getKernelMF()};
+  for (auto &[FuncSymbol, MF] : LR.functions()) {
+    if (CG.hasNonDeterministicCallGraph() || Reachable.contains(MF))
+      ProfiledFunctions.push_back(MF);
+  }
+  for (llvm::MachineFunction *MF : ProfiledFunctions) {
+    auto FuncProfile = placeMachineFunctionCounters(*MF);
+    LUTHIER_RETURN_ON_ERROR(FuncProfile.takeError());
+    FuncProfile->FirstCounter = Out.NumCounters;
+    Out.NumCounters += FuncProfile->Placement.CounterEdges.size();
+    LLVM_DEBUG(llvm::dbgs() << "Placed "
+                            << FuncProfile->Placement.CounterEdges.size()
+                            << " edge counters over the "
+                            << FuncProfile->Blocks.size() << " blocks of "
+                            << MF->getName() << "\n";);
+    Out.Functions.push_back(std::move(*FuncProfile));
+  }
+  return Out;
+}
+
+llvm::Expected<llvm::DenseMap<const llvm::MachineBasicBlock *, uint64_t>>
+MachineEdgeProfile::reconstructBlockCounts(
+    llvm::ArrayRef<uint64_t> Counters) const {
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Counters.size() == NumCounters,
+      llvm::formatv("Expected {0} counter values, got {1}.", NumCounters,
+                    Counters.size())));
+  llvm::DenseMap<const llvm::MachineBasicBlock *, uint64_t> Out;
+  for (const MachineFunctionEdgeProfile &FuncProfile : Functions) {
+    auto BlockCounts = luthier::reconstructBlockCounts(
+        FuncProfile.Placement,
+        Counters.slice(FuncProfile.FirstCounter,
+                       FuncProfile.Placement.CounterEdges.size()));
+    LUTHIER_RETURN_ON_ERROR(BlockCounts.takeError());
+    for (size_t I = 0; I < FuncProfile.Blocks.size(); ++I)
+      Out.insert({FuncProfile.Blocks[I], (*BlockCounts)[I]});
+  }
+  return Out;
+}
+
+} // namespace luthier
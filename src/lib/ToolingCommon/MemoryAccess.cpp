@@ -0,0 +1,256 @@
+//===-- MemoryAccess.cpp --------------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements decoding of the memory accesses performed by
+/// FLAT, GLOBAL, SCRATCH, buffer and DS instructions.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/MemoryAccess.h"
+#include "LuthierMemoryAccessInfo.hpp"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include <GCNSubtarget.h>
+#include <SIInstrInfo.h>
+#include <SIMachineFunctionInfo.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Support/FormatVariadic.h>
+
+namespace luthier {
+
+llvm::SmallVector<std::variant<llvm::Constant *, llvm::MCRegister>, 8>
+MemoryAccess::getHookArgs(llvm::LLVMContext &Ctx) const {
+  auto *I32 = llvm::Type::getInt32Ty(Ctx);
+  auto RegOrZero = [&](llvm::MCRegister Reg)
+      -> std::variant<llvm::Constant *, llvm::MCRegister> {
+    if (Reg.isValid())
+      return Reg;
+    return llvm::ConstantInt::get(I32, 0);
+  };
+  llvm::SmallVector<std::variant<llvm::Constant *, llvm::MCRegister>, 8> Args;
+  Args.push_back(llvm::ConstantInt::get(I32, Mode));
+  Args.push_back(RegOrZero(VAddr[0]));
+  Args.push_back(RegOrZero(VAddr[1]));
+  Args.push_back(RegOrZero(SBase[0]));
+  Args.push_back(RegOrZero(SBase[1]));
+  if (std::holds_alternative<llvm::MCRegister>(SOffset))
+    Args.push_back(RegOrZero(std::get<llvm::MCRegister>(SOffset)));
+  else
+    Args.push_back(llvm::ConstantInt::get(I32, std::get<uint32_t>(SOffset)));
+  Args.push_back(llvm::ConstantInt::getSigned(I32, Offset));
+  Args.push_back(llvm::ConstantInt::get(I32, Size));
+  return Args;
+}
+
+/// \return the size of the data accessed by each lane of \p MI, a memory
+/// instruction accessing a single address
+static llvm::Expected<uint32_t> getAccessSize(const llvm::MachineInstr &MI,
+                                              const llvm::SIInstrInfo &TII,
+                                              const llvm::SIRegisterInfo &TRI) {
+  // Sub-dword and compare-and-swap accesses do not access their whole data
+  // register; Their size is taken from the memory type of their selection
+  // patterns
+  MemoryAccessInfo Info = getMemoryAccessInfo(MI.getOpcode());
+  if (Info.MemorySize != 0)
+    return Info.MemorySize;
+
+  const llvm::MachineOperand *Data =
+      TII.getNamedOperand(MI, llvm::AMDGPU::OpName::vdata);
+  if (!Data)
+    Data = TII.getNamedOperand(MI, llvm::AMDGPU::OpName::vdst);
+  if (!Data)
+    Data = TII.getNamedOperand(MI, llvm::AMDGPU::OpName::data0);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Data != nullptr, llvm::formatv("Failed to find the access size of {0}.",
+                                     TII.getName(MI.getOpcode()))));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Data->isReg(), llvm::formatv("The data operand of {0} is not a register.",
+                                   TII.getName(MI.getOpcode()))));
+  uint32_t Size =
+      TRI.getRegSizeInBits(*TRI.getPhysRegBaseClass(Data->getReg())) / 8;
+  // The status dword returned by TFE loads is not part of the access
+  if (Info.IsTFE)
+    Size -= 4;
+  return Size;
+}
+
+/// \return \c true if \p Opcode is a DS instruction with two addresses
+/// whose offsets are in units of 64 elements
+static bool isDSStride64(unsigned Opcode) {
+  switch (Opcode) {
+  case llvm::AMDGPU::DS_READ2ST64_B32:
+  case llvm::AMDGPU::DS_READ2ST64_B32_gfx9:
+  case llvm::AMDGPU::DS_READ2ST64_B64:
+  case llvm::AMDGPU::DS_READ2ST64_B64_gfx9:
+  case llvm::AMDGPU::DS_WRITE2ST64_B32:
+  case llvm::AMDGPU::DS_WRITE2ST64_B32_gfx9:
+  case llvm::AMDGPU::DS_WRITE2ST64_B64:
+  case llvm::AMDGPU::DS_WRITE2ST64_B64_gfx9:
+    return true;
+  default:
+    return false;
+  }
+}
+
+llvm::Expected<llvm::SmallVector<MemoryAccess, 2>>
+decodeMemoryAccesses(const llvm::MachineInstr &MI) {
+  const auto &ST = MI.getMF()->getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  const auto &TRI = *ST.getRegisterInfo();
+  llvm::StringRef Name = TII.getName(MI.getOpcode());
+
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      MI.mayLoadOrStore(),
+      llvm::formatv("Instruction {0} does not access memory.", Name)));
+
+  // Returns the register of the named operand; Null if the operand is
+  // missing or is the null register
+  auto GetReg = [&](auto Operand) -> llvm::MCRegister {
+    const llvm::MachineOperand *Op = TII.getNamedOperand(MI, Operand);
+    if (!Op || !Op->isReg())
+      return {};
+    llvm::MCRegister Reg = Op->getReg().asMCReg();
+    if (Reg == llvm::AMDGPU::SGPR_NULL || Reg == llvm::AMDGPU::SGPR_NULL64)
+      return {};
+    return Reg;
+  };
+  auto GetImm = [&](auto Operand) -> int64_t {
+    const llvm::MachineOperand *Op = TII.getNamedOperand(MI, Operand);
+    return Op && Op->isImm() ? Op->getImm() : 0;
+  };
+  auto Split = [&](llvm::MCRegister Reg, llvm::MCRegister (&Halves)[2]) {
+    Halves[0] = TRI.getSubReg(Reg, llvm::AMDGPU::sub0);
+    Halves[1] = TRI.getSubReg(Reg, llvm::AMDGPU::sub1);
+  };
+
+  MemoryAccess Access;
+  if (llvm::SIInstrInfo::isFLAT(MI)) {
+    llvm::MCRegister VAddr = GetReg(llvm::AMDGPU::OpName::vaddr);
+    llvm::MCRegister SAddr = GetReg(llvm::AMDGPU::OpName::saddr);
+    if (llvm::SIInstrInfo::isFLATScratch(MI)) {
+      Access.Mode = MEM_ADDR_SCRATCH;
+      Access.VAddr[0] = VAddr;
+      Access.SBase[0] = SAddr;
+    } else if (SAddr.isValid()) {
+      Access.Mode = MEM_ADDR_GLOBAL_SADDR;
+      Access.VAddr[0] = VAddr;
+      Split(SAddr, Access.SBase);
+    } else {
+      LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+          VAddr.isValid(),
+          llvm::formatv("Failed to find the address operand of {0}.", Name)));
+      Access.Mode = MEM_ADDR_FLAT;
+      Split(VAddr, Access.VAddr);
+    }
+    Access.Offset = static_cast<int32_t>(GetImm(llvm::AMDGPU::OpName::offset));
+  } else if (llvm::SIInstrInfo::isMUBUF(MI) || llvm::SIInstrInfo::isMTBUF(MI)) {
+    BufferAddressingKind AddrKind =
+        getMemoryAccessInfo(MI.getOpcode()).BufferAddrKind;
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        AddrKind != BUF_ADDR_ADDR64,
+        llvm::formatv("64-bit buffer addressing used by {0} is not supported.",
+                      Name)));
+    llvm::MCRegister Rsrc = GetReg(llvm::AMDGPU::OpName::srsrc);
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        Rsrc.isValid(),
+        llvm::formatv("Failed to find the buffer resource of {0}.", Name)));
+    // The private segment buffer swizzles its accesses and adds the lane ID
+    // to their index, neither of which is described by the access
+    const auto &MFI = *MI.getMF()->getInfo<llvm::SIMachineFunctionInfo>();
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        Rsrc != MFI.getPreloadedReg(
+                    llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
+        llvm::formatv("Scratch access of {0} through the private segment "
+                      "buffer is not supported.",
+                      Name)));
+    Split(Rsrc, Access.SBase);
+    if (const auto *SOffset =
+            TII.getNamedOperand(MI, llvm::AMDGPU::OpName::soffset);
+        SOffset && SOffset->isImm())
+      Access.SOffset = static_cast<uint32_t>(SOffset->getImm());
+    else
+      Access.SOffset = GetReg(llvm::AMDGPU::OpName::soffset);
+    // Whether the vector address holds an index, an offset or both is
+    // encoded in the opcode
+    llvm::MCRegister VAddr = GetReg(llvm::AMDGPU::OpName::vaddr);
+    switch (AddrKind) {
+    case BUF_ADDR_BOTHEN:
+      Access.Mode = MEM_ADDR_BUFFER_BOTHEN;
+      Split(VAddr, Access.VAddr);
+      break;
+    case BUF_ADDR_IDXEN:
+      Access.Mode = MEM_ADDR_BUFFER_IDXEN;
+      Access.VAddr[0] = VAddr;
+      break;
+    case BUF_ADDR_OFFEN:
+      Access.Mode = MEM_ADDR_BUFFER_OFFEN;
+      Access.VAddr[1] = VAddr;
+      break;
+    default:
+      Access.Mode = MEM_ADDR_BUFFER;
+      break;
+    }
+    Access.Offset = static_cast<int32_t>(GetImm(llvm::AMDGPU::OpName::offset));
+  } else if (llvm::SIInstrInfo::isDS(MI)) {
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        !TII.isAlwaysGDS(MI.getOpcode()) &&
+            !TII.hasModifiersSet(MI, llvm::AMDGPU::OpName::gds),
+        llvm::formatv("GDS access of {0} is not supported.", Name)));
+    Access.Mode = MEM_ADDR_LDS;
+    Access.VAddr[0] = GetReg(llvm::AMDGPU::OpName::addr);
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        Access.VAddr[0].isValid(),
+        llvm::formatv("Failed to find the address operand of {0}.", Name)));
+    if (llvm::AMDGPU::hasNamedOperand(MI.getOpcode(),
+                                      llvm::AMDGPU::OpName::offset0)) {
+      // Instructions with two addresses scale their offsets by the size of
+      // each element, or by 64 elements for the ST64 variants; Each element
+      // is held by one of the data operands, or by half of the destination
+      const llvm::MachineOperand *Data =
+          TII.getNamedOperand(MI, llvm::AMDGPU::OpName::data0);
+      unsigned NumElements = 1;
+      if (!Data) {
+        Data = TII.getNamedOperand(MI, llvm::AMDGPU::OpName::vdst);
+        NumElements = 2;
+      }
+      LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+          Data && Data->isReg(),
+          llvm::formatv("Failed to find the data operand of {0}.", Name)));
+      Access.Size =
+          TRI.getRegSizeInBits(*TRI.getPhysRegBaseClass(Data->getReg())) / 8 /
+          NumElements;
+      int32_t Scale = isDSStride64(MI.getOpcode()) ? 64 * Access.Size
+                                                   : Access.Size;
+      MemoryAccess Second = Access;
+      Access.Offset =
+          static_cast<int32_t>(GetImm(llvm::AMDGPU::OpName::offset0) * Scale);
+      Second.Offset =
+          static_cast<int32_t>(GetImm(llvm::AMDGPU::OpName::offset1) * Scale);
+      return llvm::SmallVector<MemoryAccess, 2>{Access, Second};
+    }
+    Access.Offset = static_cast<int32_t>(GetImm(llvm::AMDGPU::OpName::offset));
+  } else {
+    return LUTHIER_MAKE_GENERIC_ERROR(llvm::formatv(
+        "Instruction {0} is not a FLAT, GLOBAL, SCRATCH, buffer or DS "
+        "instruction.",
+        Name));
+  }
+  llvm::Expected<uint32_t> SizeOrErr = getAccessSize(MI, TII, TRI);
+  LUTHIER_RETURN_ON_ERROR(SizeOrErr.takeError());
+  Access.Size = *SizeOrErr;
+  return llvm::SmallVector<MemoryAccess, 2>{Access};
+}
+
+} // namespace luthier
@@ -0,0 +1,312 @@
+//===-- OutlinedHookCallingConvPass.cpp -----------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the calling convention of outlined hooks and the
+/// Outlined Hook Calling Convention Pass.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/OutlinedHookCallingConvPass.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/consts.h"
+#include <algorithm>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/CodeGen/LivePhysRegs.h>
+#include <llvm/CodeGen/MachineFrameInfo.h>
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/CodeGen/MachineRegisterInfo.h>
+#include <llvm/CodeGen/TargetInstrInfo.h>
+#include <llvm/CodeGen/TargetOpcodes.h>
+#include <llvm/CodeGen/TargetRegisterInfo.h>
+#include <llvm/CodeGen/TargetSubtargetInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <optional>
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "luthier-outlined-hook-calling-conv"
+
+namespace luthier {
+
+char OutlinedHookCallingConvPass::ID = 0;
+
+static llvm::RegisterPass<OutlinedHookCallingConvPass>
+    X("outlined-hook-calling-conv", "Outlined Hook Calling Convention Pass",
+      true /* Only looks at CFG */, false /* Analysis Pass */);
+
+const llvm::Function *getOutlinedHookCallee(const llvm::MachineInstr &MI) {
+  if (!MI.isCall())
+    return nullptr;
+  for (const auto &MO : MI.operands()) {
+    if (!MO.isGlobal())
+      continue;
+    if (auto *Callee = llvm::dyn_cast<llvm::Function>(MO.getGlobal());
+        Callee && Callee->hasFnAttribute(OutlinedHookAttribute))
+      return Callee;
+  }
+  return nullptr;
+}
+
+llvm::BitVector
+getOutlinedHookClobberedRegs(const llvm::MachineFunction &HookMF) {
+  const auto &TRI = *HookMF.getSubtarget().getRegisterInfo();
+  unsigned NumRegs = TRI.getNumRegs();
+  // Clobbers are tracked in register units, so that a register is only
+  // considered preserved if all of its units are preserved
+  llvm::BitVector ClobberedUnits(TRI.getNumRegUnits());
+  auto SetUnits = [&](llvm::MCRegister Reg, bool Value) {
+    for (unsigned Unit : TRI.regunits(Reg))
+      ClobberedUnits[Unit] = Value;
+  };
+
+  for (const auto &MBB : HookMF) {
+    for (const auto &MI : MBB) {
+      for (const auto &MO : MI.operands()) {
+        if (MO.isReg() && MO.isDef() && MO.getReg().isPhysical()) {
+          SetUnits(MO.getReg(), true);
+        } else if (MO.isRegMask()) {
+          // Registers clobbered by the calls made by the hook
+          for (unsigned Reg = 1; Reg < NumRegs; ++Reg) {
+            if (MO.clobbersPhysReg(Reg))
+              SetUnits(Reg, true);
+          }
+        }
+      }
+    }
+  }
+
+  // Callee-saved registers are restored by the epilogue of the hook
+  for (const llvm::CalleeSavedInfo &CSI :
+       HookMF.getFrameInfo().getCalleeSavedInfo())
+    SetUnits(CSI.getReg(), false);
+
+  // Reserved registers (e.g. the stack and frame pointers, the scratch
+  // resource descriptor and the exec mask) are preserved by all functions
+  llvm::BitVector Reserved = TRI.getReservedRegs(HookMF);
+  for (unsigned Reg : Reserved.set_bits())
+    SetUnits(Reg, false);
+
+  llvm::BitVector Out(NumRegs);
+  for (unsigned Reg = 1; Reg < NumRegs; ++Reg) {
+    if (llvm::any_of(TRI.regunits(Reg),
+                     [&](unsigned Unit) { return ClobberedUnits[Unit]; }))
+      Out.set(Reg);
+  }
+  return Out;
+}
+
+llvm::Expected<llvm::SmallVector<llvm::MCRegister, 4>>
+emitOutlinedHookCallSaves(llvm::MachineInstr &CallMI,
+                          const llvm::BitVector &HookClobberedRegs) {
+  auto &MBB = *CallMI.getParent();
+  auto &MF = *MBB.getParent();
+  const auto &TRI = *MF.getSubtarget().getRegisterInfo();
+  const auto &TII = *MF.getSubtarget().getInstrInfo();
+  auto &MRI = MF.getRegInfo();
+  unsigned NumRegs = TRI.getNumRegs();
+
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      HookClobberedRegs.size() == NumRegs,
+      llvm::formatv("The hook clobbered register set has {0} registers, "
+                    "while the target has {1} registers.",
+                    HookClobberedRegs.size(), NumRegs)));
+
+  // Replace the register mask of the call with one that preserves every
+  // register not clobbered by the hook
+  uint32_t *Mask = MF.allocateRegMask();
+  for (unsigned Reg = 1; Reg < NumRegs; ++Reg) {
+    if (!HookClobberedRegs.test(Reg))
+      Mask[Reg / 32] |= 1u << (Reg % 32);
+  }
+  for (auto &MO : CallMI.operands()) {
+    if (MO.isRegMask())
+      MO.setRegMask(Mask);
+  }
+
+  // Find the physical registers live right after the call
+  llvm::LivePhysRegs LiveRegs(TRI);
+  LiveRegs.addLiveOutsNoPristines(MBB);
+  for (auto &MI : llvm::reverse(MBB)) {
+    if (&MI == &CallMI)
+      break;
+    LiveRegs.stepBackward(MI);
+  }
+
+  // Registers live after the call, clobbered by the hook and not defined by
+  // the call itself (e.g. its return address and return values) are live
+  // across the call and must be saved
+  llvm::SmallVector<llvm::MCRegister, 4> Candidates;
+  for (llvm::MCPhysReg Reg : LiveRegs) {
+    if (!HookClobberedRegs.test(Reg))
+      continue;
+    if (llvm::any_of(CallMI.operands(), [&](const llvm::MachineOperand &MO) {
+          return MO.isReg() && MO.isDef() && MO.getReg().isPhysical() &&
+                 TRI.regsOverlap(MO.getReg(), Reg);
+        }))
+      continue;
+    Candidates.push_back(Reg);
+  }
+  // Only save the largest live registers, and not their sub-registers
+  llvm::SmallVector<llvm::MCRegister, 4> SaveSet;
+  for (llvm::MCRegister Reg : Candidates) {
+    if (llvm::none_of(Candidates, [&](llvm::MCRegister Other) {
+          return Other != Reg && TRI.isSubRegister(Other, Reg);
+        }))
+      SaveSet.push_back(Reg);
+  }
+  llvm::sort(SaveSet);
+
+  for (llvm::MCRegister Reg : SaveSet) {
+    const auto *RegClass = TRI.getPhysRegBaseClass(Reg);
+    // Non-allocatable registers are saved in their cross-copy class
+    if (!TRI.isInAllocatableClass(Reg))
+      RegClass = RegClass ? TRI.getCrossCopyRegClass(RegClass) : nullptr;
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        RegClass != nullptr,
+        llvm::formatv("Failed to get a register class to save physical "
+                      "register {0} around the call to outlined hook {1}.",
+                      llvm::printReg(Reg, &TRI), CallMI)));
+    llvm::Register Storage = MRI.createVirtualRegister(RegClass);
+    llvm::BuildMI(MBB, CallMI, CallMI.getDebugLoc(),
+                  TII.get(llvm::TargetOpcode::COPY), Storage)
+        .addReg(Reg);
+    llvm::BuildMI(MBB, std::next(CallMI.getIterator()), CallMI.getDebugLoc(),
+                  TII.get(llvm::TargetOpcode::COPY), Reg)
+        .addReg(Storage, llvm::RegState::Kill);
+  }
+  return SaveSet;
+}
+
+/// Stack size in bytes assumed for callees whose machine code is not
+/// available, as well as for recursive and indirect calls; Matches the
+/// default the AMDGPU backend assumes for external calls
+static constexpr uint64_t AssumedUnknownCalleeStackSize = 16384;
+
+/// \return the stack size in bytes of \p F, including the frames of the
+/// functions it calls, with their machine functions looked up in \p MMI
+/// \param StackSizes memoized stack sizes of the functions visited so far;
+/// Functions still being visited map to \c std::nullopt
+static uint64_t getStackSizeWithCallees(
+    const llvm::Function &F, const llvm::MachineModuleInfo &MMI,
+    llvm::DenseMap<const llvm::Function *, std::optional<uint64_t>>
+        &StackSizes) {
+  auto [It, Inserted] = StackSizes.try_emplace(&F, std::nullopt);
+  if (!Inserted)
+    return It->second.value_or(AssumedUnknownCalleeStackSize);
+  const auto *MF = MMI.getMachineFunction(F);
+  if (!MF) {
+    StackSizes[&F] = AssumedUnknownCalleeStackSize;
+    return AssumedUnknownCalleeStackSize;
+  }
+  // Frames of callees are placed right after the frame of their caller
+  uint64_t CalleesStackSize{0};
+  for (const auto &MBB : *MF) {
+    for (const auto &MI : MBB) {
+      if (!MI.isCall())
+        continue;
+      const llvm::Function *Callee{nullptr};
+      for (const auto &MO : MI.operands()) {
+        if (MO.isGlobal() &&
+            (Callee = llvm::dyn_cast<llvm::Function>(MO.getGlobal())))
+          break;
+      }
+      CalleesStackSize = std::max(
+          CalleesStackSize, Callee ? getStackSizeWithCallees(*Callee, MMI,
+                                                             StackSizes)
+                                   : AssumedUnknownCalleeStackSize);
+    }
+  }
+  uint64_t Out = MF->getFrameInfo().getStackSize() + CalleesStackSize;
+  StackSizes[&F] = Out;
+  return Out;
+}
+
+uint64_t getOutlinedHookCallsStackSize(const llvm::MachineFunction &MF,
+                                       const llvm::MachineModuleInfo &MMI) {
+  llvm::DenseMap<const llvm::Function *, std::optional<uint64_t>> StackSizes;
+  uint64_t Out{0};
+  for (const auto &MBB : MF) {
+    for (const auto &MI : MBB) {
+      if (const llvm::Function *Hook = getOutlinedHookCallee(MI))
+        Out = std::max(Out, getStackSizeWithCallees(*Hook, MMI, StackSizes));
+    }
+  }
+  return Out;
+}
+
+bool OutlinedHookCallingConvPass::runOnMachineFunction(
+    llvm::MachineFunction &MF) {
+  // Only injected payloads call outlined hooks
+  if (!MF.getFunction().hasFnAttribute(InjectedPayloadAttribute))
+    return false;
+
+  const auto &MMI = getAnalysis<llvm::MachineModuleInfoWrapperPass>().getMMI();
+
+  llvm::SmallVector<llvm::MachineInstr *, 4> HookCalls;
+  for (auto &MBB : MF) {
+    for (auto &MI : MBB) {
+      if (getOutlinedHookCallee(MI))
+        HookCalls.push_back(&MI);
+    }
+  }
+
+  bool Changed{false};
+  llvm::DenseMap<const llvm::Function *, llvm::BitVector> HookClobberedRegs;
+  for (llvm::MachineInstr *CallMI : HookCalls) {
+    const llvm::Function &Hook = *getOutlinedHookCallee(*CallMI);
+    const auto *HookMF = MMI.getMachineFunction(Hook);
+    // The clobbered registers of the hook are only known after its
+    // prologue/epilogue has been inserted
+    if (!HookMF || !HookMF->getFrameInfo().isCalleeSavedInfoValid()) {
+      LLVM_DEBUG(llvm::dbgs()
+                     << "Outlined hook " << Hook.getName()
+                     << " has not been code generated yet; Keeping the "
+                        "default calling convention for its call in "
+                     << MF.getName() << ".\n";);
+      continue;
+    }
+    auto ClobberedIt = HookClobberedRegs.find(&Hook);
+    if (ClobberedIt == HookClobberedRegs.end())
+      ClobberedIt =
+          HookClobberedRegs
+              .insert({&Hook, getOutlinedHookClobberedRegs(*HookMF)})
+              .first;
+
+    auto SaveSet = emitOutlinedHookCallSaves(*CallMI, ClobberedIt->second);
+    if (auto Err = SaveSet.takeError()) {
+      MF.getContext().reportError({}, llvm::toString(std::move(Err)));
+      return false;
+    }
+    LLVM_DEBUG(
+        const auto *TRI = MF.getSubtarget().getRegisterInfo();
+        llvm::dbgs() << "Save set of the call to outlined hook "
+                     << Hook.getName() << " in " << MF.getName() << ":";
+        for (llvm::MCRegister Reg : *SaveSet) llvm::dbgs()
+        << " " << llvm::printReg(Reg, TRI);
+        llvm::dbgs() << "\n";);
+    Changed = true;
+  }
+  return Changed;
+}
+
+void OutlinedHookCallingConvPass::getAnalysisUsage(
+    llvm::AnalysisUsage &AU) const {
+  AU.addRequired<llvm::MachineModuleInfoWrapperPass>();
+  AU.setPreservesCFG();
+  llvm::MachineFunctionPass::getAnalysisUsage(AU);
+}
+
+} // namespace luthier
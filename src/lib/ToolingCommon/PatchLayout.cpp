@@ -0,0 +1,169 @@
+//===-- PatchLayout.cpp ---------------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements patch layout planning.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/PatchLayout.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include <algorithm>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FormatVariadic.h>
+
+namespace luthier {
+
+static llvm::cl::opt<unsigned> ShortBranchOffsetBits(
+    "luthier-short-branch-offset-bits", llvm::cl::Hidden,
+    llvm::cl::desc("Restrict the number of bits of short branch offsets used "
+                   "when patching injected payloads (for testing long "
+                   "jumps)."),
+    llvm::cl::init(16));
+
+uint64_t getShortBranchRange() {
+  // Short branches encode a signed offset in dwords from the end of the
+  // branch
+  return (uint64_t{1} << (ShortBranchOffsetBits + 1)) - 4;
+}
+
+llvm::Expected<llvm::SmallVector<PatchType>>
+planPatchLayout(llvm::ArrayRef<PatchSite> Sites,
+                llvm::ArrayRef<PatchBranch> Branches, uint64_t FunctionSize,
+                uint64_t BranchRange, bool OutlineAll) {
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      llvm::is_sorted(Sites,
+                      [](const PatchSite &LHS, const PatchSite &RHS) {
+                        return LHS.Offset < RHS.Offset;
+                      }),
+      "Patch sites are not sorted by their offset."));
+  llvm::SmallVector<PatchType> Types(Sites.size(),
+                                     OutlineAll ? OUTLINE : INLINE);
+  // Size of the code each site adds in place of its instrumentation point
+  auto InPlaceSize = [&](size_t I) -> uint64_t {
+    switch (Types[I]) {
+    case INLINE:
+      return Sites[I].PayloadSize;
+    case OUTLINE:
+      return ShortJumpSize;
+    case OUTLINE_LONG:
+      return LongJumpSize;
+    }
+    llvm_unreachable("Invalid patch type");
+  };
+  // Size of the code each site appends to the end of the function
+  auto OutlinedSize = [&](size_t I) -> uint64_t {
+    switch (Types[I]) {
+    case INLINE:
+      return 0;
+    case OUTLINE:
+      return Sites[I].PayloadSize + ShortJumpSize;
+    case OUTLINE_LONG:
+      return Sites[I].PayloadSize + LongJumpSize;
+    }
+    llvm_unreachable("Invalid patch type");
+  };
+  // Index of the first site at (or strictly after) offset O
+  auto FirstSiteAt = [&](uint64_t O, bool After) -> size_t {
+    if (After)
+      return std::distance(
+          Sites.begin(),
+          llvm::upper_bound(Sites, O, [](uint64_t Offset, const PatchSite &S) {
+            return Offset < S.Offset;
+          }));
+    return std::distance(
+        Sites.begin(),
+        llvm::lower_bound(Sites, O, [](const PatchSite &S, uint64_t Offset) {
+          return S.Offset < Offset;
+        }));
+  };
+
+  // Growth[I] is the number of bytes added before the I'th site
+  llvm::SmallVector<uint64_t> Growth(Sites.size() + 1, 0);
+  auto UpdateGrowth = [&]() {
+    for (size_t I = 0; I < Sites.size(); ++I)
+      Growth[I + 1] = Growth[I] + InPlaceSize(I);
+  };
+  // Every round only turns inlined payloads into outlined ones, or short
+  // jumps into long ones, so this reaches a fixed point
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    UpdateGrowth();
+
+    for (const PatchBranch &Branch : Branches) {
+      // Payloads of the branch are placed before it, while payloads of its
+      // target are placed after the label it jumps to
+      size_t BranchIdx = FirstSiteAt(Branch.Offset, true);
+      size_t TargetIdx = FirstSiteAt(Branch.TargetOffset, false);
+      uint64_t From = Branch.Offset + Growth[BranchIdx];
+      uint64_t To = Branch.TargetOffset + Growth[TargetIdx];
+      uint64_t Dist = From > To ? From - To : To - From;
+      if (Dist <= BranchRange)
+        continue;
+      // Outline the largest inlined payloads in between until the branch is
+      // back in range
+      size_t Begin = std::min(BranchIdx, TargetIdx);
+      size_t End = std::max(BranchIdx, TargetIdx);
+      llvm::SmallVector<size_t> Candidates;
+      for (size_t I = Begin; I < End; ++I) {
+        if (Types[I] == INLINE && Sites[I].PayloadSize > ShortJumpSize)
+          Candidates.push_back(I);
+      }
+      llvm::stable_sort(Candidates, [&](size_t LHS, size_t RHS) {
+        return Sites[LHS].PayloadSize > Sites[RHS].PayloadSize;
+      });
+      uint64_t Excess = Dist - BranchRange;
+      for (size_t I : Candidates) {
+        if (Excess == 0)
+          break;
+        Types[I] = OUTLINE;
+        Excess -= std::min(Excess, Sites[I].PayloadSize - ShortJumpSize);
+      }
+      LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+          Excess == 0,
+          llvm::formatv("The branch at offset {0:x} cannot reach its target "
+                        "at offset {1:x} after patching, even with all "
+                        "payloads in between outlined.",
+                        Branch.Offset, Branch.TargetOffset)));
+      // Keep the offsets seen by the remaining branches up to date
+      if (!Candidates.empty()) {
+        UpdateGrowth();
+        Changed = true;
+      }
+    }
+    if (Changed)
+      continue;
+
+    // Outlined payloads are appended to the end of the function in program
+    // order; Both the jump to the payload and the jump back must be in range
+    uint64_t OutlinedBegin = FunctionSize + Growth.back();
+    for (size_t I = 0; I < Sites.size(); ++I) {
+      if (Types[I] == INLINE)
+        continue;
+      uint64_t SiteOffset = Sites[I].Offset + Growth[I];
+      uint64_t OutlinedEnd = OutlinedBegin + OutlinedSize(I);
+      if (Types[I] == OUTLINE && OutlinedEnd - SiteOffset > BranchRange) {
+        Types[I] = OUTLINE_LONG;
+        Changed = true;
+      }
+      OutlinedBegin = OutlinedEnd;
+    }
+  }
+  return Types;
+}
+
+} // namespace luthier
@@ -18,11 +18,21 @@
 /// This file implements the Patch lifted representation pass.
 //===----------------------------------------------------------------------===//
 #include "luthier/Tooling/PatchLiftedRepresentationPass.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
 #include "luthier/LLVM/Cloning.h"
+#include "luthier/Tooling/AMDGPURegisterLiveness.h"
 #include "luthier/Tooling/IModuleIRGeneratorPass.h"
+#include "luthier/Tooling/PayloadOutlining.h"
+#include "luthier/Tooling/PhysRegsNotInLiveInsAnalysis.h"
+#include "luthier/Tooling/PrePostAmbleEmitter.h"
+#include "luthier/Tooling/RunMIRPassesOnIModulePass.h"
+#include "luthier/Tooling/SVStorageAndLoadLocations.h"
+#include "luthier/Tooling/StateValueArraySpecs.h"
 #include "luthier/Tooling/WrapperAnalysisPasses.h"
 #include "luthier/consts.h"
 #include <SIInstrInfo.h>
+#include <llvm/CodeGen/LivePhysRegs.h>
 #include <llvm/CodeGen/MachineBasicBlock.h>
 #include <llvm/CodeGen/MachineFrameInfo.h>
 #include <llvm/CodeGen/TargetRegisterInfo.h>
@@ -43,7 +53,7 @@ namespace luthier {
 static llvm::cl::opt<bool> OutlineAllInjectedPayloads(
     "luthier-outline-all-injected-payloads",
     llvm::cl::desc("Outline all injected payloads no matter the code size."),
-    llvm::cl::init(true));
+    llvm::cl::init(false));
 
 static void patchFrameInfo(const llvm::MachineFunction &InjectedPayloadMF,
                            llvm::MachineFunction &ToBeInstrumentedMF) {
@@ -113,110 +123,85 @@ static void patchFrameInfo(const llvm::MachineFunction &InjectedPayloadMF,
   }
 }
 
-llvm::DenseMap<const llvm::MachineFunction *,
-               PatchLiftedRepresentationPass::PatchType>
+llvm::Expected<llvm::DenseMap<const llvm::MachineInstr *, PatchType>>
 PatchLiftedRepresentationPass::decidePatchingMethod(
-    llvm::Module &TargetAppM, llvm::ModuleAnalysisManager &TargetMAM) {
+    llvm::Module &TargetAppM, llvm::ModuleAnalysisManager &TargetMAM,
+    llvm::ArrayRef<PayloadPatchSite> PatchSites) {
   // Analysis result output
-  llvm::DenseMap<const llvm::MachineFunction *, PatchType> Out;
+  llvm::DenseMap<const llvm::MachineInstr *, PatchType> Out;
   // Things we need for this analysis
-  auto &IModuleAnalysis =
-      *TargetMAM.getCachedResult<IModulePMAnalysis>(TargetAppM);
   auto &TargetMMI =
       TargetMAM.getResult<llvm::MachineModuleAnalysis>(TargetAppM).getMMI();
-  auto &IMAM = IModuleAnalysis.getMAM();
-  const auto &IPIP =
-      *IMAM.getCachedResult<InjectedPayloadAndInstPointAnalysis>(IModule);
-  // We need to estimate whether we can get away with outlining
-
-  // Mapping between branch instructions and their target MBBs
-  llvm::SmallDenseMap<const llvm::MachineInstr *,
-                      const llvm::MachineBasicBlock *, 8>
-      BranchToTargetMap;
-  // Mapping between branch instructions and their offset from the beginning
-  // of the function
-  llvm::SmallDenseMap<const llvm::MachineInstr *, uint64_t> BranchToOffsetMap;
-  // Mapping between the MBBs and their offset from the beginning of the
-  // function
-  llvm::SmallDenseMap<const llvm::MachineBasicBlock *, uint64_t>
-      MBBsToOffsetMap;
+  const uint64_t ShortBranchRange = getShortBranchRange();
+
+  llvm::DenseMap<const llvm::MachineInstr *, const llvm::MachineFunction *>
+      InsertionPointToPayloadMF;
+  for (const auto &Site : PatchSites)
+    InsertionPointToPayloadMF.insert({Site.InsertionPoint, Site.PayloadMF});
 
   for (const auto &TargetF : TargetAppM) {
-    if (auto *TargetMF = TargetMMI.getMachineFunction(TargetF)) {
-      const auto &TII = *TargetMF->getSubtarget().getInstrInfo();
-      /// Offset from the beginning of the MF; Accumulates anything from
-      /// the target app and the instructions we inject to the function
-      uint64_t MFBeginningOffset = 0;
-      for (const auto &MBB : *TargetMF) {
-        uint64_t MBBBeginningOffset = MFBeginningOffset;
-        MBBsToOffsetMap.insert({&MBB, MBBBeginningOffset});
-        for (const auto &MI : MBB) {
-          uint64_t InstSize = TII.getInstSizeInBytes(MI);
-          // If this is an instrumentation point, add the estimated size of the
-          // code being injected
-          if (IPIP.contains(MI)) {
-            uint64_t InjectedPayloadSize = IMMI.getMachineFunction(*IPIP.at(MI))
-                                               ->estimateFunctionSizeInBytes();
-            IModuleFuncSizes.insert(
-                {IMMI.getMachineFunction(*IPIP.at(MI)), InjectedPayloadSize});
-            MBBBeginningOffset += InjectedPayloadSize;
-          }
-          if (MI.isBranch() && !MI.isIndirectBranch()) {
-            if (auto TargetMBB = TII.getBranchDestBlock(MI)) {
-              BranchToTargetMap.insert({&MI, TargetMBB});
-              BranchToOffsetMap.insert({&MI, MBBBeginningOffset});
-            }
-          }
-          MBBBeginningOffset += InstSize;
+    auto *TargetMF = TargetMMI.getMachineFunction(TargetF);
+    if (!TargetMF)
+      continue;
+    const auto &TII = *TargetMF->getSubtarget().getInstrInfo();
+    // Lay out the function before patching
+    llvm::SmallVector<const llvm::MachineInstr *> SiteMIs;
+    llvm::SmallVector<PatchSite> Sites;
+    llvm::SmallVector<std::pair<uint64_t, const llvm::MachineBasicBlock *>>
+        BranchToTarget;
+    llvm::SmallDenseMap<const llvm::MachineBasicBlock *, uint64_t>
+        MBBsToOffsetMap;
+    uint64_t MFSize = 0;
+    for (const auto &MBB : *TargetMF) {
+      MBBsToOffsetMap.insert({&MBB, MFSize});
+      for (const auto &MI : MBB.instrs()) {
+        if (auto It = InsertionPointToPayloadMF.find(&MI);
+            It != InsertionPointToPayloadMF.end()) {
+          uint64_t InjectedPayloadSize =
+              It->second->estimateFunctionSizeInBytes();
+          IModuleFuncSizes.insert({It->second, InjectedPayloadSize});
+          SiteMIs.push_back(&MI);
+          Sites.push_back({MFSize, InjectedPayloadSize});
         }
-        MFBeginningOffset = MBBBeginningOffset;
-      }
-      // Now that we have the offset info, we can decide on the way we're going
-      // to patch the function
-      if (!OutlineAllInjectedPayloads) {
-        Out.insert({TargetMF, INLINE});
-        for (const auto &[Branch, Target] : BranchToTargetMap) {
-          uint64_t BranchOffset = BranchToOffsetMap[Branch];
-          uint64_t TargetOffset = MBBsToOffsetMap[Target];
-          uint64_t BranchDist = (BranchOffset > TargetOffset)
-                                    ? BranchOffset - TargetOffset
-                                    : TargetOffset - BranchOffset;
-          // If the branch can't make its target with the injected payload code
-          // inlined, break out of the loop
-          if (BranchDist > (1 << 18)) {
-            Out.insert({TargetMF, OUTLINE});
-          }
-        }
-      } else
-        Out.insert({TargetMF, OUTLINE});
-
-      // If the injected payload can't be inlined, we have to check what kind
-      // of branch we need to do to reach the injected payloads at the
-      // end of the function
-      if (Out.at(TargetMF) == OUTLINE) {
-        LLVM_DEBUG(llvm::dbgs()
-                       << "Have to outline MF " << TargetMF->getName() << "\n";
-                   llvm::dbgs() << "Size of the MF after patching: "
-                                << MFBeginningOffset << ".\n";);
-        // Take into account the s_branches we need to insert during outlining
-        MFBeginningOffset += IPIP.size() * 4;
-        LLVM_DEBUG(llvm::dbgs() << "Size of the MF after outlining: "
-                                << MFBeginningOffset << ".\n";);
-        if (MFBeginningOffset > (1 << 19)) {
-          llvm_unreachable(
-              "Have not yet implemented how to deal with big code.");
+        if (MI.isBranch() && !MI.isIndirectBranch()) {
+          if (auto *TargetMBB = TII.getBranchDestBlock(MI))
+            BranchToTarget.emplace_back(MFSize, TargetMBB);
         }
+        // The size of a bundle is accounted for by its instructions
+        if (!MI.isBundle())
+          MFSize += TII.getInstSizeInBytes(MI);
       }
     }
+    if (Sites.empty())
+      continue;
+    llvm::SmallVector<PatchBranch> Branches;
+    Branches.reserve(BranchToTarget.size());
+    for (const auto &[BranchOffset, TargetMBB] : BranchToTarget)
+      Branches.push_back({BranchOffset, MBBsToOffsetMap.at(TargetMBB)});
+
+    auto Types = planPatchLayout(Sites, Branches, MFSize, ShortBranchRange,
+                                 OutlineAllInjectedPayloads);
+    LUTHIER_RETURN_ON_ERROR(Types.takeError());
+    for (const auto &[MI, Type] : llvm::zip(SiteMIs, *Types))
+      Out.insert({MI, Type});
+
+    LLVM_DEBUG(llvm::dbgs()
+                   << "Patching " << Sites.size() << " payloads into MF "
+                   << TargetMF->getName() << " of size " << MFSize << ": "
+                   << llvm::count(*Types, INLINE) << " inlined, "
+                   << llvm::count(*Types, OUTLINE) << " outlined, "
+                   << llvm::count(*Types, OUTLINE_LONG)
+                   << " outlined with long jumps.\n";);
   }
   return Out;
 }
 
-void inlineInjectedPayload(const llvm::MachineFunction &InjectedPayloadMF,
-                           llvm::MachineInstr &InsertionPointMI,
-                           llvm::DenseMap<const llvm::MachineBasicBlock *,
-                                          llvm::MachineBasicBlock *> &MBBMap,
-                           const llvm::ValueToValueMapTy &VMap) {
+llvm::Error
+inlineInjectedPayload(const llvm::MachineFunction &InjectedPayloadMF,
+                      llvm::MachineInstr &InsertionPointMI,
+                      llvm::DenseMap<const llvm::MachineBasicBlock *,
+                                     llvm::MachineBasicBlock *> &MBBMap,
+                      const llvm::ValueToValueMapTy &VMap) {
   auto &InsertionPointMBB = *InsertionPointMI.getParent();
   auto &ToBeInstrumentedMF = *InsertionPointMI.getMF();
   // Number of return blocks in the hook
@@ -279,19 +264,12 @@ void inlineInjectedPayload(const llvm::MachineFunction &InjectedPayloadMF,
         auto *NewEntryBlock = ToBeInstrumentedMF.CreateMachineBasicBlock();
         ToBeInstrumentedMF.insert(HookLastReturnMBBDest->getIterator(),
                                   NewEntryBlock);
-        // First add the NewEntryBlock as a pred to all
-        // InsertionPointMBB's preds
-        llvm::SmallVector<llvm::MachineBasicBlock *, 2> PredMBBs;
-        for (auto It = InsertionPointMBB.pred_begin();
-             It != InsertionPointMBB.pred_end(); ++It) {
-          auto PredMBB = *It;
-          PredMBB->addSuccessor(NewEntryBlock);
-          PredMBBs.push_back(PredMBB);
-        }
-        // Remove the insertion point mbb from the PredMBB's successor
-        // list
+        // Redirect all of InsertionPointMBB's preds to the NewEntryBlock,
+        // including their branches
+        llvm::SmallVector<llvm::MachineBasicBlock *, 2> PredMBBs(
+            InsertionPointMBB.predecessors());
         for (auto &PredMBB : PredMBBs) {
-          PredMBB->removeSuccessor(&InsertionPointMBB);
+          PredMBB->ReplaceUsesOfBlockWith(&InsertionPointMBB, NewEntryBlock);
         }
         // Add the insertion point MBB as the successor of this block
         NewEntryBlock->addSuccessor(&InsertionPointMBB);
@@ -338,16 +316,8 @@ void inlineInjectedPayload(const llvm::MachineFunction &InjectedPayloadMF,
     }
   }
   // Finally, clone the instructions into the new MBBs
-  const llvm::TargetSubtargetInfo &STI = ToBeInstrumentedMF.getSubtarget();
-  const llvm::TargetInstrInfo *TII = STI.getInstrInfo();
-  const llvm::TargetRegisterInfo *TRI = STI.getRegisterInfo();
-  auto &TargetMFMRI = ToBeInstrumentedMF.getRegInfo();
-
-  llvm::DenseSet<const uint32_t *> ConstRegisterMasks;
-
-  // Track predefined/named regmasks which we ignore.
-  for (const uint32_t *Mask : TRI->getRegMasks())
-    ConstRegisterMasks.insert(Mask);
+  const llvm::TargetInstrInfo *TII =
+      ToBeInstrumentedMF.getSubtarget().getInstrInfo();
   for (const auto &MBB : InjectedPayloadMF) {
     auto *DstMBB = MBBMap[&MBB];
     llvm::MachineBasicBlock::iterator InsertionPoint;
@@ -364,56 +334,9 @@ void inlineInjectedPayload(const llvm::MachineFunction &InjectedPayloadMF,
       //        DstMBB->insert(InsertionPoint, DstMI);
       //        DstMI->addOperand(llvm::MachineOperand::CreateImm(0));
     }
-    for (auto &SrcMI : MBB.instrs()) {
-      if (MBB.isReturnBlock() && SrcMI.isTerminator()) {
-        break;
-      }
-      // Don't clone the bundle headers
-      if (SrcMI.isBundle())
-        continue;
-      const auto &MCID = TII->get(SrcMI.getOpcode());
-      // TODO: Properly import the debug location
-      auto *DstMI =
-          ToBeInstrumentedMF.CreateMachineInstr(MCID, llvm::DebugLoc(),
-                                                /*NoImplicit=*/true);
-      DstMI->setFlags(SrcMI.getFlags());
-      DstMI->setAsmPrinterFlag(SrcMI.getAsmPrinterFlags());
-      DstMBB->insert(InsertionPoint, DstMI);
-      for (auto &SrcMO : SrcMI.operands()) {
-        llvm::MachineOperand DstMO(SrcMO);
-        DstMO.clearParent();
-
-        // Update MBB.
-        if (DstMO.isMBB())
-          DstMO.setMBB(MBBMap[DstMO.getMBB()]);
-        else if (DstMO.isRegMask()) {
-          //          TargetMFMRI.addPhysRegsUsedFromRegMask(DstMO.getRegMask());
-
-          if (!ConstRegisterMasks.count(DstMO.getRegMask())) {
-            uint32_t *DstMask = ToBeInstrumentedMF.allocateRegMask();
-            std::memcpy(DstMask, SrcMO.getRegMask(),
-                        sizeof(*DstMask) * llvm::MachineOperand::getRegMaskSize(
-                                               TRI->getNumRegs()));
-            DstMO.setRegMask(DstMask);
-          }
-        } else if (DstMO.isGlobal()) {
-          auto GVEntry = VMap.find(DstMO.getGlobal());
-          if (GVEntry == VMap.end()) {
-            ToBeInstrumentedMF.getFunction()
-                .getParent()
-                ->getContext()
-                .emitError(
-                    llvm::formatv("Failed to find global variable {0} inside "
-                                  "the representation being patched.",
-                                  DstMO.getGlobal()));
-          }
-          auto *DestGV = cast<llvm::GlobalValue>(GVEntry->second);
-          DstMO.ChangeToGA(DestGV, DstMO.getOffset(), DstMO.getTargetFlags());
-        }
-
-        DstMI->addOperand(DstMO);
-      }
-    }
+    LUTHIER_RETURN_ON_ERROR(clonePayloadInstructions(MBB, *DstMBB,
+                                                     InsertionPoint, MBBMap,
+                                                     VMap));
     if (MBB.isReturnBlock() ||
         (MBB.isEntryBlock() && InjectedPayloadMF.size() == 1)) {
       //        auto *DstMI = ToBeInstrumentedMF.CreateMachineInstr(
@@ -427,160 +350,109 @@ void inlineInjectedPayload(const llvm::MachineFunction &InjectedPayloadMF,
                                      llvm::DebugLoc());
     }
   }
+  return llvm::Error::success();
 }
 
-void outlineInjectedPayload(const llvm::MachineFunction &InjectedPayloadMF,
-                            llvm::MachineInstr &InsertionPointMI,
-                            llvm::DenseMap<const llvm::MachineBasicBlock *,
-                                           llvm::MachineBasicBlock *> &MBBMap,
-                            const llvm::ValueToValueMapTy &VMap) {
-  auto &InsertionPointMBB = *InsertionPointMI.getParent();
-  auto &ToBeInstrumentedMF = *InsertionPointMI.getMF();
-  // The MBB that will jump to the beginning of the injected payload
-  llvm::MachineBasicBlock *JumpFromBlock{nullptr};
-  // The MBB that the injected payload return blocks will jump to
-  llvm::MachineBasicBlock *JumpToBlock{nullptr};
-
-  // Split the insertion point MBB right before the insertion point MI;
-  // if the MI is the first instruction in the MBB, then create a new block
-  // and insert it before the insertion point MBB
-  if (InsertionPointMI == InsertionPointMBB.begin()) {
-    JumpFromBlock = ToBeInstrumentedMF.CreateMachineBasicBlock();
-    ToBeInstrumentedMF.insert(InsertionPointMBB.getIterator(), JumpFromBlock);
-    // All the predecessors of InsertionPointMBB now become the JumpFromBlock's
-    // predecessors
-    for (auto &Pred :
-         llvm::make_early_inc_range(InsertionPointMBB.predecessors())) {
-      Pred->addSuccessor(JumpFromBlock);
-      if (Pred->isSuccessor(&InsertionPointMBB))
-        Pred->removeSuccessor(&InsertionPointMBB);
+/// Picks the registers used by the long jumps to and from the outlined
+/// injected payload of \p InstPoint; Neither may hold a value of the app,
+/// the state value array, or a register read by the hooks; Inside a run of
+/// state value array loads, the frame registers hold the instrumentation
+/// frame between the payloads of the run, and are not picked either
+static llvm::Expected<std::pair<llvm::MCRegister, llvm::MCRegister>>
+pickLongJumpRegsForInstPoint(const llvm::MachineInstr &InstPoint,
+                             const AMDGPURegisterLiveness &RegLiveness,
+                             const SVStorageAndLoadLocations &SVLocations,
+                             const llvm::LivePhysRegs &AccessedPhysRegs) {
+  const auto &MF = *InstPoint.getMF();
+  const llvm::LivePhysRegs *LiveIns =
+      RegLiveness.getMFLevelInstrLiveIns(InstPoint);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      LiveIns != nullptr,
+      llvm::formatv("Failed to get the live registers of an instrumentation "
+                    "point in function {0}.",
+                    MF.getName())));
+  llvm::LivePhysRegs UsedRegs(*MF.getSubtarget().getRegisterInfo());
+  for (llvm::MCPhysReg Reg : *LiveIns)
+    UsedRegs.addReg(Reg);
+  for (llvm::MCPhysReg Reg : AccessedPhysRegs)
+    UsedRegs.addReg(Reg);
+  if (const auto *LoadPlan =
+          SVLocations.getStateValueArrayLoadPlanForInstPoint(InstPoint)) {
+    llvm::SmallVector<llvm::MCRegister, 4> SVSRegs;
+    LoadPlan->StateValueStorageLocation.getAllStorageRegisters(SVSRegs);
+    for (llvm::MCRegister Reg : SVSRegs)
+      UsedRegs.addReg(Reg);
+    if (LoadPlan->isPartOfRun()) {
+      for (const auto &[PhysReg, SpillLane] :
+           stateValueArray::getFrameSpillSlots())
+        UsedRegs.addReg(PhysReg);
     }
-    // InsertionPointMBB will become the jump to block
-    JumpToBlock = &InsertionPointMBB;
-  } else {
-    JumpToBlock = InsertionPointMBB.splitAt(*InsertionPointMI.getPrevNode());
-    JumpFromBlock = &InsertionPointMBB;
   }
+  return pickLongJumpRegs(MF, UsedRegs, LiveIns->contains(llvm::AMDGPU::SCC));
+}
 
-  for (const auto &InjectedPayloadMBB : InjectedPayloadMF) {
-    // Create MBBs at the end of the function
-    auto *NewBlock = ToBeInstrumentedMF.CreateMachineBasicBlock();
-    ToBeInstrumentedMF.push_back(NewBlock);
-    MBBMap.insert({&InjectedPayloadMBB, NewBlock});
-    // If this is the entry block of the injected payload then it is
-    // the jump from block's direct successor
-    if (InjectedPayloadMBB.isEntryBlock()) {
-      JumpFromBlock->addSuccessor(NewBlock);
-    }
-    // If this is a return block of the injected payload then it is the jump to
-    // block's predecessor
-    if (InjectedPayloadMBB.isReturnBlock()) {
-      NewBlock->addSuccessor(JumpToBlock);
+llvm::PreservedAnalyses
+PatchLiftedRepresentationPass::run(llvm::Module &TargetAppM,
+                                   llvm::ModuleAnalysisManager &TargetMAM) {
+  // Gather the generated injected payloads of all code gen units
+  for (const auto &Unit : CodeGenResult.units()) {
+    for (const auto &[InsertionPointMI, InjectedPayloadFunc] :
+         Unit.IPIP.mi_payload()) {
+      // Payloads compiled by another unit only have a declaration here
+      if (const auto *InjectedPayloadMF =
+              Unit.IMMI.getMachineFunction(*InjectedPayloadFunc))
+        InstPointToPayloadMF.insert({InsertionPointMI, InjectedPayloadMF});
     }
   }
 
-  // Link blocks
-  for (auto &InjectedPayloadMBB : InjectedPayloadMF) {
-    auto *DstMBB = MBBMap[&InjectedPayloadMBB];
-    for (const auto &IPSucc : InjectedPayloadMBB.successors()) {
-      auto *DstSuccMBB = MBBMap[IPSucc];
-      if (!DstMBB->isSuccessor(DstSuccMBB))
-        DstMBB->addSuccessor(DstSuccMBB);
-    }
-  }
-  // Finally, clone the instructions into the new MBBs
-  const llvm::TargetSubtargetInfo &STI = ToBeInstrumentedMF.getSubtarget();
-  const llvm::TargetInstrInfo *TII = STI.getInstrInfo();
-  const llvm::TargetRegisterInfo *TRI = STI.getRegisterInfo();
-  auto &TargetMFMRI = ToBeInstrumentedMF.getRegInfo();
+  llvm::TimeTraceScope Scope("Lifted Representation Patching");
 
-  llvm::DenseSet<const uint32_t *> ConstRegisterMasks;
+  auto &TargetMMI =
+      TargetMAM.getResult<llvm::MachineModuleAnalysis>(TargetAppM).getMMI();
 
-  // Track predefined/named regmasks which we ignore.
-  for (const uint32_t *Mask : TRI->getRegMasks())
-    ConstRegisterMasks.insert(Mask);
-  for (const auto &MBB : InjectedPayloadMF) {
-    auto *DstMBB = MBBMap[&MBB];
-    llvm::MachineBasicBlock::iterator InsertionPoint = DstMBB->end();
-    [&]() {
-      for (auto &SrcMI : MBB.instrs()) {
-        if (MBB.isReturnBlock() && SrcMI.isTerminator()) {
-          break;
-        }
-        // Don't clone the bundle headers
-        if (SrcMI.isBundle())
-          continue;
-        const auto &MCID = TII->get(SrcMI.getOpcode());
-        // TODO: Properly import the debug location
-        auto *DstMI =
-            ToBeInstrumentedMF.CreateMachineInstr(MCID, llvm::DebugLoc(),
-                                                  /*NoImplicit=*/true);
-        DstMI->setFlags(SrcMI.getFlags());
-        DstMI->setAsmPrinterFlag(SrcMI.getAsmPrinterFlags());
-        DstMBB->insert(InsertionPoint, DstMI);
-        for (auto &SrcMO : SrcMI.operands()) {
-          llvm::MachineOperand DstMO(SrcMO);
-          DstMO.clearParent();
-
-          // Update MBB.
-          if (DstMO.isMBB())
-            DstMO.setMBB(MBBMap[DstMO.getMBB()]);
-          else if (DstMO.isRegMask()) {
-            TargetMFMRI.addPhysRegsUsedFromRegMask(DstMO.getRegMask());
-
-            if (!ConstRegisterMasks.count(DstMO.getRegMask())) {
-              uint32_t *DstMask = ToBeInstrumentedMF.allocateRegMask();
-              std::memcpy(
-                  DstMask, SrcMO.getRegMask(),
-                  sizeof(*DstMask) *
-                      llvm::MachineOperand::getRegMaskSize(TRI->getNumRegs()));
-              DstMO.setRegMask(DstMask);
-            }
-          } else if (DstMO.isGlobal()) {
-            auto GVEntry = VMap.find(DstMO.getGlobal());
-            if (GVEntry == VMap.end()) {
-              ToBeInstrumentedMF.getFunction()
-                  .getParent()
-                  ->getContext()
-                  .emitError(
-                      llvm::formatv("Failed to find global variable {0} inside "
-                                    "the representation being patched.",
-                                    DstMO.getGlobal()));
-            }
-            auto *DestGV = cast<llvm::GlobalValue>(GVEntry->second);
-            DstMO.ChangeToGA(DestGV, DstMO.getOffset(), DstMO.getTargetFlags());
-          }
+  const auto &PreambleDescriptor =
+      *TargetMAM.getCachedResult<FunctionPreambleDescriptorAnalysis>(
+          TargetAppM);
 
-          DstMI->addOperand(DstMO);
+  // Patch the instrumentation points in program order, so that the
+  // instrumented code does not depend on how the injected payloads were
+  // generated
+  llvm::SmallVector<PayloadPatchSite> PatchSites;
+  PatchSites.reserve(InstPointToPayloadMF.size());
+  for (const auto &TargetF : TargetAppM) {
+    if (auto *TargetMF = TargetMMI.getMachineFunction(TargetF)) {
+      for (auto &MBB : *TargetMF) {
+        for (auto &MI : MBB.instrs()) {
+          if (auto It = InstPointToPayloadMF.find(&MI);
+              It != InstPointToPayloadMF.end()) {
+            // Payloads of an s_endpgm must run before the LDS-staged counters
+            // are flushed
+            auto Flush = PreambleDescriptor.LDSCounterFlushes.find(&MI);
+            PatchSites.push_back(
+                {Flush != PreambleDescriptor.LDSCounterFlushes.end()
+                     ? Flush->second
+                     : &MI,
+                 &MI, It->second});
+          }
         }
       }
-    }();
-    if (MBB.isEntryBlock()) {
-      TII->insertUnconditionalBranch(*JumpFromBlock, DstMBB, llvm::DebugLoc());
-    }
-    if (MBB.isReturnBlock()) {
-      TII->insertUnconditionalBranch(*DstMBB, JumpToBlock, llvm::DebugLoc());
     }
   }
-}
-
-llvm::PreservedAnalyses
-PatchLiftedRepresentationPass::run(llvm::Module &TargetAppM,
-                                   llvm::ModuleAnalysisManager &TargetMAM) {
-  auto PatchMethods = decidePatchingMethod(TargetAppM, TargetMAM);
-  llvm::TimeTraceScope Scope("Lifted Representation Patching");
-
-  auto &IModuleAnalysis =
-      *TargetMAM.getCachedResult<IModulePMAnalysis>(TargetAppM);
-
-  auto &IModule = IModuleAnalysis.getModule();
-  auto &IMAM = IModuleAnalysis.getMAM();
 
-  const auto &IPIP =
-      *IMAM.getCachedResult<InjectedPayloadAndInstPointAnalysis>(IModule);
-
-  auto &TargetMMI =
-      TargetMAM.getResult<llvm::MachineModuleAnalysis>(TargetAppM).getMMI();
+  auto PatchMethods = decidePatchingMethod(TargetAppM, TargetMAM, PatchSites);
+  LUTHIER_REPORT_FATAL_ON_ERROR(PatchMethods.takeError());
+
+  // Registers the long jumps to outlined injected payloads must not clobber
+  const auto &RegLiveness =
+      TargetMAM.getResult<AMDGPURegLivenessAnalysis>(TargetAppM);
+  const auto &SVLocations =
+      TargetMAM.getResult<LRStateValueStorageAndLoadLocationsAnalysis>(
+          TargetAppM);
+  auto &IMAM =
+      TargetMAM.getCachedResult<IModulePMAnalysis>(TargetAppM)->getMAM();
+  const auto &AccessedPhysRegs =
+      IMAM.getResult<PhysRegsNotInLiveInsAnalysis>(IModule)
+          .getPhysRegsNotInLiveIns();
 
   // A mapping between Global Variables in the instrumentation module and
   // their corresponding Global Variables in the instrumented code
@@ -588,6 +460,11 @@ PatchLiftedRepresentationPass::run(llvm::Module &TargetAppM,
   // Clone the instrumentation module Global Variables into the instrumented
   // code
   for (const auto &GV : IModule.globals()) {
+    // Counters staged in LDS were already declared by the pre-amble emitter
+    if (PreambleDescriptor.LDSCounterOffsets.contains(GV.getName())) {
+      VMap[&GV] = TargetAppM.getNamedGlobal(GV.getName());
+      continue;
+    }
     auto *NewGV = new llvm::GlobalVariable(
         TargetAppM, GV.getValueType(), GV.isConstant(), GV.getLinkage(),
         nullptr, GV.getName(), nullptr, GV.getThreadLocalMode(),
@@ -596,35 +473,68 @@ PatchLiftedRepresentationPass::run(llvm::Module &TargetAppM,
     VMap[&GV] = NewGV;
   }
 
-  // Clone only the definition of functions that are not injected payloads
-  for (const auto &F : IModule.functions()) {
-    if (IMMI.getMachineFunction(F) != nullptr &&
-        !F.hasFnAttribute(HookAttribute) &&
-        !F.hasFnAttribute(InjectedPayloadAttribute)) {
-      auto *NewF = llvm::Function::Create(
-          llvm::cast<llvm::FunctionType>(F.getValueType()), F.getLinkage(),
-          F.getAddressSpace(), F.getName(), &TargetAppM);
-      llvm::BasicBlock *BB =
-          llvm::BasicBlock::Create(TargetAppM.getContext(), "", NewF);
-      new llvm::UnreachableInst(TargetAppM.getContext(), BB);
-      VMap[&F] = NewF;
-      auto NewMF = cloneMF(IMMI.getMachineFunction(F), VMap, TargetMMI);
-      LUTHIER_REPORT_FATAL_ON_ERROR(NewMF.takeError());
-      LLVM_DEBUG(llvm::dbgs() << "Found non-hook function. Patched contents:\n";
-                 NewMF->get()->print(llvm::dbgs()););
-      TargetMMI.insertFunction(*NewF, std::move(*NewMF));
+  // Create the functions that are not injected payloads
+  llvm::SmallVector<std::pair<const llvm::MachineFunction *, llvm::Function *>>
+      NonPayloadMFs;
+  for (const auto &Unit : CodeGenResult.units()) {
+    for (const auto &UnitF : Unit.IModule.functions()) {
+      const auto *F = IModule.getFunction(UnitF.getName());
+      if (F != nullptr && !VMap.count(F) &&
+          Unit.IMMI.getMachineFunction(UnitF) != nullptr &&
+          !F->hasFnAttribute(HookAttribute) &&
+          !F->hasFnAttribute(InjectedPayloadAttribute)) {
+        auto *NewF = llvm::Function::Create(
+            llvm::cast<llvm::FunctionType>(F->getValueType()), F->getLinkage(),
+            F->getAddressSpace(), F->getName(), &TargetAppM);
+        llvm::BasicBlock *BB =
+            llvm::BasicBlock::Create(TargetAppM.getContext(), "", NewF);
+        new llvm::UnreachableInst(TargetAppM.getContext(), BB);
+        VMap[F] = NewF;
+        NonPayloadMFs.emplace_back(Unit.IMMI.getMachineFunction(UnitF), NewF);
+      }
     }
   }
 
-  for (const auto &[InsertionPointMI, InjectedPayloadFunc] :
-       IPIP.mi_payload()) {
+  // Units compiled outside the instrumentation module refer to their own
+  // copies of the globals; Map them to the instrumented code by name
+  llvm::SmallVector<std::unique_ptr<llvm::ValueToValueMapTy>> UnitVMaps;
+  llvm::DenseMap<const llvm::Module *, const llvm::ValueToValueMapTy *>
+      ModuleVMaps;
+  ModuleVMaps.insert({&IModule, &VMap});
+  for (const auto &Unit : CodeGenResult.units()) {
+    if (ModuleVMaps.contains(&Unit.IModule))
+      continue;
+    auto &UnitVMap =
+        *UnitVMaps.emplace_back(std::make_unique<llvm::ValueToValueMapTy>());
+    for (const auto &UnitGV : Unit.IModule.global_values()) {
+      if (const auto *GV = IModule.getNamedValue(UnitGV.getName())) {
+        if (auto It = VMap.find(GV); It != VMap.end())
+          UnitVMap[&UnitGV] = It->second;
+      }
+    }
+    ModuleVMaps.insert({&Unit.IModule, &UnitVMap});
+  }
+
+  // Clone only the definition of functions that are not injected payloads
+  for (const auto &[MF, NewF] : NonPayloadMFs) {
+    auto NewMF =
+        cloneMF(MF, *ModuleVMaps.at(MF->getFunction().getParent()), TargetMMI);
+    LUTHIER_REPORT_FATAL_ON_ERROR(NewMF.takeError());
+    LLVM_DEBUG(llvm::dbgs() << "Found non-hook function. Patched contents:\n";
+               NewMF->get()->print(llvm::dbgs()););
+    TargetMMI.insertFunction(*NewF, std::move(*NewMF));
+  }
+
+  for (const auto &[InsertionPointMI, InstPoint, InjectedPayloadMFPtr] :
+       PatchSites) {
     // A mapping between a machine basic block in the instrumentation MMI
     // and its destination in the patched instrumented code
     llvm::DenseMap<const llvm::MachineBasicBlock *, llvm::MachineBasicBlock *>
         MBBMap;
 
-    const auto &InjectedPayloadMF =
-        *IMMI.getMachineFunction(*InjectedPayloadFunc);
+    const auto &InjectedPayloadMF = *InjectedPayloadMFPtr;
+    const auto &PayloadVMap =
+        *ModuleVMaps.at(InjectedPayloadMF.getFunction().getParent());
     auto &InsertionPointMBB = *InsertionPointMI->getParent();
     auto &ToBeInstrumentedMF = *InsertionPointMBB.getParent();
 
@@ -632,11 +542,45 @@ PatchLiftedRepresentationPass::run(llvm::Module &TargetAppM,
     patchFrameInfo(InjectedPayloadMF, ToBeInstrumentedMF);
 
     // Clone the MBBs
-    if (PatchMethods.at(&ToBeInstrumentedMF) == INLINE) {
-      inlineInjectedPayload(InjectedPayloadMF, *InsertionPointMI, MBBMap, VMap);
+    PatchType Method = PatchMethods->at(InsertionPointMI);
+    if (Method == INLINE) {
+      LUTHIER_REPORT_FATAL_ON_ERROR(inlineInjectedPayload(
+          InjectedPayloadMF, *InsertionPointMI, MBBMap, PayloadVMap));
     } else {
-      outlineInjectedPayload(InjectedPayloadMF, *InsertionPointMI, MBBMap,
-                             VMap);
+      llvm::MCRegister LongJumpPCReg;
+      llvm::MCRegister SCCSaveReg;
+      if (Method == OUTLINE_LONG) {
+        auto Regs = pickLongJumpRegsForInstPoint(*InstPoint, RegLiveness,
+                                                 SVLocations, AccessedPhysRegs);
+        LUTHIER_REPORT_FATAL_ON_ERROR(Regs.takeError());
+        std::tie(LongJumpPCReg, SCCSaveReg) = *Regs;
+      }
+      LUTHIER_REPORT_FATAL_ON_ERROR(
+          outlineInjectedPayload(InjectedPayloadMF, *InsertionPointMI, MBBMap,
+                                 PayloadVMap, LongJumpPCReg, SCCSaveReg));
+    }
+  }
+
+  // Resolve the references of the patched payloads to the LDS copies of the
+  // staged counters into their LDS offsets
+  if (!PreambleDescriptor.LDSCounterOffsets.empty()) {
+    for (const auto &TargetF : TargetAppM) {
+      auto *TargetMF = TargetMMI.getMachineFunction(TargetF);
+      if (!TargetMF)
+        continue;
+      for (auto &MBB : *TargetMF) {
+        for (auto &MI : MBB) {
+          for (auto &MO : MI.operands()) {
+            if (!MO.isGlobal() ||
+                MO.getTargetFlags() != llvm::SIInstrInfo::MO_ABS32_LO)
+              continue;
+            if (auto It = PreambleDescriptor.LDSCounterOffsets.find(
+                    MO.getGlobal()->getName());
+                It != PreambleDescriptor.LDSCounterOffsets.end())
+              MO.ChangeToImmediate(It->second + MO.getOffset());
+          }
+        }
+      }
     }
   }
   return llvm::PreservedAnalyses::all();
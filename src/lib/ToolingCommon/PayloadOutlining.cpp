@@ -0,0 +1,277 @@
+//===-- PayloadOutlining.cpp ----------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the outlining of injected payloads.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/PayloadOutlining.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/Tooling/MIRConvenience.h"
+#include <SIInstrInfo.h>
+#include <cstring>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/CodeGen/LivePhysRegs.h>
+#include <llvm/CodeGen/MachineFunction.h>
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/CodeGen/TargetRegisterInfo.h>
+#include <llvm/CodeGen/TargetSubtargetInfo.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/MCContext.h>
+#include <llvm/MC/MCExpr.h>
+#include <llvm/Support/FormatVariadic.h>
+
+namespace luthier {
+
+llvm::Expected<std::pair<llvm::MCRegister, llvm::MCRegister>>
+pickLongJumpRegs(const llvm::MachineFunction &MF, llvm::LivePhysRegs &UsedRegs,
+                 bool IsSCCLive) {
+  auto PCReg = pickFreePhysReg(MF, llvm::AMDGPU::SGPR_64RegClass, UsedRegs);
+  LUTHIER_RETURN_ON_ERROR(PCReg.takeError());
+  llvm::MCRegister SCCSaveReg;
+  if (IsSCCLive) {
+    auto Reg = pickFreePhysReg(MF, llvm::AMDGPU::SGPR_32RegClass, UsedRegs);
+    LUTHIER_RETURN_ON_ERROR(Reg.takeError());
+    SCCSaveReg = *Reg;
+  }
+  return std::make_pair(*PCReg, SCCSaveReg);
+}
+
+/// Inserts a long jump to \p DestMBB at the end of \p MBB, the same way
+/// branch relaxation does, using \p PCReg to compute the jump target;
+/// If \p SCCSaveReg is valid, SCC is saved into it before the jump, as the
+/// jump target computation clobbers SCC
+static void insertLongJump(llvm::MachineBasicBlock &MBB,
+                           llvm::MachineBasicBlock &DestMBB,
+                           llvm::MCRegister PCReg,
+                           llvm::MCRegister SCCSaveReg) {
+  auto &MF = *MBB.getParent();
+  const auto &TII = *MF.getSubtarget().getInstrInfo();
+  const auto &TRI = *MF.getSubtarget().getRegisterInfo();
+  auto &MCCtx = MF.getContext();
+  llvm::MCRegister PCRegLo = TRI.getSubReg(PCReg, llvm::AMDGPU::sub0);
+  llvm::MCRegister PCRegHi = TRI.getSubReg(PCReg, llvm::AMDGPU::sub1);
+
+  if (SCCSaveReg.isValid()) {
+    llvm::BuildMI(MBB, MBB.end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_CSELECT_B32), SCCSaveReg)
+        .addImm(1)
+        .addImm(0);
+  }
+  auto *GetPC = llvm::BuildMI(MBB, MBB.end(), llvm::DebugLoc(),
+                              TII.get(llvm::AMDGPU::S_GETPC_B64), PCReg)
+                    .getInstr();
+  llvm::MCSymbol *PostGetPCLabel =
+      MCCtx.createTempSymbol("luthier_post_getpc", true);
+  GetPC->setPostInstrSymbol(MF, PostGetPCLabel);
+  llvm::MCSymbol *OffsetLo = MCCtx.createTempSymbol("luthier_offset_lo", true);
+  llvm::MCSymbol *OffsetHi = MCCtx.createTempSymbol("luthier_offset_hi", true);
+  llvm::BuildMI(MBB, MBB.end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_ADD_U32), PCRegLo)
+      .addReg(PCRegLo)
+      .addSym(OffsetLo, llvm::SIInstrInfo::MO_FAR_BRANCH_OFFSET);
+  llvm::BuildMI(MBB, MBB.end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_ADDC_U32), PCRegHi)
+      .addReg(PCRegHi)
+      .addSym(OffsetHi, llvm::SIInstrInfo::MO_FAR_BRANCH_OFFSET);
+  llvm::BuildMI(MBB, MBB.end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_SETPC_B64))
+      .addReg(PCReg, llvm::RegState::Kill);
+
+  // The offset is only known once the code is laid out
+  auto *Offset = llvm::MCBinaryExpr::createSub(
+      llvm::MCSymbolRefExpr::create(DestMBB.getSymbol(), MCCtx),
+      llvm::MCSymbolRefExpr::create(PostGetPCLabel, MCCtx), MCCtx);
+  OffsetLo->setVariableValue(llvm::MCBinaryExpr::createAnd(
+      Offset, llvm::MCConstantExpr::create(0xFFFFFFFFULL, MCCtx), MCCtx));
+  OffsetHi->setVariableValue(llvm::MCBinaryExpr::createAShr(
+      Offset, llvm::MCConstantExpr::create(32, MCCtx), MCCtx));
+}
+
+/// Restores SCC saved in \p SCCSaveReg by \c insertLongJump at the
+/// beginning of \p MBB
+static void restoreSCCAfterLongJump(llvm::MachineBasicBlock &MBB,
+                                    llvm::MCRegister SCCSaveReg) {
+  const auto &TII = *MBB.getParent()->getSubtarget().getInstrInfo();
+  llvm::BuildMI(MBB, MBB.begin(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_CMP_LG_U32))
+      .addReg(SCCSaveReg, llvm::RegState::Kill)
+      .addImm(0);
+}
+
+llvm::Error clonePayloadInstructions(
+    const llvm::MachineBasicBlock &PayloadMBB, llvm::MachineBasicBlock &DstMBB,
+    llvm::MachineBasicBlock::iterator InsertionPoint,
+    const llvm::DenseMap<const llvm::MachineBasicBlock *,
+                         llvm::MachineBasicBlock *> &MBBMap,
+    const llvm::ValueToValueMapTy &VMap) {
+  auto &DstMF = *DstMBB.getParent();
+  const llvm::TargetSubtargetInfo &STI = DstMF.getSubtarget();
+  const llvm::TargetInstrInfo *TII = STI.getInstrInfo();
+  const llvm::TargetRegisterInfo *TRI = STI.getRegisterInfo();
+
+  // Track predefined/named regmasks which we ignore.
+  llvm::DenseSet<const uint32_t *> ConstRegisterMasks;
+  for (const uint32_t *Mask : TRI->getRegMasks())
+    ConstRegisterMasks.insert(Mask);
+
+  for (const auto &SrcMI : PayloadMBB.instrs()) {
+    if (PayloadMBB.isReturnBlock() && SrcMI.isTerminator())
+      break;
+    // Don't clone the bundle headers
+    if (SrcMI.isBundle())
+      continue;
+    const auto &MCID = TII->get(SrcMI.getOpcode());
+    // TODO: Properly import the debug location
+    auto *DstMI = DstMF.CreateMachineInstr(MCID, llvm::DebugLoc(),
+                                           /*NoImplicit=*/true);
+    DstMI->setFlags(SrcMI.getFlags());
+    DstMI->setAsmPrinterFlag(SrcMI.getAsmPrinterFlags());
+    DstMBB.insert(InsertionPoint, DstMI);
+    for (const auto &SrcMO : SrcMI.operands()) {
+      llvm::MachineOperand DstMO(SrcMO);
+      DstMO.clearParent();
+
+      // Update MBB.
+      if (DstMO.isMBB())
+        DstMO.setMBB(MBBMap.lookup(DstMO.getMBB()));
+      else if (DstMO.isRegMask()) {
+        // The registers clobbered by the calls of the payload are not marked
+        // as used in the instrumented function, as they would count towards
+        // its register usage
+        if (!ConstRegisterMasks.count(DstMO.getRegMask())) {
+          uint32_t *DstMask = DstMF.allocateRegMask();
+          std::memcpy(DstMask, SrcMO.getRegMask(),
+                      sizeof(*DstMask) * llvm::MachineOperand::getRegMaskSize(
+                                             TRI->getNumRegs()));
+          DstMO.setRegMask(DstMask);
+        }
+      } else if (DstMO.isGlobal()) {
+        auto GVEntry = VMap.find(DstMO.getGlobal());
+        LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+            GVEntry != VMap.end(),
+            llvm::formatv("Failed to find global variable {0} inside the "
+                          "representation being patched.",
+                          DstMO.getGlobal()->getName())));
+        auto *DestGV = llvm::cast<llvm::GlobalValue>(GVEntry->second);
+        DstMO.ChangeToGA(DestGV, DstMO.getOffset(), DstMO.getTargetFlags());
+      }
+
+      DstMI->addOperand(DstMO);
+    }
+  }
+  return llvm::Error::success();
+}
+
+llvm::Error
+outlineInjectedPayload(const llvm::MachineFunction &InjectedPayloadMF,
+                       llvm::MachineInstr &InsertionPointMI,
+                       llvm::DenseMap<const llvm::MachineBasicBlock *,
+                                      llvm::MachineBasicBlock *> &MBBMap,
+                       const llvm::ValueToValueMapTy &VMap,
+                       llvm::MCRegister LongJumpPCReg,
+                       llvm::MCRegister SCCSaveReg) {
+  auto &InsertionPointMBB = *InsertionPointMI.getParent();
+  auto &ToBeInstrumentedMF = *InsertionPointMI.getMF();
+  // The MBB that will jump to the beginning of the injected payload
+  llvm::MachineBasicBlock *JumpFromBlock{nullptr};
+  // The MBB that the injected payload return blocks will jump to
+  llvm::MachineBasicBlock *JumpToBlock{nullptr};
+
+  // Split the insertion point MBB right before the insertion point MI;
+  // if the MI is the first instruction in the MBB, then create a new block
+  // and insert it before the insertion point MBB
+  if (InsertionPointMI == InsertionPointMBB.begin()) {
+    JumpFromBlock = ToBeInstrumentedMF.CreateMachineBasicBlock();
+    ToBeInstrumentedMF.insert(InsertionPointMBB.getIterator(), JumpFromBlock);
+    // All the predecessors of InsertionPointMBB now become the JumpFromBlock's
+    // predecessors, including their branches
+    llvm::SmallVector<llvm::MachineBasicBlock *, 2> PredMBBs(
+        InsertionPointMBB.predecessors());
+    for (auto &Pred : PredMBBs)
+      Pred->ReplaceUsesOfBlockWith(&InsertionPointMBB, JumpFromBlock);
+    // InsertionPointMBB will become the jump to block
+    JumpToBlock = &InsertionPointMBB;
+  } else {
+    JumpToBlock = InsertionPointMBB.splitAt(*InsertionPointMI.getPrevNode());
+    JumpFromBlock = &InsertionPointMBB;
+    // The jump from block no longer falls through to the jump to block; It is
+    // only reached through the return blocks of the injected payload
+    JumpFromBlock->removeSuccessor(JumpToBlock);
+  }
+  // The block the return blocks of the injected payload jump back to; When
+  // SCC is preserved across long jumps, it is restored in a landing block
+  // right before the jump to block, which only the injected payload reaches
+  llvm::MachineBasicBlock *ReturnToBlock = JumpToBlock;
+  if (LongJumpPCReg.isValid() && SCCSaveReg.isValid()) {
+    ReturnToBlock = ToBeInstrumentedMF.CreateMachineBasicBlock();
+    ToBeInstrumentedMF.insert(JumpToBlock->getIterator(), ReturnToBlock);
+    ReturnToBlock->addSuccessor(JumpToBlock);
+    restoreSCCAfterLongJump(*ReturnToBlock, SCCSaveReg);
+  }
+
+  for (const auto &InjectedPayloadMBB : InjectedPayloadMF) {
+    // Create MBBs at the end of the function
+    auto *NewBlock = ToBeInstrumentedMF.CreateMachineBasicBlock();
+    ToBeInstrumentedMF.push_back(NewBlock);
+    MBBMap.insert({&InjectedPayloadMBB, NewBlock});
+    // If this is the entry block of the injected payload then it is
+    // the jump from block's direct successor
+    if (InjectedPayloadMBB.isEntryBlock()) {
+      JumpFromBlock->addSuccessor(NewBlock);
+    }
+    // If this is a return block of the injected payload then it is the jump to
+    // block's predecessor
+    if (InjectedPayloadMBB.isReturnBlock()) {
+      NewBlock->addSuccessor(ReturnToBlock);
+    }
+  }
+
+  // Link blocks
+  for (auto &InjectedPayloadMBB : InjectedPayloadMF) {
+    auto *DstMBB = MBBMap[&InjectedPayloadMBB];
+    for (const auto &IPSucc : InjectedPayloadMBB.successors()) {
+      auto *DstSuccMBB = MBBMap[IPSucc];
+      if (!DstMBB->isSuccessor(DstSuccMBB))
+        DstMBB->addSuccessor(DstSuccMBB);
+    }
+  }
+  // Finally, clone the instructions into the new MBBs
+  const auto *TII = ToBeInstrumentedMF.getSubtarget().getInstrInfo();
+  for (const auto &MBB : InjectedPayloadMF) {
+    auto *DstMBB = MBBMap[&MBB];
+    LUTHIER_RETURN_ON_ERROR(
+        clonePayloadInstructions(MBB, *DstMBB, DstMBB->end(), MBBMap, VMap));
+    if (MBB.isEntryBlock()) {
+      if (LongJumpPCReg.isValid()) {
+        if (SCCSaveReg.isValid())
+          restoreSCCAfterLongJump(*DstMBB, SCCSaveReg);
+        insertLongJump(*JumpFromBlock, *DstMBB, LongJumpPCReg, SCCSaveReg);
+      } else
+        TII->insertUnconditionalBranch(*JumpFromBlock, DstMBB,
+                                       llvm::DebugLoc());
+    }
+    if (MBB.isReturnBlock()) {
+      if (LongJumpPCReg.isValid())
+        insertLongJump(*DstMBB, *ReturnToBlock, LongJumpPCReg, SCCSaveReg);
+      else
+        TII->insertUnconditionalBranch(*DstMBB, JumpToBlock, llvm::DebugLoc());
+    }
+  }
+  return llvm::Error::success();
+}
+
+} // namespace luthier
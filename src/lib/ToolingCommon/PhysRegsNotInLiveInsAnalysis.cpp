@@ -34,6 +34,8 @@ llvm::AnalysisKey PhysRegsNotInLiveInsAnalysis::Key;
 PhysRegsNotInLiveInsAnalysis::Result
 PhysRegsNotInLiveInsAnalysis::run(llvm::Module &IModule,
                                   llvm::ModuleAnalysisManager &IMAM) {
+  if (PrecomputedRegs)
+    return Result(*PrecomputedRegs);
   auto &IntrinsicIRLoweringInfoMap =
       IMAM.getCachedResult<IntrinsicIRLoweringInfoMapAnalysis>(IModule)
           ->getLoweringInfo();
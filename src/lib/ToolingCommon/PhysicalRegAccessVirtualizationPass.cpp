@@ -32,11 +32,32 @@
 #include <llvm/CodeGen/SlotIndexes.h>
 #include <llvm/CodeGen/TargetRegisterInfo.h>
 #include <llvm/CodeGen/TargetSubtargetInfo.h>
+#include <llvm/Support/CommandLine.h>
 #include <queue>
 
 #undef DEBUG_TYPE
 #define DEBUG_TYPE "luthier-phys-reg-virtualization"
 
+static llvm::cl::opt<unsigned> PayloadMinDeadVGPRs(
+    "luthier-payload-min-dead-vgprs",
+    llvm::cl::desc("Minimum number of dead VGPRs (AGPRs) inside the "
+                   "original allocation of the application at an "
+                   "instrumentation point required to keep the live VGPRs "
+                   "(AGPRs) of the application in place inside its injected "
+                   "payload; Otherwise, they are handed to the register "
+                   "allocator, which can move or spill them"),
+    llvm::cl::init(8));
+
+static llvm::cl::opt<unsigned> PayloadMinDeadSGPRs(
+    "luthier-payload-min-dead-sgprs",
+    llvm::cl::desc("Minimum number of dead SGPRs inside the original "
+                   "allocation of the application at an instrumentation point "
+                   "required to keep the live SGPRs of the application in "
+                   "place inside its injected payload; Otherwise, they are "
+                   "handed to the register allocator, which can move or "
+                   "spill them"),
+    llvm::cl::init(16));
+
 namespace luthier {
 
 char PhysicalRegAccessVirtualizationPass::ID = 0;
@@ -182,6 +203,49 @@ add32BitRegsOfLivePhysRegsToDenseSet(const llvm::LivePhysRegs &LiveRegs,
   }
 }
 
+/// Classes of the live registers that can be pinned (i.e. kept in place
+/// throughout an injected payload); Registers implicitly defined by
+/// instructions (e.g. SCC, VCC, M0 and EXEC) are not included
+static const llvm::TargetRegisterClass *const PinnableRegClasses[] = {
+    &llvm::AMDGPU::VGPR_32RegClass, &llvm::AMDGPU::AGPR_32RegClass,
+    &llvm::AMDGPU::SGPR_32RegClass};
+
+/// \return the class of \p Reg inside \c PinnableRegClasses, or \c nullptr
+/// if \p Reg cannot be pinned
+static const llvm::TargetRegisterClass *
+getPinnableRegClass(llvm::MCRegister Reg) {
+  for (const auto *RC : PinnableRegClasses) {
+    if (RC->contains(Reg))
+      return RC;
+  }
+  return nullptr;
+}
+
+/// \return the number of registers of each class in \c PinnableRegClasses
+/// inside the original allocation of the functions of \p TargetModule, i.e.
+/// up to the highest register of the class used by any of them
+static llvm::SmallDenseMap<const llvm::TargetRegisterClass *, unsigned, 4>
+computeNumAllocatedRegs(const llvm::MachineModuleInfo &TargetMMI,
+                        const llvm::Module &TargetModule) {
+  llvm::SmallDenseMap<const llvm::TargetRegisterClass *, unsigned, 4> Out;
+  for (const auto &TargetF : TargetModule) {
+    auto *TargetMF = TargetMMI.getMachineFunction(TargetF);
+    if (!TargetMF)
+      continue;
+    const auto &TargetMRI = TargetMF->getRegInfo();
+    for (const auto *RC : PinnableRegClasses) {
+      unsigned &NumAllocated = Out[RC];
+      for (unsigned I = RC->getNumRegs(); I > NumAllocated; --I) {
+        if (TargetMRI.isPhysRegUsed(RC->getRegister(I - 1))) {
+          NumAllocated = I;
+          break;
+        }
+      }
+    }
+  }
+  return Out;
+}
+
 PhysicalRegAccessVirtualizationPass::PhysicalRegAccessVirtualizationPass()
     : llvm::MachineFunctionPass(ID) {}
 
@@ -238,19 +302,26 @@ bool PhysicalRegAccessVirtualizationPass::runOnMachineFunction(
   auto &IPIP =
       *IMAM.getCachedResult<InjectedPayloadAndInstPointAnalysis>(IModule);
 
+  // The target app analyses are calculated before code generation starts,
+  // and are only looked up here, as code gen workers share the target app's
+  // analysis manager
   auto &RegLiveness =
-      TargetMAM.getResult<AMDGPURegLivenessAnalysis>(TargetModule);
+      *TargetMAM.getCachedResult<AMDGPURegLivenessAnalysis>(TargetModule);
 
-  const auto &CG = TargetMAM.getResult<LRCallGraphAnalysis>(TargetModule);
+  const auto &CG =
+      *TargetMAM.getCachedResult<LRCallGraphAnalysis>(TargetModule);
 
   const auto &StateValueLocations =
-      TargetMAM.getResult<LRStateValueStorageAndLoadLocationsAnalysis>(
+      *TargetMAM.getCachedResult<LRStateValueStorageAndLoadLocationsAnalysis>(
           TargetModule);
 
   if (!MF.getFunction().hasFnAttribute(InjectedPayloadAttribute)) {
     return true;
   }
 
+  // The live registers are gathered separately for each injected payload
+  PhysicalLiveInsForInjectedPayload.clear();
+
   auto *SVALoadPlan =
       StateValueLocations.getStateValueArrayLoadPlanForInstPoint(
           *IPIP.at(MF.getFunction()));
@@ -338,8 +409,8 @@ bool PhysicalRegAccessVirtualizationPass::runOnMachineFunction(
               << "Lifted representation doesn't have a deterministic call "
                  "graph; Adding the live-ins of all call instructions.\n";);
       auto &TargetMMI =
-          TargetMAM.getResult<llvm::MachineModuleAnalysis>(TargetModule)
-              .getMMI();
+          TargetMAM.getCachedResult<llvm::MachineModuleAnalysis>(TargetModule)
+              ->getMMI();
 
       for (const auto &TargetF : TargetModule) {
         if (auto *TargetMF = TargetMMI.getMachineFunction(TargetF)) {
@@ -457,17 +528,88 @@ bool PhysicalRegAccessVirtualizationPass::runOnMachineFunction(
   // to them when
   auto *TII = MF.getSubtarget().getInstrInfo();
 
-  // For each live-in register that is not used in the hooks, create a copy
-  // to its equivalent virtual register in the entry basic block, and
-  // a copy back in all the return blocks
+  // Live-in registers that are not used in the hooks are pinned (i.e. left
+  // in place) when enough registers of their class are dead at the
+  // instrumentation point; This way, the register allocator only hands out
+  // dead registers to the injected payload, and the live registers are never
+  // saved or restored. If the dead set is too small, they are virtualized
+  // instead, so that the register allocator can move or spill them
+  // Only registers inside the original allocation of the application are
+  // counted as dead, i.e. up to the highest register of each class used by
+  // the lifted representation; Handing out registers past it to the payload
+  // would grow the register usage of the kernel
+  // The allocation of the application doesn't change while the injected
+  // payloads are generated, so it is only computed once
+  if (NumAllocatedRegsModule != &TargetModule) {
+    NumAllocatedRegs = computeNumAllocatedRegs(
+        TargetMAM.getCachedResult<llvm::MachineModuleAnalysis>(TargetModule)
+            ->getMMI(),
+        TargetModule);
+    NumAllocatedRegsModule = &TargetModule;
+  }
+  llvm::BitVector ReservedRegs = TRI->getReservedRegs(MF);
+  llvm::SmallDenseMap<const llvm::TargetRegisterClass *, unsigned, 4>
+      NumDeadRegs;
+  for (const auto *RC : PinnableRegClasses) {
+    unsigned &NumDead = NumDeadRegs[RC];
+    for (unsigned I = 0; I < NumAllocatedRegs[RC]; ++I) {
+      llvm::MCRegister Reg = RC->getRegister(I);
+      if (!ReservedRegs.test(Reg) &&
+          !PhysicalLiveInsForInjectedPayload.contains(Reg) &&
+          !AllPhysRegsAccessedByAllIntrinsics.contains(Reg))
+        ++NumDead;
+    }
+    LLVM_DEBUG(llvm::dbgs() << "Number of dead registers in class "
+                            << TRI->getRegClassName(RC) << ": " << NumDead
+                            << "\n";);
+  }
+  // Calls made by the payload must not clobber the pinned registers
+  llvm::SmallVector<const llvm::MachineInstr *, 4> PayloadCalls;
+  for (const auto &MBB : MF) {
+    for (const auto &MI : MBB) {
+      if (MI.isCall())
+        PayloadCalls.push_back(&MI);
+    }
+  }
+  auto CanPinLiveIn = [&](llvm::MCRegister LiveIn) {
+    const auto *RC = getPinnableRegClass(LiveIn);
+    if (RC == nullptr)
+      return false;
+    unsigned MinDeadRegs = RC == &llvm::AMDGPU::SGPR_32RegClass
+                               ? PayloadMinDeadSGPRs
+                               : PayloadMinDeadVGPRs;
+    if (NumDeadRegs[RC] < MinDeadRegs)
+      return false;
+    auto ClobbersLiveIn = [&](const llvm::MachineOperand &MO) {
+      return (MO.isRegMask() && MO.clobbersPhysReg(LiveIn)) ||
+             (MO.isReg() && MO.isDef() && MO.getReg().isPhysical() &&
+              TRI->regsOverlap(MO.getReg(), LiveIn));
+    };
+    return llvm::none_of(PayloadCalls, [&](const llvm::MachineInstr *Call) {
+      return llvm::any_of(Call->operands(), ClobbersLiveIn);
+    });
+  };
+
+  // For each live-in register that is not used in the hooks and is not
+  // pinned, create a copy to its equivalent virtual register in the entry
+  // basic block, and a copy back in all the return blocks
   // TODO: Map to the correct location of clobbered registers in case
   // the state value is not in a VGPR
+  llvm::SmallVector<llvm::MCRegister> PinnedLiveIns;
   llvm::DenseMap<llvm::MCRegister, llvm::Register>
       PreservedPhysRegToVirtRegStorageMap;
   for (const auto &LiveIn : PhysicalLiveInsForInjectedPayload) {
     if (!AllPhysRegsAccessedByAllIntrinsics.contains(LiveIn) &&
         !stateValueArray::isFrameSpillSlot(LiveIn)) {
 
+      if (CanPinLiveIn(LiveIn)) {
+        LLVM_DEBUG(llvm::dbgs() << "Live-in register "
+                                << llvm::printReg(LiveIn, TRI)
+                                << " is pinned to its physical register.\n");
+        PinnedLiveIns.push_back(LiveIn);
+        continue;
+      }
+
       LLVM_DEBUG(llvm::dbgs()
                  << "Live-in register " << llvm::printReg(LiveIn, TRI)
                  << "is not accessed by the intrinsics nor is in the state "
@@ -516,11 +658,16 @@ bool PhysicalRegAccessVirtualizationPass::runOnMachineFunction(
     }
   }
 
-  // Add the state value array's load VGPR as a live-in for all basic blocks
-  // to be preserved throughout the injected payload
+  // Add the state value array's load VGPR and the pinned live-ins as
+  // live-ins for all basic blocks to be preserved throughout the injected
+  // payload
   for (auto &MBB : MF) {
     if (!MBB.isLiveIn(SVALoadPlan->StateValueArrayLoadVGPR))
       MBB.addLiveIn(SVALoadPlan->StateValueArrayLoadVGPR);
+    for (llvm::MCRegister PinnedLiveIn : PinnedLiveIns) {
+      if (!MBB.isLiveIn(PinnedLiveIn))
+        MBB.addLiveIn(PinnedLiveIn);
+    }
   }
 
   // We now emit the copy instructions from where the preserved
@@ -587,6 +734,10 @@ bool PhysicalRegAccessVirtualizationPass::runOnMachineFunction(
       // allocator will not preserve the state value VGPR
       ReturnInst->addOperand(llvm::MachineOperand::CreateReg(
           SVALoadPlan->StateValueArrayLoadVGPR, false, true));
+      // Same goes for the pinned live-ins
+      for (llvm::MCRegister PinnedLiveIn : PinnedLiveIns)
+        ReturnInst->addOperand(
+            llvm::MachineOperand::CreateReg(PinnedLiveIn, false, true));
       for (const auto &[PreservedPhysReg, PhysRegVirtStorage] :
            PreservedPhysRegToVirtRegStorageMap) {
         if (stateValueArray::isFrameSpillSlot(PreservedPhysReg)) {
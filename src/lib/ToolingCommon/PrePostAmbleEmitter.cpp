@@ -20,12 +20,20 @@
 //===----------------------------------------------------------------------===//
 #include "luthier/Tooling/PrePostAmbleEmitter.h"
 #include "luthier/Intrinsic/IntrinsicProcessor.h"
-#include "luthier/LLVM/streams.h"
+#include "luthier/Tooling/AMDGPURegisterLiveness.h"
+#include "luthier/Tooling/DispatchBufferPool.h"
+#include "luthier/Tooling/InstrumentationStack.h"
+#include "luthier/Tooling/LDSCounterStaging.h"
+#include "luthier/Tooling/MIRConvenience.h"
 #include "luthier/Tooling/SVStorageAndLoadLocations.h"
 #include "luthier/Tooling/StateValueArraySpecs.h"
 #include "luthier/Tooling/WrapperAnalysisPasses.h"
 #include <GCNSubtarget.h>
 #include <SIMachineFunctionInfo.h>
+#include <llvm/CodeGen/LivePhysRegs.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/Support/AMDGPUAddrSpace.h>
 
 #undef DEBUG_TYPE
 #define DEBUG_TYPE "luthier-pre-post-amble-emitter"
@@ -130,169 +138,6 @@ DEFINE_ENABLE_SGPR_ARGUMENT_WITH_TRI(QueuePtr,
                                      llvm::AMDGPUFunctionArgInfo::QUEUE_PTR,
                                      addQueuePtr)
 
-static llvm::Error
-emitCodeToSetupScratch(llvm::MachineInstr &EntryInstr,
-                       llvm::MCRegister SVSStorageVGPR,
-                       const amdgpu::hsamd::Kernel::Metadata &KernelMD) {
-  auto &MF = *EntryInstr.getMF();
-  const auto &TII = *MF.getSubtarget().getInstrInfo();
-  const auto &TRI = *MF.getSubtarget().getRegisterInfo();
-  auto &MFI = *MF.getInfo<llvm::SIMachineFunctionInfo>();
-  // First make a copy of S0 and S1/ FS_lo FS_hi in the state value
-  // register
-  auto SGPR0SpillSlot =
-      stateValueArray::getFrameSpillSlotLaneId(llvm::AMDGPU::SGPR0);
-
-  auto SGPR1SpillSlot =
-      stateValueArray::getFrameSpillSlotLaneId(llvm::AMDGPU::SGPR1);
-
-  auto SGPRFlatScrLoSpillSlot =
-      stateValueArray::getFrameSpillSlotLaneId(llvm::AMDGPU::FLAT_SCR_LO);
-
-  auto SGPRFlatScrHiSpillSlot =
-      stateValueArray::getFrameSpillSlotLaneId(llvm::AMDGPU::FLAT_SCR_HI);
-
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::V_WRITELANE_B32), SVSStorageVGPR)
-      .addReg(TRI.getSubReg(
-          MFI.getPreloadedReg(
-              llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
-          llvm::AMDGPU::sub0))
-      .addImm(SGPR0SpillSlot)
-      .addReg(SVSStorageVGPR);
-
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::V_WRITELANE_B32), SVSStorageVGPR)
-      .addReg(TRI.getSubReg(
-          MFI.getPreloadedReg(
-              llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
-          llvm::AMDGPU::sub1))
-      .addImm(SGPR1SpillSlot)
-      .addReg(SVSStorageVGPR);
-
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::V_WRITELANE_B32), SVSStorageVGPR)
-      .addReg(TRI.getSubReg(
-          MFI.getPreloadedReg(llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
-          llvm::AMDGPU::sub0))
-      .addImm(SGPRFlatScrLoSpillSlot)
-      .addReg(SVSStorageVGPR);
-
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::V_WRITELANE_B32), SVSStorageVGPR)
-      .addReg(TRI.getSubReg(
-          MFI.getPreloadedReg(llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
-          llvm::AMDGPU::sub1))
-      .addImm(SGPRFlatScrHiSpillSlot)
-      .addReg(SVSStorageVGPR);
-
-  // Add the PSWO to SGPR0/its carry to SGPR1
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::S_ADD_U32))
-      .addReg(TRI.getSubReg(
-                  MFI.getPreloadedReg(
-                      llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
-                  llvm::AMDGPU::sub0),
-              llvm::RegState::Define)
-      .addReg(TRI.getSubReg(
-                  MFI.getPreloadedReg(
-                      llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
-                  llvm::AMDGPU::sub0),
-              llvm::RegState::Kill)
-      .addReg(MFI.getPreloadedReg(
-          llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_WAVE_BYTE_OFFSET));
-
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::S_ADDC_U32))
-      .addReg(TRI.getSubReg(
-                  MFI.getPreloadedReg(
-                      llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
-                  llvm::AMDGPU::sub1),
-              llvm::RegState::Define)
-      .addReg(TRI.getSubReg(
-                  MFI.getPreloadedReg(
-                      llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER),
-                  llvm::AMDGPU::sub1),
-              llvm::RegState::Kill)
-      .addImm(0);
-  // Add the PSWO to FS_init_lo/its carry to FS_init_hi
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::S_ADD_U32))
-      .addReg(TRI.getSubReg(MFI.getPreloadedReg(
-                                llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
-                            llvm::AMDGPU::sub0),
-              llvm::RegState::Define)
-      .addReg(TRI.getSubReg(MFI.getPreloadedReg(
-                                llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
-                            llvm::AMDGPU::sub0),
-              llvm::RegState::Kill)
-      .addReg(MFI.getPreloadedReg(
-          llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_WAVE_BYTE_OFFSET));
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::S_ADDC_U32))
-      .addReg(TRI.getSubReg(MFI.getPreloadedReg(
-                                llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
-                            llvm::AMDGPU::sub1),
-              llvm::RegState::Define)
-      .addReg(TRI.getSubReg(MFI.getPreloadedReg(
-                                llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
-                            llvm::AMDGPU::sub1),
-              llvm::RegState::Kill)
-      .addImm(0);
-
-  unsigned int InstrumentationStackStart{0};
-  if (KernelMD.UsesDynamicStack)
-    llvm_unreachable("Not implemented");
-  else {
-    InstrumentationStackStart = KernelMD.PrivateSegmentFixedSize;
-  }
-  // Set s32 to be the maximum amount of stack requested by the hook
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::S_MOV_B32), llvm::AMDGPU::SGPR32)
-      .addImm(InstrumentationStackStart);
-
-  // Store frame registers in their slots
-  for (const auto &[PhysReg, StoreSlot] :
-       stateValueArray::getFrameStoreSlots()) {
-    llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                  TII.get(llvm::AMDGPU::V_WRITELANE_B32), SVSStorageVGPR)
-        .addReg(PhysReg)
-        .addImm(StoreSlot)
-        .addReg(SVSStorageVGPR);
-  }
-
-  // Restore S0, S1, FS_init_lo, and FS_init_hi
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::V_READLANE_B32), llvm::AMDGPU::SGPR0)
-      .addReg(SVSStorageVGPR)
-      .addImm(SGPR0SpillSlot);
-
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::V_READLANE_B32), llvm::AMDGPU::SGPR1)
-      .addReg(SVSStorageVGPR)
-      .addImm(SGPR1SpillSlot);
-
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::V_READLANE_B32))
-      .addReg(TRI.getSubReg(MFI.getPreloadedReg(
-                                llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
-                            llvm::AMDGPU::sub0),
-              llvm::RegState::Define)
-      .addReg(SVSStorageVGPR)
-      .addImm(SGPRFlatScrLoSpillSlot);
-
-  llvm::BuildMI(MF.front(), EntryInstr, llvm::DebugLoc(),
-                TII.get(llvm::AMDGPU::V_READLANE_B32))
-      .addReg(TRI.getSubReg(MFI.getPreloadedReg(
-                                llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT),
-                            llvm::AMDGPU::sub1),
-              llvm::RegState::Define)
-      .addReg(SVSStorageVGPR)
-      .addImm(SGPRFlatScrHiSpillSlot);
-
-  return llvm::Error::success();
-}
-
 static llvm::Error
 emitCodeToStoreSGPRKernelArg(llvm::MachineInstr &InsertionPoint,
                              llvm::MCRegister SrcSGPR, llvm::MCRegister SVSVGPR,
@@ -330,6 +175,29 @@ emitCodeToStoreSGPRKernelArg(llvm::MachineInstr &InsertionPoint,
   return llvm::Error::success();
 }
 
+/// Stores the 32-bit constant \p Value into the lane \p Lane of \p SVSVGPR
+/// before \p InsertionPoint; As \c V_WRITELANE_B32 only takes inline
+/// constants, the value is first moved into an SGPR not in \p UsedRegs
+static llvm::Error
+emitCodeToStoreConstantKernelArg(llvm::MachineInstr &InsertionPoint,
+                                 uint32_t Value, llvm::MCRegister SVSVGPR,
+                                 int Lane, llvm::LivePhysRegs &UsedRegs) {
+  auto &MF = *InsertionPoint.getMF();
+  auto &MBB = *InsertionPoint.getParent();
+  const auto &TII = *MF.getSubtarget().getInstrInfo();
+  auto ValueSGPR = pickFreePhysReg(MF, llvm::AMDGPU::SGPR_32RegClass, UsedRegs);
+  LUTHIER_RETURN_ON_ERROR(ValueSGPR.takeError());
+  llvm::BuildMI(MBB, InsertionPoint, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_MOV_B32), *ValueSGPR)
+      .addImm(Value);
+  llvm::BuildMI(MBB, InsertionPoint, llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_WRITELANE_B32), SVSVGPR)
+      .addReg(*ValueSGPR, llvm::RegState::Kill)
+      .addImm(Lane)
+      .addReg(SVSVGPR);
+  return llvm::Error::success();
+}
+
 static void emitCodeToReturnSGPRArgsToOriginalPlace(
     const llvm::DenseMap<llvm::AMDGPUFunctionArgInfo::PreloadedValue,
                          llvm::MCRegister> &OriginalKernelArguments,
@@ -454,6 +322,106 @@ static void emitCodeToMoveSVA(llvm::ModuleAnalysisManager &TargetMAM,
   }
 }
 
+/// Allocates the counters staged in LDS by the injected payloads of \p LR on
+/// top of the group segment of its kernel, zeroes them before
+/// \p EntryInstr, and flushes them to their global counters before each
+/// \c s_endpgm of the kernel
+/// \param EntryLiveRegs registers live before \p EntryInstr
+static llvm::Error
+emitCodeToStageLDSCounters(LiftedRepresentation &LR,
+                           llvm::Module &TargetModule,
+                           const llvm::Module &IModule,
+                           FunctionPreambleDescriptor &PKInfo,
+                           llvm::MachineInstr &EntryInstr,
+                           llvm::LivePhysRegs &EntryLiveRegs) {
+  auto &MF = LR.getKernelMF();
+  llvm::SmallVector<llvm::StringRef, 4> CounterNames;
+  for (const auto &Counter : PKInfo.Kernels.at(&MF).LDSCounters)
+    CounterNames.push_back(Counter.getKey());
+  for (const auto &[FuncSymbol, DeviceMF] : LR.functions()) {
+    for (const auto &Counter : PKInfo.DeviceFunctions.at(DeviceMF).LDSCounters)
+      if (!llvm::is_contained(CounterNames, Counter.getKey()))
+        CounterNames.push_back(Counter.getKey());
+  }
+  if (CounterNames.empty())
+    return llvm::Error::success();
+  // Keep the layout independent of the order payloads were lowered in
+  llvm::sort(CounterNames);
+
+  auto &MFI = *MF.getInfo<llvm::SIMachineFunctionInfo>();
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  // Dynamic LDS starts right after the group segment of the application,
+  // where the counters are about to be allocated
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !MFI.isDynamicLDSUsed(),
+      llvm::formatv("Cannot stage counters in the LDS of kernel {0}, as it "
+                    "uses dynamic LDS.",
+                    MF.getName())));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !ST.ldsRequiresM0Init(),
+      llvm::formatv("Cannot stage counters in LDS on {0}, as its LDS "
+                    "instructions require M0 to be initialized.",
+                    ST.getCPU())));
+
+  // Allocate the counters, followed by the number of live wavefronts of the
+  // workgroup; Allocating them through the machine function info grows the
+  // group segment size emitted in the kernel descriptor and its metadata
+  auto *Int64Ty = llvm::Type::getInt64Ty(TargetModule.getContext());
+  auto *LDSTy = llvm::ArrayType::get(Int64Ty, CounterNames.size() + 1);
+  auto *LDSCountersGV = new llvm::GlobalVariable(
+      TargetModule, LDSTy, false, llvm::GlobalValue::InternalLinkage,
+      llvm::UndefValue::get(LDSTy), "luthier.lds.counters", nullptr,
+      llvm::GlobalValue::NotThreadLocal, llvm::AMDGPUAS::LOCAL_ADDRESS);
+  LDSCountersGV->setAlignment(llvm::Align(8));
+  unsigned CountersOffset =
+      MFI.allocateLDSGlobal(TargetModule.getDataLayout(), *LDSCountersGV);
+  unsigned LiveWavesOffset = CountersOffset + 8 * CounterNames.size();
+  // LDS instructions encode their offsets in 16 bits
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      llvm::isUInt<16>(LiveWavesOffset + 4),
+      llvm::formatv("Staged counters of kernel {0} do not fit in LDS.",
+                    MF.getName())));
+
+  // Declare the global counters of the tool, so that the flush code can refer
+  // to them; The patching pass reuses these declarations
+  llvm::SmallVector<std::pair<const llvm::GlobalVariable *, unsigned>, 4>
+      Counters;
+  for (const auto &[I, Name] : llvm::enumerate(CounterNames)) {
+    const auto *GV = IModule.getNamedGlobal(Name);
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        GV != nullptr,
+        llvm::formatv("Failed to find the staged counter {0} inside the "
+                      "instrumentation module.",
+                      Name)));
+    auto *NewGV = new llvm::GlobalVariable(
+        TargetModule, GV->getValueType(), GV->isConstant(), GV->getLinkage(),
+        nullptr, GV->getName(), nullptr, GV->getThreadLocalMode(),
+        GV->getType()->getAddressSpace());
+    NewGV->copyAttributesFrom(GV);
+    unsigned Offset = CountersOffset + 8 * I;
+    PKInfo.LDSCounterOffsets.insert({Name, Offset});
+    Counters.emplace_back(NewGV, Offset);
+  }
+
+  LUTHIER_RETURN_ON_ERROR(emitCodeToZeroLDSCounters(
+      EntryInstr, CountersOffset, LiveWavesOffset, EntryLiveRegs));
+
+  llvm::SmallVector<llvm::MachineInstr *, 2> EndPgms;
+  for (auto &MBB : MF) {
+    for (auto &MI : MBB) {
+      if (MI.getOpcode() == llvm::AMDGPU::S_ENDPGM)
+        EndPgms.push_back(&MI);
+    }
+  }
+  for (auto *EndPgm : EndPgms) {
+    auto FlushBegin =
+        emitCodeToFlushLDSCounters(*EndPgm, Counters, LiveWavesOffset);
+    LUTHIER_RETURN_ON_ERROR(FlushBegin.takeError());
+    PKInfo.LDSCounterFlushes.insert({EndPgm, *FlushBegin});
+  }
+  return llvm::Error::success();
+}
+
 llvm::AnalysisKey FunctionPreambleDescriptorAnalysis::Key;
 
 FunctionPreambleDescriptorAnalysis::Result
@@ -468,7 +436,7 @@ FunctionPreambleDescriptorAnalysis::run(
 llvm::PreservedAnalyses
 PrePostAmbleEmitter::run(llvm::Module &TargetModule,
                          llvm::ModuleAnalysisManager &TargetMAM) {
-  const auto &PKInfo =
+  auto &PKInfo =
       *TargetMAM.getCachedResult<FunctionPreambleDescriptorAnalysis>(
           TargetModule);
 
@@ -481,6 +449,24 @@ PrePostAmbleEmitter::run(llvm::Module &TargetModule,
       *TargetMAM.getCachedResult<LRStateValueStorageAndLoadLocationsAnalysis>(
           TargetModule);
 
+  // Registers live at the very beginning of the kernel, before any pre-amble
+  // code is emitted
+  auto &KernelEntryInstr = *LR.getKernelMF().begin()->begin();
+  llvm::LivePhysRegs EntryLiveRegs(
+      *LR.getKernelMF().getSubtarget().getRegisterInfo());
+  if (const auto *LiveIns = TargetMAM.getResult<AMDGPURegLivenessAnalysis>(
+                                         TargetModule)
+                                .getMFLevelInstrLiveIns(KernelEntryInstr)) {
+    for (llvm::MCPhysReg Reg : *LiveIns)
+      EntryLiveRegs.addReg(Reg);
+  }
+  llvm::SmallVector<llvm::MCRegister, 4> EntrySVSRegs;
+  SVLocations.getStorageIntervals(LR.getKernelMF().front())[0]
+      .getSVS()
+      .getAllStorageRegisters(EntrySVSRegs);
+  for (llvm::MCRegister Reg : EntrySVSRegs)
+    EntryLiveRegs.addReg(Reg);
+
   // First we need to figure out if we need to set up the state value array
   // at all
 
@@ -494,7 +480,6 @@ PrePostAmbleEmitter::run(llvm::Module &TargetModule,
     auto &EntryInstrSVS = SVLocations.getStorageIntervals(MF->front())[0];
     auto &MFI = *MF->getInfo<llvm::SIMachineFunctionInfo>();
     auto &TRI = *MF->getSubtarget<llvm::GCNSubtarget>().getRegisterInfo();
-    auto *TII = MF->getSubtarget<llvm::GCNSubtarget>().getInstrInfo();
 
     // Get the original position of all the reg arguments before they
     // are changed
@@ -526,6 +511,12 @@ PrePostAmbleEmitter::run(llvm::Module &TargetModule,
       enablePrivateSegmentBuffer(MFI, TRI);
       // Enable Flat scratch init if not already enabled
       enableFlatScratchInit(MFI, TRI);
+      // The instrumentation stack of dynamic stack kernels might be located
+      // using the private segment size of the dispatch packet; Being a user
+      // SGPR, it must be enabled before the system SGPRs
+      if (doesInstrumentationStackRequireDispatchPtr(
+              LR.getKernel().getKernelMetadata()))
+        enableDispatchPtr(MFI, TRI);
       // Check if Private buffer wave segment offset was enabled; if not,
       // enable it
       enablePrivateSegmentWaveOffset(MFI);
@@ -557,8 +548,9 @@ PrePostAmbleEmitter::run(llvm::Module &TargetModule,
     // If stack access was requested, then emit code to save it into
     // the SVS storage V/AGPR
     if (RequiresAccessToScratch) {
-      if (auto Err = emitCodeToSetupScratch(
-              *EntryInstr, SVSStorageReg, LR.getKernel().getKernelMetadata())) {
+      if (auto Err = emitCodeToSetupInstrumentationStack(
+              *EntryInstr, SVSStorageReg, LR.getKernel().getKernelMetadata(),
+              SVAInfo.RequestedAdditionalStackSizeInBytes)) {
         TargetModule.getContext().emitError(toString(std::move(Err)));
         return llvm::PreservedAnalyses::all();
       }
@@ -593,9 +585,19 @@ PrePostAmbleEmitter::run(llvm::Module &TargetModule,
         }
       }
     }
-    // Add code
+    // Registers holding a value at this point of the pre-amble; The SGPR
+    // arguments are still in their modified places, and the instrumentation
+    // stack pointer may have been set up
+    llvm::LivePhysRegs PreambleUsedRegs(TRI);
+    for (llvm::MCPhysReg Reg : EntryLiveRegs)
+      PreambleUsedRegs.addReg(Reg);
+    for (unsigned I = 0; I < MFI.getNumPreloadedSGPRs(); ++I)
+      PreambleUsedRegs.addReg(llvm::AMDGPU::SGPR0 + I);
+    for (const auto &[Arg, Reg] : OriginalSGPRArgLocs)
+      PreambleUsedRegs.addReg(Reg);
+    PreambleUsedRegs.addReg(MFI.getStackPtrOffsetReg());
+
     if (SVAInfo.RequestedKernelArguments.contains(HIDDEN_KERNARG_OFFSET)) {
-      luthier::outs() << "emitting code to store the hidden arg offset.\n";
       auto &KernArgs = LR.getKernel().getKernelMetadata().Args;
 
       LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
@@ -615,13 +617,30 @@ PrePostAmbleEmitter::run(llvm::Module &TargetModule,
               HIDDEN_KERNARG_OFFSET);
       LUTHIER_REPORT_FATAL_ON_ERROR(StoreLane.takeError());
 
-      llvm::BuildMI(*EntryInstr->getParent(), EntryInstr, llvm::DebugLoc(),
-                    TII->get(llvm::AMDGPU::V_WRITELANE_B32), SVSStorageReg)
-          .addImm(HiddenOffset)
-          .addImm(*StoreLane)
-          .addReg(SVSStorageReg);
+      if (auto Err = emitCodeToStoreConstantKernelArg(
+              *EntryInstr, HiddenOffset, SVSStorageReg, *StoreLane,
+              PreambleUsedRegs)) {
+        TargetModule.getContext().emitError(toString(std::move(Err)));
+        return llvm::PreservedAnalyses::all();
+      }
+    }
+    // The user argument area is appended to the kernel's argument buffer
+    // by the host when the dispatch packet is rewritten; Its offset only
+    // depends on the original size of the buffer
+    if (SVAInfo.RequestedKernelArguments.contains(USER_KERNARG_OFFSET)) {
+      uint32_t UserOffset = getUserKernArgOffset(
+          LR.getKernel().getKernelMetadata().KernArgSegmentSize);
+      auto StoreLane =
+          stateValueArray::getKernelArgumentLaneIdStoreSlotBeginForWave64(
+              USER_KERNARG_OFFSET);
+      LUTHIER_REPORT_FATAL_ON_ERROR(StoreLane.takeError());
 
-      EntryInstr->getMF()->print(luthier::outs());
+      if (auto Err = emitCodeToStoreConstantKernelArg(
+              *EntryInstr, UserOffset, SVSStorageReg, *StoreLane,
+              PreambleUsedRegs)) {
+        TargetModule.getContext().emitError(toString(std::move(Err)));
+        return llvm::PreservedAnalyses::all();
+      }
     }
 
     // Put every SGPR argument back in its place
@@ -633,6 +652,18 @@ PrePostAmbleEmitter::run(llvm::Module &TargetModule,
       emitCodeToMoveSVA(TargetMAM, TargetModule, MF, SVLocations);
     }
   }
+
+  // Stage the counters requested by the injected payloads in LDS; This runs
+  // after the SVA pre-amble, so that the SVA is set up before the
+  // instrumentation code of the first instruction
+  if (auto Err = emitCodeToStageLDSCounters(
+          LR, TargetModule,
+          TargetMAM.getCachedResult<IModulePMAnalysis>(TargetModule)
+              ->getModule(),
+          PKInfo, KernelEntryInstr, EntryLiveRegs)) {
+    TargetModule.getContext().emitError(toString(std::move(Err)));
+    return llvm::PreservedAnalyses::all();
+  }
   return llvm::PreservedAnalyses::all();
 }
 
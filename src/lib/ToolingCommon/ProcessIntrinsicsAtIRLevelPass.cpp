@@ -162,6 +162,15 @@ llvm::PreservedAnalyses luthier::ProcessIntrinsicsAtIRLevelPass::run(
                               IntrinsicName, ParentFunction->getName()));
             return llvm::PreservedAnalyses::all();
           }
+
+          if (!IRLoweringInfo->lds_counters().empty()) {
+            IModule.getContext().emitError(
+                llvm::formatv("Intrinsic {0} used in non-hook function {1} "
+                              "requested a counter staged in LDS, which is "
+                              "not allowed.",
+                              IntrinsicName, ParentFunction->getName()));
+            return llvm::PreservedAnalyses::all();
+          }
         }
 
         // Record the name of the intrinsic as well as the inline assembly
@@ -0,0 +1,204 @@
+//===-- ResourceUsage.cpp -------------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the kernel resource usage and occupancy calculations.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/ResourceUsage.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/LLVM/EagerManagedStatic.h"
+#include <algorithm>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/MathExtras.h>
+
+namespace luthier {
+
+static EagerManagedStatic<llvm::cl::opt<int>> MaxOccupancyDrop(
+    "luthier-max-occupancy-drop",
+    llvm::cl::desc("Maximum number of waves per SIMD instrumentation is "
+                   "allowed to cost a kernel; Negative values disable the "
+                   "occupancy budget"),
+    llvm::cl::init(-1));
+
+static EagerManagedStatic<llvm::cl::opt<bool>> OccupancyBudgetRetry(
+    "luthier-occupancy-budget-retry",
+    llvm::cl::desc("Re-instrument kernels exceeding the occupancy budget with "
+                   "injected payload options of lower register pressure "
+                   "before failing"),
+    llvm::cl::init(true));
+
+llvm::Expected<OccupancyTarget> OccupancyTarget::get(llvm::StringRef Processor,
+                                                     unsigned WavefrontSize) {
+  llvm::StringRef Version = Processor;
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Version.consume_front("gfx"),
+      llvm::formatv("{0} is not an AMDGPU processor name.", Processor)));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      WavefrontSize == 32 || WavefrontSize == 64,
+      llvm::formatv("Invalid wavefront size {0}.", WavefrontSize)));
+  OccupancyTarget Out;
+  Out.WavefrontSize = WavefrontSize;
+  if (Version.size() == 3 && Version.front() == '9') {
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        WavefrontSize == 64,
+        llvm::formatv("Processor {0} only supports wavefronts of size 64.",
+                      Processor)));
+    llvm::StringRef Family = Version.substr(0, 2);
+    if (Version == "90a" || Family == "94" || Family == "95") {
+      Out.MaxWavesPerSIMD = 8;
+      Out.VGPRsPerSIMD = 512;
+      Out.VGPRAllocGranule = 8;
+      Out.VGPREncodingGranule = 8;
+      Out.HasUnifiedAGPRs = true;
+    }
+    if (Family == "95")
+      Out.LDSPerCU = 160 * 1024;
+    return Out;
+  }
+  llvm::StringRef Major = Version.substr(0, 2);
+  if (Version.size() == 4 &&
+      (Major == "10" || Major == "11" || Major == "12")) {
+    bool IsWave32 = WavefrontSize == 32;
+    bool Has1_5xVGPRs = Version == "1100" || Version == "1101" ||
+                        Version == "1151" || Version == "1200" ||
+                        Version == "1201";
+    bool IsGFX10_3OrLater = Version >= "1030";
+    Out.MaxWavesPerSIMD = IsGFX10_3OrLater ? 16 : 20;
+    Out.VGPRsPerSIMD = (Has1_5xVGPRs ? 1536 : 1024) / (IsWave32 ? 1 : 2);
+    if (Has1_5xVGPRs)
+      Out.VGPRAllocGranule = IsWave32 ? 24 : 12;
+    else if (IsGFX10_3OrLater)
+      Out.VGPRAllocGranule = IsWave32 ? 16 : 8;
+    else
+      Out.VGPRAllocGranule = IsWave32 ? 8 : 4;
+    Out.VGPREncodingGranule = IsWave32 ? 8 : 4;
+    // Each wavefront is always allocated the maximum number of SGPRs
+    Out.SGPRsPerSIMD = 0;
+    Out.LDSPerCU = 128 * 1024;
+    return Out;
+  }
+  return LUTHIER_MAKE_GENERIC_ERROR(llvm::formatv(
+      "Occupancy calculation is not supported for processor {0}.", Processor));
+}
+
+KernelResourceUsage decodeKernelResourceUsage(unsigned GranulatedVGPRCount,
+                                              unsigned GranulatedSGPRCount,
+                                              uint32_t PrivateSegmentSize,
+                                              uint32_t GroupSegmentSize,
+                                              const OccupancyTarget &Target) {
+  KernelResourceUsage Out;
+  Out.NumVGPRs = (GranulatedVGPRCount + 1) * Target.VGPREncodingGranule;
+  if (Target.SGPRsPerSIMD != 0)
+    Out.NumSGPRs = (GranulatedSGPRCount + 1) * Target.SGPREncodingGranule;
+  Out.PrivateSegmentSize = PrivateSegmentSize;
+  Out.GroupSegmentSize = GroupSegmentSize;
+  return Out;
+}
+
+KernelResourceUsage
+readKernelResourceUsage(unsigned VGPRCount, std::optional<unsigned> AGPRCount,
+                        unsigned SGPRCount, uint32_t PrivateSegmentSize,
+                        uint32_t GroupSegmentSize,
+                        const OccupancyTarget &Target) {
+  unsigned NumAGPRs = AGPRCount.value_or(0);
+  unsigned NumVGPRs = VGPRCount;
+  if (Target.HasUnifiedAGPRs)
+    NumVGPRs = VGPRCount > NumAGPRs ? VGPRCount - NumAGPRs : 0;
+  return {NumVGPRs, NumAGPRs, SGPRCount, PrivateSegmentSize, GroupSegmentSize};
+}
+
+unsigned computeWavesPerSIMD(const KernelResourceUsage &Usage,
+                             const OccupancyTarget &Target,
+                             unsigned WorkgroupSize) {
+  unsigned Waves = Target.MaxWavesPerSIMD;
+  // AGPRs of unified register files are allocated after the VGPRs, starting
+  // from a 4-register boundary
+  unsigned NumVGPRs =
+      Target.HasUnifiedAGPRs
+          ? llvm::alignTo(Usage.NumVGPRs, 4) + Usage.NumAGPRs
+          : std::max(Usage.NumVGPRs, Usage.NumAGPRs);
+  NumVGPRs = llvm::alignTo(std::max(NumVGPRs, 1u), Target.VGPRAllocGranule);
+  Waves = std::min(Waves, Target.VGPRsPerSIMD / NumVGPRs);
+  if (Target.SGPRsPerSIMD != 0) {
+    unsigned NumSGPRs =
+        llvm::alignTo(std::max(Usage.NumSGPRs, 1u), Target.SGPRAllocGranule);
+    Waves = std::min(Waves, Target.SGPRsPerSIMD / NumSGPRs);
+  }
+  if (Usage.GroupSegmentSize != 0 && WorkgroupSize != 0) {
+    unsigned WorkgroupsPerCU = Target.LDSPerCU / Usage.GroupSegmentSize;
+    unsigned WavesPerWorkgroup =
+        llvm::divideCeil(WorkgroupSize, Target.WavefrontSize);
+    Waves = std::min(Waves, WorkgroupsPerCU * WavesPerWorkgroup /
+                                Target.SIMDsPerCU);
+  }
+  return Waves;
+}
+
+void ResourceUsageReport::print(llvm::raw_ostream &OS) const {
+  OS << llvm::formatv("VGPRs: {0} -> {1}\n", Original.NumVGPRs,
+                      Instrumented.NumVGPRs);
+  OS << llvm::formatv("AGPRs: {0} -> {1}\n", Original.NumAGPRs,
+                      Instrumented.NumAGPRs);
+  OS << llvm::formatv("SGPRs: {0} -> {1}\n", Original.NumSGPRs,
+                      Instrumented.NumSGPRs);
+  OS << llvm::formatv("Private segment size: {0} -> {1} bytes\n",
+                      Original.PrivateSegmentSize,
+                      Instrumented.PrivateSegmentSize);
+  OS << llvm::formatv("Group segment size: {0} -> {1} bytes\n",
+                      Original.GroupSegmentSize,
+                      Instrumented.GroupSegmentSize);
+  OS << llvm::formatv("Waves per SIMD: {0} -> {1} (out of {2})\n",
+                      OriginalWavesPerSIMD, InstrumentedWavesPerSIMD,
+                      MaxWavesPerSIMD);
+}
+
+ResourceUsageReport
+computeResourceUsageReport(const KernelResourceUsage &Original,
+                           const KernelResourceUsage &Instrumented,
+                           const OccupancyTarget &Target,
+                           unsigned WorkgroupSize) {
+  return ResourceUsageReport{
+      Original, Instrumented,
+      computeWavesPerSIMD(Original, Target, WorkgroupSize),
+      computeWavesPerSIMD(Instrumented, Target, WorkgroupSize),
+      Target.MaxWavesPerSIMD};
+}
+
+OccupancyBudget OccupancyBudget::getDefault() {
+  OccupancyBudget Out;
+  if (MaxOccupancyDrop->getValue() >= 0)
+    Out.MaxWavesPerSIMDDrop = MaxOccupancyDrop->getValue();
+  Out.RetryWithCheaperOptions = OccupancyBudgetRetry->getValue();
+  return Out;
+}
+
+llvm::Error checkOccupancyBudget(const ResourceUsageReport &Report,
+                                 const OccupancyBudget &Budget) {
+  if (!Budget.MaxWavesPerSIMDDrop.has_value() ||
+      Report.getOccupancyDrop() <= *Budget.MaxWavesPerSIMDDrop)
+    return llvm::Error::success();
+  std::string ReportStr;
+  llvm::raw_string_ostream ReportOS(ReportStr);
+  Report.print(ReportOS);
+  return LUTHIER_MAKE_GENERIC_ERROR(llvm::formatv(
+      "Instrumentation lowers the occupancy of the kernel by {0} waves per "
+      "SIMD, exceeding the budget of {1}:\n{2}",
+      Report.getOccupancyDrop(), *Budget.MaxWavesPerSIMDDrop, ReportStr));
+}
+
+} // namespace luthier
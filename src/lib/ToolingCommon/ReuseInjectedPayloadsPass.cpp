@@ -0,0 +1,222 @@
+//===-- ReuseInjectedPayloadsPass.cpp -------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the <tt>ReuseInjectedPayloadsPass</tt> and the
+/// <tt>InjectedPayloadSignature</tt>.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/ReuseInjectedPayloadsPass.h"
+#include "luthier/Tooling/AMDGPURegisterLiveness.h"
+#include "luthier/Tooling/LiftedRepresentation.h"
+#include "luthier/Tooling/PhysRegsNotInLiveInsAnalysis.h"
+#include "luthier/Tooling/SVStorageAndLoadLocations.h"
+#include "luthier/Tooling/WrapperAnalysisPasses.h"
+#include <llvm/ADT/MapVector.h>
+#include <llvm/ADT/SetVector.h>
+#include <llvm/Support/TimeProfiler.h>
+
+#undef DEBUG_TYPE
+
+#define DEBUG_TYPE "luthier-reuse-injected-payloads"
+
+namespace luthier {
+
+static bool
+operator==(const InstrumentationTask::hook_invocation_descriptor &LHS,
+           const InstrumentationTask::hook_invocation_descriptor &RHS) {
+  return LHS.HookName == RHS.HookName && LHS.Args == RHS.Args;
+}
+
+InjectedPayloadSignature InjectedPayloadSignature::get(
+    const llvm::MachineInstr &InstPoint,
+    llvm::ArrayRef<InstrumentationTask::hook_invocation_descriptor> Hooks,
+    const AMDGPURegisterLiveness &RegLiveness,
+    const SVStorageAndLoadLocations &SVLocations) {
+  InjectedPayloadSignature Signature;
+  Signature.Hooks.assign(Hooks.begin(), Hooks.end());
+  if (const auto *LiveIns = RegLiveness.getMFLevelInstrLiveIns(InstPoint)) {
+    for (llvm::MCPhysReg Reg : *LiveIns)
+      Signature.LiveIns.push_back(Reg);
+    llvm::sort(Signature.LiveIns);
+  }
+  if (const auto *LoadPlan =
+          SVLocations.getStateValueArrayLoadPlanForInstPoint(InstPoint)) {
+    Signature.SVALoadVGPR = LoadPlan->StateValueArrayLoadVGPR;
+    Signature.LoadDestClobbersAppVGPR = LoadPlan->LoadDestClobbersAppVGPR;
+    Signature.LoadsSVA = LoadPlan->LoadsSVA;
+    Signature.StoresSVA = LoadPlan->StoresSVA;
+    Signature.SVSScheme = LoadPlan->StateValueStorageLocation.getScheme();
+    LoadPlan->StateValueStorageLocation.getAllStorageRegisters(
+        Signature.SVSRegs);
+  }
+  return Signature;
+}
+
+bool InjectedPayloadSignature::operator==(
+    const InjectedPayloadSignature &Other) const {
+  return Hooks.size() == Other.Hooks.size() &&
+         std::equal(Hooks.begin(), Hooks.end(), Other.Hooks.begin(),
+                    [](const auto &LHS, const auto &RHS) {
+                      return LHS == RHS;
+                    }) &&
+         LiveIns == Other.LiveIns && SVALoadVGPR == Other.SVALoadVGPR &&
+         LoadDestClobbersAppVGPR == Other.LoadDestClobbersAppVGPR &&
+         LoadsSVA == Other.LoadsSVA && StoresSVA == Other.StoresSVA &&
+         SVSScheme == Other.SVSScheme && SVSRegs == Other.SVSRegs;
+}
+
+/// Merges the preamble requirements of payloads generated by a previous
+/// instrumentation into the current preamble descriptor
+static void
+mergePreambleSpecs(FunctionPreambleDescriptor::KernelPreambleSpecs &Dest,
+                   const FunctionPreambleDescriptor::KernelPreambleSpecs &Src) {
+  Dest.RequiresScratchAndStackSetup |= Src.RequiresScratchAndStackSetup;
+  Dest.RequestedAdditionalStackSizeInBytes =
+      std::max(Dest.RequestedAdditionalStackSizeInBytes,
+               Src.RequestedAdditionalStackSizeInBytes);
+  Dest.RequestedKernelArguments.insert(Src.RequestedKernelArguments.begin(),
+                                       Src.RequestedKernelArguments.end());
+  for (const auto &Counter : Src.LDSCounters)
+    Dest.LDSCounters.insert(Counter.getKey());
+}
+
+static void mergePreambleSpecs(
+    FunctionPreambleDescriptor::DeviceFunctionPreambleSpecs &Dest,
+    const FunctionPreambleDescriptor::DeviceFunctionPreambleSpecs &Src) {
+  Dest.UsesStateValueArray |= Src.UsesStateValueArray;
+  Dest.RequiresPreAndPostAmble |= Src.RequiresPreAndPostAmble;
+  Dest.RequiresScratchAndStackSetup |= Src.RequiresScratchAndStackSetup;
+  Dest.RequestedKernelArguments.insert(Src.RequestedKernelArguments.begin(),
+                                       Src.RequestedKernelArguments.end());
+  for (const auto &Counter : Src.LDSCounters)
+    Dest.LDSCounters.insert(Counter.getKey());
+}
+
+llvm::PreservedAnalyses
+ReuseInjectedPayloadsPass::run(llvm::Module &TargetAppM,
+                               llvm::ModuleAnalysisManager &TargetMAM) {
+  llvm::TimeTraceScope Scope("Injected Payload Reuse");
+  auto &IMAM =
+      TargetMAM.getCachedResult<IModulePMAnalysis>(TargetAppM)->getMAM();
+  const auto &IPIP =
+      *IMAM.getCachedResult<InjectedPayloadAndInstPointAnalysis>(IModule);
+  const auto &AccessedPhysRegs =
+      IMAM.getResult<PhysRegsNotInLiveInsAnalysis>(IModule)
+          .getPhysRegsNotInLiveIns();
+  const auto &RegLiveness =
+      TargetMAM.getResult<AMDGPURegLivenessAnalysis>(TargetAppM);
+  const auto &SVLocations =
+      TargetMAM.getResult<LRStateValueStorageAndLoadLocationsAnalysis>(
+          TargetAppM);
+  auto &PreambleDescriptor =
+      TargetMAM.getResult<FunctionPreambleDescriptorAnalysis>(TargetAppM);
+
+  Record.PipelineOptions = Task.getPipelineOptions();
+  Record.PhysRegsNotInLiveIns.assign(AccessedPhysRegs.begin(),
+                                     AccessedPhysRegs.end());
+  llvm::sort(Record.PhysRegsNotInLiveIns);
+  Record.Payloads.clear();
+  Record.NumReusedPayloads = 0;
+  Record.NumGeneratedPayloads = 0;
+
+  // The storage of the state value array at each instrumentation point
+  // depends on the registers accessed by all injected payloads; If they have
+  // changed, so has the code of every injected payload
+  bool CanReuse =
+      Previous != nullptr && Previous->IsReplayable &&
+      Previous->PipelineOptions.producesSameCodeAs(Record.PipelineOptions) &&
+      Previous->PhysRegsNotInLiveIns == Record.PhysRegsNotInLiveIns;
+
+  // Reused payloads, grouped by the machine module info housing them
+  llvm::MapVector<
+      const llvm::MachineModuleInfo *,
+      std::pair<const llvm::Module *,
+                std::unique_ptr<InjectedPayloadAndInstPoint>>>
+      ReusedUnits;
+  // Functions that will have reused payloads patched into them
+  llvm::SmallSetVector<const llvm::MachineFunction *, 4>
+      FunctionsWithReusedPayloads;
+
+  for (const auto &[InstPoint, Payload] : IPIP.mi_payload()) {
+    const hsa::Instr *Inst = LR.getLiftedEquivalent(*InstPoint);
+    // Instructions not lifted from the original code cannot be tracked
+    // across instrumentations
+    if (Inst == nullptr) {
+      Record.NumGeneratedPayloads++;
+      continue;
+    }
+    auto &Entry = Record.Payloads[Inst];
+    auto &Signature = Entry.Signature;
+    Signature = InjectedPayloadSignature::get(
+        *InstPoint, Task.getHookInsertionTasks().lookup(InstPoint),
+        RegLiveness, SVLocations);
+
+    if (CanReuse) {
+      auto PrevIt = Previous->Payloads.find(Inst);
+      if (PrevIt != Previous->Payloads.end() && PrevIt->second.MF != nullptr &&
+          PrevIt->second.Signature == Signature) {
+        const auto &PrevEntry = PrevIt->second;
+        Entry.MF = PrevEntry.MF;
+        Entry.IModule = PrevEntry.IModule;
+        Entry.IMMI = PrevEntry.IMMI;
+        Entry.State = PrevEntry.State;
+        auto &[UnitModule, UnitIPIP] = ReusedUnits[PrevEntry.IMMI];
+        if (!UnitIPIP) {
+          UnitModule = PrevEntry.IModule;
+          UnitIPIP = std::make_unique<InjectedPayloadAndInstPoint>();
+        }
+        // The instrumentation point mapping is only used for look ups; The
+        // reused machine code is never modified
+        UnitIPIP->addEntry(
+            *InstPoint, const_cast<llvm::Function &>(Entry.MF->getFunction()));
+        // Skip generating code for the payload
+        Payload->deleteBody();
+        FunctionsWithReusedPayloads.insert(InstPoint->getMF());
+        Record.NumReusedPayloads++;
+        continue;
+      }
+    }
+    Record.NumGeneratedPayloads++;
+  }
+
+  LLVM_DEBUG(llvm::dbgs() << "Reusing " << Record.NumReusedPayloads
+                          << " injected payloads, generating "
+                          << Record.NumGeneratedPayloads << ".\n");
+
+  // The code gen passes will not run on the reused payloads; Re-apply the
+  // preamble requirements recorded by the previous instrumentation
+  for (const auto *MF : FunctionsWithReusedPayloads) {
+    if (MF->getFunction().getCallingConv() ==
+        llvm::CallingConv::AMDGPU_KERNEL) {
+      if (auto It = Previous->KernelPreambles.find(MF->getName());
+          It != Previous->KernelPreambles.end())
+        mergePreambleSpecs(PreambleDescriptor.Kernels[MF], It->second);
+    } else {
+      if (auto It = Previous->DeviceFunctionPreambles.find(MF->getName());
+          It != Previous->DeviceFunctionPreambles.end())
+        mergePreambleSpecs(PreambleDescriptor.DeviceFunctions[MF],
+                           It->second);
+    }
+  }
+
+  for (auto &[IMMI, Unit] : ReusedUnits) {
+    Result.addReusedUnit(*Unit.first, *IMMI, std::move(Unit.second));
+  }
+
+  return llvm::PreservedAnalyses::all();
+}
+
+} // namespace luthier
@@ -23,7 +23,6 @@
 #include "luthier/Tooling/ProcessIntrinsicsAtIRLevelPass.h"
 #include "luthier/Tooling/WrapperAnalysisPasses.h"
 #include <llvm/Analysis/LoopAnalysisManager.h>
-#include <llvm/Passes/OptimizationLevel.h>
 #include <llvm/Passes/PassBuilder.h>
 #include <llvm/Passes/StandardInstrumentations.h>
 #include <llvm/Support/TimeProfiler.h>
@@ -37,9 +36,10 @@ namespace luthier {
 RunIRPassesOnIModulePass::RunIRPassesOnIModulePass(
     const InstrumentationTask &Task,
     const llvm::StringMap<IntrinsicProcessor> &IntrinsicProcessors,
-    llvm::GCNTargetMachine &TM, llvm::Module &IModule)
+    llvm::GCNTargetMachine &TM, llvm::Module &IModule,
+    const IModulePipelineOptions &Options)
     : TM(TM), Task(Task), IModule(IModule),
-      IntrinsicProcessors(IntrinsicProcessors) {}
+      IntrinsicProcessors(IntrinsicProcessors), Options(Options) {}
 
 llvm::PreservedAnalyses
 RunIRPassesOnIModulePass::run(llvm::Module &TargetAppM,
@@ -86,7 +86,10 @@ RunIRPassesOnIModulePass::run(llvm::Module &TargetAppM,
     // Add the pass that generates the IR for the instrumentation module
     IMPM.addPass(IModuleIRGeneratorPass(Task));
     // Add the IR optimization pipeline
-    IMPM.addPass(PB.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O3));
+    if (auto Err = Options.addIRPipeline(PB, IMPM)) {
+      IModule.getContext().emitError(llvm::toString(std::move(Err)));
+      return llvm::PreservedAnalyses::all();
+    }
     // Add the Intrinsic Processing IR stage pass
     IMPM.addPass(ProcessIntrinsicsAtIRLevelPass(TM));
     // Run the scheduled IR passes
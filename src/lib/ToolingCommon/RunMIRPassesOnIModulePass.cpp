@@ -18,23 +18,44 @@
 /// This file implements the <tt>RunMIRPassesOnIModulePass</tt>.
 //===----------------------------------------------------------------------===//
 #include "luthier/Tooling/RunMIRPassesOnIModulePass.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include "luthier/Tooling/AMDGPURegisterLiveness.h"
 #include "luthier/Tooling/InjectedPayloadPEIPass.h"
 #include "luthier/Tooling/IntrinsicMIRLoweringPass.h"
+#include "luthier/Tooling/LRCallgraph.h"
+#include "luthier/Tooling/MMISlotIndexesAnalysis.h"
+#include "luthier/Tooling/OutlinedHookCallingConvPass.h"
+#include "luthier/Tooling/PhysRegsNotInLiveInsAnalysis.h"
 #include "luthier/Tooling/PhysicalRegAccessVirtualizationPass.h"
+#include "luthier/Tooling/PrePostAmbleEmitter.h"
+#include "luthier/Tooling/SVStorageAndLoadLocations.h"
 #include "luthier/Tooling/WrapperAnalysisPasses.h"
+#include "luthier/consts.h"
+#include <llvm/ADT/ScopeExit.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Support/TimeProfiler.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
-namespace luthier {
+#undef DEBUG_TYPE
 
-llvm::PreservedAnalyses
-RunMIRPassesOnIModulePass::run(llvm::Module &TargetAppM,
-                               llvm::ModuleAnalysisManager &TargetMAM) {
-  auto &IMAM =
-      TargetMAM.getCachedResult<IModulePMAnalysis>(TargetAppM)->getMAM();
-  // Trace for profiling
-  llvm::TimeTraceScope Scope("Instrumentation Module MIR CodeGen Optimization");
+#define DEBUG_TYPE "luthier-imodule-mir-passes"
 
+namespace luthier {
+
+/// Schedules the modified code gen pipeline of \p IModule on \p ILegacyPM
+static void addIModuleCodeGenPasses(llvm::GCNTargetMachine &TM,
+                                    llvm::Module &IModule,
+                                    llvm::ModuleAnalysisManager &IMAM,
+                                    llvm::MachineModuleInfoWrapperPass &IMMIWP,
+                                    llvm::legacy::PassManager &ILegacyPM) {
   // Target library info pass, required by the code gen pipeline
   llvm::TargetLibraryInfoImpl TLII(llvm::Triple(IModule.getTargetTriple()));
 
@@ -56,14 +77,301 @@ RunMIRPassesOnIModulePass::run(llvm::Module &TargetAppM,
 
   ILegacyPM.add(PhysRegPass);
   ILegacyPM.add(new IntrinsicMIRLoweringPass());
+  ILegacyPM.add(new OutlinedHookCallingConvPass());
   TPC->insertPass(&llvm::PrologEpilogCodeInserterID,
                   new InjectedPayloadPEIPass(*PhysRegPass));
   TPC->addMachinePasses();
 
   TPC->setInitialized();
+}
+
+/// \return the injected payloads of \p IPIP, ordered by the position of
+/// their instrumentation points inside \p TargetAppM
+static llvm::SmallVector<const llvm::Function *>
+getInjectedPayloadsInProgramOrder(const llvm::Module &TargetAppM,
+                                  const llvm::MachineModuleInfo &TargetMMI,
+                                  const InjectedPayloadAndInstPoint &IPIP) {
+  llvm::SmallVector<const llvm::Function *> Out;
+  Out.reserve(IPIP.size());
+  for (const auto &F : TargetAppM) {
+    auto *MF = TargetMMI.getMachineFunction(F);
+    if (!MF)
+      continue;
+    for (const auto &MBB : *MF) {
+      for (const auto &MI : MBB.instrs()) {
+        // Payloads reused from a previous instrumentation have no body
+        if (IPIP.contains(MI) && !IPIP.at(MI)->isDeclaration())
+          Out.push_back(IPIP.at(MI));
+      }
+    }
+  }
+  return Out;
+}
+
+/// \return \c true if \p F calls an outlined hook defined in its module
+static bool callsDefinedOutlinedHook(const llvm::Function &F) {
+  for (const auto &I : llvm::instructions(F)) {
+    const auto *CB = llvm::dyn_cast<llvm::CallBase>(&I);
+    if (!CB)
+      continue;
+    const llvm::Function *Callee = CB->getCalledFunction();
+    if (Callee && !Callee->isDeclaration() &&
+        Callee->hasFnAttribute(OutlinedHookAttribute))
+      return true;
+  }
+  return false;
+}
+
+/// Calculates all analyses of \p TargetAppM used by the code gen passes of
+/// the instrumentation module; Once cached, the code gen passes only look
+/// them up, and never insert into \p TargetMAM, which is shared between the
+/// code gen workers
+static void
+calculateTargetAppCodeGenAnalyses(llvm::Module &TargetAppM,
+                                  llvm::ModuleAnalysisManager &TargetMAM) {
+  (void)TargetMAM.getResult<llvm::MachineModuleAnalysis>(TargetAppM);
+  (void)TargetMAM.getResult<AMDGPURegLivenessAnalysis>(TargetAppM);
+  (void)TargetMAM.getResult<LRCallGraphAnalysis>(TargetAppM);
+  (void)TargetMAM.getResult<MMISlotIndexesAnalysis>(TargetAppM);
+  (void)TargetMAM.getResult<FunctionPreambleDescriptorAnalysis>(TargetAppM);
+  (void)TargetMAM.getResult<LRStateValueStorageAndLoadLocationsAnalysis>(
+      TargetAppM);
+}
+
+/// \return a target machine for a code gen worker with the same target as
+/// \p TM; It is borrowed from the \c TargetManager if it is initialized,
+/// and is created directly otherwise (e.g. when code is generated offline)
+static llvm::Expected<PooledTargetMachine>
+getShardTargetMachine(const llvm::GCNTargetMachine &TM) {
+  if (TargetManager::isInitialized()) {
+    hsa_isa_t ISA;
+    LUTHIER_RETURN_ON_ERROR(TargetManager::instance().getISA(TM).moveInto(ISA));
+    return TargetManager::instance().borrowTargetMachine(ISA);
+  }
+  auto *ShardTM = TM.getTarget().createTargetMachine(
+      TM.getTargetTriple().normalize(), TM.getTargetCPU(),
+      TM.getTargetFeatureString(), TM.Options, TM.getRelocationModel(),
+      TM.getCodeModel(), TM.getOptLevel());
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      ShardTM != nullptr,
+      "Failed to create a target machine for a code gen worker."));
+  return PooledTargetMachine(
+      reinterpret_cast<llvm::GCNTargetMachine *>(ShardTM));
+}
+
+llvm::Error
+RunMIRPassesOnIModulePass::runInParallel(llvm::Module &TargetAppM,
+                                         llvm::ModuleAnalysisManager &TargetMAM,
+                                         unsigned NumShards) {
+  auto &IMAM =
+      TargetMAM.getCachedResult<IModulePMAnalysis>(TargetAppM)->getMAM();
+  const auto &IPIP =
+      *IMAM.getCachedResult<InjectedPayloadAndInstPointAnalysis>(IModule);
+  const auto &LoweringInfo =
+      IMAM.getCachedResult<IntrinsicIRLoweringInfoMapAnalysis>(IModule)
+          ->getLoweringInfo();
+  const auto &IntrinsicProcessors =
+      IMAM.getCachedResult<IntrinsicsProcessorsAnalysis>(IModule)
+          ->getProcessors();
+  const auto &PhysRegsNotInLiveIns =
+      IMAM.getResult<PhysRegsNotInLiveInsAnalysis>(IModule)
+          .getPhysRegsNotInLiveIns();
+  auto &TargetMMI =
+      TargetMAM.getCachedResult<llvm::MachineModuleAnalysis>(TargetAppM)
+          ->getMMI();
+
+  // Outlined hooks are only defined in the first shard; Payloads calling
+  // them are pinned to it, as their calling convention and stack usage are
+  // derived from the machine code of the hooks. The rest of the payloads are
+  // split into contiguous shards in program order, so that the same
+  // instrumentation points always end up next to each other
+  auto Payloads =
+      getInjectedPayloadsInProgramOrder(TargetAppM, TargetMMI, IPIP);
+  llvm::DenseMap<const llvm::Function *, unsigned> PayloadShardIdx;
+  llvm::SmallVector<const llvm::Function *> ShardedPayloads;
+  for (const llvm::Function *Payload : Payloads) {
+    if (callsDefinedOutlinedHook(*Payload))
+      PayloadShardIdx.insert({Payload, 0});
+    else
+      ShardedPayloads.push_back(Payload);
+  }
+  NumShards = std::max<unsigned>(
+      1, std::min<unsigned>(NumShards, ShardedPayloads.size()));
+  size_t ShardSize = llvm::divideCeil(ShardedPayloads.size(), NumShards);
+  for (const auto &[Idx, Payload] : llvm::enumerate(ShardedPayloads))
+    PayloadShardIdx.insert({Payload, Idx / ShardSize});
+
+  // The first shard is the instrumentation module itself, which is compiled
+  // on this thread; This way, device functions and global variables are
+  // only ever compiled inside the lifted representation's context, and
+  // the machine code of the other shards is only consulted for the
+  // injected payloads. The rest of the shards are serialized into bitcode,
+  // so that they can be loaded into each worker's own context
+  llvm::SmallVector<llvm::SmallVector<char, 0>> ShardBitcodes(NumShards - 1);
+  llvm::StringMap<llvm::MachineInstr *> PayloadInstPoints;
+  {
+    llvm::TimeTraceScope Scope("Instrumentation Module Sharding");
+    for (unsigned ShardIdx = 1; ShardIdx < NumShards; ++ShardIdx) {
+      llvm::ValueToValueMapTy VMap;
+      auto ShardModule = llvm::CloneModule(
+          IModule, VMap, [&](const llvm::GlobalValue *GV) {
+            auto *F = llvm::dyn_cast<llvm::Function>(GV);
+            return F && F->hasFnAttribute(InjectedPayloadAttribute) &&
+                   PayloadShardIdx.lookup(F) == ShardIdx;
+          });
+      llvm::raw_svector_ostream BCOS(ShardBitcodes[ShardIdx - 1]);
+      llvm::WriteBitcodeToFile(*ShardModule, BCOS);
+    }
+    // Injected payloads of the other shards become declarations in the
+    // instrumentation module; Their instrumentation points are looked up by
+    // name, as the instrumentation module is compiled concurrently with the
+    // workers
+    for (auto &F : IModule) {
+      if (F.hasFnAttribute(InjectedPayloadAttribute) &&
+          PayloadShardIdx.lookup(&F) != 0) {
+        PayloadInstPoints.insert({F.getName(), IPIP.at(F)});
+        F.deleteBody();
+      }
+    }
+  }
+
+  // Get the target machines of the shards on this thread; Their options and
+  // optimization level are reset once they are returned to the pool, or
+  // they are destroyed with the shard otherwise
+  llvm::SmallVector<IModuleCodeGenShard *> Shards;
+  for (unsigned ShardIdx = 1; ShardIdx < NumShards; ++ShardIdx) {
+    auto Shard = std::make_unique<IModuleCodeGenShard>();
+    LUTHIER_RETURN_ON_ERROR(getShardTargetMachine(TM).moveInto(Shard->TM));
+    Shard->TM->Options = TM.Options;
+    Shard->TM->setOptLevel(Options.MIROptLevel);
+    Shards.push_back(Shard.get());
+    Result.addShard(std::move(Shard));
+  }
+
+  llvm::SmallVector<llvm::Error> ShardErrors;
+  for (unsigned ShardIdx = 1; ShardIdx < NumShards; ++ShardIdx)
+    ShardErrors.push_back(llvm::Error::success());
+  {
+    llvm::TimeTraceScope Scope("Instrumentation Module Parallel MIR CodeGen");
+    // With a single shard left, there is nothing for workers to compile
+    std::unique_ptr<llvm::DefaultThreadPool> Pool;
+    if (!Shards.empty())
+      Pool = std::make_unique<llvm::DefaultThreadPool>(
+          llvm::hardware_concurrency(Shards.size()));
+    for (unsigned ShardIdx = 0; ShardIdx < Shards.size(); ++ShardIdx) {
+      Pool->async([&, ShardIdx]() {
+        auto &Shard = *Shards[ShardIdx];
+        auto &Err = ShardErrors[ShardIdx];
+        llvm::ErrorAsOutParameter EAO(&Err);
+        auto BCBuffer = llvm::MemoryBuffer::getMemBuffer(
+            llvm::toStringRef(ShardBitcodes[ShardIdx]), "", false);
+        auto ShardModule = llvm::parseBitcodeFile(*BCBuffer, Shard.Context);
+        if ((Err = ShardModule.takeError()))
+          return;
+        Shard.IModule = std::move(*ShardModule);
+        // Seed the shard's analyses with the results gathered at the IR
+        // stage of the instrumentation module
+        Shard.IMAM.registerPass(
+            [&]() { return llvm::PassInstrumentationAnalysis(); });
+        Shard.IMAM.registerPass(
+            [&]() { return IntrinsicIRLoweringInfoMapAnalysis(LoweringInfo); });
+        Shard.IMAM.registerPass([&]() {
+          return IntrinsicsProcessorsAnalysis(IntrinsicProcessors);
+        });
+        Shard.IMAM.registerPass([&]() {
+          return PhysRegsNotInLiveInsAnalysis(PhysRegsNotInLiveIns);
+        });
+        Shard.IMAM.registerPass([&]() {
+          return TargetAppModuleAndMAMAnalysis(TargetMAM, TargetAppM);
+        });
+        Shard.IMAM.registerPass(
+            [&]() { return InjectedPayloadAndInstPointAnalysis(); });
+        (void)Shard.IMAM.getResult<IntrinsicIRLoweringInfoMapAnalysis>(
+            *Shard.IModule);
+        (void)Shard.IMAM.getResult<IntrinsicsProcessorsAnalysis>(
+            *Shard.IModule);
+        (void)Shard.IMAM.getResult<PhysRegsNotInLiveInsAnalysis>(
+            *Shard.IModule);
+        // Injected payloads keep their (unique) names across the bitcode
+        // round trip; Use them to find their instrumentation points
+        auto &ShardIPIP =
+            Shard.IMAM.getResult<InjectedPayloadAndInstPointAnalysis>(
+                *Shard.IModule);
+        for (auto &F : *Shard.IModule) {
+          if (F.isDeclaration() || !F.hasFnAttribute(InjectedPayloadAttribute))
+            continue;
+          auto InstPoint = PayloadInstPoints.find(F.getName());
+          if ((Err = LUTHIER_GENERIC_ERROR_CHECK(
+                   InstPoint != PayloadInstPoints.end(),
+                   llvm::formatv("Failed to find the instrumentation point of "
+                                 "injected payload {0}.",
+                                 F.getName()))))
+            return;
+          ShardIPIP.addEntry(*InstPoint->second, F);
+        }
+        // Run the code gen pipeline on the shard
+        Shard.LegacyPM = std::make_unique<llvm::legacy::PassManager>();
+        Shard.MMIWP = new llvm::MachineModuleInfoWrapperPass(Shard.TM.get());
+        addIModuleCodeGenPasses(*Shard.TM, *Shard.IModule, Shard.IMAM,
+                                *Shard.MMIWP, *Shard.LegacyPM);
+        Shard.LegacyPM->run(*Shard.IModule);
+      });
+    }
+    // Compile the first shard while the workers are busy
+    addIModuleCodeGenPasses(TM, IModule, IMAM, IMMIWP, ILegacyPM);
+    ILegacyPM.run(IModule);
+    if (Pool)
+      Pool->wait();
+  }
+
+  // Report the failures of all shards, so that none is left unchecked
+  llvm::Error Err = llvm::Error::success();
+  for (auto &ShardErr : ShardErrors)
+    Err = llvm::joinErrors(std::move(Err), std::move(ShardErr));
+  LUTHIER_RETURN_ON_ERROR(std::move(Err));
+
+  Result.addUnit(IModule, IMMIWP.getMMI(), IPIP);
+  for (const auto &Shard : Shards) {
+    Result.addUnit(
+        *Shard->IModule, Shard->MMIWP->getMMI(),
+        *Shard->IMAM.getCachedResult<InjectedPayloadAndInstPointAnalysis>(
+            *Shard->IModule));
+  }
+  return llvm::Error::success();
+}
+
+llvm::PreservedAnalyses
+RunMIRPassesOnIModulePass::run(llvm::Module &TargetAppM,
+                               llvm::ModuleAnalysisManager &TargetMAM) {
+  auto &IMAM =
+      TargetMAM.getCachedResult<IModulePMAnalysis>(TargetAppM)->getMAM();
+  // Trace for profiling
+  llvm::TimeTraceScope Scope("Instrumentation Module MIR CodeGen Optimization");
+
+  const auto &IPIP =
+      *IMAM.getCachedResult<InjectedPayloadAndInstPointAnalysis>(IModule);
+
+  // The target machine is shared with the rest of the lifted representation;
+  // Only use the requested optimization level while the instrumentation
+  // module's code gen pipeline is being constructed and run
+  llvm::CodeGenOptLevel OriginalOptLevel = TM.getOptLevel();
+  TM.setOptLevel(Options.MIROptLevel);
+  auto RestoreOptLevel =
+      llvm::make_scope_exit([&]() { TM.setOptLevel(OriginalOptLevel); });
+
+  calculateTargetAppCodeGenAnalyses(TargetAppM, TargetMAM);
+
+  if (Options.CodeGenThreads > 1 && IPIP.size() > 1) {
+    if (auto Err = runInParallel(TargetAppM, TargetMAM, Options.CodeGenThreads))
+      IModule.getContext().emitError(llvm::toString(std::move(Err)));
+  } else {
+    addIModuleCodeGenPasses(TM, IModule, IMAM, IMMIWP, ILegacyPM);
+
+    ILegacyPM.run(IModule);
 
-  ILegacyPM.run(IModule);
+    Result.addUnit(IModule, IMMIWP.getMMI(), IPIP);
+  }
 
   return llvm::PreservedAnalyses::all();
 }
-} // namespace luthier
\ No newline at end of file
+} // namespace luthier
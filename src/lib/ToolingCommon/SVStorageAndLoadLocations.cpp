@@ -25,11 +25,15 @@
 #include "luthier/Tooling/MMISlotIndexesAnalysis.h"
 #include "luthier/Tooling/PhysRegsNotInLiveInsAnalysis.h"
 #include "luthier/Tooling/StateValueArrayStorage.h"
+#include "luthier/Tooling/StateValueArraySpecs.h"
 #include "luthier/Tooling/WrapperAnalysisPasses.h"
+#include "luthier/consts.h"
 #include <GCNSubtarget.h>
+#include <llvm/ADT/BitVector.h>
 #include <llvm/CodeGen/TargetRegisterInfo.h>
 #include <llvm/CodeGen/TargetSubtargetInfo.h>
 
+#include <array>
 #include <utility>
 
 #undef DEBUG_TYPE
@@ -37,135 +41,165 @@
 
 namespace luthier {
 
-/// Scavenges \p NumRegs registers with class \p RC available in \p MRI
-/// Availability means a register is allocatable and not in \p MRI and
-/// is not in \p AccessedPhysicalRegsNotInLiveIns and not in \p LiveInRegs
-/// \param [in] MRI the \c llvm::MachineRegisterInfo of the function being
-/// scavenged
-/// \param [in] RC the \c llvm::TargetRegisterClass of the register(s) to be
-//// scavenged
-/// \param [in] AccessedPhysicalRegsNotInLiveIns a set of physical registers
-/// that are accessed by injected payloads of the instrumentation module but
-/// at the point of access are not part of the Live-in registers of the
-/// instrumentation points
-/// \param [in] LiveInRegs a set of physical registers that are live at the
-/// app instruction where the register scavenging is taking place
-/// \param [in] NumRegs the number of registers to be scavenged
-/// \param [out] ScavengedRegs the registers scavenged by the function
-static void
-scavengeFreeRegister(const llvm::MachineRegisterInfo &MRI,
-                     const llvm::TargetRegisterClass &RC,
-                     const llvm::LivePhysRegs &AccessedPhysicalRegsNotInLiveIns,
-                     const llvm::LivePhysRegs &LiveInRegs, int NumRegs,
-                     llvm::SmallVectorImpl<llvm::MCRegister> &ScavengedRegs) {
-  int NumRegsFound = 0;
-  for (llvm::MCRegister Reg : reverse(RC)) {
-    if (MRI.isAllocatable(Reg) && !MRI.isPhysRegUsed(Reg) &&
-        AccessedPhysicalRegsNotInLiveIns.available(MRI, Reg) &&
-        LiveInRegs.available(MRI, Reg)) {
-      ScavengedRegs.push_back(Reg);
-      NumRegsFound++;
-      if (NumRegsFound == NumRegs)
-        return;
+/// \brief Bitset view of the 32-bit register classes the state value array
+/// can be stored in
+/// \details Bit \c I of each bitset corresponds to the <tt>I</tt>th register
+/// of its class. Usage and liveness information is converted into these
+/// bitsets once, so that free register queries are answered with bitset
+/// intersections and bit scans instead of querying the liveness and usage of
+/// every candidate register and its aliases
+class SVARegClassBitSets {
+public:
+  /// Register classes tracked by the bitsets
+  enum ClassKind : unsigned { VGPR = 0, AGPR = 1, SGPR = 2, NumClasses = 3 };
+
+  /// A bitset for each register class, indexed by \c ClassKind
+  using BitSets = std::array<llvm::BitVector, NumClasses>;
+
+private:
+  const llvm::TargetRegisterInfo &TRI;
+
+  /// Maps each register unit of the target to the class and the index of the
+  /// 32-bit register containing it, or to \c NumClasses if it is not part of
+  /// any of the tracked classes
+  llvm::SmallVector<std::pair<ClassKind, unsigned>> UnitToClassRegIdx;
+
+public:
+  explicit SVARegClassBitSets(const llvm::TargetRegisterInfo &TRI)
+      : TRI(TRI), UnitToClassRegIdx(TRI.getNumRegUnits(), {NumClasses, 0}) {
+    for (unsigned K = 0; K < NumClasses; ++K) {
+      const auto &RC = getRegClass(static_cast<ClassKind>(K));
+      for (unsigned I = 0; I < RC.getNumRegs(); ++I) {
+        for (unsigned Unit : TRI.regunits(RC.getRegister(I)))
+          UnitToClassRegIdx[Unit] = {static_cast<ClassKind>(K), I};
+      }
     }
   }
-}
 
-/// Scavenges \p NumRegs registers with class \p RC available in \p MRI
-/// Availability means a register is allocatable and not used in \p MRI and
-/// is not in \p AccessedPhysicalRegsNotInLiveIns and not in \p LiveInRegs
-/// \param MRI the \c llvm::MachineRegisterInfo of the function being
-/// scavenged
-/// \param RC the \c llvm::TargetRegisterClass of the register to be
-//// scavenged
-/// \param AccessedPhysicalRegsNotInLiveIns a set of physical registers
-/// that are accessed by injected payloads of the instrumentation module but
-/// at the point of access are not part of the Live-in registers of the
-/// instrumentation points
-/// \param LiveInRegs a set of physical registers that are live at the
-/// app instruction where the register scavenging is taking place
-/// \return the scavenged register if successful, or zero otherwise
-static llvm::MCRegister
-scavengeFreeRegister(const llvm::MachineRegisterInfo &MRI,
-                     const llvm::TargetRegisterClass &RC,
-                     const llvm::LivePhysRegs &AccessedPhysicalRegsNotInLiveIns,
-                     const llvm::LivePhysRegs &LiveInRegs) {
-  for (llvm::MCRegister Reg : reverse(RC)) {
-    if (MRI.isAllocatable(Reg) && !MRI.isPhysRegUsed(Reg) &&
-        AccessedPhysicalRegsNotInLiveIns.available(MRI, Reg) &&
-        LiveInRegs.available(MRI, Reg)) {
-      return Reg;
+  static const llvm::TargetRegisterClass &getRegClass(ClassKind K) {
+    switch (K) {
+    case VGPR:
+      return llvm::AMDGPU::VGPR_32RegClass;
+    case AGPR:
+      return llvm::AMDGPU::AGPR_32RegClass;
+    default:
+      return llvm::AMDGPU::SGPR_32RegClass;
     }
   }
-  return {};
-}
 
-/// Scavenges \p NumRegs register of class \p RC that are unused across
-/// all \p RelatedFunctions and are not in \p AccessedPhysRegsNotInLiveIns
-/// \param [in] Functions the functions being scavenged for a free register
-/// \param [in] RC the register class of the registers being scavenged
-/// \param [in] AccessedPhysRegsNotInLiveIns a set of physical registers
-/// accessed by the injected payloads that are not in the live-in set of their
-/// injected payload at the point of access
-/// \param [in] NumRegs number of registers to be scavenged
-/// \param [out] Regs the set of registers that were scavenged
-static void
-scavengeFreeRegister(llvm::ArrayRef<llvm::MachineFunction *> Functions,
-                     const llvm::TargetRegisterClass *RC,
-                     const llvm::LivePhysRegs &AccessedPhysRegsNotInLiveIns,
-                     unsigned int NumRegs,
-                     llvm::SmallVectorImpl<llvm::MCRegister> &Regs) {
-  unsigned int NumRegFound = 0;
-
-  for (llvm::MCRegister Reg : *RC) {
-    bool IsUnused = llvm::all_of(Functions, [&](llvm::MachineFunction *MF) {
-      auto &MRI = MF->getRegInfo();
-
-      LLVM_DEBUG(auto TRI = MF->getSubtarget().getRegisterInfo();
-                 llvm::dbgs() << "Trying to scavenged register "
-                              << llvm::printReg(Reg, TRI) << "...\n";
-                 llvm::dbgs()
-                 << "Is reg allocatable? " << MRI.isAllocatable(Reg) << ".\n";
-                 llvm::dbgs()
-                 << "Is not used? " << !MRI.isPhysRegUsed(Reg) << ".\n";
-                 llvm::dbgs()
-                 << "Is not in accessed phys regs not in live-ins? "
-                 << AccessedPhysRegsNotInLiveIns.available(MRI, Reg) << ".\n";);
-
-      return MRI.isAllocatable(Reg) && !MRI.isPhysRegUsed(Reg) &&
-             AccessedPhysRegsNotInLiveIns.available(MRI, Reg);
-    });
-    if (IsUnused) {
-      Regs.push_back(Reg);
-      NumRegFound++;
-      if (NumRegFound == NumRegs) {
-        LLVM_DEBUG(llvm::dbgs() << "Found " << NumRegFound
-                                << " registers; Scavenging was a success!\n";);
-        return;
+  /// \return bitsets with no registers set
+  [[nodiscard]] BitSets getEmptyBitSets() const {
+    BitSets Out;
+    for (unsigned K = 0; K < NumClasses; ++K)
+      Out[K].resize(getRegClass(static_cast<ClassKind>(K)).getNumRegs());
+    return Out;
+  }
+
+  /// Sets every register in \p Out that overlaps with \p Reg
+  void addReg(BitSets &Out, llvm::MCRegister Reg) const {
+    for (unsigned Unit : TRI.regunits(Reg)) {
+      auto [K, I] = UnitToClassRegIdx[Unit];
+      if (K != NumClasses)
+        Out[K].set(I);
+    }
+  }
+
+  /// \return bitsets with every register that overlaps with a register in
+  /// \p LiveRegs set
+  [[nodiscard]] BitSets getLiveRegs(const llvm::LivePhysRegs &LiveRegs) const {
+    BitSets Out = getEmptyBitSets();
+    for (llvm::MCPhysReg Reg : LiveRegs)
+      addReg(Out, Reg);
+    return Out;
+  }
+
+  /// \return bitsets with every register that overlaps with a register in
+  /// \p LiveIns, or with a register written or clobbered by \p MI set; These
+  /// registers cannot hold the state value array while \p MI executes
+  /// \param LiveIns the registers live right before \p MI
+  [[nodiscard]] BitSets getOccupiedRegs(const llvm::LivePhysRegs &LiveIns,
+                                        const llvm::MachineInstr &MI) const {
+    BitSets Out = getLiveRegs(LiveIns);
+    for (const llvm::MachineOperand &MO : MI.operands()) {
+      if (MO.isReg() && MO.isDef() && MO.getReg().isPhysical())
+        addReg(Out, MO.getReg());
+      else if (MO.isRegMask()) {
+        for (unsigned K = 0; K < NumClasses; ++K) {
+          const auto &RC = getRegClass(static_cast<ClassKind>(K));
+          for (unsigned I = 0; I < RC.getNumRegs(); ++I) {
+            if (MO.clobbersPhysReg(RC.getRegister(I)))
+              Out[K].set(I);
+          }
+        }
       }
     }
+    return Out;
   }
-}
 
-llvm::MCRegister
-scavengeFreeRegister(llvm::ArrayRef<llvm::MachineFunction *> RelatedFunctions,
-                     const llvm::TargetRegisterClass *RC,
-                     const llvm::LivePhysRegs &AccessedPhysRegsNotInLiveIns) {
-  for (llvm::MCRegister Reg : *RC) {
-    bool IsUnused =
-        llvm::all_of(RelatedFunctions, [&](llvm::MachineFunction *MF) {
-          auto &MRI = MF->getRegInfo();
-          bool IsUnusedInMF = MRI.isAllocatable(Reg) && !MRI.isPhysRegUsed(Reg);
-          if (!AccessedPhysRegsNotInLiveIns.empty())
-            IsUnusedInMF = IsUnusedInMF &&
-                           AccessedPhysRegsNotInLiveIns.available(MRI, Reg);
-          return IsUnusedInMF;
-        });
-    if (IsUnused) {
-      return Reg;
+  /// \return bitsets with every register that is allocatable and not used in
+  /// \p MRI, and is not in \p AccessedPhysicalRegsNotInLiveIns set
+  /// \param MRI the \c llvm::MachineRegisterInfo of the function being
+  /// scavenged
+  /// \param AccessedPhysicalRegsNotInLiveIns a set of physical registers
+  /// that are accessed by injected payloads of the instrumentation module but
+  /// at the point of access are not part of the Live-in registers of the
+  /// instrumentation points
+  [[nodiscard]] BitSets getUnusedRegs(
+      const llvm::MachineRegisterInfo &MRI,
+      const llvm::LivePhysRegs &AccessedPhysicalRegsNotInLiveIns) const {
+    BitSets Out = getEmptyBitSets();
+    for (unsigned K = 0; K < NumClasses; ++K) {
+      const auto &RC = getRegClass(static_cast<ClassKind>(K));
+      for (unsigned I = 0; I < RC.getNumRegs(); ++I) {
+        llvm::MCRegister Reg = RC.getRegister(I);
+        if (MRI.isAllocatable(Reg) && !MRI.isPhysRegUsed(Reg) &&
+            AccessedPhysicalRegsNotInLiveIns.available(MRI, Reg))
+          Out[K].set(I);
+      }
     }
+    return Out;
+  }
+};
+
+/// Removes the registers set in \p RHS from \p LHS
+static void resetBitSets(SVARegClassBitSets::BitSets &LHS,
+                         const SVARegClassBitSets::BitSets &RHS) {
+  for (unsigned K = 0; K < SVARegClassBitSets::NumClasses; ++K)
+    LHS[K].reset(RHS[K]);
+}
+
+/// Scavenges up to \p NumRegs registers of class \p K from \p FreeRegs by
+/// scanning its set bits
+/// \param [in] FreeRegs the registers available for scavenging
+/// \param [in] K the class of the registers being scavenged
+/// \param [in] NumRegs the number of registers to be scavenged
+/// \param [in] HighestFirst if \c true, the highest numbered free registers
+/// are scavenged first
+/// \param [out] ScavengedRegs the registers scavenged by the function
+static void
+scavengeFreeRegister(const SVARegClassBitSets::BitSets &FreeRegs,
+                     SVARegClassBitSets::ClassKind K, unsigned int NumRegs,
+                     bool HighestFirst,
+                     llvm::SmallVectorImpl<llvm::MCRegister> &ScavengedRegs) {
+  const auto &RC = SVARegClassBitSets::getRegClass(K);
+  const llvm::BitVector &Free = FreeRegs[K];
+  unsigned int NumRegsFound = 0;
+  for (int I = HighestFirst ? Free.find_last() : Free.find_first();
+       I != -1 && NumRegsFound < NumRegs;
+       I = HighestFirst ? Free.find_prev(I) : Free.find_next(I)) {
+    ScavengedRegs.push_back(RC.getRegister(I));
+    NumRegsFound++;
   }
-  return {};
+}
+
+/// Scavenges a single register of class \p K from \p FreeRegs
+/// \return the scavenged register if successful, or zero otherwise
+static llvm::MCRegister
+scavengeFreeRegister(const SVARegClassBitSets::BitSets &FreeRegs,
+                     SVARegClassBitSets::ClassKind K, bool HighestFirst) {
+  llvm::SmallVector<llvm::MCRegister, 1> Reg;
+  scavengeFreeRegister(FreeRegs, K, 1, HighestFirst, Reg);
+  return Reg.empty() ? llvm::MCRegister{} : Reg[0];
 }
 
 /// Selects a VGPR to load the state value array into for use for the
@@ -173,23 +207,21 @@ scavengeFreeRegister(llvm::ArrayRef<llvm::MachineFunction *> RelatedFunctions,
 /// \param InstPoint instrumentation point for which we are selecting a VGPR
 /// to load the state value array into
 /// \param SVS the state value array storage at the location of \p InstPoint
-/// \param InstPointLiveRegs a set of physical registers that are live before
-/// the \p InstPoint
 /// \param AccessedPhysicalRegsNotInLiveIns a set of physical registers
 /// accessed in injected payloads that aren't in the live-ins set of their
 /// instrumentation point at the point of access
-/// \param ScavengeDeadAVGPRs if \c true then it will try to scavenge a dead
-/// A/VGPR that is not used at the instrumentation point; This flag is only
-/// set when the state value array storage is fixed
+/// \param FreeRegsAtInstPoint if not \c nullptr then it will try to scavenge
+/// a dead A/VGPR from the registers that are unused and not live at the
+/// instrumentation point; This is only passed when the state value array
+/// storage is fixed
 /// \return a pair, with the first element indicating the VGPR selected, and
 /// the second element indicating whether the selected VGPR will clobber a
 /// live register of the app and needs preserving
 static std::pair<llvm::MCRegister, bool>
 selectVGPRLoadLocationForInjectedPayload(
     const llvm::MachineInstr &InstPoint, StateValueArrayStorage &SVS,
-    const llvm::LivePhysRegs &InstPointLiveRegs,
     const llvm::LivePhysRegs &AccessedPhysicalRegsNotInLiveIns,
-    bool ScavengeDeadAVGPRs) {
+    const SVARegClassBitSets::BitSets *FreeRegsAtInstPoint) {
   llvm::MCRegister AVGPRLocation{0};
   bool ClobbersAppRegister{false};
   // if the state value array already in a VGPR, then select the same VGPR
@@ -197,21 +229,19 @@ selectVGPRLoadLocationForInjectedPayload(
   if (!SVS.requiresLoadAndStoreBeforeUse())
     AVGPRLocation = SVS.getStateValueStorageReg();
   else {
-    if (!ScavengeDeadAVGPRs) {
+    if (FreeRegsAtInstPoint == nullptr) {
       AVGPRLocation = llvm::AMDGPU::VGPR0;
       ClobbersAppRegister = true;
     } else {
       auto &InstrumentedMF = *InstPoint.getParent()->getParent();
       // Scavenge a dead VGPR to hold the state value array
-      AVGPRLocation = scavengeFreeRegister(
-          InstrumentedMF.getRegInfo(), llvm::AMDGPU::VGPR_32RegClass,
-          AccessedPhysicalRegsNotInLiveIns, InstPointLiveRegs);
+      AVGPRLocation = scavengeFreeRegister(*FreeRegsAtInstPoint,
+                                           SVARegClassBitSets::VGPR, true);
       // Scavenge a dead AGPR to hold the state value array if no VGPR is
       // found
       if (AVGPRLocation == 0)
-        AVGPRLocation = scavengeFreeRegister(
-            InstrumentedMF.getRegInfo(), llvm::AMDGPU::AGPR_32RegClass,
-            AccessedPhysicalRegsNotInLiveIns, InstPointLiveRegs);
+        AVGPRLocation = scavengeFreeRegister(*FreeRegsAtInstPoint,
+                                             SVARegClassBitSets::AGPR, true);
       if (AVGPRLocation == 0) {
         ClobbersAppRegister = true;
         auto &InstrumentedMFRI = InstrumentedMF.getRegInfo();
@@ -251,18 +281,17 @@ selectVGPRLoadLocationForInjectedPayload(
 /// then as a last resort, this function tries to find three free SGPRs
 /// that can be used to spill an app's VGPR onto the stack, and load the
 /// state value array from the stack
+/// \param UnusedRegs the registers unused across all the related functions
 /// TODO: This function must take an argument indicating whether the tool
 /// writer wants to respect the original kernel's granulated register usage
 /// or not.
 static std::shared_ptr<StateValueArrayStorage> findFixedStateValueArrayStorage(
-    llvm::ArrayRef<llvm::MachineFunction *> RelatedFunctions,
+    const SVARegClassBitSets::BitSets &UnusedRegs,
     llvm::ArrayRef<StateValueArrayStorage::StorageKind> SupportedStorage,
-    int MaxAGPRsUsedByAllStorage, int MaxSGPRsUsedByAllStorage,
-    const llvm::LivePhysRegs &AccessedPhysicalRegistersNotInLiveIns) {
+    int MaxAGPRsUsedByAllStorage, int MaxSGPRsUsedByAllStorage) {
   // Find the next VGPR available to hold the value state array
   llvm::MCRegister StateValueArrayFixedVGPRLocation =
-      scavengeFreeRegister(RelatedFunctions, &llvm::AMDGPU::VGPR_32RegClass,
-                           AccessedPhysicalRegistersNotInLiveIns);
+      scavengeFreeRegister(UnusedRegs, SVARegClassBitSets::VGPR, false);
   // If we failed to find a free VGPR, we then have to scavenge for all
   // possible SGPRs and AGPRs that can be used in storing the state value
   // array
@@ -270,13 +299,11 @@ static std::shared_ptr<StateValueArrayStorage> findFixedStateValueArrayStorage(
     llvm::SmallVector<llvm::MCRegister, 3> SGPRsScavenged;
     llvm::SmallVector<llvm::MCRegister, 2> AGPRsScavenged;
     // Scavenge the maximum number of AGPRs used by all storage schemes
-    scavengeFreeRegister(RelatedFunctions, &llvm::AMDGPU::AGPR_32RegClass,
-                         AccessedPhysicalRegistersNotInLiveIns,
-                         MaxAGPRsUsedByAllStorage, AGPRsScavenged);
+    scavengeFreeRegister(UnusedRegs, SVARegClassBitSets::AGPR,
+                         MaxAGPRsUsedByAllStorage, false, AGPRsScavenged);
     // Scavenge the maximum number of SGPRs used by all storage schemes
-    scavengeFreeRegister(RelatedFunctions, &llvm::AMDGPU::SGPR_32RegClass,
-                         AccessedPhysicalRegistersNotInLiveIns,
-                         MaxSGPRsUsedByAllStorage, SGPRsScavenged);
+    scavengeFreeRegister(UnusedRegs, SVARegClassBitSets::SGPR,
+                         MaxSGPRsUsedByAllStorage, false, SGPRsScavenged);
 
     LLVM_DEBUG(
 
@@ -323,30 +350,45 @@ static std::shared_ptr<StateValueArrayStorage> findFixedStateValueArrayStorage(
         StateValueArrayFixedVGPRLocation);
 }
 
+/// Finds a location to store the state value array at an instruction
+/// \param FreeRegs the registers that are unused and not live at the
+/// instruction
+/// \param StableFreeRegs a subset of \p FreeRegs which remain free until the
+/// end of the instruction's basic block; These are preferred, so that the
+/// state value array is not moved again in the same block, and fewer storage
+/// segments (and code to move the state value array between them) are
+/// created
 static std::shared_ptr<StateValueArrayStorage> findStateValueArrayStorageAtMI(
-    const llvm::MachineRegisterInfo &MRI, const llvm::LivePhysRegs &MILiveIns,
-    const llvm::LivePhysRegs &AccessedPhysicalRegistersNotInLiveIns,
+    const SVARegClassBitSets::BitSets &FreeRegs,
+    const SVARegClassBitSets::BitSets &StableFreeRegs,
     llvm::ArrayRef<StateValueArrayStorage::StorageKind> SupportedStorage,
     int MaxAGPRsUsedByAllStorage, int MaxSGPRsUsedByAllStorage) {
+  SVARegClassBitSets::BitSets UnstableFreeRegs = FreeRegs;
+  resetBitSets(UnstableFreeRegs, StableFreeRegs);
+  // Scavenges the free registers of class K, starting with the stable ones
+  auto Scavenge = [&](SVARegClassBitSets::ClassKind K, unsigned int NumRegs,
+                      llvm::SmallVectorImpl<llvm::MCRegister> &Regs) {
+    scavengeFreeRegister(StableFreeRegs, K, NumRegs, true, Regs);
+    if (Regs.size() < NumRegs)
+      scavengeFreeRegister(UnstableFreeRegs, K, NumRegs - Regs.size(), true,
+                           Regs);
+  };
   // Find the next VGPR available to hold the value state array
-  llvm::MCRegister StateValueArrayVGPRLocation =
-      scavengeFreeRegister(MRI, llvm::AMDGPU::VGPR_32RegClass,
-                           AccessedPhysicalRegistersNotInLiveIns, MILiveIns);
+  llvm::SmallVector<llvm::MCRegister, 1> VGPRsScavenged;
+  Scavenge(SVARegClassBitSets::VGPR, 1, VGPRsScavenged);
   // If we failed to find a free VGPR, we then have to scavenge for all
   // possible SGPRs and AGPRs that can be used in storing the state value
   // array
-  if (StateValueArrayVGPRLocation == 0) {
+  if (VGPRsScavenged.empty()) {
     llvm::SmallVector<llvm::MCRegister, 3> SGPRsScavenged;
     llvm::SmallVector<llvm::MCRegister, 2> AGPRsScavenged;
     // Scavenge the maximum number of AGPRs used by all storage schemes
-    scavengeFreeRegister(MRI, llvm::AMDGPU::AGPR_32RegClass,
-                         AccessedPhysicalRegistersNotInLiveIns, MILiveIns,
-                         MaxAGPRsUsedByAllStorage, AGPRsScavenged);
+    Scavenge(SVARegClassBitSets::AGPR, MaxAGPRsUsedByAllStorage,
+             AGPRsScavenged);
 
     // Scavenge the maximum number of SGPRs used by all storage schemes
-    scavengeFreeRegister(MRI, llvm::AMDGPU::SGPR_32RegClass,
-                         AccessedPhysicalRegistersNotInLiveIns, MILiveIns,
-                         MaxSGPRsUsedByAllStorage, SGPRsScavenged);
+    Scavenge(SVARegClassBitSets::SGPR, MaxSGPRsUsedByAllStorage,
+             SGPRsScavenged);
 
     LLVM_DEBUG(
 
@@ -380,8 +422,295 @@ static std::shared_ptr<StateValueArrayStorage> findStateValueArrayStorageAtMI(
     // for the state value array, so we return nullptr
     return nullptr;
   } else
-    return std::make_shared<VGPRStateValueArrayStorage>(
-        StateValueArrayVGPRLocation);
+    return std::make_shared<VGPRStateValueArrayStorage>(VGPRsScavenged[0]);
+}
+
+/// Calculates the registers live at or written by each instruction of \p MBB
+/// or any instruction after it until the end of \p MBB
+/// \param [in] MBB the basic block being analyzed
+/// \param [in] RegLiveness the register liveness analysis of \p MBB
+/// \param [in] RegClassBitSets used to convert the live registers to bitsets
+/// \param [out] Out the occupied registers of each instruction, in order
+/// \return an \c llvm::Error if the liveness of an instruction is missing
+static llvm::Error getLiveRegsUntilMBBEnd(
+    const llvm::MachineBasicBlock &MBB,
+    const AMDGPURegisterLiveness &RegLiveness,
+    const SVARegClassBitSets &RegClassBitSets,
+    llvm::SmallVectorImpl<SVARegClassBitSets::BitSets> &Out) {
+  unsigned int Idx = std::distance(MBB.begin(), MBB.end());
+  Out.assign(Idx, RegClassBitSets.getEmptyBitSets());
+  for (const auto &MI : llvm::reverse(MBB)) {
+    --Idx;
+    auto *InstrLiveRegs = RegLiveness.getMFLevelInstrLiveIns(MI);
+    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        InstrLiveRegs != nullptr,
+        llvm::formatv(
+            "Failed to get the live physical register set for MI {0}.", MI)));
+    Out[Idx] = RegClassBitSets.getOccupiedRegs(*InstrLiveRegs, MI);
+    if (Idx + 1 < Out.size()) {
+      for (unsigned K = 0; K < SVARegClassBitSets::NumClasses; ++K)
+        Out[Idx][K] |= Out[Idx + 1][K];
+    }
+  }
+  return llvm::Error::success();
+}
+
+/// Queries the state value array storage schemes supported by \p ST, in
+/// order of preference, and the maximum number of AGPRs and SGPRs used by
+/// any of them; The maximums save time during register scavenging
+/// \return an \c llvm::Error if no storage scheme is supported by \p ST
+static llvm::Error getSupportedSVAStorage(
+    const llvm::GCNSubtarget &ST,
+    llvm::SmallVectorImpl<StateValueArrayStorage::StorageKind>
+        &SupportedStorage,
+    int &MaxNumAGPRsUsedByAllStorage, int &MaxNumSGPRsUsedByAllStorage) {
+  getSupportedSVAStorageList(ST, SupportedStorage);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !SupportedStorage.empty(),
+      llvm::formatv("Failed to find compatible state value array storage "
+                    "for ST {0}, CPU {1}.",
+                    ST.getTargetTriple().str(), ST.getCPU())));
+  MaxNumAGPRsUsedByAllStorage = 0;
+  MaxNumSGPRsUsedByAllStorage = 0;
+  for (const auto &StorageScheme : SupportedStorage) {
+    int MaxNumAGPRsUsedByStorage =
+        StateValueArrayStorage::getNumAGPRsUsed(StorageScheme);
+    if (MaxNumAGPRsUsedByStorage > MaxNumAGPRsUsedByAllStorage)
+      MaxNumAGPRsUsedByAllStorage = MaxNumAGPRsUsedByStorage;
+    int MaxNumSGPRsUsedByStorage =
+        StateValueArrayStorage::getNumSGPRsUsed(StorageScheme);
+    if (MaxNumSGPRsUsedByStorage > MaxNumSGPRsUsedByAllStorage)
+      MaxNumSGPRsUsedByAllStorage = MaxNumSGPRsUsedByStorage;
+  }
+  return llvm::Error::success();
+}
+
+/// Calculates the storage segments of the state value array inside \p MF
+/// when it doesn't have a fixed location, as well as the load plans of the
+/// instrumentation points of \p MF
+/// \details The state value array starts in the highest numbered free VGPR
+/// or AGPR at the entry of \p MF. It is relocated before an instruction that
+/// reads or writes one of its storage registers, and when it is spilled and
+/// the instruction has an injected payload, which must load it anyway
+/// \param UnusedRegs the registers which can hold the state value array
+/// whenever they are not live or written by an instruction
+/// \param [out] StateValueStorageIntervals the storage segments of each
+/// basic block of \p MF
+/// \param [out] InstPointSVSLoadPlans the load plans of each instrumentation
+/// point of \p MF
+static llvm::Error calculateRelocatableStorageSegments(
+    const llvm::MachineFunction &MF, const llvm::SlotIndexes &MFSlotIndexes,
+    const AMDGPURegisterLiveness &RegLiveness,
+    const InjectedPayloadAndInstPoint &IPIP,
+    const SVARegClassBitSets &RegClassBitSets,
+    const SVARegClassBitSets::BitSets &UnusedRegs,
+    llvm::ArrayRef<StateValueArrayStorage::StorageKind> SupportedStorage,
+    int MaxNumAGPRsUsedByAllStorage, int MaxNumSGPRsUsedByAllStorage,
+    const llvm::LivePhysRegs &AccessedPhysicalRegistersNotInLiveIns,
+    llvm::DenseMap<const llvm::MachineBasicBlock *,
+                   llvm::SmallVector<StateValueStorageSegment>>
+        &StateValueStorageIntervals,
+    llvm::DenseMap<const llvm::MachineInstr *, InstPointSVALoadPlan>
+        &InstPointSVSLoadPlans) {
+  const auto *TRI = MF.getSubtarget().getRegisterInfo();
+  // Pick the highest numbered VGPR not accessed by the Hooks
+  // to hold the value state
+  // TODO: is there a more informed way to do initialize this?
+  // TODO: if an argument is passed specifying to keep the register
+  // usage of the kernel the same as before, these needs to be initialized
+  // to the last available SGPR/VGPR/AGPR
+  const llvm::MachineInstr &FirstMI = *MF.begin()->begin();
+  auto FirstMILiveIns = RegLiveness.getMFLevelInstrLiveIns(FirstMI);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      FirstMILiveIns != nullptr,
+      llvm::formatv("Failed to obtain the live physical regs for MI {0}.",
+                    FirstMI)));
+
+  // The current location of the state value register
+  SVARegClassBitSets::BitSets FirstMIFreeRegs = UnusedRegs;
+  resetBitSets(FirstMIFreeRegs,
+               RegClassBitSets.getOccupiedRegs(*FirstMILiveIns, FirstMI));
+  std::shared_ptr<StateValueArrayStorage> SVS = findStateValueArrayStorageAtMI(
+      FirstMIFreeRegs, FirstMIFreeRegs, SupportedStorage,
+      MaxNumAGPRsUsedByAllStorage, MaxNumSGPRsUsedByAllStorage);
+
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      SVS != nullptr,
+      llvm::formatv("Failed to get a state value array storage for MI {0}.",
+                    FirstMI)));
+
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      llvm::isa<VGPRStateValueArrayStorage>(SVS.get()) ||
+          llvm::isa<SingleAGPRStateValueArrayStorage>(SVS.get()),
+      "The entry SVS must be stored in a VGPR or an AGPR."));
+
+  // A set of hook insertion points that fall into the current interval
+  llvm::SmallDenseSet<const llvm::MachineInstr *, 4>
+      HookInsertionPointsInCurrentSegment{};
+  for (const auto &MBB : MF) {
+    // Marks the beginning of the current interval we are in this loop
+    llvm::SlotIndex CurrentIntervalBegin = MFSlotIndexes.getMBBStartIdx(&MBB);
+
+    auto &CurrentMBBSegments =
+        StateValueStorageIntervals.insert({&MBB, {}}).first->getSecond();
+    // Registers occupied from each MI until the end of the MBB; Only
+    // calculated once the SVS needs to be relocated inside the MBB
+    llvm::SmallVector<SVARegClassBitSets::BitSets> LiveRegsUntilMBBEnd;
+    unsigned int MIIdx = 0;
+    for (const auto &MI : MBB) {
+      unsigned int CurrentMIIdx = MIIdx++;
+      if (IPIP.contains(MI))
+        HookInsertionPointsInCurrentSegment.insert(&MI);
+      auto *InstrLiveRegs = RegLiveness.getMFLevelInstrLiveIns(MI);
+      LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+          InstrLiveRegs != nullptr,
+          llvm::formatv(
+              "Failed to get the live physical register set for MI {0}.",
+              MI)));
+      // - If we have spilled the state value reg and this instruction
+      // will require a hook to be inserted, then we try to relocate the
+      // SVS. In this instance, since the hook will have to load the value
+      // state register anyway, we try and see if after loading it, we can
+      // store it in a V/AGPR.
+      // - If the SVS registers are going to be used or overwritten, we must
+      // relocate the SVS before this instruction.
+      // - Otherwise, we keep the SVS in its place.
+      bool TryRelocatingValueStateReg =
+          SVS->getStateValueStorageReg() == 0 && IPIP.contains(MI);
+      llvm::SmallVector<llvm::MCRegister, 4> SVSRegs;
+      SVS->getAllStorageRegisters(SVSRegs);
+      bool MustRelocateStateValue =
+          llvm::any_of(SVSRegs, [&](llvm::MCRegister Reg) {
+            return !InstrLiveRegs->available(MF.getRegInfo(), Reg) ||
+                   MI.modifiesRegister(Reg, TRI);
+          });
+      // Find where the SVS is relocated to, preferring registers that
+      // remain free until the end of the MBB
+      std::shared_ptr<StateValueArrayStorage> NextSVS = SVS;
+      if (TryRelocatingValueStateReg || MustRelocateStateValue) {
+        if (LiveRegsUntilMBBEnd.empty()) {
+          LUTHIER_RETURN_ON_ERROR(getLiveRegsUntilMBBEnd(
+              MBB, RegLiveness, RegClassBitSets, LiveRegsUntilMBBEnd));
+        }
+        SVARegClassBitSets::BitSets FreeRegs = UnusedRegs;
+        resetBitSets(FreeRegs,
+                     RegClassBitSets.getOccupiedRegs(*InstrLiveRegs, MI));
+        SVARegClassBitSets::BitSets StableFreeRegs = UnusedRegs;
+        resetBitSets(StableFreeRegs, LiveRegsUntilMBBEnd[CurrentMIIdx]);
+        NextSVS = findStateValueArrayStorageAtMI(
+            FreeRegs, StableFreeRegs, SupportedStorage,
+            MaxNumAGPRsUsedByAllStorage, MaxNumSGPRsUsedByAllStorage);
+        LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+            NextSVS != nullptr, "Failed to relocate the SVA storage."));
+      }
+      // If the SVS was relocated, then create a new interval for it;
+      // Reg scavenging might conclude that the values remain where they
+      // are, in which case the current interval is extended instead, as
+      // no code is required to move the SVS between the two
+      // Also create a new interval if we reach the end of a MBB
+      if (&MI == &MBB.back() || *NextSVS != *SVS) {
+        auto NextIndex = &MI == &MBB.back()
+                             ? MFSlotIndexes.getMBBEndIdx(&MBB)
+                             : MFSlotIndexes.getInstructionIndex(MI);
+        CurrentMBBSegments.emplace_back(CurrentIntervalBegin, NextIndex, SVS);
+        for (const auto &HookMI : HookInsertionPointsInCurrentSegment) {
+          auto [HookSVGPR, ClobbersAppReg] =
+              selectVGPRLoadLocationForInjectedPayload(
+                  *HookMI, *SVS, AccessedPhysicalRegistersNotInLiveIns,
+                  nullptr);
+          InstPointSVSLoadPlans.insert(
+              {HookMI, {HookSVGPR, ClobbersAppReg, *SVS}});
+        }
+        HookInsertionPointsInCurrentSegment.clear();
+        CurrentIntervalBegin = NextIndex;
+      }
+      SVS = std::move(NextSVS);
+    }
+  }
+  return llvm::Error::success();
+}
+
+/// \return true if the application instruction \p MI, which executes between
+/// the injected payloads of two adjacent instrumentation points, prevents
+/// the state value array loaded according to \p Plan and the
+/// instrumentation frame from remaining materialized across it
+/// \param PinnedRegs registers accessed in place by the injected payloads,
+/// which may hold their values instead of the app's between the payloads
+static bool breaksSVALoadRun(const llvm::MachineInstr &MI,
+                             const InstPointSVALoadPlan &Plan,
+                             const llvm::LivePhysRegs &PinnedRegs) {
+  if (MI.isTerminator() || MI.isCall() || MI.isInlineAsm())
+    return true;
+  const auto *TRI = MI.getMF()->getSubtarget().getRegisterInfo();
+  auto AccessesReg = [&](llvm::MCRegister Reg) {
+    return MI.readsRegister(Reg, TRI) || MI.modifiesRegister(Reg, TRI);
+  };
+  // The app's values of the load VGPR and the frame registers are only
+  // restored at the end of the run, and the state value array is only
+  // stored back into its storage there
+  if (AccessesReg(Plan.StateValueArrayLoadVGPR) ||
+      MI.modifiesRegister(llvm::AMDGPU::EXEC, TRI))
+    return true;
+  llvm::SmallVector<llvm::MCRegister, 4> SVSRegs;
+  Plan.StateValueStorageLocation.getAllStorageRegisters(SVSRegs);
+  if (llvm::any_of(SVSRegs, AccessesReg))
+    return true;
+  for (llvm::MCPhysReg Reg : PinnedRegs) {
+    if (AccessesReg(Reg))
+      return true;
+  }
+  for (const auto &[PhysReg, SpillLane] :
+       stateValueArray::getFrameSpillSlots()) {
+    if (AccessesReg(PhysReg))
+      return true;
+  }
+  // Flat and scratch instructions can address the private segment via the
+  // flat scratch registers, which aren't always explicit operands
+  return llvm::SIInstrInfo::isFLAT(MI) && !llvm::SIInstrInfo::isFLATGlobal(MI);
+}
+
+void SVStorageAndLoadLocations::formSVALoadRuns(
+    llvm::ArrayRef<llvm::MachineFunction *> MFs,
+    const InjectedPayloadAndInstPoint &IPIP,
+    const llvm::LivePhysRegs &AccessedPhysicalRegistersNotInLiveIns) {
+  for (const llvm::MachineFunction *MF : MFs) {
+    for (const llvm::MachineBasicBlock &MBB : *MF) {
+      const llvm::MachineInstr *PrevInstPoint{nullptr};
+      InstPointSVALoadPlan *PrevPlan{nullptr};
+      for (const llvm::MachineInstr &MI : MBB) {
+        auto It = InstPointSVSLoadPlans.find(&MI);
+        // A skipped predicated payload would leave the rest of its run
+        // without a loaded state value array
+        if (It == InstPointSVSLoadPlans.end() ||
+            IPIP.at(MI)->hasFnAttribute(HookEnableMaskAttribute)) {
+          PrevInstPoint = nullptr;
+          PrevPlan = nullptr;
+          continue;
+        }
+        InstPointSVALoadPlan &Plan = It->second;
+        // The previous instrumentation point is the only app instruction
+        // executed between the two injected payloads; A different storage
+        // means the state value array is relocated between them
+        if (PrevPlan != nullptr &&
+            &PrevPlan->StateValueStorageLocation ==
+                &Plan.StateValueStorageLocation &&
+            !breaksSVALoadRun(*PrevInstPoint, *PrevPlan,
+                              AccessedPhysicalRegistersNotInLiveIns)) {
+          // The load VGPR of the run is not live at the start of the run,
+          // and is not accessed inside it, so it is safe to keep using it
+          Plan.StateValueArrayLoadVGPR = PrevPlan->StateValueArrayLoadVGPR;
+          Plan.LoadDestClobbersAppVGPR = PrevPlan->LoadDestClobbersAppVGPR;
+          PrevPlan->StoresSVA = false;
+          Plan.LoadsSVA = false;
+          LLVM_DEBUG(llvm::dbgs() << "Instrumentation point " << MI
+                                  << " joins the SVA load run of "
+                                  << *PrevInstPoint;);
+        }
+        PrevInstPoint = &MI;
+        PrevPlan = &Plan;
+      }
+    }
+  }
 }
 
 llvm::ArrayRef<StateValueStorageSegment>
@@ -424,31 +753,39 @@ llvm::Error SVStorageAndLoadLocations::calculate(
   // used and check if we have at least only one method for storage
   const auto &ST = MFs[0]->getSubtarget<llvm::GCNSubtarget>();
   llvm::SmallVector<StateValueArrayStorage::StorageKind, 6> SupportedStorage;
-  getSupportedSVAStorageList(ST, SupportedStorage);
-  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-      !SupportedStorage.empty(),
-      llvm::formatv("Failed to find compatible state value array storage "
-                    "for ST {0}, CPU {1}.",
-                    ST.getTargetTriple().str(), ST.getCPU())));
-  // Query the maximum number of SGPRs and AGPRs in all storage methods;
-  // This saves us time during register scavenging
-  int MaxNumAGPRsUsedByAllStorage = 0;
-  int MaxNumSGPRsUsedByAllStorage = 0;
-  for (const auto &StorageScheme : SupportedStorage) {
-    int MaxNumAGPRsUsedByStorage =
-        StateValueArrayStorage::getNumAGPRsUsed(StorageScheme);
-    if (MaxNumAGPRsUsedByStorage > MaxNumAGPRsUsedByAllStorage)
-      MaxNumAGPRsUsedByAllStorage = MaxNumAGPRsUsedByStorage;
-    int MaxNumSGPRsUsedByStorage =
-        StateValueArrayStorage::getNumSGPRsUsed(StorageScheme);
-    if (MaxNumSGPRsUsedByStorage > MaxNumSGPRsUsedByAllStorage)
-      MaxNumSGPRsUsedByAllStorage = MaxNumSGPRsUsedByStorage;
+  int MaxNumAGPRsUsedByAllStorage;
+  int MaxNumSGPRsUsedByAllStorage;
+  LUTHIER_RETURN_ON_ERROR(getSupportedSVAStorage(ST, SupportedStorage,
+                                                 MaxNumAGPRsUsedByAllStorage,
+                                                 MaxNumSGPRsUsedByAllStorage));
+
+  // Calculate the registers unused in each MF once, as well as the
+  // registers unused across all MFs; Free register queries are then answered
+  // by removing the live registers from these bitsets
+  SVARegClassBitSets RegClassBitSets(*ST.getRegisterInfo());
+  llvm::SmallDenseMap<const llvm::MachineFunction *,
+                      SVARegClassBitSets::BitSets, 4>
+      MFUnusedRegs;
+  SVARegClassBitSets::BitSets UnusedRegsInAllMFs;
+  for (const auto &MF : MFs) {
+    auto &UnusedRegs =
+        MFUnusedRegs
+            .insert({MF, RegClassBitSets.getUnusedRegs(
+                             MF->getRegInfo(),
+                             AccessedPhysicalRegistersNotInLiveIns)})
+            .first->second;
+    if (MF == MFs[0])
+      UnusedRegsInAllMFs = UnusedRegs;
+    else {
+      for (unsigned K = 0; K < SVARegClassBitSets::NumClasses; ++K)
+        UnusedRegsInAllMFs[K] &= UnusedRegs[K];
+    }
   }
 
   // Try to find a fixed location to store the state value array
   auto StateValueFixedLocation = findFixedStateValueArrayStorage(
-      MFs, SupportedStorage, MaxNumAGPRsUsedByAllStorage,
-      MaxNumSGPRsUsedByAllStorage, AccessedPhysicalRegistersNotInLiveIns);
+      UnusedRegsInAllMFs, SupportedStorage, MaxNumAGPRsUsedByAllStorage,
+      MaxNumSGPRsUsedByAllStorage);
 
   if (StateValueFixedLocation != nullptr) {
     // If a fixed location was found, then all MBB intervals inside all MFs
@@ -479,10 +816,13 @@ llvm::Error SVStorageAndLoadLocations::calculate(
           llvm::formatv(
               "Failed to get the Live Physical register set for MI {0}.",
               *InsertionPointMI)));
+      SVARegClassBitSets::BitSets FreeRegs =
+          MFUnusedRegs[InsertionPointMI->getMF()];
+      resetBitSets(FreeRegs, RegClassBitSets.getLiveRegs(*HookLiveRegs));
       auto [VGPRLocation, ClobbersAppReg] =
           selectVGPRLoadLocationForInjectedPayload(
-              *InsertionPointMI, *StateValueFixedLocation, *HookLiveRegs,
-              AccessedPhysicalRegistersNotInLiveIns, true);
+              *InsertionPointMI, *StateValueFixedLocation,
+              AccessedPhysicalRegistersNotInLiveIns, &FreeRegs);
 
       InstPointSVSLoadPlans.insert(
           {InsertionPointMI, InstPointSVALoadPlan{VGPRLocation, ClobbersAppReg,
@@ -496,108 +836,42 @@ llvm::Error SVStorageAndLoadLocations::calculate(
           llvm::CallingConv::AMDGPU_KERNEL) {
         FPD.DeviceFunctions[MF].RequiresPreAndPostAmble = true;
       }
-      auto &MRI = MF->getRegInfo();
-      // Pick the highest numbered VGPR not accessed by the Hooks
-      // to hold the value state
-      // TODO: is there a more informed way to do initialize this?
-      // TODO: if an argument is passed specifying to keep the register
-      // usage of the kernel the same as before, these needs to be initialized
-      // to the last available SGPR/VGPR/AGPR
-      auto FirstMILiveIns =
-          RegLiveness.getMFLevelInstrLiveIns(*MF->begin()->begin());
-      LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-          FirstMILiveIns != nullptr,
-          llvm::formatv("Failed to obtain the live physical regs for MI {0}.",
-                        *MF->begin()->begin())));
-
-      // The current location of the state value register
-      std::shared_ptr<StateValueArrayStorage> SVS =
-          findStateValueArrayStorageAtMI(
-              MRI, *FirstMILiveIns, AccessedPhysicalRegistersNotInLiveIns,
-              SupportedStorage, MaxNumAGPRsUsedByAllStorage,
-              MaxNumSGPRsUsedByAllStorage);
-
-      LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-          SVS != nullptr,
-          llvm::formatv("Failed to get a state value array storage for MI {0}.",
-                        *MF->begin()->begin())));
-
-      LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-          llvm::isa<VGPRStateValueArrayStorage>(SVS.get()) ||
-              llvm::isa<SingleAGPRStateValueArrayStorage>(SVS.get()),
-          "The entry SVS must be stored in a VGPR or an AGPR."));
-
-      // A set of hook insertion points that fall into the current interval
-      llvm::SmallDenseSet<const llvm::MachineInstr *, 4>
-          HookInsertionPointsInCurrentSegment{};
-      for (const auto &MBB : *MF) {
-        // Marks the beginning of the current interval we are in this loop
-        llvm::SlotIndex CurrentIntervalBegin =
-            SlotIndexes.at(*MF).getMBBStartIdx(&MBB);
-
-        auto &CurrentMBBSegments =
-            StateValueStorageIntervals.insert({&MBB, {}}).first->getSecond();
-        for (const auto &MI : MBB) {
-          if (IPIP.contains(MI))
-            HookInsertionPointsInCurrentSegment.insert(&MI);
-          auto *InstrLiveRegs = RegLiveness.getMFLevelInstrLiveIns(MI);
-          LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-              InstrLiveRegs != nullptr,
-              llvm::formatv(
-                  "Failed to get the live physical register set for MI {0}.",
-                  MI)));
-          // - If we have spilled the state value reg and this instruction
-          // will require a hook to be inserted, then we try to relocate the
-          // SVS. In this instance, since the hook will have to load the value
-          // state register anyway, we try and see if after loading it, we can
-          // store it in a V/AGPR.
-          // - If the SVS registers are going to be used, we must relocate
-          // the SVS.
-          // - Otherwise, we keep the SVS in its place.
-          bool TryRelocatingValueStateReg =
-              SVS->getStateValueStorageReg() == 0 && IPIP.contains(MI);
-          llvm::SmallVector<llvm::MCRegister, 4> SVSRegs;
-          SVS->getAllStorageRegisters(SVSRegs);
-          bool MustRelocateStateValue =
-              llvm::any_of(SVSRegs, [&](llvm::MCRegister Reg) {
-                return !InstrLiveRegs->available(MF->getRegInfo(), Reg);
-              });
-          // If we have to relocate something, then create a new interval
-          // for it;
-          // Note that reg scavenging might conclude that the values remain
-          // where they are, and that's okay
-          // Also create a new interval if we reach the end of a MBB
-          if (&MI == &MBB.back() || TryRelocatingValueStateReg ||
-              MustRelocateStateValue) {
-            auto NextIndex = &MI == &MBB.back()
-                                 ? SlotIndexes.at(*MF).getMBBEndIdx(&MBB)
-                                 : SlotIndexes.at(*MF).getInstructionIndex(MI);
-            CurrentMBBSegments.emplace_back(CurrentIntervalBegin, NextIndex,
-                                            SVS);
-            for (const auto &HookMI : HookInsertionPointsInCurrentSegment) {
-              auto *HookLiveRegs = RegLiveness.getMFLevelInstrLiveIns(*HookMI);
-              auto [HookSVGPR, ClobbersAppReg] =
-                  selectVGPRLoadLocationForInjectedPayload(
-                      *HookMI, *SVS, *HookLiveRegs,
-                      AccessedPhysicalRegistersNotInLiveIns, false);
-              InstPointSVSLoadPlans.insert(
-                  {HookMI, {HookSVGPR, ClobbersAppReg, *SVS}});
-            }
-            HookInsertionPointsInCurrentSegment.clear();
-            CurrentIntervalBegin = NextIndex;
-          }
-          if (TryRelocatingValueStateReg || MustRelocateStateValue) {
-            SVS = findStateValueArrayStorageAtMI(
-                MRI, *FirstMILiveIns, AccessedPhysicalRegistersNotInLiveIns,
-                SupportedStorage, MaxNumAGPRsUsedByAllStorage,
-                MaxNumSGPRsUsedByAllStorage);
-            LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-                SVS != nullptr, "Failed to relocate the SVA storage."));
-          }
-        }
-      }
+      LUTHIER_RETURN_ON_ERROR(calculateRelocatableStorageSegments(
+          *MF, SlotIndexes.at(*MF), RegLiveness, IPIP, RegClassBitSets,
+          MFUnusedRegs[MF], SupportedStorage, MaxNumAGPRsUsedByAllStorage,
+          MaxNumSGPRsUsedByAllStorage, AccessedPhysicalRegistersNotInLiveIns,
+          StateValueStorageIntervals, InstPointSVSLoadPlans));
     }
   }
+  formSVALoadRuns(MFs, IPIP, AccessedPhysicalRegistersNotInLiveIns);
+  return llvm::Error::success();
+}
+
+llvm::Error SVStorageAndLoadLocations::calculateRelocatable(
+    llvm::MachineFunction &MF, const llvm::SlotIndexes &MFSlotIndexes,
+    const AMDGPURegisterLiveness &RegLiveness,
+    const InjectedPayloadAndInstPoint &IPIP,
+    const llvm::LivePhysRegs &CandidateRegs,
+    const llvm::LivePhysRegs &AccessedPhysicalRegistersNotInLiveIns) {
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  llvm::SmallVector<StateValueArrayStorage::StorageKind, 6> SupportedStorage;
+  int MaxNumAGPRsUsedByAllStorage;
+  int MaxNumSGPRsUsedByAllStorage;
+  LUTHIER_RETURN_ON_ERROR(getSupportedSVAStorage(ST, SupportedStorage,
+                                                 MaxNumAGPRsUsedByAllStorage,
+                                                 MaxNumSGPRsUsedByAllStorage));
+  SVARegClassBitSets RegClassBitSets(*ST.getRegisterInfo());
+  SVARegClassBitSets::BitSets FreeRegs =
+      RegClassBitSets.getLiveRegs(CandidateRegs);
+  resetBitSets(FreeRegs, RegClassBitSets.getLiveRegs(
+                             AccessedPhysicalRegistersNotInLiveIns));
+  LUTHIER_RETURN_ON_ERROR(calculateRelocatableStorageSegments(
+      MF, MFSlotIndexes, RegLiveness, IPIP, RegClassBitSets, FreeRegs,
+      SupportedStorage, MaxNumAGPRsUsedByAllStorage,
+      MaxNumSGPRsUsedByAllStorage, AccessedPhysicalRegistersNotInLiveIns,
+      StateValueStorageIntervals, InstPointSVSLoadPlans));
+  llvm::MachineFunction *MFs[] = {&MF};
+  formSVALoadRuns(MFs, IPIP, AccessedPhysicalRegistersNotInLiveIns);
   return llvm::Error::success();
 }
 
@@ -18,7 +18,10 @@
 /// This file implements Luthier's Target Manager Singleton.
 //===----------------------------------------------------------------------===//
 #include "luthier/Tooling/TargetManager.h"
+#include "luthier/Common/ConcurrentCache.h"
 #include "luthier/HSA/Agent.h"
+#include "luthier/HSA/ISA.h"
+#include "luthier/Object/ObjectFileUtils.h"
 #include <AMDGPUTargetMachine.h>
 #include <llvm/MC/MCAsmBackend.h>
 #include <llvm/MC/MCAsmInfo.h>
@@ -37,15 +40,31 @@
 #include <llvm/Support/ManagedStatic.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Target/TargetMachine.h>
+#include <mutex>
 
 namespace luthier {
 
 template <> TargetManager *Singleton<TargetManager>::Instance{nullptr};
 
+/// Maximum number of idle target machines kept in the pool for each ISA;
+/// Target machines returned to a full pool are destroyed
+static constexpr unsigned MaxPooledTargetMachinesPerISA = 16;
+
+void TargetMachinePoolReturner::operator()(llvm::GCNTargetMachine *TM) const {
+  if (TM == nullptr)
+    return;
+  if (TargetManager::isInitialized())
+    TargetManager::instance().returnTargetMachine(ISA, TM);
+  else
+    delete TM;
+}
+
 TargetManager::TargetManager(
     const rocprofiler::HsaApiTableSnapshot<::CoreApiTable>
         &CoreApiTableSnapshot)
-    : Singleton<TargetManager>(), CoreApiTableSnapshot(CoreApiTableSnapshot) {
+    : Singleton<TargetManager>(),
+      TargetMachinePool(MaxPooledTargetMachinesPerISA),
+      CoreApiTableSnapshot(CoreApiTableSnapshot) {
   LLVMInitializeAMDGPUTarget();
   LLVMInitializeAMDGPUTargetInfo();
   LLVMInitializeAMDGPUTargetMC();
@@ -66,90 +85,114 @@ TargetManager::~TargetManager() {
     delete It.second.TargetOptions;
   }
   LLVMTargetInfo.clear();
+  TargetMachinePool.clear();
   llvm::llvm_shutdown();
   Singleton<TargetManager>::~Singleton();
 }
 
+llvm::Expected<TargetInfo>
+TargetManager::createTargetInfo(hsa_isa_t Isa) const {
+  TargetInfo Info;
+
+  const auto HsaApiTableSnapshot = CoreApiTableSnapshot.getTable();
+
+  auto TT = hsa::isaGetTargetTriple(HsaApiTableSnapshot, Isa);
+  LUTHIER_RETURN_ON_ERROR(TT.takeError());
+
+  std::string Error;
+
+  auto Target = llvm::TargetRegistry::lookupTarget(TT->normalize(), Error);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Target, llvm::formatv("Failed to lookup target {0} in LLVM. Reason "
+                            "according to LLVM: {1}.",
+                            TT->normalize(), Error)));
+
+  auto MRI = Target->createMCRegInfo(TT->getTriple());
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      MRI, llvm::formatv("Failed to create machine register info for {0}.",
+                         TT->getTriple())));
+
+  auto TargetOptions = new llvm::TargetOptions();
+
+  TargetOptions->MCOptions.AsmVerbose = true;
+
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      TargetOptions, "Failed to create target options."));
+
+  auto MAI = Target->createMCAsmInfo(*MRI, TT->getTriple(),
+                                     TargetOptions->MCOptions);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      MAI,
+      llvm::formatv(
+          "Failed to create MCAsmInfo from target {0} for Target Triple {1}.",
+          Target, TT->getTriple())));
+
+  auto MII = Target->createMCInstrInfo();
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      MII,
+      llvm::formatv("Failed to create MCInstrInfo from target {0}", Target)));
+
+  auto MIA = Target->createMCInstrAnalysis(MII);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      MIA, llvm::formatv("Failed to create MCInstrAnalysis for target {0}.",
+                         Target)));
+
+  auto CPU = hsa::isaGetGPUName(HsaApiTableSnapshot, Isa);
+  LUTHIER_RETURN_ON_ERROR(CPU.takeError());
+
+  auto FeatureString = hsa::isaGetSubTargetFeatures(HsaApiTableSnapshot, Isa);
+  LUTHIER_RETURN_ON_ERROR(FeatureString.takeError());
+
+  auto STI = Target->createMCSubtargetInfo(TT->getTriple(), *CPU,
+                                           FeatureString->getString());
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      STI, llvm::formatv("Failed to create MCSubTargetInfo from target {0} "
+                         "for triple {1}, CPU {2}, with feature string {3}",
+                         Target, TT->getTriple(), *CPU,
+                         FeatureString->getString())));
+
+  auto IP = Target->createMCInstPrinter(
+      llvm::Triple(*TT), MAI->getAssemblerDialect(), *MAI, *MII, *MRI);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      IP,
+      llvm::formatv(
+          "Failed to create MCInstPrinter from Target {0} for Triple {1}.",
+          Target, TT->getTriple())));
+
+  Info.Target = Target;
+  Info.MRI = MRI;
+  Info.MAI = MAI;
+  Info.MII = MII;
+  Info.MIA = MIA;
+  Info.STI = STI;
+  Info.IP = IP;
+  Info.TargetOptions = TargetOptions;
+  return Info;
+}
+
 llvm::Expected<const TargetInfo &>
 TargetManager::getTargetInfo(hsa_isa_t Isa) const {
-  if (!LLVMTargetInfo.contains(Isa)) {
-    auto Info = LLVMTargetInfo.insert({Isa, TargetInfo()}).first;
-
-    const auto HsaApiTableSnapshot = CoreApiTableSnapshot.getTable();
-
-    auto TT = hsa::isaGetTargetTriple(HsaApiTableSnapshot, Isa);
-    LUTHIER_RETURN_ON_ERROR(TT.takeError());
-
-    std::string Error;
-
-    auto Target = llvm::TargetRegistry::lookupTarget(TT->normalize(), Error);
-    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-        Target, llvm::formatv("Failed to lookup target {0} in LLVM. Reason "
-                              "according to LLVM: {1}.",
-                              TT->normalize(), Error)));
-
-    auto MRI = Target->createMCRegInfo(TT->getTriple());
-    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-        MRI, llvm::formatv("Failed to create machine register info for {0}.",
-                           TT->getTriple())));
-
-    auto TargetOptions = new llvm::TargetOptions();
-
-    TargetOptions->MCOptions.AsmVerbose = true;
-
-    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-        TargetOptions, "Failed to create target options."));
-
-    auto MAI = Target->createMCAsmInfo(*MRI, TT->getTriple(),
-                                       TargetOptions->MCOptions);
-    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-        MAI,
-        llvm::formatv(
-            "Failed to create MCAsmInfo from target {0} for Target Triple {1}.",
-            Target, TT->getTriple())));
-
-    auto MII = Target->createMCInstrInfo();
-    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-        MII,
-        llvm::formatv("Failed to create MCInstrInfo from target {0}", Target)));
-
-    auto MIA = Target->createMCInstrAnalysis(MII);
-    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-        MIA, llvm::formatv("Failed to create MCInstrAnalysis for target {0}.",
-                           Target)));
-
-    auto CPU = hsa::isaGetGPUName(HsaApiTableSnapshot, Isa);
-    LUTHIER_RETURN_ON_ERROR(CPU.takeError());
-
-    auto FeatureString = hsa::isaGetSubTargetFeatures(HsaApiTableSnapshot, Isa);
-    LUTHIER_RETURN_ON_ERROR(FeatureString.takeError());
-
-    auto STI = Target->createMCSubtargetInfo(TT->getTriple(), *CPU,
-                                             FeatureString->getString());
-    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-        STI, llvm::formatv("Failed to create MCSubTargetInfo from target {0} "
-                           "for triple {1}, CPU {2}, with feature string {3}",
-                           Target, TT->getTriple(), *CPU,
-                           FeatureString->getString())));
-
-    auto IP = Target->createMCInstPrinter(
-        llvm::Triple(*TT), MAI->getAssemblerDialect(), *MAI, *MII, *MRI);
-    LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
-        IP,
-        llvm::formatv(
-            "Failed to create MCInstPrinter from Target {0} for Triple {1}.",
-            Target, TT->getTriple())));
-
-    Info->second.Target = Target;
-    Info->second.MRI = MRI;
-    Info->second.MAI = MAI;
-    Info->second.MII = MII;
-    Info->second.MIA = MIA;
-    Info->second.STI = STI;
-    Info->second.IP = IP;
-    Info->second.TargetOptions = TargetOptions;
-  }
-  return LLVMTargetInfo[Isa];
+  return lookupOrCompute(
+      TargetInfoMutex,
+      [&]() -> const TargetInfo * {
+        auto It = LLVMTargetInfo.find(Isa);
+        return It != LLVMTargetInfo.end() ? &It->second : nullptr;
+      },
+      [&]() { return createTargetInfo(Isa); },
+      [&](const TargetInfo &Info) -> const TargetInfo & {
+        auto [It, Inserted] = LLVMTargetInfo.insert({Isa, Info});
+        // Another thread created the target info first; Discard ours
+        if (!Inserted) {
+          delete Info.MRI;
+          delete Info.MAI;
+          delete Info.MII;
+          delete Info.MIA;
+          delete Info.STI;
+          delete Info.IP;
+          delete Info.TargetOptions;
+        }
+        return It->second;
+      });
 }
 
 llvm::Expected<std::unique_ptr<llvm::GCNTargetMachine>>
@@ -176,4 +219,61 @@ TargetManager::createTargetMachine(
           TargetOptions, llvm::Reloc::PIC_)));
 }
 
+llvm::Expected<PooledTargetMachine>
+TargetManager::borrowTargetMachine(hsa_isa_t ISA) const {
+  std::unique_ptr<llvm::GCNTargetMachine> TM = TargetMachinePool.take(ISA);
+  if (TM != nullptr)
+    return PooledTargetMachine(TM.release(), TargetMachinePoolReturner{ISA});
+  LUTHIER_RETURN_ON_ERROR(createTargetMachine(ISA).moveInto(TM));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      TM != nullptr, "Failed to create a target machine for the pool."));
+  return PooledTargetMachine(TM.release(), TargetMachinePoolReturner{ISA});
+}
+
+void TargetManager::returnTargetMachine(hsa_isa_t ISA,
+                                        llvm::GCNTargetMachine *TM) const {
+  std::unique_ptr<llvm::GCNTargetMachine> Returned(TM);
+  // Undo any changes made by the borrower
+  Returned->Options = llvm::TargetOptions();
+  Returned->setOptLevel(llvm::CodeGenOptLevel::Default);
+  TargetMachinePool.put(ISA, std::move(Returned));
+}
+
+llvm::Expected<hsa_isa_t>
+TargetManager::getISA(const llvm::Triple &TT, llvm::StringRef CPU,
+                      const llvm::SubtargetFeatures &Features) const {
+  std::string Key =
+      (llvm::Twine(TT.getTriple()) + "--" + CPU + ":" + Features.getString())
+          .str();
+  auto ISA = lookupOrCompute(
+      ISAMutex,
+      [&]() -> const hsa_isa_t * {
+        auto It = ISAMap.find(Key);
+        return It != ISAMap.end() ? &It->second : nullptr;
+      },
+      [&]() {
+        return hsa::isaFromLLVM(CoreApiTableSnapshot.getTable(), TT, CPU,
+                                Features);
+      },
+      [&](hsa_isa_t Computed) -> const hsa_isa_t & {
+        return ISAMap.try_emplace(Key, Computed).first->second;
+      });
+  LUTHIER_RETURN_ON_ERROR(ISA.takeError());
+  return *ISA;
+}
+
+llvm::Expected<hsa_isa_t>
+TargetManager::getISA(const llvm::object::ObjectFile &ObjFile) const {
+  auto LLVMIsa = object::getObjectFileTargetTuple(ObjFile);
+  LUTHIER_RETURN_ON_ERROR(LLVMIsa.takeError());
+  return getISA(std::get<0>(*LLVMIsa), std::get<1>(*LLVMIsa),
+                std::get<2>(*LLVMIsa));
+}
+
+llvm::Expected<hsa_isa_t>
+TargetManager::getISA(const llvm::TargetMachine &TM) const {
+  return getISA(TM.getTargetTriple(), TM.getTargetCPU(),
+                llvm::SubtargetFeatures(TM.getTargetFeatureString()));
+}
+
 } // namespace luthier
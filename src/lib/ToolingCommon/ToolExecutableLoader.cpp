@@ -24,6 +24,7 @@
 #include "luthier/HSA/LoadedCodeObjectCache.h"
 #include "luthier/HSA/hsa.h"
 #include "luthier/Object/AMDGCNObjectFile.h"
+#include "luthier/Tooling/InstrumentationStack.h"
 #include "luthier/Tooling/TargetManager.h"
 #include "luthier/consts.h"
 #include <llvm/ADT/SmallVector.h>
@@ -125,6 +126,10 @@ ToolExecutableLoader::hsaExecutableDestroyWrapper(hsa_executable_t Executable) {
     // Check if this executable has been instrumented before. If so,
     // destroy the instrumented versions of this executable, and remove its
     // entries from the internal maps
+    // The instrumented executables are destroyed after releasing the lock, as
+    // their destruction goes through this wrapper as well
+    llvm::DenseSet<hsa_executable_t> InstrumentedExecs;
+    std::unique_lock Lock(TEL.Mutex);
     if (TEL.OriginalExecutablesWithKernelsInstrumented.contains(Executable)) {
       // 1. Find all instrumented versions of each kernel of Exec
       // 2. For each instrumented kernel, get its executable and insert it in
@@ -145,16 +150,23 @@ ToolExecutableLoader::hsaExecutableDestroyWrapper(hsa_executable_t Executable) {
           if (TEL.OriginalToInstrumentedKernelsMap.contains(ExecSymbol)) {
             TEL.OriginalToInstrumentedKernelsMap.erase(
                 TEL.OriginalToInstrumentedKernelsMap.find(ExecSymbol));
+            auto KD = hsa::executableSymbolGetAddress(
+                TEL.CoreApiSnapshot.getTable(), ExecSymbol);
+            LUTHIER_REPORT_FATAL_ON_ERROR(KD.takeError());
+            TEL.DispatchOverrides.erase(*KD);
           }
         }
       }
       // clean up all instrumented versions of Exec
-
-      for (auto &InstrumentedExec :
-           TEL.OriginalExecutablesWithKernelsInstrumented[Executable]) {
-        LUTHIER_REPORT_FATAL_ON_ERROR(hsa::executableDestroy(
-            TEL.CoreApiSnapshot.getTable(), InstrumentedExec));
-      }
+      auto InstrumentedExecsIt =
+          TEL.OriginalExecutablesWithKernelsInstrumented.find(Executable);
+      InstrumentedExecs = std::move(InstrumentedExecsIt->second);
+      TEL.OriginalExecutablesWithKernelsInstrumented.erase(InstrumentedExecsIt);
+    }
+    Lock.unlock();
+    for (auto &InstrumentedExec : InstrumentedExecs) {
+      LUTHIER_REPORT_FATAL_ON_ERROR(hsa::executableDestroy(
+          TEL.CoreApiSnapshot.getTable(), InstrumentedExec));
     }
   }
   return UnderlyingHsaExecutableDestroyFn(Executable);
@@ -197,6 +209,7 @@ llvm::Expected<
 ToolExecutableLoader::getInstrumentedKernel(
     hsa_executable_symbol_t OriginalKernel, llvm::StringRef Preset) const {
   const auto CoreApiTable = CoreApiSnapshot.getTable();
+  std::shared_lock Lock(Mutex);
   llvm::Expected<hsa_symbol_kind_t> SymTypeOrErr =
       hsa::executableSymbolGetType(CoreApiTable, OriginalKernel);
   LUTHIER_RETURN_ON_ERROR(SymTypeOrErr.takeError());
@@ -231,12 +244,29 @@ ToolExecutableLoader::getInstrumentedKernel(
   return std::make_pair(Out, MD);
 }
 
+llvm::Expected<std::unique_ptr<amdgpu::hsamd::Kernel::Metadata>>
+ToolExecutableLoader::parseInstrumentedKernelMetadata(
+    llvm::ArrayRef<uint8_t> InstrumentedElf,
+    const hsa::LoadedCodeObjectKernel &OriginalKernel) const {
+  std::string KDSymbolName;
+  LUTHIER_RETURN_ON_ERROR(OriginalKernel.getName().moveInto(KDSymbolName));
+  KDSymbolName.append(".kd");
+  auto ObjFile =
+      object::AMDGCNObjectFile::createAMDGCNObjectFile(InstrumentedElf);
+  LUTHIER_RETURN_ON_ERROR(ObjFile.takeError());
+  std::unique_ptr<llvm::msgpack::Document> InstrumentedExecMDDoc;
+  LUTHIER_RETURN_ON_ERROR(
+      (*ObjFile)->getMetadataDocument().moveInto(InstrumentedExecMDDoc));
+  return MDParser.parseKernelMetadata(*InstrumentedExecMDDoc, KDSymbolName);
+}
+
 llvm::Error ToolExecutableLoader::loadInstrumentedKernel(
     llvm::ArrayRef<uint8_t> InstrumentedElf,
     const hsa::LoadedCodeObjectKernel &OriginalKernel, llvm::StringRef Preset,
     const llvm::StringMap<const void *> &ExternVariables) {
-  std::lock_guard Lock(Mutex);
-  // Ensure this kernel was not instrumented under this preset
+  // Ensure this kernel was not instrumented under this preset; The check is
+  // repeated before updating the maps, as the loading itself happens without
+  // holding the lock so that other kernels can be loaded concurrently
   if (isKernelInstrumented(OriginalKernel, Preset)) {
     auto OriginalKernelName = OriginalKernel.getName();
     LUTHIER_RETURN_ON_ERROR(OriginalKernelName.takeError());
@@ -305,34 +335,89 @@ llvm::Error ToolExecutableLoader::loadInstrumentedKernel(
   LUTHIER_RETURN_ON_ERROR(OriginalExecutableOrErr.takeError());
 
   /// Parse the metadata
-  auto ObjFile =
-      object::AMDGCNObjectFile::createAMDGCNObjectFile(InstrumentedElf);
-  LUTHIER_RETURN_ON_ERROR(ObjFile.takeError());
-  std::unique_ptr<llvm::msgpack::Document> InstrumentedExecMDDoc;
-  LUTHIER_RETURN_ON_ERROR(
-      (*ObjFile)->getMetadataDocument().moveInto(InstrumentedExecMDDoc));
-
   std::unique_ptr<amdgpu::hsamd::Kernel::Metadata> MD;
-
   LUTHIER_RETURN_ON_ERROR(
-      MDParser.parseKernelMetadata(*InstrumentedExecMDDoc, OriginalSymbolName)
+      parseInstrumentedKernelMetadata(InstrumentedElf, OriginalKernel)
           .moveInto(MD));
 
+  // Precompute the fields patched into the dispatch packets of the original
+  // kernel, so that overriding them does not require querying HSA
+  llvm::Expected<uint64_t> OriginalKD = hsa::executableSymbolGetAddress(
+      CoreApiTable, *OriginalKernel.getExecutableSymbol());
+  LUTHIER_RETURN_ON_ERROR(OriginalKD.takeError());
+  llvm::Expected<uint64_t> InstrumentedKD =
+      hsa::executableSymbolGetAddress(CoreApiTable, **InstrumentedKernelOrErr);
+  LUTHIER_RETURN_ON_ERROR(InstrumentedKD.takeError());
+  const auto &OriginalMD = OriginalKernel.getKernelMetadata();
+  uint32_t OriginalGroupSegmentSize = OriginalMD.GroupSegmentFixedSize;
+  DispatchOverride Override{
+      *InstrumentedKD, MD->PrivateSegmentFixedSize,
+      MD->GroupSegmentFixedSize > OriginalGroupSegmentSize
+          ? MD->GroupSegmentFixedSize - OriginalGroupSegmentSize
+          : 0,
+      OriginalMD.KernArgSegmentSize};
+  // Each injected payload of a dynamic stack kernel uses the instrumentation
+  // stack region reserved by the preamble; The fixed private segment of the
+  // instrumented kernel grows by at least the size of the region
+  if (OriginalMD.UsesDynamicStack) {
+    Override.UsesDynamicStack = true;
+    Override.DynamicStackPrivateSegmentSizeIncrease =
+        MD->PrivateSegmentFixedSize > OriginalMD.PrivateSegmentFixedSize
+            ? llvm::alignTo(MD->PrivateSegmentFixedSize -
+                                OriginalMD.PrivateSegmentFixedSize,
+                            DynamicStackInstrumentationRegionAlign)
+            : 0;
+  }
+
+  std::unique_lock Lock(Mutex);
+  if (isKernelInstrumentedUnlocked(*OriginalKernel.getExecutableSymbol(),
+                                   Preset)) {
+    Lock.unlock();
+    // Another thread loaded an instrumented version of the same kernel
+    // under the same preset first; Discard ours
+    LUTHIER_RETURN_ON_ERROR(
+        hsa::codeObjectReaderDestroy(*Reader, CoreApiTable));
+    LUTHIER_RETURN_ON_ERROR(hsa::executableDestroy(CoreApiTable, *Executable));
+    return llvm::make_error<GenericLuthierError>(
+        llvm::formatv("Kernel {0} is already instrumented under preset {1}.",
+                      OriginalSymbolName, Preset));
+  }
+
   InstrumentedKernelMetadata.insert({**InstrumentedKernelOrErr, std::move(MD)});
 
   insertInstrumentedKernelIntoMap(*OriginalExecutableOrErr,
                                   *OriginalKernel.getExecutableSymbol(), Preset,
                                   *Executable, **InstrumentedKernelOrErr);
+
+  InstrumentationPresetID PresetID =
+      PresetIDs.try_emplace(Preset, PresetIDs.size()).first->second;
+  DispatchOverrides.insert(*OriginalKD, PresetID, Override);
+  Lock.unlock();
   LUTHIER_RETURN_ON_ERROR(hsa::codeObjectReaderDestroy(*Reader, CoreApiTable));
   return llvm::Error::success();
 }
 
+InstrumentationPresetID
+ToolExecutableLoader::getOrCreatePresetID(llvm::StringRef Preset) {
+  if (auto ID = lookupPresetID(Preset))
+    return *ID;
+  std::unique_lock Lock(Mutex);
+  return PresetIDs.try_emplace(Preset, PresetIDs.size()).first->second;
+}
+
+std::optional<InstrumentationPresetID>
+ToolExecutableLoader::lookupPresetID(llvm::StringRef Preset) const {
+  std::shared_lock Lock(Mutex);
+  auto It = PresetIDs.find(Preset);
+  if (It == PresetIDs.end())
+    return std::nullopt;
+  return It->second;
+}
+
 bool ToolExecutableLoader::isKernelInstrumented(
     const hsa::LoadedCodeObjectKernel &Kernel, llvm::StringRef Preset) const {
-  return OriginalToInstrumentedKernelsMap.contains(
-             *Kernel.getExecutableSymbol()) &&
-         OriginalToInstrumentedKernelsMap.find(*Kernel.getExecutableSymbol())
-             ->second.contains(Preset);
+  std::shared_lock Lock(Mutex);
+  return isKernelInstrumentedUnlocked(*Kernel.getExecutableSymbol(), Preset);
 }
 
 ToolExecutableLoader::~ToolExecutableLoader() {
@@ -0,0 +1,185 @@
+//===-- TraceBuffer.cpp ---------------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements the host side of trace buffers and the trace buffer
+/// drain thread.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/TraceBuffer.h"
+#include "luthier/Common/ErrorCheck.h"
+#include "luthier/Common/GenericLuthierError.h"
+#include <cstring>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/MathExtras.h>
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "luthier-trace-buffer"
+
+namespace luthier {
+
+uint64_t TraceBuffer::getAllocationSize(uint32_t Capacity,
+                                        uint32_t RecordSize) {
+  return TraceBufferSlotsOffset +
+         static_cast<uint64_t>(Capacity) *
+             (TraceBufferSlotTagSize + RecordSize);
+}
+
+llvm::Expected<std::unique_ptr<TraceBuffer>>
+TraceBuffer::create(uint32_t Capacity, uint32_t RecordSize,
+                    TraceBufferOverflowPolicy Policy,
+                    const AllocateFunc &Allocate, DeallocateFunc Deallocate) {
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      llvm::isPowerOf2_32(Capacity),
+      llvm::formatv("Trace buffer capacity {0} is not a power of two.",
+                    Capacity)));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      RecordSize != 0 && RecordSize % TraceBufferSlotTagSize == 0,
+      llvm::formatv("Trace buffer record size {0} is not a non-zero multiple "
+                    "of {1}.",
+                    RecordSize, TraceBufferSlotTagSize)));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Policy == TRACE_BUFFER_BLOCK || Policy == TRACE_BUFFER_DROP_NEWEST ||
+          Policy == TRACE_BUFFER_OVERWRITE_OLDEST,
+      llvm::formatv("Invalid trace buffer overflow policy {0}.",
+                    static_cast<uint32_t>(Policy))));
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Allocate && Deallocate,
+      "Trace buffer allocate and deallocate functions must be provided."));
+
+  uint64_t Size = getAllocationSize(Capacity, RecordSize);
+  void *Mem = Allocate(Size);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Mem != nullptr,
+      llvm::formatv("Failed to allocate {0} bytes for the trace buffer.",
+                    Size)));
+  // Zero out the header and the tags of all slots
+  std::memset(Mem, 0, Size);
+  auto *Header = static_cast<TraceBufferHeader *>(Mem);
+  Header->Capacity = Capacity;
+  Header->RecordSize = RecordSize;
+  Header->OverflowPolicy = Policy;
+
+  LLVM_DEBUG(llvm::dbgs() << llvm::formatv(
+                 "Created a trace buffer at {0:x} with {1} slots of {2} "
+                 "bytes.\n",
+                 Mem, Capacity, RecordSize));
+
+  return std::unique_ptr<TraceBuffer>(
+      new TraceBuffer(Header, std::move(Deallocate)));
+}
+
+TraceBuffer::~TraceBuffer() { Deallocate(Header); }
+
+uint64_t *TraceBuffer::getSlotTag(uint64_t Slot) const {
+  uint64_t SlotSize = TraceBufferSlotTagSize + Header->RecordSize;
+  return reinterpret_cast<uint64_t *>(
+      reinterpret_cast<uint8_t *>(Header) + TraceBufferSlotsOffset +
+      (Slot & (Header->Capacity - 1)) * SlotSize);
+}
+
+uint64_t TraceBuffer::getNumDropped() const {
+  return std::atomic_ref(Header->NumDropped).load(std::memory_order_relaxed);
+}
+
+size_t TraceBuffer::drain(RecordConsumer Consumer, size_t MaxRecords) {
+  std::lock_guard Lock(DrainMutex);
+  const uint64_t Capacity = Header->Capacity;
+  const uint32_t RecordSize = Header->RecordSize;
+  const bool CanBeOverwritten =
+      Header->OverflowPolicy == TRACE_BUFFER_OVERWRITE_OLDEST;
+  std::atomic_ref WriteIndex(Header->WriteIndex);
+  std::atomic_ref ReadIndex(Header->ReadIndex);
+
+  // Records are copied out of the slot before being handed to the consumer,
+  // so that the device can reuse the slot as soon as it is released
+  llvm::SmallVector<uint8_t, 64> Record(RecordSize);
+  size_t NumDrained = 0;
+  while (NumDrained < MaxRecords) {
+    // If the device has lapped the host, skip to the oldest slot that can
+    // still hold a valid record
+    if (CanBeOverwritten) {
+      uint64_t Reserved = WriteIndex.load(std::memory_order_relaxed);
+      if (Reserved > NextSlot + Capacity) {
+        NumLost += Reserved - Capacity - NextSlot;
+        NextSlot = Reserved - Capacity;
+      }
+    }
+    uint64_t *Tag = getSlotTag(NextSlot);
+    std::atomic_ref TagRef(*Tag);
+    uint64_t TagVal = TagRef.load(std::memory_order_acquire);
+    const uint64_t PublishedTag = getTraceSlotPublishedTag(NextSlot);
+    if (TagVal < PublishedTag || TagVal == getTraceSlotWritingTag(NextSlot))
+      // The record is not published yet
+      break;
+    if (TagVal == PublishedTag) {
+      std::memcpy(Record.data(), Tag + 1, RecordSize);
+      // Make sure no later record started overwriting the slot while it was
+      // being copied; Writers mark the slot before touching its payload
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (!CanBeOverwritten ||
+          TagRef.load(std::memory_order_relaxed) == TagVal) {
+        Consumer(Record);
+        ++NumConsumed;
+        ++NumDrained;
+      } else
+        ++NumLost;
+    } else
+      // The slot was overwritten by a later record before being consumed
+      ++NumLost;
+    ++NextSlot;
+    // Release the slot to the device
+    ReadIndex.store(NextSlot, std::memory_order_release);
+  }
+  return NumDrained;
+}
+
+TraceBufferDrainThread::TraceBufferDrainThread(
+    TraceBuffer &Buffer, RecordConsumer Consumer,
+    std::chrono::microseconds PollInterval)
+    : Buffer(Buffer), Consumer(std::move(Consumer)),
+      PollInterval(PollInterval), Worker([this] { run(); }) {}
+
+TraceBufferDrainThread::~TraceBufferDrainThread() { stop(); }
+
+void TraceBufferDrainThread::run() {
+  std::unique_lock Lock(Mutex);
+  while (!StopRequested) {
+    Lock.unlock();
+    // Keep draining without waiting as long as records are available
+    while (Buffer.drain(Consumer, Buffer.getCapacity()) != 0)
+      ;
+    Lock.lock();
+    StopCV.wait_for(Lock, PollInterval, [this] { return StopRequested; });
+  }
+}
+
+void TraceBufferDrainThread::stop() {
+  {
+    std::lock_guard Lock(Mutex);
+    if (StopRequested)
+      return;
+    StopRequested = true;
+  }
+  StopCV.notify_all();
+  if (Worker.joinable())
+    Worker.join();
+  // Consume whatever was published after the last drain of the thread
+  (void)Buffer.drain(Consumer);
+}
+
+} // namespace luthier
@@ -19,6 +19,7 @@
 /// structures commonly used by the instrumentation passes in Luthier.
 //===----------------------------------------------------------------------===//
 #include "luthier/Tooling/WrapperAnalysisPasses.h"
+#include <llvm/IR/InstIterator.h>
 
 namespace luthier {
 
@@ -26,6 +27,34 @@ llvm::AnalysisKey IntrinsicsProcessorsAnalysis::Key;
 
 llvm::AnalysisKey IntrinsicIRLoweringInfoMapAnalysis::Key;
 
+IntrinsicIRLoweringInfoMapAnalysis::Result
+IntrinsicIRLoweringInfoMapAnalysis::run(llvm::Module &IModule,
+                                        llvm::ModuleAnalysisManager &) {
+  Result Out;
+  if (!PrecomputedInfo)
+    return Out;
+  Out.LoweringInfo = *PrecomputedInfo;
+  // The precomputed info refers to the IR values of another copy of the
+  // instrumentation module; The placeholders are re-materialized here by
+  // their inline assembly string, which is their index in the lowering info
+  for (auto &LoweringInfo : Out.LoweringInfo)
+    LoweringInfo.rebindIRValues(nullptr);
+  for (const auto &F : IModule) {
+    for (const auto &I : llvm::instructions(F)) {
+      const auto *Call = llvm::dyn_cast<llvm::CallInst>(&I);
+      if (Call == nullptr || !Call->isInlineAsm())
+        continue;
+      llvm::StringRef AsmString =
+          llvm::cast<llvm::InlineAsm>(Call->getCalledOperand())
+              ->getAsmString();
+      unsigned int Idx;
+      if (!AsmString.getAsInteger(10, Idx) && Idx < Out.LoweringInfo.size())
+        Out.LoweringInfo[Idx].rebindIRValues(Call);
+    }
+  }
+  return Out;
+}
+
 llvm::AnalysisKey TargetAppModuleAndMAMAnalysis::Key;
 
 llvm::AnalysisKey LiftedRepresentationAnalysis::Key;
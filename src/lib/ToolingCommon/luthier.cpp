@@ -21,14 +21,18 @@
 //===----------------------------------------------------------------------===//
 #include "luthier/luthier.h"
 #include "luthier/Comgr/Comgr.h"
+#include "luthier/HSA/HsaError.h"
 #include "luthier/HSA/Instr.h"
 #include "luthier/Tooling/CodeGenerator.h"
 #include "luthier/Tooling/CodeLifter.h"
 #include "luthier/Tooling/Context.h"
 #include "luthier/Tooling/InstrumentationTask.h"
 #include "luthier/Tooling/ToolExecutableLoader.h"
+#include <algorithm>
 #include <llvm/ADT/StringExtras.h>
 #include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <mutex>
 #include <optional>
 
 namespace luthier {
@@ -66,17 +70,26 @@ printLiftedRepresentation(LiftedRepresentation &LR,
   return llvm::Error::success();
 }
 
-llvm::Error
-instrumentAndLoad(const hsa::LoadedCodeObjectKernel &Kernel,
-                  const LiftedRepresentation &LR,
+/// Instruments the \p LR using the \p Mutator and links it into an
+/// \p Executable
+/// \param [out] UsedOptions the pipeline options the injected payloads were
+/// compiled with
+static llvm::Error
+instrumentAndLink(const LiftedRepresentation &LR,
                   llvm::function_ref<llvm::Error(InstrumentationTask &,
                                                  LiftedRepresentation &)>
                       Mutator,
-                  llvm::StringRef Preset) {
-  const auto &LoaderApiTable = Context::instance().getHsaLoaderTable();
-  auto Lock = LR.getLock();
+                  llvm::SmallVectorImpl<char> &Executable,
+                  IModulePipelineOptions &UsedOptions) {
   // Instrument the lifted representation
-  auto InstrumentedLR = CodeGenerator::instance().instrument(LR, Mutator);
+  auto InstrumentedLR = CodeGenerator::instance().instrument(
+      LR,
+      [&](InstrumentationTask &IT, LiftedRepresentation &ClonedLR)
+          -> llvm::Error {
+        LUTHIER_RETURN_ON_ERROR(Mutator(IT, ClonedLR));
+        UsedOptions = IT.getPipelineOptions();
+        return llvm::Error::success();
+      });
   LUTHIER_RETURN_ON_ERROR(InstrumentedLR.takeError());
 
   // Print the assembly file of the Instrumented LR
@@ -86,11 +99,100 @@ instrumentAndLoad(const hsa::LoadedCodeObjectKernel &Kernel,
       **InstrumentedLR, Relocatable, llvm::CodeGenFileType::ObjectFile));
 
   // Link the object file into executables
+  Executable.clear();
+  return comgr::linkRelocatableToExecutable(Relocatable, Executable);
+}
+
+/// \return the resource usage of a kernel recorded in its metadata \p MD
+/// on \p Target
+static KernelResourceUsage
+getKernelResourceUsage(const amdgpu::hsamd::Kernel::Metadata &MD,
+                       const OccupancyTarget &Target) {
+  return readKernelResourceUsage(MD.VGPRCount, MD.AGPRCount, MD.SGPRCount,
+                                 MD.PrivateSegmentFixedSize,
+                                 MD.GroupSegmentFixedSize, Target);
+}
+
+/// \return the resource usage report of the \p Kernel before and after
+/// instrumentation; Both are read from the kernel metadata, of the original
+/// code object and of the instrumented \p Executable respectively, so that
+/// their register counts are exact and directly comparable
+static llvm::Expected<ResourceUsageReport>
+computeResourceUsageReport(const hsa::LoadedCodeObjectKernel &Kernel,
+                           const LiftedRepresentation &LR,
+                           llvm::ArrayRef<char> Executable) {
+  const auto &OriginalMD = Kernel.getKernelMetadata();
+  auto Target = OccupancyTarget::get(LR.getTM().getTargetCPU(),
+                                     OriginalMD.WaveFrontSize);
+  LUTHIER_RETURN_ON_ERROR(Target.takeError());
+
+  std::unique_ptr<amdgpu::hsamd::Kernel::Metadata> MD;
+  LUTHIER_RETURN_ON_ERROR(
+      ToolExecutableLoader::instance()
+          .parseInstrumentedKernelMetadata(
+              llvm::ArrayRef(reinterpret_cast<const uint8_t *>(
+                                 Executable.data()),
+                             Executable.size()),
+              Kernel)
+          .moveInto(MD));
+
+  unsigned WorkgroupSize = OriginalMD.MaxFlatWorkgroupSize;
+  if (OriginalMD.ReqdWorkGroupSize.has_value())
+    WorkgroupSize = OriginalMD.ReqdWorkGroupSize->X *
+                    OriginalMD.ReqdWorkGroupSize->Y *
+                    OriginalMD.ReqdWorkGroupSize->Z;
+  return luthier::computeResourceUsageReport(
+      getKernelResourceUsage(OriginalMD, *Target),
+      getKernelResourceUsage(*MD, *Target), *Target, WorkgroupSize);
+}
+
+llvm::Error
+instrumentAndLoad(const hsa::LoadedCodeObjectKernel &Kernel,
+                  const LiftedRepresentation &LR,
+                  llvm::function_ref<llvm::Error(InstrumentationTask &,
+                                                 LiftedRepresentation &)>
+                      Mutator,
+                  llvm::StringRef Preset, ResourceUsageReport *Report,
+                  const OccupancyBudget &Budget) {
+  const auto &LoaderApiTable = Context::instance().getHsaLoaderTable();
+  auto Lock = LR.getLock();
   llvm::SmallVector<char> Executable;
+  IModulePipelineOptions UsedOptions;
   LUTHIER_RETURN_ON_ERROR(
-      comgr::linkRelocatableToExecutable(Relocatable, Executable));
-  // Create a set of extern variables used in the instrumented code
+      instrumentAndLink(LR, Mutator, Executable, UsedOptions));
+
+  // Only calculate the resource usage when it is asked for, as occupancy
+  // calculation doesn't support all targets
+  if (Report != nullptr || Budget.MaxWavesPerSIMDDrop.has_value()) {
+    auto Usage = computeResourceUsageReport(Kernel, LR, Executable);
+    LUTHIER_RETURN_ON_ERROR(Usage.takeError());
+    if (auto Err = checkOccupancyBudget(*Usage, Budget)) {
+      IModulePipelineOptions CheaperOptions =
+          UsedOptions.withLowerRegisterPressure();
+      if (!Budget.RetryWithCheaperOptions ||
+          CheaperOptions.producesSameCodeAs(UsedOptions))
+        return Err;
+      llvm::consumeError(std::move(Err));
+      // Re-instrument with cheaper injected payloads
+      LUTHIER_RETURN_ON_ERROR(instrumentAndLink(
+          LR,
+          [&](InstrumentationTask &IT,
+              LiftedRepresentation &ClonedLR) -> llvm::Error {
+            LUTHIER_RETURN_ON_ERROR(Mutator(IT, ClonedLR));
+            IT.setPipelineOptions(
+                IT.getPipelineOptions().withLowerRegisterPressure());
+            return llvm::Error::success();
+          },
+          Executable, UsedOptions));
+      LUTHIER_RETURN_ON_ERROR(
+          computeResourceUsageReport(Kernel, LR, Executable).moveInto(*Usage));
+      LUTHIER_RETURN_ON_ERROR(checkOccupancyBudget(*Usage, Budget));
+    }
+    if (Report != nullptr)
+      *Report = *Usage;
+  }
 
+  // Create a set of extern variables used in the instrumented code
   llvm::StringMap<const void *> ExternVariables;
   // set of static variables used in the original kernel itself
   for (const auto &[Symbol, GV] : LR.globals()) {
@@ -120,8 +222,30 @@ isKernelInstrumented(const hsa::LoadedCodeObjectKernel &Kernel,
   return ToolExecutableLoader::instance().isKernelInstrumented(Kernel, Preset);
 }
 
-llvm::Error overrideWithInstrumented(hsa_kernel_dispatch_packet_t &Packet,
-                                     llvm::StringRef Preset) {
+/// Patches the precomputed \p Override into the dispatch \p Packet
+static void applyDispatchOverride(hsa_kernel_dispatch_packet_t &Packet,
+                                  const DispatchOverride &Override) {
+  Packet.kernel_object = Override.InstrumentedKernelObject;
+  // The private segment size of dispatches of kernels using a dynamic stack
+  // also covers the stack limit of the application; Keep it, and add the
+  // instrumentation stack on top
+  if (Override.UsesDynamicStack)
+    Packet.private_segment_size =
+        std::max(Packet.private_segment_size +
+                     Override.DynamicStackPrivateSegmentSizeIncrease,
+                 Override.PrivateSegmentSize);
+  else
+    Packet.private_segment_size = Override.PrivateSegmentSize;
+  // The group segment size of the packet also covers the dynamic LDS of the
+  // dispatch; Only add the extra static LDS of the instrumented kernel
+  Packet.group_segment_size += Override.GroupSegmentSizeIncrease;
+}
+
+/// Called when the kernel of the \p Packet has no dispatch override under
+/// \p Preset; Resolves the kernel symbol to report a descriptive error
+static llvm::Error
+diagnoseMissingDispatchOverride(const hsa_kernel_dispatch_packet_t &Packet,
+                                llvm::StringRef Preset) {
   luthier::Context &C = Context::instance();
   auto CoreApiTable = C.getHsaCoreTable();
   const auto &LoaderApiTable = C.getHsaLoaderTable();
@@ -139,17 +263,122 @@ llvm::Error overrideWithInstrumented(hsa_kernel_dispatch_packet_t &Packet,
       luthier::ToolExecutableLoader::instance().getInstrumentedKernel(
           *(*Symbol)->getExecutableSymbol(), Preset);
   LUTHIER_RETURN_ON_ERROR(InstrumentedKernel.takeError());
-  auto &[InstrumentedSymbol, InstrumentedMD] = *InstrumentedKernel;
+  return LUTHIER_MAKE_GENERIC_ERROR(
+      llvm::formatv("Kernel object {0:x} is instrumented under preset {1}, "
+                    "but has no precomputed dispatch override.",
+                    Packet.kernel_object, Preset));
+}
 
-  llvm::Expected<uint64_t> InstrumentedKD =
-      hsa::executableSymbolGetAddress(CoreApiTable, InstrumentedSymbol);
-  LUTHIER_RETURN_ON_ERROR(InstrumentedKD.takeError());
+InstrumentationPresetID getInstrumentationPresetID(llvm::StringRef Preset) {
+  return ToolExecutableLoader::instance().getOrCreatePresetID(Preset);
+}
 
-  Packet.kernel_object = *InstrumentedKD;
+llvm::Error overrideWithInstrumented(hsa_kernel_dispatch_packet_t &Packet,
+                                     llvm::StringRef Preset) {
+  const auto &TEL = ToolExecutableLoader::instance();
+  std::optional<DispatchOverride> Override;
+  if (auto PresetID = TEL.lookupPresetID(Preset))
+    Override = TEL.lookupDispatchOverride(Packet.kernel_object, *PresetID);
+  if (!Override)
+    return diagnoseMissingDispatchOverride(Packet, Preset);
+  applyDispatchOverride(Packet, *Override);
+  return llvm::Error::success();
+}
 
-  Packet.private_segment_size = InstrumentedMD.PrivateSegmentFixedSize;
+llvm::Error overrideWithInstrumented(hsa_kernel_dispatch_packet_t &Packet,
+                                     InstrumentationPresetID Preset) {
+  auto Override = ToolExecutableLoader::instance().lookupDispatchOverride(
+      Packet.kernel_object, Preset);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Override.has_value(),
+      llvm::formatv("Kernel object {0:x} has no instrumented version loaded "
+                    "under preset ID {1}.",
+                    Packet.kernel_object, Preset)));
+  applyDispatchOverride(Packet, *Override);
+  return llvm::Error::success();
+}
 
+llvm::Error
+overrideWithInstrumented(hsa_kernel_dispatch_packet_t &Packet,
+                         InstrumentationPresetID Preset,
+                         DispatchBufferPool &Buffers,
+                         DispatchBufferPool::CompletionHandler OnCompletion) {
+  auto Override = ToolExecutableLoader::instance().lookupDispatchOverride(
+      Packet.kernel_object, Preset);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Override.has_value(),
+      llvm::formatv("Kernel object {0:x} has no instrumented version loaded "
+                    "under preset ID {1}.",
+                    Packet.kernel_object, Preset)));
+  // Attach the buffer first, so that the packet is left untouched on failure
+  LUTHIER_RETURN_ON_ERROR(Buffers.attach(Packet, Override->KernArgSegmentSize,
+                                         std::move(OnCompletion)));
+  applyDispatchOverride(Packet, *Override);
   return llvm::Error::success();
 }
 
+llvm::Expected<bool>
+overrideWithInstrumented(hsa_kernel_dispatch_packet_t &Packet,
+                         llvm::StringRef Preset, DispatchSampler &Sampler) {
+  // Dispatches that are not sampled are launched as is
+  if (!Sampler.sample(Packet))
+    return false;
+  LUTHIER_RETURN_ON_ERROR(overrideWithInstrumented(Packet, Preset));
+  return true;
+}
+
+/// Serializes the updates of the hook enable mask by the host
+static std::mutex HookEnableMaskMutex;
+
+/// Replaces the hook enable mask of the tool on the \p Agent with the
+/// result of \p Update applied to its current value
+static llvm::Error
+updateHookEnableMask(hsa_agent_t Agent,
+                     llvm::function_ref<uint32_t(uint32_t)> Update) {
+  const auto &SIM =
+      ToolExecutableLoader::instance().getStaticInstrumentationModule();
+  auto MaskAddress =
+      SIM.getGlobalVariablesLoadedOnAgent(HookEnableMaskVar, Agent);
+  LUTHIER_RETURN_ON_ERROR(MaskAddress.takeError());
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      MaskAddress->has_value(),
+      llvm::formatv("The device code of the tool is not loaded on agent "
+                    "{0:x}.",
+                    Agent.handle)));
+  auto *DeviceMask = reinterpret_cast<void *>(**MaskAddress);
+  auto CoreApi = Context::instance().getHsaCoreTable();
+
+  std::lock_guard Lock(HookEnableMaskMutex);
+  uint32_t Mask;
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_HSA_CALL_ERROR_CHECK(
+      CoreApi.callFunction<&::CoreApiTable::hsa_memory_copy_fn>(
+          &Mask, DeviceMask, sizeof(Mask)),
+      llvm::formatv("Failed to read the hook enable mask on agent {0:x}.",
+                    Agent.handle)));
+  Mask = Update(Mask);
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_HSA_CALL_ERROR_CHECK(
+      CoreApi.callFunction<&::CoreApiTable::hsa_memory_copy_fn>(
+          DeviceMask, &Mask, sizeof(Mask)),
+      llvm::formatv("Failed to write the hook enable mask on agent {0:x}.",
+                    Agent.handle)));
+  return llvm::Error::success();
+}
+
+llvm::Error setHooksEnabled(hsa_agent_t Agent, bool Enabled) {
+  return updateHookEnableMask(
+      Agent, [&](uint32_t) -> uint32_t { return Enabled ? ~0U : 0U; });
+}
+
+llvm::Error setHookEnabled(hsa_agent_t Agent, const void *Hook, bool Enabled) {
+  const auto &SIM =
+      ToolExecutableLoader::instance().getStaticInstrumentationModule();
+  auto HookName = SIM.convertHookHandleToHookName(Hook);
+  LUTHIER_RETURN_ON_ERROR(HookName.takeError());
+  auto Bit = SIM.getHookEnableBit(*HookName);
+  LUTHIER_RETURN_ON_ERROR(Bit.takeError());
+  return updateHookEnableMask(Agent, [&](uint32_t Mask) -> uint32_t {
+    return Enabled ? Mask | (1U << *Bit) : Mask & ~(1U << *Bit);
+  });
+}
+
 } // namespace luthier
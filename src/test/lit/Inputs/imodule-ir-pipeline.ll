@@ -0,0 +1,51 @@
+; Instrumentation module shared by the imodule-ir-pipeline-*.test fixtures;
+; Every IR pipeline must produce injected payloads with the same behavior
+
+; Both hooks are inlined, and the payload reads the register, stores its sum
+; with the bank size, and increments the counter, in that order; The
+; optimizing pipelines also promote the stack slots of the inlined hooks
+; CHECK-LABEL: define void @payload()
+; OPT-NOT: alloca
+; CHECK: [[REG:%[a-z0-9.]+]] = {{(tail )?}}call i32 @"luthier::readReg.i32.i32"(i32 4)
+; CHECK-NOT: call void @{{.*}}_hook
+; OPT-NEXT: [[SUM:%[a-z0-9.]+]] = add i32 [[REG]], 32
+; OPT-NEXT: store i32 [[SUM]], ptr addrspace(1) @counter
+; O0: store i32 [[REG]], ptr addrspace(5) [[ADDR:%[a-z0-9.]+]]
+; O0: [[LOADED:%[a-z0-9.]+]] = load i32, ptr addrspace(5) [[ADDR]]
+; O0-NEXT: [[SUM:%[a-z0-9.]+]] = add i32 [[LOADED]], 32
+; O0-NEXT: store i32 [[SUM]], ptr addrspace(1) @counter
+; CHECK-NOT: call void @{{.*}}_hook
+; CHECK: atomicrmw add ptr addrspace(1) @counter, i32 1 monotonic
+; CHECK-NOT: call void @{{.*}}_hook
+; CHECK: ret void
+
+@counter = addrspace(1) global i32 0
+
+define void @add_hook(i32 %bank_size, i32 %reg) #0 {
+entry:
+  %reg.addr = alloca i32, addrspace(5)
+  store i32 %reg, ptr addrspace(5) %reg.addr
+  %r = load i32, ptr addrspace(5) %reg.addr
+  %sum = add i32 %r, %bank_size
+  store i32 %sum, ptr addrspace(1) @counter
+  ret void
+}
+
+define void @count_hook() #0 {
+entry:
+  %old = atomicrmw add ptr addrspace(1) @counter, i32 1 monotonic
+  ret void
+}
+
+define void @payload() #1 {
+  %1 = call i32 @"luthier::readReg.i32.i32"(i32 4)
+  call void @add_hook(i32 32, i32 %1)
+  call void @count_hook()
+  ret void
+}
+
+declare i32 @"luthier::readReg.i32.i32"(i32) #2
+
+attributes #0 = { alwaysinline "luthier_hook" }
+attributes #1 = { naked "luthier_injected_payload" }
+attributes #2 = { "luthier_intrinsic"="luthier::readReg" }
@@ -0,0 +1,98 @@
+//===-- hook-call-specialization.cpp --------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements hook-call-specialization, an executable used to test
+/// the specialization of hook calls to their call site offline. It reads an
+/// instrumentation module in textual IR, specializes the hook calls of each
+/// of its injected payloads, removes the injected payloads that end up empty,
+/// and prints the resulting module.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/HookSpecialization.h"
+#include "luthier/consts.h"
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <luthier/Common/ErrorCheck.h>
+#include <luthier/Common/GenericLuthierError.h>
+
+static llvm::cl::OptionCategory
+    HookCallSpecializationOptions("Hook Call Specialization Options");
+
+static llvm::cl::opt<std::string>
+    InputFilename(llvm::cl::Positional,
+                  llvm::cl::desc("<instrumentation module IR file>"),
+                  llvm::cl::Required,
+                  llvm::cl::cat(HookCallSpecializationOptions));
+
+static llvm::cl::opt<std::string>
+    OutputFilename("o", llvm::cl::desc("Output filename"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init("-"),
+                   llvm::cl::cat(HookCallSpecializationOptions));
+
+int main(int Argc, char *Argv[]) {
+  llvm::InitLLVM X(Argc, Argv);
+
+  llvm::cl::ParseCommandLineOptions(
+      Argc, Argv, "Luthier hook call specialization tool\n");
+
+  llvm::LLVMContext Ctx;
+  llvm::SMDiagnostic Diag;
+  std::unique_ptr<llvm::Module> M = llvm::parseIRFile(InputFilename, Diag, Ctx);
+  if (M == nullptr) {
+    Diag.print(Argv[0], llvm::errs());
+    return 1;
+  }
+
+  std::error_code EC;
+  auto OutFile = std::make_unique<llvm::ToolOutputFile>(OutputFilename, EC,
+                                                        llvm::sys::fs::OF_None);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !EC, llvm::formatv("Failed to open output file, error: {0}.",
+                         EC.message())));
+
+  llvm::SmallVector<llvm::Function *, 4> InjectedPayloads;
+  for (llvm::Function &F : *M) {
+    if (F.hasFnAttribute(luthier::InjectedPayloadAttribute))
+      InjectedPayloads.push_back(&F);
+  }
+  for (llvm::Function *Payload : InjectedPayloads) {
+    auto IsEmpty = luthier::specializeHookCalls(*Payload);
+    LUTHIER_REPORT_FATAL_ON_ERROR(IsEmpty.takeError());
+    if (*IsEmpty) {
+      OutFile->os() << "Removed empty injected payload " << Payload->getName()
+                    << "\n";
+      Payload->eraseFromParent();
+    }
+  }
+
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !llvm::verifyModule(*M, &llvm::errs()),
+      "The specialized instrumentation module is broken."));
+
+  M->print(OutFile->os(), nullptr);
+
+  OutFile->keep();
+
+  return 0;
+}
@@ -0,0 +1,175 @@
+//===-- hook-enable-guard.cpp ---------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements hook-enable-guard, an executable used to test the
+/// guarding of injected payloads with the hook enable mask offline. It builds
+/// the MIR of a register allocated injected payload with the requested
+/// application registers live on entry, guards it with a check of the hook
+/// enable mask, verifies the payload, and prints it.
+//===----------------------------------------------------------------------===//
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "luthier/Tooling/HookPredication.h"
+#include "luthier/consts.h"
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/CodeGen/MachineModuleInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <luthier/Common/ErrorCheck.h>
+#include <luthier/Common/GenericLuthierError.h>
+
+static llvm::cl::OptionCategory
+    HookEnableGuardOptions("Hook Enable Guard Options");
+
+static llvm::cl::opt<std::string>
+    CPU("mcpu", llvm::cl::desc("Target GPU to emit the MIR for"),
+        llvm::cl::init("gfx908"), llvm::cl::cat(HookEnableGuardOptions));
+
+static llvm::cl::list<std::string>
+    AppLiveIns("app-live-ins",
+               llvm::cl::desc("Application registers live at the "
+                              "instrumentation point"),
+               llvm::cl::CommaSeparated, llvm::cl::cat(HookEnableGuardOptions));
+
+static llvm::cl::opt<bool>
+    SCCLive("scc-live",
+            llvm::cl::desc("Whether SCC is live at the instrumentation point"),
+            llvm::cl::init(false), llvm::cl::cat(HookEnableGuardOptions));
+
+static llvm::cl::opt<uint32_t>
+    PayloadMask("payload-mask",
+                llvm::cl::desc("Bits of the hook enable mask enabling the "
+                               "injected payload"),
+                llvm::cl::init(~0U), llvm::cl::cat(HookEnableGuardOptions));
+
+static llvm::cl::opt<bool> DSOLocalMask(
+    "dso-local-mask",
+    llvm::cl::desc("Whether the hook enable mask is DSO local, and therefore "
+                   "not accessed through the GOT"),
+    llvm::cl::init(false), llvm::cl::cat(HookEnableGuardOptions));
+
+static llvm::cl::opt<std::string>
+    OutputFilename("o", llvm::cl::desc("Output filename"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init("-"),
+                   llvm::cl::cat(HookEnableGuardOptions));
+
+/// \return the physical register named \p Name (e.g. "v0" or "s4")
+static llvm::Expected<llvm::MCRegister>
+parseReg(llvm::StringRef Name, const llvm::TargetRegisterInfo &TRI) {
+  std::string TableGenName = Name.upper();
+  if (Name.starts_with("v"))
+    TableGenName = "VGPR" + Name.substr(1).str();
+  else if (Name.starts_with("s"))
+    TableGenName = "SGPR" + Name.substr(1).str();
+  for (unsigned Reg = 1; Reg < TRI.getNumRegs(); ++Reg) {
+    if (TableGenName == TRI.getName(Reg))
+      return Reg;
+  }
+  return LUTHIER_MAKE_GENERIC_ERROR(
+      llvm::formatv("Unknown physical register {0}.", Name));
+}
+
+int main(int Argc, char *Argv[]) {
+  llvm::InitLLVM X(Argc, Argv);
+
+  llvm::cl::ParseCommandLineOptions(Argc, Argv,
+                                    "Luthier hook enable guard tool\n");
+
+  LLVMInitializeAMDGPUTarget();
+  LLVMInitializeAMDGPUTargetInfo();
+  LLVMInitializeAMDGPUTargetMC();
+
+  llvm::Triple TT("amdgcn-amd-amdhsa");
+  std::string Error;
+  auto *Target = llvm::TargetRegistry::lookupTarget(TT.normalize(), Error);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Target != nullptr,
+      llvm::formatv("Failed to get target {0} from LLVM, error: {1}.",
+                    TT.normalize(), Error)));
+  std::unique_ptr<llvm::GCNTargetMachine> TM(
+      reinterpret_cast<llvm::GCNTargetMachine *>(Target->createTargetMachine(
+          TT.normalize(), CPU, "", llvm::TargetOptions(), llvm::Reloc::PIC_)));
+
+  llvm::LLVMContext Ctx;
+  llvm::Module M("hook-enable-guard", Ctx);
+  M.setTargetTriple(TT.normalize());
+  M.setDataLayout(TM->createDataLayout());
+  auto *Int32Ty = llvm::Type::getInt32Ty(Ctx);
+  auto *EnableMask = new llvm::GlobalVariable(
+      M, Int32Ty, false, llvm::GlobalValue::ExternalLinkage,
+      llvm::ConstantInt::get(Int32Ty, ~0U), luthier::HookEnableMaskVar,
+      nullptr, llvm::GlobalValue::NotThreadLocal, 1);
+  EnableMask->setDSOLocal(DSOLocalMask);
+  auto *FuncTy = llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), false);
+  auto *PayloadF = llvm::Function::Create(
+      FuncTy, llvm::GlobalValue::ExternalLinkage, "payload", M);
+  PayloadF->addFnAttr(luthier::InjectedPayloadAttribute);
+
+  llvm::MachineModuleInfo MMI(TM.get());
+
+  // Build the injected payload, after its prologue/epilogue has been inserted
+  auto &PayloadMF = MMI.getOrCreateMachineFunction(*PayloadF);
+  const auto &ST = PayloadMF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  const auto &TRI = *ST.getRegisterInfo();
+  PayloadMF.getProperties().set(
+      llvm::MachineFunctionProperties::Property::NoVRegs);
+  PayloadMF.getRegInfo().freezeReservedRegs();
+  auto *PayloadMBB = PayloadMF.CreateMachineBasicBlock();
+  PayloadMF.push_back(PayloadMBB);
+  llvm::LivePhysRegs UsedRegs(TRI);
+  for (const auto &Name : AppLiveIns) {
+    auto Reg = parseReg(Name, TRI);
+    LUTHIER_REPORT_FATAL_ON_ERROR(Reg.takeError());
+    PayloadMBB->addLiveIn(*Reg);
+    UsedRegs.addReg(*Reg);
+  }
+  if (SCCLive)
+    PayloadMBB->addLiveIn(llvm::AMDGPU::SCC);
+  llvm::BuildMI(*PayloadMBB, PayloadMBB->end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::V_MOV_B32_e32), llvm::AMDGPU::VGPR0)
+      .addImm(0);
+  llvm::BuildMI(*PayloadMBB, PayloadMBB->end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::SI_RETURN));
+
+  LUTHIER_REPORT_FATAL_ON_ERROR(luthier::emitHookEnableGuard(
+      PayloadMF, *EnableMask, PayloadMask, UsedRegs, SCCLive));
+
+  PayloadMF.verify(nullptr, "After guarding the injected payload with the "
+                            "hook enable mask");
+
+  std::error_code EC;
+  auto OutFile = std::make_unique<llvm::ToolOutputFile>(OutputFilename, EC,
+                                                        llvm::sys::fs::OF_None);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !EC, llvm::formatv("Failed to open output file, error: {0}.",
+                         EC.message())));
+  PayloadMF.print(OutFile->os());
+
+  OutFile->keep();
+
+  return 0;
+}
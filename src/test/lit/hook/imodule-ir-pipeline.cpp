@@ -0,0 +1,120 @@
+//===-- imodule-ir-pipeline.cpp -------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements imodule-ir-pipeline, an executable used to test the
+/// IR pipelines run over the instrumentation module offline. It reads an
+/// instrumentation module in textual IR, runs the IR pipeline selected by the
+/// <tt>-luthier-imodule-*</tt> command line options over it, and prints the
+/// resulting module.
+//===----------------------------------------------------------------------===//
+#include "luthier/Tooling/IModulePipelineOptions.h"
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <llvm/Target/TargetMachine.h>
+#include <luthier/Common/ErrorCheck.h>
+#include <luthier/Common/GenericLuthierError.h>
+
+static llvm::cl::OptionCategory
+    IModuleIRPipelineOptions("Instrumentation Module IR Pipeline Options");
+
+static llvm::cl::opt<std::string>
+    InputFilename(llvm::cl::Positional,
+                  llvm::cl::desc("<instrumentation module IR file>"),
+                  llvm::cl::Required, llvm::cl::cat(IModuleIRPipelineOptions));
+
+static llvm::cl::opt<std::string>
+    CPU("mcpu", llvm::cl::desc("Target GPU to optimize the module for"),
+        llvm::cl::init("gfx908"), llvm::cl::cat(IModuleIRPipelineOptions));
+
+static llvm::cl::opt<std::string>
+    OutputFilename("o", llvm::cl::desc("Output filename"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init("-"),
+                   llvm::cl::cat(IModuleIRPipelineOptions));
+
+int main(int Argc, char *Argv[]) {
+  llvm::InitLLVM X(Argc, Argv);
+
+  llvm::cl::ParseCommandLineOptions(
+      Argc, Argv, "Luthier instrumentation module IR pipeline tool\n");
+
+  LLVMInitializeAMDGPUTarget();
+  LLVMInitializeAMDGPUTargetInfo();
+  LLVMInitializeAMDGPUTargetMC();
+
+  llvm::LLVMContext Ctx;
+  llvm::SMDiagnostic Diag;
+  std::unique_ptr<llvm::Module> M = llvm::parseIRFile(InputFilename, Diag, Ctx);
+  if (M == nullptr) {
+    Diag.print(Argv[0], llvm::errs());
+    return 1;
+  }
+
+  llvm::Triple TT("amdgcn-amd-amdhsa");
+  std::string Error;
+  auto *Target = llvm::TargetRegistry::lookupTarget(TT.normalize(), Error);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Target != nullptr,
+      llvm::formatv("Failed to get target {0} from LLVM, error: {1}.",
+                    TT.normalize(), Error)));
+  std::unique_ptr<llvm::TargetMachine> TM(Target->createTargetMachine(
+      TT.normalize(), CPU, "", llvm::TargetOptions(), llvm::Reloc::PIC_));
+  M->setTargetTriple(TT.normalize());
+  M->setDataLayout(TM->createDataLayout());
+
+  llvm::LoopAnalysisManager LAM;
+  llvm::FunctionAnalysisManager FAM;
+  llvm::CGSCCAnalysisManager CGAM;
+  llvm::ModuleAnalysisManager MAM;
+  llvm::PassBuilder PB(TM.get());
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  llvm::ModulePassManager MPM;
+  LUTHIER_REPORT_FATAL_ON_ERROR(
+      luthier::IModulePipelineOptions::getDefault().addIRPipeline(PB, MPM));
+  MPM.run(*M, MAM);
+
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !llvm::verifyModule(*M, &llvm::errs()),
+      "The optimized instrumentation module is broken."));
+
+  std::error_code EC;
+  auto OutFile = std::make_unique<llvm::ToolOutputFile>(OutputFilename, EC,
+                                                        llvm::sys::fs::OF_None);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !EC, llvm::formatv("Failed to open output file, error: {0}.",
+                         EC.message())));
+  M->print(OutFile->os(), nullptr);
+
+  OutFile->keep();
+
+  return 0;
+}
@@ -0,0 +1,330 @@
+//===-- imodule-mir-codegen.cpp -------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements imodule-mir-codegen, an executable used to test the
+/// code gen pipeline run over the instrumentation module offline. It builds
+/// the MIR of a target kernel and an instrumentation module with one injected
+/// payload per kernel instruction, optionally calling an outlined hook or
+/// predicated on the hook enable mask, generates the machine code of the
+/// payloads with the <tt>RunMIRPassesOnIModulePass</tt> using the number of
+/// threads requested by <tt>-luthier-imodule-codegen-threads</tt>, and prints
+/// the machine code of the payloads in program order.
+//===----------------------------------------------------------------------===//
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "luthier/Tooling/AMDGPURegisterLiveness.h"
+#include "luthier/Tooling/IModuleIRGeneratorPass.h"
+#include "luthier/Tooling/LRCallgraph.h"
+#include "luthier/Tooling/MMISlotIndexesAnalysis.h"
+#include "luthier/Tooling/PhysRegsNotInLiveInsAnalysis.h"
+#include "luthier/Tooling/PrePostAmbleEmitter.h"
+#include "luthier/Tooling/RunMIRPassesOnIModulePass.h"
+#include "luthier/Tooling/SVStorageAndLoadLocations.h"
+#include "luthier/Tooling/WrapperAnalysisPasses.h"
+#include "luthier/consts.h"
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/CodeGen/MachineModuleInfo.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <luthier/Common/ErrorCheck.h>
+#include <luthier/Common/GenericLuthierError.h>
+
+static llvm::cl::OptionCategory
+    IModuleMIRCodeGenOptions("Instrumentation Module MIR CodeGen Options");
+
+static llvm::cl::opt<std::string>
+    CPU("mcpu", llvm::cl::desc("Target GPU to generate the machine code for"),
+        llvm::cl::init("gfx908"), llvm::cl::cat(IModuleMIRCodeGenOptions));
+
+static llvm::cl::opt<unsigned>
+    NumPayloads("num-payloads",
+                llvm::cl::desc("Number of instrumented instructions in the "
+                               "target kernel"),
+                llvm::cl::init(8), llvm::cl::cat(IModuleMIRCodeGenOptions));
+
+static llvm::cl::opt<unsigned> NumLiveVGPRs(
+    "num-live-vgprs",
+    llvm::cl::desc("Number of VGPRs, starting from v4, live throughout the "
+                   "target kernel"),
+    llvm::cl::init(0), llvm::cl::cat(IModuleMIRCodeGenOptions));
+
+static llvm::cl::opt<unsigned> NumLiveSGPRs(
+    "num-live-sgprs",
+    llvm::cl::desc("Number of SGPRs, starting from s8, live throughout the "
+                   "target kernel"),
+    llvm::cl::init(0), llvm::cl::cat(IModuleMIRCodeGenOptions));
+
+static llvm::cl::opt<bool> OutlinedHook(
+    "outlined-hook",
+    llvm::cl::desc("Make every other injected payload call an outlined hook "
+                   "defined in the instrumentation module"),
+    llvm::cl::init(false), llvm::cl::cat(IModuleMIRCodeGenOptions));
+
+static llvm::cl::opt<bool> Predicated(
+    "predicated",
+    llvm::cl::desc("Predicate every injected payload on the first bit of the "
+                   "hook enable mask"),
+    llvm::cl::init(false), llvm::cl::cat(IModuleMIRCodeGenOptions));
+
+static llvm::cl::opt<bool> PrintLoadPlans(
+    "print-load-plans",
+    llvm::cl::desc("Print whether each injected payload loads and stores "
+                   "the state value array"),
+    llvm::cl::init(false), llvm::cl::cat(IModuleMIRCodeGenOptions));
+
+static llvm::cl::opt<bool> PrintNumUnits(
+    "print-num-units",
+    llvm::cl::desc("Print the number of code gen units the machine code of "
+                   "the injected payloads was generated in"),
+    llvm::cl::init(false), llvm::cl::cat(IModuleMIRCodeGenOptions));
+
+static llvm::cl::opt<std::string>
+    OutputFilename("o", llvm::cl::desc("Output filename"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init("-"),
+                   llvm::cl::cat(IModuleMIRCodeGenOptions));
+
+int main(int Argc, char *Argv[]) {
+  llvm::InitLLVM X(Argc, Argv);
+
+  llvm::cl::ParseCommandLineOptions(
+      Argc, Argv, "Luthier instrumentation module MIR code gen tool\n");
+
+  LLVMInitializeAMDGPUTarget();
+  LLVMInitializeAMDGPUTargetInfo();
+  LLVMInitializeAMDGPUTargetMC();
+
+  llvm::Triple TT("amdgcn-amd-amdhsa");
+  std::string Error;
+  auto *Target = llvm::TargetRegistry::lookupTarget(TT.normalize(), Error);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Target != nullptr,
+      llvm::formatv("Failed to get target {0} from LLVM, error: {1}.",
+                    TT.normalize(), Error)));
+  std::unique_ptr<llvm::GCNTargetMachine> TM(
+      reinterpret_cast<llvm::GCNTargetMachine *>(Target->createTargetMachine(
+          TT.normalize(), CPU, "", llvm::TargetOptions(), llvm::Reloc::PIC_)));
+
+  llvm::LLVMContext Ctx;
+  auto *VoidTy = llvm::Type::getVoidTy(Ctx);
+  auto *Int32Ty = llvm::Type::getInt32Ty(Ctx);
+
+  // Build the target kernel, with one instruction per injected payload
+  llvm::Module TargetAppM("target-app", Ctx);
+  TargetAppM.setTargetTriple(TT.normalize());
+  TargetAppM.setDataLayout(TM->createDataLayout());
+  auto *KernelF = llvm::Function::Create(
+      llvm::FunctionType::get(VoidTy, false),
+      llvm::GlobalValue::ExternalLinkage, "kernel", TargetAppM);
+  KernelF->setCallingConv(llvm::CallingConv::AMDGPU_KERNEL);
+
+  llvm::MachineModuleInfo TargetMMI(TM.get());
+  auto &KernelMF = TargetMMI.getOrCreateMachineFunction(*KernelF);
+  const auto &TII = *KernelMF.getSubtarget<llvm::GCNSubtarget>().getInstrInfo();
+  KernelMF.getProperties().set(
+      llvm::MachineFunctionProperties::Property::NoVRegs);
+  KernelMF.getRegInfo().freezeReservedRegs();
+  auto *KernelMBB = KernelMF.CreateMachineBasicBlock();
+  KernelMF.push_back(KernelMBB);
+  llvm::SmallVector<llvm::MachineInstr *> InstPoints;
+  for (unsigned I = 0; I < NumPayloads; ++I) {
+    InstPoints.push_back(
+        llvm::BuildMI(*KernelMBB, KernelMBB->end(), llvm::DebugLoc(),
+                      TII.get(llvm::AMDGPU::V_MOV_B32_e32),
+                      llvm::AMDGPU::VGPR0 + I % 4)
+            .addImm(I));
+  }
+  // The live registers are read by the kernel right before it exits
+  for (unsigned I = 0; I < NumLiveVGPRs; ++I) {
+    KernelMBB->addLiveIn(llvm::AMDGPU::VGPR4 + I);
+    llvm::BuildMI(*KernelMBB, KernelMBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::V_MOV_B32_e32),
+                  llvm::AMDGPU::VGPR4 + I)
+        .addReg(llvm::AMDGPU::VGPR4 + I);
+  }
+  for (unsigned I = 0; I < NumLiveSGPRs; ++I) {
+    KernelMBB->addLiveIn(llvm::AMDGPU::SGPR8 + I);
+    llvm::BuildMI(*KernelMBB, KernelMBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_MOV_B32), llvm::AMDGPU::SGPR8 + I)
+        .addReg(llvm::AMDGPU::SGPR8 + I);
+  }
+  llvm::BuildMI(*KernelMBB, KernelMBB->end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_ENDPGM))
+      .addImm(0);
+
+  // Build the instrumentation module, where each injected payload records
+  // the index of its instrumentation point
+  auto IModule = std::make_unique<llvm::Module>("imodule", Ctx);
+  IModule->setTargetTriple(TT.normalize());
+  IModule->setDataLayout(TM->createDataLayout());
+  auto *Counter = new llvm::GlobalVariable(
+      *IModule, Int32Ty, false, llvm::GlobalValue::ExternalLinkage,
+      llvm::ConstantInt::get(Int32Ty, 0), "counter", nullptr,
+      llvm::GlobalValue::NotThreadLocal, 1);
+  if (Predicated) {
+    new llvm::GlobalVariable(
+        *IModule, Int32Ty, false, llvm::GlobalValue::ExternalLinkage,
+        llvm::ConstantInt::get(Int32Ty, ~0U), luthier::HookEnableMaskVar,
+        nullptr, llvm::GlobalValue::NotThreadLocal, 1);
+  }
+  llvm::Function *HookF{nullptr};
+  if (OutlinedHook) {
+    HookF = llvm::Function::Create(llvm::FunctionType::get(VoidTy, false),
+                                   llvm::GlobalValue::ExternalLinkage, "hook",
+                                   *IModule);
+    HookF->addFnAttr(luthier::OutlinedHookAttribute);
+    HookF->addFnAttr(llvm::Attribute::NoInline);
+    llvm::IRBuilder<> Builder(llvm::BasicBlock::Create(Ctx, "", HookF));
+    Builder.CreateStore(llvm::ConstantInt::get(Int32Ty, NumPayloads), Counter,
+                        true);
+    Builder.CreateRetVoid();
+  }
+  llvm::SmallVector<llvm::Function *> Payloads;
+  for (unsigned I = 0; I < NumPayloads; ++I) {
+    auto *PayloadF = llvm::Function::Create(
+        llvm::FunctionType::get(VoidTy, false),
+        llvm::GlobalValue::ExternalLinkage,
+        llvm::formatv("payload.{0}", I).str(), *IModule);
+    PayloadF->setCallingConv(llvm::CallingConv::C);
+    PayloadF->addFnAttr(llvm::Attribute::Naked);
+    PayloadF->addFnAttr(luthier::InjectedPayloadAttribute);
+    if (Predicated)
+      PayloadF->addFnAttr(luthier::HookEnableMaskAttribute, "1");
+    llvm::IRBuilder<> Builder(llvm::BasicBlock::Create(Ctx, "", PayloadF));
+    Builder.CreateStore(llvm::ConstantInt::get(Int32Ty, I), Counter, true);
+    if (HookF && I % 2 == 1)
+      Builder.CreateCall(HookF);
+    Builder.CreateRetVoid();
+    Payloads.push_back(PayloadF);
+  }
+
+  // Register the analyses of the instrumentation module the code gen
+  // pipeline expects to be already calculated by the IR pipeline
+  llvm::LoopAnalysisManager ILAM;
+  llvm::FunctionAnalysisManager IFAM;
+  llvm::CGSCCAnalysisManager ICGAM;
+  llvm::ModuleAnalysisManager IMAM;
+  llvm::ModulePassManager IPM;
+  llvm::ModuleAnalysisManager TargetMAM;
+  llvm::StringMap<luthier::IntrinsicProcessor> IntrinsicProcessors;
+
+  IMAM.registerPass([&]() { return llvm::PassInstrumentationAnalysis(); });
+  IMAM.registerPass(
+      [&]() { return luthier::InjectedPayloadAndInstPointAnalysis(); });
+  IMAM.registerPass(
+      [&]() { return luthier::IntrinsicIRLoweringInfoMapAnalysis(); });
+  IMAM.registerPass([&]() {
+    return luthier::IntrinsicsProcessorsAnalysis(IntrinsicProcessors);
+  });
+  IMAM.registerPass([&]() {
+    return luthier::TargetAppModuleAndMAMAnalysis(TargetMAM, TargetAppM);
+  });
+  IMAM.registerPass([&]() { return luthier::PhysRegsNotInLiveInsAnalysis(); });
+  auto &IPIP =
+      IMAM.getResult<luthier::InjectedPayloadAndInstPointAnalysis>(*IModule);
+  for (unsigned I = 0; I < NumPayloads; ++I)
+    IPIP.addEntry(*InstPoints[I], *Payloads[I]);
+  (void)IMAM.getResult<luthier::IntrinsicIRLoweringInfoMapAnalysis>(*IModule);
+  (void)IMAM.getResult<luthier::IntrinsicsProcessorsAnalysis>(*IModule);
+
+  TargetMAM.registerPass([&]() { return llvm::PassInstrumentationAnalysis(); });
+  TargetMAM.registerPass(
+      [&]() { return llvm::MachineModuleAnalysis(TargetMMI); });
+  TargetMAM.registerPass([&]() {
+    return luthier::IModulePMAnalysis(*IModule, IPM, IMAM, ILAM, IFAM, ICGAM);
+  });
+  TargetMAM.registerPass(
+      [&]() { return luthier::AMDGPURegLivenessAnalysis(); });
+  TargetMAM.registerPass([&]() { return luthier::LRCallGraphAnalysis(); });
+  TargetMAM.registerPass([&]() { return luthier::MMISlotIndexesAnalysis(); });
+  TargetMAM.registerPass([&]() {
+    return luthier::LRStateValueStorageAndLoadLocationsAnalysis();
+  });
+  TargetMAM.registerPass(
+      [&]() { return luthier::FunctionPreambleDescriptorAnalysis(); });
+  (void)TargetMAM.getResult<luthier::IModulePMAnalysis>(TargetAppM);
+
+  // Generate the machine code of the injected payloads
+  auto ILegacyPM = std::make_unique<llvm::legacy::PassManager>();
+  auto *IMMIWP = new llvm::MachineModuleInfoWrapperPass(TM.get());
+  auto Options = luthier::IModulePipelineOptions::getDefault();
+  luthier::IModuleCodeGenResult CodeGenResult;
+  llvm::ModulePassManager TargetMPM;
+  TargetMPM.addPass(luthier::RunMIRPassesOnIModulePass(
+      *TM, *IModule, *IMMIWP, *ILegacyPM, Options, CodeGenResult));
+  TargetMPM.run(TargetAppM, TargetMAM);
+
+  std::error_code EC;
+  auto OutFile = std::make_unique<llvm::ToolOutputFile>(OutputFilename, EC,
+                                                        llvm::sys::fs::OF_None);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !EC, llvm::formatv("Failed to open output file, error: {0}.",
+                         EC.message())));
+
+  if (PrintNumUnits)
+    OutFile->os() << "Number of code gen units: "
+                  << CodeGenResult.units().size() << "\n";
+
+  if (PrintLoadPlans) {
+    const auto &SVLocations = *TargetMAM.getCachedResult<
+        luthier::LRStateValueStorageAndLoadLocationsAnalysis>(TargetAppM);
+    for (const auto *InstPoint : InstPoints) {
+      const auto *Plan =
+          SVLocations.getStateValueArrayLoadPlanForInstPoint(*InstPoint);
+      LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+          Plan != nullptr,
+          llvm::formatv("Failed to find the load plan of injected payload "
+                        "{0}.",
+                        IPIP.at(*InstPoint)->getName())));
+      OutFile->os() << "load plan " << IPIP.at(*InstPoint)->getName()
+                    << ": loads SVA " << Plan->LoadsSVA << ", stores SVA "
+                    << Plan->StoresSVA << "\n";
+    }
+  }
+
+  // Print the injected payloads in program order, regardless of the unit
+  // they were generated in
+  for (const auto *InstPoint : InstPoints) {
+    llvm::StringRef PayloadName = IPIP.at(*InstPoint)->getName();
+    const llvm::MachineFunction *PayloadMF{nullptr};
+    for (const auto &Unit : CodeGenResult.units()) {
+      if (const auto *UnitF = Unit.IModule.getFunction(PayloadName)) {
+        if ((PayloadMF = Unit.IMMI.getMachineFunction(*UnitF)))
+          break;
+      }
+    }
+    LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+        PayloadMF != nullptr,
+        llvm::formatv("Failed to find the machine code of injected payload "
+                      "{0}.",
+                      PayloadName)));
+    PayloadMF->print(OutFile->os());
+  }
+
+  OutFile->keep();
+
+  return 0;
+}
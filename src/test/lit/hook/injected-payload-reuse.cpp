@@ -0,0 +1,266 @@
+//===-- injected-payload-reuse.cpp ----------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements injected-payload-reuse, an executable used to test
+/// which injected payloads are reused when re-instrumenting a kernel
+/// incrementally. It builds the MIR of a target kernel twice, once for the
+/// previous instrumentation and once for the current one, with a hook
+/// inserted before each instruction. It then computes the
+/// <tt>InjectedPayloadSignature</tt> of each instrumentation point in both,
+/// and prints whether the injected payload of each instrumentation point
+/// would be reused or regenerated. The command line options of the tool
+/// describe the delta between the two instrumentations.
+//===----------------------------------------------------------------------===//
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "luthier/Tooling/AMDGPURegisterLiveness.h"
+#include "luthier/Tooling/IModuleIRGeneratorPass.h"
+#include "luthier/Tooling/InstrumentationRecord.h"
+#include "luthier/Tooling/LRCallgraph.h"
+#include "luthier/Tooling/MMISlotIndexesAnalysis.h"
+#include "luthier/Tooling/PhysRegsNotInLiveInsAnalysis.h"
+#include "luthier/Tooling/PrePostAmbleEmitter.h"
+#include "luthier/Tooling/SVStorageAndLoadLocations.h"
+#include "luthier/Tooling/WrapperAnalysisPasses.h"
+#include "luthier/consts.h"
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/CodeGen/MachineModuleInfo.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <luthier/Common/ErrorCheck.h>
+#include <luthier/Common/GenericLuthierError.h>
+
+static llvm::cl::OptionCategory
+    InjectedPayloadReuseOptions("Injected Payload Reuse Options");
+
+static llvm::cl::opt<std::string>
+    CPU("mcpu", llvm::cl::desc("Target GPU to generate the machine code for"),
+        llvm::cl::init("gfx908"), llvm::cl::cat(InjectedPayloadReuseOptions));
+
+static llvm::cl::opt<unsigned> NumInstPoints(
+    "num-inst-points",
+    llvm::cl::desc("Number of instrumented instructions in the target kernel"),
+    llvm::cl::init(8), llvm::cl::cat(InjectedPayloadReuseOptions));
+
+static llvm::cl::list<unsigned> ChangeHookArgs(
+    "change-hook-args",
+    llvm::cl::desc("Instrumentation points whose hook is passed a different "
+                   "argument by the current instrumentation"),
+    llvm::cl::CommaSeparated, llvm::cl::cat(InjectedPayloadReuseOptions));
+
+static llvm::cl::list<unsigned> ChangeHooks(
+    "change-hooks",
+    llvm::cl::desc("Instrumentation points where the current instrumentation "
+                   "inserts a different hook"),
+    llvm::cl::CommaSeparated, llvm::cl::cat(InjectedPayloadReuseOptions));
+
+static llvm::cl::opt<int> ReadBackVGPR(
+    "read-back-vgpr",
+    llvm::cl::desc("VGPR read at the end of the kernel of the current "
+                   "instrumentation, changing its liveness; -1 for none"),
+    llvm::cl::init(-1), llvm::cl::cat(InjectedPayloadReuseOptions));
+
+static llvm::cl::opt<bool> LowerRegisterPressure(
+    "lower-register-pressure",
+    llvm::cl::desc("Generate the current instrumentation with pipeline "
+                   "options of lower register pressure"),
+    llvm::cl::init(false), llvm::cl::cat(InjectedPayloadReuseOptions));
+
+static llvm::cl::opt<unsigned> CodeGenThreads(
+    "current-codegen-threads",
+    llvm::cl::desc("Number of code gen threads of the current "
+                   "instrumentation; 0 to keep the previous one's"),
+    llvm::cl::init(0), llvm::cl::cat(InjectedPayloadReuseOptions));
+
+/// Builds the target kernel and the hooks of an instrumentation, and
+/// computes the signature of each of its instrumentation points
+/// \param TM the target machine of the target kernel
+/// \param Ctx the context the kernel and its instrumentation module are
+/// created in
+/// \param IsCurrent whether to apply the delta of the current instrumentation
+/// \return the signature of each instrumentation point, in program order
+static llvm::SmallVector<luthier::InjectedPayloadSignature>
+getSignatures(llvm::GCNTargetMachine &TM, llvm::LLVMContext &Ctx,
+              bool IsCurrent) {
+  auto *VoidTy = llvm::Type::getVoidTy(Ctx);
+  auto *Int32Ty = llvm::Type::getInt32Ty(Ctx);
+
+  llvm::Module TargetAppM("target-app", Ctx);
+  TargetAppM.setTargetTriple(TM.getTargetTriple().normalize());
+  TargetAppM.setDataLayout(TM.createDataLayout());
+  auto *KernelF = llvm::Function::Create(
+      llvm::FunctionType::get(VoidTy, false),
+      llvm::GlobalValue::ExternalLinkage, "kernel", TargetAppM);
+  KernelF->setCallingConv(llvm::CallingConv::AMDGPU_KERNEL);
+
+  llvm::MachineModuleInfo TargetMMI(&TM);
+  auto &KernelMF = TargetMMI.getOrCreateMachineFunction(*KernelF);
+  const auto &TII = *KernelMF.getSubtarget<llvm::GCNSubtarget>().getInstrInfo();
+  KernelMF.getProperties().set(
+      llvm::MachineFunctionProperties::Property::NoVRegs);
+  KernelMF.getRegInfo().freezeReservedRegs();
+  auto *KernelMBB = KernelMF.CreateMachineBasicBlock();
+  KernelMF.push_back(KernelMBB);
+  llvm::SmallVector<llvm::MachineInstr *> InstPoints;
+  for (unsigned I = 0; I < NumInstPoints; ++I) {
+    InstPoints.push_back(
+        llvm::BuildMI(*KernelMBB, KernelMBB->end(), llvm::DebugLoc(),
+                      TII.get(llvm::AMDGPU::V_MOV_B32_e32),
+                      llvm::AMDGPU::VGPR0 + I % 4)
+            .addImm(I));
+  }
+  if (IsCurrent && ReadBackVGPR >= 0) {
+    llvm::BuildMI(*KernelMBB, KernelMBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::V_MOV_B32_e32),
+                  llvm::AMDGPU::VGPR0 + ReadBackVGPR)
+        .addReg(llvm::AMDGPU::VGPR0 + ReadBackVGPR);
+  }
+  llvm::BuildMI(*KernelMBB, KernelMBB->end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_ENDPGM))
+      .addImm(0);
+
+  // Hooks inserted before each instrumentation point; The argument of each
+  // hook is the index of its instrumentation point
+  llvm::SmallVector<luthier::InstrumentationTask::hook_invocation_descriptor>
+      Hooks;
+  for (unsigned I = 0; I < NumInstPoints; ++I) {
+    bool ChangeHook = IsCurrent && llvm::is_contained(ChangeHooks, I);
+    bool ChangeArg = IsCurrent && llvm::is_contained(ChangeHookArgs, I);
+    Hooks.push_back(
+        {ChangeHook ? "other_hook" : "hook",
+         {llvm::ConstantInt::get(Int32Ty, ChangeArg ? I + 100 : I)}});
+  }
+
+  auto IModule = std::make_unique<llvm::Module>("imodule", Ctx);
+  IModule->setTargetTriple(TM.getTargetTriple().normalize());
+  IModule->setDataLayout(TM.createDataLayout());
+  llvm::SmallVector<llvm::Function *> Payloads;
+  for (unsigned I = 0; I < NumInstPoints; ++I) {
+    auto *PayloadF = llvm::Function::Create(
+        llvm::FunctionType::get(VoidTy, false),
+        llvm::GlobalValue::ExternalLinkage,
+        llvm::formatv("payload.{0}", I).str(), *IModule);
+    PayloadF->setCallingConv(llvm::CallingConv::C);
+    PayloadF->addFnAttr(llvm::Attribute::Naked);
+    PayloadF->addFnAttr(luthier::InjectedPayloadAttribute);
+    llvm::IRBuilder<> Builder(llvm::BasicBlock::Create(Ctx, "", PayloadF));
+    Builder.CreateRetVoid();
+    Payloads.push_back(PayloadF);
+  }
+
+  llvm::LoopAnalysisManager ILAM;
+  llvm::FunctionAnalysisManager IFAM;
+  llvm::CGSCCAnalysisManager ICGAM;
+  llvm::ModuleAnalysisManager IMAM;
+  llvm::ModulePassManager IPM;
+  llvm::ModuleAnalysisManager TargetMAM;
+  llvm::StringMap<luthier::IntrinsicProcessor> IntrinsicProcessors;
+
+  IMAM.registerPass([&]() { return llvm::PassInstrumentationAnalysis(); });
+  IMAM.registerPass(
+      [&]() { return luthier::InjectedPayloadAndInstPointAnalysis(); });
+  IMAM.registerPass(
+      [&]() { return luthier::IntrinsicIRLoweringInfoMapAnalysis(); });
+  IMAM.registerPass([&]() {
+    return luthier::IntrinsicsProcessorsAnalysis(IntrinsicProcessors);
+  });
+  IMAM.registerPass([&]() {
+    return luthier::TargetAppModuleAndMAMAnalysis(TargetMAM, TargetAppM);
+  });
+  IMAM.registerPass([&]() { return luthier::PhysRegsNotInLiveInsAnalysis(); });
+  auto &IPIP =
+      IMAM.getResult<luthier::InjectedPayloadAndInstPointAnalysis>(*IModule);
+  for (unsigned I = 0; I < NumInstPoints; ++I)
+    IPIP.addEntry(*InstPoints[I], *Payloads[I]);
+  (void)IMAM.getResult<luthier::IntrinsicIRLoweringInfoMapAnalysis>(*IModule);
+  (void)IMAM.getResult<luthier::IntrinsicsProcessorsAnalysis>(*IModule);
+
+  TargetMAM.registerPass([&]() { return llvm::PassInstrumentationAnalysis(); });
+  TargetMAM.registerPass(
+      [&]() { return llvm::MachineModuleAnalysis(TargetMMI); });
+  TargetMAM.registerPass([&]() {
+    return luthier::IModulePMAnalysis(*IModule, IPM, IMAM, ILAM, IFAM, ICGAM);
+  });
+  TargetMAM.registerPass(
+      [&]() { return luthier::AMDGPURegLivenessAnalysis(); });
+  TargetMAM.registerPass([&]() { return luthier::LRCallGraphAnalysis(); });
+  TargetMAM.registerPass([&]() { return luthier::MMISlotIndexesAnalysis(); });
+  TargetMAM.registerPass([&]() {
+    return luthier::LRStateValueStorageAndLoadLocationsAnalysis();
+  });
+  TargetMAM.registerPass(
+      [&]() { return luthier::FunctionPreambleDescriptorAnalysis(); });
+
+  const auto &RegLiveness =
+      TargetMAM.getResult<luthier::AMDGPURegLivenessAnalysis>(TargetAppM);
+  const auto &SVLocations =
+      TargetMAM.getResult<luthier::LRStateValueStorageAndLoadLocationsAnalysis>(
+          TargetAppM);
+
+  llvm::SmallVector<luthier::InjectedPayloadSignature> Out;
+  for (unsigned I = 0; I < NumInstPoints; ++I)
+    Out.push_back(luthier::InjectedPayloadSignature::get(
+        *InstPoints[I], Hooks[I], RegLiveness, SVLocations));
+  return Out;
+}
+
+int main(int Argc, char *Argv[]) {
+  llvm::InitLLVM X(Argc, Argv);
+
+  llvm::cl::ParseCommandLineOptions(Argc, Argv,
+                                    "Luthier injected payload reuse tool\n");
+
+  LLVMInitializeAMDGPUTarget();
+  LLVMInitializeAMDGPUTargetInfo();
+  LLVMInitializeAMDGPUTargetMC();
+
+  llvm::Triple TT("amdgcn-amd-amdhsa");
+  std::string Error;
+  auto *Target = llvm::TargetRegistry::lookupTarget(TT.normalize(), Error);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Target != nullptr,
+      llvm::formatv("Failed to get target {0} from LLVM, error: {1}.",
+                    TT.normalize(), Error)));
+  std::unique_ptr<llvm::GCNTargetMachine> TM(
+      reinterpret_cast<llvm::GCNTargetMachine *>(Target->createTargetMachine(
+          TT.normalize(), CPU, "", llvm::TargetOptions(), llvm::Reloc::PIC_)));
+
+  llvm::LLVMContext Ctx;
+  auto PreviousSignatures = getSignatures(*TM, Ctx, false);
+  auto CurrentSignatures = getSignatures(*TM, Ctx, true);
+
+  auto PreviousOptions = luthier::IModulePipelineOptions::getDefault();
+  auto CurrentOptions = LowerRegisterPressure
+                            ? PreviousOptions.withLowerRegisterPressure()
+                            : PreviousOptions;
+  if (CodeGenThreads != 0)
+    CurrentOptions.CodeGenThreads = CodeGenThreads;
+  bool SameCode = PreviousOptions.producesSameCodeAs(CurrentOptions);
+
+  for (unsigned I = 0; I < NumInstPoints; ++I) {
+    bool Reused = SameCode && PreviousSignatures[I] == CurrentSignatures[I];
+    llvm::outs() << llvm::formatv("inst point {0}: {1}\n", I,
+                                  Reused ? "reused" : "regenerated");
+  }
+  return 0;
+}
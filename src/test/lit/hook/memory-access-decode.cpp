@@ -0,0 +1,248 @@
+//===-- memory-access-decode.cpp ------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements memory-access-decode, an executable used to test
+/// memory access decoding offline. It builds FLAT, GLOBAL, SCRATCH, buffer
+/// and DS instructions of different widths and addressing modes, decodes
+/// the accesses of each, and prints the arguments passed to memory access
+/// hooks.
+//===----------------------------------------------------------------------===//
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "SIMachineFunctionInfo.h"
+#include "luthier/Tooling/MemoryAccess.h"
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/CodeGen/MachineModuleInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <luthier/Common/ErrorCheck.h>
+#include <luthier/Common/GenericLuthierError.h>
+
+static llvm::cl::OptionCategory
+    MemoryAccessDecodeOptions("Memory Access Decode Options");
+
+static llvm::cl::opt<std::string>
+    CPU("mcpu", llvm::cl::desc("Target GPU to decode the instructions for"),
+        llvm::cl::init("gfx908"), llvm::cl::cat(MemoryAccessDecodeOptions));
+
+static llvm::cl::opt<std::string>
+    OutputFilename("o", llvm::cl::desc("Output filename"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init("-"),
+                   llvm::cl::cat(MemoryAccessDecodeOptions));
+
+static llvm::StringRef getModeName(luthier::MemoryAddressingMode Mode) {
+  switch (Mode) {
+  case luthier::MEM_ADDR_FLAT:
+    return "flat";
+  case luthier::MEM_ADDR_GLOBAL_SADDR:
+    return "global-saddr";
+  case luthier::MEM_ADDR_SCRATCH:
+    return "scratch";
+  case luthier::MEM_ADDR_BUFFER:
+    return "buffer";
+  case luthier::MEM_ADDR_BUFFER_OFFEN:
+    return "buffer-offen";
+  case luthier::MEM_ADDR_BUFFER_IDXEN:
+    return "buffer-idxen";
+  case luthier::MEM_ADDR_BUFFER_BOTHEN:
+    return "buffer-bothen";
+  case luthier::MEM_ADDR_LDS:
+    return "lds";
+  }
+  return "invalid";
+}
+
+int main(int Argc, char *Argv[]) {
+  llvm::InitLLVM X(Argc, Argv);
+
+  llvm::cl::ParseCommandLineOptions(Argc, Argv,
+                                    "Luthier memory access decoding tool\n");
+
+  LLVMInitializeAMDGPUTarget();
+  LLVMInitializeAMDGPUTargetInfo();
+  LLVMInitializeAMDGPUTargetMC();
+
+  llvm::Triple TT("amdgcn-amd-amdhsa");
+  std::string Error;
+  auto *Target = llvm::TargetRegistry::lookupTarget(TT.normalize(), Error);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Target != nullptr,
+      llvm::formatv("Failed to get target {0} from LLVM, error: {1}.",
+                    TT.normalize(), Error)));
+  std::unique_ptr<llvm::GCNTargetMachine> TM(
+      reinterpret_cast<llvm::GCNTargetMachine *>(Target->createTargetMachine(
+          TT.normalize(), CPU, "", llvm::TargetOptions(), llvm::Reloc::PIC_)));
+
+  llvm::LLVMContext Ctx;
+  llvm::Module M("memory-access-decode", Ctx);
+  M.setTargetTriple(TT.normalize());
+  M.setDataLayout(TM->createDataLayout());
+  auto *F = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), false),
+      llvm::GlobalValue::ExternalLinkage, "kernel", M);
+  F->setCallingConv(llvm::CallingConv::AMDGPU_KERNEL);
+
+  llvm::MachineModuleInfo MMI(TM.get());
+  auto &MF = MMI.getOrCreateMachineFunction(*F);
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  const auto &TRI = *ST.getRegisterInfo();
+  MF.getProperties().set(llvm::MachineFunctionProperties::Property::NoVRegs);
+
+  // The private segment buffer is preloaded into s[0:3]
+  MF.getInfo<llvm::SIMachineFunctionInfo>()->addPrivateSegmentBuffer(TRI);
+
+  auto *MBB = MF.CreateMachineBasicBlock();
+  MF.push_back(MBB);
+
+  // Instructions are built with their address and data operands only; Their
+  // remaining operands (e.g. cache policy and gds bits) are zero
+  auto Build = [&](unsigned Opcode) {
+    return llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(), TII.get(Opcode));
+  };
+  auto BuildLoad = [&](unsigned Opcode, llvm::MCRegister Dst) {
+    return llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(), TII.get(Opcode),
+                         Dst);
+  };
+  auto Finish = [](llvm::MachineInstrBuilder MIB) {
+    while (MIB->getNumOperands() < MIB->getDesc().getNumOperands())
+      MIB.addImm(0);
+  };
+
+  // FLAT, GLOBAL and SCRATCH
+  Finish(BuildLoad(llvm::AMDGPU::GLOBAL_LOAD_UBYTE, llvm::AMDGPU::VGPR0)
+             .addReg(llvm::AMDGPU::VGPR2_VGPR3)
+             .addImm(-16));
+  Finish(BuildLoad(llvm::AMDGPU::GLOBAL_LOAD_DWORDX4_SADDR,
+                   llvm::AMDGPU::VGPR4_VGPR5_VGPR6_VGPR7)
+             .addReg(llvm::AMDGPU::SGPR4_SGPR5)
+             .addReg(llvm::AMDGPU::VGPR1)
+             .addImm(32));
+  Finish(Build(llvm::AMDGPU::GLOBAL_ATOMIC_CMPSWAP)
+             .addReg(llvm::AMDGPU::VGPR2_VGPR3)
+             .addReg(llvm::AMDGPU::VGPR4_VGPR5)
+             .addImm(0));
+  Finish(Build(llvm::AMDGPU::FLAT_STORE_SHORT)
+             .addReg(llvm::AMDGPU::VGPR2_VGPR3)
+             .addReg(llvm::AMDGPU::VGPR0)
+             .addImm(8));
+  Finish(BuildLoad(llvm::AMDGPU::FLAT_LOAD_DWORDX2, llvm::AMDGPU::VGPR4_VGPR5)
+             .addReg(llvm::AMDGPU::VGPR2_VGPR3)
+             .addImm(0));
+  Finish(BuildLoad(llvm::AMDGPU::SCRATCH_LOAD_DWORD_SADDR, llvm::AMDGPU::VGPR0)
+             .addReg(llvm::AMDGPU::SGPR6)
+             .addImm(4));
+  Finish(Build(llvm::AMDGPU::SCRATCH_STORE_BYTE)
+             .addReg(llvm::AMDGPU::VGPR1)
+             .addReg(llvm::AMDGPU::VGPR0)
+             .addImm(-8));
+
+  // Buffer
+  Finish(BuildLoad(llvm::AMDGPU::BUFFER_LOAD_DWORD_OFFEN, llvm::AMDGPU::VGPR0)
+             .addReg(llvm::AMDGPU::VGPR1)
+             .addReg(llvm::AMDGPU::SGPR8_SGPR9_SGPR10_SGPR11)
+             .addReg(llvm::AMDGPU::SGPR12)
+             .addImm(16));
+  Finish(BuildLoad(llvm::AMDGPU::BUFFER_LOAD_UBYTE_IDXEN, llvm::AMDGPU::VGPR0)
+             .addReg(llvm::AMDGPU::VGPR1)
+             .addReg(llvm::AMDGPU::SGPR8_SGPR9_SGPR10_SGPR11)
+             .addImm(0)
+             .addImm(4));
+  Finish(Build(llvm::AMDGPU::BUFFER_STORE_SHORT_BOTHEN)
+             .addReg(llvm::AMDGPU::VGPR0)
+             .addReg(llvm::AMDGPU::VGPR2_VGPR3)
+             .addReg(llvm::AMDGPU::SGPR8_SGPR9_SGPR10_SGPR11)
+             .addReg(llvm::AMDGPU::SGPR12)
+             .addImm(0));
+  Finish(Build(llvm::AMDGPU::BUFFER_ATOMIC_CMPSWAP_OFFSET)
+             .addReg(llvm::AMDGPU::VGPR0_VGPR1)
+             .addReg(llvm::AMDGPU::SGPR8_SGPR9_SGPR10_SGPR11)
+             .addImm(0)
+             .addImm(4));
+  Finish(BuildLoad(llvm::AMDGPU::BUFFER_LOAD_DWORD_ADDR64, llvm::AMDGPU::VGPR0)
+             .addReg(llvm::AMDGPU::VGPR2_VGPR3)
+             .addReg(llvm::AMDGPU::SGPR8_SGPR9_SGPR10_SGPR11)
+             .addImm(0)
+             .addImm(0));
+  Finish(Build(llvm::AMDGPU::BUFFER_STORE_DWORD_OFFEN)
+             .addReg(llvm::AMDGPU::VGPR0)
+             .addReg(llvm::AMDGPU::VGPR1)
+             .addReg(llvm::AMDGPU::SGPR0_SGPR1_SGPR2_SGPR3)
+             .addReg(llvm::AMDGPU::SGPR33)
+             .addImm(4));
+
+  // DS
+  Finish(BuildLoad(llvm::AMDGPU::DS_READ_U16_gfx9, llvm::AMDGPU::VGPR0)
+             .addReg(llvm::AMDGPU::VGPR4)
+             .addImm(6));
+  Finish(Build(llvm::AMDGPU::DS_WRITE2_B32_gfx9)
+             .addReg(llvm::AMDGPU::VGPR4)
+             .addReg(llvm::AMDGPU::VGPR0)
+             .addReg(llvm::AMDGPU::VGPR1)
+             .addImm(3)
+             .addImm(5));
+  Finish(BuildLoad(llvm::AMDGPU::DS_READ2ST64_B64_gfx9,
+                   llvm::AMDGPU::VGPR0_VGPR1_VGPR2_VGPR3)
+             .addReg(llvm::AMDGPU::VGPR4)
+             .addImm(1)
+             .addImm(2));
+
+  std::error_code EC;
+  auto OutFile = std::make_unique<llvm::ToolOutputFile>(OutputFilename, EC,
+                                                        llvm::sys::fs::OF_None);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !EC, llvm::formatv("Failed to open output file, error: {0}.",
+                         EC.message())));
+  auto &OS = OutFile->os();
+  for (const llvm::MachineInstr &MI : *MBB) {
+    OS << TII.getName(MI.getOpcode()) << ":";
+    auto AccessesOrErr = luthier::decodeMemoryAccesses(MI);
+    // Only the failure is printed, as the error message carries the
+    // location it was created at
+    if (auto Err = AccessesOrErr.takeError()) {
+      llvm::consumeError(std::move(Err));
+      OS << " unsupported\n";
+      continue;
+    }
+    for (const luthier::MemoryAccess &Access : *AccessesOrErr) {
+      OS << " {mode=" << getModeName(Access.Mode)
+         << " vaddr=" << llvm::printReg(Access.VAddr[0].id(), &TRI) << ","
+         << llvm::printReg(Access.VAddr[1].id(), &TRI)
+         << " sbase=" << llvm::printReg(Access.SBase[0].id(), &TRI) << ","
+         << llvm::printReg(Access.SBase[1].id(), &TRI) << " soffset=";
+      if (std::holds_alternative<llvm::MCRegister>(Access.SOffset))
+        OS << llvm::printReg(std::get<llvm::MCRegister>(Access.SOffset).id(),
+                             &TRI);
+      else
+        OS << std::get<uint32_t>(Access.SOffset);
+      OS << " offset=" << Access.Offset << " size=" << Access.Size << "}";
+    }
+    OS << "\n";
+  }
+
+  OutFile->keep();
+
+  return 0;
+}
@@ -0,0 +1,267 @@
+//===-- outlined-hook-save-set.cpp ----------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements outlined-hook-save-set, an executable used to test
+/// the calling convention of outlined hooks offline. It builds the MIR of an
+/// outlined hook which defines the requested registers, and an injected
+/// payload which calls it with the requested registers live across the call.
+/// It then applies the calling convention to the call, verifies the payload,
+/// and prints the save set of the call, the stack size reserved for the
+/// outlined hook calls of the payload, and the payload.
+//===----------------------------------------------------------------------===//
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "luthier/Tooling/OutlinedHookCallingConvPass.h"
+#include "luthier/consts.h"
+#include <llvm/CodeGen/MachineFrameInfo.h>
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/CodeGen/MachineModuleInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <luthier/Common/ErrorCheck.h>
+#include <luthier/Common/GenericLuthierError.h>
+
+static llvm::cl::OptionCategory
+    OutlinedHookSaveSetOptions("Outlined Hook Save Set Options");
+
+static llvm::cl::opt<std::string>
+    CPU("mcpu", llvm::cl::desc("Target GPU to emit the MIR for"),
+        llvm::cl::init("gfx908"), llvm::cl::cat(OutlinedHookSaveSetOptions));
+
+static llvm::cl::list<std::string>
+    HookDefs("hook-defs",
+             llvm::cl::desc("32-bit registers defined by the outlined hook"),
+             llvm::cl::CommaSeparated,
+             llvm::cl::cat(OutlinedHookSaveSetOptions));
+
+static llvm::cl::list<std::string> HookCalleeSaved(
+    "hook-callee-saved",
+    llvm::cl::desc("Registers saved and restored by the outlined hook's "
+                   "prologue and epilogue"),
+    llvm::cl::CommaSeparated, llvm::cl::cat(OutlinedHookSaveSetOptions));
+
+static llvm::cl::opt<bool> HookMakesCall(
+    "hook-makes-call",
+    llvm::cl::desc("Whether the outlined hook calls a device function with "
+                   "the default calling convention"),
+    llvm::cl::init(false), llvm::cl::cat(OutlinedHookSaveSetOptions));
+
+static llvm::cl::opt<unsigned>
+    HookStackSize("hook-stack-size",
+                  llvm::cl::desc("Size of the outlined hook's own frame"),
+                  llvm::cl::init(0), llvm::cl::cat(OutlinedHookSaveSetOptions));
+
+static llvm::cl::opt<unsigned> DeviceFunctionStackSize(
+    "device-function-stack-size",
+    llvm::cl::desc("Size of the frame of the device function called by the "
+                   "outlined hook; If not given, the device function has no "
+                   "machine code"),
+    llvm::cl::cat(OutlinedHookSaveSetOptions));
+
+static llvm::cl::list<std::string> LiveAcrossCall(
+    "live-across-call",
+    llvm::cl::desc("Registers live across the call to the outlined hook "
+                   "inside the injected payload"),
+    llvm::cl::CommaSeparated, llvm::cl::cat(OutlinedHookSaveSetOptions));
+
+static llvm::cl::opt<std::string>
+    OutputFilename("o", llvm::cl::desc("Output filename"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init("-"),
+                   llvm::cl::cat(OutlinedHookSaveSetOptions));
+
+/// \return the physical register named \p Name (e.g. "v0" or "s4")
+static llvm::Expected<llvm::MCRegister>
+parseReg(llvm::StringRef Name, const llvm::TargetRegisterInfo &TRI) {
+  std::string TableGenName = Name.upper();
+  if (Name.starts_with("v"))
+    TableGenName = "VGPR" + Name.substr(1).str();
+  else if (Name.starts_with("s"))
+    TableGenName = "SGPR" + Name.substr(1).str();
+  for (unsigned Reg = 1; Reg < TRI.getNumRegs(); ++Reg) {
+    if (TableGenName == TRI.getName(Reg))
+      return Reg;
+  }
+  return LUTHIER_MAKE_GENERIC_ERROR(
+      llvm::formatv("Unknown physical register {0}.", Name));
+}
+
+/// Builds an instruction defining the 32-bit register \p Reg before \p I
+static llvm::Error buildDef(llvm::MachineBasicBlock &MBB,
+                            llvm::MachineBasicBlock::iterator I,
+                            llvm::MCRegister Reg,
+                            const llvm::SIInstrInfo &TII) {
+  if (llvm::AMDGPU::VGPR_32RegClass.contains(Reg)) {
+    llvm::BuildMI(MBB, I, llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::V_MOV_B32_e32), Reg)
+        .addImm(0);
+  } else if (llvm::AMDGPU::SGPR_32RegClass.contains(Reg)) {
+    llvm::BuildMI(MBB, I, llvm::DebugLoc(), TII.get(llvm::AMDGPU::S_MOV_B32),
+                  Reg)
+        .addImm(0);
+  } else {
+    return LUTHIER_MAKE_GENERIC_ERROR(
+        "Only 32-bit SGPRs and VGPRs can be defined by the hook.");
+  }
+  return llvm::Error::success();
+}
+
+/// Builds a call to \p Callee at the end of \p MBB, with the return address
+/// in s[30:31] and the callee address in s[16:17]
+static llvm::MachineInstr &buildCall(llvm::MachineBasicBlock &MBB,
+                                     llvm::Function &Callee,
+                                     const llvm::SIInstrInfo &TII,
+                                     const llvm::SIRegisterInfo &TRI) {
+  auto &MF = *MBB.getParent();
+  MBB.addLiveIn(llvm::AMDGPU::SGPR16_SGPR17);
+  return *llvm::BuildMI(MBB, MBB.end(), llvm::DebugLoc(),
+                        TII.get(llvm::AMDGPU::SI_CALL),
+                        llvm::AMDGPU::SGPR30_SGPR31)
+              .addReg(llvm::AMDGPU::SGPR16_SGPR17)
+              .addGlobalAddress(&Callee)
+              .addRegMask(TRI.getCallPreservedMask(MF, llvm::CallingConv::C))
+              .getInstr();
+}
+
+int main(int Argc, char *Argv[]) {
+  llvm::InitLLVM X(Argc, Argv);
+
+  llvm::cl::ParseCommandLineOptions(
+      Argc, Argv, "Luthier outlined hook save set tool\n");
+
+  LLVMInitializeAMDGPUTarget();
+  LLVMInitializeAMDGPUTargetInfo();
+  LLVMInitializeAMDGPUTargetMC();
+
+  llvm::Triple TT("amdgcn-amd-amdhsa");
+  std::string Error;
+  auto *Target = llvm::TargetRegistry::lookupTarget(TT.normalize(), Error);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Target != nullptr,
+      llvm::formatv("Failed to get target {0} from LLVM, error: {1}.",
+                    TT.normalize(), Error)));
+  std::unique_ptr<llvm::GCNTargetMachine> TM(
+      reinterpret_cast<llvm::GCNTargetMachine *>(Target->createTargetMachine(
+          TT.normalize(), CPU, "", llvm::TargetOptions(), llvm::Reloc::PIC_)));
+
+  llvm::LLVMContext Ctx;
+  llvm::Module M("outlined-hook-save-set", Ctx);
+  M.setTargetTriple(TT.normalize());
+  M.setDataLayout(TM->createDataLayout());
+  auto *FuncTy = llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), false);
+  auto *HookF = llvm::Function::Create(
+      FuncTy, llvm::GlobalValue::ExternalLinkage, "hook", M);
+  HookF->addFnAttr(luthier::OutlinedHookAttribute);
+  auto *DeviceF = llvm::Function::Create(
+      FuncTy, llvm::GlobalValue::ExternalLinkage, "device_function", M);
+  auto *PayloadF = llvm::Function::Create(
+      FuncTy, llvm::GlobalValue::ExternalLinkage, "payload", M);
+  PayloadF->addFnAttr(luthier::InjectedPayloadAttribute);
+
+  llvm::MachineModuleInfo MMI(TM.get());
+
+  // Build the outlined hook, after its prologue/epilogue has been inserted
+  auto &HookMF = MMI.getOrCreateMachineFunction(*HookF);
+  const auto &ST = HookMF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  const auto &TRI = *ST.getRegisterInfo();
+  HookMF.getProperties().set(
+      llvm::MachineFunctionProperties::Property::NoVRegs);
+  auto *HookMBB = HookMF.CreateMachineBasicBlock();
+  HookMF.push_back(HookMBB);
+  HookMBB->addLiveIn(llvm::AMDGPU::SGPR30_SGPR31);
+  for (const auto &Name : HookDefs) {
+    auto Reg = parseReg(Name, TRI);
+    LUTHIER_REPORT_FATAL_ON_ERROR(Reg.takeError());
+    LUTHIER_REPORT_FATAL_ON_ERROR(
+        buildDef(*HookMBB, HookMBB->end(), *Reg, TII));
+  }
+  if (HookMakesCall)
+    (void)buildCall(*HookMBB, *DeviceF, TII, TRI);
+  llvm::BuildMI(*HookMBB, HookMBB->end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_SETPC_B64_return))
+      .addReg(llvm::AMDGPU::SGPR30_SGPR31);
+  std::vector<llvm::CalleeSavedInfo> CSI;
+  for (const auto &Name : HookCalleeSaved) {
+    auto Reg = parseReg(Name, TRI);
+    LUTHIER_REPORT_FATAL_ON_ERROR(Reg.takeError());
+    CSI.emplace_back(*Reg);
+  }
+  HookMF.getFrameInfo().setCalleeSavedInfo(CSI);
+  HookMF.getFrameInfo().setCalleeSavedInfoValid(true);
+  HookMF.getFrameInfo().setStackSize(HookStackSize);
+
+  // Build the device function called by the hook if its machine code is
+  // available
+  if (DeviceFunctionStackSize.getNumOccurrences()) {
+    auto &DeviceMF = MMI.getOrCreateMachineFunction(*DeviceF);
+    auto *DeviceMBB = DeviceMF.CreateMachineBasicBlock();
+    DeviceMF.push_back(DeviceMBB);
+    DeviceMBB->addLiveIn(llvm::AMDGPU::SGPR30_SGPR31);
+    llvm::BuildMI(*DeviceMBB, DeviceMBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_SETPC_B64_return))
+        .addReg(llvm::AMDGPU::SGPR30_SGPR31);
+    DeviceMF.getFrameInfo().setStackSize(DeviceFunctionStackSize);
+  }
+
+  // Build the injected payload, before register allocation
+  auto &PayloadMF = MMI.getOrCreateMachineFunction(*PayloadF);
+  auto *PayloadMBB = PayloadMF.CreateMachineBasicBlock();
+  PayloadMF.push_back(PayloadMBB);
+  auto &CallMI = buildCall(*PayloadMBB, *HookF, TII, TRI);
+  auto Return = llvm::BuildMI(*PayloadMBB, PayloadMBB->end(), llvm::DebugLoc(),
+                              TII.get(llvm::AMDGPU::SI_RETURN));
+  for (const auto &Name : LiveAcrossCall) {
+    auto Reg = parseReg(Name, TRI);
+    LUTHIER_REPORT_FATAL_ON_ERROR(Reg.takeError());
+    PayloadMBB->addLiveIn(*Reg);
+    Return.addReg(*Reg, llvm::RegState::Implicit);
+  }
+
+  auto SaveSet = luthier::emitOutlinedHookCallSaves(
+      CallMI, luthier::getOutlinedHookClobberedRegs(HookMF));
+  LUTHIER_REPORT_FATAL_ON_ERROR(SaveSet.takeError());
+
+  PayloadMF.verify(nullptr, "After applying the outlined hook calling "
+                            "convention");
+
+  std::error_code EC;
+  auto OutFile = std::make_unique<llvm::ToolOutputFile>(OutputFilename, EC,
+                                                        llvm::sys::fs::OF_None);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !EC, llvm::formatv("Failed to open output file, error: {0}.",
+                         EC.message())));
+  OutFile->os() << "Save set:";
+  for (llvm::MCRegister Reg : *SaveSet)
+    OutFile->os() << " " << llvm::printReg(Reg, &TRI);
+  OutFile->os() << "\n";
+  OutFile->os() << "Outlined hooks stack size: "
+                << luthier::getOutlinedHookCallsStackSize(PayloadMF, MMI)
+                << "\n";
+  PayloadMF.print(OutFile->os());
+
+  OutFile->keep();
+
+  return 0;
+}
@@ -0,0 +1,199 @@
+//===-- payload-outlining-mir-emit.cpp ------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements payload-outlining-mir-emit, an executable used to
+/// test the outlining of injected payloads offline. It builds a kernel with
+/// SCC live at its instrumentation point and an injected payload of the
+/// requested size, plans the patching of the payload with outlining forced,
+/// outlines it using either short jumps or long jumps depending on the plan,
+/// verifies the kernel, and prints it.
+//===----------------------------------------------------------------------===//
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "luthier/Tooling/PatchLayout.h"
+#include "luthier/Tooling/PayloadOutlining.h"
+#include "luthier/consts.h"
+#include <llvm/CodeGen/LivePhysRegs.h>
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/CodeGen/MachineModuleInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <luthier/Common/ErrorCheck.h>
+#include <luthier/Common/GenericLuthierError.h>
+
+static llvm::cl::OptionCategory
+    PayloadOutliningMIREmitOptions("Payload Outlining MIR Emit Options");
+
+static llvm::cl::opt<std::string>
+    CPU("mcpu", llvm::cl::desc("Target GPU to emit the MIR for"),
+        llvm::cl::init("gfx908"),
+        llvm::cl::cat(PayloadOutliningMIREmitOptions));
+
+static llvm::cl::opt<unsigned>
+    PayloadNops("payload-nops",
+                llvm::cl::desc("Number of s_nop instructions in the body of "
+                               "the injected payload"),
+                llvm::cl::init(16),
+                llvm::cl::cat(PayloadOutliningMIREmitOptions));
+
+static llvm::cl::opt<std::string>
+    OutputFilename("o", llvm::cl::desc("Output filename"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init("-"),
+                   llvm::cl::cat(PayloadOutliningMIREmitOptions));
+
+int main(int Argc, char *Argv[]) {
+  llvm::InitLLVM X(Argc, Argv);
+
+  llvm::cl::ParseCommandLineOptions(
+      Argc, Argv, "Luthier injected payload outlining MIR emission tool\n");
+
+  LLVMInitializeAMDGPUTarget();
+  LLVMInitializeAMDGPUTargetInfo();
+  LLVMInitializeAMDGPUTargetMC();
+
+  llvm::Triple TT("amdgcn-amd-amdhsa");
+  std::string Error;
+  auto *Target = llvm::TargetRegistry::lookupTarget(TT.normalize(), Error);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Target != nullptr,
+      llvm::formatv("Failed to get target {0} from LLVM, error: {1}.",
+                    TT.normalize(), Error)));
+  std::unique_ptr<llvm::GCNTargetMachine> TM(
+      reinterpret_cast<llvm::GCNTargetMachine *>(Target->createTargetMachine(
+          TT.normalize(), CPU, "", llvm::TargetOptions(), llvm::Reloc::PIC_)));
+
+  llvm::LLVMContext Ctx;
+  llvm::Module M("payload-outlining-mir-emit", Ctx);
+  M.setTargetTriple(TT.normalize());
+  M.setDataLayout(TM->createDataLayout());
+  auto *FuncTy = llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), false);
+  auto *KernelF = llvm::Function::Create(
+      FuncTy, llvm::GlobalValue::ExternalLinkage, "kernel", M);
+  KernelF->setCallingConv(llvm::CallingConv::AMDGPU_KERNEL);
+  auto *PayloadF = llvm::Function::Create(
+      FuncTy, llvm::GlobalValue::ExternalLinkage, "payload", M);
+  PayloadF->addFnAttr(luthier::InjectedPayloadAttribute);
+
+  llvm::MachineModuleInfo MMI(TM.get());
+
+  // Build the kernel; SCC is defined right before the instrumentation point,
+  // and read right after it
+  auto &MF = MMI.getOrCreateMachineFunction(*KernelF);
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  const auto &TRI = *ST.getRegisterInfo();
+  MF.getProperties().set(llvm::MachineFunctionProperties::Property::NoVRegs);
+  MF.getRegInfo().freezeReservedRegs();
+  auto *MBB = MF.CreateMachineBasicBlock();
+  MF.push_back(MBB);
+  MBB->addLiveIn(llvm::AMDGPU::SGPR0);
+  MBB->addLiveIn(llvm::AMDGPU::SGPR1);
+  llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_CMP_EQ_U32))
+      .addReg(llvm::AMDGPU::SGPR0)
+      .addReg(llvm::AMDGPU::SGPR1);
+  llvm::MachineInstr &InstPoint =
+      *llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                     TII.get(llvm::AMDGPU::S_NOP))
+           .addImm(0)
+           .getInstr();
+  llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_CSELECT_B32), llvm::AMDGPU::SGPR2)
+      .addImm(1)
+      .addImm(0);
+  llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_ENDPGM))
+      .addImm(0);
+
+  // Build the injected payload, after its prologue/epilogue has been inserted
+  auto &PayloadMF = MMI.getOrCreateMachineFunction(*PayloadF);
+  PayloadMF.getProperties().set(
+      llvm::MachineFunctionProperties::Property::NoVRegs);
+  PayloadMF.getRegInfo().freezeReservedRegs();
+  auto *PayloadMBB = PayloadMF.CreateMachineBasicBlock();
+  PayloadMF.push_back(PayloadMBB);
+  for (unsigned I = 0; I < PayloadNops; ++I) {
+    llvm::BuildMI(*PayloadMBB, PayloadMBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_NOP))
+        .addImm(0);
+  }
+  llvm::BuildMI(*PayloadMBB, PayloadMBB->end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::SI_RETURN));
+
+  // Plan the patching of the payload the same way the patching pass does
+  uint64_t InstPointOffset = 0;
+  uint64_t MFSize = 0;
+  for (const auto &MI : *MBB) {
+    if (&MI == &InstPoint)
+      InstPointOffset = MFSize;
+    MFSize += TII.getInstSizeInBytes(MI);
+  }
+  luthier::PatchSite Site{InstPointOffset,
+                          PayloadMF.estimateFunctionSizeInBytes()};
+  auto Types = luthier::planPatchLayout(Site, {}, MFSize,
+                                        luthier::getShortBranchRange(),
+                                        /*OutlineAll=*/true);
+  LUTHIER_REPORT_FATAL_ON_ERROR(Types.takeError());
+
+  llvm::MCRegister LongJumpPCReg;
+  llvm::MCRegister SCCSaveReg;
+  if ((*Types)[0] == luthier::OUTLINE_LONG) {
+    // Registers live at the instrumentation point must not be clobbered
+    llvm::LivePhysRegs UsedRegs(TRI);
+    UsedRegs.addLiveOuts(*MBB);
+    for (const auto &MI : llvm::reverse(*MBB)) {
+      UsedRegs.stepBackward(MI);
+      if (&MI == &InstPoint)
+        break;
+    }
+    auto Regs = luthier::pickLongJumpRegs(
+        MF, UsedRegs, UsedRegs.contains(llvm::AMDGPU::SCC));
+    LUTHIER_REPORT_FATAL_ON_ERROR(Regs.takeError());
+    std::tie(LongJumpPCReg, SCCSaveReg) = *Regs;
+  }
+
+  llvm::DenseMap<const llvm::MachineBasicBlock *, llvm::MachineBasicBlock *>
+      MBBMap;
+  llvm::ValueToValueMapTy VMap;
+  LUTHIER_REPORT_FATAL_ON_ERROR(luthier::outlineInjectedPayload(
+      PayloadMF, InstPoint, MBBMap, VMap, LongJumpPCReg, SCCSaveReg));
+
+  // Outlining does not update the live-ins of the blocks it creates
+  MF.getProperties().reset(
+      llvm::MachineFunctionProperties::Property::TracksLiveness);
+  MF.verify(nullptr, "After outlining the injected payload");
+
+  std::error_code EC;
+  auto OutFile = std::make_unique<llvm::ToolOutputFile>(OutputFilename, EC,
+                                                        llvm::sys::fs::OF_None);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !EC, llvm::formatv("Failed to open output file, error: {0}.",
+                         EC.message())));
+  MF.print(OutFile->os());
+
+  OutFile->keep();
+
+  return 0;
+}
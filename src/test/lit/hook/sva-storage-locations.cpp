@@ -0,0 +1,355 @@
+//===-- sva-storage-locations.cpp -----------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements sva-storage-locations, an executable used to test
+/// where the state value array is stored and loaded offline. It builds one
+/// of a set of target kernels, with an injected payload before each of its
+/// <tt>s_nop</tt> instructions, or before each of its instructions for the
+/// <tt>run</tt> kernel, calculates the storage segments of the state value
+/// array inside the kernel when it can only be stored in the registers
+/// passed to <tt>-candidate-regs</tt>, and prints the kernel with its slot
+/// indexes, followed by the storage segments and the load plans of the
+/// instrumentation points.
+//===----------------------------------------------------------------------===//
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "luthier/Tooling/AMDGPURegisterLiveness.h"
+#include "luthier/Tooling/IModuleIRGeneratorPass.h"
+#include "luthier/Tooling/LRCallgraph.h"
+#include "luthier/Tooling/MMISlotIndexesAnalysis.h"
+#include "luthier/Tooling/SVStorageAndLoadLocations.h"
+#include "luthier/consts.h"
+#include <llvm/CodeGen/LivePhysRegs.h>
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/CodeGen/MachineModuleInfo.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <luthier/Common/ErrorCheck.h>
+#include <luthier/Common/GenericLuthierError.h>
+
+static llvm::cl::OptionCategory
+    SVAStorageLocationsOptions("SVA Storage Locations Options");
+
+static llvm::cl::opt<std::string>
+    CPU("mcpu", llvm::cl::desc("Target GPU of the target kernel"),
+        llvm::cl::init("gfx908"), llvm::cl::cat(SVAStorageLocationsOptions));
+
+enum KernelKind { RelocateKernel, SpillKernel, RunKernel };
+
+static llvm::cl::opt<KernelKind> Kernel(
+    "kernel", llvm::cl::desc("The target kernel to build"),
+    llvm::cl::values(
+        clEnumValN(RelocateKernel, "relocate",
+                   "A kernel overwriting the entry storage of the state "
+                   "value array while a 64-bit register dies"),
+        clEnumValN(SpillKernel, "spill",
+                   "A kernel overwriting the only candidate VGPR, forcing "
+                   "the state value array to be spilled"),
+        clEnumValN(RunKernel, "run",
+                   "A kernel instrumented before each of its instructions, "
+                   "where each instruction that ends a run of state value "
+                   "array loads follows an s_nop")),
+    llvm::cl::init(RelocateKernel), llvm::cl::cat(SVAStorageLocationsOptions));
+
+static llvm::cl::list<std::string> CandidateRegs(
+    "candidate-regs",
+    llvm::cl::desc("Registers the state value array can be stored in, e.g. "
+                   "v253,s20"),
+    llvm::cl::CommaSeparated, llvm::cl::cat(SVAStorageLocationsOptions));
+
+static llvm::cl::list<std::string> AccessedRegs(
+    "accessed-regs",
+    llvm::cl::desc("Registers accessed in place by the injected payloads, "
+                   "e.g. s40"),
+    llvm::cl::CommaSeparated, llvm::cl::cat(SVAStorageLocationsOptions));
+
+static llvm::cl::opt<std::string>
+    OutputFilename("o", llvm::cl::desc("Output filename"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init("-"),
+                   llvm::cl::cat(SVAStorageLocationsOptions));
+
+/// \return the physical register named \p Name (e.g. "v0", "a0" or "s4")
+static llvm::Expected<llvm::MCRegister>
+parseReg(llvm::StringRef Name, const llvm::TargetRegisterInfo &TRI) {
+  std::string TableGenName = Name.upper();
+  if (Name.starts_with("v"))
+    TableGenName = "VGPR" + Name.substr(1).str();
+  else if (Name.starts_with("a"))
+    TableGenName = "AGPR" + Name.substr(1).str();
+  else if (Name.starts_with("s"))
+    TableGenName = "SGPR" + Name.substr(1).str();
+  for (unsigned Reg = 1; Reg < TRI.getNumRegs(); ++Reg) {
+    if (TableGenName == TRI.getName(Reg))
+      return Reg;
+  }
+  return LUTHIER_MAKE_GENERIC_ERROR(
+      llvm::formatv("Unknown physical register {0}.", Name));
+}
+
+/// \return a short name for the storage scheme \p Kind
+static llvm::StringRef
+getStorageKindName(luthier::StateValueArrayStorage::StorageKind Kind) {
+  switch (Kind) {
+  case luthier::StateValueArrayStorage::SVS_SINGLE_VGPR:
+    return "vgpr";
+  case luthier::StateValueArrayStorage::SVS_ONE_AGPR_post_gfx908:
+    return "agpr";
+  case luthier::StateValueArrayStorage::SVS_TWO_AGPRs_pre_gfx908:
+    return "two-agprs";
+  case luthier::StateValueArrayStorage::
+      SVS_SINGLE_AGPR_WITH_THREE_SGPRS_pre_gfx908:
+    return "agpr-with-three-sgprs";
+  case luthier::StateValueArrayStorage::
+      SVS_SPILLED_WITH_THREE_SGPRS_absolute_fs:
+    return "spilled-with-three-sgprs";
+  case luthier::StateValueArrayStorage::
+      SVS_SPILLED_WITH_ONE_SGPR_architected_fs:
+    return "spilled-with-one-sgpr";
+  }
+  llvm_unreachable("Invalid storage kind");
+}
+
+/// Prints the storage scheme and the registers of \p SVS
+static void printSVS(const luthier::StateValueArrayStorage &SVS,
+                     const llvm::TargetRegisterInfo &TRI,
+                     llvm::raw_ostream &OS) {
+  OS << getStorageKindName(SVS.getScheme());
+  llvm::SmallVector<llvm::MCRegister, 4> Regs;
+  SVS.getAllStorageRegisters(Regs);
+  for (llvm::MCRegister Reg : Regs)
+    OS << " " << llvm::printReg(Reg, &TRI);
+}
+
+int main(int Argc, char *Argv[]) {
+  llvm::InitLLVM X(Argc, Argv);
+
+  llvm::cl::ParseCommandLineOptions(
+      Argc, Argv, "Luthier state value array storage locations tool\n");
+
+  LLVMInitializeAMDGPUTarget();
+  LLVMInitializeAMDGPUTargetInfo();
+  LLVMInitializeAMDGPUTargetMC();
+
+  llvm::Triple TT("amdgcn-amd-amdhsa");
+  std::string Error;
+  auto *Target = llvm::TargetRegistry::lookupTarget(TT.normalize(), Error);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Target != nullptr,
+      llvm::formatv("Failed to get target {0} from LLVM, error: {1}.",
+                    TT.normalize(), Error)));
+  std::unique_ptr<llvm::GCNTargetMachine> TM(
+      reinterpret_cast<llvm::GCNTargetMachine *>(Target->createTargetMachine(
+          TT.normalize(), CPU, "", llvm::TargetOptions(), llvm::Reloc::PIC_)));
+
+  llvm::LLVMContext Ctx;
+  auto *VoidTy = llvm::Type::getVoidTy(Ctx);
+
+  llvm::Module TargetAppM("target-app", Ctx);
+  TargetAppM.setTargetTriple(TT.normalize());
+  TargetAppM.setDataLayout(TM->createDataLayout());
+  auto *KernelF = llvm::Function::Create(
+      llvm::FunctionType::get(VoidTy, false),
+      llvm::GlobalValue::ExternalLinkage, "kernel", TargetAppM);
+  KernelF->setCallingConv(llvm::CallingConv::AMDGPU_KERNEL);
+
+  llvm::MachineModuleInfo TargetMMI(TM.get());
+  auto &KernelMF = TargetMMI.getOrCreateMachineFunction(*KernelF);
+  const auto &ST = KernelMF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  const auto &TRI = *ST.getRegisterInfo();
+  KernelMF.getProperties().set(
+      llvm::MachineFunctionProperties::Property::NoVRegs);
+  KernelMF.getRegInfo().freezeReservedRegs();
+  auto *MBB = KernelMF.CreateMachineBasicBlock();
+  KernelMF.push_back(MBB);
+
+  auto BuildNop = [&]() {
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_NOP))
+        .addImm(0);
+  };
+  auto BuildVMov = [&](llvm::MCRegister Dst) {
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::V_MOV_B32_e32), Dst)
+        .addImm(0);
+  };
+
+  switch (Kernel) {
+  case RelocateKernel:
+    // v[254:255] dies right after the entry; v253 is then overwritten,
+    // while v255 is overwritten after it, so both must be avoided when
+    // relocating the state value array
+    MBB->addLiveIn(llvm::AMDGPU::VGPR254);
+    MBB->addLiveIn(llvm::AMDGPU::VGPR255);
+    BuildNop();
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::GLOBAL_STORE_DWORDX2))
+        .addReg(llvm::AMDGPU::VGPR254_VGPR255)
+        .addReg(llvm::AMDGPU::VGPR254_VGPR255)
+        .addImm(0)
+        .addImm(0);
+    BuildVMov(llvm::AMDGPU::VGPR253);
+    BuildVMov(llvm::AMDGPU::VGPR255);
+    BuildNop();
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::V_ADD_U32_e32), llvm::AMDGPU::VGPR0)
+        .addReg(llvm::AMDGPU::VGPR253)
+        .addReg(llvm::AMDGPU::VGPR255);
+    break;
+  case SpillKernel:
+    // v253 is overwritten and read between the first and the last
+    // instrumentation points
+    BuildNop();
+    BuildVMov(llvm::AMDGPU::VGPR253);
+    BuildNop();
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::V_MOV_B32_e32), llvm::AMDGPU::VGPR0)
+        .addReg(llvm::AMDGPU::VGPR253);
+    BuildNop();
+    break;
+  case RunKernel:
+    // The first two s_nops share a run with the v0 write; Each following
+    // s_nop starts a new run, which the instruction after it ends
+    MBB->addLiveIn(llvm::AMDGPU::VGPR2);
+    MBB->addLiveIn(llvm::AMDGPU::VGPR3);
+    MBB->addLiveIn(llvm::AMDGPU::VGPR4);
+    BuildNop();
+    BuildNop();
+    BuildVMov(llvm::AMDGPU::VGPR0);
+    BuildNop();
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_MOV_B64), llvm::AMDGPU::EXEC)
+        .addImm(-1);
+    BuildNop();
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_MOV_B32), llvm::AMDGPU::SGPR0)
+        .addImm(0);
+    BuildNop();
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_MOV_B32), llvm::AMDGPU::SGPR40)
+        .addImm(0);
+    BuildNop();
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::FLAT_STORE_DWORD))
+        .addReg(llvm::AMDGPU::VGPR2_VGPR3)
+        .addReg(llvm::AMDGPU::VGPR4)
+        .addImm(0)
+        .addImm(0);
+    BuildNop();
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::INLINEASM))
+        .addExternalSymbol("")
+        .addImm(0);
+    BuildNop();
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::V_ACCVGPR_WRITE_B32_e64),
+                  llvm::AMDGPU::AGPR255)
+        .addImm(0);
+    BuildNop();
+    break;
+  }
+  llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_ENDPGM))
+      .addImm(0);
+
+  // Inject a payload before each s_nop of the kernel, or before each of its
+  // instructions for the run kernel
+  llvm::Module IModule("imodule", Ctx);
+  luthier::InjectedPayloadAndInstPoint IPIP;
+  unsigned NumPayloads = 0;
+  for (auto &MI : *MBB) {
+    if (Kernel == RunKernel ? MI.isTerminator()
+                            : MI.getOpcode() != llvm::AMDGPU::S_NOP)
+      continue;
+    auto *PayloadF = llvm::Function::Create(
+        llvm::FunctionType::get(VoidTy, false),
+        llvm::GlobalValue::ExternalLinkage,
+        llvm::formatv("payload.{0}", NumPayloads++).str(), IModule);
+    PayloadF->addFnAttr(luthier::InjectedPayloadAttribute);
+    IPIP.addEntry(MI, *PayloadF);
+  }
+
+  llvm::ModuleAnalysisManager TargetMAM;
+  TargetMAM.registerPass([&]() { return llvm::PassInstrumentationAnalysis(); });
+  TargetMAM.registerPass(
+      [&]() { return llvm::MachineModuleAnalysis(TargetMMI); });
+  TargetMAM.registerPass(
+      [&]() { return luthier::AMDGPURegLivenessAnalysis(); });
+  TargetMAM.registerPass([&]() { return luthier::LRCallGraphAnalysis(); });
+  TargetMAM.registerPass([&]() { return luthier::MMISlotIndexesAnalysis(); });
+  const auto &RegLiveness =
+      TargetMAM.getResult<luthier::AMDGPURegLivenessAnalysis>(TargetAppM);
+  const auto &SlotIndexes =
+      TargetMAM.getResult<luthier::MMISlotIndexesAnalysis>(TargetAppM).at(
+          KernelMF);
+
+  llvm::LivePhysRegs Candidates(TRI);
+  for (const auto &Name : CandidateRegs) {
+    auto Reg = parseReg(Name, TRI);
+    LUTHIER_REPORT_FATAL_ON_ERROR(Reg.takeError());
+    Candidates.addReg(*Reg);
+  }
+  llvm::LivePhysRegs AccessedPhysRegsNotInLiveIns(TRI);
+  for (const auto &Name : AccessedRegs) {
+    auto Reg = parseReg(Name, TRI);
+    LUTHIER_REPORT_FATAL_ON_ERROR(Reg.takeError());
+    AccessedPhysRegsNotInLiveIns.addReg(*Reg);
+  }
+
+  luthier::SVStorageAndLoadLocations SVLocations;
+  LUTHIER_REPORT_FATAL_ON_ERROR(SVLocations.calculateRelocatable(
+      KernelMF, SlotIndexes, RegLiveness, IPIP, Candidates,
+      AccessedPhysRegsNotInLiveIns));
+
+  std::error_code EC;
+  auto OutFile = std::make_unique<llvm::ToolOutputFile>(OutputFilename, EC,
+                                                        llvm::sys::fs::OF_None);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !EC, llvm::formatv("Failed to open output file, error: {0}.",
+                         EC.message())));
+  auto &OS = OutFile->os();
+
+  KernelMF.print(OS, &SlotIndexes);
+  for (const auto &Segment : SVLocations.getStorageIntervals(*MBB)) {
+    OS << "segment [" << Segment.begin() << ", " << Segment.end() << "): ";
+    printSVS(Segment.getSVS(), TRI, OS);
+    OS << "\n";
+  }
+  for (const auto &MI : *MBB) {
+    const auto *Plan = SVLocations.getStateValueArrayLoadPlanForInstPoint(MI);
+    if (!Plan)
+      continue;
+    OS << "load plan " << SlotIndexes.getInstructionIndex(MI) << ": ";
+    printSVS(Plan->StateValueStorageLocation, TRI, OS);
+    OS << ", load VGPR " << llvm::printReg(Plan->StateValueArrayLoadVGPR, &TRI)
+       << (Plan->LoadDestClobbersAppVGPR ? " (clobbers app)" : "")
+       << ", loads SVA " << Plan->LoadsSVA << ", stores SVA "
+       << Plan->StoresSVA << "\n";
+  }
+
+  OutFile->keep();
+
+  return 0;
+}
@@ -0,0 +1,231 @@
+//===-- intrinsic-mir-lower.cpp -------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements intrinsic-mir-lower, an executable used to test the
+/// MIR lowering stage of Luthier intrinsics offline. It runs the MIR processor
+/// of an intrinsic on freshly created virtual registers inside an empty
+/// machine function, verifies the result, and prints it.
+//===----------------------------------------------------------------------===//
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "luthier/Intrinsic/IntrinsicProcessor.h"
+#include "luthier/Intrinsic/LDSCounterAdd.h"
+#include "luthier/Intrinsic/ReadClock.h"
+#include "luthier/Intrinsic/SAtomicAdd.h"
+#include "luthier/Intrinsic/TraceReserve.h"
+#include "luthier/Intrinsic/WaveAtomicAdd.h"
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/CodeGen/MachineModuleInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/AMDGPUAddrSpace.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <llvm/Support/WithColor.h>
+#include <luthier/Common/ErrorCheck.h>
+#include <luthier/Common/GenericLuthierError.h>
+
+static llvm::cl::OptionCategory
+    IntrinsicMIRLowerOptions("Intrinsic MIR Lower Options");
+
+static llvm::cl::opt<std::string>
+    IntrinsicName("intrinsic",
+                  llvm::cl::desc("Name of the intrinsic to lower, without "
+                                 "the luthier:: prefix"),
+                  llvm::cl::Required, llvm::cl::cat(IntrinsicMIRLowerOptions));
+
+static llvm::cl::opt<std::string>
+    CPU("mcpu", llvm::cl::desc("Target GPU to lower the intrinsic for"),
+        llvm::cl::init("gfx908"), llvm::cl::cat(IntrinsicMIRLowerOptions));
+
+static llvm::cl::opt<unsigned>
+    DataBits("data-bits",
+             llvm::cl::desc("Width of the data operands of the intrinsic"),
+             llvm::cl::init(32), llvm::cl::cat(IntrinsicMIRLowerOptions));
+
+static llvm::cl::opt<std::string>
+    OutputFilename("o", llvm::cl::desc("Output filename"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init("-"),
+                   llvm::cl::cat(IntrinsicMIRLowerOptions));
+
+namespace {
+
+/// Describes how to invoke the MIR processor of an intrinsic under test
+struct IntrinsicUnderTest {
+  luthier::IntrinsicMIRProcessorFunc MIRProcessor;
+  /// Whether each inline assembly operand passed to the MIR processor is a
+  /// def, and its register class
+  llvm::SmallVector<std::pair<bool, const llvm::TargetRegisterClass *>, 3>
+      Operands;
+  /// Whether the intrinsic stages a global counter named "Counter" in LDS
+  bool StagesCounterInLDS{false};
+};
+
+} // namespace
+
+static llvm::Expected<IntrinsicUnderTest> getIntrinsicUnderTest() {
+  LUTHIER_RETURN_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      DataBits == 32 || DataBits == 64,
+      llvm::formatv("Data width must be either 32 or 64 bits, got {0} "
+                    "instead.",
+                    DataBits.getValue())));
+  const llvm::TargetRegisterClass *SData = DataBits == 64
+                                               ? &llvm::AMDGPU::SReg_64RegClass
+                                               : &llvm::AMDGPU::SReg_32RegClass;
+  const llvm::TargetRegisterClass *VData = DataBits == 64
+                                               ? &llvm::AMDGPU::VReg_64RegClass
+                                               : &llvm::AMDGPU::VGPR_32RegClass;
+  const auto *SAddress = &llvm::AMDGPU::SReg_64RegClass;
+  if (IntrinsicName == "sAtomicAdd")
+    return IntrinsicUnderTest{
+        luthier::sAtomicAddMIRProcessor,
+        {{true, SData}, {false, SAddress}, {false, SData}}};
+  if (IntrinsicName == "traceReserve")
+    return IntrinsicUnderTest{
+        luthier::traceReserveMIRProcessor,
+        {{true, &llvm::AMDGPU::VReg_64RegClass}, {false, SAddress}}};
+  if (IntrinsicName == "waveAtomicAdd")
+    return IntrinsicUnderTest{luthier::waveAtomicAddMIRProcessor,
+                              {{false, SAddress}, {false, VData}}};
+  if (IntrinsicName == "ldsCounterAdd")
+    return IntrinsicUnderTest{luthier::ldsCounterAddMIRProcessor,
+                              {{false, &llvm::AMDGPU::VReg_64RegClass}},
+                              true};
+  if (IntrinsicName == "readClock")
+    return IntrinsicUnderTest{luthier::readClockMIRProcessor,
+                              {{true, &llvm::AMDGPU::SReg_64RegClass}}};
+  if (IntrinsicName == "readRealTime")
+    return IntrinsicUnderTest{luthier::readRealTimeMIRProcessor,
+                              {{true, &llvm::AMDGPU::SReg_64RegClass}}};
+  return LUTHIER_MAKE_GENERIC_ERROR(
+      llvm::formatv("Intrinsic {0} is not supported by this tool.",
+                    IntrinsicName.getValue()));
+}
+
+int main(int Argc, char *Argv[]) {
+  llvm::InitLLVM X(Argc, Argv);
+
+  llvm::cl::HideUnrelatedOptions(
+      {&IntrinsicMIRLowerOptions, &llvm::getColorCategory()});
+  llvm::cl::ParseCommandLineOptions(Argc, Argv,
+                                    "Luthier intrinsic MIR lowering tool\n");
+
+  LLVMInitializeAMDGPUTarget();
+  LLVMInitializeAMDGPUTargetInfo();
+  LLVMInitializeAMDGPUTargetMC();
+
+  auto Intrinsic = getIntrinsicUnderTest();
+  LUTHIER_REPORT_FATAL_ON_ERROR(Intrinsic.takeError());
+
+  llvm::Triple TT("amdgcn-amd-amdhsa");
+  std::string Error;
+  auto *Target = llvm::TargetRegistry::lookupTarget(TT.normalize(), Error);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Target != nullptr,
+      llvm::formatv("Failed to get target {0} from LLVM, error: {1}.",
+                    TT.normalize(), Error)));
+  std::unique_ptr<llvm::GCNTargetMachine> TM(
+      reinterpret_cast<llvm::GCNTargetMachine *>(Target->createTargetMachine(
+          TT.normalize(), CPU, "", llvm::TargetOptions(), llvm::Reloc::PIC_)));
+
+  llvm::LLVMContext Ctx;
+  llvm::Module M("intrinsic-mir-lower", Ctx);
+  M.setTargetTriple(TT.normalize());
+  M.setDataLayout(TM->createDataLayout());
+  auto *F = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), false),
+      llvm::GlobalValue::ExternalLinkage, IntrinsicName.getValue(), M);
+
+  luthier::IntrinsicIRLoweringInfo IRLoweringInfo;
+  if (Intrinsic->StagesCounterInLDS) {
+    new llvm::GlobalVariable(
+        M, llvm::Type::getInt64Ty(Ctx), false,
+        llvm::GlobalValue::ExternalLinkage, nullptr, "Counter", nullptr,
+        llvm::GlobalValue::NotThreadLocal, llvm::AMDGPUAS::GLOBAL_ADDRESS);
+    IRLoweringInfo.requestLDSCounter("Counter");
+  }
+
+  llvm::MachineModuleInfo MMI(TM.get());
+  auto &MF = MMI.getOrCreateMachineFunction(*F);
+  auto *MBB = MF.CreateMachineBasicBlock();
+  MF.push_back(MBB);
+  const auto *TII = MF.getSubtarget().getInstrInfo();
+  auto &MRI = MF.getRegInfo();
+
+  auto MIBuilder = [&](int Opcode) {
+    return llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(), TII->get(Opcode));
+  };
+
+  auto VirtRegBuilder = [&](const llvm::TargetRegisterClass *RC) {
+    return MRI.createVirtualRegister(RC);
+  };
+
+  auto KernArgAccessor = [&](luthier::KernelArgumentType) -> llvm::Register {
+    LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_MAKE_GENERIC_ERROR(
+        "Accessing kernel arguments is not supported by this tool."));
+    return {};
+  };
+
+  auto PhysRegAccessor = [&](llvm::MCRegister) -> llvm::Register {
+    LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_MAKE_GENERIC_ERROR(
+        "Accessing physical registers is not supported by this tool."));
+    return {};
+  };
+
+  // Create the registers of the inline assembly placeholder; Used registers
+  // are defined up front, as they would be by the instrumentation function
+  llvm::SmallVector<std::pair<llvm::InlineAsm::Flag, llvm::Register>, 3> Args;
+  for (const auto &[IsDef, RC] : Intrinsic->Operands) {
+    llvm::Register Reg = MRI.createVirtualRegister(RC);
+    if (!IsDef)
+      MIBuilder(llvm::AMDGPU::IMPLICIT_DEF)
+          .addReg(Reg, llvm::RegState::Define);
+    Args.emplace_back(
+        llvm::InlineAsm::Flag(IsDef ? llvm::InlineAsm::Kind::RegDef
+                                    : llvm::InlineAsm::Kind::RegUse,
+                              1),
+        Reg);
+  }
+
+  llvm::DenseMap<llvm::MCRegister, llvm::Register> PhysRegsToBeOverwritten;
+  LUTHIER_REPORT_FATAL_ON_ERROR(Intrinsic->MIRProcessor(
+      IRLoweringInfo, Args, MIBuilder, VirtRegBuilder, KernArgAccessor, MF,
+      PhysRegAccessor, PhysRegsToBeOverwritten));
+
+  MIBuilder(llvm::AMDGPU::S_ENDPGM).addImm(0);
+
+  MF.verify(nullptr, "After lowering the intrinsic");
+
+  std::error_code EC;
+  auto OutFile = std::make_unique<llvm::ToolOutputFile>(OutputFilename, EC,
+                                                        llvm::sys::fs::OF_None);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !EC, llvm::formatv("Failed to open output file, error: {0}.",
+                         EC.message())));
+  MF.print(OutFile->os());
+
+  OutFile->keep();
+
+  return 0;
+}
@@ -4,10 +4,10 @@ import lit.formats
 import lit.util
 
 config.name = "Luthier"
-config.suffixes = {".s"}
+config.suffixes = {".s", ".test"}
 config.test_format = lit.formats.ShTest(True)
 
-config.excludes = ["comgr"]
+config.excludes = ["Inputs", "comgr", "hook", "intrinsic", "preamble"]
 
 config.test_source_root = os.path.dirname(__file__)
 config.test_exec_root = config.my_obj_root
\ No newline at end of file
@@ -0,0 +1,163 @@
+//===-- instrumentation-stack-mir-emit.cpp --------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements instrumentation-stack-mir-emit, an executable used to
+/// test the instrumentation stack setup of the kernel preamble offline. It
+/// emits the setup code at the beginning of a kernel which only initializes
+/// its stack pointer the same way the compiler does, verifies the result,
+/// and prints it.
+//===----------------------------------------------------------------------===//
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "SIMachineFunctionInfo.h"
+#include "luthier/Tooling/InstrumentationStack.h"
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/CodeGen/MachineModuleInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <luthier/Common/ErrorCheck.h>
+#include <luthier/Common/GenericLuthierError.h>
+
+static llvm::cl::OptionCategory InstrumentationStackMIREmitOptions(
+    "Instrumentation Stack MIR Emit Options");
+
+static llvm::cl::opt<std::string>
+    CPU("mcpu", llvm::cl::desc("Target GPU to emit the preamble for"),
+        llvm::cl::init("gfx908"),
+        llvm::cl::cat(InstrumentationStackMIREmitOptions));
+
+static llvm::cl::opt<unsigned> PrivateSegmentFixedSize(
+    "private-segment-fixed-size",
+    llvm::cl::desc("Fixed private segment size of the kernel in bytes"),
+    llvm::cl::init(0), llvm::cl::cat(InstrumentationStackMIREmitOptions));
+
+static llvm::cl::opt<bool>
+    UsesDynamicStack("uses-dynamic-stack",
+                     llvm::cl::desc("Whether the kernel uses a dynamic stack"),
+                     llvm::cl::init(false),
+                     llvm::cl::cat(InstrumentationStackMIREmitOptions));
+
+static llvm::cl::opt<unsigned> InstrumentationStackSize(
+    "instrumentation-stack-size",
+    llvm::cl::desc("Number of stack bytes per lane requested by the injected "
+                   "payloads"),
+    llvm::cl::init(0), llvm::cl::cat(InstrumentationStackMIREmitOptions));
+
+static llvm::cl::opt<std::string>
+    OutputFilename("o", llvm::cl::desc("Output filename"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init("-"),
+                   llvm::cl::cat(InstrumentationStackMIREmitOptions));
+
+int main(int Argc, char *Argv[]) {
+  llvm::InitLLVM X(Argc, Argv);
+
+  llvm::cl::ParseCommandLineOptions(
+      Argc, Argv, "Luthier instrumentation stack MIR emission tool\n");
+
+  LLVMInitializeAMDGPUTarget();
+  LLVMInitializeAMDGPUTargetInfo();
+  LLVMInitializeAMDGPUTargetMC();
+
+  llvm::Triple TT("amdgcn-amd-amdhsa");
+  std::string Error;
+  auto *Target = llvm::TargetRegistry::lookupTarget(TT.normalize(), Error);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Target != nullptr,
+      llvm::formatv("Failed to get target {0} from LLVM, error: {1}.",
+                    TT.normalize(), Error)));
+  std::unique_ptr<llvm::GCNTargetMachine> TM(
+      reinterpret_cast<llvm::GCNTargetMachine *>(Target->createTargetMachine(
+          TT.normalize(), CPU, "", llvm::TargetOptions(), llvm::Reloc::PIC_)));
+
+  llvm::LLVMContext Ctx;
+  llvm::Module M("instrumentation-stack-mir-emit", Ctx);
+  M.setTargetTriple(TT.normalize());
+  M.setDataLayout(TM->createDataLayout());
+  auto *F = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), false),
+      llvm::GlobalValue::ExternalLinkage, "kernel", M);
+  F->setCallingConv(llvm::CallingConv::AMDGPU_KERNEL);
+
+  luthier::amdgpu::hsamd::Kernel::Metadata KernelMD;
+  KernelMD.PrivateSegmentFixedSize = PrivateSegmentFixedSize;
+  KernelMD.UsesDynamicStack = UsesDynamicStack;
+
+  llvm::MachineModuleInfo MMI(TM.get());
+  auto &MF = MMI.getOrCreateMachineFunction(*F);
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  const auto &TRI = *ST.getRegisterInfo();
+  auto &MFI = *MF.getInfo<llvm::SIMachineFunctionInfo>();
+  MF.getProperties().set(llvm::MachineFunctionProperties::Property::NoVRegs);
+
+  // Enable the kernel arguments the same way the preamble emitter does
+  MFI.addPrivateSegmentBuffer(TRI);
+  MFI.addFlatScratchInit(TRI);
+  if (luthier::doesInstrumentationStackRequireDispatchPtr(KernelMD))
+    MFI.addDispatchPtr(TRI);
+  MFI.addPrivateSegmentWaveByteOffset();
+
+  auto *MBB = MF.CreateMachineBasicBlock();
+  MF.push_back(MBB);
+  llvm::MCRegister SVSStorageVGPR = llvm::AMDGPU::VGPR40;
+  for (auto PreloadedValue :
+       {llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_BUFFER,
+        llvm::AMDGPUFunctionArgInfo::DISPATCH_PTR,
+        llvm::AMDGPUFunctionArgInfo::FLAT_SCRATCH_INIT,
+        llvm::AMDGPUFunctionArgInfo::PRIVATE_SEGMENT_WAVE_BYTE_OFFSET}) {
+    if (llvm::MCRegister Reg = MFI.getPreloadedReg(PreloadedValue))
+      MBB->addLiveIn(Reg);
+  }
+  MBB->addLiveIn(SVSStorageVGPR);
+
+  // The compiler initializes the stack pointer of dynamic stack kernels to
+  // the end of their fixed private segment
+  unsigned ScaleFactor = ST.enableFlatScratch() ? 1 : ST.getWavefrontSize();
+  llvm::MachineInstr &EntryInstr =
+      *llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                     TII.get(llvm::AMDGPU::S_MOV_B32), llvm::AMDGPU::SGPR32)
+           .addImm(PrivateSegmentFixedSize * ScaleFactor)
+           .getInstr();
+  llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                TII.get(llvm::AMDGPU::S_ENDPGM))
+      .addImm(0);
+
+  LUTHIER_REPORT_FATAL_ON_ERROR(luthier::emitCodeToSetupInstrumentationStack(
+      EntryInstr, SVSStorageVGPR, KernelMD, InstrumentationStackSize));
+
+  MF.verify(nullptr, "After emitting the instrumentation stack setup");
+
+  std::error_code EC;
+  auto OutFile = std::make_unique<llvm::ToolOutputFile>(OutputFilename, EC,
+                                                        llvm::sys::fs::OF_None);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !EC, llvm::formatv("Failed to open output file, error: {0}.",
+                         EC.message())));
+  MF.print(OutFile->os());
+
+  OutFile->keep();
+
+  return 0;
+}
@@ -0,0 +1,198 @@
+//===-- lds-counter-mir-emit.cpp ------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements lds-counter-mir-emit, an executable used to test the
+/// code staging counters in LDS offline. It emits the code zeroing the
+/// counters at the beginning of a kernel, and the code flushing them before
+/// each of its \c s_endpgm instructions, verifies the result, and prints it.
+//===----------------------------------------------------------------------===//
+#include "AMDGPUTargetMachine.h"
+#include "GCNSubtarget.h"
+#include "luthier/Tooling/LDSCounterStaging.h"
+#include <llvm/CodeGen/LivePhysRegs.h>
+#include <llvm/CodeGen/MachineInstrBuilder.h>
+#include <llvm/CodeGen/MachineModuleInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/AMDGPUAddrSpace.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <luthier/Common/ErrorCheck.h>
+#include <luthier/Common/GenericLuthierError.h>
+
+static llvm::cl::OptionCategory
+    LDSCounterMIREmitOptions("LDS Counter MIR Emit Options");
+
+static llvm::cl::opt<std::string>
+    CPU("mcpu", llvm::cl::desc("Target GPU to emit the code for"),
+        llvm::cl::init("gfx908"), llvm::cl::cat(LDSCounterMIREmitOptions));
+
+static llvm::cl::opt<unsigned>
+    NumCounters("num-counters",
+                llvm::cl::desc("Number of counters staged in LDS"),
+                llvm::cl::init(1), llvm::cl::cat(LDSCounterMIREmitOptions));
+
+static llvm::cl::opt<unsigned> CountersOffset(
+    "counters-offset",
+    llvm::cl::desc("LDS offset of the first counter, i.e. the size of the "
+                   "group segment of the kernel"),
+    llvm::cl::init(0), llvm::cl::cat(LDSCounterMIREmitOptions));
+
+static llvm::cl::opt<unsigned> NumLiveVGPRs(
+    "num-live-vgprs",
+    llvm::cl::desc("Number of VGPRs, starting from v0, live at the "
+                   "beginning of the kernel"),
+    llvm::cl::init(0), llvm::cl::cat(LDSCounterMIREmitOptions));
+
+static llvm::cl::opt<bool> TwoExits(
+    "two-exits",
+    llvm::cl::desc("Whether the kernel exits through two s_endpgm "
+                   "instructions instead of one"),
+    llvm::cl::init(false), llvm::cl::cat(LDSCounterMIREmitOptions));
+
+static llvm::cl::opt<std::string>
+    OutputFilename("o", llvm::cl::desc("Output filename"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init("-"),
+                   llvm::cl::cat(LDSCounterMIREmitOptions));
+
+int main(int Argc, char *Argv[]) {
+  llvm::InitLLVM X(Argc, Argv);
+
+  llvm::cl::ParseCommandLineOptions(Argc, Argv,
+                                    "Luthier LDS counter MIR emission tool\n");
+
+  LLVMInitializeAMDGPUTarget();
+  LLVMInitializeAMDGPUTargetInfo();
+  LLVMInitializeAMDGPUTargetMC();
+
+  llvm::Triple TT("amdgcn-amd-amdhsa");
+  std::string Error;
+  auto *Target = llvm::TargetRegistry::lookupTarget(TT.normalize(), Error);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      Target != nullptr,
+      llvm::formatv("Failed to get target {0} from LLVM, error: {1}.",
+                    TT.normalize(), Error)));
+  std::unique_ptr<llvm::GCNTargetMachine> TM(
+      reinterpret_cast<llvm::GCNTargetMachine *>(Target->createTargetMachine(
+          TT.normalize(), CPU, "", llvm::TargetOptions(), llvm::Reloc::PIC_)));
+
+  llvm::LLVMContext Ctx;
+  llvm::Module M("lds-counter-mir-emit", Ctx);
+  M.setTargetTriple(TT.normalize());
+  M.setDataLayout(TM->createDataLayout());
+  auto *F = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), false),
+      llvm::GlobalValue::ExternalLinkage, "kernel", M);
+  F->setCallingConv(llvm::CallingConv::AMDGPU_KERNEL);
+
+  // Declare the global counters the same way the pre-amble emitter does
+  llvm::SmallVector<std::pair<const llvm::GlobalVariable *, unsigned>, 4>
+      Counters;
+  for (unsigned I = 0; I < NumCounters; ++I) {
+    auto *GV = new llvm::GlobalVariable(
+        M, llvm::Type::getInt64Ty(Ctx), false,
+        llvm::GlobalValue::ExternalLinkage, nullptr,
+        llvm::formatv("Counter{0}", I).str(), nullptr,
+        llvm::GlobalValue::NotThreadLocal, llvm::AMDGPUAS::GLOBAL_ADDRESS);
+    Counters.emplace_back(GV, CountersOffset + 8 * I);
+  }
+  unsigned LiveWavesOffset = CountersOffset + 8 * NumCounters;
+
+  llvm::MachineModuleInfo MMI(TM.get());
+  auto &MF = MMI.getOrCreateMachineFunction(*F);
+  const auto &ST = MF.getSubtarget<llvm::GCNSubtarget>();
+  const auto &TII = *ST.getInstrInfo();
+  MF.getProperties().set(llvm::MachineFunctionProperties::Property::NoVRegs);
+  MF.getRegInfo().freezeReservedRegs();
+
+  auto *MBB = MF.CreateMachineBasicBlock();
+  MF.push_back(MBB);
+  llvm::LivePhysRegs EntryLiveRegs(*ST.getRegisterInfo());
+  for (unsigned I = 0; I < NumLiveVGPRs; ++I) {
+    MBB->addLiveIn(llvm::AMDGPU::VGPR0 + I);
+    EntryLiveRegs.addReg(llvm::AMDGPU::VGPR0 + I);
+  }
+
+  // The application reads its live VGPRs, then exits; With two exits, the
+  // exit is picked by a uniform branch on SCC
+  llvm::MachineInstr &EntryInstr =
+      *llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                     TII.get(llvm::AMDGPU::S_NOP))
+           .addImm(0)
+           .getInstr();
+  for (unsigned I = 0; I < NumLiveVGPRs; ++I) {
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::V_MOV_B32_e32),
+                  llvm::AMDGPU::VGPR0 + I)
+        .addReg(llvm::AMDGPU::VGPR0 + I);
+  }
+  llvm::SmallVector<llvm::MachineInstr *, 2> EndPgms;
+  if (TwoExits) {
+    MBB->addLiveIn(llvm::AMDGPU::SCC);
+    EntryLiveRegs.addReg(llvm::AMDGPU::SCC);
+    auto *FallThroughMBB = MF.CreateMachineBasicBlock();
+    auto *TakenMBB = MF.CreateMachineBasicBlock();
+    MF.push_back(FallThroughMBB);
+    MF.push_back(TakenMBB);
+    MBB->addSuccessor(FallThroughMBB);
+    MBB->addSuccessor(TakenMBB);
+    llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                  TII.get(llvm::AMDGPU::S_CBRANCH_SCC0))
+        .addMBB(TakenMBB);
+    for (auto *ExitMBB : {FallThroughMBB, TakenMBB}) {
+      EndPgms.push_back(llvm::BuildMI(*ExitMBB, ExitMBB->end(),
+                                      llvm::DebugLoc(),
+                                      TII.get(llvm::AMDGPU::S_ENDPGM))
+                            .addImm(0)
+                            .getInstr());
+    }
+  } else {
+    EndPgms.push_back(llvm::BuildMI(*MBB, MBB->end(), llvm::DebugLoc(),
+                                    TII.get(llvm::AMDGPU::S_ENDPGM))
+                          .addImm(0)
+                          .getInstr());
+  }
+
+  LUTHIER_REPORT_FATAL_ON_ERROR(luthier::emitCodeToZeroLDSCounters(
+      EntryInstr, CountersOffset, LiveWavesOffset, EntryLiveRegs));
+  for (auto *EndPgm : EndPgms) {
+    LUTHIER_REPORT_FATAL_ON_ERROR(
+        luthier::emitCodeToFlushLDSCounters(*EndPgm, Counters, LiveWavesOffset)
+            .takeError());
+  }
+
+  MF.verify(nullptr, "After emitting the LDS counter staging code");
+
+  std::error_code EC;
+  auto OutFile = std::make_unique<llvm::ToolOutputFile>(OutputFilename, EC,
+                                                        llvm::sys::fs::OF_None);
+  LUTHIER_REPORT_FATAL_ON_ERROR(LUTHIER_GENERIC_ERROR_CHECK(
+      !EC, llvm::formatv("Failed to open output file, error: {0}.",
+                         EC.message())));
+  MF.print(OutFile->os());
+
+  OutFile->keep();
+
+  return 0;
+}
@@ -0,0 +1,212 @@
+//===-- DispatchCompletionNotifierTest.cpp --------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file tests the signal chaining of
+/// \c luthier::hsa::DispatchCompletionNotifier against mocked HSA API tables.
+//===----------------------------------------------------------------------===//
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <luthier/HSA/DispatchCompletionNotifier.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace luthier::hsa;
+
+namespace {
+
+/// Values of the live mocked signals
+std::map<uint64_t, hsa_signal_value_t> SignalValues;
+
+uint64_t NextSignalHandle;
+
+unsigned NumSignalsCreated;
+
+/// Async handlers registered with the mocked runtime, not yet fired
+std::vector<std::tuple<hsa_signal_t, hsa_amd_signal_handler, void *>>
+    AsyncHandlers;
+
+/// Events observed by the mocked runtime and the handlers, in order
+std::vector<std::string> Events;
+
+bool FailAsyncHandlerRegistration;
+
+hsa_status_t mockSignalCreate(hsa_signal_value_t InitialValue, uint32_t,
+                              const hsa_agent_t *, hsa_signal_t *Signal) {
+  Signal->handle = NextSignalHandle++;
+  SignalValues[Signal->handle] = InitialValue;
+  NumSignalsCreated++;
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t mockSignalDestroy(hsa_signal_t Signal) {
+  return SignalValues.erase(Signal.handle) ? HSA_STATUS_SUCCESS
+                                           : HSA_STATUS_ERROR_INVALID_SIGNAL;
+}
+
+void mockSignalStoreRelaxed(hsa_signal_t Signal, hsa_signal_value_t Value) {
+  SignalValues.at(Signal.handle) = Value;
+}
+
+void mockSignalSubtractScRelease(hsa_signal_t Signal,
+                                 hsa_signal_value_t Value) {
+  SignalValues.at(Signal.handle) -= Value;
+  Events.push_back("subtract " + std::to_string(Signal.handle));
+}
+
+hsa_status_t mockSignalAsyncHandler(hsa_signal_t Signal,
+                                    hsa_signal_condition_t Cond,
+                                    hsa_signal_value_t Value,
+                                    hsa_amd_signal_handler Handler,
+                                    void *Arg) {
+  if (FailAsyncHandlerRegistration)
+    return HSA_STATUS_ERROR_OUT_OF_RESOURCES;
+  EXPECT_EQ(Cond, HSA_SIGNAL_CONDITION_LT);
+  EXPECT_EQ(Value, 1);
+  AsyncHandlers.emplace_back(Signal, Handler, Arg);
+  return HSA_STATUS_SUCCESS;
+}
+
+/// Emulates the packet processor completing the dispatch attached to
+/// \p Signal, and the runtime firing its async handler
+void completeDispatch(hsa_signal_t Signal) {
+  SignalValues.at(Signal.handle) -= 1;
+  auto It = std::find_if(AsyncHandlers.begin(), AsyncHandlers.end(),
+                         [&](const auto &Entry) {
+                           return std::get<0>(Entry).handle == Signal.handle;
+                         });
+  ASSERT_NE(It, AsyncHandlers.end());
+  auto [S, Handler, Arg] = *It;
+  AsyncHandlers.erase(It);
+  EXPECT_FALSE(Handler(SignalValues.at(S.handle), Arg));
+}
+
+class DispatchCompletionNotifierTest : public ::testing::Test {
+protected:
+  ::CoreApiTable CoreTable{};
+  ::AmdExtTable AmdExtTable{};
+
+  void SetUp() override {
+    SignalValues.clear();
+    NextSignalHandle = 1;
+    NumSignalsCreated = 0;
+    AsyncHandlers.clear();
+    Events.clear();
+    FailAsyncHandlerRegistration = false;
+
+    CoreTable.version.minor_id = sizeof(::CoreApiTable);
+    CoreTable.hsa_signal_create_fn = mockSignalCreate;
+    CoreTable.hsa_signal_destroy_fn = mockSignalDestroy;
+    CoreTable.hsa_signal_store_relaxed_fn = mockSignalStoreRelaxed;
+    CoreTable.hsa_signal_subtract_screlease_fn = mockSignalSubtractScRelease;
+    AmdExtTable.version.minor_id = sizeof(::AmdExtTable);
+    AmdExtTable.hsa_amd_signal_async_handler_fn = mockSignalAsyncHandler;
+  }
+
+  std::unique_ptr<DispatchCompletionNotifier> makeNotifier() {
+    return std::make_unique<DispatchCompletionNotifier>(
+        ApiTableContainer<::CoreApiTable>(CoreTable),
+        ApiTableContainer<::AmdExtTable>(AmdExtTable));
+  }
+};
+
+} // namespace
+
+TEST_F(DispatchCompletionNotifierTest, HandlerRunsBeforeOriginalSignal) {
+  auto Notifier = makeNotifier();
+  hsa_signal_t Original;
+  ASSERT_EQ(mockSignalCreate(1, 0, nullptr, &Original), HSA_STATUS_SUCCESS);
+
+  hsa_kernel_dispatch_packet_t Packet{};
+  Packet.completion_signal = Original;
+  ASSERT_FALSE(static_cast<bool>(Notifier->attach(Packet, [&] {
+    // The application must not observe the completion before the handler
+    // is done
+    EXPECT_EQ(SignalValues.at(Original.handle), 1);
+    Events.emplace_back("handler");
+  })));
+  ASSERT_NE(Packet.completion_signal.handle, Original.handle);
+  ASSERT_EQ(AsyncHandlers.size(), 1u);
+
+  completeDispatch(Packet.completion_signal);
+  ASSERT_EQ(Events.size(), 2u);
+  EXPECT_EQ(Events[0], "handler");
+  EXPECT_EQ(Events[1], "subtract " + std::to_string(Original.handle));
+  EXPECT_EQ(SignalValues.at(Original.handle), 0);
+  // The replacement signal is reset for reuse
+  EXPECT_EQ(SignalValues.at(Packet.completion_signal.handle), 1);
+
+  // Destroying the notifier destroys the replacement signal only
+  Notifier.reset();
+  EXPECT_EQ(SignalValues.size(), 1u);
+  EXPECT_TRUE(SignalValues.count(Original.handle));
+}
+
+TEST_F(DispatchCompletionNotifierTest, DispatchWithoutOriginalSignal) {
+  auto Notifier = makeNotifier();
+  hsa_kernel_dispatch_packet_t Packet{};
+  bool HandlerRan = false;
+  ASSERT_FALSE(static_cast<bool>(
+      Notifier->attach(Packet, [&] { HandlerRan = true; })));
+  ASSERT_NE(Packet.completion_signal.handle, 0u);
+  completeDispatch(Packet.completion_signal);
+  EXPECT_TRUE(HandlerRan);
+  // Nothing is forwarded to a zero signal
+  EXPECT_TRUE(Events.empty());
+}
+
+TEST_F(DispatchCompletionNotifierTest, ReplacementSignalsAreRecycled) {
+  auto Notifier = makeNotifier();
+  hsa_kernel_dispatch_packet_t First{}, Second{}, Third{};
+  unsigned NumHandlersRun = 0;
+  auto Handler = [&] { NumHandlersRun++; };
+
+  // Both dispatches are in flight at once, so each gets its own signal
+  ASSERT_FALSE(static_cast<bool>(Notifier->attach(First, Handler)));
+  ASSERT_FALSE(static_cast<bool>(Notifier->attach(Second, Handler)));
+  EXPECT_NE(First.completion_signal.handle, Second.completion_signal.handle);
+  EXPECT_EQ(NumSignalsCreated, 2u);
+
+  completeDispatch(Second.completion_signal);
+  ASSERT_FALSE(static_cast<bool>(Notifier->attach(Third, Handler)));
+  EXPECT_EQ(Third.completion_signal.handle, Second.completion_signal.handle);
+  EXPECT_EQ(NumSignalsCreated, 2u);
+
+  completeDispatch(First.completion_signal);
+  completeDispatch(Third.completion_signal);
+  EXPECT_EQ(NumHandlersRun, 3u);
+  Notifier->waitForPendingCompletions();
+  Notifier.reset();
+  EXPECT_TRUE(SignalValues.empty());
+}
+
+TEST_F(DispatchCompletionNotifierTest, FailedRegistrationLeavesPacketIntact) {
+  auto Notifier = makeNotifier();
+  hsa_kernel_dispatch_packet_t Packet{};
+  Packet.completion_signal.handle = 1234;
+  FailAsyncHandlerRegistration = true;
+  llvm::Error Err = Notifier->attach(Packet, [] {});
+  EXPECT_TRUE(static_cast<bool>(Err));
+  llvm::consumeError(std::move(Err));
+  EXPECT_EQ(Packet.completion_signal.handle, 1234u);
+  // The notifier must not wait on the failed attachment
+  Notifier->waitForPendingCompletions();
+  Notifier.reset();
+  EXPECT_TRUE(SignalValues.empty());
+}
@@ -0,0 +1,118 @@
+//===-- PacketBatchTest.cpp -----------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file tests the copy-on-edit behavior of \c luthier::hsa::PacketBatch.
+//===----------------------------------------------------------------------===//
+#include <gtest/gtest.h>
+#include <luthier/HSA/PacketBatch.h>
+#include <vector>
+
+using namespace luthier::hsa;
+
+namespace {
+
+/// Calls made to the writer, in order
+std::vector<std::pair<const void *, uint64_t>> Writes;
+
+void recordWrite(const void *Packets, uint64_t PacketCount) {
+  Writes.emplace_back(Packets, PacketCount);
+}
+
+std::vector<AqlPacket> makePackets() {
+  std::vector<AqlPacket> Packets(3);
+  for (auto &Packet : Packets)
+    Packet.Packet.Header = HSA_PACKET_TYPE_KERNEL_DISPATCH
+                           << HSA_PACKET_HEADER_TYPE;
+  Packets[1].Packet.Header = HSA_PACKET_TYPE_BARRIER_AND
+                             << HSA_PACKET_HEADER_TYPE;
+  return Packets;
+}
+
+} // namespace
+
+TEST(PacketBatchTest, UneditedBatchIsForwardedWithoutCopying) {
+  Writes.clear();
+  auto Packets = makePackets();
+  llvm::SmallVector<AqlPacket, 0> Scratch;
+  PacketBatch Batch(Packets, recordWrite, Scratch);
+  EXPECT_EQ(Batch.size(), 3u);
+  EXPECT_NE(Batch[0].asKernelDispatch(), nullptr);
+  EXPECT_EQ(Batch[1].asKernelDispatch(), nullptr);
+  Batch.submit();
+  EXPECT_FALSE(Batch.isEdited());
+  EXPECT_TRUE(Scratch.empty());
+  ASSERT_EQ(Writes.size(), 1u);
+  EXPECT_EQ(Writes[0].first, Packets.data());
+  EXPECT_EQ(Writes[0].second, 3u);
+  // Submitting twice does not write the batch again
+  Batch.submit();
+  EXPECT_EQ(Writes.size(), 1u);
+}
+
+TEST(PacketBatchTest, EditsAreWrittenFromTheScratchBuffer) {
+  Writes.clear();
+  auto Packets = makePackets();
+  llvm::SmallVector<AqlPacket, 0> Scratch;
+  PacketBatch Batch(Packets, recordWrite, Scratch);
+  Batch.edit(2).asKernelDispatch()->kernel_object = 0x1000;
+  Batch.edit(0).asKernelDispatch()->kernel_object = 0x2000;
+  EXPECT_TRUE(Batch.isEdited());
+  // The application's packets are left untouched
+  EXPECT_EQ(Packets[2].asKernelDispatch()->kernel_object, 0u);
+  EXPECT_EQ(Batch[2].asKernelDispatch()->kernel_object, 0x1000u);
+  Batch.submit();
+  ASSERT_EQ(Writes.size(), 1u);
+  EXPECT_EQ(Writes[0].first, Scratch.data());
+  EXPECT_EQ(Writes[0].second, 3u);
+  EXPECT_EQ(Scratch[0].asKernelDispatch()->kernel_object, 0x2000u);
+  EXPECT_NE(Scratch[1].asBarrierAnd(), nullptr);
+}
+
+TEST(PacketBatchTest, ScratchBufferIsReusedAcrossBatches) {
+  Writes.clear();
+  auto Packets = makePackets();
+  llvm::SmallVector<AqlPacket, 0> Scratch;
+  {
+    PacketBatch Batch(Packets, recordWrite, Scratch);
+    (void)Batch.edit();
+    Batch.submit();
+  }
+  const AqlPacket *ScratchData = Scratch.data();
+  {
+    PacketBatch Batch(llvm::ArrayRef<AqlPacket>(Packets).take_front(2),
+                      recordWrite, Scratch);
+    (void)Batch.edit();
+    Batch.submit();
+  }
+  EXPECT_EQ(Scratch.data(), ScratchData);
+  EXPECT_EQ(Scratch.size(), 2u);
+}
+
+TEST(PacketBatchTest, ExtraPacketsAreWrittenAroundTheBatch) {
+  Writes.clear();
+  auto Packets = makePackets();
+  AqlPacket Barrier{};
+  llvm::SmallVector<AqlPacket, 0> Scratch;
+  PacketBatch Batch(Packets, recordWrite, Scratch);
+  Batch.write(Barrier);
+  Batch.submit();
+  Batch.write(Barrier);
+  ASSERT_EQ(Writes.size(), 3u);
+  EXPECT_EQ(Writes[0].first, &Barrier);
+  EXPECT_EQ(Writes[1].first, Packets.data());
+  EXPECT_EQ(Writes[2].first, &Barrier);
+}
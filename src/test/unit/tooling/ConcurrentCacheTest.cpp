@@ -0,0 +1,217 @@
+//===-- ConcurrentCacheTest.cpp -------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file tests \c luthier::lookupOrCompute, the locking discipline of the
+/// target info and memoized ISA caches of the \c TargetManager, and of the
+/// lifted kernel, disassembled symbol and relocation caches of the
+/// \c CodeLifter, from several threads.
+//===----------------------------------------------------------------------===//
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <llvm/ADT/StringMap.h>
+#include <luthier/Common/ConcurrentCache.h>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace luthier;
+
+namespace {
+
+/// A cache with the same layout as the caches of the \c CodeLifter; Entries
+/// are owned through pointers, so that their address is stable
+class Cache {
+  std::shared_mutex Mutex;
+  std::unordered_map<int, std::unique_ptr<int>> Entries;
+
+public:
+  std::atomic<unsigned> NumComputed{0};
+  std::atomic<unsigned> NumDiscarded{0};
+
+  template <typename ComputeFnT>
+  llvm::Expected<int &> get(int Key, ComputeFnT &&Compute) {
+    return lookupOrCompute(
+        Mutex,
+        [&]() -> int * {
+          auto It = Entries.find(Key);
+          return It != Entries.end() ? It->second.get() : nullptr;
+        },
+        [&]() -> llvm::Expected<std::unique_ptr<int>> {
+          NumComputed++;
+          return Compute();
+        },
+        [&](std::unique_ptr<int> Entry) -> int & {
+          auto [It, Inserted] = Entries.try_emplace(Key, std::move(Entry));
+          if (!Inserted)
+            NumDiscarded++;
+          return *It->second;
+        });
+  }
+
+  size_t size() {
+    std::shared_lock Lock(Mutex);
+    return Entries.size();
+  }
+};
+
+} // namespace
+
+TEST(ConcurrentCacheTest, HitsDoNotRecompute) {
+  Cache C;
+  auto First = C.get(1, [] { return std::make_unique<int>(10); });
+  ASSERT_TRUE(static_cast<bool>(First));
+  auto Second = C.get(1, [] { return std::make_unique<int>(20); });
+  ASSERT_TRUE(static_cast<bool>(Second));
+  EXPECT_EQ(&*First, &*Second);
+  EXPECT_EQ(*Second, 10);
+  EXPECT_EQ(C.NumComputed, 1u);
+  EXPECT_EQ(C.size(), 1u);
+}
+
+TEST(ConcurrentCacheTest, ComputeErrorsAreNotCached) {
+  Cache C;
+  auto Failed = C.get(1, []() -> llvm::Expected<std::unique_ptr<int>> {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   "failed to compute the entry");
+  });
+  EXPECT_FALSE(static_cast<bool>(Failed));
+  llvm::consumeError(Failed.takeError());
+  EXPECT_EQ(C.size(), 0u);
+  // A later request computes the entry again
+  auto Retried = C.get(1, [] { return std::make_unique<int>(10); });
+  ASSERT_TRUE(static_cast<bool>(Retried));
+  EXPECT_EQ(*Retried, 10);
+  EXPECT_EQ(C.size(), 1u);
+}
+
+TEST(ConcurrentCacheTest, RacingMissesAgreeOnOneEntry) {
+  constexpr unsigned NumThreads = 16;
+  constexpr int NumKeys = 64;
+  Cache C;
+  std::atomic<bool> Start{false};
+  std::vector<std::vector<int *>> Seen(NumThreads);
+  std::vector<std::thread> Threads;
+  for (unsigned T = 0; T < NumThreads; ++T) {
+    Threads.emplace_back([&, T] {
+      while (!Start.load())
+        std::this_thread::yield();
+      for (int Key = 0; Key < NumKeys; ++Key) {
+        // Each thread computes a different value; Only one of them must
+        // make it into the cache
+        auto Entry = C.get(Key, [&] {
+          return std::make_unique<int>(Key * 1000 + static_cast<int>(T));
+        });
+        ASSERT_TRUE(static_cast<bool>(Entry));
+        Seen[T].push_back(&*Entry);
+      }
+    });
+  }
+  Start.store(true);
+  for (auto &Thread : Threads)
+    Thread.join();
+
+  EXPECT_EQ(C.size(), static_cast<size_t>(NumKeys));
+  // All threads got the same entry for each key
+  for (unsigned T = 1; T < NumThreads; ++T)
+    EXPECT_EQ(Seen[T], Seen[0]);
+  for (int Key = 0; Key < NumKeys; ++Key)
+    EXPECT_EQ(*Seen[0][Key] / 1000, Key);
+  // Every computed entry that did not make it into the cache was discarded
+  EXPECT_EQ(C.NumComputed - C.NumDiscarded, static_cast<unsigned>(NumKeys));
+}
+
+TEST(ConcurrentCacheTest, ComputeDoesNotHoldTheLock) {
+  Cache C;
+  std::atomic<bool> SlowComputeStarted{false};
+  std::atomic<bool> FastEntryInserted{false};
+  bool FastInsertedDuringSlowCompute{false};
+
+  // The slow entry waits for another entry to be inserted while it is being
+  // computed; If the lock were held during its computation, the insertion
+  // would block until the wait below times out
+  std::thread Slow([&] {
+    auto Entry = C.get(1, [&] {
+      SlowComputeStarted.store(true);
+      auto Deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds(5);
+      while (!FastEntryInserted.load() &&
+             std::chrono::steady_clock::now() < Deadline)
+        std::this_thread::yield();
+      FastInsertedDuringSlowCompute = FastEntryInserted.load();
+      return std::make_unique<int>(1);
+    });
+    ASSERT_TRUE(static_cast<bool>(Entry));
+  });
+  std::thread Fast([&] {
+    while (!SlowComputeStarted.load())
+      std::this_thread::yield();
+    auto Entry = C.get(2, [] { return std::make_unique<int>(2); });
+    ASSERT_TRUE(static_cast<bool>(Entry));
+    FastEntryInserted.store(true);
+  });
+  Slow.join();
+  Fast.join();
+
+  EXPECT_TRUE(FastInsertedDuringSlowCompute);
+  EXPECT_EQ(C.size(), 2u);
+}
+
+TEST(ConcurrentCacheTest, MemoizedLookupsComputeOncePerKey) {
+  // Same layout as the memoized ISA lookups of the TargetManager, where
+  // values are stored inline in a string map
+  constexpr unsigned NumThreads = 8;
+  std::shared_mutex Mutex;
+  llvm::StringMap<uint64_t> Memoized;
+  std::atomic<unsigned> NumComputed{0};
+  auto Get = [&](llvm::StringRef Key) {
+    return lookupOrCompute(
+        Mutex,
+        [&]() -> const uint64_t * {
+          auto It = Memoized.find(Key);
+          return It != Memoized.end() ? &It->second : nullptr;
+        },
+        [&]() -> llvm::Expected<uint64_t> {
+          NumComputed++;
+          return Key.size();
+        },
+        [&](uint64_t Computed) -> const uint64_t & {
+          return Memoized.try_emplace(Key, Computed).first->second;
+        });
+  };
+
+  std::vector<std::thread> Threads;
+  for (unsigned T = 0; T < NumThreads; ++T) {
+    Threads.emplace_back([&] {
+      for (llvm::StringRef Key : {"gfx908", "gfx90a:xnack+", "gfx942"}) {
+        auto Value = Get(Key);
+        ASSERT_TRUE(static_cast<bool>(Value));
+        EXPECT_EQ(*Value, Key.size());
+      }
+    });
+  }
+  for (auto &Thread : Threads)
+    Thread.join();
+  EXPECT_EQ(Memoized.size(), 3u);
+
+  // Once memoized, lookups do not compute anything
+  unsigned ComputedBefore = NumComputed;
+  for (unsigned I = 0; I < 100; ++I)
+    ASSERT_TRUE(static_cast<bool>(Get("gfx908")));
+  EXPECT_EQ(NumComputed, ComputedBefore);
+}
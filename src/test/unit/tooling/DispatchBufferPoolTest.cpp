@@ -0,0 +1,183 @@
+//===-- DispatchBufferPoolTest.cpp ----------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file tests the layout of the chunks of \c luthier::DispatchBufferPool,
+/// their reuse, and how buffers are handed back on dispatch completion,
+/// against mocked HSA API tables.
+//===----------------------------------------------------------------------===//
+#include <cstdlib>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <llvm/Support/Error.h>
+#include <luthier/Tooling/DispatchBufferPool.h>
+#include <numeric>
+#include <vector>
+
+using namespace luthier;
+
+namespace {
+
+void *allocate(uint64_t Size) { return std::aligned_alloc(64, Size); }
+
+void deallocate(void *Ptr) { std::free(Ptr); }
+
+/// Async handler registered by the last attach, and its argument
+hsa_amd_signal_handler LastHandler;
+
+void *LastHandlerArg;
+
+hsa_status_t mockSignalCreate(hsa_signal_value_t, uint32_t,
+                              const hsa_agent_t *, hsa_signal_t *Signal) {
+  static uint64_t NextHandle = 1;
+  Signal->handle = NextHandle++;
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t mockSignalDestroy(hsa_signal_t) { return HSA_STATUS_SUCCESS; }
+
+void mockSignalStoreRelaxed(hsa_signal_t, hsa_signal_value_t) {}
+
+void mockSignalSubtractScRelease(hsa_signal_t, hsa_signal_value_t) {}
+
+hsa_status_t mockSignalAsyncHandler(hsa_signal_t, hsa_signal_condition_t,
+                                    hsa_signal_value_t,
+                                    hsa_amd_signal_handler Handler,
+                                    void *Arg) {
+  LastHandler = Handler;
+  LastHandlerArg = Arg;
+  return HSA_STATUS_SUCCESS;
+}
+
+class DispatchBufferPoolTest : public ::testing::Test {
+protected:
+  ::CoreApiTable CoreTable{};
+  ::AmdExtTable AmdExtTable{};
+  std::unique_ptr<hsa::DispatchCompletionNotifier> Notifier;
+
+  void SetUp() override {
+    CoreTable.version.minor_id = sizeof(::CoreApiTable);
+    CoreTable.hsa_signal_create_fn = mockSignalCreate;
+    CoreTable.hsa_signal_destroy_fn = mockSignalDestroy;
+    CoreTable.hsa_signal_store_relaxed_fn = mockSignalStoreRelaxed;
+    CoreTable.hsa_signal_subtract_screlease_fn = mockSignalSubtractScRelease;
+    AmdExtTable.version.minor_id = sizeof(::AmdExtTable);
+    AmdExtTable.hsa_amd_signal_async_handler_fn = mockSignalAsyncHandler;
+    LastHandler = nullptr;
+    LastHandlerArg = nullptr;
+    Notifier = std::make_unique<hsa::DispatchCompletionNotifier>(
+        hsa::ApiTableContainer<::CoreApiTable>(CoreTable),
+        hsa::ApiTableContainer<::AmdExtTable>(AmdExtTable));
+  }
+
+  std::unique_ptr<DispatchBufferPool> makePool(uint64_t BufferSize) {
+    auto Pool =
+        DispatchBufferPool::create(BufferSize, *Notifier, allocate, deallocate);
+    EXPECT_TRUE(static_cast<bool>(Pool));
+    return std::move(*Pool);
+  }
+};
+
+} // namespace
+
+TEST_F(DispatchBufferPoolTest, RejectsEmptyBuffers) {
+  auto Pool = DispatchBufferPool::create(0, *Notifier, allocate, deallocate);
+  EXPECT_FALSE(static_cast<bool>(Pool));
+  llvm::consumeError(Pool.takeError());
+}
+
+TEST_F(DispatchBufferPoolTest, ChunkLayout) {
+  auto Pool = makePool(100);
+  std::vector<uint8_t> KernArgs(20);
+  std::iota(KernArgs.begin(), KernArgs.end(), 1);
+
+  auto Buffer = Pool->acquire(KernArgs.data(), KernArgs.size());
+  ASSERT_TRUE(static_cast<bool>(Buffer));
+  auto *Chunk = static_cast<uint8_t *>(Buffer->KernArgs);
+  // The original arguments come first
+  EXPECT_EQ(std::memcmp(Chunk, KernArgs.data(), KernArgs.size()), 0);
+  // Followed by the address of the buffer at the user argument offset
+  uint32_t UserOffset = getUserKernArgOffset(KernArgs.size());
+  EXPECT_EQ(UserOffset, 24u);
+  uint64_t StoredAddress;
+  std::memcpy(&StoredAddress, Chunk + UserOffset, sizeof(StoredAddress));
+  EXPECT_EQ(StoredAddress, reinterpret_cast<uint64_t>(Buffer->Data));
+  // The buffer itself is aligned, zeroed and fits inside the chunk
+  EXPECT_EQ((Buffer->Data - Chunk) % 64, 0);
+  EXPECT_GE(Buffer->Data - Chunk, UserOffset + 8);
+  EXPECT_LE(Buffer->Data - Chunk + 100, Buffer->ChunkSize);
+  for (uint64_t I = 0; I < 100; I++)
+    EXPECT_EQ(Buffer->Data[I], 0);
+  Pool->release(*Buffer);
+}
+
+TEST_F(DispatchBufferPoolTest, ReleasedChunksAreReused) {
+  auto Pool = makePool(64);
+  uint8_t KernArgs[16]{};
+  auto First = Pool->acquire(KernArgs, sizeof(KernArgs));
+  ASSERT_TRUE(static_cast<bool>(First));
+  // Leave some data behind; It must be cleared on reuse
+  First->Data[0] = 42;
+  Pool->release(*First);
+
+  auto Second = Pool->acquire(KernArgs, sizeof(KernArgs));
+  ASSERT_TRUE(static_cast<bool>(Second));
+  EXPECT_EQ(Second->KernArgs, First->KernArgs);
+  EXPECT_EQ(Second->Data[0], 0);
+  EXPECT_EQ(Pool->getNumChunks(), 1u);
+
+  // Kernels with larger arguments fall into a different bin
+  std::vector<uint8_t> LargeKernArgs(1024);
+  auto Third = Pool->acquire(LargeKernArgs.data(), LargeKernArgs.size());
+  ASSERT_TRUE(static_cast<bool>(Third));
+  EXPECT_NE(Third->KernArgs, Second->KernArgs);
+  EXPECT_EQ(Pool->getNumChunks(), 2u);
+  Pool->release(*Second);
+  Pool->release(*Third);
+}
+
+TEST_F(DispatchBufferPoolTest, BufferIsHandedBackOnCompletion) {
+  auto Pool = makePool(8);
+  uint64_t KernArgs[2] = {0xDEADBEEF, 0xCAFE};
+  hsa_kernel_dispatch_packet_t Packet{};
+  Packet.kernarg_address = KernArgs;
+
+  uint64_t Observed = 0;
+  ASSERT_FALSE(static_cast<bool>(Pool->attach(
+      Packet, sizeof(KernArgs), [&](llvm::ArrayRef<uint8_t> Buffer) {
+        ASSERT_EQ(Buffer.size(), 8u);
+        std::memcpy(&Observed, Buffer.data(), sizeof(Observed));
+      })));
+  ASSERT_NE(Packet.kernarg_address, static_cast<void *>(KernArgs));
+  ASSERT_NE(LastHandler, nullptr);
+
+  // Emulate the device incrementing a counter in the buffer
+  auto *ExtendedKernArgs = static_cast<uint64_t *>(Packet.kernarg_address);
+  EXPECT_EQ(ExtendedKernArgs[0], KernArgs[0]);
+  EXPECT_EQ(ExtendedKernArgs[1], KernArgs[1]);
+  auto *Counter = reinterpret_cast<uint64_t *>(ExtendedKernArgs[2]);
+  *Counter += 7;
+
+  EXPECT_FALSE(LastHandler(0, LastHandlerArg));
+  EXPECT_EQ(Observed, 7u);
+
+  // The chunk was returned to the pool
+  auto Buffer = Pool->acquire(KernArgs, sizeof(KernArgs));
+  ASSERT_TRUE(static_cast<bool>(Buffer));
+  EXPECT_EQ(Buffer->KernArgs, Packet.kernarg_address);
+  EXPECT_EQ(Pool->getNumChunks(), 1u);
+  Pool->release(*Buffer);
+}
@@ -0,0 +1,112 @@
+//===-- DispatchOverrideTableBenchmark.cpp --------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file implements a host-only microbenchmark of dispatch-time
+/// instrumented kernel lookups. It compares the lock-free dispatch override
+/// table against a baseline resembling the previous lookup path, which
+/// took a shared lock and looked up the preset by name in a per-kernel
+/// string map.
+//===----------------------------------------------------------------------===//
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#include <luthier/Tooling/DispatchOverrideTable.h>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+using namespace luthier;
+
+namespace {
+
+constexpr uint64_t NumKernels = 256;
+constexpr uint64_t NumLookupsPerThread = 1 << 22;
+
+uint64_t kernelObject(uint64_t I) { return 0x7f0000000000 + I * 64; }
+
+/// Baseline resembling the previous lookup path
+struct LockedStringMapLookup {
+  mutable std::shared_mutex Mutex;
+  llvm::DenseMap<uint64_t, llvm::StringMap<DispatchOverride>> Map;
+
+  const DispatchOverride *lookup(uint64_t KernelObject,
+                                 llvm::StringRef Preset) const {
+    std::shared_lock Lock(Mutex);
+    auto KernelIt = Map.find(KernelObject);
+    if (KernelIt == Map.end())
+      return nullptr;
+    auto PresetIt = KernelIt->second.find(Preset);
+    return PresetIt == KernelIt->second.end() ? nullptr : &PresetIt->second;
+  }
+};
+
+/// Runs \p Lookup on \p NumThreads threads, and returns the average time of
+/// a single lookup in nanoseconds
+template <typename LookupFunc>
+double measure(unsigned NumThreads, const LookupFunc &Lookup) {
+  std::vector<std::thread> Threads;
+  std::vector<uint64_t> Checksums(NumThreads);
+  auto Start = std::chrono::steady_clock::now();
+  for (unsigned T = 0; T < NumThreads; ++T) {
+    Threads.emplace_back([&, T]() {
+      uint64_t Checksum = 0;
+      for (uint64_t I = 0; I < NumLookupsPerThread; ++I)
+        Checksum += Lookup(kernelObject((I * 31 + T) % NumKernels));
+      Checksums[T] = Checksum;
+    });
+  }
+  for (auto &Thread : Threads)
+    Thread.join();
+  auto Elapsed = std::chrono::steady_clock::now() - Start;
+  uint64_t Checksum = 0;
+  for (uint64_t C : Checksums)
+    Checksum += C;
+  if (Checksum == 0)
+    std::fprintf(stderr, "Lookups did not find any overrides.\n");
+  return std::chrono::duration<double, std::nano>(Elapsed).count() /
+         NumLookupsPerThread;
+}
+
+} // namespace
+
+int main() {
+  DispatchOverrideTable Table;
+  LockedStringMapLookup Baseline;
+  for (uint64_t I = 0; I < NumKernels; ++I) {
+    DispatchOverride Override{kernelObject(I) + 0x100000000, 1024, 0};
+    Table.insert(kernelObject(I), 0, Override);
+    Baseline.Map[kernelObject(I)]["memory-trace"] = Override;
+  }
+
+  std::printf("%-10s %24s %24s\n", "threads", "locked string map (ns)",
+              "override table (ns)");
+  unsigned MaxThreads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned NumThreads = 1; NumThreads <= MaxThreads; NumThreads *= 2) {
+    double BaselineNs = measure(NumThreads, [&](uint64_t KernelObject) {
+      const auto *Override = Baseline.lookup(KernelObject, "memory-trace");
+      return Override ? Override->InstrumentedKernelObject : 0;
+    });
+    double TableNs = measure(NumThreads, [&](uint64_t KernelObject) {
+      auto Override = Table.lookup(KernelObject, 0);
+      return Override ? Override->InstrumentedKernelObject : 0;
+    });
+    std::printf("%-10u %24.2f %24.2f\n", NumThreads, BaselineNs, TableNs);
+  }
+  return 0;
+}
@@ -0,0 +1,116 @@
+//===-- DispatchOverrideTableTest.cpp -------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file tests the dispatch override table, including lock-free lookups
+/// racing with insertions that grow the table.
+//===----------------------------------------------------------------------===//
+#include <atomic>
+#include <gtest/gtest.h>
+#include <luthier/Tooling/DispatchOverrideTable.h>
+#include <thread>
+#include <vector>
+
+using namespace luthier;
+
+namespace {
+
+uint64_t kernelObject(uint64_t I) { return 0x7f0000000000 + I * 64; }
+
+DispatchOverride overrideFor(uint64_t I, InstrumentationPresetID Preset) {
+  return {kernelObject(I) + 0x100000000 * (Preset + 1),
+          static_cast<uint32_t>(I), Preset};
+}
+
+} // namespace
+
+TEST(DispatchOverrideTableTest, InsertLookupErase) {
+  DispatchOverrideTable Table(4);
+  EXPECT_FALSE(Table.lookup(kernelObject(0), 0).has_value());
+  for (uint64_t I = 0; I < 100; ++I) {
+    EXPECT_TRUE(Table.insert(kernelObject(I), 0, overrideFor(I, 0)));
+    EXPECT_TRUE(Table.insert(kernelObject(I), 1, overrideFor(I, 1)));
+  }
+  // Duplicates are rejected and do not replace the existing entry
+  EXPECT_FALSE(Table.insert(kernelObject(3), 0, overrideFor(4, 0)));
+  EXPECT_EQ(Table.size(), 200u);
+  for (uint64_t I = 0; I < 100; ++I) {
+    for (InstrumentationPresetID Preset : {0u, 1u}) {
+      auto Override = Table.lookup(kernelObject(I), Preset);
+      ASSERT_TRUE(Override.has_value());
+      EXPECT_EQ(Override->InstrumentedKernelObject,
+                overrideFor(I, Preset).InstrumentedKernelObject);
+      EXPECT_EQ(Override->PrivateSegmentSize, I);
+      EXPECT_EQ(Override->GroupSegmentSizeIncrease, Preset);
+    }
+  }
+  EXPECT_FALSE(Table.lookup(kernelObject(3), 2).has_value());
+
+  // Erasing a kernel removes its entries under all presets
+  EXPECT_EQ(Table.erase(kernelObject(7)), 2u);
+  EXPECT_FALSE(Table.lookup(kernelObject(7), 0).has_value());
+  EXPECT_FALSE(Table.lookup(kernelObject(7), 1).has_value());
+  EXPECT_TRUE(Table.lookup(kernelObject(8), 1).has_value());
+  EXPECT_EQ(Table.size(), 198u);
+  // The kernel can be instrumented again after being erased
+  EXPECT_TRUE(Table.insert(kernelObject(7), 0, overrideFor(7, 0)));
+  EXPECT_TRUE(Table.lookup(kernelObject(7), 0).has_value());
+}
+
+TEST(DispatchOverrideTableTest, TombstonesDoNotFillTheTable) {
+  DispatchOverrideTable Table(8);
+  // Repeatedly inserting and erasing must keep probes terminating
+  for (uint64_t I = 0; I < 1000; ++I) {
+    ASSERT_TRUE(Table.insert(kernelObject(I), 0, overrideFor(I, 0)));
+    ASSERT_EQ(Table.erase(kernelObject(I)), 1u);
+    ASSERT_FALSE(Table.lookup(kernelObject(I), 0).has_value());
+  }
+  EXPECT_EQ(Table.size(), 0u);
+}
+
+TEST(DispatchOverrideTableTest, LookupsRaceWithGrowingInsertions) {
+  constexpr uint64_t NumKernels = 4096;
+  constexpr int NumReaders = 4;
+  DispatchOverrideTable Table(2);
+  std::atomic<uint64_t> NumPublished{0};
+  std::atomic<bool> Failed{false};
+
+  std::vector<std::thread> Readers;
+  for (int R = 0; R < NumReaders; ++R) {
+    Readers.emplace_back([&]() {
+      while (NumPublished.load(std::memory_order_acquire) < NumKernels) {
+        // Every kernel published before the load must be visible, with its
+        // contents intact
+        uint64_t Published = NumPublished.load(std::memory_order_acquire);
+        for (uint64_t I = 0; I < Published; I += 7) {
+          auto Override = Table.lookup(kernelObject(I), 0);
+          if (!Override.has_value() ||
+              Override->InstrumentedKernelObject !=
+                  overrideFor(I, 0).InstrumentedKernelObject)
+            Failed.store(true);
+        }
+      }
+    });
+  }
+  for (uint64_t I = 0; I < NumKernels; ++I) {
+    Table.insert(kernelObject(I), 0, overrideFor(I, 0));
+    NumPublished.store(I + 1, std::memory_order_release);
+  }
+  for (auto &Reader : Readers)
+    Reader.join();
+  EXPECT_FALSE(Failed.load());
+  EXPECT_EQ(Table.size(), NumKernels);
+}
@@ -0,0 +1,220 @@
+//===-- DispatchSamplerTest.cpp -------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file tests the dispatch sampling policies of the dispatch sampler.
+//===----------------------------------------------------------------------===//
+#include "ExpectedTestHelpers.h"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/Error.h>
+#include <luthier/Tooling/DispatchSampler.h>
+#include <thread>
+#include <vector>
+
+using namespace luthier;
+
+namespace {
+
+constexpr uint64_t KernelA = 0x1000;
+constexpr uint64_t KernelB = 0x2000;
+
+hsa_kernel_dispatch_packet_t makePacket(uint64_t KernelObject,
+                                        uint32_t GridSizeX = 1) {
+  hsa_kernel_dispatch_packet_t Packet{};
+  Packet.kernel_object = KernelObject;
+  Packet.grid_size_x = GridSizeX;
+  return Packet;
+}
+
+std::unique_ptr<DispatchSampler>
+createSampler(DispatchSamplingPolicy Policy,
+              DispatchSampler::ClockFunc Clock =
+                  std::chrono::steady_clock::now) {
+  return valueOrFail(DispatchSampler::create(std::move(Policy), Clock));
+}
+
+} // namespace
+
+TEST(DispatchSamplerTest, InvalidPoliciesAreRejected) {
+  auto EveryZeroth =
+      DispatchSampler::create(DispatchSamplingPolicy::everyNth(0));
+  EXPECT_FALSE(static_cast<bool>(EveryZeroth));
+  llvm::consumeError(EveryZeroth.takeError());
+
+  auto EmptyWindow = DispatchSampler::create(
+      DispatchSamplingPolicy::timeBudget(1, std::chrono::nanoseconds(0)));
+  EXPECT_FALSE(static_cast<bool>(EmptyWindow));
+  llvm::consumeError(EmptyWindow.takeError());
+
+  auto NoPredicate =
+      DispatchSampler::create(DispatchSamplingPolicy::predicate(nullptr));
+  EXPECT_FALSE(static_cast<bool>(NoPredicate));
+  llvm::consumeError(NoPredicate.takeError());
+}
+
+TEST(DispatchSamplerTest, EveryNthIsCountedPerKernel) {
+  auto Sampler = createSampler(DispatchSamplingPolicy::everyNth(3));
+  ASSERT_NE(Sampler, nullptr);
+  std::vector<bool> SampledA;
+  for (int I = 0; I < 7; ++I) {
+    SampledA.push_back(Sampler->sample(makePacket(KernelA)));
+    // Interleaved dispatches of another kernel must not shift the period
+    Sampler->sample(makePacket(KernelB));
+  }
+  EXPECT_EQ(SampledA, (std::vector<bool>{true, false, false, true, false,
+                                         false, true}));
+  auto Counts = Sampler->getCounts(KernelA);
+  EXPECT_EQ(Counts.NumDispatches, 7u);
+  EXPECT_EQ(Counts.NumSampled, 3u);
+}
+
+TEST(DispatchSamplerTest, FirstKStopsSampling) {
+  auto Sampler = createSampler(DispatchSamplingPolicy::firstK(2));
+  ASSERT_NE(Sampler, nullptr);
+  EXPECT_TRUE(Sampler->sample(makePacket(KernelA)));
+  EXPECT_TRUE(Sampler->sample(makePacket(KernelA)));
+  EXPECT_FALSE(Sampler->sample(makePacket(KernelA)));
+  EXPECT_TRUE(Sampler->sample(makePacket(KernelB)));
+  EXPECT_EQ(Sampler->getCounts(KernelA).NumSampled, 2u);
+  EXPECT_EQ(Sampler->getCounts(KernelA).NumDispatches, 3u);
+  EXPECT_EQ(Sampler->getCounts(KernelB).NumSampled, 1u);
+}
+
+TEST(DispatchSamplerTest, TimeBudgetResetsEveryWindow) {
+  std::chrono::steady_clock::time_point Now{};
+  auto Sampler = createSampler(
+      DispatchSamplingPolicy::timeBudget(2, std::chrono::milliseconds(10)),
+      [&]() { return Now; });
+  ASSERT_NE(Sampler, nullptr);
+  EXPECT_TRUE(Sampler->sample(makePacket(KernelA)));
+  Now += std::chrono::milliseconds(1);
+  EXPECT_TRUE(Sampler->sample(makePacket(KernelA)));
+  Now += std::chrono::milliseconds(1);
+  EXPECT_FALSE(Sampler->sample(makePacket(KernelA)));
+  // Another kernel has its own budget
+  EXPECT_TRUE(Sampler->sample(makePacket(KernelB)));
+  Now += std::chrono::milliseconds(10);
+  EXPECT_TRUE(Sampler->sample(makePacket(KernelA)));
+  auto Counts = Sampler->getCounts(KernelA);
+  EXPECT_EQ(Counts.NumDispatches, 4u);
+  EXPECT_EQ(Counts.NumSampled, 3u);
+}
+
+TEST(DispatchSamplerTest, PredicateSeesThePacket) {
+  auto Sampler =
+      createSampler(DispatchSamplingPolicy::predicate(
+          [](const hsa_kernel_dispatch_packet_t &Packet) {
+            return Packet.grid_size_x >= 1024;
+          }));
+  ASSERT_NE(Sampler, nullptr);
+  EXPECT_FALSE(Sampler->sample(makePacket(KernelA, 64)));
+  EXPECT_TRUE(Sampler->sample(makePacket(KernelA, 4096)));
+  EXPECT_EQ(Sampler->getCounts(KernelA).NumDispatches, 2u);
+  EXPECT_EQ(Sampler->getCounts(KernelA).NumSampled, 1u);
+}
+
+TEST(DispatchSamplerTest, CountsAreExtrapolated) {
+  DispatchSampleCounts Counts{100, 25};
+  EXPECT_DOUBLE_EQ(Counts.extrapolate(50.0), 200.0);
+  EXPECT_DOUBLE_EQ(DispatchSampleCounts{}.extrapolate(50.0), 0.0);
+
+  auto Sampler = createSampler(DispatchSamplingPolicy::all());
+  ASSERT_NE(Sampler, nullptr);
+  EXPECT_EQ(Sampler->getCounts(KernelA).NumDispatches, 0u);
+  Sampler->sample(makePacket(KernelA));
+  Sampler->sample(makePacket(KernelB));
+  Sampler->sample(makePacket(KernelB));
+  llvm::DenseMap<uint64_t, DispatchSampleCounts> Seen;
+  Sampler->forEachKernel(
+      [&](uint64_t KernelObject, const DispatchSampleCounts &C) {
+        Seen[KernelObject] = C;
+      });
+  ASSERT_EQ(Seen.size(), 2u);
+  EXPECT_EQ(Seen[KernelA].NumSampled, 1u);
+  EXPECT_EQ(Seen[KernelB].NumDispatches, 2u);
+}
+
+TEST(DispatchSamplerTest, ConcurrentSamplingKeepsExactCounts) {
+  constexpr int NumThreads = 8;
+  constexpr int NumDispatchesPerThread = 1000;
+  auto Sampler = createSampler(DispatchSamplingPolicy::everyNth(4));
+  ASSERT_NE(Sampler, nullptr);
+  std::vector<std::thread> Threads;
+  for (int T = 0; T < NumThreads; ++T) {
+    Threads.emplace_back([&]() {
+      for (int I = 0; I < NumDispatchesPerThread; ++I)
+        Sampler->sample(makePacket(KernelA));
+    });
+  }
+  for (auto &Thread : Threads)
+    Thread.join();
+  auto Counts = Sampler->getCounts(KernelA);
+  EXPECT_EQ(Counts.NumDispatches, NumThreads * NumDispatchesPerThread);
+  EXPECT_EQ(Counts.NumSampled, NumThreads * NumDispatchesPerThread / 4);
+}
+
+TEST(DispatchSamplerTest, ConcurrentTimeBudgetIsNeverExceeded) {
+  constexpr int NumThreads = 8;
+  constexpr uint64_t NumKernels = 2000;
+  constexpr int NumRoundsPerKernel = 4;
+  constexpr uint64_t Budget = 2;
+  constexpr auto Window = std::chrono::milliseconds(10);
+  // The clock only moves when the test moves it, so that every dispatch of a
+  // phase falls into the same window
+  std::atomic<int64_t> ElapsedNs{0};
+  auto Sampler = createSampler(
+      DispatchSamplingPolicy::timeBudget(Budget, Window), [&]() {
+        return std::chrono::steady_clock::time_point(
+            std::chrono::nanoseconds(ElapsedNs.load()));
+      });
+  ASSERT_NE(Sampler, nullptr);
+  // All threads walk the kernels in the same order, so that they race on the
+  // first dispatches of each kernel
+  auto DispatchConcurrently = [&]() {
+    std::atomic<bool> Start{false};
+    std::vector<std::thread> Threads;
+    for (int T = 0; T < NumThreads; ++T) {
+      Threads.emplace_back([&]() {
+        while (!Start.load())
+          std::this_thread::yield();
+        for (uint64_t K = 1; K <= NumKernels; ++K)
+          for (int I = 0; I < NumRoundsPerKernel; ++I)
+            Sampler->sample(makePacket(K));
+      });
+    }
+    Start.store(true);
+    for (auto &Thread : Threads)
+      Thread.join();
+  };
+
+  // A racing first dispatch must not reset a window another dispatch has
+  // already consumed, which would let more dispatches through than the
+  // budget
+  DispatchConcurrently();
+  for (uint64_t K = 1; K <= NumKernels; ++K) {
+    auto Counts = Sampler->getCounts(K);
+    EXPECT_EQ(Counts.NumDispatches, NumThreads * NumRoundsPerKernel);
+    EXPECT_EQ(Counts.NumSampled, Budget) << "kernel " << K;
+  }
+
+  // Each new window gets exactly one budget
+  ElapsedNs += std::chrono::nanoseconds(Window).count();
+  DispatchConcurrently();
+  for (uint64_t K = 1; K <= NumKernels; ++K)
+    EXPECT_EQ(Sampler->getCounts(K).NumSampled, 2 * Budget) << "kernel " << K;
+}
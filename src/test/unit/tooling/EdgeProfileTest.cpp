@@ -0,0 +1,179 @@
+//===-- EdgeProfileTest.cpp -----------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file tests edge profiling counter placement and the reconstruction
+/// of block execution counts on synthetic control flow graphs.
+//===----------------------------------------------------------------------===//
+#include "ExpectedTestHelpers.h"
+#include <gtest/gtest.h>
+#include <llvm/Support/Error.h>
+#include <luthier/Tooling/EdgeProfile.h>
+#include <random>
+
+using namespace luthier;
+
+namespace {
+
+EdgeCounterPlacement place(unsigned NumBlocks,
+                           llvm::ArrayRef<ProfileEdge> Edges,
+                           llvm::ArrayRef<unsigned> ExitBlocks) {
+  return valueOrFail(placeEdgeCounters(NumBlocks, 0, Edges, ExitBlocks));
+}
+
+/// Executes the CFG \p Times times with random walks from the entry block to
+/// an exit block
+/// \return the execution count of every edge of \p Placement
+llvm::SmallVector<uint64_t> simulate(const EdgeCounterPlacement &Placement,
+                                     unsigned Times, std::mt19937_64 &Rng) {
+  llvm::SmallVector<uint64_t> EdgeCounts(Placement.Edges.size(), 0);
+  // Edges leaving each block, including the exit edges
+  llvm::SmallVector<llvm::SmallVector<unsigned, 2>> OutEdges(
+      Placement.NumBlocks);
+  for (size_t I = 0; I + 1 < Placement.Edges.size(); ++I)
+    OutEdges[Placement.Edges[I].Src].push_back(I);
+  unsigned Entry = Placement.Edges.back().Dst;
+  for (unsigned Run = 0; Run < Times; ++Run) {
+    ++EdgeCounts.back();
+    unsigned Block = Entry;
+    while (Block != Placement.NumBlocks) {
+      auto &Choices = OutEdges[Block];
+      unsigned EdgeIdx = Choices[Rng() % Choices.size()];
+      ++EdgeCounts[EdgeIdx];
+      Block = Placement.Edges[EdgeIdx].Dst;
+    }
+  }
+  return EdgeCounts;
+}
+
+/// \return the counter values of \p Placement given the execution count of
+/// every edge
+llvm::SmallVector<uint64_t> readCounters(const EdgeCounterPlacement &Placement,
+                                         llvm::ArrayRef<uint64_t> EdgeCounts) {
+  llvm::SmallVector<uint64_t> Out;
+  for (unsigned EdgeIdx : Placement.CounterEdges)
+    Out.push_back(EdgeCounts[EdgeIdx]);
+  return Out;
+}
+
+/// \return the execution count of every block given the execution count of
+/// every edge
+llvm::SmallVector<uint64_t>
+blockCountsOf(const EdgeCounterPlacement &Placement,
+              llvm::ArrayRef<uint64_t> EdgeCounts) {
+  llvm::SmallVector<uint64_t> Out(Placement.NumBlocks, 0);
+  for (size_t I = 0; I < Placement.Edges.size(); ++I) {
+    if (!Placement.isExitEdge(Placement.Edges[I]))
+      Out[Placement.Edges[I].Dst] += EdgeCounts[I];
+  }
+  return Out;
+}
+
+/// Checks that the block and edge counts reconstructed from the counters of
+/// \p Placement match the ones of a simulated execution
+void expectExactReconstruction(const EdgeCounterPlacement &Placement,
+                               std::mt19937_64 &Rng) {
+  auto EdgeCounts = simulate(Placement, 100, Rng);
+  auto Counters = readCounters(Placement, EdgeCounts);
+  auto Reconstructed = reconstructEdgeCounts(Placement, Counters);
+  ASSERT_TRUE(static_cast<bool>(Reconstructed))
+      << llvm::toString(Reconstructed.takeError());
+  EXPECT_EQ(*Reconstructed, EdgeCounts);
+  auto BlockCounts = reconstructBlockCounts(Placement, Counters);
+  ASSERT_TRUE(static_cast<bool>(BlockCounts))
+      << llvm::toString(BlockCounts.takeError());
+  EXPECT_EQ(*BlockCounts, blockCountsOf(Placement, EdgeCounts));
+}
+
+} // namespace
+
+TEST(EdgeProfileTest, StraightLineCodeNeedsOneCounter) {
+  // The only counter measures how many times the function is entered
+  auto Placement = place(3, {{0, 1}, {1, 2}}, {2});
+  ASSERT_EQ(Placement.CounterEdges.size(), 1u);
+  auto BlockCounts = reconstructBlockCounts(Placement, {42});
+  ASSERT_TRUE(static_cast<bool>(BlockCounts));
+  EXPECT_EQ(*BlockCounts, (llvm::SmallVector<uint64_t>{42, 42, 42}));
+}
+
+TEST(EdgeProfileTest, DiamondNeedsTwoCounters) {
+  // Block 0 branches to blocks 1 and 2, which both jump to block 3;
+  // Per-block counting would need four counters
+  auto Placement = place(4, {{0, 1}, {0, 2}, {1, 3}, {2, 3}}, {3});
+  ASSERT_EQ(Placement.CounterEdges.size(), 2u);
+  // The virtual edge from the exit to the entry is never instrumented
+  for (unsigned EdgeIdx : Placement.CounterEdges)
+    EXPECT_NE(EdgeIdx, Placement.Edges.size() - 1);
+  std::mt19937_64 Rng(1);
+  expectExactReconstruction(Placement, Rng);
+}
+
+TEST(EdgeProfileTest, FrequentEdgesDontCarryCounters) {
+  // A loop whose back edge is much more frequent than its exit edge
+  auto Placement = place(3, {{0, 1}, {1, 1, 1}, {1, 2, 1}, {2, 1, 100}}, {2});
+  for (unsigned EdgeIdx : Placement.CounterEdges)
+    EXPECT_NE(EdgeIdx, 3u);
+  std::mt19937_64 Rng(2);
+  expectExactReconstruction(Placement, Rng);
+}
+
+TEST(EdgeProfileTest, MultipleExitsAreSolved) {
+  auto Placement = place(4, {{0, 1}, {0, 2}, {1, 3}, {2, 3}, {1, 0}}, {2, 3});
+  std::mt19937_64 Rng(3);
+  expectExactReconstruction(Placement, Rng);
+}
+
+TEST(EdgeProfileTest, InconsistentCountersAreReported) {
+  auto Placement = place(4, {{0, 1}, {0, 2}, {1, 3}, {2, 3}}, {3});
+  // More executions of the first branch of the diamond than of the function
+  // itself are not possible
+  Placement.CounterEdges = {0, 4};
+  auto EdgeCounts = reconstructEdgeCounts(Placement, {10, 5});
+  EXPECT_FALSE(static_cast<bool>(EdgeCounts));
+  llvm::consumeError(EdgeCounts.takeError());
+}
+
+TEST(EdgeProfileTest, OutOfRangeBlocksAreRejected) {
+  auto PlacementOrErr = placeEdgeCounters(2, 0, {{0, 2}}, {1});
+  EXPECT_FALSE(static_cast<bool>(PlacementOrErr));
+  llvm::consumeError(PlacementOrErr.takeError());
+}
+
+TEST(EdgeProfileTest, RandomizedCFGsAreReconstructedExactly) {
+  std::mt19937_64 Rng(7);
+  for (int Round = 0; Round < 100; ++Round) {
+    unsigned NumBlocks = 2 + Rng() % 30;
+    // A chain through all blocks keeps every block reachable and able to
+    // reach the exit; Extra edges add branches and loops
+    llvm::SmallVector<ProfileEdge> Edges;
+    for (unsigned B = 0; B + 1 < NumBlocks; ++B)
+      Edges.push_back({B, B + 1, 1 + Rng() % 8});
+    for (unsigned I = 0; I < NumBlocks / 2; ++I) {
+      unsigned Src = Rng() % (NumBlocks - 1);
+      unsigned Dst = Rng() % NumBlocks;
+      if (llvm::none_of(Edges, [&](const ProfileEdge &E) {
+            return E.Src == Src && E.Dst == Dst;
+          }))
+        Edges.push_back({Src, Dst, 1 + Rng() % 8});
+    }
+    auto Placement = place(NumBlocks, Edges, {NumBlocks - 1});
+    // Edges (including the virtual ones) minus the nodes of the spanning
+    // tree (including the virtual exit) plus one
+    EXPECT_EQ(Placement.CounterEdges.size(),
+              Placement.Edges.size() - (NumBlocks + 1) + 1);
+    expectExactReconstruction(Placement, Rng);
+  }
+}
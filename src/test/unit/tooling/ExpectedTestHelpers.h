@@ -0,0 +1,41 @@
+//===-- ExpectedTestHelpers.h -----------------------------------*- C++ -*-===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file defines helpers shared by the tooling unit tests for unwrapping
+/// the \c llvm::Expected values returned by the code under test.
+//===----------------------------------------------------------------------===//
+#ifndef LUTHIER_TEST_UNIT_TOOLING_EXPECTED_TEST_HELPERS_H
+#define LUTHIER_TEST_UNIT_TOOLING_EXPECTED_TEST_HELPERS_H
+#include <gtest/gtest.h>
+#include <llvm/Support/Error.h>
+
+namespace luthier {
+
+/// \return the value held by \p ValOrErr; If it holds an error instead, fails
+/// the current test with the error's message and returns a
+/// default-constructed value, so that callers can keep checking it
+template <typename T> T valueOrFail(llvm::Expected<T> ValOrErr) {
+  if (auto Err = ValOrErr.takeError()) {
+    ADD_FAILURE() << llvm::toString(std::move(Err));
+    return T{};
+  }
+  return std::move(*ValOrErr);
+}
+
+} // namespace luthier
+
+#endif
@@ -0,0 +1,134 @@
+//===-- KeyedObjectPoolTest.cpp -------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file tests the \c KeyedObjectPool backing the target machine pool of
+/// the \c TargetManager, including objects borrowed and returned from several
+/// threads.
+//===----------------------------------------------------------------------===//
+#include <atomic>
+#include <gtest/gtest.h>
+#include <luthier/Common/KeyedObjectPool.h>
+#include <thread>
+#include <vector>
+
+using namespace luthier;
+
+namespace {
+
+/// Stands in for a target machine; Keeps track of how many instances are
+/// alive, and whether it is currently borrowed
+struct PooledObject {
+  static std::atomic<int> NumAlive;
+
+  std::atomic<bool> Borrowed{false};
+
+  PooledObject() { NumAlive++; }
+
+  ~PooledObject() { NumAlive--; }
+};
+
+std::atomic<int> PooledObject::NumAlive{0};
+
+} // namespace
+
+TEST(KeyedObjectPoolTest, ObjectsAreReusedPerKey) {
+  KeyedObjectPool<int, PooledObject> Pool(4);
+  EXPECT_EQ(Pool.take(0), nullptr);
+
+  auto First = std::make_unique<PooledObject>();
+  auto Second = std::make_unique<PooledObject>();
+  auto *FirstPtr = First.get();
+  auto *SecondPtr = Second.get();
+  EXPECT_TRUE(Pool.put(0, std::move(First)));
+  EXPECT_TRUE(Pool.put(0, std::move(Second)));
+  EXPECT_EQ(Pool.getNumIdle(0), 2u);
+  EXPECT_EQ(Pool.getNumIdle(1), 0u);
+
+  // Objects of other keys are never handed out
+  EXPECT_EQ(Pool.take(1), nullptr);
+  // The most recently returned object is reused first
+  auto Taken = Pool.take(0);
+  EXPECT_EQ(Taken.get(), SecondPtr);
+  Taken = Pool.take(0);
+  EXPECT_EQ(Taken.get(), FirstPtr);
+  EXPECT_EQ(Pool.take(0), nullptr);
+}
+
+TEST(KeyedObjectPoolTest, FullPoolsDestroyReturnedObjects) {
+  int AliveBefore = PooledObject::NumAlive;
+  {
+    KeyedObjectPool<int, PooledObject> Pool(2);
+    EXPECT_TRUE(Pool.put(0, std::make_unique<PooledObject>()));
+    EXPECT_TRUE(Pool.put(0, std::make_unique<PooledObject>()));
+    EXPECT_FALSE(Pool.put(0, std::make_unique<PooledObject>()));
+    EXPECT_EQ(Pool.getNumIdle(0), 2u);
+    EXPECT_EQ(PooledObject::NumAlive, AliveBefore + 2);
+    // The limit applies to each key separately
+    EXPECT_TRUE(Pool.put(1, std::make_unique<PooledObject>()));
+    EXPECT_EQ(PooledObject::NumAlive, AliveBefore + 3);
+
+    Pool.clear();
+    EXPECT_EQ(Pool.getNumIdle(0), 0u);
+    EXPECT_EQ(PooledObject::NumAlive, AliveBefore);
+    EXPECT_TRUE(Pool.put(0, std::make_unique<PooledObject>()));
+  }
+  // Idle objects are destroyed with the pool
+  EXPECT_EQ(PooledObject::NumAlive, AliveBefore);
+}
+
+TEST(KeyedObjectPoolTest, ConcurrentBorrowersNeverShareAnObject) {
+  constexpr unsigned NumThreads = 16;
+  constexpr unsigned NumIterations = 2000;
+  constexpr unsigned MaxIdlePerKey = 4;
+  int AliveBefore = PooledObject::NumAlive;
+  KeyedObjectPool<int, PooledObject> Pool(MaxIdlePerKey);
+  std::atomic<bool> Start{false};
+  std::atomic<unsigned> NumShared{0};
+  std::atomic<unsigned> NumCreated{0};
+  std::vector<std::thread> Threads;
+  for (unsigned T = 0; T < NumThreads; ++T) {
+    Threads.emplace_back([&, T] {
+      while (!Start.load())
+        std::this_thread::yield();
+      for (unsigned I = 0; I < NumIterations; ++I) {
+        int Key = static_cast<int>((T + I) % 2);
+        auto Object = Pool.take(Key);
+        if (Object == nullptr) {
+          Object = std::make_unique<PooledObject>();
+          NumCreated++;
+        }
+        if (Object->Borrowed.exchange(true))
+          NumShared++;
+        std::this_thread::yield();
+        Object->Borrowed.store(false);
+        Pool.put(Key, std::move(Object));
+      }
+    });
+  }
+  Start.store(true);
+  for (auto &Thread : Threads)
+    Thread.join();
+
+  EXPECT_EQ(NumShared, 0u);
+  // Objects are reused instead of being created on every borrow
+  EXPECT_LT(NumCreated, NumThreads * NumIterations);
+  // Every object that is still alive is idle in the pool, within its limit
+  EXPECT_LE(Pool.getNumIdle(0), MaxIdlePerKey);
+  EXPECT_LE(Pool.getNumIdle(1), MaxIdlePerKey);
+  EXPECT_EQ(static_cast<size_t>(PooledObject::NumAlive - AliveBefore),
+            Pool.getNumIdle(0) + Pool.getNumIdle(1));
+}
@@ -0,0 +1,154 @@
+//===-- MemoryAddressTest.cpp ---------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file tests the effective address computation of memory access hooks
+/// against addresses computed by hand for each addressing mode.
+//===----------------------------------------------------------------------===//
+#include <gtest/gtest.h>
+#include <luthier/address.h>
+
+using namespace luthier;
+
+namespace {
+
+/// Operands of a single memory access, as passed to a memory access hook
+struct Operands {
+  uint32_t VAddr0{0};
+  uint32_t VAddr1{0};
+  uint32_t SBase0{0};
+  uint32_t SBase1{0};
+  uint32_t SOffset{0};
+  int32_t Offset{0};
+
+  [[nodiscard]] uint64_t compute(MemoryAddressingMode Mode) const {
+    return computeEffectiveAddress(Mode, VAddr0, VAddr1, SBase0, SBase1,
+                                   SOffset, Offset);
+  }
+};
+
+} // namespace
+
+TEST(MemoryAddressTest, Flat) {
+  Operands Ops;
+  Ops.VAddr0 = 0x3456'789A;
+  Ops.VAddr1 = 0x7F12;
+  EXPECT_EQ(Ops.compute(MEM_ADDR_FLAT), 0x7F12'3456'789AULL);
+  Ops.Offset = 16;
+  EXPECT_EQ(Ops.compute(MEM_ADDR_FLAT), 0x7F12'3456'78AAULL);
+  Ops.Offset = -16;
+  EXPECT_EQ(Ops.compute(MEM_ADDR_FLAT), 0x7F12'3456'788AULL);
+  Ops.Offset = 4095;
+  EXPECT_EQ(Ops.compute(MEM_ADDR_FLAT), 0x7F12'3456'8899ULL);
+  Ops.Offset = -4096;
+  EXPECT_EQ(Ops.compute(MEM_ADDR_FLAT), 0x7F12'3456'689AULL);
+  // The offset carries into the upper half of the address
+  Ops.VAddr0 = 0xFFFF'FFF8;
+  Ops.VAddr1 = 0x7F00;
+  Ops.Offset = 16;
+  EXPECT_EQ(Ops.compute(MEM_ADDR_FLAT), 0x7F01'0000'0008ULL);
+}
+
+TEST(MemoryAddressTest, GlobalWithScalarBase) {
+  Operands Ops;
+  Ops.SBase0 = 0xFFFF'0000;
+  Ops.SBase1 = 0x7F00'0000;
+  // The vector offset is unsigned, and carries into the upper half of the
+  // base
+  Ops.VAddr0 = 0x0002'0000;
+  Ops.Offset = -8;
+  EXPECT_EQ(Ops.compute(MEM_ADDR_GLOBAL_SADDR), 0x7F00'0001'0000'FFF8ULL);
+  Ops.SBase0 = 0;
+  Ops.SBase1 = 0x1000;
+  Ops.VAddr0 = 0xFFFF'FFFF;
+  Ops.Offset = 0;
+  EXPECT_EQ(Ops.compute(MEM_ADDR_GLOBAL_SADDR), 0x1000'FFFF'FFFFULL);
+}
+
+TEST(MemoryAddressTest, ScratchWrapsAroundThePrivateSegment) {
+  Operands Ops;
+  Ops.VAddr0 = 0x100;
+  Ops.SBase0 = 0x20;
+  Ops.Offset = -0x10;
+  EXPECT_EQ(Ops.compute(MEM_ADDR_SCRATCH), 0x110u);
+  Ops.VAddr0 = 0xFFFF'FFF0;
+  Ops.SBase0 = 0;
+  Ops.Offset = 0x20;
+  EXPECT_EQ(Ops.compute(MEM_ADDR_SCRATCH), 0x10u);
+}
+
+TEST(MemoryAddressTest, BufferModes) {
+  Operands Ops;
+  // Base address 0x7F00'1234'5000 and a stride of 48 bytes
+  Ops.SBase0 = 0x1234'5000;
+  Ops.SBase1 = 0x0030'7F00;
+  Ops.SOffset = 0x40;
+  Ops.Offset = 12;
+  Ops.VAddr0 = 7;
+  Ops.VAddr1 = 0x300;
+  // The stride must not leak into the base address
+  EXPECT_EQ(Ops.compute(MEM_ADDR_BUFFER), 0x7F00'1234'504CULL);
+  EXPECT_EQ(Ops.compute(MEM_ADDR_BUFFER_OFFEN), 0x7F00'1234'534CULL);
+  // Element 7 is 7 * 48 = 0x150 bytes into the buffer
+  EXPECT_EQ(Ops.compute(MEM_ADDR_BUFFER_IDXEN), 0x7F00'1234'519CULL);
+  EXPECT_EQ(Ops.compute(MEM_ADDR_BUFFER_BOTHEN), 0x7F00'1234'549CULL);
+}
+
+TEST(MemoryAddressTest, BufferWithLargestFields) {
+  Operands Ops;
+  // Base address 0xFFFF'FFFF'F000 and the largest stride, 0x3FFF bytes
+  Ops.SBase0 = 0xFFFF'F000;
+  Ops.SBase1 = 0x3FFF'FFFF;
+  Ops.SOffset = 0xFFF;
+  Ops.Offset = 0xFFF;
+  Ops.VAddr0 = 2;
+  Ops.VAddr1 = 0x10;
+  // Buffer offsets are unsigned, and carry past the 48 bits of the base
+  EXPECT_EQ(Ops.compute(MEM_ADDR_BUFFER), 0x1'0000'0000'0FFEULL);
+  EXPECT_EQ(Ops.compute(MEM_ADDR_BUFFER_BOTHEN), 0x1'0000'0000'900CULL);
+}
+
+TEST(MemoryAddressTest, SwizzledBuffersYieldZero) {
+  Operands Ops;
+  Ops.SBase0 = 0x1234'5000;
+  Ops.SOffset = 0x40;
+  Ops.VAddr0 = 7;
+  Ops.VAddr1 = 0x300;
+  for (uint32_t SwizzleBits : {0x8000'0000U, 0x4000'0000U, 0xC000'0000U}) {
+    Ops.SBase1 = SwizzleBits | 0x0030'7F00;
+    EXPECT_TRUE(isBufferResourceSwizzled(Ops.SBase1));
+    EXPECT_EQ(Ops.compute(MEM_ADDR_BUFFER), 0u);
+    EXPECT_EQ(Ops.compute(MEM_ADDR_BUFFER_OFFEN), 0u);
+    EXPECT_EQ(Ops.compute(MEM_ADDR_BUFFER_IDXEN), 0u);
+    EXPECT_EQ(Ops.compute(MEM_ADDR_BUFFER_BOTHEN), 0u);
+  }
+  // Swizzling only applies to buffer resources
+  Ops.SBase1 = 0x8000'7F00;
+  EXPECT_EQ(Ops.compute(MEM_ADDR_GLOBAL_SADDR), 0x8000'7F00'1234'5007ULL);
+}
+
+TEST(MemoryAddressTest, Lds) {
+  Operands Ops;
+  Ops.VAddr0 = 0x200;
+  Ops.Offset = 0xFFFF;
+  EXPECT_EQ(Ops.compute(MEM_ADDR_LDS), 0x1'01FFu);
+}
+
+TEST(MemoryAddressTest, InvalidModesYieldZero) {
+  Operands Ops;
+  Ops.VAddr0 = 0x1234;
+  EXPECT_EQ(Ops.compute(static_cast<MemoryAddressingMode>(100)), 0u);
+}
@@ -0,0 +1,156 @@
+//===-- MockAMDGPULoaderConcurrencyTest.cpp -------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file includes a multi-threaded stress test that loads the same code
+/// object using many independent \c MockAMDGPULoader instances at once, the
+/// same way concurrent instrumentation requests of independent kernels feed
+/// their code objects to the tooling pipeline.
+//===----------------------------------------------------------------------===//
+#include <amd_comgr/amd_comgr.h>
+#include <atomic>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Error.h>
+#include <luthier/Comgr/Comgr.h>
+#include <luthier/Tooling/MockAMDGPULoader.h>
+#include <thread>
+
+static constexpr const char *Isa = "amdgcn-amd-amdhsa--gfx908";
+
+static constexpr const char *KernelSource = R"(
+  .amdgcn_target "amdgcn-amd-amdhsa--gfx908"
+  .text
+  .globl counter_kernel
+  .p2align 8
+  .type counter_kernel,@function
+counter_kernel:
+  s_getpc_b64 s[4:5]
+  s_add_u32 s4, s4, counter@rel32@lo+4
+  s_addc_u32 s5, s5, counter@rel32@hi+12
+  v_mov_b32 v0, 0
+  v_mov_b32 v1, 1
+  global_atomic_add v0, v1, s[4:5]
+  s_endpgm
+.Lfunc_end0:
+  .size counter_kernel, .Lfunc_end0-counter_kernel
+
+  .protected counter
+  .type counter,@object
+  .bss
+  .globl counter
+  .p2align 2
+counter:
+  .long 0
+  .size counter, 4
+
+  .rodata
+  .p2align 6
+  .amdhsa_kernel counter_kernel
+    .amdhsa_next_free_vgpr 2
+    .amdhsa_next_free_sgpr 6
+  .end_amdhsa_kernel
+)";
+
+/// Assembles \c KernelSource and links it into an executable code object
+static llvm::Error assembleAndLink(llvm::SmallVectorImpl<char> &Executable) {
+  amd_comgr_data_set_t Input, Output;
+  amd_comgr_data_t Source;
+  amd_comgr_action_info_t Action;
+  if (amd_comgr_create_data_set(&Input) != AMD_COMGR_STATUS_SUCCESS ||
+      amd_comgr_create_data_set(&Output) != AMD_COMGR_STATUS_SUCCESS ||
+      amd_comgr_create_data(AMD_COMGR_DATA_KIND_SOURCE, &Source) !=
+          AMD_COMGR_STATUS_SUCCESS ||
+      amd_comgr_set_data(Source, strlen(KernelSource), KernelSource) !=
+          AMD_COMGR_STATUS_SUCCESS ||
+      amd_comgr_set_data_name(Source, "source.s") !=
+          AMD_COMGR_STATUS_SUCCESS ||
+      amd_comgr_data_set_add(Input, Source) != AMD_COMGR_STATUS_SUCCESS ||
+      amd_comgr_create_action_info(&Action) != AMD_COMGR_STATUS_SUCCESS ||
+      amd_comgr_action_info_set_isa_name(Action, Isa) !=
+          AMD_COMGR_STATUS_SUCCESS ||
+      amd_comgr_do_action(AMD_COMGR_ACTION_ASSEMBLE_SOURCE_TO_RELOCATABLE,
+                          Action, Input, Output) != AMD_COMGR_STATUS_SUCCESS)
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   "Failed to assemble the test kernel");
+
+  amd_comgr_data_t Relocatable;
+  size_t Size;
+  if (amd_comgr_action_data_get_data(
+          Output, AMD_COMGR_DATA_KIND_RELOCATABLE, 0, &Relocatable) !=
+          AMD_COMGR_STATUS_SUCCESS ||
+      amd_comgr_get_data(Relocatable, &Size, nullptr) !=
+          AMD_COMGR_STATUS_SUCCESS)
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   "Failed to get the assembled kernel");
+  llvm::SmallVector<char> RelocatableBytes(Size);
+  if (amd_comgr_get_data(Relocatable, &Size, RelocatableBytes.data()) !=
+      AMD_COMGR_STATUS_SUCCESS)
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   "Failed to get the assembled kernel");
+
+  (void)amd_comgr_release_data(Relocatable);
+  (void)amd_comgr_release_data(Source);
+  (void)amd_comgr_destroy_data_set(Input);
+  (void)amd_comgr_destroy_data_set(Output);
+  (void)amd_comgr_destroy_action_info(Action);
+
+  return luthier::comgr::linkRelocatableToExecutable(RelocatableBytes,
+                                                     Executable);
+}
+
+/// Loads and finalizes the same code object in many independent loaders at
+/// once; All loaders must succeed, and each must resolve the relocations
+/// against its own copy of the loaded code object
+TEST(LuthierToolingTests, ConcurrentIndependentMockLoaders) {
+  llvm::SmallVector<char> Executable;
+  ASSERT_FALSE(llvm::errorToBool(assembleAndLink(Executable)));
+  llvm::ArrayRef<std::byte> CodeObject(
+      reinterpret_cast<const std::byte *>(Executable.data()),
+      Executable.size());
+
+  constexpr unsigned NumThreads = 16;
+  constexpr unsigned NumIterations = 64;
+  std::atomic<unsigned> NumFailures{0};
+  std::atomic<size_t> LoadedSize{0};
+
+  llvm::SmallVector<std::thread, NumThreads> Threads;
+  for (unsigned I = 0; I < NumThreads; ++I) {
+    Threads.emplace_back([&]() {
+      for (unsigned J = 0; J < NumIterations; ++J) {
+        luthier::MockAMDGPULoader Loader;
+        auto LCO = Loader.loadCodeObject(CodeObject);
+        if (llvm::errorToBool(LCO.takeError()) ||
+            llvm::errorToBool(Loader.finalize())) {
+          NumFailures++;
+          continue;
+        }
+        // Every loader must lay out the code object the same way
+        size_t Size = LCO->getLoadedRegion().size();
+        size_t Expected = 0;
+        if (!LoadedSize.compare_exchange_strong(Expected, Size) &&
+            Expected != Size)
+          NumFailures++;
+      }
+    });
+  }
+  for (auto &Thread : Threads)
+    Thread.join();
+
+  EXPECT_EQ(NumFailures.load(), 0u);
+  EXPECT_NE(LoadedSize.load(), 0u);
+}
@@ -0,0 +1,169 @@
+//===-- PatchLayoutTest.cpp -----------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file tests the per-instrumentation point patch layout planning.
+//===----------------------------------------------------------------------===//
+#include "ExpectedTestHelpers.h"
+#include <gtest/gtest.h>
+#include <luthier/Tooling/PatchLayout.h>
+#include <random>
+
+using namespace luthier;
+
+namespace {
+
+llvm::SmallVector<PatchType> plan(llvm::ArrayRef<PatchSite> Sites,
+                                  llvm::ArrayRef<PatchBranch> Branches,
+                                  uint64_t FunctionSize, uint64_t BranchRange,
+                                  bool OutlineAll = false) {
+  return valueOrFail(
+      planPatchLayout(Sites, Branches, FunctionSize, BranchRange, OutlineAll));
+}
+
+/// Lays out the function after patching it with \p Types, and checks that
+/// every branch and every short jump to an outlined payload is in range
+void expectInRange(llvm::ArrayRef<PatchSite> Sites,
+                   llvm::ArrayRef<PatchBranch> Branches,
+                   llvm::ArrayRef<PatchType> Types, uint64_t FunctionSize,
+                   uint64_t BranchRange) {
+  ASSERT_EQ(Sites.size(), Types.size());
+  auto InPlace = [&](size_t I) {
+    return Types[I] == INLINE    ? Sites[I].PayloadSize
+           : Types[I] == OUTLINE ? ShortJumpSize
+                                 : LongJumpSize;
+  };
+  // Patched offset of the instruction at unpatched offset O
+  auto Patched = [&](uint64_t O, bool IncludeSitesAtO) {
+    uint64_t Out = O;
+    for (size_t I = 0; I < Sites.size(); ++I) {
+      if (Sites[I].Offset < O || (IncludeSitesAtO && Sites[I].Offset == O))
+        Out += InPlace(I);
+    }
+    return Out;
+  };
+  for (const PatchBranch &Branch : Branches) {
+    uint64_t From = Patched(Branch.Offset, true);
+    uint64_t To = Patched(Branch.TargetOffset, false);
+    EXPECT_LE(From > To ? From - To : To - From, BranchRange)
+        << "Branch at " << Branch.Offset << " is out of range";
+  }
+  uint64_t OutlinedBegin = Patched(FunctionSize, true);
+  for (size_t I = 0; I < Sites.size(); ++I) {
+    if (Types[I] == INLINE)
+      continue;
+    uint64_t OutlinedEnd = OutlinedBegin + Sites[I].PayloadSize + InPlace(I);
+    if (Types[I] == OUTLINE) {
+      EXPECT_LE(OutlinedEnd - Patched(Sites[I].Offset, false), BranchRange)
+          << "Short jump of site " << I << " is out of range";
+    }
+    OutlinedBegin = OutlinedEnd;
+  }
+}
+
+} // namespace
+
+TEST(PatchLayoutTest, PayloadsAreInlinedWhenBranchesStayInRange) {
+  llvm::SmallVector<PatchSite> Sites{{100, 64}, {200, 128}, {300, 64}};
+  llvm::SmallVector<PatchBranch> Branches{{400, 0}, {50, 350}};
+  EXPECT_EQ(plan(Sites, Branches, 500, 1000),
+            (llvm::SmallVector<PatchType>{INLINE, INLINE, INLINE}));
+}
+
+TEST(PatchLayoutTest, OutlineAllOutlinesEveryPayload) {
+  llvm::SmallVector<PatchSite> Sites{{100, 64}, {200, 128}};
+  EXPECT_EQ(plan(Sites, {}, 300, 1 << 17, true),
+            (llvm::SmallVector<PatchType>{OUTLINE, OUTLINE}));
+}
+
+TEST(PatchLayoutTest, OnlyTheLargestPayloadsOfAnOutOfRangeRegionAreOutlined) {
+  // A loop around the whole function, with a large payload in the middle
+  llvm::SmallVector<PatchSite> Sites{{200, 100}, {400, 3200}, {600, 200}};
+  llvm::SmallVector<PatchBranch> Branches{{990, 10}};
+  auto Types = plan(Sites, Branches, 1000, 4100);
+  EXPECT_EQ(Types, (llvm::SmallVector<PatchType>{INLINE, OUTLINE, INLINE}));
+  expectInRange(Sites, Branches, Types, 1000, 4100);
+}
+
+TEST(PatchLayoutTest, PayloadsOutsideTheBranchRegionStayInline) {
+  // The payload of the branch itself is placed before the branch, and the
+  // payload of the target is placed after the label being jumped to
+  llvm::SmallVector<PatchSite> Sites{{100, 10000}, {500, 1000}, {800, 10000}};
+  llvm::SmallVector<PatchBranch> Branches{{100, 800}};
+  auto Types = plan(Sites, Branches, 1000, 1000);
+  ASSERT_EQ(Types.size(), 3u);
+  EXPECT_EQ(Types[0], INLINE);
+  EXPECT_NE(Types[1], INLINE);
+  EXPECT_EQ(Types[2], INLINE);
+  expectInRange(Sites, Branches, Types, 1000, 1000);
+}
+
+TEST(PatchLayoutTest, FarOutlinedPayloadsUseLongJumps) {
+  // The payload at 500 has to be outlined, but the end of the function is
+  // out of short jump range after inlining the payload at 800
+  llvm::SmallVector<PatchSite> Sites{{500, 1000}, {800, 10000}};
+  llvm::SmallVector<PatchBranch> Branches{{100, 700}};
+  auto Types = plan(Sites, Branches, 1000, 1000);
+  EXPECT_EQ(Types, (llvm::SmallVector<PatchType>{OUTLINE_LONG, INLINE}));
+  expectInRange(Sites, Branches, Types, 1000, 1000);
+}
+
+TEST(PatchLayoutTest, FunctionsLargerThanTheBranchRangeArePatched) {
+  // Every payload is far from the end of the function
+  llvm::SmallVector<PatchSite> Sites{{0, 64}, {1 << 20, 64}};
+  auto Types = plan(Sites, {}, 1 << 21, 1 << 17, true);
+  EXPECT_EQ(Types, (llvm::SmallVector<PatchType>{OUTLINE_LONG, OUTLINE_LONG}));
+}
+
+TEST(PatchLayoutTest, UnreachableBranchesAreReported) {
+  // Payloads smaller than a jump cannot be outlined to shrink the region
+  llvm::SmallVector<PatchSite> Sites{{4, 4}, {8, 4}};
+  llvm::SmallVector<PatchBranch> Branches{{12, 0}};
+  auto TypesOrErr = planPatchLayout(Sites, Branches, 16, 12);
+  EXPECT_FALSE(static_cast<bool>(TypesOrErr));
+  llvm::consumeError(TypesOrErr.takeError());
+}
+
+TEST(PatchLayoutTest, UnsortedSitesAreRejected) {
+  llvm::SmallVector<PatchSite> Sites{{8, 4}, {4, 4}};
+  auto TypesOrErr = planPatchLayout(Sites, {}, 16, 1 << 17);
+  EXPECT_FALSE(static_cast<bool>(TypesOrErr));
+  llvm::consumeError(TypesOrErr.takeError());
+}
+
+TEST(PatchLayoutTest, RandomizedLayoutsKeepEveryJumpInRange) {
+  std::mt19937_64 Rng(7);
+  constexpr uint64_t FunctionSize = 1 << 16;
+  constexpr uint64_t BranchRange = 1 << 14;
+  for (int Round = 0; Round < 100; ++Round) {
+    llvm::SmallVector<PatchSite> Sites;
+    for (uint64_t Offset = 0; Offset < FunctionSize;
+         Offset += 4 * (1 + Rng() % 256))
+      Sites.push_back({Offset, 4 * (1 + Rng() % 512)});
+    // Branches of the original code are always in range
+    llvm::SmallVector<PatchBranch> Branches;
+    for (int I = 0; I < 32; ++I) {
+      uint64_t From = 4 * (Rng() % (FunctionSize / 4));
+      uint64_t Dist = 4 * (Rng() % (BranchRange / 16));
+      uint64_t To = (Rng() & 1) && From >= Dist
+                        ? From - Dist
+                        : std::min(From + Dist, FunctionSize - 4);
+      Branches.push_back({From, To});
+    }
+    auto Types = plan(Sites, Branches, FunctionSize, BranchRange);
+    expectInRange(Sites, Branches, Types, FunctionSize, BranchRange);
+  }
+}
@@ -0,0 +1,136 @@
+//===-- ResourceUsageTest.cpp ---------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file tests the kernel resource usage and occupancy calculations on
+/// synthetic kernel descriptors.
+//===----------------------------------------------------------------------===//
+#include "ExpectedTestHelpers.h"
+#include <gtest/gtest.h>
+#include <luthier/Tooling/ResourceUsage.h>
+
+using namespace luthier;
+
+namespace {
+
+OccupancyTarget getTarget(llvm::StringRef Processor,
+                          unsigned WavefrontSize = 64) {
+  return valueOrFail(OccupancyTarget::get(Processor, WavefrontSize));
+}
+
+KernelResourceUsage usage(unsigned NumVGPRs, unsigned NumAGPRs = 0,
+                          unsigned NumSGPRs = 16,
+                          uint32_t GroupSegmentSize = 0) {
+  return {NumVGPRs, NumAGPRs, NumSGPRs, 0, GroupSegmentSize};
+}
+
+} // namespace
+
+TEST(ResourceUsageTest, VGPRsLimitOccupancy) {
+  auto Target = getTarget("gfx906");
+  EXPECT_EQ(computeWavesPerSIMD(usage(24), Target, 64), 10u);
+  EXPECT_EQ(computeWavesPerSIMD(usage(32), Target, 64), 8u);
+  // 33 VGPRs are allocated as 36
+  EXPECT_EQ(computeWavesPerSIMD(usage(33), Target, 64), 7u);
+  EXPECT_EQ(computeWavesPerSIMD(usage(256), Target, 64), 1u);
+}
+
+TEST(ResourceUsageTest, SGPRsLimitOccupancyBeforeGFX10) {
+  // 102 SGPRs are allocated as 112
+  EXPECT_EQ(computeWavesPerSIMD(usage(4, 0, 102), getTarget("gfx906"), 64),
+            7u);
+  EXPECT_EQ(
+      computeWavesPerSIMD(usage(4, 0, 106), getTarget("gfx1030", 32), 64),
+      16u);
+}
+
+TEST(ResourceUsageTest, AGPRsShareTheRegisterFileOnGFX90A) {
+  // 30 VGPRs rounded up to 32, followed by 64 AGPRs
+  EXPECT_EQ(computeWavesPerSIMD(usage(30, 64), getTarget("gfx90a"), 64), 5u);
+  // AGPRs have their own register file on GFX908
+  EXPECT_EQ(computeWavesPerSIMD(usage(40, 128), getTarget("gfx908"), 64), 2u);
+}
+
+TEST(ResourceUsageTest, LDSLimitsOccupancy) {
+  auto Target = getTarget("gfx906");
+  // Two workgroups of four wavefronts per CU
+  EXPECT_EQ(computeWavesPerSIMD(usage(4, 0, 16, 32768), Target, 256), 2u);
+  // A workgroup which doesn't fit on a CU can't run at all
+  EXPECT_EQ(computeWavesPerSIMD(usage(4, 0, 16, 65537), Target, 256), 0u);
+}
+
+TEST(ResourceUsageTest, Wave32VGPRGranules) {
+  auto Target = getTarget("gfx1030", 32);
+  EXPECT_EQ(computeWavesPerSIMD(usage(64), Target, 32), 16u);
+  // 100 VGPRs are allocated as 112
+  EXPECT_EQ(computeWavesPerSIMD(usage(100), Target, 32), 9u);
+  // 100 VGPRs are allocated as 120 on targets with 1.5x VGPRs
+  EXPECT_EQ(computeWavesPerSIMD(usage(100), getTarget("gfx1100", 32), 32),
+            12u);
+}
+
+TEST(ResourceUsageTest, GranulatedCountsAreDecoded) {
+  auto Usage = decodeKernelResourceUsage(3, 5, 16, 1024, getTarget("gfx90a"));
+  EXPECT_EQ(Usage.NumVGPRs, 32u);
+  EXPECT_EQ(Usage.NumSGPRs, 48u);
+  EXPECT_EQ(Usage.PrivateSegmentSize, 16u);
+  EXPECT_EQ(Usage.GroupSegmentSize, 1024u);
+  // GFX10+ kernel descriptors don't encode the SGPR count
+  EXPECT_EQ(decodeKernelResourceUsage(3, 5, 0, 0, getTarget("gfx1030", 64))
+                .NumSGPRs,
+            0u);
+}
+
+TEST(ResourceUsageTest, MetadataCountsAreRead) {
+  // The metadata VGPR count of GFX90A already includes the AGPRs: 30 VGPRs
+  // rounded up to 32, followed by 64 AGPRs
+  auto Target = getTarget("gfx90a");
+  auto Usage = readKernelResourceUsage(96, 64, 16, 0, 0, Target);
+  EXPECT_EQ(Usage.NumVGPRs, 32u);
+  EXPECT_EQ(Usage.NumAGPRs, 64u);
+  EXPECT_EQ(computeWavesPerSIMD(Usage, Target, 64), 5u);
+  // Kernels without AGPRs are unaffected
+  Usage = readKernelResourceUsage(32, 0, 16, 0, 0, Target);
+  EXPECT_EQ(computeWavesPerSIMD(Usage, Target, 64), 8u);
+  // AGPRs are counted separately on GFX908
+  Usage = readKernelResourceUsage(40, 128, 16, 0, 0, getTarget("gfx908"));
+  EXPECT_EQ(Usage.NumVGPRs, 40u);
+  EXPECT_EQ(computeWavesPerSIMD(Usage, getTarget("gfx908"), 64), 2u);
+}
+
+TEST(ResourceUsageTest, BudgetGuardsOccupancyDrop) {
+  auto Report = computeResourceUsageReport(usage(32), usage(48),
+                                           getTarget("gfx906"), 256);
+  EXPECT_EQ(Report.OriginalWavesPerSIMD, 8u);
+  EXPECT_EQ(Report.InstrumentedWavesPerSIMD, 5u);
+  EXPECT_EQ(Report.getOccupancyDrop(), 3u);
+
+  EXPECT_FALSE(static_cast<bool>(checkOccupancyBudget(Report, {})));
+  EXPECT_FALSE(static_cast<bool>(checkOccupancyBudget(Report, {3})));
+  auto Err = checkOccupancyBudget(Report, {2});
+  EXPECT_TRUE(static_cast<bool>(Err));
+  llvm::consumeError(std::move(Err));
+}
+
+TEST(ResourceUsageTest, UnsupportedTargetsAreRejected) {
+  for (auto [Processor, WavefrontSize] :
+       {std::pair{"gfx803", 64u}, {"sm_80", 32u}, {"gfx906", 32u},
+        {"gfx90a", 16u}}) {
+    auto TargetOrErr = OccupancyTarget::get(Processor, WavefrontSize);
+    EXPECT_FALSE(static_cast<bool>(TargetOrErr)) << Processor;
+    llvm::consumeError(TargetOrErr.takeError());
+  }
+}
@@ -0,0 +1,336 @@
+//===-- TraceBufferTest.cpp -----------------------------------------------===//
+// Copyright 2022-2025 @ Northeastern University Computer Architecture Lab
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// This file tests the host side of trace buffers and their drain thread
+/// against a simulated producer, which follows the same protocol as the
+/// device-side \c luthier::traceAppend.
+//===----------------------------------------------------------------------===//
+#include "ExpectedTestHelpers.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Error.h>
+#include <luthier/Tooling/TraceBuffer.h>
+#include <mutex>
+#include <thread>
+
+using namespace luthier;
+
+namespace {
+
+struct TestRecord {
+  uint64_t ProducerID;
+  uint64_t Sequence;
+  /// Complement of \c Sequence; A record mixing the fields of two writers
+  /// fails to match it
+  uint64_t Check;
+};
+
+TestRecord makeRecord(uint64_t ProducerID, uint64_t Sequence) {
+  return {ProducerID, Sequence, ~Sequence};
+}
+
+void *allocate(uint64_t Size) { return std::aligned_alloc(64, Size); }
+
+void deallocate(void *Ptr) { std::free(Ptr); }
+
+std::unique_ptr<TraceBuffer> createBuffer(uint32_t Capacity,
+                                          TraceBufferOverflowPolicy Policy) {
+  return valueOrFail(TraceBuffer::create(Capacity, sizeof(TestRecord), Policy,
+                                         allocate, deallocate));
+}
+
+/// \return the tag of the slot \p Slot of the buffer of \p Header
+uint64_t *getSlotTag(TraceBufferHeader &Header, uint64_t Slot) {
+  return reinterpret_cast<uint64_t *>(
+      reinterpret_cast<uint8_t *>(&Header) + TraceBufferSlotsOffset +
+      (Slot & (Header.Capacity - 1)) *
+          (TraceBufferSlotTagSize + Header.RecordSize));
+}
+
+/// Claims the slot \p Slot for writing its record, the same way as
+/// \c luthier::traceAppend
+/// \return \c false if a later record already claimed the slot
+bool claimSlot(TraceBufferHeader &Header, uint64_t Slot) {
+  std::atomic_ref Tag(*getSlotTag(Header, Slot));
+  const uint64_t WritingTag = getTraceSlotWritingTag(Slot);
+  uint64_t CurrentTag = Tag.load(std::memory_order_relaxed);
+  do {
+    if (CurrentTag >= WritingTag)
+      return false;
+  } while (!Tag.compare_exchange_weak(CurrentTag, WritingTag,
+                                      std::memory_order_relaxed));
+  std::atomic_thread_fence(std::memory_order_release);
+  return true;
+}
+
+/// Publishes the record of the claimed slot \p Slot, unless a later record
+/// claimed it meanwhile
+void publishSlot(TraceBufferHeader &Header, uint64_t Slot) {
+  uint64_t ExpectedTag = getTraceSlotWritingTag(Slot);
+  std::atomic_ref(*getSlotTag(Header, Slot))
+      .compare_exchange_strong(ExpectedTag, getTraceSlotPublishedTag(Slot),
+                               std::memory_order_release,
+                               std::memory_order_relaxed);
+}
+
+/// Appends the \p Records as a single wavefront would, with each record
+/// coming from a separate active lane
+void simulateWavefrontAppend(TraceBufferHeader &Header,
+                             llvm::ArrayRef<TestRecord> Records) {
+  const uint64_t Capacity = Header.Capacity;
+  std::atomic_ref WriteIndex(Header.WriteIndex);
+  std::atomic_ref ReadIndex(Header.ReadIndex);
+  if (Header.OverflowPolicy == TRACE_BUFFER_DROP_NEWEST &&
+      WriteIndex.load(std::memory_order_relaxed) -
+              ReadIndex.load(std::memory_order_relaxed) >=
+          Capacity) {
+    std::atomic_ref(Header.NumDropped)
+        .fetch_add(Records.size(), std::memory_order_relaxed);
+    return;
+  }
+  // A single atomic reserves the slots of the entire wavefront
+  uint64_t FirstSlot =
+      WriteIndex.fetch_add(Records.size(), std::memory_order_relaxed);
+  for (size_t Lane = 0; Lane < Records.size(); ++Lane) {
+    uint64_t Slot = FirstSlot + Lane;
+    if (Header.OverflowPolicy != TRACE_BUFFER_OVERWRITE_OLDEST) {
+      while (Slot - ReadIndex.load(std::memory_order_acquire) >= Capacity)
+        std::this_thread::yield();
+    }
+    if (!claimSlot(Header, Slot))
+      continue;
+    std::memcpy(getSlotTag(Header, Slot) + 1, &Records[Lane],
+                sizeof(TestRecord));
+    publishSlot(Header, Slot);
+  }
+}
+
+TestRecord toRecord(llvm::ArrayRef<uint8_t> Bytes) {
+  TestRecord Out;
+  EXPECT_EQ(Bytes.size(), sizeof(TestRecord));
+  std::memcpy(&Out, Bytes.data(), sizeof(TestRecord));
+  return Out;
+}
+
+} // namespace
+
+TEST(TraceBufferTest, RejectsInvalidParameters) {
+  auto NotPowerOfTwo = TraceBuffer::create(
+      48, sizeof(TestRecord), TRACE_BUFFER_BLOCK, allocate, deallocate);
+  EXPECT_FALSE(static_cast<bool>(NotPowerOfTwo));
+  llvm::consumeError(NotPowerOfTwo.takeError());
+
+  auto UnalignedRecord =
+      TraceBuffer::create(64, 12, TRACE_BUFFER_BLOCK, allocate, deallocate);
+  EXPECT_FALSE(static_cast<bool>(UnalignedRecord));
+  llvm::consumeError(UnalignedRecord.takeError());
+
+  auto FailedAllocation = TraceBuffer::create(
+      64, sizeof(TestRecord), TRACE_BUFFER_BLOCK,
+      [](uint64_t) -> void * { return nullptr; }, deallocate);
+  EXPECT_FALSE(static_cast<bool>(FailedAllocation));
+  llvm::consumeError(FailedAllocation.takeError());
+}
+
+TEST(TraceBufferTest, BlockPolicyDeliversEveryRecordWhileProducing) {
+  constexpr unsigned NumProducers = 8;
+  constexpr unsigned NumWavefronts = 512;
+  constexpr unsigned WavefrontSize = 64;
+  auto Buffer = createBuffer(256, TRACE_BUFFER_BLOCK);
+  ASSERT_NE(Buffer, nullptr);
+
+  std::vector<uint64_t> NextExpected(NumProducers, 0);
+  std::atomic<bool> OutOfOrder{false};
+  TraceBufferDrainThread Drainer(*Buffer, [&](llvm::ArrayRef<uint8_t> Bytes) {
+    TestRecord Record = toRecord(Bytes);
+    // Slots of a single producer are reserved in increasing order, hence
+    // its records must be consumed in order
+    if (Record.Sequence != NextExpected[Record.ProducerID])
+      OutOfOrder = true;
+    NextExpected[Record.ProducerID] = Record.Sequence + 1;
+  });
+
+  std::vector<std::thread> Producers;
+  for (unsigned P = 0; P < NumProducers; ++P) {
+    Producers.emplace_back([&, P] {
+      llvm::SmallVector<TestRecord, WavefrontSize> Wavefront(WavefrontSize);
+      for (unsigned W = 0; W < NumWavefronts; ++W) {
+        for (unsigned Lane = 0; Lane < WavefrontSize; ++Lane)
+          Wavefront[Lane] = makeRecord(P, W * WavefrontSize + Lane);
+        simulateWavefrontAppend(*Buffer->getDeviceHandle(), Wavefront);
+      }
+    });
+  }
+  for (auto &Producer : Producers)
+    Producer.join();
+  Drainer.stop();
+
+  EXPECT_FALSE(OutOfOrder);
+  for (unsigned P = 0; P < NumProducers; ++P)
+    EXPECT_EQ(NextExpected[P], NumWavefronts * WavefrontSize);
+  EXPECT_EQ(Buffer->getNumConsumed(),
+            NumProducers * NumWavefronts * WavefrontSize);
+  EXPECT_EQ(Buffer->getNumDropped(), 0);
+  EXPECT_EQ(Buffer->getNumLost(), 0);
+}
+
+TEST(TraceBufferTest, DropNewestPolicyKeepsOldestRecords) {
+  auto Buffer = createBuffer(16, TRACE_BUFFER_DROP_NEWEST);
+  ASSERT_NE(Buffer, nullptr);
+  for (uint64_t I = 0; I < 100; ++I)
+    simulateWavefrontAppend(*Buffer->getDeviceHandle(), {makeRecord(0, I)});
+
+  llvm::SmallVector<uint64_t> Received;
+  Buffer->drain([&](llvm::ArrayRef<uint8_t> Bytes) {
+    Received.push_back(toRecord(Bytes).Sequence);
+  });
+  ASSERT_EQ(Received.size(), 16);
+  for (uint64_t I = 0; I < 16; ++I)
+    EXPECT_EQ(Received[I], I);
+  EXPECT_EQ(Buffer->getNumDropped(), 84);
+
+  // Space freed by the drain must be reusable
+  simulateWavefrontAppend(*Buffer->getDeviceHandle(), {makeRecord(0, 100)});
+  EXPECT_EQ(Buffer->drain([&](llvm::ArrayRef<uint8_t> Bytes) {
+    EXPECT_EQ(toRecord(Bytes).Sequence, 100);
+  }),
+            1);
+}
+
+TEST(TraceBufferTest, OverwriteOldestPolicyKeepsNewestRecords) {
+  auto Buffer = createBuffer(16, TRACE_BUFFER_OVERWRITE_OLDEST);
+  ASSERT_NE(Buffer, nullptr);
+  for (uint64_t I = 0; I < 100; ++I)
+    simulateWavefrontAppend(*Buffer->getDeviceHandle(), {makeRecord(0, I)});
+
+  llvm::SmallVector<uint64_t> Received;
+  Buffer->drain([&](llvm::ArrayRef<uint8_t> Bytes) {
+    Received.push_back(toRecord(Bytes).Sequence);
+  });
+  ASSERT_EQ(Received.size(), 16);
+  for (uint64_t I = 0; I < 16; ++I)
+    EXPECT_EQ(Received[I], 84 + I);
+  EXPECT_EQ(Buffer->getNumLost(), 84);
+  EXPECT_EQ(Buffer->getNumDropped(), 0);
+}
+
+TEST(TraceBufferTest, DrainStopsAtUnpublishedRecord) {
+  auto Buffer = createBuffer(16, TRACE_BUFFER_BLOCK);
+  ASSERT_NE(Buffer, nullptr);
+  auto &Header = *Buffer->getDeviceHandle();
+  simulateWavefrontAppend(Header, {makeRecord(0, 0)});
+  // Reserve a slot without publishing it, as a lane still writing its record
+  std::atomic_ref(Header.WriteIndex).fetch_add(1);
+  EXPECT_EQ(Buffer->drain([](llvm::ArrayRef<uint8_t>) {}), 1);
+  EXPECT_EQ(Buffer->drain([](llvm::ArrayRef<uint8_t>) {}), 0);
+  EXPECT_EQ(std::atomic_ref(Header.ReadIndex).load(), 1);
+}
+
+TEST(TraceBufferTest, DrainRejectsRecordBeingOverwritten) {
+  auto Buffer = createBuffer(4, TRACE_BUFFER_OVERWRITE_OLDEST);
+  ASSERT_NE(Buffer, nullptr);
+  auto &Header = *Buffer->getDeviceHandle();
+  for (uint64_t I = 0; I < 4; ++I)
+    simulateWavefrontAppend(Header, {makeRecord(0, I)});
+  // A writer lapping the host claims the slot of the oldest record, and is
+  // preempted halfway through writing its own; Its reservation is not
+  // visible to the host yet, as if it happened after the host checked how
+  // far the device got
+  const uint64_t LappingSlot = 4;
+  ASSERT_TRUE(claimSlot(Header, LappingSlot));
+  TestRecord Lapping = makeRecord(1, LappingSlot);
+  std::memcpy(getSlotTag(Header, LappingSlot) + 1, &Lapping,
+              offsetof(TestRecord, Check));
+
+  llvm::SmallVector<uint64_t> Received;
+  Buffer->drain([&](llvm::ArrayRef<uint8_t> Bytes) {
+    TestRecord Record = toRecord(Bytes);
+    EXPECT_EQ(Record.Check, ~Record.Sequence);
+    Received.push_back(Record.Sequence);
+  });
+  EXPECT_EQ(Received, (llvm::SmallVector<uint64_t>{1, 2, 3}));
+  EXPECT_EQ(Buffer->getNumLost(), 1);
+
+  // Once published, the lapping record is consumed like any other
+  std::atomic_ref(Header.WriteIndex).store(LappingSlot + 1);
+  std::memcpy(getSlotTag(Header, LappingSlot) + 1, &Lapping,
+              sizeof(TestRecord));
+  publishSlot(Header, LappingSlot);
+  EXPECT_EQ(Buffer->drain([&](llvm::ArrayRef<uint8_t> Bytes) {
+    EXPECT_EQ(toRecord(Bytes).ProducerID, 1);
+  }),
+            1);
+}
+
+TEST(TraceBufferTest, OverwriteOldestPolicyNeverDeliversTornRecords) {
+  constexpr unsigned NumProducers = 8;
+  constexpr unsigned NumRecords = 1 << 13;
+  // Large records keep the host copying them long enough for producers to
+  // start overwriting them meanwhile
+  constexpr unsigned NumWords = 512;
+  auto Buffer = valueOrFail(
+      TraceBuffer::create(8, NumWords * sizeof(uint64_t),
+                          TRACE_BUFFER_OVERWRITE_OLDEST, allocate, deallocate));
+  ASSERT_NE(Buffer, nullptr);
+  auto &Header = *Buffer->getDeviceHandle();
+
+  bool Torn{false};
+  auto Consumer = [&](llvm::ArrayRef<uint8_t> Bytes) {
+    llvm::SmallVector<uint64_t, NumWords> Words(NumWords);
+    std::memcpy(Words.data(), Bytes.data(), Bytes.size());
+    if (llvm::any_of(Words, [&](uint64_t W) { return W != Words[0]; }))
+      Torn = true;
+  };
+
+  // Producers keep lapping the host, and fill every word of their record
+  // with its slot index; A record mixing the words of two writers would be
+  // delivered if the host accepted slots being overwritten
+  std::atomic<unsigned> NumRunning{NumProducers};
+  std::vector<std::thread> Producers;
+  for (unsigned P = 0; P < NumProducers; ++P) {
+    Producers.emplace_back([&] {
+      for (unsigned I = 0; I < NumRecords; ++I) {
+        uint64_t Slot = std::atomic_ref(Header.WriteIndex)
+                            .fetch_add(1, std::memory_order_relaxed);
+        if (!claimSlot(Header, Slot))
+          continue;
+        auto *Payload = getSlotTag(Header, Slot) + 1;
+        for (unsigned W = 0; W < NumWords; ++W)
+          std::atomic_ref(Payload[W]).store(Slot, std::memory_order_relaxed);
+        publishSlot(Header, Slot);
+      }
+      --NumRunning;
+    });
+  }
+  // Drain without pausing while the producers run
+  while (NumRunning != 0)
+    Buffer->drain(Consumer);
+  for (auto &Producer : Producers)
+    Producer.join();
+  Buffer->drain(Consumer);
+
+  EXPECT_FALSE(Torn);
+  EXPECT_GT(Buffer->getNumLost(), 0);
+  EXPECT_EQ(Buffer->getNumConsumed() + Buffer->getNumLost(),
+            NumProducers * NumRecords);
+}